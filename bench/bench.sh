@@ -20,18 +20,31 @@ EARLY_QUIT_DEFAULT=(chromium)
 STAT_DEFAULT=(rust)
 PRINT_DEFAULT=(linux)
 STRATEGIES_DEFAULT=(rust)
+SORT_DEFAULT=(linux)
 JOBS_DEFAULT=(rust)
 EXEC_DEFAULT=(linux)
+STARTUP_DEFAULT=(linux)
+COLD_DEFAULT=(linux)
+LATENCY_DEFAULT=(linux)
+REPLAY_DEFAULT=(linux)
 
 usage() {
     printf 'Usage: tailfin run %s\n' "${BASH_SOURCE[0]}"
     printf '           [--default] [--<BENCHMARK> [--<BENCHMARK>...]]\n'
-    printf '           [--build=...] [--bfs] [--find] [--fd]\n'
+    printf '           [--build=...] [--no-uring] [--bfs] [--find] [--fd]\n'
     printf '           [--no-clean] [--help]\n\n'
 
     printf '  --default\n'
     printf '      Run the default set of benchmarks\n\n'
 
+    printf '  CORPUS is a space- or comma-separated list of git repositories\n'
+    printf '  (%s) or synthetic tree shapes:\n\n' "${!URLS[*]}"
+
+    printf '      flat<N>       N files in a single directory (e.g. flat1m)\n'
+    printf '      hash<F>x<D>   Hashed object store with F-way fan-out, D levels deep\n'
+    printf '      deep<N>       A chain of N nested directories\n'
+    printf '      links<N>      N symlinks to N files\n\n'
+
     printf '  --complete[=CORPUS]\n'
     printf '      Complete traversal benchmark.\n'
     printf '      Default corpus is --complete="%s"\n\n' "${COMPLETE_DEFAULT[*]}"
@@ -52,18 +65,58 @@ usage() {
     printf '      Search strategy benchmark.\n'
     printf '      Default corpus is --strategies=%s\n\n' "${STRATEGIES_DEFAULT[*]}"
 
+    printf '  --sort[=CORPUS]\n'
+    printf '      Sorted traversal (-s) benchmark.\n'
+    printf '      Default corpus is --sort=%s\n\n' "${SORT_DEFAULT[*]}"
+
     printf '  --jobs[=CORPUS]\n'
-    printf '      Parallelism benchmark.\n'
+    printf '      Parallelism benchmark.  Sweeps -j up to the number of CPUs, and\n'
+    printf '      reports the speedup and parallel efficiency relative to -j1.\n'
     printf '      Default corpus is --jobs=%s\n\n' "${JOBS_DEFAULT[*]}"
 
     printf '  --exec[=CORPUS]\n'
     printf '      Process spawning benchmark.\n'
     printf '      Default corpus is --exec=%s\n\n' "${EXEC_DEFAULT[*]}"
 
+    printf '  --startup[=CORPUS]\n'
+    printf '      Startup latency benchmark.  Runs bfs many times without\n'
+    printf '      descending into the corpus.\n'
+    printf '      Default corpus is --startup=%s\n\n' "${STARTUP_DEFAULT[*]}"
+
+    printf '  --cold[=CORPUS]\n'
+    printf '      Cold cache benchmark (parallelism and search strategies).  Drops\n'
+    printf '      the page, dentry, and inode caches before every run, so it must\n'
+    printf '      be run as root.  Not included in --default.\n'
+    printf '      Default corpus is --cold=%s\n\n' "${COLD_DEFAULT[*]}"
+
+    printf '  --latency[=CORPUS]\n'
+    printf '      Network storage benchmark (parallelism and search strategies).\n'
+    printf '      Serves the corpus through bench/latencyfs.c, a FUSE filesystem\n'
+    printf '      that delays every request.  Needs libfuse3.  Not included in\n'
+    printf '      --default.\n'
+    printf '      Default corpus is --latency=%s\n\n' "${LATENCY_DEFAULT[*]}"
+
+    printf '  --latency-delay=USEC\n'
+    printf '      The latency to add to each request (default: 500)\n\n'
+
+    printf '  --latency-concurrency=N\n'
+    printf '      The maximum number of concurrent requests (default: 0, unlimited)\n\n'
+
+    printf '  --replay[=CORPUS]\n'
+    printf '      Replayed traversal benchmark.  Records the corpus once with\n'
+    printf '      -save-index, then searches the index (-index) instead of the file\n'
+    printf '      system, so the optimizer, evaluator, and output paths are timed\n'
+    printf '      without any dependence on the disk or the page cache.\n'
+    printf '      Default corpus is --replay=%s\n\n' "${REPLAY_DEFAULT[*]}"
+
     printf '  --build=COMMIT\n'
     printf '      Build this bfs commit and benchmark it.  Specify multiple times to\n'
     printf '      compare, e.g. --build=3.0.1 --build=3.0.2\n\n'
 
+    printf '  --no-uring\n'
+    printf '      Also build each --build commit without io_uring (as\n'
+    printf '      bfs-COMMIT-no-uring), to compare the ioq backends\n\n'
+
     printf '  --bfs[=COMMAND]\n'
     printf '      Benchmark an existing build of bfs\n\n'
 
@@ -108,6 +161,7 @@ setup() {
     # Options
 
     CLEAN=1
+    NO_URING=0
 
     BUILD=()
     BFS=()
@@ -119,8 +173,15 @@ setup() {
     STAT=()
     PRINT=()
     STRATEGIES=()
+    SORT=()
     JOBS=()
     EXEC=()
+    STARTUP=()
+    COLD=()
+    LATENCY=()
+    LATENCY_DELAY=500
+    LATENCY_CONCURRENCY=0
+    REPLAY=()
 
     for arg; do
         case "$arg" in
@@ -128,6 +189,9 @@ setup() {
             --no-clean)
                 CLEAN=0
                 ;;
+            --no-uring)
+                NO_URING=1
+                ;;
             # bfs commits/tags to benchmark
             --build=*)
                 BUILD+=("${arg#*=}")
@@ -157,43 +221,79 @@ setup() {
                 COMPLETE=("${COMPLETE_DEFAULT[@]}")
                 ;;
             --complete=*)
-                read -ra COMPLETE <<<"${arg#*=}"
+                IFS=", " read -ra COMPLETE <<<"${arg#*=}"
                 ;;
             --early-quit)
                 EARLY_QUIT=("${EARLY_QUIT_DEFAULT[@]}")
                 ;;
             --early-quit=*)
-                read -ra EARLY_QUIT <<<"${arg#*=}"
+                IFS=", " read -ra EARLY_QUIT <<<"${arg#*=}"
                 ;;
             --stat)
                 STAT=("${STAT_DEFAULT[@]}")
                 ;;
             --stat=*)
-                read -ra STAT <<<"${arg#*=}"
+                IFS=", " read -ra STAT <<<"${arg#*=}"
                 ;;
             --print)
                 PRINT=("${PRINT_DEFAULT[@]}")
                 ;;
             --print=*)
-                read -ra PRINT <<<"${arg#*=}"
+                IFS=", " read -ra PRINT <<<"${arg#*=}"
                 ;;
             --strategies)
                 STRATEGIES=("${STRATEGIES_DEFAULT[@]}")
                 ;;
             --strategies=*)
-                read -ra STRATEGIES <<<"${arg#*=}"
+                IFS=", " read -ra STRATEGIES <<<"${arg#*=}"
+                ;;
+            --sort)
+                SORT=("${SORT_DEFAULT[@]}")
+                ;;
+            --sort=*)
+                IFS=", " read -ra SORT <<<"${arg#*=}"
                 ;;
             --jobs)
                 JOBS=("${JOBS_DEFAULT[@]}")
                 ;;
             --jobs=*)
-                read -ra JOBS <<<"${arg#*=}"
+                IFS=", " read -ra JOBS <<<"${arg#*=}"
                 ;;
             --exec)
                 EXEC=("${EXEC_DEFAULT[@]}")
                 ;;
             --exec=*)
-                read -ra EXEC <<<"${arg#*=}"
+                IFS=", " read -ra EXEC <<<"${arg#*=}"
+                ;;
+            --startup)
+                STARTUP=("${STARTUP_DEFAULT[@]}")
+                ;;
+            --startup=*)
+                IFS=", " read -ra STARTUP <<<"${arg#*=}"
+                ;;
+            --cold)
+                COLD=("${COLD_DEFAULT[@]}")
+                ;;
+            --cold=*)
+                IFS=", " read -ra COLD <<<"${arg#*=}"
+                ;;
+            --latency)
+                LATENCY=("${LATENCY_DEFAULT[@]}")
+                ;;
+            --latency=*)
+                IFS=", " read -ra LATENCY <<<"${arg#*=}"
+                ;;
+            --latency-delay=*)
+                LATENCY_DELAY="${arg#*=}"
+                ;;
+            --latency-concurrency=*)
+                LATENCY_CONCURRENCY="${arg#*=}"
+                ;;
+            --replay)
+                REPLAY=("${REPLAY_DEFAULT[@]}")
+                ;;
+            --replay=*)
+                IFS=", " read -ra REPLAY <<<"${arg#*=}"
                 ;;
             --default)
                 COMPLETE=("${COMPLETE_DEFAULT[@]}")
@@ -201,8 +301,11 @@ setup() {
                 STAT=("${STAT_DEFAULT[@]}")
                 PRINT=("${PRINT_DEFAULT[@]}")
                 STRATEGIES=("${STRATEGIES_DEFAULT[@]}")
+                SORT=("${SORT_DEFAULT[@]}")
                 JOBS=("${JOBS_DEFAULT[@]}")
                 EXEC=("${EXEC_DEFAULT[@]}")
+                STARTUP=("${STARTUP_DEFAULT[@]}")
+                REPLAY=("${REPLAY_DEFAULT[@]}")
                 ;;
             --help)
                 usage
@@ -216,6 +319,11 @@ setup() {
         esac
     done
 
+    if ((${#COLD[@]})); then
+        DROP_CACHES=$(drop-caches-cmd)
+        export DROP_CACHES
+    fi
+
     if ((UID == 0)); then
         max-freq
     fi
@@ -224,10 +332,16 @@ setup() {
     as-user ./configure --enable-release
     as-user make -s -j"$nproc" all
 
+    if ((${#LATENCY[@]})); then
+        echo "Building latencyfs ..."
+        as-user make -s bin/bench/latencyfs
+        export LATENCY_DELAY LATENCY_CONCURRENCY
+    fi
+
     as-user mkdir -p bench/corpus
 
     declare -A cloned=()
-    for corpus in "${COMPLETE[@]}" "${EARLY_QUIT[@]}" "${STAT[@]}" "${PRINT[@]}" "${STRATEGIES[@]}" "${JOBS[@]}" "${EXEC[@]}"; do
+    for corpus in "${COMPLETE[@]}" "${EARLY_QUIT[@]}" "${STAT[@]}" "${PRINT[@]}" "${STRATEGIES[@]}" "${SORT[@]}" "${JOBS[@]}" "${EXEC[@]}" "${STARTUP[@]}" "${COLD[@]}" "${LATENCY[@]}" "${REPLAY[@]}"; do
         if ((cloned["$corpus"])); then
             continue
         fi
@@ -235,7 +349,11 @@ setup() {
 
         dir="bench/corpus/$corpus"
         if ((CLEAN)) || ! [ -e "$dir" ]; then
-            as-user ./bench/clone-tree.sh "${URLS[$corpus]}" "${TAGS[$corpus]}" "$dir"{,.git}
+            if [ "${URLS[$corpus]-}" ]; then
+                as-user ./bench/clone-tree.sh "${URLS[$corpus]}" "${TAGS[$corpus]}" "$dir"{,.git}
+            else
+                as-user ./bench/gen-tree.sh "$corpus" "$dir"
+            fi
         fi
     done
 
@@ -266,7 +384,19 @@ setup() {
                     as-user cp ./bfs "$bin/bfs-$commit"
                 fi
                 as-user make -s clean
+
+                if ((NO_URING)) && [ -e configure ]; then
+                    echo "Building bfs $commit without io_uring ..."
+                    as-user ./configure --enable-release --without-liburing
+                    as-user make -s -j"$nproc"
+                    as-user cp ./bin/bfs "$bin/bfs-$commit-no-uring"
+                    as-user make -s clean
+                fi
             )
+
+            if ((NO_URING)) && [ -e "$bin/bfs-$commit-no-uring" ]; then
+                BFS+=("bfs-$commit-no-uring")
+            fi
         done
 
         export PATH="$bin:$PATH"
@@ -281,8 +411,13 @@ setup() {
     export_array STAT
     export_array PRINT
     export_array STRATEGIES
+    export_array SORT
     export_array JOBS
     export_array EXEC
+    export_array STARTUP
+    export_array COLD
+    export_array LATENCY
+    export_array REPLAY
 
     if ((UID == 0)); then
         turbo-off
@@ -291,6 +426,74 @@ setup() {
     sync
 }
 
+# Get a command that drops the filesystem caches
+drop-caches-cmd() {
+    case "$(uname)" in
+        Linux)
+            if ((UID != 0)); then
+                printf 'error: --cold must be run as root\n' >&2
+                exit 1
+            fi
+            echo 'sync && echo 3 >/proc/sys/vm/drop_caches'
+            ;;
+        Darwin)
+            echo 'sync && purge'
+            ;;
+        *)
+            printf 'error: --cold is not supported on %s\n' "$(uname)" >&2
+            exit 1
+            ;;
+    esac
+}
+
+# GNU time, for measuring resource usage
+GNU_TIME="${GNU_TIME:-/usr/bin/time}"
+
+# Measures the peak memory, context switches, and system calls of each command,
+# saving the max RSS in RSS[command]
+do-resources() {
+    # Needs GNU time (BSD time has no -f)
+    if ! "$GNU_TIME" -q -f '' true &>/dev/null; then
+        return
+    fi
+
+    local md="$BENCH_DIR/bench.md"
+    local tmp="$BENCH_DIR/.resources"
+
+    local strace=0
+    if command -v strace &>/dev/null; then
+        strace=1
+    fi
+
+    printf '\n| Command | Max RSS [KiB] | Voluntary switches | Involuntary switches | System calls |\n' >>"$md"
+    printf '|:---|---:|---:|---:|---:|\n' >>"$md"
+
+    local cmd rss vcsw ivcsw syscalls
+    for cmd; do
+        if [ "${PREPARE-}" ]; then
+            bash -c "$PREPARE"
+        fi
+
+        "$GNU_TIME" -q -o "$tmp" -f '%M %w %c' bash -c "$cmd" &>/dev/null || :
+        read -r rss vcsw ivcsw <"$tmp"
+        RSS["$cmd"]="$rss"
+
+        syscalls="-"
+        if ((strace)); then
+            if [ "${PREPARE-}" ]; then
+                bash -c "$PREPARE"
+            fi
+
+            strace -fc -o "$tmp" bash -c "$cmd" &>/dev/null || :
+            syscalls=$(awk '$NF == "total" { print $4 }' "$tmp")
+        fi
+
+        printf '| `%s` | %s | %s | %s | %s |\n' "$cmd" "$rss" "$vcsw" "$ivcsw" "${syscalls:--}" >>"$md"
+    done
+
+    rm -f "$tmp"
+}
+
 # Runs hyperfine and saves the output
 do-hyperfine() {
     local tmp_md="$BENCH_DIR/.bench.md"
@@ -303,8 +506,35 @@ do-hyperfine() {
         return 1
     fi
 
-    hyperfine -w2 -M20 --export-markdown="$tmp_md" --export-json="$tmp_json" "$@" &>/dev/tty
+    # Warmup runs are pointless if the caches are dropped anyway
+    local args=(-w2 -M20)
+    if [ "${PREPARE-}" ]; then
+        args=(-w0 -M10 --prepare="$PREPARE")
+    elif [ "${RUNS-}" ]; then
+        # Short commands need many runs, and no shell in between
+        args=(-N -w20 -r"$RUNS")
+    fi
+
+    hyperfine "${args[@]}" --export-markdown="$tmp_md" --export-json="$tmp_json" "$@" &>/dev/tty
+    if [ "${RESULTS-}" ]; then
+        # Save the mean time for each command and -j value
+        jq -r '.results[] | (.command | capture("^(?<cmd>\\S+) -j(?<j>[0-9]+) ")) as $m | [$m.cmd, $m.j, .mean] | @tsv' \
+            <"$tmp_json" >>"$RESULTS"
+    fi
     cat "$tmp_md" >>"$md"
+
+    declare -A RSS=()
+    do-resources "$@"
+
+    # Save a line of JSON for each command
+    local cmd rss='{}'
+    for cmd in "${!RSS[@]}"; do
+        rss=$(jq -c --arg cmd "$cmd" --arg kib "${RSS[$cmd]}" '.[$cmd] = ($kib | tonumber? // null)' <<<"$rss")
+    done
+    jq -c --arg group "$GROUP" --arg corpus "$SUBGROUP" --arg case "$SUBSUBGROUP" --argjson rss "$rss" \
+        '.results[] | {group: $group, corpus: $corpus, case: $case, command, mean, stddev, min, max, rss: $rss[.command]}' \
+        <"$tmp_json" >>"$BENCH_DIR/results.jsonl"
+
     cat "$tmp_json" >>"$json"
     rm "$tmp_md" "$tmp_json"
 
@@ -313,17 +543,23 @@ do-hyperfine() {
 
 # Print the header for a benchmark group
 group() {
-    printf "## $1\\n\\n" "${@:2}" | tee -a "$BENCH_DIR/bench.md"
+    printf -v GROUP "$1" "${@:2}"
+    SUBGROUP=
+    SUBSUBGROUP=
+    printf '## %s\n\n' "$GROUP" | tee -a "$BENCH_DIR/bench.md"
 }
 
 # Print the header for a benchmark subgroup
 subgroup() {
-    printf "### $1\\n\\n" "${@:2}" | tee -a "$BENCH_DIR/bench.md"
+    printf -v SUBGROUP "$1" "${@:2}"
+    SUBSUBGROUP=
+    printf '### %s\n\n' "$SUBGROUP" | tee -a "$BENCH_DIR/bench.md"
 }
 
 # Print the header for a benchmark sub-subgroup
 subsubgroup() {
-    printf "#### $1\\n\\n" "${@:2}" | tee -a "$BENCH_DIR/bench.md"
+    printf -v SUBSUBGROUP "$1" "${@:2}"
+    printf '#### %s\n\n' "$SUBSUBGROUP" | tee -a "$BENCH_DIR/bench.md"
 }
 
 # Benchmark the complete traversal of a directory tree
@@ -355,7 +591,7 @@ bench-complete() {
         group "Complete traversal"
 
         for corpus; do
-            bench-complete-corpus "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-complete-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
     fi
 }
@@ -404,7 +640,7 @@ bench-early-quit() {
         group "Early termination"
 
         for corpus; do
-            bench-early-quit-corpus "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-early-quit-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
     fi
 }
@@ -437,7 +673,7 @@ bench-stat() {
         group "Traversal with stat()"
 
         for corpus; do
-            bench-stat-corpus "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-stat-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
     fi
 }
@@ -485,12 +721,12 @@ bench-print() {
 
         subgroup "Without colors"
         for corpus; do
-            bench-print-nocolor "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-print-nocolor "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
 
         subgroup "With colors"
         for corpus; do
-            bench-print-color "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-print-color "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
     fi
 }
@@ -521,32 +757,106 @@ bench-strategies() {
         group "Search strategies"
 
         for corpus; do
-            bench-strategies-corpus "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-strategies-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
     fi
 }
 
+# Benchmark sorted traversal
+bench-sort-corpus() {
+    total=$(./bin/bfs "$2" -printf '.' | wc -c)
+
+    subgroup "%s (%'d files)" "$1" "$total"
+
+    if ((${#BFS[@]} == 1)); then
+        cmds=("$BFS -s -S "{bfs,dfs}" $2 -false")
+        do-hyperfine "${cmds[@]}"
+    else
+        for S in bfs dfs; do
+            subsubgroup '`-s -S %s`' "$S"
+
+            cmds=()
+            for bfs in "${BFS[@]}"; do
+                cmds+=("$bfs -s -S $S $2 -false")
+            done
+            do-hyperfine "${cmds[@]}"
+        done
+    fi
+}
+
+# All sorted traversal benchmarks
+bench-sort() {
+    if (($#)); then
+        group "Sorted traversal"
+
+        for corpus; do
+            bench-sort-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
+        done
+    fi
+}
+
+# The -j values to benchmark, up to the number of CPUs
+jobs-counts() {
+    local max=$(nproc) j
+    for j in 1 2 3 4 6 8 12 16 24 32 48 64 96 128 192 256; do
+        if ((j < max)); then
+            printf '%d\n' $j
+        fi
+    done
+    printf '%d\n' $max
+}
+
+# Summarize the speedup and efficiency of each -j value
+jobs-summary() {
+    subsubgroup "Scaling"
+
+    printf '| Command | `-j` | Mean [s] | Speedup | Efficiency |\n' >>"$BENCH_DIR/bench.md"
+    printf '|:---|---:|---:|---:|---:|\n' >>"$BENCH_DIR/bench.md"
+
+    sort -t$'\t' -k1,1 -k2,2n "$2" \
+        | awk -F'\t' -v corpus="$1" -v md="$BENCH_DIR/bench.md" -v json="$BENCH_DIR/jobs.json" '
+            $2 == 1 { base[$1] = $3 }
+            {
+                speedup = ($1 in base) ? base[$1] / $3 : 0
+                efficiency = speedup / $2
+                printf "| `%s` | %d | %.3f | %.2f | %.0f%% |\n", $1, $2, $3, speedup, 100 * efficiency >>md
+                printf "{\"corpus\":\"%s\",\"command\":\"%s\",\"jobs\":%d,\"mean\":%g,\"speedup\":%g,\"efficiency\":%g}\n", corpus, $1, $2, $3, speedup, efficiency >>json
+            }'
+
+    printf '\n' >>"$BENCH_DIR/bench.md"
+}
+
 # Benchmark parallelism
 bench-jobs-corpus() {
     subgroup '%s' "$1"
 
+    local counts
+    readarray -t counts < <(jobs-counts)
+
+    local RESULTS="$BENCH_DIR/jobs.tsv"
+    : >"$RESULTS"
+
     if ((${#BFS[@]} + ${#FD[@]} == 1)); then
         cmds=()
         for bfs in "${BFS[@]}"; do
             if "$bfs" -j1 -quit &>/dev/null; then
-                cmds+=("$bfs -j"{1,2,3,4,6,8,12,16}" $2 -false")
+                for j in "${counts[@]}"; do
+                    cmds+=("$bfs -j$j $2 -false")
+                done
             else
                 cmds+=("$bfs $2 -false")
             fi
         done
 
         for fd in "${FD[@]}"; do
-            cmds+=("$fd -j"{1,2,3,4,6,8,12,16}" -u '^$' $2")
+            for j in "${counts[@]}"; do
+                cmds+=("$fd -j$j -u '^$' $2")
+            done
         done
 
         do-hyperfine "${cmds[@]}"
     else
-        for j in 1 2 3 4 6 8 12 16; do
+        for j in "${counts[@]}"; do
             subsubgroup '`-j%d`' $j
 
             cmds=()
@@ -567,6 +877,9 @@ bench-jobs-corpus() {
             fi
         done
     fi
+
+    jobs-summary "$1" "$RESULTS"
+    rm "$RESULTS"
 }
 
 # All parallelism benchmarks
@@ -575,7 +888,7 @@ bench-jobs() {
         group "Parallelism"
 
         for corpus; do
-            bench-jobs-corpus "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-jobs-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
     fi
 }
@@ -645,7 +958,219 @@ bench-exec() {
         group "Process spawning"
 
         for corpus; do
-            bench-exec-corpus "$corpus ${TAGS[$corpus]}" "bench/corpus/$corpus"
+            bench-exec-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
+        done
+    fi
+}
+
+# Benchmark startup latency
+bench-startup-corpus() {
+    subgroup '%s' "$1"
+
+    local RUNS=1000
+
+    # Nothing needs the colors, mount table, or user/group databases
+    subsubgroup '`-maxdepth 0`'
+
+    cmds=()
+    for bfs in "${BFS[@]}"; do
+        cmds+=("$bfs $2 -maxdepth 0")
+    done
+
+    for find in "${FIND[@]}"; do
+        cmds+=("$find $2 -maxdepth 0")
+    done
+
+    do-hyperfine "${cmds[@]}"
+
+    # -type may need the mount table on Linux
+    subsubgroup '`-maxdepth 0 -type d`'
+
+    cmds=()
+    for bfs in "${BFS[@]}"; do
+        cmds+=("$bfs $2 -maxdepth 0 -type d")
+    done
+
+    for find in "${FIND[@]}"; do
+        cmds+=("$find $2 -maxdepth 0 -type d")
+    done
+
+    do-hyperfine "${cmds[@]}"
+}
+
+# All startup latency benchmarks
+bench-startup() {
+    if (($#)); then
+        group "Startup"
+
+        for corpus; do
+            bench-startup-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
+        done
+    fi
+}
+
+# Benchmark parallelism and search strategies with cold caches
+bench-cold-corpus() {
+    subgroup '%s' "$1"
+
+    local PREPARE="$DROP_CACHES"
+
+    for j in 1 2 4 8 16; do
+        subsubgroup '`-j%d`' $j
+
+        cmds=()
+        for bfs in "${BFS[@]}"; do
+            if "$bfs" -j1 -quit &>/dev/null; then
+                cmds+=("$bfs -j$j $2 -false")
+            elif ((j == 1)); then
+                cmds+=("$bfs $2 -false")
+            fi
+        done
+
+        for find in "${FIND[@]}"; do
+            if ((j == 1)); then
+                cmds+=("$find $2 -false")
+            fi
+        done
+
+        for fd in "${FD[@]}"; do
+            cmds+=("$fd -j$j -u '^$' $2")
+        done
+
+        if ((${#cmds[@]})); then
+            do-hyperfine "${cmds[@]}"
+        fi
+    done
+
+    for S in bfs dfs ids eds; do
+        subsubgroup '`-S %s`' "$S"
+
+        cmds=()
+        for bfs in "${BFS[@]}"; do
+            cmds+=("$bfs -S $S $2 -false")
+        done
+        do-hyperfine "${cmds[@]}"
+    done
+}
+
+# All cold cache benchmarks
+bench-cold() {
+    if (($#)); then
+        group "Cold cache"
+
+        for corpus; do
+            bench-cold-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
+        done
+    fi
+}
+
+# Benchmark parallelism and search strategies on a high-latency filesystem
+bench-latency-corpus() {
+    subgroup '%s (%d µs latency)' "$1" "$LATENCY_DELAY"
+
+    local mnt="$BENCH_DIR/mnt"
+    mkdir -p "$mnt"
+    ./bin/bench/latencyfs "$2" "$mnt" -o ro \
+        -o delay="$LATENCY_DELAY" -o concurrency="$LATENCY_CONCURRENCY"
+
+    # Hiding the latency needs more threads than CPUs
+    for j in 1 2 4 8 16 32 64; do
+        subsubgroup '`-j%d`' $j
+
+        cmds=()
+        for bfs in "${BFS[@]}"; do
+            if "$bfs" -j1 -quit &>/dev/null; then
+                cmds+=("$bfs -j$j $mnt -false")
+            elif ((j == 1)); then
+                cmds+=("$bfs $mnt -false")
+            fi
+        done
+
+        for find in "${FIND[@]}"; do
+            if ((j == 1)); then
+                cmds+=("$find $mnt -false")
+            fi
+        done
+
+        for fd in "${FD[@]}"; do
+            cmds+=("$fd -j$j -u '^$' $mnt")
+        done
+
+        if ((${#cmds[@]})); then
+            do-hyperfine "${cmds[@]}"
+        fi
+    done
+
+    for S in bfs dfs ids eds; do
+        subsubgroup '`-S %s`' "$S"
+
+        cmds=()
+        for bfs in "${BFS[@]}"; do
+            cmds+=("$bfs -S $S $mnt -false")
+        done
+        do-hyperfine "${cmds[@]}"
+    done
+
+    fusermount3 -u "$mnt" 2>/dev/null || umount "$mnt"
+    rmdir "$mnt"
+}
+
+# All high-latency filesystem benchmarks
+bench-latency() {
+    if (($#)); then
+        group "High-latency filesystem"
+
+        for corpus; do
+            bench-latency-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
+        done
+    fi
+}
+
+# Benchmark searching a recorded index instead of the file system
+bench-replay-corpus() {
+    total=$(./bin/bfs "$2" -printf '.' | wc -c)
+
+    subgroup "%s (%'d files)" "$1" "$total"
+
+    # The index format is host- and version-specific, so each bfs records
+    # its own.  Builds without -index are skipped.
+    local bfs index
+    local -A indexes=()
+    for bfs in "${BFS[@]}"; do
+        index="$BENCH_DIR/${bfs##*/}.index"
+        if "$bfs" "$2" -save-index "$index" -false &>/dev/null; then
+            indexes["$bfs"]="$index"
+        fi
+    done
+
+    local args
+    for args in "-false" "-name '*.c'" "-size +4k" "-print" "-printf '%p %s %TY\\n'"; do
+        subsubgroup '`%s`' "$args"
+
+        cmds=()
+        for bfs in "${BFS[@]}"; do
+            if [ "${indexes[$bfs]-}" ]; then
+                cmds+=("$bfs -index ${indexes[$bfs]} $2 $args")
+            fi
+        done
+
+        if ((${#cmds[@]})); then
+            do-hyperfine "${cmds[@]}"
+        fi
+    done
+
+    for index in "${indexes[@]}"; do
+        rm -f "$index"
+    done
+}
+
+# All replayed traversal benchmarks
+bench-replay() {
+    if (($#)); then
+        group "Replayed traversal"
+
+        for corpus; do
+            bench-replay-corpus "$corpus ${TAGS[$corpus]-}" "bench/corpus/$corpus"
         done
     fi
 }
@@ -696,15 +1221,25 @@ bench() {
     import_array STAT
     import_array PRINT
     import_array STRATEGIES
+    import_array SORT
     import_array JOBS
     import_array EXEC
+    import_array STARTUP
+    import_array COLD
+    import_array LATENCY
+    import_array REPLAY
 
     bench-complete "${COMPLETE[@]}"
     bench-early-quit "${EARLY_QUIT[@]}"
     bench-stat "${STAT[@]}"
     bench-print "${PRINT[@]}"
     bench-strategies "${STRATEGIES[@]}"
+    bench-sort "${SORT[@]}"
     bench-jobs "${JOBS[@]}"
     bench-exec "${EXEC[@]}"
+    bench-startup "${STARTUP[@]}"
+    bench-cold "${COLD[@]}"
+    bench-latency "${LATENCY[@]}"
+    bench-replay "${REPLAY[@]}"
     bench-details
 }
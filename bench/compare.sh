@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+
+# Copyright © Tavian Barnes <tavianator@tavianator.com>
+# SPDX-License-Identifier: 0BSD
+
+# Compares two builds from a bench/bench.sh run, and fails if any benchmark got
+# significantly slower.  E.g.
+#
+#     $ tailfin run bench/bench.sh --build=3.0.1 --build=3.0.2 --default
+#     $ ./bench/compare.sh results/.../runs/1/results.jsonl 3.0.1 3.0.2
+#
+# compares bfs-3.0.2 to bfs-3.0.1.  A benchmark is a regression if its mean time
+# increased by more than SIGMA (default 3) combined standard deviations.
+
+set -eu
+
+SIGMA=3
+
+usage() {
+    printf 'Usage: %s [-n SIGMA] path/to/results.jsonl OLD NEW\n' "$0" >&2
+    exit 1
+}
+
+while getopts n: opt; do
+    case "$opt" in
+        n)
+            SIGMA="$OPTARG"
+            ;;
+        *)
+            usage
+            ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if (($# != 3)); then
+    usage
+fi
+
+RESULTS="$1"
+OLD="bfs-${2#bfs-}"
+NEW="bfs-${3#bfs-}"
+
+jq -rs --arg old "$OLD" --arg new "$NEW" --argjson sigma "$SIGMA" '
+    # Split the binary from the rest of the command
+    def key: [.group, .corpus, .case, (.command | sub("^\\S+"; ""))];
+    def bin: .command | capture("^(?<bin>\\S+)").bin;
+
+    (map(select(bin == $old)) | map({key: (key | tojson), value: .}) | from_entries) as $base
+    | map(select(bin == $new))
+    | map($base[key | tojson] as $b | select($b)
+        | {
+            name: ([.group, .corpus, .case] | map(select(. != "")) | join(" / ")),
+            command: (.command | sub("^\\S+ "; "")),
+            old: $b.mean,
+            new: .mean,
+            limit: ($sigma * ((($b.stddev // 0) | . * .) + ((.stddev // 0) | . * .) | sqrt)),
+        }
+        | .regression = (.new - .old > .limit))
+    | (map(
+        "\(if .regression then "REGRESSION" else "ok        " end)  \(.old * 1000 | round) ms -> \(.new * 1000 | round) ms  \(.name): \(.command)"
+      ) | .[]),
+      (if any(.[]; .regression) then "\(map(select(.regression)) | length) regression(s)\n" | halt_error(1) else empty end)
+' "$RESULTS"
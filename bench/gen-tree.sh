@@ -0,0 +1,151 @@
+#!/usr/bin/env bash
+
+# Copyright © Tavian Barnes <tavianator@tavianator.com>
+# SPDX-License-Identifier: 0BSD
+
+# Creates a synthetic directory tree of a named shape, with empty files.  E.g.
+#
+#     $ ./bench/gen-tree.sh flat1m ./flat1m
+#
+# will create a directory ./flat1m containing one million files.  The supported
+# shapes are
+#
+#     flat<N>       N files in a single directory
+#     hash<F>x<D>   A hashed object store: D - 1 levels of F-way directory
+#                   fan-out, with F files in each leaf (F^D files in total)
+#     deep<N>       A chain of N nested directories
+#     links<N>      N symlinks, each pointing to its own file
+#
+# Counts may use the suffixes k (thousand) and m (million).
+
+set -eu
+
+if (($# != 2)); then
+    printf 'Usage: %s <SHAPE> path/to/tree\n' "$0" >&2
+    exit 1
+fi
+
+SHAPE="$1"
+DIR="$2"
+
+BENCH=$(dirname -- "${BASH_SOURCE[0]}")
+BIN=$(realpath -- "$BENCH/../bin")
+BFS="$BIN/bfs"
+XTOUCH="$BIN/tests/xtouch"
+
+NPROC=$(nproc)
+JOBS=$((NPROC < 8 ? NPROC : 8))
+
+# Parse a count like 1m
+count() {
+    if ! [[ "$1" =~ ^[0-9]+[km]?$ ]]; then
+        printf 'error: Invalid count %q in shape %q\n' "$1" "$SHAPE" >&2
+        exit 1
+    fi
+
+    case "$1" in
+        *k)
+            echo $((${1%k} * 1000))
+            ;;
+        *m)
+            echo $((${1%m} * 1000000))
+            ;;
+        *)
+            echo $((10#$1))
+            ;;
+    esac
+}
+
+# Touch files in parallel
+xtouch() (
+    cd "$1"
+    tr '\n' '\0' \
+        | if ((JOBS > 1)); then
+            xargs -0r -n4096 -P$JOBS -- "$XTOUCH" -p --
+        else
+            xargs -0r -- "$XTOUCH" -p --
+        fi
+)
+
+# N files in one directory
+flat() {
+    seq -f 'file%.0f' "$1" | xtouch "$2"
+}
+
+# A hashed object store
+hash() {
+    local fanout="$1" depth="$2"
+
+    # The number of hex digits per level
+    local width=1
+    while (((1 << (4 * width)) < fanout)); do
+        ((++width))
+    done
+
+    awk -v F="$fanout" -v D="$depth" -v W="$width" 'BEGIN {
+        fmt = "%0" W "x"
+        total = F ^ D
+        for (i = 0; i < total; ++i) {
+            path = ""
+            x = i
+            for (l = 0; l < D; ++l) {
+                path = sprintf(fmt, x % F) (l ? "/" : "") path
+                x = int(x / F)
+            }
+            print path
+        }
+    }' | xtouch "$DIR"
+}
+
+# A chain of nested directories
+deep() (
+    local n="$1" chunk path
+
+    # Create the chain in chunks, to stay under PATH_MAX
+    cd "$DIR"
+    for ((i = 0; i < n; i += chunk)); do
+        chunk=$((n - i < 1000 ? n - i : 1000))
+        path=$(printf 'd/%.0s' $(seq "$chunk"))
+        "$XTOUCH" -p -- "${path}file"
+        cd -- "$path"
+    done
+)
+
+# A symlink farm
+links() {
+    mkdir -p -- "$DIR/files" "$DIR/links"
+    flat "$1" "$DIR/files"
+
+    seq -f '../files/file%.0f' "$1" \
+        | tr '\n' '\0' \
+        | (cd "$DIR/links" && xargs -0r sh -c 'ln -s "$@" .' sh)
+}
+
+case "$SHAPE" in
+    flat*)
+        GEN=(flat "$(count "${SHAPE#flat}")" "$DIR")
+        ;;
+    hash*x*)
+        ARGS="${SHAPE#hash}"
+        GEN=(hash "$(count "${ARGS%x*}")" "$(count "${ARGS#*x}")")
+        ;;
+    deep*)
+        GEN=(deep "$(count "${SHAPE#deep}")")
+        ;;
+    links*)
+        GEN=(links "$(count "${SHAPE#links}")")
+        ;;
+    *)
+        printf 'error: Unknown shape %q\n' "$SHAPE" >&2
+        exit 1
+        ;;
+esac
+
+if [ -e "$DIR" ]; then
+    printf 'Cleaning old directory tree %s ...\n' "$DIR" >&2
+    "$BFS" -f "$DIR" -delete
+fi
+
+printf 'Generating %s ...\n' "$DIR" >&2
+mkdir -p -- "$DIR"
+"${GEN[@]}"
@@ -0,0 +1,249 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * A read-only FUSE passthrough filesystem that adds latency to every request,
+ * to simulate network storage.  Usage:
+ *
+ *     $ latencyfs SOURCE MOUNTPOINT [-o delay=USEC] [-o concurrency=N]
+ *
+ * delay is the latency added to each request, in microseconds (default 500).
+ * concurrency limits how many requests can be in flight at once (default 0,
+ * meaning unlimited), like the slot table of an NFS client.
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <fuse.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Global filesystem state. */
+struct latencyfs {
+	/** The source directory. */
+	const char *source;
+	/** A file descriptor for the source directory. */
+	int fd;
+	/** The added latency, in microseconds. */
+	unsigned int delay;
+	/** The maximum number of concurrent requests (0 for unlimited). */
+	unsigned int concurrency;
+	/** Limits the number of concurrent requests. */
+	sem_t slots;
+};
+
+static struct latencyfs fs = {
+	.fd = -1,
+	.delay = 500,
+};
+
+/** Start a request. */
+static void fs_enter(void) {
+	if (fs.concurrency) {
+		while (sem_wait(&fs.slots) != 0 && errno == EINTR);
+	}
+
+	struct timespec ts = {
+		.tv_sec = fs.delay / 1000000,
+		.tv_nsec = (fs.delay % 1000000) * 1000L,
+	};
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+/** Finish a request. */
+static int fs_exit(int ret) {
+	if (fs.concurrency) {
+		sem_post(&fs.slots);
+	}
+	return ret;
+}
+
+/** Convert a FUSE path (always absolute) to a path relative to fs.fd. */
+static const char *fs_path(const char *path) {
+	while (*path == '/') {
+		++path;
+	}
+	return *path ? path : ".";
+}
+
+static void *fs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+	cfg->use_ino = 1;
+
+	// Don't let the kernel cache anything, so every run sees the latency
+	cfg->entry_timeout = 0;
+	cfg->negative_timeout = 0;
+	cfg->attr_timeout = 0;
+
+	return NULL;
+}
+
+static int fs_getattr(const char *path, struct stat *buf, struct fuse_file_info *fi) {
+	fs_enter();
+	int ret = fstatat(fs.fd, fs_path(path), buf, AT_SYMLINK_NOFOLLOW);
+	return fs_exit(ret == 0 ? 0 : -errno);
+}
+
+static int fs_readlink(const char *path, char *buf, size_t size) {
+	if (size == 0) {
+		return -EINVAL;
+	}
+
+	fs_enter();
+	ssize_t len = readlinkat(fs.fd, fs_path(path), buf, size - 1);
+	if (len < 0) {
+		return fs_exit(-errno);
+	}
+	buf[len] = '\0';
+	return fs_exit(0);
+}
+
+static int fs_open(const char *path, struct fuse_file_info *fi) {
+	if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		return -EROFS;
+	}
+
+	fs_enter();
+	int fd = openat(fs.fd, fs_path(path), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return fs_exit(-errno);
+	}
+	fi->fh = fd;
+	return fs_exit(0);
+}
+
+static int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+	fs_enter();
+	ssize_t ret = pread(fi->fh, buf, size, offset);
+	return fs_exit(ret >= 0 ? (int)ret : -errno);
+}
+
+static int fs_release(const char *path, struct fuse_file_info *fi) {
+	close(fi->fh);
+	return 0;
+}
+
+static int fs_statfs(const char *path, struct statvfs *buf) {
+	fs_enter();
+	int ret = fstatvfs(fs.fd, buf);
+	return fs_exit(ret == 0 ? 0 : -errno);
+}
+
+static int fs_opendir(const char *path, struct fuse_file_info *fi) {
+	fs_enter();
+
+	int fd = openat(fs.fd, fs_path(path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return fs_exit(-errno);
+	}
+
+	DIR *dir = fdopendir(fd);
+	if (!dir) {
+		int error = errno;
+		close(fd);
+		return fs_exit(-error);
+	}
+
+	fi->fh = (uintptr_t)dir;
+	return fs_exit(0);
+}
+
+static int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+	DIR *dir = (DIR *)(uintptr_t)fi->fh;
+
+	fs_enter();
+	rewinddir(dir);
+
+	while (true) {
+		errno = 0;
+		struct dirent *de = readdir(dir);
+		if (!de) {
+			return fs_exit(-errno);
+		}
+
+		// Pass through the inode number and type (d_type is the top bits
+		// of st_mode, like DTTOIF())
+		struct stat st = {
+			.st_ino = de->d_ino,
+			.st_mode = (mode_t)de->d_type << 12,
+		};
+		if (filler(buf, de->d_name, &st, 0, 0) != 0) {
+			return fs_exit(0);
+		}
+	}
+}
+
+static int fs_releasedir(const char *path, struct fuse_file_info *fi) {
+	closedir((DIR *)(uintptr_t)fi->fh);
+	return 0;
+}
+
+static const struct fuse_operations fs_ops = {
+	.init = fs_init,
+	.getattr = fs_getattr,
+	.readlink = fs_readlink,
+	.open = fs_open,
+	.read = fs_read,
+	.release = fs_release,
+	.statfs = fs_statfs,
+	.opendir = fs_opendir,
+	.readdir = fs_readdir,
+	.releasedir = fs_releasedir,
+};
+
+/** Command line options. */
+static const struct fuse_opt fs_opts[] = {
+	{"delay=%u", offsetof(struct latencyfs, delay), 0},
+	{"concurrency=%u", offsetof(struct latencyfs, concurrency), 0},
+	FUSE_OPT_END,
+};
+
+/** Handle the SOURCE argument. */
+static int fs_opt(void *data, const char *arg, int key, struct fuse_args *args) {
+	struct latencyfs *self = data;
+
+	if (key == FUSE_OPT_KEY_NONOPT && !self->source) {
+		self->source = arg;
+		return 0;
+	}
+
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	if (fuse_opt_parse(&args, &fs, fs_opts, fs_opt) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (!fs.source) {
+		fprintf(stderr, "Usage: %s SOURCE MOUNTPOINT [-o delay=USEC] [-o concurrency=N]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fs.fd = open(fs.source, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fs.fd < 0) {
+		perror(fs.source);
+		return EXIT_FAILURE;
+	}
+
+	if (fs.concurrency && sem_init(&fs.slots, 0, fs.concurrency) != 0) {
+		perror("sem_init()");
+		return EXIT_FAILURE;
+	}
+
+	int ret = fuse_main(args.argc, args.argv, &fs_ops, NULL);
+	fuse_opt_free_args(&args);
+	return ret;
+}
@@ -0,0 +1,92 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "bench.h"
+
+#include "alloc.h"
+#include "diag.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The number of live objects to churn through. */
+#define NLIVE 4096
+
+/** A fixed-size object. */
+struct fixed {
+	/** Some padding to make it a realistic size. */
+	char data[64];
+};
+
+/** A flexible object. */
+struct flexible {
+	/** The length of the flexible array. */
+	size_t count;
+	/** The flexible array. */
+	char data[];
+};
+
+/** Benchmark arena_alloc()/arena_free() in a random order. */
+static void bench_arena_churn(struct bench *bench, void *arg) {
+	bench_stop(bench);
+
+	struct arena arena;
+	ARENA_INIT(&arena, struct fixed);
+
+	struct fixed *live[NLIVE];
+	for (size_t i = 0; i < NLIVE; ++i) {
+		live[i] = arena_alloc(&arena);
+		bfs_everify(live[i], "arena_alloc()");
+	}
+
+	uint64_t state = 1;
+	bench_start(bench);
+
+	for (size_t i = 0; i < bench->n; ++i) {
+		size_t j = bench_random(&state) % NLIVE;
+		arena_free(&arena, live[j]);
+		live[j] = arena_alloc(&arena);
+		bfs_verify(live[j]);
+	}
+
+	bench_stop(bench);
+	arena_destroy(&arena);
+}
+
+/** Benchmark varena_alloc()/varena_free() with random sizes and order. */
+static void bench_varena_churn(struct bench *bench, void *arg) {
+	bench_stop(bench);
+
+	struct varena varena;
+	VARENA_INIT(&varena, struct flexible, data);
+
+	uint64_t state = 1;
+	struct flexible *live[NLIVE];
+	for (size_t i = 0; i < NLIVE; ++i) {
+		size_t count = bench_random(&state) % 256;
+		live[i] = varena_alloc(&varena, count);
+		bfs_everify(live[i], "varena_alloc()");
+		live[i]->count = count;
+	}
+
+	bench_start(bench);
+
+	for (size_t i = 0; i < bench->n; ++i) {
+		uint64_t x = bench_random(&state);
+		size_t j = x % NLIVE;
+		size_t count = (x >> 32) % 256;
+
+		varena_free(&varena, live[j], live[j]->count);
+		live[j] = varena_alloc(&varena, count);
+		bfs_verify(live[j]);
+		live[j]->count = count;
+	}
+
+	bench_stop(bench);
+	varena_destroy(&varena);
+}
+
+void bench_alloc(void) {
+	bench_run("alloc/arena/churn", bench_arena_churn, NULL);
+	bench_run("alloc/varena/churn", bench_varena_churn, NULL);
+}
@@ -0,0 +1,77 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Micro-benchmarks.
+ */
+
+#ifndef BFS_BENCH_H
+#define BFS_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The state of a running benchmark.
+ */
+struct bench {
+	/** The number of operations to perform. */
+	size_t n;
+	/** When the timer was last started, or 0 if it is stopped. */
+	uint64_t start;
+	/** The total time measured so far, in nanoseconds. */
+	uint64_t elapsed;
+};
+
+/**
+ * Start (or resume) the timer.  The timer is already running when a benchmark
+ * function is called.
+ */
+void bench_start(struct bench *bench);
+
+/**
+ * Stop the timer, e.g. to exclude setup or teardown work.
+ */
+void bench_stop(struct bench *bench);
+
+/**
+ * A benchmark function, which should perform bench->n operations.
+ */
+typedef void bench_fn(struct bench *bench, void *arg);
+
+/**
+ * Run a benchmark (if it matches the command line) and print the result.
+ *
+ * @param name
+ *         The name of the benchmark, like "group/case".
+ * @param fn
+ *         The benchmark function.
+ * @param arg
+ *         An argument to pass to fn.
+ */
+void bench_run(const char *name, bench_fn *fn, void *arg);
+
+/**
+ * Generate a pseudo-random number (xorshift64*).
+ *
+ * @param state
+ *         The generator state, which must be non-zero.
+ */
+uint64_t bench_random(uint64_t *state);
+
+/** Allocator benchmarks. */
+void bench_alloc(void);
+
+/** Directory reading benchmarks. */
+void bench_dir(void);
+
+/** Dynamic string benchmarks. */
+void bench_dstring(void);
+
+/** I/O queue benchmarks. */
+void bench_ioq(void);
+
+/** Trie benchmarks. */
+void bench_trie(void);
+
+#endif // BFS_BENCH_H
@@ -0,0 +1,72 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "bench.h"
+
+#include "bfstd.h"
+#include "diag.h"
+#include "dir.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** The number of files in the directory. */
+#define NFILES 4096
+
+/** Benchmark bfs_readdir(), including opening and closing the directory. */
+static void bench_readdir(struct bench *bench, void *arg) {
+	const int *dfd = arg;
+
+	struct bfs_dir *dir = bfs_allocdir();
+	bfs_everify(dir, "bfs_allocdir()");
+
+	size_t count = 0;
+	while (count < bench->n) {
+		bfs_everify(bfs_opendir(dir, *dfd, ".", 0) == 0, "bfs_opendir()");
+
+		struct bfs_dirent de;
+		int ret;
+		while ((ret = bfs_readdir(dir, &de)) > 0) {
+			++count;
+		}
+		bfs_everify(ret == 0, "bfs_readdir()");
+
+		bfs_everify(bfs_closedir(dir) == 0, "bfs_closedir()");
+	}
+
+	free(dir);
+}
+
+void bench_dir(void) {
+	const char *tmpdir = getenv("TMPDIR");
+	if (!tmpdir) {
+		tmpdir = "/tmp";
+	}
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/bfs-bench.XXXXXX", tmpdir);
+	bfs_everify(mkdtemp(path), "mkdtemp('%s')", path);
+
+	int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	bfs_everify(dfd >= 0, "open('%s')", path);
+
+	char name[32];
+	for (size_t i = 0; i < NFILES; ++i) {
+		snprintf(name, sizeof(name), "file%zu", i);
+		int fd = openat(dfd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		bfs_everify(fd >= 0, "openat('%s')", name);
+		xclose(fd);
+	}
+
+	bench_run("dir/readdir", bench_readdir, &dfd);
+
+	for (size_t i = 0; i < NFILES; ++i) {
+		snprintf(name, sizeof(name), "file%zu", i);
+		unlinkat(dfd, name, 0);
+	}
+	xclose(dfd);
+	rmdir(path);
+}
@@ -0,0 +1,57 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "bench.h"
+
+#include "diag.h"
+#include "dstring.h"
+
+#include <stddef.h>
+
+/** The number of appends before starting over with a fresh string. */
+#define NAPPENDS 65536
+
+/** Benchmark growing a string with dstrapp(). */
+static void bench_dstrapp(struct bench *bench, void *arg) {
+	dchar *str = NULL;
+
+	for (size_t i = 0; i < bench->n; ++i) {
+		if (i % NAPPENDS == 0) {
+			bench_stop(bench);
+			dstrfree(str);
+			str = dstralloc(0);
+			bfs_everify(str, "dstralloc()");
+			bench_start(bench);
+		}
+		bfs_verify(dstrapp(&str, 'x') == 0);
+	}
+
+	bench_stop(bench);
+	dstrfree(str);
+}
+
+/** Benchmark growing a string with dstrcat(). */
+static void bench_dstrcat(struct bench *bench, void *arg) {
+	const char *src = arg;
+	dchar *str = NULL;
+
+	for (size_t i = 0; i < bench->n; ++i) {
+		if (i % NAPPENDS == 0) {
+			bench_stop(bench);
+			dstrfree(str);
+			str = dstralloc(0);
+			bfs_everify(str, "dstralloc()");
+			bench_start(bench);
+		}
+		bfs_verify(dstrcat(&str, src) == 0);
+	}
+
+	bench_stop(bench);
+	dstrfree(str);
+}
+
+void bench_dstring(void) {
+	bench_run("dstring/dstrapp", bench_dstrapp, NULL);
+	bench_run("dstring/dstrcat/8", bench_dstrcat, "01234567");
+	bench_run("dstring/dstrcat/64", bench_dstrcat, "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef");
+}
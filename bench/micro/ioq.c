@@ -0,0 +1,71 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "bench.h"
+
+#include "alloc.h"
+#include "bfstd.h"
+#include "diag.h"
+#include "fsade.h"
+#include "ioq.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/** The queue depth. */
+#define DEPTH 1024
+
+/** Benchmark round trips of no-op requests through the queue. */
+static void bench_ioq_probe(struct bench *bench, void *arg) {
+	size_t nthreads = *(const size_t *)arg;
+
+	bench_stop(bench);
+
+	struct ioq *ioq = ioq_create(DEPTH, nthreads, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	// Each request needs its own output buffer
+	struct bfs_fsade_probe *probes = ALLOC_ARRAY(struct bfs_fsade_probe, DEPTH);
+	bfs_everify(probes, "malloc()");
+	struct bfs_fsade_probe **free_probes = ALLOC_ARRAY(struct bfs_fsade_probe *, DEPTH);
+	bfs_everify(free_probes, "malloc()");
+	size_t nfree = 0;
+	for (size_t i = 0; i < DEPTH; ++i) {
+		free_probes[nfree++] = &probes[i];
+	}
+
+	bench_start(bench);
+
+	size_t submitted = 0, completed = 0;
+	while (completed < bench->n) {
+		while (submitted < bench->n && nfree > 0 && ioq_capacity(ioq) > 0) {
+			struct bfs_fsade_probe *probe = free_probes[--nfree];
+			int ret = ioq_probe(ioq, AT_FDCWD, "/", BFS_DIR, 0, 0, probe, probe);
+			bfs_everify(ret == 0, "ioq_probe()");
+			++submitted;
+		}
+
+		struct ioq_ent *batch[IOQ_BATCH];
+		size_t size = ioq_pop_batch(ioq, batch, countof(batch), true);
+		for (size_t i = 0; i < size; ++i) {
+			free_probes[nfree++] = batch[i]->ptr;
+		}
+		ioq_free_batch(ioq, batch, size);
+		completed += size;
+	}
+
+	bench_stop(bench);
+
+	ioq_destroy(ioq);
+	free(free_probes);
+	free(probes);
+}
+
+void bench_ioq(void) {
+	static size_t threads[] = {1, 2, 4};
+
+	bench_run("ioq/probe/threads=1", bench_ioq_probe, &threads[0]);
+	bench_run("ioq/probe/threads=2", bench_ioq_probe, &threads[1]);
+	bench_run("ioq/probe/threads=4", bench_ioq_probe, &threads[2]);
+}
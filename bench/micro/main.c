@@ -0,0 +1,131 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Entry point for micro-benchmarks.
+ *
+ * Each benchmark prints one line of JSON to standard output:
+ *
+ *     {"name":"trie/insert/random","n":1048576,"ns_per_op":123.456}
+ *
+ * The command line arguments, if any, are name prefixes that select which
+ * benchmarks to run.
+ */
+
+#include "bench.h"
+
+#include "perf.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The minimum time to run each sample for, in nanoseconds. */
+#define BENCH_SAMPLE_NS 100000000
+
+/** The number of samples to take (the fastest one is reported). */
+#define BENCH_SAMPLES 5
+
+/** Number of command line arguments. */
+static int bench_argc;
+/** The arguments themselves. */
+static char **bench_argv;
+
+void bench_start(struct bench *bench) {
+	bench->start = bfs_perf_now();
+}
+
+void bench_stop(struct bench *bench) {
+	if (bench->start) {
+		bench->elapsed += bfs_perf_now() - bench->start;
+		bench->start = 0;
+	}
+}
+
+uint64_t bench_random(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/** Check if a benchmark is enabled for this run. */
+static bool should_run(const char *name) {
+	// Run all benchmarks by default
+	if (bench_argc < 2) {
+		return true;
+	}
+
+	for (int i = 1; i < bench_argc; ++i) {
+		const char *prefix = bench_argv[i];
+		if (strncmp(name, prefix, strlen(prefix)) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Run a benchmark once with a fixed number of operations. */
+static uint64_t bench_once(bench_fn *fn, void *arg, size_t n) {
+	struct bench bench = {
+		.n = n,
+		.elapsed = 0,
+	};
+
+	bench_start(&bench);
+	fn(&bench, arg);
+	bench_stop(&bench);
+
+	// Avoid dividing by zero for extremely fast benchmarks
+	return bench.elapsed ? bench.elapsed : 1;
+}
+
+void bench_run(const char *name, bench_fn *fn, void *arg) {
+	if (!should_run(name)) {
+		return;
+	}
+
+	// Find an n that takes long enough to measure reliably
+	size_t n = 1;
+	uint64_t elapsed;
+	while ((elapsed = bench_once(fn, arg, n)) < BENCH_SAMPLE_NS / 4 && n < SIZE_MAX / 2) {
+		n *= 2;
+	}
+	if (elapsed < BENCH_SAMPLE_NS) {
+		double scale = (double)BENCH_SAMPLE_NS / elapsed;
+		n *= scale;
+	}
+
+	uint64_t best = UINT64_MAX;
+	for (int i = 0; i < BENCH_SAMPLES; ++i) {
+		elapsed = bench_once(fn, arg, n);
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	printf("{\"name\":\"%s\",\"n\":%zu,\"ns_per_op\":%.3f}\n", name, n, (double)best / n);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	bench_argc = argc;
+	bench_argv = argv;
+
+	bench_alloc();
+	bench_dir();
+	bench_dstring();
+	bench_ioq();
+	bench_trie();
+
+	if (ferror(stdout) || fclose(stdout) != 0) {
+		perror("stdout");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "bench.h"
+
+#include "alloc.h"
+#include "diag.h"
+#include "trie.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** The number of distinct keys. */
+#define NKEYS 65536
+
+/** The longest key. */
+#define KEY_MAX 64
+
+/** A benchmark key. */
+struct trie_key {
+	/** The key string. */
+	char str[KEY_MAX];
+};
+
+/** A set of benchmark keys. */
+struct trie_keys {
+	/** The keys themselves. */
+	struct trie_key *keys;
+	/** A trie containing all the keys, for lookups. */
+	struct trie trie;
+};
+
+/** Generate random keys. */
+static void random_keys(struct trie_key *keys) {
+	uint64_t state = 1;
+	for (size_t i = 0; i < NKEYS; ++i) {
+		uint64_t x = bench_random(&state);
+		snprintf(keys[i].str, KEY_MAX, "%08x%08x", (unsigned int)(x >> 32), (unsigned int)x);
+	}
+}
+
+/** Generate sequential keys. */
+static void sequential_keys(struct trie_key *keys) {
+	for (size_t i = 0; i < NKEYS; ++i) {
+		snprintf(keys[i].str, KEY_MAX, "%08zu", i);
+	}
+}
+
+/** Generate keys that look like paths in a source tree. */
+static void path_keys(struct trie_key *keys) {
+	uint64_t state = 1;
+	for (size_t i = 0; i < NKEYS; ++i) {
+		uint64_t x = bench_random(&state);
+		snprintf(keys[i].str, KEY_MAX, "./src/module%u/sub%u/file%zu.c",
+			(unsigned int)(x % 16), (unsigned int)((x >> 8) % 64), i);
+	}
+}
+
+/** Initialize a key set. */
+static void trie_keys_init(struct trie_keys *keys, void (*generate)(struct trie_key *)) {
+	keys->keys = ALLOC_ARRAY(struct trie_key, NKEYS);
+	bfs_everify(keys->keys, "malloc()");
+	generate(keys->keys);
+
+	trie_init(&keys->trie);
+	for (size_t i = 0; i < NKEYS; ++i) {
+		bfs_everify(trie_insert_str(&keys->trie, keys->keys[i].str), "trie_insert_str()");
+	}
+}
+
+/** Destroy a key set. */
+static void trie_keys_destroy(struct trie_keys *keys) {
+	trie_destroy(&keys->trie);
+	free(keys->keys);
+}
+
+/** Benchmark trie_insert_str(). */
+static void bench_trie_insert(struct bench *bench, void *arg) {
+	struct trie_keys *keys = arg;
+
+	struct trie trie;
+	trie_init(&trie);
+
+	for (size_t i = 0; i < bench->n; ++i) {
+		size_t j = i % NKEYS;
+		if (i > 0 && j == 0) {
+			bench_stop(bench);
+			trie_clear(&trie);
+			bench_start(bench);
+		}
+		bfs_verify(trie_insert_str(&trie, keys->keys[j].str));
+	}
+
+	bench_stop(bench);
+	trie_destroy(&trie);
+}
+
+/** Benchmark trie_find_str(). */
+static void bench_trie_find(struct bench *bench, void *arg) {
+	struct trie_keys *keys = arg;
+
+	for (size_t i = 0; i < bench->n; ++i) {
+		bfs_verify(trie_find_str(&keys->trie, keys->keys[i % NKEYS].str));
+	}
+}
+
+/** Run the benchmarks for one kind of key. */
+static void bench_trie_keys(const char *insert, const char *find, void (*generate)(struct trie_key *)) {
+	struct trie_keys keys;
+	trie_keys_init(&keys, generate);
+
+	bench_run(insert, bench_trie_insert, &keys);
+	bench_run(find, bench_trie_find, &keys);
+
+	trie_keys_destroy(&keys);
+}
+
+void bench_trie(void) {
+	bench_trie_keys("trie/insert/random", "trie/find/random", random_keys);
+	bench_trie_keys("trie/insert/sequential", "trie/find/sequential", sequential_keys);
+	bench_trie_keys("trie/insert/path", "trie/find/path", path_keys);
+}
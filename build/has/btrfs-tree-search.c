@@ -0,0 +1,13 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
+#include <sys/ioctl.h>
+
+int main(void) {
+	struct btrfs_ioctl_search_args_v2 args = {0};
+	args.key.min_type = BTRFS_INODE_ITEM_KEY;
+	args.key.max_type = BTRFS_INODE_ITEM_KEY;
+	return ioctl(3, BTRFS_IOC_TREE_SEARCH_V2, &args);
+}
@@ -0,0 +1,9 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <stdio.h>
+
+int main(void) {
+	cookie_io_functions_t funcs = {0};
+	return !fopencookie(NULL, "w", funcs);
+}
@@ -0,0 +1,8 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <sys/inotify.h>
+
+int main(void) {
+	return inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+}
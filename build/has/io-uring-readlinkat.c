@@ -0,0 +1,11 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <liburing.h>
+
+int main(void) {
+	struct io_uring_sqe sqe;
+	char buf[1024];
+	io_uring_prep_rw(IORING_OP_READLINKAT, &sqe, 0, ".", sizeof(buf), (unsigned long)buf);
+	return 0;
+}
@@ -0,0 +1,21 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <linux/mount.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int main(void) {
+	struct mnt_id_req req = {
+		.size = MNT_ID_REQ_SIZE_VER0,
+		.mnt_id = LSMT_ROOT,
+	};
+	uint64_t ids[1];
+	syscall(SYS_listmount, &req, ids, 1, 0);
+
+	struct statmount sm;
+	req.param = STATMOUNT_SB_BASIC | STATMOUNT_MNT_POINT | STATMOUNT_FS_TYPE;
+	syscall(SYS_statmount, &req, &sm, sizeof(sm), 0);
+	return sm.sb_dev_major + sm.mnt_point + sm.fs_type;
+}
@@ -0,0 +1,17 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <fcntl.h>
+
+int main(void) {
+	struct {
+		struct file_handle fh;
+		unsigned char buf[MAX_HANDLE_SZ];
+	} storage;
+	storage.fh.handle_bytes = MAX_HANDLE_SZ;
+	int mount_id;
+	if (name_to_handle_at(AT_FDCWD, ".", &storage.fh, &mount_id, 0) != 0) {
+		return 1;
+	}
+	return open_by_handle_at(AT_FDCWD, &storage.fh, O_RDONLY | O_DIRECTORY);
+}
@@ -0,0 +1,15 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int main(void) {
+	struct open_how how = {
+		.flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY,
+		.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_XDEV,
+	};
+	return syscall(SYS_openat2, AT_FDCWD, ".", &how, sizeof(how));
+}
@@ -0,0 +1,14 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <pthread.h>
+#include <sched.h>
+
+int main(void) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		return 1;
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
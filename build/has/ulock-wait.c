@@ -0,0 +1,14 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <stdint.h>
+
+// These are private Darwin APIs, so there is no header to include
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+
+int main(void) {
+	uint32_t word = 0;
+	__ulock_wait(1, &word, 1, 0);
+	return __ulock_wake(1, &word, 0);
+}
@@ -0,0 +1,11 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <sys/types.h>
+#include <sys/umtx.h>
+
+int main(void) {
+	u_int word = 0;
+	_umtx_op(&word, UMTX_OP_WAIT_UINT_PRIVATE, 1, NULL, NULL);
+	return _umtx_op(&word, UMTX_OP_WAKE_PRIVATE, 1, NULL, NULL);
+}
@@ -0,0 +1,10 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <sys/ioctl.h>
+#include <xfs/xfs.h>
+
+int main(void) {
+	struct xfs_bulkstat_req *req = 0;
+	return ioctl(3, XFS_IOC_BULKSTAT, req) + req->bulkstat[0].bs_mode;
+}
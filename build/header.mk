@@ -19,6 +19,7 @@ HEADERS := \
     gen/has/acl-is-trivial-np.h \
     gen/has/acl-trivial.h \
     gen/has/aligned-alloc.h \
+    gen/has/btrfs-tree-search.h \
     gen/has/builtin-riscv-pause.h \
     gen/has/confstr.h \
     gen/has/extattr-get-file.h \
@@ -26,6 +27,9 @@ HEADERS := \
     gen/has/extattr-list-file.h \
     gen/has/extattr-list-link.h \
     gen/has/fdclosedir.h \
+    gen/has/fopencookie.h \
+    gen/has/futex-syscall.h \
+    gen/has/getattrlistbulk.h \
     gen/has/getdents.h \
     gen/has/getdents64-syscall.h \
     gen/has/getdents64.h \
@@ -34,10 +38,19 @@ HEADERS := \
     gen/has/getmntinfo.h \
     gen/has/getprogname-gnu.h \
     gen/has/getprogname.h \
+    gen/has/inotify.h \
+    gen/has/io-uring-getdents.h \
+    gen/has/io-uring-readlinkat.h \
+    gen/has/io-uring-register-ring-fd.h \
+    gen/has/ioprio-set-syscall.h \
+    gen/has/listmount-syscall.h \
+    gen/has/name-to-handle-at.h \
+    gen/has/openat2-syscall.h \
     gen/has/pipe2.h \
     gen/has/posix-getdents.h \
     gen/has/posix-spawn-addfchdir-np.h \
     gen/has/posix-spawn-addfchdir.h \
+    gen/has/pthread-setaffinity-np.h \
     gen/has/st-acmtim.h \
     gen/has/st-acmtimespec.h \
     gen/has/st-birthtim.h \
@@ -53,7 +66,10 @@ HEADERS := \
     gen/has/tcgetwinsize.h \
     gen/has/timegm.h \
     gen/has/tm-gmtoff.h \
-    gen/has/uselocale.h
+    gen/has/ulock-wait.h \
+    gen/has/umtx-op.h \
+    gen/has/uselocale.h \
+    gen/has/xfs-bulkstat.h
 
 # Previously generated by pkgs.mk
 PKG_HEADERS := ${ALL_PKGS:%=gen/with/%.h}
@@ -80,6 +80,9 @@ for LIB; do
         oniguruma)
             LDLIB=-lonig
             ;;
+        zlib)
+            LDLIB=-lz
+            ;;
         *)
             printf 'error: Unknown package %s\n' "$LIB" >&2
             exit 1
@@ -21,6 +21,7 @@ PREFIX ?= /usr
 MANDIR ?= ${PREFIX}/share/man
 
 # Configurable executables
+AR ?= ar
 CC ?= cc
 INSTALL ?= install
 MKDIR ?= mkdir -p
@@ -67,7 +68,8 @@ ALL_PKGS := \
     libcap \
     libselinux \
     liburing \
-    oniguruma
+    oniguruma \
+    zlib
 
 # List all object files here, as they're needed by both `./configure` and `make`
 
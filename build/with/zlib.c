@@ -0,0 +1,10 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include <zlib.h>
+
+int main(void) {
+	z_stream strm = {0};
+	deflateEnd(&strm);
+	return 0;
+}
@@ -12,6 +12,13 @@ _bfs() {
     local special=(
         -D
         -S
+        -compress
+        -coproc
+        -coproc-test
+        -coproc-test0
+        -coproc0
+        -count-by
+        -errors
         -exec
         -execdir
         -fprintf
@@ -32,9 +39,22 @@ _bfs() {
     # (e.g. because they are numeric, glob, regexp, time, etc.)
     local nocomp=(
         -{a,B,c,m}{min,since,time}
+        -bottom
+        -checkpoint-interval
+        -chmod
+        -chown
         -context
+        -dir-memory
+        -exec-jobs
+        -grep
+        -grep-regex
+        -hash
         -ilname
         -iname
+        -index-fields
+        -io-depth
+        -io-rate
+        -io-timeout
         -inum
         -ipath
         -iregex
@@ -49,9 +69,16 @@ _bfs() {
         -path
         -perm
         -printf
+        -profile-sample
         -regex
+        -shard
+        -shard-depth
         -since
         -size
+        -sort-limit
+        -stat-cache
+        -top
+        -touch-time
         -used
         -wholename
         -xattrname
@@ -60,13 +87,30 @@ _bfs() {
     # Options whose value is a filename
     local filecomp=(
         -{a,B,c,m}newer
+        -calibrate
+        -changed-since
+        -checkpoint
+        -debug-decode
+        -debug-log
         -f
         -fls
         -fprint
         -fprint0
+        -fprintjson
+        -index
+        -load-costs
+        -load-profile
+        -name-from
         -newer
         -newer{a,B,c,m}{a,B,c,m}
+        -path-from
+        -resume
         -samefile
+        -save-index
+        -save-profile
+        -serve
+        -trace
+        -update-index
     )
 
     local operators=(
@@ -92,20 +136,30 @@ _bfs() {
 
     # Options that take no arguments
     local nullary_options=(
+        -append-only
         -color
         -daystart
+        -dedup
         -depth
+        -exec-capture
         -follow
+        -gitignore
         -ignore_readdir_race
+        -io-idle
         -mount
         -nocolor
         -noerror
         -noignore_readdir_race
         -noleaf
+        -nostat-cache
         -nowarn
+        -ordered
+        -parallel
+        -parallel-roots
         -status
         -unique
         -warn
+        -watch
         -xdev
     )
 
@@ -131,16 +185,20 @@ _bfs() {
     local nullary_actions=(
         --help
         --version
+        -count
         -delete
+        -du
         -exit
         -help
         -ls
         -print
         -print0
+        -printjson
         -printx
         -prune
         -quit
         -rm
+        -touch
         -version
     )
 
@@ -163,7 +221,7 @@ _bfs() {
         fi
 
         case "${words[i]}" in
-            -exec|-execdir|-ok|-okdir)
+            -coproc|-coproc0|-coproc-test|-coproc-test0|-exec|-execdir|-ok|-okdir)
                 offset=$((i + 1))
                 ;;
             \\\;|+)
@@ -209,14 +267,33 @@ _bfs() {
         -D)
             # -D FLAG
             #     Turn on a debugging flag (see -D help)
-            COMPREPLY=($(compgen -W 'help cost exec opt rates search stat tree all' -- "$cur"))
+            COMPREPLY=($(compgen -W 'help cost exec mem opt perf rates search stat tree all' -- "$cur"))
             return
             ;;
         -S)
-            # -S bfs|dfs|ids|eds
-            #     Use breadth-first/depth-first/iterative/exponential deepening search
+            # -S bfs|dfs|ids|eds|best
+            #     Use breadth-first/depth-first/iterative/exponential deepening search,
+            #     or best-first search towards the paths and names in the expression
             #     (default: -S bfs)
-            COMPREPLY=($(compgen -W 'bfs dfs ids eds' -- "$cur"))
+            COMPREPLY=($(compgen -W 'bfs dfs ids eds best' -- "$cur"))
+            return
+            ;;
+        -count-by)
+            # -count-by root|depth
+            #     Like -count, but print a count for each root path/depth
+            COMPREPLY=($(compgen -W 'root depth' -- "$cur"))
+            return
+            ;;
+        -compress)
+            # -compress none|gzip[:LEVEL]
+            #     How to compress the output
+            COMPREPLY=($(compgen -W 'none gzip' -- "$cur"))
+            return
+            ;;
+        -errors)
+            # -errors each|buffered|summary
+            #     How to report errors
+            COMPREPLY=($(compgen -W 'each buffered summary' -- "$cur"))
             return
             ;;
         -fstype)
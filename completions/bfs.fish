@@ -1,8 +1,8 @@
 # Completions for the 'bfs' command
 
-set -l debug_flag_comp 'help\t"Print help message" cost\t"Show cost estimates" exec\t"Print executed command details" opt\t"Print optimization details" rates\t"Print predicate success rates" search\t"Trace the filesystem traversal" stat\t"Trace all stat() calls" tree\t"Print the parse tree" all\t"All debug flags at once"'
+set -l debug_flag_comp 'help\t"Print help message" cost\t"Show cost estimates" exec\t"Print executed command details" mem\t"Print memory usage" opt\t"Print optimization details" perf\t"Print system call counters" rates\t"Print predicate success rates" search\t"Trace the filesystem traversal" stat\t"Trace all stat() calls" tree\t"Print the parse tree" all\t"All debug flags at once"'
 set -l optimization_comp '0\t"Disable all optimizations" 1\t"Basic logical simplifications" 2\t"-O1, plus dead code elimination and data flow analysis" 3\t"-02, plus re-order expressions to reduce expected cost" 4\t"All optimizations, including aggressive optimizations" fast\t"Same as -O4"'
-set -l strategy_comp 'bfs\t"Breadth-first search" dfs\t"Depth-first search" ids\t"Iterative deepening search" eds\t"Exponential deepening search"'
+set -l strategy_comp 'bfs\t"Breadth-first search" dfs\t"Depth-first search" ids\t"Iterative deepening search" eds\t"Exponential deepening search" best\t"Best-first search"'
 set -l regex_type_comp 'help\t"Print help message" posix-basic\t"POSIX basic regular expressions" posix-extended\t"POSIX extended regular expressions" ed\t"Like ed" emacs\t"Like emacs" grep\t"Like grep" sed\t"Like sed"'
 set -l type_comp 'b\t"Block device" c\t"Character device" d\t"Directory" l\t"Symbolic link" p\t"Pipe" f\t"Regular file" s\t"Socket" w\t"Whiteout" D\t"Door"'
 
@@ -20,7 +20,7 @@ complete -c bfs -o f -d "Treat specified path as a path to search" -a "(__fish_c
 complete -c bfs -o D -d "Turn on a debugging flag" -a $debug_flag_comp -x
 complete -c bfs -s O -d "Enable specified optimization level" -a $optimization_comp -x
 complete -c bfs -o S -d "Choose the search strategy" -a $strategy_comp -x
-complete -c bfs -s j -d "Use this many threads" -x
+complete -c bfs -s j -d "Use this many threads" -x -a "auto"
 
 # Operators
 
@@ -34,23 +34,60 @@ complete -c bfs -o exclude -d "Exclude all paths matching the expression from th
 
 # Options
 
+complete -c bfs -o calibrate -d "Measure the cost of each kind of test and save the estimates to specified file" -F
+complete -c bfs -o changed-since -d "Only search the files that changed since specified btrfs or ZFS snapshot" -F
+complete -c bfs -o checkpoint -d "Periodically save the remaining directories to specified file" -F
+complete -c bfs -o checkpoint-interval -d "Save a checkpoint every N seconds" -x
 complete -c bfs -o color -d "Turn colors on"
 complete -c bfs -o nocolor -d "Turn colors off"
+complete -c bfs -o compress -d "Compress the output on background threads" -a "none gzip" -x
+complete -c bfs -o append-only -d "Assert that files are only added, never modified, to skip stale directories"
 complete -c bfs -o daystart -d "Measure time relative to the start of today"
+complete -c bfs -o debug-log -d "Record -D stat, search, and exec messages to specified file at exit" -F
+complete -c bfs -o dedup -d "Skip overlapping roots and directories that are mounted more than once"
+complete -c bfs -o dir-memory -d "Use at most specified number of bytes for directory buffers" -x
+complete -c bfs -o errors -d "Write each error right away, buffer them, or only report totals" -a "each buffered summary" -x
+complete -c bfs -o exec-capture -d "Buffer the output of concurrent -exec commands"
+complete -c bfs -o exec-jobs -d "Run up to specified number of -exec commands at once" -x
 complete -c bfs -o files0-from -d "Treat the NUL-separated paths in specified file as starting points for the search" -F
+complete -c bfs -o gitignore -d "Skip files matched by .gitignore and .ignore files"
 complete -c bfs -o ignore_readdir_race -d "Don't report an error if the file tree is modified during the search"
 complete -c bfs -o noignore_readdir_race -d "Report an error if the file tree is modified during the search"
+complete -c bfs -o index -d "Search the files saved in specified index instead of the file system" -F
+complete -c bfs -o index-fields -d "Choose the metadata saved by -save-index" -x
+complete -c bfs -o io-depth -d "Run at most N I/O operations at once" -x
+complete -c bfs -o io-idle -d "Use the idle I/O scheduling class"
+complete -c bfs -o io-rate -d "Run at most N I/O operations per second" -x
+complete -c bfs -o io-timeout -d "Give up on background I/O after specified number of seconds" -x
+complete -c bfs -o load-costs -d "Use the cost estimates in specified file to optimize the expression" -F
+complete -c bfs -o load-profile -d "Use the cost measurements in specified file to optimize the expression" -F
 complete -c bfs -o maxdepth -d "Ignore files deeper than specified number" -x
 complete -c bfs -o mindepth -d "Ignore files shallower than specified number" -x
 complete -c bfs -o mount -d "Exclude mount points"
 complete -c bfs -o noerror -d "Ignore any errors that occur during traversal"
 complete -c bfs -o nohidden -d "Exclude hidden files and directories"
 complete -c bfs -o noleaf -d "Ignored; for compatibility with GNU find"
+complete -c bfs -o nostat-cache -d "Always ask the file system for fresh attributes"
+complete -c bfs -o ordered -d "Evaluate the expression on multiple threads, keeping the output order"
+complete -c bfs -o parallel -d "Evaluate the expression on multiple threads"
+complete -c bfs -o parallel-roots -d "Search starting points on different devices in parallel"
+complete -c bfs -o profile-sample -d "Only time one evaluation in N for -D rates and -save-profile" -x
 complete -c bfs -o regextype -d "Use specified flavored regex" -a $regex_type_comp -x
+complete -c bfs -o resume -d "Continue a search from specified checkpoint file" -F
+complete -c bfs -o save-index -d "Save the files visited to specified index" -F
+complete -c bfs -o save-profile -d "Save cost measurements for the expression to specified file" -F
+complete -c bfs -o serve -d "Run the searches of \$BFS_SERVER clients on specified socket" -F
+complete -c bfs -o shard -d "Only search one of N disjoint parts of the tree (K/N)" -x
+complete -c bfs -o shard-depth -d "Split the tree for -shard at specified depth" -x
+complete -c bfs -o sort-limit -d "Sort at most specified number of files in memory for -s" -x
+complete -c bfs -o stat-cache -d "Let stat() use cached attributes on file systems with the given types" -a "(__fish_print_filesystems)" -x
 complete -c bfs -o status -d "Display a status bar while searching"
+complete -c bfs -o trace -d "Write a timeline of the search to specified file" -F
 complete -c bfs -o unique -d "Skip any files that have already been seen"
+complete -c bfs -o update-index -d "Update specified index, then search it" -F
 complete -c bfs -o warn -d "Turn on warnings about the command line"
 complete -c bfs -o nowarn -d "Turn off warnings about the command line"
+complete -c bfs -o watch -d "Keep handling new or modified files after the search"
 
 # Tests
 
@@ -85,6 +122,9 @@ complete -c bfs -o gid -d "Find files owned by group ID" -a "(__fish_complete_gr
 complete -c bfs -o uid -d "Find files owned by user ID" -a "(__fish_complete_user_ids)" -x
 complete -c bfs -o group -d "Find files owned by the group" -a "(__fish_complete_groups)" -x
 complete -c bfs -o user -d "Find files owned by the user" -a "(__fish_complete_users)" -x
+complete -c bfs -o grep -d "Find regular files that contain the literal string PATTERN" -x
+complete -c bfs -o grep-regex -d "Find regular files with a line that matches REGEX" -x
+complete -c bfs -o hash -d "Find regular files whose contents hash to ALGO:DIGEST" -x
 complete -c bfs -o hidden -d "Find hidden files"
 complete -c bfs -o ilname -d "Case-insensitive versions of -lname" -x
 complete -c bfs -o iname -d "Case-insensitive versions of -name" -x
@@ -95,6 +135,7 @@ complete -c bfs -o inum -d "Find files with specified inode number" -x
 complete -c bfs -o links -d "Find files with specified number of hard links" -x
 complete -c bfs -o lname -d "Find symbolic links whose target matches specified glob" -x
 complete -c bfs -o name -d "Find files whose name matches specified glob" -x
+complete -c bfs -o name-from -d "Find files whose name is one of the entries in specified file" -F
 complete -c bfs -o newer -d "Find files newer than specified file" -F
 
 # handle -newer{a,B,c,m}{a,B,c,m} FILE
@@ -112,6 +153,7 @@ end
 complete -c bfs -o nogroup -d "Find files owned by nonexistent groups"
 complete -c bfs -o nouser -d "Find files owned by nonexistent users"
 complete -c bfs -o path -o wholename -d "Find files whose entire path matches specified glob" -x
+complete -c bfs -o path-from -d "Find files whose entire path is one of the entries in specified file" -F
 complete -c bfs -o perm -d "Find files with a matching mode" -x
 complete -c bfs -o regex -d "Find files whose entire path matches the regular expression" -x
 complete -c bfs -o samefile -d "Find hard links to specified file" -F
@@ -126,7 +168,16 @@ complete -c bfs -o xtype -d "Find files of the given type, following links when
 
 # Actions
 
+complete -c bfs -o chmod -d "Change the permissions of the found file" -x
+complete -c bfs -o chown -d "Change the owner and/or group of the found file" -x
+complete -c bfs -o coproc -d "Start a command once and write the found paths to its standard input" -r
+complete -c bfs -o coproc0 -d "Like -coproc, but separate the paths with NUL bytes" -r
+complete -c bfs -o coproc-test -d "Like -coproc, but read a y/n reply for each path" -r
+complete -c bfs -o coproc-test0 -d "Like -coproc-test, but separate the paths with NUL bytes" -r
+complete -c bfs -o count -d "Print the number of found files when the search finishes"
+complete -c bfs -o count-by -d "Like -count, but count each root path or depth separately" -a "root depth" -x
 complete -c bfs -o rm -o delete -d "Delete any found files"
+complete -c bfs -o du -d "Print the disk usage of each found file and everything beneath it"
 complete -c bfs -o exec -d "Execute a command" -r
 complete -c bfs -o ok -d "Prompt the user whether to execute a command" -r
 complete -c bfs -o execdir -d "Like -exec, but run the command in the same directory as the found file(s)" -r
@@ -136,13 +187,20 @@ complete -c bfs -o fls -d "Like -ls, but write to specified file" -F
 complete -c bfs -o fprint -d "Like -print, but write to specified file" -F
 complete -c bfs -o fprint0 -d "Like -print0, but write to specified file" -F
 complete -c bfs -o fprintf -d "Like -printf, but write to specified file" -F
+complete -c bfs -o fprintjson -d "Like -printjson, but write to specified file" -F
 complete -c bfs -o limit -d "Limit the number of results" -x
 complete -c bfs -o ls -d "List files like ls -dils"
 complete -c bfs -o print -d "Print the path to the found file"
 complete -c bfs -o print0 -d "Like -print, but use the null character as a separator rather than newlines"
 complete -c bfs -o printf -d "Print according to a format string" -x
+complete -c bfs -o printjson -d "Print the path and metadata of the found file as JSON"
 complete -c bfs -o printx -d "Like -print, but escape whitespace and quotation characters"
 complete -c bfs -o prune -d "Don't descend into this directory"
 complete -c bfs -o quit -d "Quit immediately"
+complete -c bfs -o top -d "Print the N found files with the largest FIELD when the search finishes" -x
+complete -c bfs -o bottom -d "Print the N found files with the smallest FIELD when the search finishes" -x
+complete -c bfs -o touch -d "Set the access and modification times of the found file to now"
+complete -c bfs -o touch-time -d "Set the access and modification times of the found file" -x
+complete -c bfs -o debug-decode -d "Print the messages recorded by -debug-log" -F
 complete -c bfs -o version -l version -d "Print version information"
 complete -c bfs -o help -l help -d "Print usage information"
@@ -0,0 +1,69 @@
+// gen/config.h
+#ifndef BFS_CONFIG_H
+#define BFS_CONFIG_H
+#define BFS_WITH_LIBACL false
+#define BFS_WITH_LIBCAP false
+#define BFS_WITH_LIBSELINUX false
+#define BFS_WITH_LIBURING false
+#define BFS_WITH_ONIGURUMA false
+#define BFS_WITH_ZLIB true
+#define BFS_HAS___ST_BIRTHTIM false
+#define BFS_HAS__FORK true
+#define BFS_HAS_ACL_GET_ENTRY false
+#define BFS_HAS_ACL_GET_FILE false
+#define BFS_HAS_ACL_GET_TAG_TYPE false
+#define BFS_HAS_ACL_IS_TRIVIAL_NP false
+#define BFS_HAS_ACL_TRIVIAL false
+#define BFS_HAS_ALIGNED_ALLOC true
+#define BFS_HAS_BTRFS_TREE_SEARCH true
+#define BFS_HAS_BUILTIN_RISCV_PAUSE false
+#define BFS_HAS_CONFSTR true
+#define BFS_HAS_EXTATTR_GET_FILE false
+#define BFS_HAS_EXTATTR_GET_LINK false
+#define BFS_HAS_EXTATTR_LIST_FILE false
+#define BFS_HAS_EXTATTR_LIST_LINK false
+#define BFS_HAS_FDCLOSEDIR false
+#define BFS_HAS_FOPENCOOKIE true
+#define BFS_HAS_FUTEX_SYSCALL true
+#define BFS_HAS_GETATTRLISTBULK false
+#define BFS_HAS_GETDENTS false
+#define BFS_HAS_GETDENTS64_SYSCALL true
+#define BFS_HAS_GETDENTS64 true
+#define BFS_HAS_GETMNTENT_1 true
+#define BFS_HAS_GETMNTENT_2 false
+#define BFS_HAS_GETMNTINFO false
+#define BFS_HAS_GETPROGNAME_GNU true
+#define BFS_HAS_GETPROGNAME false
+#define BFS_HAS_INOTIFY true
+#define BFS_HAS_IO_URING_GETDENTS false
+#define BFS_HAS_IO_URING_READLINKAT false
+#define BFS_HAS_IO_URING_REGISTER_RING_FD false
+#define BFS_HAS_IOPRIO_SET_SYSCALL true
+#define BFS_HAS_LISTMOUNT_SYSCALL false
+#define BFS_HAS_NAME_TO_HANDLE_AT true
+#define BFS_HAS_OPENAT2_SYSCALL true
+#define BFS_HAS_PIPE2 true
+#define BFS_HAS_POSIX_GETDENTS false
+#define BFS_HAS_POSIX_SPAWN_ADDFCHDIR_NP true
+#define BFS_HAS_POSIX_SPAWN_ADDFCHDIR false
+#define BFS_HAS_PTHREAD_SETAFFINITY_NP true
+#define BFS_HAS_ST_ACMTIM true
+#define BFS_HAS_ST_ACMTIMESPEC false
+#define BFS_HAS_ST_BIRTHTIM false
+#define BFS_HAS_ST_BIRTHTIMESPEC false
+#define BFS_HAS_ST_FLAGS false
+#define BFS_HAS_STATX_SYSCALL true
+#define BFS_HAS_STATX true
+#define BFS_HAS_STRERROR_L true
+#define BFS_HAS_STRERROR_R_GNU true
+#define BFS_HAS_STRERROR_R_POSIX false
+#define BFS_HAS_STRING_TO_FLAGS false
+#define BFS_HAS_STRTOFFLAGS false
+#define BFS_HAS_TCGETWINSIZE false
+#define BFS_HAS_TIMEGM true
+#define BFS_HAS_TM_GMTOFF true
+#define BFS_HAS_ULOCK_WAIT false
+#define BFS_HAS_UMTX_OP false
+#define BFS_HAS_USELOCALE true
+#define BFS_HAS_XFS_BULKSTAT false
+#endif // BFS_CONFIG_H
@@ -0,0 +1,4 @@
+# gen/config.mk
+include gen/vars.mk
+include gen/flags.mk
+include gen/pkgs.mk
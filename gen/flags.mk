@@ -0,0 +1,15 @@
+# gen/flags.mk
+_CPPFLAGS := -Isrc -Igen -include src/prelude.h  
+_CFLAGS := -std=c17 -pthread -g -Wall 
+_LDFLAGS :=  
+_LDLIBS :=   -lrt
+NOLIBS := 
+_CFLAGS += -Wformat=2
+_CFLAGS += -Wimplicit-fallthrough
+_CFLAGS += -Werror=implicit
+_CFLAGS += -Wmissing-declarations
+_CFLAGS += -Wshadow
+_CFLAGS += -Wsign-compare
+_CFLAGS += -Wstrict-prototypes
+_LDFLAGS += -Wl,-z,now
+_CPPFLAGS += -MD -MP
@@ -0,0 +1 @@
+_CFLAGS += -Wsign-compare
@@ -0,0 +1 @@
+_LDFLAGS += -Wl,-z,now
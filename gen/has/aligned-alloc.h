@@ -0,0 +1 @@
+#define BFS_HAS_ALIGNED_ALLOC true
@@ -0,0 +1 @@
+#define BFS_HAS_BTRFS_TREE_SEARCH true
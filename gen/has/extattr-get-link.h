@@ -0,0 +1 @@
+#define BFS_HAS_EXTATTR_GET_LINK false
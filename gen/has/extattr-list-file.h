@@ -0,0 +1 @@
+#define BFS_HAS_EXTATTR_LIST_FILE false
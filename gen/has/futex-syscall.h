@@ -0,0 +1 @@
+#define BFS_HAS_FUTEX_SYSCALL true
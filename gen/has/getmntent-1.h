@@ -0,0 +1 @@
+#define BFS_HAS_GETMNTENT_1 true
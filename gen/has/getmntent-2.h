@@ -0,0 +1 @@
+#define BFS_HAS_GETMNTENT_2 false
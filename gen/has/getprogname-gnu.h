@@ -0,0 +1 @@
+#define BFS_HAS_GETPROGNAME_GNU true
@@ -0,0 +1 @@
+#define BFS_HAS_IO_URING_READLINKAT false
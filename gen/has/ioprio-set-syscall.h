@@ -0,0 +1 @@
+#define BFS_HAS_IOPRIO_SET_SYSCALL true
@@ -0,0 +1 @@
+#define BFS_HAS_NAME_TO_HANDLE_AT true
@@ -0,0 +1 @@
+#define BFS_HAS_OPENAT2_SYSCALL true
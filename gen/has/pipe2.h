@@ -0,0 +1 @@
+#define BFS_HAS_PIPE2 true
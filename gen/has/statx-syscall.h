@@ -0,0 +1 @@
+#define BFS_HAS_STATX_SYSCALL true
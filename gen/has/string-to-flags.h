@@ -0,0 +1 @@
+#define BFS_HAS_STRING_TO_FLAGS false
@@ -0,0 +1 @@
+#define BFS_HAS_ULOCK_WAIT false
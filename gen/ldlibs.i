@@ -0,0 +1 @@
+ 0x2d, 0x6c, 0x7a, 0x20, 0x20, 0x2d, 0x6c, 0x72, 0x74, 0x00,
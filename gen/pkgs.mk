@@ -0,0 +1,5 @@
+# gen/pkgs.mk
+PKGS := zlib
+_CFLAGS += 
+_LDFLAGS += 
+_LDLIBS := -lz  ${_LDLIBS}
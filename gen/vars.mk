@@ -0,0 +1,9 @@
+# gen/vars.mk
+PREFIX := /usr
+MANDIR := /usr/share/man
+OS := Linux
+CC := cc
+INSTALL := install
+MKDIR := mkdir -p
+PKG_CONFIG := pkg-config
+RM := rm -f
@@ -0,0 +1 @@
+ 0x66, 0x32, 0x62, 0x33, 0x65, 0x66, 0x35, 0x00,
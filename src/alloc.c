@@ -7,11 +7,14 @@
 #include "bit.h"
 #include "diag.h"
 #include "sanity.h"
+#include "thread.h"
 
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 /** The largest possible allocation size. */
 #if PTRDIFF_MAX < SIZE_MAX / 2
@@ -158,7 +161,39 @@ static void chunk_set_next(const struct arena *arena, union chunk *chunk, union
 	chunk->next = (uintptr_t)next - base;
 }
 
-void arena_init(struct arena *arena, size_t align, size_t size) {
+/** The most distinct arena names to track. */
+#define ARENA_STATS_MAX 64
+
+/** Memory usage statistics for each arena name. */
+static struct arena_stats arena_stats_table[ARENA_STATS_MAX];
+/** The number of arena names seen so far. */
+static size_t arena_stats_count;
+
+/** Find or add the statistics for an arena name. */
+static struct arena_stats *arena_stats_for(const char *name) {
+	for (size_t i = 0; i < arena_stats_count; ++i) {
+		struct arena_stats *stats = &arena_stats_table[i];
+		if (strcmp(stats->name, name) == 0) {
+			return stats;
+		}
+	}
+
+	if (arena_stats_count >= ARENA_STATS_MAX) {
+		return NULL;
+	}
+
+	struct arena_stats *stats = &arena_stats_table[arena_stats_count++];
+	stats->name = name;
+	return stats;
+}
+
+const struct arena_stats *arena_stats(size_t *count) {
+	*count = arena_stats_count;
+	return arena_stats_table;
+}
+
+/** Initialize an arena that shares some statistics. */
+static void arena_init_stats(struct arena *arena, size_t align, size_t size, struct arena_stats *stats) {
 	bfs_assert(has_single_bit(align));
 	bfs_assert(is_aligned(align, size));
 
@@ -171,15 +206,21 @@ void arena_init(struct arena *arena, size_t align, size_t size) {
 	bfs_assert(is_aligned(align, size));
 
 	arena->chunks = NULL;
+	arena->trimmed = NULL;
 	arena->nslabs = 0;
 	arena->slabs = NULL;
 	arena->align = align;
 	arena->size = size;
+	arena->live = 0;
+	arena->stats = stats;
 }
 
-/** Allocate a new slab. */
-_cold
-static int slab_alloc(struct arena *arena) {
+void arena_init(struct arena *arena, size_t align, size_t size, const char *name) {
+	arena_init_stats(arena, align, size, arena_stats_for(name));
+}
+
+/** Get the size of a slab. */
+static size_t slab_size(const struct arena *arena, size_t i) {
 	// Make the initial allocation size ~4K
 	size_t size = 4096;
 	if (size < arena->size) {
@@ -188,10 +229,51 @@ static int slab_alloc(struct arena *arena) {
 	// Trim off the excess
 	size -= size % arena->size;
 	// Double the size for every slab
-	size <<= arena->nslabs;
+	return size << i;
+}
+
+/**
+ * Slabs at least this big are mapped directly, so they can use transparent
+ * huge pages, and are returned to the OS as soon as they're freed.
+ */
+#define SLAB_MAP_MIN ((size_t)2 << 20)
+
+/** Allocate zeroed memory for a slab. */
+static void *slab_map(const struct arena *arena, size_t size) {
+	if (size < SLAB_MAP_MIN) {
+		return zalloc(arena->align, size);
+	}
+
+	// Anonymous mappings are zeroed and page-aligned
+	void *slab = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (slab == MAP_FAILED) {
+		return NULL;
+	}
+
+#ifdef MADV_HUGEPAGE
+	// Millions of bftw_files cause a lot of TLB misses with small pages
+	madvise(slab, size, MADV_HUGEPAGE);
+#endif
+
+	return slab;
+}
+
+/** Free the memory for a slab. */
+static void slab_unmap(void *slab, size_t size) {
+	if (size < SLAB_MAP_MIN) {
+		free(slab);
+	} else {
+		munmap(slab, size);
+	}
+}
+
+/** Allocate a new slab. */
+_cold
+static int slab_alloc(struct arena *arena) {
+	size_t size = slab_size(arena, arena->nslabs);
 
 	// Allocate the slab
-	void *slab = zalloc(arena->align, size);
+	void *slab = slab_map(arena, size);
 	if (!slab) {
 		return -1;
 	}
@@ -199,7 +281,7 @@ static int slab_alloc(struct arena *arena) {
 	// Grow the slab array
 	void **pslab = RESERVE(void *, &arena->slabs, &arena->nslabs);
 	if (!pslab) {
-		free(slab);
+		slab_unmap(slab, size);
 		return -1;
 	}
 
@@ -211,12 +293,117 @@ static int slab_alloc(struct arena *arena) {
 	sanitize_uninit(slab, size);
 
 	arena->chunks = *pslab = slab;
+
+	struct arena_stats *stats = arena->stats;
+	if (stats) {
+		++stats->nslabs;
+		stats->bytes += size;
+		if (stats->peak_bytes < stats->bytes) {
+			stats->peak_bytes = stats->bytes;
+		}
+	}
+
 	return 0;
 }
 
+/**
+ * The madvise() advice that gives pages back to the OS right away.  Linux's
+ * MADV_DONTNEED does that, but elsewhere it's only a hint, and MADV_FREE is the
+ * one that actually frees the pages.
+ */
+#if __linux__
+#  define TRIM_ADVICE MADV_DONTNEED
+#elif defined(MADV_FREE)
+#  define TRIM_ADVICE MADV_FREE
+#endif
+
+/** Get the whole pages of a free chunk that can be trimmed. */
+static size_t chunk_trim_range(const struct arena *arena, union chunk *chunk, size_t page, void **start) {
+	// The header holds the free list, so it can't be trimmed
+	uintptr_t begin = align_ceil(page, (uintptr_t)(chunk + 1));
+	uintptr_t end = align_floor(page, (uintptr_t)chunk + arena->size);
+	*start = (void *)begin;
+	return end > begin ? end - begin : 0;
+}
+
+/** Refill the free list from the trimmed chunks. */
+static void arena_untrim(struct arena *arena) {
+	union chunk *chunk = arena->trimmed;
+	sanitize_alloc(chunk, sizeof(*chunk));
+	sanitize_init(chunk);
+	arena->trimmed = chunk_next(arena, chunk);
+	chunk_set_next(arena, chunk, NULL);
+	sanitize_free(chunk, arena->size);
+	arena->chunks = chunk;
+
+	struct arena_stats *stats = arena->stats;
+	if (stats) {
+		void *start;
+		stats->trimmed -= chunk_trim_range(arena, chunk, sysconf(_SC_PAGESIZE), &start);
+	}
+}
+
+size_t arena_trim(struct arena *arena, size_t keep) {
+#ifdef TRIM_ADVICE
+	size_t page = sysconf(_SC_PAGESIZE);
+	if (arena->size < 2 * page) {
+		// Chunks this small rarely cover a whole page past their header
+		return 0;
+	}
+
+	// Keep the first few free chunks, which will be reused first
+	union chunk *prev = NULL;
+	union chunk *chunk = arena->chunks;
+	for (size_t i = 0; chunk && i < keep; ++i) {
+		sanitize_alloc(chunk, sizeof(*chunk));
+		prev = chunk;
+		chunk = chunk_next(arena, chunk);
+		sanitize_free(prev, sizeof(*prev));
+	}
+
+	if (prev) {
+		sanitize_alloc(prev, sizeof(*prev));
+		chunk_set_next(arena, prev, NULL);
+		sanitize_free(prev, sizeof(*prev));
+	} else {
+		arena->chunks = NULL;
+	}
+
+	// Give back the rest, and set them aside so they're only trimmed once
+	size_t ret = 0;
+	while (chunk) {
+		sanitize_alloc(chunk, sizeof(*chunk));
+		sanitize_init(chunk);
+		union chunk *next = chunk_next(arena, chunk);
+		chunk_set_next(arena, chunk, arena->trimmed);
+		sanitize_free(chunk, sizeof(*chunk));
+		arena->trimmed = chunk;
+
+		void *start;
+		size_t len = chunk_trim_range(arena, chunk, page, &start);
+		if (len > 0 && madvise(start, len, TRIM_ADVICE) == 0) {
+			ret += len;
+		}
+
+		chunk = next;
+	}
+
+	if (arena->stats) {
+		arena->stats->trimmed += ret;
+	}
+	return ret;
+#else
+	return 0;
+#endif
+}
+
 void *arena_alloc(struct arena *arena) {
-	if (!arena->chunks && slab_alloc(arena) != 0) {
-		return NULL;
+	if (!arena->chunks) {
+		if (arena->trimmed) {
+			arena_untrim(arena);
+		} else if (slab_alloc(arena) != 0) {
+			return NULL;
+		}
 	}
 
 	union chunk *chunk = arena->chunks;
@@ -226,6 +413,12 @@ void *arena_alloc(struct arena *arena) {
 	arena->chunks = chunk_next(arena, chunk);
 	sanitize_uninit(chunk, arena->size);
 
+	++arena->live;
+	struct arena_stats *stats = arena->stats;
+	if (stats && ++stats->live > stats->peak) {
+		stats->peak = stats->live;
+	}
+
 	return chunk;
 }
 
@@ -234,14 +427,35 @@ void arena_free(struct arena *arena, void *ptr) {
 	chunk_set_next(arena, chunk, arena->chunks);
 	arena->chunks = chunk;
 	sanitize_free(chunk, arena->size);
+
+	--arena->live;
+	if (arena->stats) {
+		--arena->stats->live;
+	}
 }
 
 void arena_clear(struct arena *arena) {
+	// Fix up the trimmed byte count
+	while (arena->trimmed) {
+		arena_untrim(arena);
+	}
+
+	struct arena_stats *stats = arena->stats;
 	for (size_t i = 0; i < arena->nslabs; ++i) {
-		free(arena->slabs[i]);
+		size_t size = slab_size(arena, i);
+		slab_unmap(arena->slabs[i], size);
+		if (stats) {
+			--stats->nslabs;
+			stats->bytes -= size;
+		}
 	}
 	free(arena->slabs);
 
+	if (stats) {
+		stats->live -= arena->live;
+	}
+	arena->live = 0;
+
 	arena->chunks = NULL;
 	arena->nslabs = 0;
 	arena->slabs = NULL;
@@ -252,12 +466,105 @@ void arena_destroy(struct arena *arena) {
 	sanitize_uninit(arena);
 }
 
-void varena_init(struct varena *varena, size_t align, size_t min, size_t offset, size_t size) {
+int arena_pool_init(struct arena_pool *pool, size_t align, size_t size, const char *name) {
+	if (mutex_init(&pool->mutex, NULL) != 0) {
+		return -1;
+	}
+
+	arena_init(&pool->arena, align, size, name);
+	return 0;
+}
+
+void arena_pool_destroy(struct arena_pool *pool) {
+	arena_destroy(&pool->arena);
+	mutex_destroy(&pool->mutex);
+}
+
+void arena_cache_init(struct arena_cache *cache, struct arena_pool *pool) {
+	cache->pool = pool;
+	cache->count = 0;
+}
+
+/** Move chunks from the pool to a cache. */
+_cold
+static void arena_cache_refill(struct arena_cache *cache, size_t target) {
+	struct arena_pool *pool = cache->pool;
+
+	mutex_lock(&pool->mutex);
+	while (cache->count < target) {
+		void *chunk = arena_alloc(&pool->arena);
+		if (!chunk) {
+			break;
+		}
+		cache->chunks[cache->count++] = chunk;
+	}
+	mutex_unlock(&pool->mutex);
+}
+
+/** Move chunks from a cache to the pool. */
+_cold
+static void arena_cache_drain(struct arena_cache *cache, size_t target) {
+	struct arena_pool *pool = cache->pool;
+	size_t size = pool->arena.size;
+
+	mutex_lock(&pool->mutex);
+	while (cache->count > target) {
+		void *chunk = cache->chunks[--cache->count];
+		sanitize_alloc(chunk, size);
+		arena_free(&pool->arena, chunk);
+	}
+	mutex_unlock(&pool->mutex);
+}
+
+void *arena_cache_alloc(struct arena_cache *cache) {
+	size_t size = cache->pool->arena.size;
+
+	if (cache->count == 0) {
+		arena_cache_refill(cache, ARENA_CACHE_SIZE / 2);
+		if (cache->count == 0) {
+			return NULL;
+		}
+	} else {
+		sanitize_alloc(cache->chunks[cache->count - 1], size);
+	}
+
+	void *chunk = cache->chunks[--cache->count];
+	sanitize_uninit(chunk, size);
+	return chunk;
+}
+
+void arena_cache_free(struct arena_cache *cache, void *ptr) {
+	if (cache->count == ARENA_CACHE_SIZE) {
+		arena_cache_drain(cache, ARENA_CACHE_SIZE / 2);
+	}
+
+	cache->chunks[cache->count++] = ptr;
+	sanitize_free(ptr, cache->pool->arena.size);
+}
+
+void arena_cache_flush(struct arena_cache *cache) {
+	if (cache->count > 0) {
+		arena_cache_drain(cache, 0);
+	}
+}
+
+void arena_cache_destroy(struct arena_cache *cache) {
+	arena_cache_flush(cache);
+	sanitize_uninit(cache);
+}
+
+void varena_init(struct varena *varena, size_t align, size_t min, size_t offset, size_t size, const char *name) {
+	// Every size class must be a multiple of the arena chunk alignment
+	if (align < alignof(union chunk)) {
+		align = alignof(union chunk);
+	}
+
 	varena->align = align;
 	varena->offset = offset;
 	varena->size = size;
 	varena->narenas = 0;
 	varena->arenas = NULL;
+	varena->stats = arena_stats_for(name);
 
 	// The smallest size class is at least as many as fit in the smallest
 	// aligned allocation size
@@ -290,7 +597,7 @@ static struct arena *varena_get(struct varena *varena, size_t count) {
 
 		size_t shift = j + varena->shift;
 		size_t size = varena_exact_size(varena, (size_t)1 << shift);
-		arena_init(arena, varena->align, size);
+		arena_init_stats(arena, varena->align, size, varena->stats);
 	}
 
 	return &varena->arenas[i];
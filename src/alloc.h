@@ -11,6 +11,7 @@
 #include "bfs.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
 
@@ -220,6 +221,36 @@ void *reserve(void *ptr, size_t align, size_t size, size_t count);
 	((*ptr) = reserve((*ptr), alignof(type), sizeof(type), (*count)), \
 	 errno ? NULL : (*ptr) + (*count)++)
 
+/**
+ * Memory usage statistics for all the arenas with the same name (-D mem).
+ */
+struct arena_stats {
+	/** The name of the arenas. */
+	const char *name;
+	/** The number of live objects. */
+	size_t live;
+	/** The most objects that were live at once. */
+	size_t peak;
+	/** The number of allocated slabs. */
+	size_t nslabs;
+	/** The total size of the allocated slabs. */
+	size_t bytes;
+	/** The most bytes that were allocated at once. */
+	size_t peak_bytes;
+	/** The bytes of free chunks that were given back to the OS. */
+	size_t trimmed;
+};
+
+/**
+ * Get the memory usage statistics for every arena name seen so far.
+ *
+ * @param[out] count
+ *         Set to the number of entries.
+ * @return
+ *         The statistics, in order of first use.
+ */
+const struct arena_stats *arena_stats(size_t *count);
+
 /**
  * An arena allocator for fixed-size types.
  *
@@ -228,6 +259,8 @@ void *reserve(void *ptr, size_t align, size_t size, size_t count);
 struct arena {
 	/** The list of free chunks. */
 	void *chunks;
+	/** The list of free chunks whose memory was given back by arena_trim(). */
+	void *trimmed;
 	/** The number of allocated slabs. */
 	size_t nslabs;
 	/** The array of slabs. */
@@ -236,18 +269,25 @@ struct arena {
 	size_t align;
 	/** Chunk size. */
 	size_t size;
+	/** The number of live objects. */
+	size_t live;
+	/** The shared statistics for arenas with this name. */
+	struct arena_stats *stats;
 };
 
 /**
  * Initialize an arena for chunks of the given size and alignment.
+ *
+ * @param name
+ *         The name to report memory usage under, which must outlive the arena.
  */
-void arena_init(struct arena *arena, size_t align, size_t size);
+void arena_init(struct arena *arena, size_t align, size_t size, const char *name);
 
 /**
  * Initialize an arena for the given type.
  */
 #define ARENA_INIT(arena, type) \
-	arena_init((arena), alignof(type), sizeof(type))
+	arena_init((arena), alignof(type), sizeof(type), #type)
 
 /**
  * Free an object from the arena.
@@ -260,6 +300,20 @@ void arena_free(struct arena *arena, void *ptr);
 _malloc(arena_free, 2)
 void *arena_alloc(struct arena *arena);
 
+/**
+ * Give the memory of an arena's free chunks back to the OS.  The chunks stay
+ * allocated, and can be handed out again later (after they fault back in).
+ * Only has an effect for chunks spanning multiple pages.
+ *
+ * @param arena
+ *         The arena to trim.
+ * @param keep
+ *         The number of most recently freed chunks to keep resident.
+ * @return
+ *         The number of bytes given back.
+ */
+size_t arena_trim(struct arena *arena, size_t keep);
+
 /**
  * Free all allocations from an arena.
  */
@@ -270,6 +324,82 @@ void arena_clear(struct arena *arena);
  */
 void arena_destroy(struct arena *arena);
 
+/**
+ * An arena that can be shared between threads, through per-thread caches.
+ */
+struct arena_pool {
+	/** The underlying arena. */
+	struct arena arena;
+	/** Protects the arena. */
+	pthread_mutex_t mutex;
+};
+
+/**
+ * Initialize an arena pool.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int arena_pool_init(struct arena_pool *pool, size_t align, size_t size, const char *name);
+
+/**
+ * Initialize an arena pool for the given type.
+ */
+#define ARENA_POOL_INIT(pool, type) \
+	arena_pool_init((pool), alignof(type), sizeof(type), #type)
+
+/**
+ * Destroy an arena pool, freeing all allocations.  Every cache must have been
+ * destroyed first.
+ */
+void arena_pool_destroy(struct arena_pool *pool);
+
+/** The number of chunks an arena_cache can hold. */
+#define ARENA_CACHE_SIZE 64
+
+/**
+ * A single thread's cache of chunks from an arena_pool.
+ *
+ * Allocations and frees only touch the cache until it runs empty or full, and
+ * then half of it is refilled or returned to the pool at once.  Any thread's
+ * cache can free a chunk allocated by any other thread's cache from the same
+ * pool.  Chunks held by caches still count as live in the arena's statistics.
+ */
+struct arena_cache {
+	/** The shared pool. */
+	struct arena_pool *pool;
+	/** The number of cached chunks. */
+	size_t count;
+	/** The cached chunks. */
+	void *chunks[ARENA_CACHE_SIZE];
+};
+
+/**
+ * Initialize a cache for an arena pool.
+ */
+void arena_cache_init(struct arena_cache *cache, struct arena_pool *pool);
+
+/**
+ * Free an object to a cache.
+ */
+void arena_cache_free(struct arena_cache *cache, void *ptr);
+
+/**
+ * Allocate an object from a cache.
+ */
+_malloc(arena_cache_free, 2)
+void *arena_cache_alloc(struct arena_cache *cache);
+
+/**
+ * Return all the cached chunks to the pool.
+ */
+void arena_cache_flush(struct arena_cache *cache);
+
+/**
+ * Destroy a cache, returning its chunks to the pool.
+ */
+void arena_cache_destroy(struct arena_cache *cache);
+
 /**
  * An arena allocator for flexibly-sized types.
  */
@@ -286,6 +416,8 @@ struct varena {
 	size_t narenas;
 	/** The array of differently-sized arenas. */
 	struct arena *arenas;
+	/** The shared statistics for all the size classes. */
+	struct arena_stats *stats;
 };
 
 /**
@@ -301,8 +433,10 @@ struct varena {
  *         offsetof(type, flexible_array)
  * @param size
  *         sizeof(flexible_array[i])
+ * @param name
+ *         The name to report memory usage under, which must outlive the varena.
  */
-void varena_init(struct varena *varena, size_t align, size_t min, size_t offset, size_t size);
+void varena_init(struct varena *varena, size_t align, size_t min, size_t offset, size_t size, const char *name);
 
 /**
  * Initialize a varena for the given type and flexible array.
@@ -315,7 +449,7 @@ void varena_init(struct varena *varena, size_t align, size_t min, size_t offset,
  *         The name of the flexible array member.
  */
 #define VARENA_INIT(varena, type, member) \
-	varena_init(varena, alignof(type), sizeof(type), offsetof(type, member), sizeof_member(type, member[0]))
+	varena_init(varena, alignof(type), sizeof(type), offsetof(type, member), sizeof_member(type, member[0]), #type)
 
 /**
  * Free an arena-allocated flexible struct.
@@ -119,6 +119,15 @@ extern const char bfs_ldlibs[];
 #  define _noinline
 #endif
 
+/**
+ * Hint to always inline a function.
+ */
+#if __has_attribute(always_inline)
+#  define _always_inline inline __attribute__((always_inline))
+#else
+#  define _always_inline inline
+#endif
+
 /**
  * Marks a non-returning function.
  */
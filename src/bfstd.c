@@ -6,6 +6,7 @@
 #include "bfs.h"
 #include "bit.h"
 #include "diag.h"
+#include "perf.h"
 #include "sanity.h"
 #include "thread.h"
 #include "xregex.h"
@@ -28,6 +29,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <wchar.h>
+#include <wctype.h>
 
 #if __has_include(<sys/sysmacros.h>)
 #  include <sys/sysmacros.h>
@@ -173,8 +175,8 @@ char *xgetdelim(FILE *file, char delim) {
 	size_t n = 0;
 	ssize_t len = getdelim(&chunk, &n, delim, file);
 	if (len >= 0) {
-		if (chunk[len] == delim) {
-			chunk[len] = '\0';
+		if (len > 0 && chunk[len - 1] == delim) {
+			chunk[len - 1] = '\0';
 		}
 		return chunk;
 	} else {
@@ -602,7 +604,9 @@ void close_quietly(int fd) {
 }
 
 int xclose(int fd) {
+	uint64_t start = bfs_perf_start();
 	int ret = close(fd);
+	bfs_perf_end(BFS_PERF_CLOSE, start, 0);
 	if (ret != 0) {
 		bfs_verify(errno != EBADF);
 	}
@@ -664,7 +668,9 @@ char *xreadlinkat(int fd, const char *path, size_t size) {
 		}
 		name = new_name;
 
+		uint64_t start = bfs_perf_start();
 		len = readlinkat(fd, path, name, size);
+		bfs_perf_end(BFS_PERF_READLINK, start, 0);
 		if (len < 0) {
 			goto error;
 		} else if ((size_t)len >= size) {
@@ -716,6 +722,234 @@ int xstrtofflags(const char **str, unsigned long long *set, unsigned long long *
 #endif
 }
 
+int xstrtomode(const char *str, mode_t umask, mode_t *file_mode, mode_t *dir_mode) {
+	if (str[0] >= '0' && str[0] <= '9') {
+		long long parsed;
+		if (xstrtoll(str, NULL, 8, &parsed) != 0) {
+			return -1;
+		}
+		if (parsed < 0 || parsed > 07777) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		*file_mode = parsed;
+		*dir_mode = parsed;
+		return 0;
+	}
+
+	// X only applies to files that were already executable by someone
+	bool file_x = *file_mode & 0111;
+
+	// Parse the same grammar as chmod(1), which looks like this:
+	//
+	// MODE : CLAUSE ["," CLAUSE]*
+	//
+	// CLAUSE : WHO* ACTION+
+	//
+	// WHO : "u" | "g" | "o" | "a"
+	//
+	// ACTION : OP PERM*
+	//        | OP PERMCOPY
+	//
+	// OP : "+" | "-" | "="
+	//
+	// PERM : "r" | "w" | "x" | "X" | "s" | "t"
+	//
+	// PERMCOPY : "u" | "g" | "o"
+
+	// State machine state
+	enum {
+		MODE_CLAUSE,
+		MODE_WHO,
+		MODE_ACTION,
+		MODE_ACTION_APPLY,
+		MODE_OP,
+		MODE_PERM,
+	} state = MODE_CLAUSE;
+
+	enum {
+		MODE_PLUS,
+		MODE_MINUS,
+		MODE_EQUALS,
+	} op uninit(MODE_EQUALS);
+
+	mode_t who uninit(0);
+	mode_t mask uninit(0);
+	mode_t file_change uninit(0);
+	mode_t dir_change uninit(0);
+
+	const char *i = str;
+	while (true) {
+		switch (state) {
+		case MODE_CLAUSE:
+			who = 0;
+			mask = 0777;
+			state = MODE_WHO;
+			_fallthrough;
+
+		case MODE_WHO:
+			switch (*i) {
+			case 'u':
+				who |= 0700;
+				break;
+			case 'g':
+				who |= 0070;
+				break;
+			case 'o':
+				who |= 0007;
+				break;
+			case 'a':
+				who |= 0777;
+				break;
+			default:
+				state = MODE_ACTION;
+				continue;
+			}
+			break;
+
+		case MODE_ACTION_APPLY:
+			switch (op) {
+			case MODE_EQUALS:
+				*file_mode &= ~who;
+				*dir_mode &= ~who;
+				_fallthrough;
+			case MODE_PLUS:
+				*file_mode |= file_change;
+				*dir_mode |= dir_change;
+				break;
+			case MODE_MINUS:
+				*file_mode &= ~file_change;
+				*dir_mode &= ~dir_change;
+				break;
+			}
+			_fallthrough;
+
+		case MODE_ACTION:
+			if (who == 0) {
+				who = 0777;
+				mask = who & ~umask;
+			} else {
+				mask = who;
+			}
+
+			switch (*i) {
+			case '+':
+				op = MODE_PLUS;
+				state = MODE_OP;
+				break;
+			case '-':
+				op = MODE_MINUS;
+				state = MODE_OP;
+				break;
+			case '=':
+				op = MODE_EQUALS;
+				state = MODE_OP;
+				break;
+
+			case ',':
+				if (state == MODE_ACTION_APPLY) {
+					state = MODE_CLAUSE;
+				} else {
+					goto fail;
+				}
+				break;
+
+			case '\0':
+				if (state == MODE_ACTION_APPLY) {
+					goto done;
+				} else {
+					goto fail;
+				}
+
+			default:
+				goto fail;
+			}
+			break;
+
+		case MODE_OP:
+			switch (*i) {
+			case 'u':
+				file_change = (*file_mode >> 6) & 07;
+				dir_change = (*dir_mode >> 6) & 07;
+				break;
+			case 'g':
+				file_change = (*file_mode >> 3) & 07;
+				dir_change = (*dir_mode >> 3) & 07;
+				break;
+			case 'o':
+				file_change = *file_mode & 07;
+				dir_change = *dir_mode & 07;
+				break;
+
+			default:
+				file_change = 0;
+				dir_change = 0;
+				state = MODE_PERM;
+				continue;
+			}
+
+			file_change |= (file_change << 6) | (file_change << 3);
+			file_change &= mask;
+			dir_change |= (dir_change << 6) | (dir_change << 3);
+			dir_change &= mask;
+			state = MODE_ACTION_APPLY;
+			break;
+
+		case MODE_PERM:
+			switch (*i) {
+			case 'r':
+				file_change |= mask & 0444;
+				dir_change |= mask & 0444;
+				break;
+			case 'w':
+				file_change |= mask & 0222;
+				dir_change |= mask & 0222;
+				break;
+			case 'x':
+				file_change |= mask & 0111;
+				dir_change |= mask & 0111;
+				break;
+			case 'X':
+				if (file_x) {
+					file_change |= mask & 0111;
+				}
+				dir_change |= mask & 0111;
+				break;
+			case 's':
+				if (who & 0700) {
+					file_change |= S_ISUID;
+					dir_change |= S_ISUID;
+				}
+				if (who & 0070) {
+					file_change |= S_ISGID;
+					dir_change |= S_ISGID;
+				}
+				break;
+			case 't':
+				if (who & 0007) {
+					file_change |= S_ISVTX;
+					dir_change |= S_ISVTX;
+				}
+				break;
+			default:
+				state = MODE_ACTION_APPLY;
+				continue;
+			}
+			break;
+		}
+
+		++i;
+	}
+
+done:
+	return 0;
+
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
 long xsysconf(int name) {
 #if __FreeBSD__ && __SANITIZE_MEMORY__
 	// Work around https://github.com/llvm/llvm-project/issues/88163
@@ -731,6 +965,17 @@ long xsysconf(int name) {
 	return ret;
 }
 
+bool ascii_casefold_safe(void) {
+	for (wint_t c = 'A'; c <= 'Z'; ++c) {
+		wint_t lower = c + ('a' - 'A');
+		if (towlower(c) != lower || towupper(lower) != c) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 size_t asciilen(const char *str) {
 	return asciinlen(str, strlen(str));
 }
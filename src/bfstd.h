@@ -219,6 +219,32 @@ size_t asciilen(const char *str);
  */
 size_t asciinlen(const char *str, size_t n);
 
+/**
+ * Check whether the current locale folds the case of ASCII letters exactly
+ * like the C locale does (e.g. not Turkish, where 'I' folds to U+0131).
+ */
+bool ascii_casefold_safe(void);
+
+/**
+ * Fold the case of an ASCII letter like the C locale does.
+ */
+static inline char ascii_tolower(char c) {
+	if (c >= 'A' && c <= 'Z') {
+		c += 'a' - 'A';
+	}
+	return c;
+}
+
+/**
+ * Capitalize an ASCII letter like the C locale does.
+ */
+static inline char ascii_toupper(char c) {
+	if (c >= 'a' && c <= 'z') {
+		c -= 'a' - 'A';
+	}
+	return c;
+}
+
 /**
  * Allocate a copy of a region of memory.
  *
@@ -442,6 +468,22 @@ char *xconfstr(int name);
  */
 int xstrtofflags(const char **str, unsigned long long *set, unsigned long long *clear);
 
+/**
+ * Parse a permission mode like chmod(1), applying it to existing modes.
+ *
+ * @param str
+ *         The mode to parse, either octal or symbolic.
+ * @param umask
+ *         The umask, for symbolic clauses without any "who" (like "+x").
+ * @param[in,out] file_mode
+ *         The initial mode of a non-directory, updated on success.
+ * @param[in,out] dir_mode
+ *         The initial mode of a directory, updated on success.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int xstrtomode(const char *str, mode_t umask, mode_t *file_mode, mode_t *dir_mode);
+
 /**
  * Wrapper for sysconf() that works around an MSan bug.
  */
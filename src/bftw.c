@@ -23,41 +23,41 @@
 #include "alloc.h"
 #include "bfs.h"
 #include "bfstd.h"
+#include "bulkstat.h"
 #include "diag.h"
 #include "dir.h"
 #include "dstring.h"
+#include "idset.h"
 #include "ioq.h"
 #include "list.h"
 #include "mtab.h"
+#include "perf.h"
 #include "stat.h"
+#include "thread.h"
+#include "throttle.h"
+#include "trace.h"
 #include "trie.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 /** Initialize a bftw_stat cache. */
-static void bftw_stat_init(struct bftw_stat *bufs, struct bfs_stat *stat_buf, struct bfs_stat *lstat_buf) {
+static void bftw_stat_init(struct bftw_stat *bufs, struct bfs_stat *stat_buf, struct bfs_stat *lstat_buf, dchar **link_buf) {
 	bufs->stat_buf = stat_buf;
 	bufs->lstat_buf = lstat_buf;
 	bufs->stat_err = -1;
 	bufs->lstat_err = -1;
-}
-
-/** Fill a bftw_stat cache from another one. */
-static void bftw_stat_fill(struct bftw_stat *dest, const struct bftw_stat *src) {
-	if (dest->stat_err < 0 && src->stat_err >= 0) {
-		dest->stat_buf = src->stat_buf;
-		dest->stat_err = src->stat_err;
-	}
-
-	if (dest->lstat_err < 0 && src->lstat_err >= 0) {
-		dest->lstat_buf = src->lstat_buf;
-		dest->lstat_err = src->lstat_err;
-	}
+	bufs->link_buf = link_buf;
+	bufs->link_err = -1;
+	bufs->targets = NULL;
 }
 
 /** Cache a bfs_stat() result. */
@@ -87,6 +87,173 @@ static void bftw_stat_cache(struct bftw_stat *bufs, enum bfs_stat_flags flags, c
 	}
 }
 
+/**
+ * Cached bfs_stat() info for a buffered file, packed to save memory.
+ */
+struct bftw_packed_stat {
+	/** The bfs_stat(BFS_STAT_FOLLOW) buffer. */
+	struct bfs_packed_stat *stat_buf;
+	/** The bfs_stat(BFS_STAT_NOFOLLOW) buffer (may be the same). */
+	struct bfs_packed_stat *lstat_buf;
+	/** The cached bfs_stat(BFS_STAT_FOLLOW) error. */
+	int stat_err;
+	/** The cached bfs_stat(BFS_STAT_NOFOLLOW) error. */
+	int lstat_err;
+};
+
+/** Initialize a packed stat cache. */
+static void bftw_packed_init(struct bftw_packed_stat *packed) {
+	packed->stat_buf = NULL;
+	packed->lstat_buf = NULL;
+	packed->stat_err = -1;
+	packed->lstat_err = -1;
+}
+
+/** The number of entries in the symlink target cache (a power of two). */
+#define BFTW_TARGETS_SIZE 1024
+
+/**
+ * Give up on the target cache if fewer than 1/BFTW_TARGETS_ODDS lookups hit.
+ * A readlink() costs about as much as the stat() a hit saves.
+ */
+#define BFTW_TARGETS_ODDS 2
+
+/**
+ * A cached symlink target.
+ */
+struct bftw_target {
+	/** The path that the link resolves, or NULL for an empty entry. */
+	dchar *key;
+	/** The bfs_stat() error, or 0. */
+	int err;
+	/** The bfs_stat(BFS_STAT_FOLLOW) info. */
+	struct bfs_stat buf;
+};
+
+/**
+ * A direct-mapped cache of bfs_stat(BFS_STAT_FOLLOW) results for symlinks, so
+ * that the links in a symlink farm that point to the same few files don't stat()
+ * them over and over.
+ *
+ * Entries are keyed by the path that following the link resolves: its target,
+ * if that's absolute, or else the path to the link's parent directory followed
+ * by the target.  Equal keys resolve through the same directory entries, so
+ * they find the same file.
+ *
+ * Entries are never revalidated, so a target that changes during the search
+ * may be seen with its old attributes.  That's why bfs only sets
+ * BFTW_SHARE_TARGETS when the expression can't modify any files.  The cache
+ * is only used by the thread that calls the bftw() callback.
+ */
+struct bftw_targets {
+	/** The entries (allocated on first use). */
+	struct bftw_target *table;
+	/** Scratch space for building keys. */
+	dchar *key;
+	/** The number of lookups so far. */
+	size_t lookups;
+	/** The number of lookups that hit. */
+	size_t hits;
+	/** Set if the cache isn't paying for its readlink() calls. */
+	bool disabled;
+};
+
+/** Initialize a symlink target cache. */
+static void bftw_targets_init(struct bftw_targets *targets) {
+	targets->table = NULL;
+	targets->key = NULL;
+	targets->lookups = 0;
+	targets->hits = 0;
+	targets->disabled = false;
+}
+
+/** Destroy a symlink target cache. */
+static void bftw_targets_destroy(struct bftw_targets *targets) {
+	if (targets->table) {
+		for (size_t i = 0; i < BFTW_TARGETS_SIZE; ++i) {
+			dstrfree(targets->table[i].key);
+		}
+		free(targets->table);
+	}
+	dstrfree(targets->key);
+}
+
+/** Hash a target cache key (FNV-1a). */
+static size_t bftw_target_hash(const char *key) {
+	uint32_t hash = 0x811C9DC5;
+	for (const char *c = key; *c; ++c) {
+		hash ^= (unsigned char)*c;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+/**
+ * Find a symlink's target in the cache, or stat() it and add it.
+ *
+ * @return
+ *         The cache entry, or NULL if the cache can't be used for this link.
+ */
+static const struct bftw_target *bftw_target_stat(struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
+	struct bftw_targets *targets = ftwbuf->stat_bufs.targets;
+	if (targets->disabled) {
+		return NULL;
+	}
+
+	if (targets->lookups >= BFTW_TARGETS_SIZE && targets->hits < targets->lookups / BFTW_TARGETS_ODDS) {
+		// Few links share their targets, so the readlink() calls are
+		// just overhead
+		targets->disabled = true;
+		return NULL;
+	}
+
+	if (!targets->table) {
+		targets->table = ZALLOC_ARRAY(struct bftw_target, BFTW_TARGETS_SIZE);
+		if (!targets->table) {
+			targets->disabled = true;
+			return NULL;
+		}
+	}
+
+	const char *target = bftw_readlink(ftwbuf);
+	if (!target) {
+		return NULL;
+	}
+
+	dchar **key = &targets->key;
+	if (target[0] == '/') {
+		if (dstrcpy(key, target) != 0) {
+			return NULL;
+		}
+	} else {
+		if (dstrncpy(key, ftwbuf->path, ftwbuf->nameoff) != 0 || dstrcat(key, target) != 0) {
+			return NULL;
+		}
+	}
+
+	++targets->lookups;
+
+	struct bftw_target *entry = &targets->table[bftw_target_hash(*key) & (BFTW_TARGETS_SIZE - 1)];
+	if (entry->key && strcmp(entry->key, *key) == 0) {
+		++targets->hits;
+		bfs_perf_count(BFS_PERF_TARGETS_CACHED);
+		return entry;
+	}
+
+	if (dstrdcpy(&entry->key, *key) != 0) {
+		dstrfree(entry->key);
+		entry->key = NULL;
+		return NULL;
+	}
+
+	if (bfs_stat_mask(ftwbuf->at_fd, ftwbuf->at_path, flags, ftwbuf->stat_mask, &entry->buf) == 0) {
+		entry->err = 0;
+	} else {
+		entry->err = errno;
+	}
+	return entry;
+}
+
 /** Caching bfs_stat(). */
 static const struct bfs_stat *bftw_stat_impl(struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
 	struct bftw_stat *bufs = &ftwbuf->stat_bufs;
@@ -110,9 +277,23 @@ static const struct bfs_stat *bftw_stat_impl(struct BFTW *ftwbuf, enum bfs_stat_
 		}
 	}
 
+	const struct bftw_target *target = NULL;
+	if (!(flags & BFS_STAT_NOFOLLOW) && ftwbuf->type == BFS_LNK && bufs->targets) {
+		target = bftw_target_stat(ftwbuf, flags);
+	}
+
 	struct bfs_stat *ret;
 	int err;
-	if (bfs_stat(ftwbuf->at_fd, ftwbuf->at_path, flags, buf) == 0) {
+	if (target) {
+		err = target->err;
+		if (err) {
+			ret = NULL;
+			errno = err;
+		} else {
+			ret = buf;
+			*ret = target->buf;
+		}
+	} else if (bfs_stat_mask(ftwbuf->at_fd, ftwbuf->at_path, flags, ftwbuf->stat_mask, buf) == 0) {
 		ret = buf;
 		err = 0;
 #ifdef S_IFWHT
@@ -136,9 +317,10 @@ const struct bfs_stat *bftw_stat(const struct BFTW *ftwbuf, enum bfs_stat_flags
 	const struct bfs_stat *ret;
 
 	if (flags & BFS_STAT_TRYFOLLOW) {
-		ret = bftw_stat_impl(mutbuf, BFS_STAT_FOLLOW);
+		flags &= ~BFS_STAT_TRYFOLLOW;
+		ret = bftw_stat_impl(mutbuf, flags | BFS_STAT_FOLLOW);
 		if (!ret && errno_is_like(ENOENT)) {
-			ret = bftw_stat_impl(mutbuf, BFS_STAT_NOFOLLOW);
+			ret = bftw_stat_impl(mutbuf, flags | BFS_STAT_NOFOLLOW);
 		}
 	} else {
 		ret = bftw_stat_impl(mutbuf, flags);
@@ -165,6 +347,32 @@ const struct bfs_stat *bftw_cached_stat(const struct BFTW *ftwbuf, enum bfs_stat
 	return NULL;
 }
 
+const char *bftw_readlink(const struct BFTW *ftwbuf) {
+	struct bftw_stat *bufs = (struct bftw_stat *)&ftwbuf->stat_bufs;
+
+	if (bufs->link_err == 0) {
+		return *bufs->link_buf;
+	} else if (bufs->link_err > 0) {
+		errno = bufs->link_err;
+		return NULL;
+	}
+
+	// Size the buffer from st_size, but only if we already know it
+	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
+	size_t len = statbuf ? statbuf->size : 0;
+
+	if (dstreadlinkat(bufs->link_buf, ftwbuf->at_fd, ftwbuf->at_path, len) == 0) {
+		bufs->link_err = 0;
+		return *bufs->link_buf;
+	}
+
+	// Don't cache transient allocation failures
+	if (errno != ENOMEM) {
+		bufs->link_err = errno;
+	}
+	return NULL;
+}
+
 enum bfs_type bftw_type(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
 	if (flags & BFS_STAT_NOFOLLOW) {
 		if (ftwbuf->type == BFS_LNK || (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW)) {
@@ -194,10 +402,11 @@ enum bfs_type bftw_type(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
  * A file.
  */
 struct bftw_file {
-	/** The parent directory, if any. */
-	struct bftw_file *parent;
-	/** The root under which this file was found. */
-	struct bftw_file *root;
+	/*
+	 * Hot fields, touched by queue operations and every visit.  These are
+	 * kept together at the start of the struct (and free of padding) so
+	 * that walking the queue touches as few cache lines as possible.
+	 */
 
 	/**
 	 * List node for:
@@ -216,6 +425,40 @@ struct bftw_file {
 	 */
 	struct { struct bftw_file *next; } ready;
 
+	/** The parent directory, if any. */
+	struct bftw_file *parent;
+	/** This file's depth in the walk. */
+	size_t depth;
+
+	/** An open directory for this file, if any. */
+	struct bfs_dir *dir;
+	/** An open descriptor to this file, or -1. */
+	int fd;
+	/** This file's type, if known. */
+	enum bfs_type type;
+	/** Whether this file has a pending ioq request. */
+	bool ioqueued;
+	/** The number of pending ioq requests for a buffered file. */
+	unsigned char ioqops;
+	/** Whether this directory is expected to be large. */
+	bool large;
+	/** Whether this directory was empty (1), not empty (0), or unknown (-1). */
+	signed char empty;
+	/** Whether this directory's ID is in bftw_state::dirs. */
+	bool tracked;
+	/** This directory's priority, for BFTW_BEST. */
+	unsigned char priority;
+	/** Whether this directory is being opened ahead of its visit. */
+	bool prefetch;
+
+	/*
+	 * Cold fields, only needed for cache management, cycle detection, and
+	 * when the ioq has cached stat() info.
+	 */
+
+	/** The root under which this file was found. */
+	struct bftw_file *root;
+
 	/**
 	 * List node for bftw_cache.
 	 */
@@ -224,29 +467,44 @@ struct bftw_file {
 		struct bftw_file *next;
 	} lru;
 
-	/** This file's depth in the walk. */
-	size_t depth;
 	/** Reference count (for ->parent). */
 	size_t refcount;
-
 	/** Pin count (for ->fd). */
 	size_t pincount;
-	/** An open descriptor to this file, or -1. */
-	int fd;
-	/** Whether this file has a pending ioq request. */
-	bool ioqueued;
-	/** An open directory for this file, if any. */
-	struct bfs_dir *dir;
 
-	/** This file's type, if known. */
-	enum bfs_type type;
+	/** The total reported by the callback for this directory's children. */
+	uintmax_t usage;
+	/** The callback's saved state for this directory's children. */
+	uint64_t cookie;
+	/** The callback's saved pointer for this directory's children. */
+	void *data;
+
 	/** The device number, for cycle detection. */
 	dev_t dev;
-	/** The inode number, for cycle detection. */
+	/** The inode number, for cycle detection (or a hint from readdir()). */
 	ino_t ino;
+	/** The file system type of this directory, once it's been looked up. */
+	const char *fstype;
 
 	/** Cached bfs_stat() info. */
-	struct bftw_stat stat_bufs;
+	struct bftw_packed_stat stat_bufs;
+	/** Checks that were done ahead of time. */
+	struct bfs_fsade_probe fsade;
+	/** The link target read ahead of time (BFTW_READLINK), if any. */
+	char *link;
+	/** The cached readlink() error. */
+	int link_err;
+	/** A cached listing of this directory, if any. */
+	struct bftw_listing *listing;
+	/** A file handle saved when this directory was evicted, if any. */
+	struct file_handle *handle;
+	/** The mount ID that goes with the handle. */
+	int mount_id;
+
+	/*
+	 * The name is last, since it's a flexible array member.  Path building
+	 * and sorting are the only hot users.
+	 */
 
 	/** The offset of this file in the full path. */
 	size_t nameoff;
@@ -276,6 +534,10 @@ enum bftw_qflags {
 	BFTW_QLIFO    = 1 << 2,
 	/** Maintain a strict order. */
 	BFTW_QORDER   = 1 << 3,
+	/** Service files in inode number order (requires BFTW_QBUFFER | BFTW_QORDER). */
+	BFTW_QINODE   = 1 << 4,
+	/** Service files in priority order (incompatible with the others, except BFTW_QBALANCE). */
+	BFTW_QPRIORITY = 1 << 5,
 };
 
 /**
@@ -349,6 +611,12 @@ enum bftw_qflags {
  *     ready:   ║ 𝕒 ║ 𝕓 ║ 𝕔 ║ 𝕕 ║ 𝓮 ║ 𝕗 ║ g ║ h ║ i ║
  *              ╚═══╩═══╩═══╩═══╩═══╩═══╩═══╩═══╩═══╝
  *
+ * If BFTW_QINODE is also set, the buffer is sorted by inode number after it is
+ * added to the ready list, but before it is added to the waiting list.  Files
+ * are still popped in the same order, but serviced in inode order, which is
+ * much friendlier to rotational storage.  The next ready file may then be
+ * stuck behind others on the waiting list, which bftw_pop() takes care of.
+ *
  * If BFTW_QBALANCE is set, queue->imbalance tracks the delta between async
  * service (negative) and synchronous service (positive).  The queue is
  * considered "balanced" when this number is non-negative.  Only a balanced
@@ -358,6 +626,15 @@ enum bftw_qflags {
  * BFTW_QBALANCE is only set for single-threaded ioqs.  When an ioq has multiple
  * threads, it is faster to wait for the ioq to complete an operation than it is
  * to perform it on the main thread.
+ *
+ * If BFTW_QPRIORITY is set, the waiting list is a bucket queue: files are kept
+ * sorted by file->priority (and in FIFO order within a priority), and
+ * queue->cursors[i] points to the end of the files with priority i.  Pushing a
+ * file just inserts it at its cursor, so every operation is still O(1).  The
+ * ready list is kept sorted the same way (with queue->ready_cursors), and
+ * bftw_pop() waits for files in-service rather than popping a worse one that
+ * happened to finish first.  BFTW_QORDER works as usual, since both lists are
+ * still in the same order.
  */
 struct bftw_queue {
 	/** Queue flags. */
@@ -374,8 +651,205 @@ struct bftw_queue {
 	size_t ioqueued;
 	/** Tracks the imbalance between synchronous and async service. */
 	unsigned long imbalance;
+	/** The waiting list insertion points for each priority, for BFTW_QPRIORITY. */
+	struct bftw_file **cursors[BFTW_PRIORITIES];
+	/** The ready list insertion points for each priority, for BFTW_QPRIORITY. */
+	struct bftw_file **ready_cursors[BFTW_PRIORITIES];
+	/** The number of files in-service at each priority, for BFTW_QPRIORITY. */
+	size_t inservice[BFTW_PRIORITIES];
+};
+
+/** A comparison function for bftw_list_sort(). */
+typedef int bftw_cmp_fn(const struct bftw_file *a, const struct bftw_file *b);
+
+/** Compare files by name. */
+static int bftw_name_cmp(const struct bftw_file *a, const struct bftw_file *b) {
+	return strcoll(a->name, b->name);
+}
+
+/** Compare files by inode number. */
+static int bftw_ino_cmp(const struct bftw_file *a, const struct bftw_file *b) {
+	return (a->ino > b->ino) - (a->ino < b->ino);
+}
+
+/** Sort a bftw_list (stably). */
+static void bftw_list_sort(struct bftw_list *list, bftw_cmp_fn *cmp) {
+	if (!list->head || !list->head->next) {
+		return;
+	}
+
+	struct bftw_list left, right;
+	SLIST_INIT(&left);
+	SLIST_INIT(&right);
+
+	// Split
+	for (struct bftw_file *hare = list->head; hare && (hare = hare->next); hare = hare->next) {
+		struct bftw_file *tortoise = SLIST_POP(list);
+		SLIST_APPEND(&left, tortoise);
+	}
+	SLIST_EXTEND(&right, list);
+
+	// Recurse
+	bftw_list_sort(&left, cmp);
+	bftw_list_sort(&right, cmp);
+
+	// Merge
+	while (!SLIST_EMPTY(&left) && !SLIST_EMPTY(&right)) {
+		struct bftw_file *lf = left.head;
+		struct bftw_file *rf = right.head;
+
+		if (cmp(lf, rf) <= 0) {
+			SLIST_POP(&left);
+			SLIST_APPEND(list, lf);
+		} else {
+			SLIST_POP(&right);
+			SLIST_APPEND(list, rf);
+		}
+	}
+	SLIST_EXTEND(list, &left);
+	SLIST_EXTEND(list, &right);
+}
+
+/** A collation key for bftw_name_sort(). */
+struct bftw_sortkey {
+	/** The first 8 bytes of the key, big-endian, for fast comparisons. */
+	uint64_t prefix;
+	/** The whole key. */
+	const char *key;
+	/** The file itself. */
+	struct bftw_file *file;
+	/** The original position of the file, for stability. */
+	size_t index;
 };
 
+/** Load the prefix of a collation key. */
+static uint64_t bftw_key_prefix(const char *key) {
+	uint64_t prefix = 0;
+	for (size_t i = 0; i < 8; ++i) {
+		unsigned char c = key[i];
+		prefix |= (uint64_t)c << (56 - 8 * i);
+		if (!c) {
+			break;
+		}
+	}
+	return prefix;
+}
+
+/** Compare collation keys. */
+static int bftw_sortkey_cmp(const void *a, const void *b) {
+	const struct bftw_sortkey *x = a;
+	const struct bftw_sortkey *y = b;
+
+	if (x->prefix != y->prefix) {
+		return x->prefix < y->prefix ? -1 : 1;
+	}
+
+	int ret = strcmp(x->key, y->key);
+	if (ret == 0) {
+		ret = (x->index > y->index) - (x->index < y->index);
+	}
+	return ret;
+}
+
+/** Check whether strcoll() is just strcmp(). */
+static bool bftw_bytewise_collation(void) {
+	const char *name = setlocale(LC_COLLATE, NULL);
+	return !name || strcmp(name, "C") == 0 || strcmp(name, "POSIX") == 0;
+}
+
+/**
+ * Sort a bftw_list by name (stably).  Rather than calling strcoll() for every
+ * comparison, this computes each strxfrm() key once, and sorts an array of key
+ * prefixes before relinking the list.
+ */
+static void bftw_name_sort(struct bftw_list *list) {
+	size_t n = 0;
+	for_slist (struct bftw_file, file, list) {
+		++n;
+	}
+	if (n < 2) {
+		return;
+	}
+
+	struct bftw_sortkey *keys = ALLOC_ARRAY(struct bftw_sortkey, n);
+	if (!keys) {
+		goto fallback;
+	}
+
+	// In the C locale, the names are their own keys
+	bool bytewise = bftw_bytewise_collation();
+	char *buf = NULL;
+	size_t cap = 0, len = 0;
+	if (!bytewise) {
+		cap = 256;
+		buf = ALLOC_ARRAY(char, cap);
+		if (!buf) {
+			free(keys);
+			goto fallback;
+		}
+	}
+
+	size_t i = 0;
+	for_slist (struct bftw_file, file, list) {
+		struct bftw_sortkey *key = &keys[i];
+		key->file = file;
+		key->index = i++;
+
+		if (bytewise) {
+			key->key = file->name;
+			continue;
+		}
+
+		while (true) {
+			size_t ret = strxfrm(buf + len, file->name, cap - len);
+			if (ret < cap - len) {
+				// Store the offset until the buffer stops moving
+				key->prefix = len;
+				len += ret + 1;
+				break;
+			}
+
+			size_t size = len + ret + 1;
+			size_t new_cap = cap;
+			while (new_cap < size) {
+				new_cap *= 2;
+			}
+			char *new_buf = REALLOC_ARRAY(char, buf, cap, new_cap);
+			if (!new_buf) {
+				free(buf);
+				free(keys);
+				goto fallback;
+			}
+			buf = new_buf;
+			cap = new_cap;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		struct bftw_sortkey *key = &keys[i];
+		if (!bytewise) {
+			key->key = buf + key->prefix;
+		}
+		key->prefix = bftw_key_prefix(key->key);
+	}
+
+	qsort(keys, n, sizeof(*keys), bftw_sortkey_cmp);
+
+	SLIST_INIT(list);
+	for (i = 0; i < n; ++i) {
+		struct bftw_file *file = keys[i].file;
+		file->next = NULL;
+		SLIST_APPEND(list, file);
+	}
+
+	free(buf);
+	free(keys);
+	return;
+
+fallback:
+	bftw_list_sort(list, bftw_name_cmp);
+}
+
 /** Initialize a queue. */
 static void bftw_queue_init(struct bftw_queue *queue, enum bftw_qflags flags) {
 	queue->flags = flags;
@@ -385,12 +859,72 @@ static void bftw_queue_init(struct bftw_queue *queue, enum bftw_qflags flags) {
 	queue->size = 0;
 	queue->ioqueued = 0;
 	queue->imbalance = 0;
+	for (size_t i = 0; i < BFTW_PRIORITIES; ++i) {
+		queue->cursors[i] = &queue->waiting.head;
+		queue->ready_cursors[i] = &queue->ready.head;
+		queue->inservice[i] = 0;
+	}
+}
+
+/** Update bucket cursors after inserting a file at cursors[prio]. */
+static void bftw_cursors_insert(struct bftw_file ***cursors, size_t prio, struct bftw_file **next) {
+	// Empty buckets after this one now start after this file too
+	struct bftw_file **cursor = cursors[prio];
+	for (size_t i = prio; i < BFTW_PRIORITIES && cursors[i] == cursor; ++i) {
+		cursors[i] = next;
+	}
+}
+
+/** Update bucket cursors after popping the head of their list. */
+static void bftw_cursors_pop(struct bftw_file ***cursors, struct bftw_file **next, struct bftw_file **head) {
+	for (size_t i = 0; i < BFTW_PRIORITIES; ++i) {
+		if (cursors[i] == next) {
+			cursors[i] = head;
+		}
+	}
+}
+
+/** Insert a file into the waiting list by priority. */
+static void bftw_queue_prioritize(struct bftw_queue *queue, struct bftw_file *file) {
+	size_t prio = file->priority;
+	struct bftw_file **next = SLIST_INSERT(&queue->waiting, queue->cursors[prio], file);
+	bftw_cursors_insert(queue->cursors, prio, next);
+}
+
+/** Insert a file into the ready list by priority. */
+static void bftw_queue_prioritize_ready(struct bftw_queue *queue, struct bftw_file *file) {
+	size_t prio = file->priority;
+	struct bftw_file **next = SLIST_INSERT(&queue->ready, queue->ready_cursors[prio], file, ready);
+	bftw_cursors_insert(queue->ready_cursors, prio, next);
+}
+
+/** Pop the head of the waiting list. */
+static struct bftw_file *bftw_queue_pop_waiting(struct bftw_queue *queue) {
+	struct bftw_file *file = SLIST_POP(&queue->waiting);
+	if (file && (queue->flags & BFTW_QPRIORITY)) {
+		bftw_cursors_pop(queue->cursors, &file->next, &queue->waiting.head);
+	}
+	return file;
+}
+
+/** Pop the head of the ready list. */
+static struct bftw_file *bftw_queue_pop_ready(struct bftw_queue *queue) {
+	struct bftw_file *file = SLIST_POP(&queue->ready, ready);
+	if (file && (queue->flags & BFTW_QPRIORITY)) {
+		bftw_cursors_pop(queue->ready_cursors, &file->ready.next, &queue->ready.head);
+	}
+	return file;
 }
 
 /** Add a file to the queue. */
 static void bftw_queue_push(struct bftw_queue *queue, struct bftw_file *file) {
 	if (queue->flags & BFTW_QBUFFER) {
 		SLIST_APPEND(&queue->buffer, file);
+	} else if (queue->flags & BFTW_QPRIORITY) {
+		bftw_queue_prioritize(queue, file);
+		if (queue->flags & BFTW_QORDER) {
+			bftw_queue_prioritize_ready(queue, file);
+		}
 	} else if (queue->flags & BFTW_QLIFO) {
 		SLIST_PREPEND(&queue->waiting, file);
 		if (queue->flags & BFTW_QORDER) {
@@ -423,6 +957,10 @@ static void bftw_queue_flush(struct bftw_queue *queue) {
 		}
 	}
 
+	if (queue->flags & BFTW_QINODE) {
+		bftw_list_sort(&queue->buffer, bftw_ino_cmp);
+	}
+
 	if (queue->flags & BFTW_QLIFO) {
 		SLIST_EXTEND(&queue->buffer, &queue->waiting);
 	}
@@ -458,7 +996,7 @@ static void bftw_queue_detach(struct bftw_queue *queue, struct bftw_file *file,
 		bfs_assert(!(queue->flags & BFTW_QORDER));
 		SLIST_POP(&queue->buffer);
 	} else if (file == SLIST_HEAD(&queue->waiting)) {
-		SLIST_POP(&queue->waiting);
+		bftw_queue_pop_waiting(queue);
 	} else {
 		bfs_bug("Detached file was not buffered or waiting");
 	}
@@ -466,6 +1004,7 @@ static void bftw_queue_detach(struct bftw_queue *queue, struct bftw_file *file,
 	if (async) {
 		file->ioqueued = true;
 		++queue->ioqueued;
+		++queue->inservice[file->priority];
 		bftw_queue_rebalance(queue, true);
 	}
 }
@@ -476,11 +1015,16 @@ static void bftw_queue_attach(struct bftw_queue *queue, struct bftw_file *file,
 		bfs_assert(file->ioqueued);
 		file->ioqueued = false;
 		--queue->ioqueued;
+		--queue->inservice[file->priority];
 	} else {
 		bfs_assert(!file->ioqueued);
 	}
 
-	if (!(queue->flags & BFTW_QORDER)) {
+	if (queue->flags & BFTW_QORDER) {
+		// Already on the ready list
+	} else if (queue->flags & BFTW_QPRIORITY) {
+		bftw_queue_prioritize_ready(queue, file);
+	} else {
 		SLIST_APPEND(&queue->ready, file, ready);
 	}
 }
@@ -521,26 +1065,81 @@ static struct bftw_file *bftw_queue_ready(const struct bftw_queue *queue) {
 	return SLIST_HEAD(&queue->ready);
 }
 
-/** Pop a file from the queue. */
-static struct bftw_file *bftw_queue_pop(struct bftw_queue *queue) {
-	// Don't pop until we've had a chance to sort the buffer
-	bfs_assert(SLIST_EMPTY(&queue->buffer));
+/** Check if the next ready file is stuck behind other waiting files. */
+static bool bftw_queue_blocked(const struct bftw_queue *queue) {
+	if (!(queue->flags & BFTW_QINODE)) {
+		return false;
+	}
 
-	struct bftw_file *file = SLIST_POP(&queue->ready, ready);
+	struct bftw_file *file = SLIST_HEAD(&queue->ready);
+	return file
+		&& file != SLIST_HEAD(&queue->waiting)
+		&& SLIST_ATTACHED(&queue->waiting, file);
+}
 
-	if (!file || file == SLIST_HEAD(&queue->waiting)) {
-		// If no files are ready, try the waiting list.  Or, if
-		// BFTW_QORDER is set, we may need to pop from both lists.
-		file = SLIST_POP(&queue->waiting);
+/** Check if a better file than the next one to pop is still in-service. */
+static bool bftw_queue_preempted(const struct bftw_queue *queue) {
+	if ((queue->flags & (BFTW_QPRIORITY | BFTW_QORDER)) != BFTW_QPRIORITY) {
+		return false;
 	}
 
-	if (file) {
-		--queue->size;
+	// bftw_queue_pop() takes the better of the next ready and waiting
+	// files.  The waiting one would be serviced synchronously, so it could
+	// also jump ahead of a better file that the ioq hasn't finished yet.
+	const struct bftw_file *file = SLIST_HEAD(&queue->ready);
+	const struct bftw_file *waiting = SLIST_HEAD(&queue->waiting);
+	if (!file || (waiting && waiting->priority < file->priority)) {
+		file = waiting;
+	}
+	if (!file) {
+		return false;
 	}
 
-	return file;
-}
-
+	for (size_t i = 0; i < file->priority; ++i) {
+		if (queue->inservice[i] > 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Pop a file from the queue. */
+static struct bftw_file *bftw_queue_pop(struct bftw_queue *queue) {
+	// Don't pop until we've had a chance to sort the buffer
+	bfs_assert(SLIST_EMPTY(&queue->buffer));
+
+	struct bftw_file *file = SLIST_HEAD(&queue->ready);
+	struct bftw_file *waiting = SLIST_HEAD(&queue->waiting);
+	bool prio = queue->flags & BFTW_QPRIORITY;
+	if (prio && file && waiting && waiting->priority < file->priority) {
+		// Files that finished early can't jump ahead of better ones
+		file = NULL;
+	}
+
+	if (file) {
+		bftw_queue_pop_ready(queue);
+	}
+
+	if (!file || file == waiting) {
+		// If no files are ready, try the waiting list.  Or, if
+		// BFTW_QORDER is set, we may need to pop from both lists.
+		file = bftw_queue_pop_waiting(queue);
+	}
+
+	if (file) {
+		--queue->size;
+	}
+
+	return file;
+}
+
+/**
+ * The size of the buffers for link targets read ahead of time.  Longer targets
+ * are read again when the link is visited.
+ */
+#define BFTW_LINK_SIZE 256
+
 /**
  * A cache of open directories.
  */
@@ -561,13 +1160,26 @@ struct bftw_cache {
 	struct arena dirs;
 	/** Remaining bfs_dir capacity. */
 	int dir_limit;
+	/** The most bfs_dirs in use at once since the arena was last trimmed. */
+	size_t dir_peak;
+	/** The number of bfs_dirs freed since the arena was last trimmed. */
+	size_t dir_frees;
 
-	/** bfs_stat arena. */
+	/** bfs_stat arena, for stat() calls in flight. */
 	struct arena stat_bufs;
+	/** bfs_packed_stat arena, for buffered files. */
+	struct varena packed_stats;
+	/** Digest arena, for BFS_CHECK_HASH. */
+	struct arena digests;
+	/** Link target arena, for BFTW_READLINK. */
+	struct arena links;
+
+	/** Whether to save file handles for evicted directories. */
+	bool handles;
 };
 
 /** Initialize a cache. */
-static void bftw_cache_init(struct bftw_cache *cache, size_t capacity) {
+static void bftw_cache_init(struct bftw_cache *cache, size_t capacity, size_t dir_memory) {
 	LIST_INIT(cache);
 	cache->target = NULL;
 	cache->capacity = capacity;
@@ -576,13 +1188,29 @@ static void bftw_cache_init(struct bftw_cache *cache, size_t capacity) {
 
 	bfs_dir_arena(&cache->dirs);
 
-	if (cache->capacity > 1024) {
-		cache->dir_limit = 1024;
-	} else {
-		cache->dir_limit = capacity - 1;
+	size_t dir_limit = 1024;
+	if (dir_limit > capacity - 1) {
+		dir_limit = capacity - 1;
 	}
+	if (dir_memory) {
+		size_t max = dir_memory / cache->dirs.size;
+		if (max < 1) {
+			max = 1;
+		}
+		if (dir_limit > max) {
+			dir_limit = max;
+		}
+	}
+	cache->dir_limit = dir_limit;
+	cache->dir_peak = 0;
+	cache->dir_frees = 0;
 
 	ARENA_INIT(&cache->stat_bufs, struct bfs_stat);
+	VARENA_INIT(&cache->packed_stats, struct bfs_packed_stat, data);
+	ARENA_INIT(&cache->digests, unsigned char[BFS_HASH_MAX]);
+	ARENA_INIT(&cache->links, char[BFTW_LINK_SIZE]);
+
+	cache->handles = BFS_HAS_NAME_TO_HANDLE_AT;
 }
 
 /** Allocate a directory. */
@@ -595,14 +1223,32 @@ static struct bfs_dir *bftw_allocdir(struct bftw_cache *cache, bool force) {
 	struct bfs_dir *dir = arena_alloc(&cache->dirs);
 	if (dir) {
 		--cache->dir_limit;
+		if (cache->dir_peak < cache->dirs.live) {
+			cache->dir_peak = cache->dirs.live;
+		}
 	}
 	return dir;
 }
 
+/**
+ * The number of directories to close between checks for idle bfs_dirs.
+ */
+#define BFTW_DIR_TRIM_INTERVAL 1024
+
 /** Free a directory. */
 static void bftw_freedir(struct bftw_cache *cache, struct bfs_dir *dir) {
 	++cache->dir_limit;
 	arena_free(&cache->dirs, dir);
+
+	// The pool grows to cover as many bfs_dirs as are in use at once (e.g.
+	// by the ioq), but once they've sat idle for a while, their memory is
+	// given back until the peak of the last interval
+	if (++cache->dir_frees >= BFTW_DIR_TRIM_INTERVAL) {
+		size_t live = cache->dirs.live;
+		arena_trim(&cache->dirs, cache->dir_peak - live);
+		cache->dir_peak = live;
+		cache->dir_frees = 0;
+	}
 }
 
 /** Remove a bftw_file from the LRU list. */
@@ -637,6 +1283,47 @@ static void bftw_file_close(struct bftw_cache *cache, struct bftw_file *file) {
 	bftw_cache_remove(cache, file);
 }
 
+/** Save a file handle for a directory, so it can be reopened without its path. */
+static void bftw_save_handle(struct bftw_cache *cache, struct bftw_file *file) {
+#if BFS_HAS_NAME_TO_HANDLE_AT
+	if (!cache->handles || file->handle) {
+		return;
+	}
+
+	struct {
+		struct file_handle fh;
+		unsigned char buf[MAX_HANDLE_SZ];
+	} storage;
+	struct file_handle *fh = &storage.fh;
+	fh->handle_bytes = MAX_HANDLE_SZ;
+
+	int error = errno;
+	int mount_id;
+	if (name_to_handle_at(file->fd, "", fh, &mount_id, AT_EMPTY_PATH) != 0) {
+		if (errno_is_like(ENOSYS)) {
+			cache->handles = false;
+		}
+		// Otherwise (e.g. EOPNOTSUPP), just fall back to the path
+		errno = error;
+		return;
+	}
+
+	size_t size = sizeof_flex(struct file_handle, f_handle, fh->handle_bytes);
+	file->handle = ALLOC_FLEX(struct file_handle, f_handle, fh->handle_bytes);
+	if (file->handle) {
+		memcpy(file->handle, fh, size);
+		file->mount_id = mount_id;
+	}
+	errno = error;
+#endif
+}
+
+/** Forget a directory's saved file handle. */
+static void bftw_drop_handle(struct bftw_file *file) {
+	free(file->handle);
+	file->handle = NULL;
+}
+
 /** Pop the least recently used directory from the cache. */
 static int bftw_cache_pop(struct bftw_cache *cache) {
 	struct bftw_file *file = cache->tail;
@@ -644,6 +1331,12 @@ static int bftw_cache_pop(struct bftw_cache *cache) {
 		return -1;
 	}
 
+	// Directories right below a root are cheap to reopen by name, since the
+	// roots are kept open if possible
+	if (file->depth >= 2) {
+		bftw_save_handle(cache, file);
+	}
+
 	bftw_file_close(cache, file);
 	return 0;
 }
@@ -710,14 +1403,16 @@ static void bftw_cache_destroy(struct bftw_cache *cache) {
 	bfs_assert(LIST_EMPTY(cache));
 	bfs_assert(!cache->target);
 
+	arena_destroy(&cache->links);
+	arena_destroy(&cache->digests);
 	arena_destroy(&cache->stat_bufs);
+	varena_destroy(&cache->packed_stats);
 	arena_destroy(&cache->dirs);
 	varena_destroy(&cache->files);
 }
 
 /** Create a new bftw_file. */
-static struct bftw_file *bftw_file_new(struct bftw_cache *cache, struct bftw_file *parent, const char *name) {
-	size_t namelen = strlen(name);
+static struct bftw_file *bftw_file_new(struct bftw_cache *cache, struct bftw_file *parent, const char *name, size_t namelen) {
 	struct bftw_file *file = varena_alloc(&cache->files, namelen + 1);
 	if (!file) {
 		return NULL;
@@ -744,13 +1439,28 @@ static struct bftw_file *bftw_file_new(struct bftw_cache *cache, struct bftw_fil
 	file->pincount = 0;
 	file->fd = -1;
 	file->ioqueued = false;
+	file->ioqops = 0;
+	file->large = false;
+	file->empty = -1;
+	file->usage = 0;
+	file->cookie = 0;
+	file->data = NULL;
+	file->tracked = false;
+	file->priority = 0;
+	file->prefetch = false;
 	file->dir = NULL;
+	file->listing = NULL;
+	file->handle = NULL;
 
 	file->type = BFS_UNKNOWN;
 	file->dev = -1;
 	file->ino = -1;
+	file->fstype = NULL;
 
-	bftw_stat_init(&file->stat_bufs, NULL, NULL);
+	bftw_packed_init(&file->stat_bufs);
+	file->fsade = (struct bfs_fsade_probe){0};
+	file->link = NULL;
+	file->link_err = -1;
 
 	file->namelen = namelen;
 	memcpy(file->name, name, namelen + 1);
@@ -771,19 +1481,71 @@ static void bftw_file_set_dir(struct bftw_cache *cache, struct bftw_file *file,
 	}
 }
 
-/** Free a file's cached stat() buffers. */
+/** Free a packed stat() buffer. */
+static void bftw_packed_free(struct bftw_cache *cache, struct bfs_packed_stat *buf) {
+	varena_free(&cache->packed_stats, buf, bfs_stat_packed_size(buf->mask));
+}
+
+/** Free a file's cached stat() and readlink() buffers. */
 static void bftw_stat_recycle(struct bftw_cache *cache, struct bftw_file *file) {
-	struct bftw_stat *bufs = &file->stat_bufs;
+	struct bftw_packed_stat *packed = &file->stat_bufs;
+
+	if (packed->stat_buf) {
+		bftw_packed_free(cache, packed->stat_buf);
+	}
+	if (packed->lstat_buf && packed->lstat_buf != packed->stat_buf) {
+		bftw_packed_free(cache, packed->lstat_buf);
+	}
+
+	bftw_packed_init(packed);
 
-	struct bfs_stat *stat_buf = (struct bfs_stat *)bufs->stat_buf;
-	struct bfs_stat *lstat_buf = (struct bfs_stat *)bufs->lstat_buf;
-	if (stat_buf) {
-		arena_free(&cache->stat_bufs, stat_buf);
-	} else if (lstat_buf) {
-		arena_free(&cache->stat_bufs, lstat_buf);
+	if (file->link) {
+		arena_free(&cache->links, file->link);
+		file->link = NULL;
 	}
+	file->link_err = -1;
+}
+
+/**
+ * An entry in a cached directory listing (its name is stored separately).
+ */
+struct bftw_listing_entry {
+	/** The inode number hint from readdir(). */
+	ino_t ino;
+	/** The length of the name (excluding the NUL terminator). */
+	size_t namelen;
+	/** The file type hint from readdir(). */
+	enum bfs_type type;
+};
 
-	bftw_stat_init(bufs, NULL, NULL);
+/**
+ * A cached directory listing, so later passes of an iterative or exponential
+ * deepening search don't have to read the same directory again.
+ */
+struct bftw_listing {
+	/** The trie leaf for this listing's path, or NULL once it's evicted. */
+	struct trie_leaf *leaf;
+	/** List node for bftw_listings. */
+	struct bftw_listing *prev, *next;
+	/** Reference count (for the cache and bftw_file::listing). */
+	size_t refcount;
+	/** The size of this allocation. */
+	size_t size;
+	/** The names of the entries, each NUL-terminated. */
+	char *names;
+	/** The number of entries. */
+	size_t count;
+	/** The entries themselves. */
+	struct bftw_listing_entry entries[];
+};
+
+/** Release a reference to a cached listing. */
+static void bftw_listing_unref(struct bftw_listing *listing) {
+	bfs_assert(listing->refcount > 0);
+	if (--listing->refcount == 0) {
+		bfs_assert(!listing->leaf);
+		free(listing);
+	}
 }
 
 /** Free a bftw_file. */
@@ -794,11 +1556,122 @@ static void bftw_file_free(struct bftw_cache *cache, struct bftw_file *file) {
 		bftw_file_close(cache, file);
 	}
 
+	if (file->listing) {
+		bftw_listing_unref(file->listing);
+	}
+
+	bftw_drop_handle(file);
 	bftw_stat_recycle(cache, file);
 
+	if (file->fsade.digest) {
+		arena_free(&cache->digests, file->fsade.digest);
+	}
+
 	varena_free(&cache->files, file, file->namelen + 1);
 }
 
+/**
+ * A sorted run of files, for sorting directories too big to hold in memory.
+ */
+struct bftw_run {
+	/** The next file from this run, or NULL if it's exhausted. */
+	struct bftw_file *head;
+	/** The rest of an in-memory run. */
+	struct bftw_list list;
+	/** The offset of the next spilled record. */
+	off_t offset;
+	/** The end of this run in the temporary file. */
+	off_t end;
+	/** A buffer for reading records. */
+	char *buf;
+	/** The capacity of buf. */
+	size_t cap;
+	/** The position of the next record in buf. */
+	size_t pos;
+	/** The number of bytes in buf. */
+	size_t len;
+};
+
+/**
+ * The header of a file record in a spilled run (followed by its name).
+ */
+struct bftw_run_rec {
+	/** The inode number hint from readdir(). */
+	ino_t ino;
+	/** The length of the name (excluding the NUL terminator). */
+	size_t namelen;
+	/** The file type hint from readdir(). */
+	enum bfs_type type;
+};
+
+/**
+ * External sorting state.  With BFTW_SORT, every file in a directory is
+ * buffered so it can be sorted before it is visited.  Once more than `limit`
+ * files are buffered, they are sorted and spilled to a temporary file as a run
+ * instead.  When the directory is closed, the runs are merged back together,
+ * and the files are added to the queue a batch at a time.
+ */
+struct bftw_runs {
+	/** The maximum number of files to sort in memory (0 for unlimited). */
+	size_t limit;
+	/** The number of files in the buffer. */
+	size_t buffered;
+	/** The parent directory of the files being sorted (with a reference). */
+	struct bftw_file *parent;
+
+	/** The temporary file descriptor, or -1. */
+	int fd;
+	/** The size of the temporary file. */
+	off_t size;
+	/** A buffer for writing records. */
+	char *wbuf;
+	/** The number of bytes in wbuf. */
+	size_t wlen;
+
+	/** The runs being merged. */
+	struct bftw_run *runs;
+	/** The number of runs. */
+	size_t nruns;
+	/** A min-heap of the indices of unexhausted runs. */
+	size_t *heap;
+	/** The number of unexhausted runs. */
+	size_t nheap;
+};
+
+/**
+ * Directory listings saved between the passes of BFTW_IDS and BFTW_EDS, which
+ * would otherwise read every shallow directory again on each pass.  Listings
+ * are keyed by path, and evicted in LRU order to stay under the memory limit.
+ */
+struct bftw_listings {
+	/** The most memory to use for listings (0 to disable the cache). */
+	size_t limit;
+	/** The memory currently used. */
+	size_t size;
+	/** Maps paths to listings. */
+	struct trie trie;
+	/** The cached listings, from most to least recently used. */
+	struct bftw_listing *head, *tail;
+
+	/** Whether the current directory's listing is being recorded. */
+	bool recording;
+	/** The path of the directory being recorded. */
+	dchar *key;
+	/** The entries recorded so far. */
+	struct bftw_listing_entry *entries;
+	/** The number of recorded entries. */
+	size_t count;
+	/** The recorded names. */
+	dchar *names;
+
+	/** The listing being replayed instead of reading the directory, if any. */
+	struct bftw_listing *replay;
+	/** The index of the next entry to replay. */
+	size_t pos;
+	/** The offset of the next name to replay. */
+	size_t namepos;
+};
+
 /**
  * Holds the current state of the bftw() traversal.
  */
@@ -807,22 +1680,119 @@ struct bftw_state {
 	const char **paths;
 	/** The number of starting paths. */
 	size_t npaths;
+	/** The depths of the starting paths, if resuming from a checkpoint. */
+	const size_t *depths;
+	/** Streams more starting paths, until they run out. */
+	bftw_next_path *next_path;
 	/** bftw() callback. */
 	bftw_callback *callback;
 	/** bftw() callback data. */
 	void *ptr;
+	/** bftw() entry filter. */
+	bftw_filter *filter;
+	/** bftw() stat() hint. */
+	bftw_stat_hint *stat_hint;
+	/** bftw() directory priorities, for BFTW_BEST. */
+	bftw_priority *priority;
 	/** bftw() flags. */
 	enum bftw_flags flags;
 	/** Search strategy. */
 	enum bftw_strategy strategy;
+	/** The cutoff for BFTW_SKIP_STALE. */
+	struct timespec stale_time;
+	/** The shared symlink targets, for BFTW_SHARE_TARGETS. */
+	struct bftw_targets targets;
 	/** The mount table. */
 	const struct bfs_mtab *mtab;
 	/** bfs_opendir() flags. */
 	enum bfs_dir_flags dir_flags;
+	/** bfs_stat() fields. */
+	enum bfs_stat_field stat_mask;
+	/** Checks to do ahead of time. */
+	enum bfs_fsade_check fsade_checks;
+	/** The xattr name for BFS_CHECK_XATTR_NAMED. */
+	const char *fsade_xattr;
+	/** The hash algorithm for BFS_CHECK_HASH. */
+	enum bfs_hash_algo fsade_hash;
+	/** The content search for BFS_CHECK_GREP. */
+	const struct bfs_grep *fsade_grep;
+
+	/** The maximum size of the breadth-first frontier, or 0 for unlimited. */
+	size_t frontier;
+	/** The number of times the frontier limit was hit. */
+	size_t spills;
+	/** Where to report the spill count, if anywhere. */
+	size_t *spills_out;
+	/** Where to report progress, if anywhere. */
+	struct bftw_progress *progress;
+
+	/** The checkpoint function, if any. */
+	bftw_checkpoint *checkpoint;
+	/** The time between checkpoints. */
+	uint64_t checkpoint_interval;
+	/** When the next checkpoint is due. */
+	uint64_t checkpoint_next;
+
+	/** Sorted runs, for directories too big to sort in memory. */
+	struct bftw_runs runs;
+	/** Cached directory listings, for iterative/exponential deepening. */
+	struct bftw_listings listings;
+
+	/** The target number of directories to open asynchronously at once. */
+	size_t lookahead;
+	/** The minimum lookahead. */
+	size_t lookahead_min;
+	/** The maximum lookahead. */
+	size_t lookahead_max;
+	/** The number of directories popped since the ioq last fell behind. */
+	size_t lookahead_hits;
+	/** The number of directories being opened ahead of their visit. */
+	size_t prefetching;
+
+	/** The ioq's current in-flight limit. */
+	size_t depth;
+	/** The minimum in-flight limit. */
+	size_t depth_min;
+	/** The maximum in-flight limit. */
+	size_t depth_max;
+	/** The number of full batches popped since the ioq last fell behind. */
+	size_t depth_hits;
+
+	/** Per-file-system I/O limits. */
+	const struct bftw_fslimit *fslimits;
+	/** The number of fslimits. */
+	size_t nfslimits;
+	/** The number of in-flight requests for each fslimit. */
+	size_t *fsinflight;
+	/** The I/O throttle, if any. */
+	struct bfs_throttle *throttle;
+	/** The bulk-loaded inode attributes of the current root's file system (BFTW_BULKSTAT). */
+	struct bfs_bulkstat *bulkstat;
+	/** Storage for attributes found in the bulkstat table. */
+	struct bfs_stat bulkstat_buf;
+	/** The most recently classified device. */
+	dev_t fsdev;
+	/** The fslimit index for fsdev (SIZE_MAX for none). */
+	size_t fsindex;
+	/** File system types where stats may use cached attributes. */
+	char *const *stat_cache;
+	/** The number of stat_cache types. */
+	size_t nstat_cache;
+	/** The most recently checked device for stat_cache. */
+	dev_t syncdev;
+	/** Whether syncdev is on a stat_cache file system. */
+	bool nosync;
 
 	/** The appropriate errno value, if any. */
 	int error;
 
+	/**
+	 * The IDs of every live directory, for cycle detection.  Every file's
+	 * ancestors are live, so a miss here rules out a cycle without walking
+	 * up the tree.
+	 */
+	struct idset dirs;
+
 	/** The cache of open directories. */
 	struct bftw_cache cache;
 
@@ -830,6 +1800,14 @@ struct bftw_state {
 	struct ioq *ioq;
 	/** The number of I/O threads. */
 	size_t nthreads;
+	/** The number of active I/O threads (see BFTW_AUTO_THREADS). */
+	size_t active;
+	/** When the active threads were last tuned. */
+	uint64_t tune_time;
+	/** ioq_idle_time() as of tune_time. */
+	uint64_t tune_idle;
+	/** The time spent waiting for the ioq since tune_time. */
+	uint64_t tune_stalled;
 
 	/** The queue of unpinned directories to unwrap. */
 	struct bftw_list to_close;
@@ -853,13 +1831,35 @@ struct bftw_state {
 	struct bfs_dirent de_storage;
 	/** Any error encountered while reading the directory. */
 	int direrror;
+	/** Whether to skip the current directory's non-directory entries. */
+	bool dirs_only;
+	/** The number of subdirectories left to read, or SIZE_MAX if unknown. */
+	size_t subdirs;
+	/** The number of entries read from the current directory. */
+	size_t nentries;
+	/** How many of them had unknown types. */
+	size_t nunknown;
+	/** Whether to batch the current directory's stat() calls in the ioq. */
+	bool batch;
+	/** Whether the ioq is reading ahead in the current directory. */
+	bool ahead;
 
 	/** Extra data about the current file. */
 	struct BFTW ftwbuf;
+	/** Cookie storage, for files that don't have a bftw_file yet. */
+	uint64_t cookie;
+	/** Data storage, for files that don't have a bftw_file yet. */
+	void *data;
 	/** stat() buffer storage. */
 	struct bfs_stat stat_buf;
 	/** lstat() buffer storage. */
 	struct bfs_stat lstat_buf;
+	/** Storage for stat() info unpacked from a buffered file. */
+	struct bfs_stat unpacked_buf;
+	/** Storage for lstat() info unpacked from a buffered file. */
+	struct bfs_stat unpacked_lbuf;
+	/** readlink() buffer storage. */
+	dchar *link_buf;
 };
 
 /** Check if we have to buffer files before visiting them. */
@@ -882,7 +1882,8 @@ static bool bftw_must_buffer(const struct bftw_state *state) {
 		//
 		// This is okay for iterative deepening, since the caller only
 		// sees files at the target depth.  We also deem it okay for
-		// parallel searches, since the order is unpredictable anyway.
+		// parallel searches, since the order is unpredictable anyway
+		// (unless we're sorting, which buffers everything above).
 		return true;
 	}
 
@@ -894,18 +1895,99 @@ static bool bftw_must_buffer(const struct bftw_state *state) {
 	return false;
 }
 
+/** Check if files must be visited in the exact order they're queued. */
+static bool bftw_must_order(const struct bftw_state *state) {
+	// Sorted searches are only deterministic if they're exact, but the
+	// ordering costs parallelism, so unsorted searches don't pay for it
+	return state->flags & BFTW_SORT;
+}
+
 /** Initialize the bftw() state. */
 static int bftw_state_init(struct bftw_state *state, const struct bftw_args *args) {
 	state->paths = args->paths;
 	state->npaths = args->npaths;
+	state->next_path = args->next_path;
+	state->depths = args->depths;
 	state->callback = args->callback;
 	state->ptr = args->ptr;
+	state->filter = args->filter;
+	state->stat_hint = args->stat_hint;
 	state->flags = args->flags;
 	state->strategy = args->strategy;
+	state->stale_time = args->stale_time;
+	state->priority = NULL;
+	if (state->strategy == BFTW_BEST) {
+		state->priority = args->priority;
+	}
 	state->mtab = args->mtab;
+	state->bulkstat = NULL;
 	state->dir_flags = 0;
+	state->stat_mask = args->stat_mask ? args->stat_mask : BFS_STAT_ALL;
+	state->fsade_checks = args->fsade_checks;
+	state->fsade_xattr = args->fsade_xattr;
+	state->fsade_hash = args->fsade_hash;
+	state->fsade_grep = args->fsade_grep;
 	state->error = 0;
 
+	state->frontier = 0;
+	if (state->strategy == BFTW_BFS) {
+		state->frontier = args->frontier;
+	}
+	state->spills = 0;
+	state->spills_out = args->spills;
+	state->progress = args->progress;
+
+	state->checkpoint = args->checkpoint;
+	state->checkpoint_interval = args->checkpoint_interval;
+	state->checkpoint_next = 0;
+	if (state->checkpoint) {
+		state->checkpoint_next = bfs_perf_now() + state->checkpoint_interval;
+	}
+
+	struct bftw_runs *runs = &state->runs;
+	runs->limit = 0;
+	if (state->strategy == BFTW_BFS && (state->flags & BFTW_SORT)) {
+		runs->limit = args->sort_limit;
+	}
+	runs->buffered = 0;
+	runs->parent = NULL;
+	runs->fd = -1;
+	runs->size = 0;
+	runs->wbuf = NULL;
+	runs->wlen = 0;
+	runs->runs = NULL;
+	runs->nruns = 0;
+	runs->heap = NULL;
+	runs->nheap = 0;
+
+	struct bftw_listings *listings = &state->listings;
+	listings->limit = 0;
+	if (state->strategy == BFTW_IDS || state->strategy == BFTW_EDS) {
+		listings->limit = args->listing_memory;
+	}
+	listings->size = 0;
+	trie_init(&listings->trie);
+	LIST_INIT(listings);
+	listings->recording = false;
+	listings->key = NULL;
+	listings->entries = NULL;
+	listings->count = 0;
+	listings->names = NULL;
+	listings->replay = NULL;
+	listings->pos = 0;
+	listings->namepos = 0;
+
+	state->fslimits = NULL;
+	state->nfslimits = 0;
+	state->fsinflight = NULL;
+	state->throttle = args->throttle;
+	state->fsdev = -1;
+	state->fsindex = SIZE_MAX;
+	state->stat_cache = NULL;
+	state->nstat_cache = 0;
+	state->syncdev = -1;
+	state->nosync = false;
+
 	if (args->nopenfd < 2) {
 		errno = EMFILE;
 		return -1;
@@ -923,10 +2005,31 @@ static int bftw_state_init(struct bftw_state *state, const struct bftw_args *arg
 	nopenfd -= nthreads;
 #endif
 
-	bftw_cache_init(&state->cache, nopenfd);
+	bftw_cache_init(&state->cache, nopenfd, args->dir_memory);
+	if (state->progress) {
+		*state->progress = (struct bftw_progress){
+			.fd_limit = nopenfd,
+		};
+	}
+	idset_init(&state->dirs);
+
+	enum ioq_flags ioq_flags = 0;
+	if (state->flags & BFTW_SQPOLL) {
+		ioq_flags |= IOQ_SQPOLL;
+	}
+	if (state->flags & BFTW_AFFINITY) {
+		ioq_flags |= IOQ_AFFINITY;
+	}
+	if (nthreads <= 1) {
+		// Nothing to tune
+		state->flags &= ~BFTW_AUTO_THREADS;
+	}
+	if (state->flags & BFTW_AUTO_THREADS) {
+		ioq_flags |= IOQ_IDLE_TIME;
+	}
 
 	if (nthreads > 0) {
-		state->ioq = ioq_create(qdepth, nthreads);
+		state->ioq = ioq_create(qdepth, nthreads, ioq_flags, state->throttle, args->io_timeout);
 		if (!state->ioq) {
 			return -1;
 		}
@@ -935,6 +2038,63 @@ static int bftw_state_init(struct bftw_state *state, const struct bftw_args *arg
 	}
 	state->nthreads = nthreads;
 
+	state->active = nthreads;
+	if (state->flags & BFTW_AUTO_THREADS) {
+		state->active = ioq_set_threads(state->ioq, args->active_threads);
+	}
+	state->tune_time = bfs_perf_now();
+	state->tune_idle = 0;
+	state->tune_stalled = 0;
+
+	// Every asynchronously opened directory needs its own fd and bfs_dir,
+	// so the ioq can't usefully get further ahead than the cache allows
+	size_t lookahead_max = state->cache.dir_limit;
+	size_t lookahead_min = 2 * state->active;
+	if (args->lookahead) {
+		lookahead_min = args->lookahead;
+	}
+	if (lookahead_min > lookahead_max) {
+		lookahead_min = lookahead_max;
+	}
+	if (args->lookahead) {
+		lookahead_max = lookahead_min;
+	}
+	state->lookahead = lookahead_min;
+	state->lookahead_min = lookahead_min;
+	state->lookahead_max = lookahead_max;
+	state->lookahead_hits = 0;
+	state->prefetching = 0;
+
+	// Start with enough requests to keep every thread busy, and let
+	// bftw_depth_update() find the right depth for the storage
+	size_t depth_max = qdepth;
+	size_t depth_min = IOQ_BATCH * (nthreads ? nthreads : 1);
+	if (depth_min > depth_max) {
+		depth_min = depth_max;
+	}
+	state->depth = depth_min;
+	state->depth_min = depth_min;
+	state->depth_max = depth_max;
+	state->depth_hits = 0;
+	if (state->ioq) {
+		state->depth = ioq_set_depth(state->ioq, depth_min);
+	}
+
+	if (state->ioq && state->mtab && args->nfslimits > 0) {
+		state->fsinflight = ZALLOC_ARRAY(size_t, args->nfslimits);
+		if (!state->fsinflight) {
+			ioq_destroy(state->ioq);
+			return -1;
+		}
+		state->fslimits = args->fslimits;
+		state->nfslimits = args->nfslimits;
+	}
+
+	if (state->mtab && args->nstat_cache > 0) {
+		state->stat_cache = args->stat_cache;
+		state->nstat_cache = args->nstat_cache;
+	}
+
 	if (bftw_must_buffer(state)) {
 		state->flags |= BFTW_BUFFER;
 	}
@@ -946,33 +2106,53 @@ static int bftw_state_init(struct bftw_state *state, const struct bftw_args *arg
 	SLIST_INIT(&state->to_close);
 
 	enum bftw_qflags qflags = 0;
-	if (state->strategy != BFTW_BFS) {
+	if (state->strategy != BFTW_BFS && state->strategy != BFTW_BEST) {
 		qflags |= BFTW_QBUFFER | BFTW_QLIFO;
 	}
 	if (state->flags & BFTW_BUFFER) {
 		qflags |= BFTW_QBUFFER;
 	}
-	if (state->flags & BFTW_SORT) {
+	if (bftw_must_order(state)) {
 		qflags |= BFTW_QORDER;
 	} else if (nthreads == 1) {
 		qflags |= BFTW_QBALANCE;
 	}
+	if ((state->flags & BFTW_INO_ORDER) && state->ioq) {
+		qflags |= BFTW_QBUFFER | BFTW_QORDER | BFTW_QINODE;
+	}
 	bftw_queue_init(&state->fileq, qflags);
 
 	if (state->strategy == BFTW_BFS || (state->flags & BFTW_BUFFER)) {
 		// In breadth-first mode, or if we're already buffering files,
 		// directories can be queued in FIFO order
 		qflags &= ~(BFTW_QBUFFER | BFTW_QLIFO);
+		if (qflags & BFTW_QINODE) {
+			// But they still need to be buffered to sort them
+			qflags |= BFTW_QBUFFER;
+		}
+	}
+	if (state->strategy == BFTW_BEST) {
+		// Directories are serviced in priority order instead
+		qflags &= BFTW_QBALANCE | BFTW_QORDER;
+		qflags |= BFTW_QPRIORITY;
 	}
 	bftw_queue_init(&state->dirq, qflags);
 
 	state->path = NULL;
+	state->link_buf = NULL;
+	bftw_targets_init(&state->targets);
 	state->file = NULL;
 	state->previous = NULL;
 
 	state->dir = NULL;
 	state->de = NULL;
 	state->direrror = 0;
+	state->dirs_only = state->flags & BFTW_DIRS_ONLY;
+	state->subdirs = SIZE_MAX;
+	state->nentries = 0;
+	state->nunknown = 0;
+	state->batch = false;
+	state->ahead = false;
 
 	return 0;
 }
@@ -1000,18 +2180,189 @@ static void bftw_unpin_parent(struct bftw_state *state, struct bftw_file *file,
 	}
 }
 
-/** Pop a response from the I/O queue. */
-static int bftw_ioq_pop(struct bftw_state *state, bool block) {
+/**
+ * Get the device a file is (probably) on.  Files are assumed to be on their
+ * parent's file system unless their own device is known.
+ */
+static dev_t bftw_file_dev(const struct bftw_file *file) {
+	dev_t dev = file->dev;
+	if (dev == (dev_t)-1 && file->parent) {
+		dev = file->parent->dev;
+	}
+	return dev;
+}
+
+/** Check whether stats on a device may use cached attributes (-stat-cache). */
+static bool bftw_nosync(struct bftw_state *state, dev_t dev) {
+	if (state->nstat_cache == 0 || dev == (dev_t)-1) {
+		return false;
+	}
+
+	if (dev != state->syncdev) {
+		state->syncdev = dev;
+		state->nosync = false;
+
+		const char *type = bfs_dev_fstype(state->mtab, dev);
+		for (size_t i = 0; type && i < state->nstat_cache; ++i) {
+			if (strcmp(type, state->stat_cache[i]) == 0) {
+				state->nosync = true;
+				break;
+			}
+		}
+	}
+
+	return state->nosync;
+}
+
+/** Get the in-flight request counter for a file's file system, if it has a limit. */
+static size_t *bftw_fsinflight(struct bftw_state *state, const struct bftw_file *file) {
+	if (state->nfslimits == 0) {
+		return NULL;
+	}
+
+	dev_t dev = bftw_file_dev(file);
+	if (dev == (dev_t)-1) {
+		return NULL;
+	}
+
+	if (dev != state->fsdev) {
+		state->fsdev = dev;
+		state->fsindex = SIZE_MAX;
+
+		const char *type = bfs_dev_fstype(state->mtab, dev);
+		for (size_t i = 0; type && i < state->nfslimits; ++i) {
+			if (strcmp(type, state->fslimits[i].type) == 0) {
+				state->fsindex = i;
+				break;
+			}
+		}
+	}
+
+	if (state->fsindex == SIZE_MAX) {
+		return NULL;
+	}
+	return &state->fsinflight[state->fsindex];
+}
+
+/** Check whether a file's file system can take another async request. */
+static bool bftw_fs_reserve(struct bftw_state *state, const struct bftw_file *file) {
+	size_t *inflight = bftw_fsinflight(state, file);
+	if (!inflight) {
+		return true;
+	}
+
+	size_t limit = state->fslimits[inflight - state->fsinflight].limit;
+	if (*inflight >= limit) {
+		return false;
+	}
+
+	++*inflight;
+	return true;
+}
+
+/** Release a file system request reservation. */
+static void bftw_fs_release(struct bftw_state *state, const struct bftw_file *file) {
+	size_t *inflight = bftw_fsinflight(state, file);
+	if (inflight) {
+		bfs_assert(*inflight > 0);
+		--*inflight;
+	}
+}
+
+/** Finish one of the pending requests for a buffered file. */
+static void bftw_fileq_done(struct bftw_state *state, struct bftw_file *file) {
+	bfs_assert(file->ioqops > 0);
+	if (--file->ioqops == 0) {
+		bftw_queue_attach(&state->fileq, file, true);
+	}
+}
+
+/** Save a completed bfs_stat() call to a file's packed cache. */
+static void bftw_stat_save(struct bftw_state *state, struct bftw_file *file, enum bfs_stat_flags flags, struct bfs_stat *buf, int err) {
 	struct bftw_cache *cache = &state->cache;
-	struct ioq *ioq = state->ioq;
-	if (!ioq) {
-		return -1;
+
+	// Work out which results to save the same way the visit would
+	struct bftw_stat bufs;
+	bftw_stat_init(&bufs, NULL, NULL, NULL);
+	bftw_stat_cache(&bufs, flags, buf, err);
+
+	struct bfs_packed_stat *packed = NULL;
+	if (buf) {
+		size_t size = bfs_stat_packed_size(buf->mask & state->stat_mask);
+		packed = varena_alloc(&cache->packed_stats, size);
+		if (packed) {
+			bfs_stat_pack(packed, buf, state->stat_mask);
+		}
+		arena_free(&cache->stat_bufs, buf);
+		if (!packed) {
+			// Leave it uncached, so it will be re-done when visited
+			return;
+		}
 	}
 
-	struct ioq_ent *ent = ioq_pop(ioq, block);
-	if (!ent) {
-		return -1;
+	struct bftw_packed_stat *dest = &file->stat_bufs;
+	if (bufs.stat_err >= 0) {
+		dest->stat_buf = bufs.stat_buf ? packed : NULL;
+		dest->stat_err = bufs.stat_err;
+	}
+	if (bufs.lstat_err >= 0) {
+		dest->lstat_buf = bufs.lstat_buf ? packed : NULL;
+		dest->lstat_err = bufs.lstat_err;
+	}
+}
+
+/** Save a completed readlink() call to a file's cache. */
+static void bftw_link_save(struct bftw_state *state, struct bftw_file *file, char *buf, int result) {
+	struct bftw_cache *cache = &state->cache;
+
+	if (result >= 0 && (size_t)result < BFTW_LINK_SIZE) {
+		buf[result] = '\0';
+		file->link = buf;
+		file->link_err = 0;
+		return;
+	}
+
+	arena_free(&cache->links, buf);
+
+	// Truncated targets and transient failures are re-done when visited
+	if (result < 0 && result != -ENOMEM && result != -EINTR) {
+		file->link_err = -result;
+	}
+}
+
+/** Expand a file's packed stat() cache for a visit. */
+static void bftw_stat_unpack(struct bftw_state *state, struct BFTW *ftwbuf, const struct bftw_file *file) {
+	const struct bftw_packed_stat *packed = &file->stat_bufs;
+	struct bftw_stat *bufs = &ftwbuf->stat_bufs;
+
+	if (packed->stat_err >= 0) {
+		if (packed->stat_buf) {
+			bfs_stat_unpack(&state->unpacked_buf, packed->stat_buf);
+			bufs->stat_buf = &state->unpacked_buf;
+		}
+		bufs->stat_err = packed->stat_err;
+	}
+
+	if (packed->lstat_err >= 0) {
+		if (packed->lstat_buf && packed->lstat_buf == packed->stat_buf) {
+			bufs->lstat_buf = bufs->stat_buf;
+		} else if (packed->lstat_buf) {
+			bfs_stat_unpack(&state->unpacked_lbuf, packed->lstat_buf);
+			bufs->lstat_buf = &state->unpacked_lbuf;
+		}
+		bufs->lstat_err = packed->lstat_err;
+	}
+
+	if (file->link_err > 0) {
+		bufs->link_err = file->link_err;
+	} else if (file->link_err == 0 && dstrcpy(bufs->link_buf, file->link) == 0) {
+		bufs->link_err = 0;
 	}
+}
+
+/** Handle a single response from the I/O queue. */
+static void bftw_ioq_handle(struct bftw_state *state, struct ioq_ent *ent) {
+	struct bftw_cache *cache = &state->cache;
 
 	struct bftw_file *file = ent->ptr;
 	if (file) {
@@ -1031,6 +2382,7 @@ static int bftw_ioq_pop(struct bftw_state *state, bool block) {
 
 	case IOQ_OPENDIR:
 		++cache->capacity;
+		bftw_fs_release(state, file);
 
 		if (ent->result >= 0) {
 			bftw_file_set_dir(cache, file, ent->opendir.dir);
@@ -1038,68 +2390,295 @@ static int bftw_ioq_pop(struct bftw_state *state, bool block) {
 			bftw_freedir(cache, ent->opendir.dir);
 		}
 
-		bftw_queue_attach(&state->dirq, file, true);
+		if (file->prefetch) {
+			// Still on the fileq, waiting to be visited
+			file->prefetch = false;
+			--state->prefetching;
+		} else {
+			bftw_queue_attach(&state->dirq, file, true);
+		}
+		break;
+
+	case IOQ_READAHEAD:
+		bfs_assert(state->ahead && ent->readahead.dir == state->dir);
+#if BFS_USE_GETDENTS
+		bfs_dirahead_done(ent->readahead.dir, ent->result);
+#endif
+		state->ahead = false;
 		break;
 
 	case IOQ_STAT:
+		bftw_fs_release(state, file);
+
 		if (ent->result >= 0) {
-			bftw_stat_cache(&file->stat_bufs, ent->stat.flags, ent->stat.buf, 0);
+			bftw_stat_save(state, file, ent->stat.flags, ent->stat.buf, 0);
 		} else {
 			arena_free(&cache->stat_bufs, ent->stat.buf);
-			bftw_stat_cache(&file->stat_bufs, ent->stat.flags, NULL, -ent->result);
+			bftw_stat_save(state, file, ent->stat.flags, NULL, -ent->result);
 		}
 
-		bftw_queue_attach(&state->fileq, file, true);
+		bftw_fileq_done(state, file);
 		break;
-	}
 
-	ioq_free(ioq, ent);
-	return op;
-}
+	case IOQ_PROBE:
+		bftw_fs_release(state, file);
 
-/** Try to reserve space in the I/O queue. */
-static int bftw_ioq_reserve(struct bftw_state *state) {
-	struct ioq *ioq = state->ioq;
-	if (!ioq) {
-		return -1;
-	}
+		if (ent->result < 0) {
+			file->fsade.checked = 0;
+		}
 
-	if (ioq_capacity(ioq) > 0) {
-		return 0;
-	}
+		bftw_fileq_done(state, file);
+		break;
 
-	// With more than one background thread, it's faster to wait on
-	// background I/O than it is to do it on the main thread
-	bool block = state->nthreads > 1;
-	if (bftw_ioq_pop(state, block) < 0) {
-		return -1;
-	}
+	case IOQ_READLINK:
+		bftw_fs_release(state, file);
+		bftw_link_save(state, file, ent->readlink.buf, ent->result);
+		bftw_fileq_done(state, file);
+		break;
 
-	return 0;
+	case IOQ_UNLINK:
+		// bftw() doesn't unlink anything itself
+		bfs_bug("Unexpected IOQ_UNLINK");
+		break;
+	}
 }
 
-/** Try to reserve space in the cache. */
-static int bftw_cache_reserve(struct bftw_state *state) {
-	struct bftw_cache *cache = &state->cache;
-	if (cache->capacity > 0) {
-		return 0;
+/** How often to tune the number of active I/O threads, in nanoseconds. */
+#define BFTW_TUNE_INTERVAL (10 * 1000 * 1000)
+
+/**
+ * Tune the number of active I/O threads.  If the main thread spends much of its
+ * time waiting on the ioq while the active threads are kept busy, more threads
+ * are likely to help (e.g. on high-latency network file systems), so they are
+ * doubled.  If the threads spend much of their time waiting for requests
+ * instead, one is parked.
+ */
+static void bftw_tune_threads(struct bftw_state *state, uint64_t now) {
+	uint64_t elapsed = now - state->tune_time;
+	if (now < state->tune_time || elapsed < BFTW_TUNE_INTERVAL) {
+		return;
 	}
 
-	while (bftw_ioq_pop(state, true) >= 0) {
-		if (cache->capacity > 0) {
-			return 0;
-		}
+	uint64_t idle = ioq_idle_time(state->ioq);
+	uint64_t idled = idle - state->tune_idle;
+	uint64_t avail = elapsed * state->active;
+
+	size_t active = state->active;
+	if (state->tune_stalled > elapsed / 4 && idled < avail / 4) {
+		active *= 2;
+	} else if (idled > avail / 2 && active > 1) {
+		--active;
 	}
 
-	if (bftw_cache_pop(cache) != 0) {
-		errno = EMFILE;
-		return -1;
+	if (active != state->active) {
+		// The lookahead adapts to the new thread count by itself
+		state->active = ioq_set_threads(state->ioq, active);
 	}
 
-	bfs_assert(cache->capacity > 0);
+	bfs_perf_sample(BFS_PERF_THREADS, state->active);
+	bfs_trace_counter("ioq threads", state->active);
+
+	state->tune_time = now;
+	state->tune_idle = idle;
+	state->tune_stalled = 0;
+}
+
+/**
+ * Adapt the ioq's in-flight limit to its latency.  Whenever the queue is full
+ * of requests that haven't finished yet, the limit is doubled, so more latency
+ * can be overlapped (e.g. on network storage).  If full batches of responses
+ * keep piling up instead, the main thread is the bottleneck, so the limit
+ * slowly shrinks again.
+ *
+ * The limit only bounds how far ahead of the main thread the ioq gets; the
+ * directories it can open at once are still bounded by the cache's share of
+ * the fd limit.
+ */
+static void bftw_depth_update(struct bftw_state *state, bool stalled) {
+	size_t depth = state->depth;
+
+	if (stalled) {
+		state->depth_hits = 0;
+		if (depth < state->depth_max / 2) {
+			depth *= 2;
+		} else {
+			depth = state->depth_max;
+		}
+	} else if (++state->depth_hits >= depth / IOQ_BATCH) {
+		state->depth_hits = 0;
+		if (depth >= state->depth_min + IOQ_BATCH) {
+			depth -= IOQ_BATCH;
+		} else {
+			depth = state->depth_min;
+		}
+	}
+
+	if (depth != state->depth) {
+		state->depth = ioq_set_depth(state->ioq, depth);
+		bfs_perf_sample(BFS_PERF_DEPTH, state->depth);
+		bfs_trace_counter("ioq depth", state->depth);
+	}
+}
+
+/** Pop a batch of responses from the I/O queue. */
+static int bftw_ioq_pop(struct bftw_state *state, bool block) {
+	struct ioq *ioq = state->ioq;
+	if (!ioq) {
+		return -1;
+	}
+
+	bool tune = state->flags & BFTW_AUTO_THREADS;
+	uint64_t start = 0;
+	if (tune && block) {
+		start = bfs_perf_now();
+	}
+
+	struct ioq_ent *batch[IOQ_BATCH];
+	size_t size = ioq_pop_batch(ioq, batch, IOQ_BATCH, block);
+
+	if (tune) {
+		uint64_t now = bfs_perf_now();
+		if (start && now > start) {
+			state->tune_stalled += now - start;
+		}
+		bftw_tune_threads(state, now);
+	}
+
+	if (size == 0) {
+		return -1;
+	}
+
+	if (!block && size == IOQ_BATCH) {
+		bftw_depth_update(state, false);
+	}
+
+	for (size_t i = 0; i < size; ++i) {
+		bftw_ioq_handle(state, batch[i]);
+	}
+
+	ioq_free_batch(ioq, batch, size);
+	return size;
+}
+
+/** Try to reserve space in the I/O queue. */
+static int bftw_ioq_reserve(struct bftw_state *state) {
+	struct ioq *ioq = state->ioq;
+	if (!ioq) {
+		return -1;
+	}
+
+	if (ioq_capacity(ioq) > 0) {
+		return 0;
+	}
+
+	if (bftw_ioq_pop(state, false) >= 0) {
+		return 0;
+	}
+
+	// Nothing has finished yet, so the queue isn't deep enough to hide
+	// the latency
+	bftw_depth_update(state, true);
+	if (ioq_capacity(ioq) > 0) {
+		return 0;
+	}
+
+	// With more than one background thread, it's faster to wait on
+	// background I/O than it is to do it on the main thread
+	bool block = state->active > 1;
+	if (!block || bftw_ioq_pop(state, true) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Start reading the next chunk of a large directory in the background, so it's
+ * ready by the time the current chunk has been visited.
+ */
+static void bftw_readahead(struct bftw_state *state) {
+#if BFS_USE_GETDENTS
+	struct ioq *ioq = state->ioq;
+	if (!ioq || state->ahead || ioq_capacity(ioq) == 0) {
+		return;
+	}
+
+	void *buf;
+	size_t size = bfs_dirahead(state->dir, &buf);
+	if (size == 0) {
+		return;
+	}
+
+	if (ioq_readahead(ioq, state->dir, buf, size, NULL) == 0) {
+		state->ahead = true;
+		bfs_perf_count(BFS_PERF_DIRS_AHEAD);
+	} else {
+		bfs_dirahead_done(state->dir, -1);
+	}
+#endif
+}
+
+/** Wait for any read-ahead in the current directory to finish. */
+static void bftw_readahead_wait(struct bftw_state *state) {
+	while (state->ahead) {
+		if (bftw_ioq_pop(state, true) < 0) {
+			break;
+		}
+	}
+}
+
+/** Try to reserve space in the cache. */
+static int bftw_cache_reserve(struct bftw_state *state) {
+	struct bftw_cache *cache = &state->cache;
+	if (cache->capacity > 0) {
+		return 0;
+	}
+
+	while (bftw_ioq_pop(state, true) >= 0) {
+		if (cache->capacity > 0) {
+			return 0;
+		}
+	}
+
+	if (bftw_cache_pop(cache) != 0) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	bfs_assert(cache->capacity > 0);
 	return 0;
 }
 
+/** Get the bfs_opendir() flags for a file. */
+static enum bfs_dir_flags bftw_file_dir_flags(const struct bftw_state *state, const struct bftw_file *file) {
+	enum bfs_dir_flags flags = state->dir_flags;
+	if (file->large) {
+		flags |= BFS_DIR_LARGE;
+	}
+
+	// Below the roots, make sure nothing changed between the visit and the
+	// open that would have stopped us from descending
+	if (file->depth > 0) {
+		if (!(state->flags & BFTW_FOLLOW_ALL)) {
+			flags |= BFS_DIR_NOFOLLOW;
+		}
+		if (state->flags & (BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS)) {
+			flags |= BFS_DIR_NOXDEV;
+		}
+	}
+
+	return flags;
+}
+
+/** Check whether an opened directory is on a different device than expected. */
+static bool bftw_fd_dev_changed(int fd, const struct bftw_file *file) {
+	struct bfs_stat buf;
+	if (bfs_stat_mask(fd, NULL, 0, BFS_STAT_DEV, &buf) != 0) {
+		return true;
+	}
+	return file->dev != (dev_t)-1 && buf.dev != file->dev;
+}
+
 /** Open a bftw_file relative to another one. */
 static int bftw_file_openat(struct bftw_state *state, struct bftw_file *file, struct bftw_file *base, const char *at_path) {
 	bfs_assert(file->fd < 0);
@@ -1117,16 +2696,28 @@ static int bftw_file_openat(struct bftw_state *state, struct bftw_file *file, st
 		goto unpin;
 	}
 
-	int flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
-	fd = openat(at_fd, at_path, flags);
+	// The kernel can only check the path if it's all inside the tree
+	enum bfs_dir_flags flags = base ? bftw_file_dir_flags(state, file) : 0;
+	fd = bfs_opendirfd(at_fd, at_path, flags);
 
 	if (fd < 0 && errno == EMFILE) {
 		if (bftw_cache_pop(cache) == 0) {
-			fd = openat(at_fd, at_path, flags);
+			fd = bfs_opendirfd(at_fd, at_path, flags);
 		}
 		cache->capacity = 1;
 	}
 
+	if (fd < 0 && errno == EXDEV && (flags & BFS_DIR_NOXDEV)) {
+		// Bind mounts of the same file system don't count as mount
+		// points for -xdev, so check the device of what we opened
+		fd = bfs_opendirfd(at_fd, at_path, flags & ~BFS_DIR_NOXDEV);
+		if (fd >= 0 && bftw_fd_dev_changed(fd, file)) {
+			close_quietly(fd);
+			fd = -1;
+			errno = EXDEV;
+		}
+	}
+
 unpin:
 	if (base) {
 		bftw_cache_unpin(cache, base);
@@ -1140,6 +2731,60 @@ unpin:
 	return fd;
 }
 
+/** Reopen an evicted directory from its saved file handle. */
+static int bftw_file_open_handle(struct bftw_state *state, struct bftw_file *file, struct bftw_file *base) {
+#if BFS_HAS_NAME_TO_HANDLE_AT
+	bfs_assert(file->fd < 0);
+
+	struct bftw_cache *cache = &state->cache;
+	if (!cache->handles) {
+		bftw_drop_handle(file);
+		return -1;
+	}
+
+	// The mount_fd must be on the same mount, or the handle could be
+	// decoded by the wrong file system
+	bftw_save_handle(cache, base);
+	if (!base->handle || base->mount_id != file->mount_id) {
+		return -1;
+	}
+
+	bftw_cache_pin(cache, base);
+
+	int fd = -1;
+	if (bftw_cache_reserve(state) != 0) {
+		goto unpin;
+	}
+
+	int error = errno;
+	uint64_t start = bfs_perf_start();
+	fd = open_by_handle_at(base->fd, file->handle, O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+	bfs_perf_end(BFS_PERF_OPENAT, start, 0);
+	if (fd < 0) {
+		if (errno_is_like(ENOSYS)) {
+			// Without CAP_DAC_READ_SEARCH, save no more handles
+			cache->handles = false;
+		}
+		// The handle may be stale, so fall back to the path
+		bftw_drop_handle(file);
+		errno = error;
+	}
+
+unpin:
+	bftw_cache_unpin(cache, base);
+
+	if (fd >= 0) {
+		bfs_perf_count(BFS_PERF_DIRS_HANDLE);
+		file->fd = fd;
+		bftw_cache_add(cache, file);
+	}
+
+	return fd;
+#else
+	return -1;
+#endif
+}
+
 /** Open a bftw_file. */
 static int bftw_file_open(struct bftw_state *state, struct bftw_file *file, const char *path) {
 	// Find the nearest open ancestor
@@ -1148,6 +2793,20 @@ static int bftw_file_open(struct bftw_state *state, struct bftw_file *file, cons
 		base = base->parent;
 	} while (base && base->fd < 0);
 
+	// Rather than walking a long path from there, try reopening the
+	// closest evicted directory we saved a handle for
+	for (struct bftw_file *cur = file; base && cur->parent != base; cur = cur->parent) {
+		if (cur->handle) {
+			if (bftw_file_open_handle(state, cur, base) >= 0) {
+				if (cur == file) {
+					return file->fd;
+				}
+				base = cur;
+			}
+			break;
+		}
+	}
+
 	const char *at_path = path;
 	if (base) {
 		at_path += bftw_child_nameoff(base);
@@ -1308,12 +2967,16 @@ static int bftw_ioq_opendir(struct bftw_state *state, struct bftw_file *file) {
 		goto unpin;
 	}
 
+	if (!bftw_fs_reserve(state, file)) {
+		goto unpin;
+	}
+
 	struct bfs_dir *dir = bftw_allocdir(cache, false);
 	if (!dir) {
-		goto unpin;
+		goto release;
 	}
 
-	if (ioq_opendir(state->ioq, dir, dfd, file->name, state->dir_flags, file) != 0) {
+	if (ioq_opendir(state->ioq, dir, dfd, file->name, bftw_file_dir_flags(state, file), file) != 0) {
 		goto free;
 	}
 
@@ -1322,6 +2985,8 @@ static int bftw_ioq_opendir(struct bftw_state *state, struct bftw_file *file) {
 
 free:
 	bftw_freedir(cache, dir);
+release:
+	bftw_fs_release(state, file);
 unpin:
 	bftw_unpin_parent(state, file, false);
 fail:
@@ -1330,13 +2995,29 @@ fail:
 
 /** Open a batch of directories asynchronously. */
 static void bftw_ioq_opendirs(struct bftw_state *state) {
-	while (bftw_queue_balanced(&state->dirq)) {
+	while (true) {
+		if (state->dirq.ioqueued >= state->lookahead) {
+			break;
+		}
+
 		struct bftw_file *dir = bftw_queue_waiting(&state->dirq);
 		if (!dir) {
 			break;
 		}
 
+		if (dir->dir || dir->listing) {
+			// Already opened by bftw_prefetch_dirs(), or won't be read
+			bftw_queue_skip(&state->dirq, dir);
+			continue;
+		}
+
+		if (!bftw_queue_balanced(&state->dirq)) {
+			bfs_perf_count(BFS_PERF_DIRS_UNBALANCED);
+			break;
+		}
+
 		if (bftw_ioq_opendir(state, dir) == 0) {
+			bfs_perf_count(BFS_PERF_DIRS_ASYNC);
 			bftw_queue_detach(&state->dirq, dir, true);
 		} else {
 			break;
@@ -1344,62 +3025,84 @@ static void bftw_ioq_opendirs(struct bftw_state *state) {
 	}
 }
 
-/** Push a directory onto the queue. */
-static void bftw_push_dir(struct bftw_state *state, struct bftw_file *file) {
-	bfs_assert(file->type == BFS_DIR);
-	bftw_queue_push(&state->dirq, file);
-	bftw_ioq_opendirs(state);
-}
+/** How many queued files bftw_prefetch_dirs() looks through per directory. */
+#define BFTW_PREFETCH_SCAN 16
 
-/** Pop a file from a queue, then activate it. */
-static bool bftw_pop(struct bftw_state *state, struct bftw_queue *queue) {
-	if (queue->size == 0) {
-		return false;
+/**
+ * Open the directories that a sorted depth-first search will visit next.  The
+ * fileq (with BFTW_QORDER) already lists the files in the exact order they will
+ * be visited, so the ioq can open the directories among them while the main
+ * thread visits what comes before.  Any that are pruned are just closed again.
+ */
+static void bftw_prefetch_dirs(struct bftw_state *state) {
+	if (state->strategy != BFTW_DFS || !state->ioq || !bftw_must_order(state)) {
+		return;
 	}
 
-	while (!bftw_queue_ready(queue) && queue->ioqueued > 0) {
-		bool block = true;
-		if (bftw_queue_waiting(queue) && state->nthreads == 1) {
-			// With only one background thread, balance the work
-			// between it and the main thread
-			block = false;
-		}
+	size_t lookahead = state->lookahead;
+	size_t budget = BFTW_PREFETCH_SCAN * lookahead;
+	size_t dirs = 0;
 
-		if (bftw_ioq_pop(state, block) < 0) {
+	for_slist (struct bftw_file, file, &state->fileq.ready, ready) {
+		if (dirs >= lookahead || budget-- == 0) {
 			break;
 		}
-	}
 
-	struct bftw_file *file = bftw_queue_pop(queue);
-	if (!file) {
-		return false;
-	}
+		if (file->type != BFS_DIR) {
+			continue;
+		}
+		++dirs;
 
-	while (file->ioqueued) {
-		bftw_ioq_pop(state, true);
-	}
+		if (file->prefetch || file->dir || file->fd >= 0) {
+			continue;
+		}
 
-	state->file = file;
-	return true;
-}
+		const struct bftw_file *parent = file->parent;
+		if (parent && parent->fd < 0) {
+			continue;
+		}
 
-/** Pop a directory to read from the queue. */
-static bool bftw_pop_dir(struct bftw_state *state) {
-	bfs_assert(!state->file);
+		// Don't wait or evict anything for a speculative open
+		if (state->prefetching >= lookahead || state->cache.capacity == 0 || ioq_capacity(state->ioq) == 0) {
+			break;
+		}
 
-	if (state->flags & BFTW_SORT) {
-		// Keep strict breadth-first order when sorting
-		if (state->strategy == BFTW_BFS && bftw_queue_ready(&state->fileq)) {
-			return false;
+		if (bftw_ioq_opendir(state, file) != 0) {
+			break;
 		}
-	} else if (!bftw_queue_ready(&state->dirq)) {
-		// Don't block if we have files ready to visit
-		if (bftw_queue_ready(&state->fileq)) {
-			return false;
+		file->prefetch = true;
+		++state->prefetching;
+	}
+}
+
+/**
+ * Keep the breadth-first frontier bounded.  Once too many directories are
+ * queued, new ones are pushed to the front of the queue instead, which makes
+ * the search depth-first until the queue drains again.
+ */
+static void bftw_limit_frontier(struct bftw_state *state) {
+	size_t limit = state->frontier;
+	if (limit == 0) {
+		return;
+	}
+
+	struct bftw_queue *dirq = &state->dirq;
+	if (dirq->flags & BFTW_QLIFO) {
+		if (dirq->size <= limit / 2) {
+			dirq->flags &= ~BFTW_QLIFO;
 		}
+	} else if (dirq->size >= limit) {
+		dirq->flags |= BFTW_QLIFO;
+		++state->spills;
 	}
+}
 
-	return bftw_pop(state, &state->dirq);
+/** Push a directory onto the queue. */
+static void bftw_push_dir(struct bftw_state *state, struct bftw_file *file) {
+	bfs_assert(file->type == BFS_DIR);
+	bftw_limit_frontier(state);
+	bftw_queue_push(&state->dirq, file);
+	bftw_ioq_opendirs(state);
 }
 
 /** Figure out bfs_stat() flags. */
@@ -1416,18 +3119,87 @@ static enum bfs_stat_flags bftw_stat_flags(const struct bftw_state *state, size_
 	}
 }
 
-/** Check if a stat() call is necessary. */
-static bool bftw_must_stat(const struct bftw_state *state, size_t depth, enum bfs_type type, const char *name) {
-	if (state->flags & BFTW_STAT) {
-		return true;
+/** Figure out bfs_stat() flags for a file, including -stat-cache. */
+static enum bfs_stat_flags bftw_file_stat_flags(struct bftw_state *state, const struct bftw_file *file, size_t depth) {
+	enum bfs_stat_flags flags = bftw_stat_flags(state, depth);
+	if (file && bftw_nosync(state, bftw_file_dev(file))) {
+		flags |= BFS_STAT_NOSYNC;
 	}
+	return flags;
+}
 
-	switch (type) {
-	case BFS_UNKNOWN:
-		return true;
+/**
+ * Get the file system type of a directory.  Subdirectories on the same device
+ * reuse their parent's, so the mount table is only consulted when the device
+ * changes.
+ */
+static const char *bftw_dir_fstype(const struct bftw_state *state, struct bftw_file *dir) {
+	if (dir->fstype) {
+		return dir->fstype;
+	}
+
+	dev_t dev = dir->dev;
+	if (dev == (dev_t)-1) {
+		struct bfs_stat buf;
+		if (dir->fd < 0 || bfs_stat_mask(dir->fd, NULL, 0, BFS_STAT_DEV, &buf) != 0) {
+			return NULL;
+		}
+		dev = buf.dev;
+	}
+
+	const struct bftw_file *parent = dir->parent;
+	if (parent && parent->fstype && parent->dev == dev) {
+		dir->fstype = parent->fstype;
+	} else {
+		dir->fstype = bfs_dev_fstype(state->mtab, dev);
+	}
+	return dir->fstype;
+}
 
+/**
+ * Check whether a non-root file must be on the same file system as its parent
+ * directory, i.e. it can't be a mount point.
+ */
+static bool bftw_same_mount(const struct bftw_state *state, const struct BFTW *ftwbuf) {
+	switch (ftwbuf->type) {
+	case BFS_UNKNOWN:
 	case BFS_DIR:
-		return state->flags & (BFTW_DETECT_CYCLES | BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS);
+	case BFS_ERROR:
+		return false;
+
+	case BFS_LNK:
+		if (!(ftwbuf->stat_flags & BFS_STAT_NOFOLLOW)) {
+			return false;
+		}
+		_fallthrough;
+
+	default:
+#if __linux__
+		// Non-directories can be bind-mounted on Linux
+		if (bfs_might_be_mount(state->mtab, ftwbuf->path + ftwbuf->nameoff)) {
+			return false;
+		}
+#endif
+		return true;
+	}
+}
+
+/** Check if a stat() call is necessary. */
+static bool bftw_must_stat(const struct bftw_state *state, size_t depth, enum bfs_type type, const char *name) {
+	if (state->flags & BFTW_STAT) {
+		return true;
+	}
+
+	switch (type) {
+	case BFS_UNKNOWN:
+		return true;
+
+	case BFS_DIR:
+		if (state->nfslimits > 0) {
+			// Per-file-system limits need to know each directory's device
+			return true;
+		}
+		return state->flags & (BFTW_DETECT_CYCLES | BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS);
 
 	case BFS_LNK:
 		if (!(bftw_stat_flags(state, depth) & BFS_STAT_NOFOLLOW)) {
@@ -1445,6 +3217,16 @@ static bool bftw_must_stat(const struct bftw_state *state, size_t depth, enum bf
 	}
 }
 
+/** Check if a file should be stat()ed ahead of time. */
+static bool bftw_want_stat(const struct bftw_state *state, size_t depth, enum bfs_type type, const char *name) {
+	if (bftw_must_stat(state, depth, type, name)) {
+		return true;
+	}
+
+	// Speculatively prefetch the files the callback will probably stat()
+	return state->stat_hint && state->stat_hint(name, state->ptr);
+}
+
 /** stat() a file asynchronously. */
 static int bftw_ioq_stat(struct bftw_state *state, struct bftw_file *file) {
 	if (bftw_ioq_reserve(state) != 0) {
@@ -1456,14 +3238,18 @@ static int bftw_ioq_stat(struct bftw_state *state, struct bftw_file *file) {
 		goto fail;
 	}
 
+	if (!bftw_fs_reserve(state, file)) {
+		goto unpin;
+	}
+
 	struct bftw_cache *cache = &state->cache;
 	struct bfs_stat *buf = arena_alloc(&cache->stat_bufs);
 	if (!buf) {
-		goto unpin;
+		goto release;
 	}
 
-	enum bfs_stat_flags flags = bftw_stat_flags(state, file->depth);
-	if (ioq_stat(state->ioq, dfd, file->name, flags, buf, file) != 0) {
+	enum bfs_stat_flags flags = bftw_file_stat_flags(state, file, file->depth);
+	if (ioq_stat(state->ioq, dfd, file->name, flags, state->stat_mask, buf, file) != 0) {
 		goto free;
 	}
 
@@ -1471,12 +3257,132 @@ static int bftw_ioq_stat(struct bftw_state *state, struct bftw_file *file) {
 
 free:
 	arena_free(&cache->stat_bufs, buf);
+release:
+	bftw_fs_release(state, file);
+unpin:
+	bftw_unpin_parent(state, file, false);
+fail:
+	return -1;
+}
+
+/** Do some fsade checks asynchronously. */
+static int bftw_ioq_probe(struct bftw_state *state, struct bftw_file *file, enum bfs_fsade_check checks) {
+	if (bftw_ioq_reserve(state) != 0) {
+		goto fail;
+	}
+
+	int dfd = bftw_pin_parent(state, file);
+	if (dfd < 0 && dfd != (int)AT_FDCWD) {
+		goto fail;
+	}
+
+	if (!bftw_fs_reserve(state, file)) {
+		goto unpin;
+	}
+
+	// If we'll follow a link, let the I/O thread find out what it points to
+	enum bfs_stat_flags flags = bftw_file_stat_flags(state, file, file->depth);
+	enum bfs_type type = file->type;
+	if (type == BFS_LNK && !(flags & BFS_STAT_NOFOLLOW)) {
+		type = BFS_UNKNOWN;
+	}
+
+	if (checks & BFS_CHECK_HASH) {
+		if (!file->fsade.digest) {
+			file->fsade.digest = arena_alloc(&state->cache.digests);
+		}
+		if (file->fsade.digest) {
+			file->fsade.hash = state->fsade_hash;
+		} else {
+			checks &= ~BFS_CHECK_HASH;
+		}
+	}
+	if (!checks) {
+		goto release;
+	}
+
+	file->fsade.name = state->fsade_xattr;
+	file->fsade.grep = state->fsade_grep;
+	if (ioq_probe(state->ioq, dfd, file->name, type, flags, checks, &file->fsade, file) != 0) {
+		goto release;
+	}
+
+	return 0;
+
+release:
+	bftw_fs_release(state, file);
+unpin:
+	bftw_unpin_parent(state, file, false);
+fail:
+	return -1;
+}
+
+/** Read a symbolic link asynchronously. */
+static int bftw_ioq_readlink(struct bftw_state *state, struct bftw_file *file) {
+	struct bftw_cache *cache = &state->cache;
+
+	if (bftw_ioq_reserve(state) != 0) {
+		goto fail;
+	}
+
+	int dfd = bftw_pin_parent(state, file);
+	if (dfd < 0 && dfd != (int)AT_FDCWD) {
+		goto fail;
+	}
+
+	if (!bftw_fs_reserve(state, file)) {
+		goto unpin;
+	}
+
+	char *buf = arena_alloc(&cache->links);
+	if (!buf) {
+		goto release;
+	}
+
+	if (ioq_readlink(state->ioq, dfd, file->name, buf, BFTW_LINK_SIZE, file) != 0) {
+		goto free;
+	}
+
+	return 0;
+
+free:
+	arena_free(&cache->links, buf);
+release:
+	bftw_fs_release(state, file);
 unpin:
 	bftw_unpin_parent(state, file, false);
 fail:
 	return -1;
 }
 
+/** Get the fsade checks to do asynchronously for a file. */
+static enum bfs_fsade_check bftw_fsade_checks(const struct bftw_state *state, const struct bftw_file *file) {
+	// Like bftw_should_ioq_stat(), leave the roots alone
+	if (file->depth == 0) {
+		return 0;
+	}
+
+#ifdef S_IFWHT
+	if (file->type == BFS_WHT) {
+		return 0;
+	}
+#endif
+
+	enum bfs_fsade_check checks = state->fsade_checks;
+	switch (file->type) {
+	case BFS_UNKNOWN:
+	case BFS_REG:
+	case BFS_LNK:
+		break;
+	default:
+		// Only regular files (or links to them) can be hashed or searched
+		checks &= ~(BFS_CHECK_HASH | BFS_CHECK_GREP);
+		break;
+	}
+
+	return checks;
+}
+
 /** Check if we should stat() a file asynchronously. */
 static bool bftw_should_ioq_stat(struct bftw_state *state, struct bftw_file *file) {
 	// To avoid surprising users too much, process the roots in order
@@ -1491,7 +3397,23 @@ static bool bftw_should_ioq_stat(struct bftw_state *state, struct bftw_file *fil
 	}
 #endif
 
-	return bftw_must_stat(state, file->depth, file->type, file->name);
+	return bftw_want_stat(state, file->depth, file->type, file->name);
+}
+
+/** Check if we should readlink() a file asynchronously. */
+static bool bftw_should_ioq_readlink(struct bftw_state *state, const struct bftw_file *file) {
+	if (!(state->flags & BFTW_READLINK) || file->depth == 0) {
+		return false;
+	}
+
+	// Followed links are visited as their targets, so only links we know
+	// will be reported as links are worth reading
+	if (file->type != BFS_LNK || file->link_err >= 0) {
+		return false;
+	}
+
+	enum bfs_stat_flags flags = bftw_file_stat_flags(state, file, file->depth);
+	return flags & BFS_STAT_NOFOLLOW;
 }
 
 /** Call stat() on files that need it. */
@@ -1502,20 +3424,48 @@ static void bftw_stat_files(struct bftw_state *state) {
 			break;
 		}
 
-		if (!bftw_should_ioq_stat(state, file)) {
+		bool stat = bftw_should_ioq_stat(state, file);
+		enum bfs_fsade_check checks = bftw_fsade_checks(state, file);
+		bool link = bftw_should_ioq_readlink(state, file);
+		if (!stat && !checks && !link) {
 			bftw_queue_skip(&state->fileq, file);
 			continue;
 		}
 
-		if (!bftw_queue_balanced(&state->fileq)) {
+		if (!state->batch && !bftw_queue_balanced(&state->fileq)) {
+			bfs_perf_count(BFS_PERF_FILES_UNBALANCED);
 			break;
 		}
 
-		if (bftw_ioq_stat(state, file) == 0) {
-			bftw_queue_detach(&state->fileq, file, true);
-		} else {
+		if (stat) {
+			if (bftw_ioq_stat(state, file) != 0) {
+				break;
+			}
+			++file->ioqops;
+		}
+
+		// Don't let bftw_ioq_reserve() handle the stat() before we detach
+		if (checks && (!stat || ioq_capacity(state->ioq) > 0)) {
+			if (bftw_ioq_probe(state, file, checks) == 0) {
+				++file->ioqops;
+			}
+		}
+
+		if (link && (file->ioqops == 0 || ioq_capacity(state->ioq) > 0)) {
+			if (bftw_ioq_readlink(state, file) == 0) {
+				++file->ioqops;
+			}
+		}
+
+		if (file->ioqops == 0) {
 			break;
 		}
+		bfs_perf_count(BFS_PERF_FILES_ASYNC);
+		bftw_queue_detach(&state->fileq, file, true);
+		if (state->batch) {
+			// Batched calls don't need to be paid back by the main thread
+			bftw_queue_rebalance(&state->fileq, false);
+		}
 	}
 }
 
@@ -1525,122 +3475,1245 @@ static void bftw_push_file(struct bftw_state *state, struct bftw_file *file) {
 	bftw_stat_files(state);
 }
 
-/** Pop a file to visit from the queue. */
-static bool bftw_pop_file(struct bftw_state *state) {
-	bfs_assert(!state->file);
-	return bftw_pop(state, &state->fileq);
+/**
+ * Adapt the directory lookahead to the ioq's latency.  Whenever we have to wait
+ * for a directory to be opened, the lookahead is doubled.  If the ioq stays
+ * ahead of us for a while, it slowly shrinks again, so we don't tie up more
+ * file descriptors than necessary.
+ */
+static void bftw_lookahead_update(struct bftw_state *state, bool stalled) {
+	if (stalled) {
+		state->lookahead_hits = 0;
+		if (state->lookahead < state->lookahead_max / 2) {
+			state->lookahead *= 2;
+		} else {
+			state->lookahead = state->lookahead_max;
+		}
+	} else if (++state->lookahead_hits >= state->lookahead) {
+		state->lookahead_hits = 0;
+		if (state->lookahead > state->lookahead_min) {
+			--state->lookahead;
+		}
+	}
 }
 
-/** Add a path component to the path. */
-static void bftw_prepend_path(char *path, size_t nameoff, size_t namelen, const char *name) {
-	if (nameoff > 0) {
-		path[nameoff - 1] = '/';
+/** Service as many waiting files as possible asynchronously. */
+static void bftw_queue_service(struct bftw_state *state, struct bftw_queue *queue) {
+	if (queue == &state->dirq) {
+		bftw_ioq_opendirs(state);
+	} else {
+		bftw_stat_files(state);
 	}
-	memcpy(path + nameoff, name, namelen);
 }
 
-/** Build the path to the current file. */
-static int bftw_build_path(struct bftw_state *state, const char *name) {
-	const struct bftw_file *file = state->file;
+/** Pop a file from a queue, then activate it. */
+static bool bftw_pop(struct bftw_state *state, struct bftw_queue *queue) {
+	if (queue->size == 0) {
+		return false;
+	}
 
-	size_t nameoff, namelen;
-	if (name) {
-		nameoff = file ? bftw_child_nameoff(file) : 0;
-		namelen = strlen(name);
-	} else {
-		nameoff = file->nameoff;
-		namelen = file->namelen;
+	bfs_trace_counter("dirq", state->dirq.size);
+	bfs_trace_counter("fileq", state->fileq.size);
+	uint64_t start = bfs_trace_begin();
+	bool stalled = false;
+
+	while (bftw_queue_blocked(queue)) {
+		// Let the ioq catch up to the next file, or service the files
+		// ahead of it synchronously if it can't
+		if (bftw_queue_balanced(queue) && bftw_ioq_pop(state, true) >= 0) {
+			bftw_queue_service(state, queue);
+			stalled = true;
+		} else {
+			bftw_queue_skip(queue, bftw_queue_waiting(queue));
+		}
 	}
 
-	size_t pathlen = nameoff + namelen;
-	if (dstresize(&state->path, pathlen) != 0) {
-		state->error = errno;
-		return -1;
+	while (!bftw_queue_ready(queue) && queue->ioqueued > 0) {
+		bool block = true;
+		if (bftw_queue_waiting(queue) && state->active == 1) {
+			// With only one background thread, balance the work
+			// between it and the main thread
+			block = false;
+		}
+
+		if (bftw_ioq_pop(state, block) < 0) {
+			break;
+		}
+		stalled |= block;
 	}
 
-	// Try to find a common ancestor with the existing path
-	const struct bftw_file *ancestor = state->previous;
-	while (ancestor && ancestor->depth > file->depth) {
-		ancestor = ancestor->parent;
+	// Only check this once we know what we would pop, since a worse file
+	// may finish first
+	while (bftw_queue_preempted(queue)) {
+		// Wait for the better file to be ready
+		if (bftw_ioq_pop(state, true) < 0) {
+			break;
+		}
+		stalled = true;
 	}
 
-	// Build the path backwards
-	if (name) {
-		bftw_prepend_path(state->path, nameoff, namelen, name);
+	struct bftw_file *file = bftw_queue_pop(queue);
+	if (!file) {
+		bfs_trace_end("bftw_pop", start);
+		return false;
 	}
-	while (file && file != ancestor) {
-		bftw_prepend_path(state->path, file->nameoff, file->namelen, file->name);
 
-		if (ancestor && ancestor->depth == file->depth) {
-			ancestor = ancestor->parent;
+	if (state->progress && queue == &state->dirq) {
+		++state->progress->dirs;
+	}
+
+	while (file->ioqueued) {
+		bftw_ioq_pop(state, true);
+		stalled = true;
+	}
+
+	if (file->prefetch) {
+		// Don't visit (and maybe free) directories before they're open
+		while (file->prefetch) {
+			if (bftw_ioq_pop(state, true) < 0) {
+				break;
+			}
 		}
-		file = file->parent;
+		bftw_lookahead_update(state, true);
 	}
+	bfs_trace_end("bftw_pop", start);
 
-	state->previous = state->file;
-	return 0;
+	if (queue == &state->dirq) {
+		bftw_lookahead_update(state, stalled);
+	}
+
+	state->file = file;
+	return true;
 }
 
-/** Open a bftw_file as a directory. */
-static struct bfs_dir *bftw_file_opendir(struct bftw_state *state, struct bftw_file *file, const char *path) {
-	int fd = bftw_file_open(state, file, path);
-	if (fd < 0) {
-		return NULL;
-	}
+/** The size of the buffers for reading and writing sorted runs. */
+#define BFTW_RUN_BUFSIZE (64 << 10)
 
-	struct bftw_cache *cache = &state->cache;
-	struct bfs_dir *dir = bftw_allocdir(cache, true);
-	if (!dir) {
-		return NULL;
+/** Create the temporary file for spilled runs. */
+static int bftw_runs_open(struct bftw_runs *runs) {
+	const char *tmpdir = getenv("TMPDIR");
+	if (!tmpdir || !tmpdir[0]) {
+		tmpdir = "/tmp";
 	}
 
-	if (bfs_opendir(dir, fd, NULL, state->dir_flags) != 0) {
-		bftw_freedir(cache, dir);
-		return NULL;
+	dchar *path = dstrprintf("%s/bfs.XXXXXX", tmpdir);
+	if (!path) {
+		return -1;
 	}
 
-	bftw_file_set_dir(cache, file, dir);
-	return dir;
-}
+	int fd = mkstemp(path);
+	int error = errno;
+	if (fd >= 0) {
+		// Nobody else needs to see it
+		unlink(path);
+	}
+	dstrfree(path);
 
-/** Open the current directory. */
-static int bftw_opendir(struct bftw_state *state) {
-	bfs_assert(!state->dir);
-	bfs_assert(!state->de);
+	if (fd < 0) {
+		errno = error;
+		return -1;
+	}
 
-	state->direrror = 0;
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+		goto fail;
+	}
 
-	struct bftw_file *file = state->file;
-	state->dir = file->dir;
-	if (state->dir) {
-		goto pin;
+	runs->wbuf = ALLOC_ARRAY(char, BFTW_RUN_BUFSIZE);
+	if (!runs->wbuf) {
+		goto fail;
 	}
 
-	if (bftw_build_path(state, NULL) != 0) {
+	runs->fd = fd;
+	return 0;
+
+fail:
+	close_quietly(fd);
+	return -1;
+}
+
+/** Flush the run write buffer. */
+static int bftw_runs_flush(struct bftw_runs *runs) {
+	size_t len = runs->wlen;
+	runs->wlen = 0;
+
+	if (xwrite(runs->fd, runs->wbuf, len) != len) {
 		return -1;
 	}
 
-	bftw_queue_rebalance(&state->dirq, false);
+	runs->size += len;
+	return 0;
+}
 
+/** Append some data to the spilled runs. */
+static int bftw_runs_write(struct bftw_runs *runs, const void *data, size_t len) {
+	if (runs->wlen + len > BFTW_RUN_BUFSIZE) {
+		if (bftw_runs_flush(runs) != 0) {
+			return -1;
+		}
+	}
+
+	if (len > BFTW_RUN_BUFSIZE) {
+		if (xwrite(runs->fd, data, len) != len) {
+			return -1;
+		}
+		runs->size += len;
+	} else {
+		memcpy(runs->wbuf + runs->wlen, data, len);
+		runs->wlen += len;
+	}
+
+	return 0;
+}
+
+/** Free a buffered file whose record has been spilled. */
+static void bftw_runs_release(struct bftw_cache *cache, struct bftw_file *file) {
+	struct bftw_file *parent = file->parent;
+	if (parent) {
+		// The runs hold their own reference to the parent
+		bfs_assert(parent->refcount > 1);
+		--parent->refcount;
+	}
+
+	--file->refcount;
+	bftw_file_free(cache, file);
+}
+
+/** Sort the buffered files, and spill them to a new run. */
+static int bftw_runs_spill(struct bftw_state *state) {
+	struct bftw_runs *runs = &state->runs;
+	struct bftw_queue *fileq = &state->fileq;
+
+	if (runs->fd < 0 && bftw_runs_open(runs) != 0) {
+		return -1;
+	}
+
+	struct bftw_run *run = RESERVE(struct bftw_run, &runs->runs, &runs->nruns);
+	if (!run) {
+		return -1;
+	}
+	run->head = NULL;
+	SLIST_INIT(&run->list);
+	run->offset = runs->size + runs->wlen;
+	run->end = run->offset;
+	run->buf = NULL;
+	run->cap = 0;
+	run->pos = 0;
+	run->len = 0;
+
+	bftw_name_sort(&fileq->buffer);
+
+	// Everything buffered at once has the same parent
+	struct bftw_file *parent = SLIST_HEAD(&fileq->buffer)->parent;
+	if (runs->nruns == 1) {
+		runs->parent = parent;
+		if (parent) {
+			++parent->refcount;
+		}
+	}
+	bfs_assert(parent == runs->parent);
+
+	struct bftw_file *file;
+	while ((file = SLIST_HEAD(&fileq->buffer))) {
+		struct bftw_run_rec rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.ino = file->ino;
+		rec.namelen = file->namelen;
+		rec.type = file->type;
+
+		if (bftw_runs_write(runs, &rec, sizeof(rec)) != 0) {
+			return -1;
+		}
+		if (bftw_runs_write(runs, file->name, file->namelen + 1) != 0) {
+			return -1;
+		}
+		run->end = runs->size + runs->wlen;
+
+		SLIST_POP(&fileq->buffer);
+		--fileq->size;
+		--runs->buffered;
+		bftw_runs_release(&state->cache, file);
+	}
+
+	return 0;
+}
+
+/** Count a newly buffered file, spilling a run if there are too many. */
+static int bftw_runs_push(struct bftw_state *state) {
+	struct bftw_runs *runs = &state->runs;
+	if (runs->limit == 0 || ++runs->buffered < runs->limit) {
+		return 0;
+	}
+
+	return bftw_runs_spill(state);
+}
+
+/** Make sure a run's buffer holds at least `need` bytes. */
+static int bftw_run_fill(struct bftw_run *run, int fd, size_t need) {
+	size_t avail = run->len - run->pos;
+	if (avail >= need) {
+		return 0;
+	}
+
+	if (avail > 0) {
+		memmove(run->buf, run->buf + run->pos, avail);
+	}
+	run->pos = 0;
+	run->len = avail;
+
+	if (need > run->cap) {
+		size_t cap = need > BFTW_RUN_BUFSIZE ? need : BFTW_RUN_BUFSIZE;
+		char *buf = REALLOC_ARRAY(char, run->buf, run->cap, cap);
+		if (!buf) {
+			return -1;
+		}
+		run->buf = buf;
+		run->cap = cap;
+	}
+
+	while (run->len < need) {
+		size_t size = run->cap - run->len;
+		off_t left = run->end - run->offset;
+		if ((off_t)size > left) {
+			size = left;
+		}
+
+		ssize_t ret = 0;
+		if (size > 0) {
+			ret = pread(fd, run->buf + run->len, size, run->offset);
+		}
+
+		if (ret > 0) {
+			run->len += ret;
+			run->offset += ret;
+		} else if (ret == 0) {
+			// The run was cut short
+			errno = EIO;
+			return -1;
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Advance a run to its next file. */
+static int bftw_run_next(struct bftw_state *state, struct bftw_run *run) {
+	struct bftw_runs *runs = &state->runs;
+
+	run->head = SLIST_POP(&run->list);
+	if (run->head || (run->pos == run->len && run->offset == run->end)) {
+		return 0;
+	}
+
+	struct bftw_run_rec rec;
+	if (bftw_run_fill(run, runs->fd, sizeof(rec)) != 0) {
+		return -1;
+	}
+	memcpy(&rec, run->buf + run->pos, sizeof(rec));
+
+	size_t size = sizeof(rec) + rec.namelen + 1;
+	if (bftw_run_fill(run, runs->fd, size) != 0) {
+		return -1;
+	}
+
+	const char *name = run->buf + run->pos + sizeof(rec);
+	struct bftw_file *file = bftw_file_new(&state->cache, runs->parent, name, rec.namelen);
+	if (!file) {
+		return -1;
+	}
+	run->pos += size;
+
+	file->type = rec.type;
+	file->ino = rec.ino;
+	run->head = file;
+	return 0;
+}
+
+/** Compare two runs by their heads (earlier runs win ties, for stability). */
+static bool bftw_runs_less(const struct bftw_runs *runs, size_t i, size_t j) {
+	int cmp = bftw_name_cmp(runs->runs[i].head, runs->runs[j].head);
+	return cmp < 0 || (cmp == 0 && i < j);
+}
+
+/** Restore the heap property below a changed run. */
+static void bftw_runs_sift(struct bftw_runs *runs, size_t i) {
+	size_t *heap = runs->heap;
+	size_t n = runs->nheap;
+
+	while (true) {
+		size_t min = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+		if (left < n && bftw_runs_less(runs, heap[left], heap[min])) {
+			min = left;
+		}
+		if (right < n && bftw_runs_less(runs, heap[right], heap[min])) {
+			min = right;
+		}
+		if (min == i) {
+			break;
+		}
+
+		size_t tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/** Free the runs themselves. */
+static void bftw_runs_clear(struct bftw_runs *runs) {
+	for (size_t i = 0; i < runs->nruns; ++i) {
+		free(runs->runs[i].buf);
+	}
+	free(runs->runs);
+	runs->runs = NULL;
+	runs->nruns = 0;
+
+	free(runs->heap);
+	runs->heap = NULL;
+	runs->nheap = 0;
+}
+
+/** Clean up once every run has been merged. */
+static int bftw_runs_finish(struct bftw_runs *runs) {
+	bftw_runs_clear(runs);
+
+	struct bftw_file *parent = runs->parent;
+	if (parent) {
+		// The merged files still hold references to the parent
+		bfs_assert(parent->refcount > 1);
+		--parent->refcount;
+		runs->parent = NULL;
+	}
+
+	// Reuse the temporary file for the next big directory
+	runs->size = 0;
+	if (ftruncate(runs->fd, 0) != 0) {
+		return -1;
+	}
+	if (lseek(runs->fd, 0, SEEK_SET) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Add the next batch of merged files to the queue. */
+static int bftw_runs_refill(struct bftw_state *state) {
+	struct bftw_runs *runs = &state->runs;
+	struct bftw_queue *fileq = &state->fileq;
+
+	// Top up the queue once it's half empty
+	if (runs->nheap == 0 || fileq->size > runs->limit / 2) {
+		return 0;
+	}
+
+	int ret = 0;
+	while (runs->nheap > 0 && fileq->size < runs->limit) {
+		struct bftw_run *run = &runs->runs[runs->heap[0]];
+		bftw_queue_push(fileq, run->head);
+
+		if (bftw_run_next(state, run) != 0) {
+			ret = -1;
+			break;
+		}
+
+		if (!run->head) {
+			runs->heap[0] = runs->heap[--runs->nheap];
+		}
+		bftw_runs_sift(runs, 0);
+	}
+
+	bftw_queue_flush(fileq);
+	bftw_stat_files(state);
+
+	if (ret == 0 && runs->nheap == 0) {
+		ret = bftw_runs_finish(runs);
+	}
+	return ret;
+}
+
+/** Merge the spilled runs with the rest of the (sorted) buffer. */
+static int bftw_runs_merge(struct bftw_state *state) {
+	struct bftw_runs *runs = &state->runs;
+	struct bftw_queue *fileq = &state->fileq;
+
+	// The buffer becomes the last run
+	struct bftw_run *run = RESERVE(struct bftw_run, &runs->runs, &runs->nruns);
+	if (!run) {
+		return -1;
+	}
+	run->head = NULL;
+	SLIST_INIT(&run->list);
+	SLIST_EXTEND(&run->list, &fileq->buffer);
+	run->offset = 0;
+	run->end = 0;
+	run->buf = NULL;
+	run->cap = 0;
+	run->pos = 0;
+	run->len = 0;
+
+	fileq->size -= runs->buffered;
+	runs->buffered = 0;
+
+	if (runs->wlen > 0 && bftw_runs_flush(runs) != 0) {
+		return -1;
+	}
+
+	runs->heap = ALLOC_ARRAY(size_t, runs->nruns);
+	if (!runs->heap) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < runs->nruns; ++i) {
+		if (bftw_run_next(state, &runs->runs[i]) != 0) {
+			return -1;
+		}
+		if (runs->runs[i].head) {
+			runs->heap[runs->nheap++] = i;
+		}
+	}
+
+	for (size_t i = runs->nheap / 2; i-- > 0;) {
+		bftw_runs_sift(runs, i);
+	}
+
+	return bftw_runs_refill(state);
+}
+
+/** Add a path component to the path. */
+static void bftw_prepend_path(char *path, size_t nameoff, size_t namelen, const char *name) {
+	if (nameoff > 0) {
+		path[nameoff - 1] = '/';
+	}
+	memcpy(path + nameoff, name, namelen);
+}
+
+/** Get the path to a file in the tree. */
+static int bftw_file_path(const struct bftw_file *file, dchar **path) {
+	if (dstresize(path, file->nameoff + file->namelen) != 0) {
+		return -1;
+	}
+
+	for (; file; file = file->parent) {
+		bftw_prepend_path(*path, file->nameoff, file->namelen, file->name);
+	}
+	return 0;
+}
+
+/** Add a queued directory to a checkpoint. */
+static int bftw_checkpoint_add(dchar **buf, size_t **depths, size_t *count, dchar **path, const struct bftw_file *file) {
+	if (bftw_file_path(file, path) != 0) {
+		return -1;
+	}
+
+	size_t *depth = RESERVE(size_t, depths, count);
+	if (!depth) {
+		return -1;
+	}
+	*depth = file->depth;
+
+	// Keep the terminating NUL to separate the paths
+	return dstrxcat(buf, *path, dstrlen(*path) + 1);
+}
+
+/** Pass the queued directories to the checkpoint function. */
+static int bftw_save_checkpoint(struct bftw_state *state) {
+	struct bftw_queue *queue = &state->dirq;
+
+	// Wait for any in-flight opendir() calls, so every queued directory
+	// is on one of the lists
+	while (queue->ioqueued > 0) {
+		if (bftw_ioq_pop(state, true) < 0) {
+			break;
+		}
+	}
+
+	int ret = -1;
+	dchar *buf = dstralloc(0);
+	dchar *path = dstralloc(0);
+	size_t *depths = NULL;
+	size_t count = 0;
+	const char **paths = NULL;
+	if (!buf || !path) {
+		goto done;
+	}
+
+	for_slist (struct bftw_file, file, &queue->buffer) {
+		if (bftw_checkpoint_add(&buf, &depths, &count, &path, file) != 0) {
+			goto done;
+		}
+	}
+
+	for_slist (struct bftw_file, file, &queue->ready, ready) {
+		if (bftw_checkpoint_add(&buf, &depths, &count, &path, file) != 0) {
+			goto done;
+		}
+	}
+
+	// With BFTW_QORDER, every waiting file is also on the ready list
+	if (!(queue->flags & BFTW_QORDER)) {
+		for_slist (struct bftw_file, file, &queue->waiting) {
+			if (bftw_checkpoint_add(&buf, &depths, &count, &path, file) != 0) {
+				goto done;
+			}
+		}
+	}
+
+	paths = ALLOC_ARRAY(const char *, count);
+	if (count > 0 && !paths) {
+		goto done;
+	}
+	const char *str = buf;
+	for (size_t i = 0; i < count; ++i) {
+		paths[i] = str;
+		str += strlen(str) + 1;
+	}
+
+	state->checkpoint(paths, depths, count, state->ptr);
+	ret = 0;
+
+done:
+	free(paths);
+	free(depths);
+	dstrfree(path);
+	dstrfree(buf);
+	return ret;
+}
+
+/** Pop a directory to read from the queue. */
+static bool bftw_pop_dir(struct bftw_state *state) {
+	bfs_assert(!state->file);
+
+	if (state->checkpoint && bfs_perf_now() >= state->checkpoint_next) {
+		if (state->fileq.size > 0) {
+			// Visit the buffered files first, so the checkpoint
+			// doesn't lose them
+			return false;
+		}
+
+		if (bftw_save_checkpoint(state) != 0) {
+			state->error = errno;
+			return false;
+		}
+		state->checkpoint_next = bfs_perf_now() + state->checkpoint_interval;
+	}
+
+	if (bftw_must_order(state)) {
+		// Keep the strict order
+		bool bfs = state->strategy == BFTW_BFS || state->strategy == BFTW_BEST;
+		if (bfs && bftw_queue_ready(&state->fileq)) {
+			return false;
+		}
+		if (state->runs.nheap > 0) {
+			return false;
+		}
+	} else if (!bftw_queue_ready(&state->dirq)) {
+		// Don't block if we have files ready to visit
+		if (bftw_queue_ready(&state->fileq)) {
+			return false;
+		}
+	}
+
+	return bftw_pop(state, &state->dirq);
+}
+
+/** Pop a file to visit from the queue. */
+static bool bftw_pop_file(struct bftw_state *state) {
+	bfs_assert(!state->file);
+
+	if (bftw_runs_refill(state) != 0) {
+		state->error = errno;
+		return false;
+	}
+
+	if (!bftw_pop(state, &state->fileq)) {
+		return false;
+	}
+
+	if (state->file->dir) {
+		// Keep the prefetch window moving
+		bftw_prefetch_dirs(state);
+	}
+	return true;
+}
+
+/** Get the length of a name to visit, without strlen() if possible. */
+static size_t bftw_namelen(const struct bftw_state *state, const char *name) {
+	const struct bfs_dirent *de = state->de;
+	if (de && name == de->name) {
+		return de->namelen;
+	} else {
+		return strlen(name);
+	}
+}
+
+/** Build the path to the current file. */
+static int bftw_build_path(struct bftw_state *state, const char *name) {
+	const struct bftw_file *file = state->file;
+
+	size_t nameoff, namelen;
+	if (name) {
+		nameoff = file ? bftw_child_nameoff(file) : 0;
+		namelen = bftw_namelen(state, name);
+	} else {
+		nameoff = file->nameoff;
+		namelen = file->namelen;
+	}
+
+	size_t pathlen = nameoff + namelen;
+	if (dstresize(&state->path, pathlen) != 0) {
+		state->error = errno;
+		return -1;
+	}
+
+	// Try to find a common ancestor with the existing path
+	const struct bftw_file *ancestor = state->previous;
+	while (ancestor && ancestor->depth > file->depth) {
+		ancestor = ancestor->parent;
+	}
+
+	// Build the path backwards
+	if (name) {
+		bftw_prepend_path(state->path, nameoff, namelen, name);
+	}
+	while (file && file != ancestor) {
+		bftw_prepend_path(state->path, file->nameoff, file->namelen, file->name);
+
+		if (ancestor && ancestor->depth == file->depth) {
+			ancestor = ancestor->parent;
+		}
+		file = file->parent;
+	}
+
+	state->previous = state->file;
+	return 0;
+}
+
+/** Open a bftw_file as a directory. */
+static struct bfs_dir *bftw_file_opendir(struct bftw_state *state, struct bftw_file *file, const char *path) {
+	int fd = bftw_file_open(state, file, path);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	struct bfs_dir *dir = bftw_allocdir(cache, true);
+	if (!dir) {
+		return NULL;
+	}
+
+	if (bfs_opendir(dir, fd, NULL, bftw_file_dir_flags(state, file)) != 0) {
+		bftw_freedir(cache, dir);
+		return NULL;
+	}
+
+	bftw_file_set_dir(cache, file, dir);
+	return dir;
+}
+
+/** Stop recording a directory listing. */
+static void bftw_listing_discard(struct bftw_listings *listings) {
+	listings->recording = false;
+	free(listings->entries);
+	listings->entries = NULL;
+	listings->count = 0;
+	if (listings->names) {
+		dstresize(&listings->names, 0);
+	}
+}
+
+/** Evict the least recently used listing. */
+static void bftw_listing_evict(struct bftw_listings *listings) {
+	struct bftw_listing *listing = listings->tail;
+	LIST_REMOVE(listings, listing);
+	trie_remove(&listings->trie, listing->leaf);
+	listing->leaf = NULL;
+	listings->size -= listing->size;
+	bftw_listing_unref(listing);
+}
+
+/** Free the cached listings. */
+static void bftw_listings_destroy(struct bftw_listings *listings) {
+	while (listings->tail) {
+		bftw_listing_evict(listings);
+	}
+	trie_destroy(&listings->trie);
+
+	bftw_listing_discard(listings);
+	dstrfree(listings->names);
+	dstrfree(listings->key);
+}
+
+/** Look for a cached listing of a directory that is about to be queued. */
+static void bftw_listing_find(struct bftw_state *state, struct bftw_file *file) {
+	struct bftw_listings *listings = &state->listings;
+	if (!listings->head) {
+		return;
+	}
+
+	// state->path is already the path to this directory
+	bfs_assert(dstrlen(state->path) == file->nameoff + file->namelen);
+	struct trie_leaf *leaf = trie_find_str(&listings->trie, state->path);
+	if (leaf) {
+		struct bftw_listing *listing = leaf->value;
+		++listing->refcount;
+		file->listing = listing;
+	}
+}
+
+/** Start replaying the current directory's cached listing. */
+static void bftw_listing_replay(struct bftw_state *state) {
+	struct bftw_listings *listings = &state->listings;
+	struct bftw_listing *listing = state->file->listing;
+
+	if (listing->leaf) {
+		LIST_REMOVE(listings, listing);
+		LIST_PREPEND(listings, listing);
+	}
+
+	listings->replay = listing;
+	listings->pos = 0;
+	listings->namepos = 0;
+	bfs_perf_count(BFS_PERF_DIRS_CACHED);
+}
+
+/** Start recording the current directory's listing. */
+static int bftw_listing_record(struct bftw_state *state) {
+	struct bftw_listings *listings = &state->listings;
+	if (listings->limit == 0) {
+		return 0;
+	}
+
+	// The path isn't built yet for directories opened by the ioq
+	if (bftw_build_path(state, NULL) != 0) {
+		return -1;
+	}
+
+	if (!listings->names) {
+		listings->names = dstralloc(0);
+		if (!listings->names) {
+			return 0;
+		}
+	}
+
+	const struct bftw_file *file = state->file;
+	if (dstrxcpy(&listings->key, state->path, file->nameoff + file->namelen) == 0) {
+		listings->recording = true;
+	}
+	return 0;
+}
+
+/** Add an entry to the listing being recorded. */
+static void bftw_listing_add(struct bftw_listings *listings, const struct bfs_dirent *de) {
+	if (!listings->recording) {
+		return;
+	}
+
+	struct bftw_listing_entry *entry = RESERVE(struct bftw_listing_entry, &listings->entries, &listings->count);
+	if (!entry) {
+		goto fail;
+	}
+	entry->ino = de->ino;
+	entry->namelen = de->namelen;
+	entry->type = de->type;
+
+	// Include the NUL terminator
+	if (dstrxcat(&listings->names, de->name, de->namelen + 1) != 0) {
+		goto fail;
+	}
+
+	size_t size = sizeof_flex(struct bftw_listing, entries, listings->count);
+	if (size + dstrlen(listings->names) > listings->limit) {
+		goto fail;
+	}
+
+	return;
+fail:
+	// Just read it again next time
+	bftw_listing_discard(listings);
+}
+
+/** Save the recorded listing once the whole directory has been read. */
+static void bftw_listing_commit(struct bftw_listings *listings) {
+	if (!listings->recording) {
+		return;
+	}
+
+	size_t offset = sizeof_flex(struct bftw_listing, entries, listings->count);
+	size_t nameslen = dstrlen(listings->names);
+	size_t size = align_ceil(alignof(struct bftw_listing), offset + nameslen);
+	if (size > listings->limit) {
+		goto done;
+	}
+
+	while (listings->size + size > listings->limit) {
+		bftw_listing_evict(listings);
+	}
+
+	struct trie_leaf *leaf = trie_insert_str(&listings->trie, listings->key);
+	if (!leaf || leaf->value) {
+		goto done;
+	}
+
+	struct bftw_listing *listing = alloc(alignof(struct bftw_listing), size);
+	if (!listing) {
+		trie_remove(&listings->trie, leaf);
+		goto done;
+	}
+
+	listing->leaf = leaf;
+	LIST_ITEM_INIT(listing);
+	listing->refcount = 1;
+	listing->size = size;
+	listing->names = (char *)listing + offset;
+	listing->count = listings->count;
+	if (listing->count) {
+		memcpy(listing->entries, listings->entries, sizeof_array(struct bftw_listing_entry, listing->count));
+	}
+	if (nameslen) {
+		memcpy(listing->names, listings->names, nameslen);
+	}
+	leaf->value = listing;
+
+	// New listings start out cold, so reading the next level down can't
+	// flush the shallower listings that every pass needs
+	LIST_APPEND(listings, listing);
+	listings->size += size;
+
+done:
+	bftw_listing_discard(listings);
+}
+
+/** Read a raw entry from the current directory, or its cached listing. */
+static int bftw_listing_read(struct bftw_state *state, struct bfs_dirent *de) {
+	struct bftw_listings *listings = &state->listings;
+
+	const struct bftw_listing *listing = listings->replay;
+	if (listing) {
+		if (listings->pos == listing->count) {
+			return 0;
+		}
+
+		const struct bftw_listing_entry *entry = &listing->entries[listings->pos++];
+		de->type = entry->type;
+		de->name = listing->names + listings->namepos;
+		de->namelen = entry->namelen;
+		de->ino = entry->ino;
+		de->stat = NULL;
+		listings->namepos += entry->namelen + 1;
+		return 1;
+	}
+
+	int ret = bfs_readdir(state->dir, de);
+	if (ret < 0 && errno == EAGAIN && state->ahead) {
+		// We caught up with the read-ahead
+		bftw_readahead_wait(state);
+		ret = bfs_readdir(state->dir, de);
+	}
+
+	if (ret > 0) {
+		bftw_listing_add(listings, de);
+		bftw_readahead(state);
+	} else if (ret == 0) {
+		bftw_listing_commit(listings);
+	}
+	return ret;
+}
+
+/** Bulk-load the attributes of a root's whole file system, if possible. */
+static void bftw_bulkstat_load(struct bftw_state *state, const struct bftw_file *root) {
+	if (!(state->flags & BFTW_BULKSTAT) || !state->mtab || root->dev == (dev_t)-1) {
+		return;
+	}
+
+	struct bfs_bulkstat *bulk = state->bulkstat;
+	if (bulk && bfs_bulkstat_dev(bulk) == root->dev) {
+		return;
+	}
+
+	// Failures just mean we stat() everything as usual
+	int error = errno;
+
+	// Enumerating a whole file system is only worth it for its mount point
+	int fd = bfs_dirfd(state->dir);
+	struct bfs_stat parent;
+	if (bfs_stat(fd, "..", BFS_STAT_NOFOLLOW, &parent) != 0) {
+		goto done;
+	} else if (parent.dev == root->dev && parent.ino != root->ino) {
+		goto done;
+	}
+
+	const char *type = bfs_dev_fstype(state->mtab, root->dev);
+	if (!type) {
+		goto done;
+	}
+
+	uint64_t start = bfs_trace_begin();
+	bulk = bfs_bulkstat_load(fd, type, state->stat_mask);
+	bfs_trace_end("bulkstat", start);
+	if (bulk) {
+		bfs_bulkstat_free(state->bulkstat);
+		state->bulkstat = bulk;
+	}
+
+done:
+	errno = error;
+}
+
+/** Fill in a directory entry's attributes from the bulkstat table. */
+static void bftw_bulkstat_find(struct bftw_state *state, struct bfs_dirent *de) {
+	const struct bfs_bulkstat *bulk = state->bulkstat;
+	if (!bulk || de->stat || de->type == BFS_DIR) {
+		return;
+	} else if (state->file->dev != bfs_bulkstat_dev(bulk)) {
+		return;
+	}
+
+	// Mount points (and nested btrfs subvolumes, which are always
+	// directories) have the attributes of a different file system
+	if (state->mtab && bfs_might_be_mount(state->mtab, de->name)) {
+		return;
+	}
+
+	struct bfs_stat *buf = &state->bulkstat_buf;
+	if (bfs_bulkstat_find(bulk, de->ino, buf) == 0 && !S_ISDIR(buf->mode)) {
+		de->stat = buf;
+	}
+}
+
+/** Open the current directory. */
+/** Check whether a file system's directory link counts include each subdirectory. */
+static bool bftw_nlink_counts_subdirs(const char *type) {
+	static const char *const types[] = {
+		"ext2",
+		"ext3",
+		"ext4",
+		"tmpfs",
+		"xfs",
+	};
+
+	for (size_t i = 0; i < countof(types); ++i) {
+		if (strcmp(type, types[i]) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Check whether a directory was last modified before the BFTW_SKIP_STALE cutoff. */
+static bool bftw_is_stale(const struct bftw_state *state, const struct bfs_stat *buf) {
+	if (!(buf->mask & BFS_STAT_MTIME)) {
+		return false;
+	}
+
+	const struct timespec *mtime = &buf->mtime;
+	const struct timespec *cutoff = &state->stale_time;
+	return mtime->tv_sec < cutoff->tv_sec
+		|| (mtime->tv_sec == cutoff->tv_sec && mtime->tv_nsec < cutoff->tv_nsec);
+}
+
+/**
+ * Decide whether BFTW_DIRS_ONLY or BFTW_SKIP_STALE applies to the current
+ * directory, and if so, work out how many subdirectories it has, so we can stop
+ * reading it once we've seen them all.
+ */
+static void bftw_count_subdirs(struct bftw_state *state) {
+	state->subdirs = SIZE_MAX;
+
+	bool stale = !state->dirs_only && (state->flags & BFTW_SKIP_STALE);
+	if (!state->dirs_only && !stale) {
+		return;
+	}
+
+	// Failures just mean we read the whole directory
+	int error = errno;
+
+	struct bfs_stat buf;
+	if (bfs_stat(bfs_dirfd(state->dir), NULL, BFS_STAT_NOFOLLOW, &buf) != 0) {
+		goto done;
+	}
+
+	if (stale) {
+		if (!bftw_is_stale(state, &buf)) {
+			goto done;
+		}
+		bfs_perf_count(BFS_PERF_DIRS_STALE);
+		state->dirs_only = true;
+	}
+
+	// Links to directories aren't counted
+	if ((state->flags & BFTW_FOLLOW_ALL) || !state->mtab) {
+		goto done;
+	}
+
+	// One link from the parent, one from ".", and one from each ".."; some
+	// file systems use 1 when the count overflows or isn't tracked
+	if (buf.nlink < 2) {
+		goto done;
+	}
+
+	const char *type = bfs_fstype(state->mtab, &buf);
+	if (type && bftw_nlink_counts_subdirs(type)) {
+		state->subdirs = buf.nlink - 2;
+	}
+
+done:
+	errno = error;
+}
+
+static int bftw_opendir(struct bftw_state *state) {
+	bfs_assert(!state->dir);
+	bfs_assert(!state->de);
+
+	state->direrror = 0;
+	state->dirs_only = state->flags & BFTW_DIRS_ONLY;
+	state->subdirs = SIZE_MAX;
+	state->nentries = 0;
+	state->nunknown = 0;
+	state->batch = false;
+	state->ahead = false;
+
+	struct bftw_file *file = state->file;
+	if (file->listing) {
+		// No need to read it again
+		bftw_listing_replay(state);
+		return 0;
+	}
+
+	state->dir = file->dir;
+	if (state->dir) {
+		goto pin;
+	}
+
+	if (bftw_build_path(state, NULL) != 0) {
+		return -1;
+	}
+
+	bfs_perf_count(BFS_PERF_DIRS_SYNC);
+	bftw_queue_rebalance(&state->dirq, false);
+
+	uint64_t start = 0;
+	if (state->throttle) {
+		start = bfs_throttle_start(state->throttle);
+	}
 	state->dir = bftw_file_opendir(state, file, state->path);
+	if (state->throttle) {
+		bfs_throttle_end(state->throttle, start);
+	}
 	if (!state->dir) {
 		state->direrror = errno;
 		return 0;
 	}
 
-pin:
-	bftw_cache_pin(&state->cache, file);
-	return 0;
-}
-
-/** Read an entry from the current directory. */
-static int bftw_readdir(struct bftw_state *state) {
-	if (!state->dir) {
-		return -1;
+pin:
+	bftw_cache_pin(&state->cache, file);
+	if (file->depth == 0) {
+		bftw_bulkstat_load(state, file);
+	}
+	bftw_count_subdirs(state);
+	return bftw_listing_record(state);
+}
+
+/** The number of unknown types that make a directory worth batching. */
+#define BFTW_BATCH_MIN 8
+
+/**
+ * Switch to batched stat() calls for directories with mostly unknown types.
+ * Without batching, the ioq and the main thread take turns, so on file
+ * systems with slow stat() calls (and no d_type, e.g. some NFS and FUSE
+ * mounts), half the entries would still pay for a serial round trip.
+ */
+static void bftw_detect_batch(struct bftw_state *state, const struct bfs_dirent *de) {
+	if (state->batch || !state->ioq) {
+		return;
+	}
+
+	++state->nentries;
+	if (de->type != BFS_UNKNOWN) {
+		return;
+	}
+
+	++state->nunknown;
+	if (state->nunknown >= BFTW_BATCH_MIN && 2 * state->nunknown > state->nentries) {
+		bfs_perf_count(BFS_PERF_DIRS_BATCHED);
+		state->batch = true;
+	}
+}
+
+/** Check whether BFTW_DIRS_ONLY lets us skip a directory entry. */
+static bool bftw_skip_nondir(const struct bftw_state *state, const struct bfs_dirent *de) {
+	if (!state->dirs_only) {
+		return false;
+	}
+
+	switch (de->type) {
+	case BFS_DIR:
+	case BFS_UNKNOWN:
+		return false;
+	case BFS_LNK:
+		return !(state->flags & BFTW_FOLLOW_ALL);
+	default:
+		return true;
+	}
+}
+
+/** Read an entry from the current directory. */
+static int bftw_readdir(struct bftw_state *state) {
+	if (!state->dir && !state->listings.replay) {
+		return -1;
+	}
+
+	uint64_t start = bfs_trace_begin();
+
+	struct bftw_file *file = state->file;
+	struct bfs_dirent *de = &state->de_storage;
+	size_t depth = file->depth + 1;
+	int ret;
+	while (true) {
+		if (state->subdirs == 0) {
+			// The rest of the entries would all be skipped (but don't
+			// save the partial listing, since it would look complete)
+			ret = 0;
+			goto stop;
+		}
+
+		ret = bftw_listing_read(state, de);
+		if (ret <= 0) {
+			break;
+		}
+
+		// Remember what we saw, for -empty (which ignores whiteouts)
+		if (de->type != BFS_WHT) {
+			file->empty = 0;
+		}
+
+		if (bftw_skip_nondir(state, de)) {
+			continue;
+		}
+
+		if (de->type == BFS_DIR && state->subdirs != SIZE_MAX) {
+			--state->subdirs;
+		}
+
+		bftw_detect_batch(state, de);
+
+		if (!state->filter || !state->filter(de, depth, state->ptr)) {
+			break;
+		}
+	}
+
+	if (ret == 0 && file->empty < 0) {
+		file->empty = 1;
 	}
 
-	int ret = bfs_readdir(state->dir, &state->de_storage);
+stop:
+
 	if (ret > 0) {
+		bftw_bulkstat_find(state, de);
 		state->de = &state->de_storage;
 	} else if (ret == 0) {
 		state->de = NULL;
@@ -1649,6 +4722,7 @@ static int bftw_readdir(struct bftw_state *state) {
 		state->direrror = errno;
 	}
 
+	bfs_trace_end("bftw_readdir", start);
 	return ret;
 }
 
@@ -1684,7 +4758,13 @@ static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
 	ftwbuf->loopoff = 0;
 	ftwbuf->at_fd = AT_FDCWD;
 	ftwbuf->at_path = ftwbuf->path;
-	bftw_stat_init(&ftwbuf->stat_bufs, &state->stat_buf, &state->lstat_buf);
+	ftwbuf->empty = -1;
+	ftwbuf->usage = 0;
+	bftw_stat_init(&ftwbuf->stat_bufs, &state->stat_buf, &state->lstat_buf, &state->link_buf);
+	if (state->flags & BFTW_SHARE_TARGETS) {
+		ftwbuf->stat_bufs.targets = &state->targets;
+	}
+	ftwbuf->fsade = (struct bfs_fsade_probe){0};
 
 	struct bftw_file *parent = NULL;
 	if (de) {
@@ -1692,13 +4772,37 @@ static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
 		ftwbuf->depth = file->depth + 1;
 		ftwbuf->type = de->type;
 		ftwbuf->nameoff = bftw_child_nameoff(file);
+		if (de->stat) {
+			// The directory listing already told us the attributes
+			state->lstat_buf = *de->stat;
+			bftw_stat_cache(&ftwbuf->stat_bufs, BFS_STAT_NOFOLLOW, &state->lstat_buf, 0);
+		}
 	} else if (file) {
 		parent = file->parent;
 		ftwbuf->depth = file->depth;
 		ftwbuf->type = file->type;
 		ftwbuf->nameoff = file->nameoff;
-		bftw_stat_fill(&ftwbuf->stat_bufs, &file->stat_bufs);
+		bftw_stat_unpack(state, ftwbuf, file);
+		ftwbuf->fsade = file->fsade;
+		if (visit == BFTW_POST) {
+			ftwbuf->empty = file->empty;
+			ftwbuf->usage = file->usage;
+		}
+	}
+
+	ftwbuf->parent_usage = parent ? &parent->usage : NULL;
+
+	if (file && !de) {
+		ftwbuf->cookie = &file->cookie;
+		ftwbuf->data = &file->data;
+	} else {
+		state->cookie = 0;
+		ftwbuf->cookie = &state->cookie;
+		state->data = NULL;
+		ftwbuf->data = &state->data;
 	}
+	ftwbuf->parent_cookie = parent ? &parent->cookie : NULL;
+	ftwbuf->parent_data = parent ? &parent->data : NULL;
 
 	if (parent) {
 		// Try to ensure the immediate parent is open, to avoid ENAMETOOLONG
@@ -1715,7 +4819,13 @@ static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
 		ftwbuf->nameoff = xbaseoff(ftwbuf->path);
 	}
 
-	ftwbuf->stat_flags = bftw_stat_flags(state, ftwbuf->depth);
+	ftwbuf->stat_flags = bftw_file_stat_flags(state, file, ftwbuf->depth);
+	ftwbuf->stat_mask = state->stat_mask;
+
+	ftwbuf->fstype = NULL;
+	if (parent && state->mtab && bftw_same_mount(state, ftwbuf)) {
+		ftwbuf->fstype = bftw_dir_fstype(state, parent);
+	}
 
 	if (ftwbuf->error != 0) {
 		ftwbuf->type = BFS_ERROR;
@@ -1734,7 +4844,11 @@ static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
 		}
 	}
 
-	if (ftwbuf->type == BFS_DIR && (state->flags & BFTW_DETECT_CYCLES)) {
+	// A POST visit was already checked when it was entered
+	if (ftwbuf->type == BFS_DIR && (state->flags & BFTW_DETECT_CYCLES) && visit == BFTW_PRE
+	    && idset_contains(&state->dirs, statbuf->dev, statbuf->ino)) {
+		// The same directory may be live under a different path, so make
+		// sure it's really an ancestor
 		for (const struct bftw_file *ancestor = parent; ancestor; ancestor = ancestor->parent) {
 			if (ancestor->dev == statbuf->dev && ancestor->ino == statbuf->ino) {
 				ftwbuf->type = BFS_ERROR;
@@ -1792,6 +4906,14 @@ static enum bftw_action bftw_call_back(struct bftw_state *state, const char *nam
 		goto done;
 	}
 
+	struct bftw_progress *progress = state->progress;
+	if (progress) {
+		progress->queued = state->dirq.size;
+		progress->inflight = state->dirq.ioqueued + state->fileq.ioqueued;
+		size_t capacity = state->cache.capacity;
+		progress->fds = progress->fd_limit > capacity ? progress->fd_limit - capacity : 0;
+	}
+
 	ret = state->callback(ftwbuf, state->ptr);
 	switch (ret) {
 	case BFTW_CONTINUE:
@@ -1819,6 +4941,7 @@ done:
 		const struct bfs_stat *buf = bftw_cached_stat(ftwbuf, BFS_STAT_FOLLOW);
 		const struct bfs_stat *lbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
 		if (bftw_stat_was_sync(state, buf) || bftw_stat_was_sync(state, lbuf)) {
+			bfs_perf_count(BFS_PERF_FILES_SYNC);
 			bftw_queue_rebalance(&state->fileq, false);
 		}
 	}
@@ -1846,6 +4969,9 @@ enum bftw_gc_flags {
 static int bftw_gc(struct bftw_state *state, enum bftw_gc_flags flags) {
 	int ret = 0;
 
+	// The directory can't be released while it's still being read
+	bftw_readahead_wait(state);
+
 	struct bftw_file *file = state->file;
 	if (file) {
 		if (state->dir) {
@@ -1857,6 +4983,9 @@ static int bftw_gc(struct bftw_state *state, enum bftw_gc_flags flags) {
 	}
 	state->dir = NULL;
 	state->de = NULL;
+	state->batch = false;
+	state->listings.replay = NULL;
+	bftw_listing_discard(&state->listings);
 
 	if (state->direrror != 0) {
 		if (flags & BFTW_VISIT_ERROR) {
@@ -1898,60 +5027,39 @@ static int bftw_gc(struct bftw_state *state, enum bftw_gc_flags flags) {
 		if (file->fd >= 0) {
 			bftw_close(state, file);
 		}
+		if (file->tracked) {
+			idset_unref(&state->dirs, file->dev, file->ino);
+		}
 		bftw_file_free(&state->cache, file);
 	}
 
 	return ret;
 }
 
-/** Sort a bftw_list by filename. */
-static void bftw_list_sort(struct bftw_list *list) {
-	if (!list->head || !list->head->next) {
-		return;
-	}
-
-	struct bftw_list left, right;
-	SLIST_INIT(&left);
-	SLIST_INIT(&right);
-
-	// Split
-	for (struct bftw_file *hare = list->head; hare && (hare = hare->next); hare = hare->next) {
-		struct bftw_file *tortoise = SLIST_POP(list);
-		SLIST_APPEND(&left, tortoise);
-	}
-	SLIST_EXTEND(&right, list);
-
-	// Recurse
-	bftw_list_sort(&left);
-	bftw_list_sort(&right);
+/** Flush all the queue buffers. */
+static int bftw_flush(struct bftw_state *state) {
+	int ret = 0;
 
-	// Merge
-	while (!SLIST_EMPTY(&left) && !SLIST_EMPTY(&right)) {
-		struct bftw_file *lf = left.head;
-		struct bftw_file *rf = right.head;
+	if (state->flags & BFTW_SORT) {
+		bftw_name_sort(&state->fileq.buffer);
 
-		if (strcoll(lf->name, rf->name) <= 0) {
-			SLIST_POP(&left);
-			SLIST_APPEND(list, lf);
-		} else {
-			SLIST_POP(&right);
-			SLIST_APPEND(list, rf);
+		if (state->runs.nruns > 0 && !state->runs.heap) {
+			// Some runs were spilled, and not yet merged
+			ret = bftw_runs_merge(state);
+			if (ret != 0) {
+				state->error = errno;
+			}
 		}
-	}
-	SLIST_EXTEND(list, &left);
-	SLIST_EXTEND(list, &right);
-}
-
-/** Flush all the queue buffers. */
-static void bftw_flush(struct bftw_state *state) {
-	if (state->flags & BFTW_SORT) {
-		bftw_list_sort(&state->fileq.buffer);
+		state->runs.buffered = 0;
 	}
 	bftw_queue_flush(&state->fileq);
 	bftw_stat_files(state);
+	bftw_prefetch_dirs(state);
 
 	bftw_queue_flush(&state->dirq);
 	bftw_ioq_opendirs(state);
+
+	return ret;
 }
 
 /** Close the current directory. */
@@ -1960,18 +5068,24 @@ static int bftw_closedir(struct bftw_state *state) {
 		return -1;
 	}
 
-	bftw_flush(state);
-	return 0;
+	return bftw_flush(state);
 }
 
 /** Fill file identity information from an ftwbuf. */
 static void bftw_save_ftwbuf(struct bftw_file *file, const struct BFTW *ftwbuf) {
 	file->type = ftwbuf->type;
+	file->cookie = *ftwbuf->cookie;
+	file->data = *ftwbuf->data;
 
 	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, ftwbuf->stat_flags);
 	if (statbuf) {
 		file->dev = statbuf->dev;
 		file->ino = statbuf->ino;
+
+		// st_size is only a rough guide for directories (it counts
+		// blocks on some file systems, and names on others), but
+		// anything over a page can use a bigger getdents() buffer
+		file->large = statbuf->size > 4096;
 	}
 }
 
@@ -1991,23 +5105,23 @@ static bool bftw_buffer_file(const struct bftw_state *state, const struct bftw_f
 		return false;
 	}
 
-	if (!bftw_queue_balanced(&state->fileq)) {
+	if (!state->batch && !bftw_queue_balanced(&state->fileq)) {
 		// stat() would run synchronously anyway
 		return false;
 	}
 
 	size_t depth = file ? file->depth + 1 : 1;
 	enum bfs_type type = state->de ? state->de->type : BFS_UNKNOWN;
-	return bftw_must_stat(state, depth, type, name);
+	return bftw_want_stat(state, depth, type, name) || state->fsade_checks;
 }
 
 /** Visit and/or enqueue the current file. */
-static int bftw_visit(struct bftw_state *state, const char *name) {
+static int bftw_visit_impl(struct bftw_state *state, const char *name) {
 	struct bftw_cache *cache = &state->cache;
 	struct bftw_file *file = state->file;
 
 	if (bftw_buffer_file(state, file, name)) {
-		file = bftw_file_new(cache, file, name);
+		file = bftw_file_new(cache, file, name, bftw_namelen(state, name));
 		if (!file) {
 			state->error = errno;
 			return -1;
@@ -2015,16 +5129,21 @@ static int bftw_visit(struct bftw_state *state, const char *name) {
 
 		if (state->de) {
 			file->type = state->de->type;
+			file->ino = state->de->ino;
 		}
 
 		bftw_push_file(state, file);
+		if (bftw_runs_push(state) != 0) {
+			state->error = errno;
+			return -1;
+		}
 		return 0;
 	}
 
 	switch (bftw_call_back(state, name, BFTW_PRE)) {
 	case BFTW_CONTINUE:
 		if (name) {
-			file = bftw_file_new(cache, state->file, name);
+			file = bftw_file_new(cache, state->file, name, bftw_namelen(state, name));
 		} else {
 			state->file = NULL;
 		}
@@ -2033,10 +5152,31 @@ static int bftw_visit(struct bftw_state *state, const char *name) {
 			return -1;
 		}
 
+		if (name && state->de) {
+			file->ino = state->de->ino;
+		}
+
 		bftw_save_ftwbuf(file, &state->ftwbuf);
 		bftw_stat_recycle(cache, file);
+		bftw_listing_find(state, file);
+
+		if (state->priority) {
+			unsigned int prio = state->priority(&state->ftwbuf, state->ptr);
+			file->priority = prio < BFTW_PRIORITIES ? prio : BFTW_PRIORITIES - 1;
+		}
+
+		int ret = 0;
+		if (state->flags & BFTW_DETECT_CYCLES) {
+			if (idset_ref(&state->dirs, file->dev, file->ino) == 0) {
+				file->tracked = true;
+			} else {
+				state->error = errno;
+				ret = -1;
+			}
+		}
+
 		bftw_push_dir(state, file);
-		return 0;
+		return ret;
 
 	case BFTW_PRUNE:
 		if (file && !name) {
@@ -2062,6 +5202,34 @@ static void bftw_drain(struct bftw_state *state, struct bftw_queue *queue) {
 	}
 }
 
+/** Free the external sorting state. */
+static void bftw_runs_destroy(struct bftw_state *state) {
+	struct bftw_runs *runs = &state->runs;
+
+	for (size_t i = 0; i < runs->nruns; ++i) {
+		struct bftw_run *run = &runs->runs[i];
+		if (run->head) {
+			state->file = run->head;
+			bftw_gc(state, BFTW_VISIT_NONE);
+		}
+		while ((state->file = SLIST_POP(&run->list))) {
+			bftw_gc(state, BFTW_VISIT_NONE);
+		}
+	}
+	bftw_runs_clear(runs);
+
+	if (runs->parent) {
+		state->file = runs->parent;
+		bftw_gc(state, BFTW_VISIT_NONE);
+		runs->parent = NULL;
+	}
+
+	free(runs->wbuf);
+	if (runs->fd >= 0) {
+		xclose(runs->fd);
+	}
+}
+
 /**
  * Dispose of the bftw() state.
  *
@@ -2070,36 +5238,143 @@ static void bftw_drain(struct bftw_state *state, struct bftw_queue *queue) {
  */
 static int bftw_state_destroy(struct bftw_state *state) {
 	dstrfree(state->path);
+	dstrfree(state->link_buf);
+	bftw_targets_destroy(&state->targets);
 
+	// Cancel the in-flight I/O, but keep the queue around to close the
+	// remaining directories in the background
 	struct ioq *ioq = state->ioq;
 	if (ioq) {
 		ioq_cancel(ioq);
 		while (bftw_ioq_pop(state, true) >= 0);
-		state->ioq = NULL;
 	}
 
 	bftw_gc(state, BFTW_VISIT_NONE);
+	bftw_runs_destroy(state);
 	bftw_drain(state, &state->dirq);
 	bftw_drain(state, &state->fileq);
+	bftw_listings_destroy(&state->listings);
+	bfs_bulkstat_free(state->bulkstat);
+
+	if (ioq) {
+		while (bftw_ioq_pop(state, true) >= 0);
+		state->ioq = NULL;
+	}
 
 	ioq_destroy(ioq);
+	free(state->fsinflight);
 
 	bftw_cache_destroy(&state->cache);
+	idset_destroy(&state->dirs);
+
+	if (state->spills_out) {
+		*state->spills_out += state->spills;
+	}
 
 	errno = state->error;
 	return state->error ? -1 : 0;
 }
 
+/** Visit and/or enqueue the current file, tracing it for -trace. */
+static int bftw_visit(struct bftw_state *state, const char *name) {
+	uint64_t start = bfs_trace_begin();
+	int ret = bftw_visit_impl(state, name);
+	bfs_trace_end("bftw_visit", start);
+	return ret;
+}
+
+/** Queue a directory from a checkpoint, without visiting it again. */
+static int bftw_resume(struct bftw_state *state, const char *path, size_t depth) {
+	struct bftw_file *file = bftw_file_new(&state->cache, NULL, path, strlen(path));
+	if (!file) {
+		state->error = errno;
+		return -1;
+	}
+	file->type = BFS_DIR;
+	file->depth = depth;
+
+	// If this fails, the error will be reported when we open it
+	int ret = 0;
+	struct bfs_stat buf;
+	if (bfs_stat(AT_FDCWD, path, bftw_stat_flags(state, depth), &buf) == 0) {
+		file->dev = buf.dev;
+		file->ino = buf.ino;
+		file->large = buf.size > 4096;
+
+		if (state->flags & BFTW_DETECT_CYCLES) {
+			if (idset_ref(&state->dirs, file->dev, file->ino) == 0) {
+				file->tracked = true;
+			} else {
+				state->error = errno;
+				ret = -1;
+			}
+		}
+	}
+
+	bftw_push_dir(state, file);
+	return ret;
+}
+
+/**
+ * The number of streamed starting paths to visit at once.  This is enough to
+ * keep the ioq busy with their stat() and opendir() calls.
+ */
+#define BFTW_PATH_WINDOW 1024
+
+/**
+ * Visit the next window of streamed starting paths.
+ *
+ * @return
+ *         The number of paths visited, or -1 on error.
+ */
+static int bftw_next_paths(struct bftw_state *state) {
+	if (!state->next_path || state->error) {
+		return 0;
+	}
+
+	int count = 0;
+	while (count < BFTW_PATH_WINDOW) {
+		errno = 0;
+		const char *path = state->next_path(state->ptr);
+		if (!path) {
+			state->next_path = NULL;
+			if (errno) {
+				state->error = errno;
+				return -1;
+			}
+			break;
+		}
+
+		if (bftw_visit(state, path) != 0) {
+			return -1;
+		}
+		++count;
+	}
+
+	return count;
+}
+
 /**
  * Shared implementation for all search strategies.
  */
 static int bftw_impl(struct bftw_state *state) {
 	for (size_t i = 0; i < state->npaths; ++i) {
-		if (bftw_visit(state, state->paths[i]) != 0) {
+		int ret;
+		if (state->depths) {
+			ret = bftw_resume(state, state->paths[i], state->depths[i]);
+		} else {
+			ret = bftw_visit(state, state->paths[i]);
+		}
+		if (ret != 0) {
 			return -1;
 		}
 	}
-	bftw_flush(state);
+	if (bftw_next_paths(state) < 0) {
+		return -1;
+	}
+	if (bftw_flush(state) != 0) {
+		return -1;
+	}
 
 	while (true) {
 		while (bftw_pop_dir(state)) {
@@ -2117,12 +5392,19 @@ static int bftw_impl(struct bftw_state *state) {
 		}
 
 		if (!bftw_pop_file(state)) {
-			break;
+			// Move on to the next window of streamed paths, if any
+			int count = bftw_next_paths(state);
+			if (count < 0) {
+				return -1;
+			} else if (count == 0) {
+				break;
+			}
+		} else if (bftw_visit(state, NULL) != 0) {
+			return -1;
 		}
-		if (bftw_visit(state, NULL) != 0) {
+		if (bftw_flush(state) != 0) {
 			return -1;
 		}
-		bftw_flush(state);
 	}
 
 	return 0;
@@ -2151,6 +5433,10 @@ struct bftw_ids_state {
 	bftw_callback *delegate;
 	/** The wrapped callback arguments. */
 	void *ptr;
+	/** The wrapped filter. */
+	bftw_filter *filter;
+	/** The wrapped stat() hint. */
+	bftw_stat_hint *stat_hint;
 	/** Which visit this search corresponds to. */
 	enum bftw_visit visit;
 	/** Whether to override the bftw_visit. */
@@ -2161,6 +5447,8 @@ struct bftw_ids_state {
 	size_t max_depth;
 	/** The set of pruned paths. */
 	struct trie pruned;
+	/** The callback's data for each directory, restored on later passes. */
+	struct trie data;
 	/** Whether the bottom has been found. */
 	bool bottom;
 };
@@ -2185,9 +5473,13 @@ static enum bftw_action bftw_ids_callback(const struct BFTW *ftwbuf, void *ptr)
 	if (ftwbuf->depth < state->min_depth) {
 		if (trie_find_str(&state->pruned, ftwbuf->path)) {
 			return BFTW_PRUNE;
-		} else {
-			return BFTW_CONTINUE;
 		}
+
+		const struct trie_leaf *leaf = trie_find_str(&state->data, ftwbuf->path);
+		if (leaf) {
+			*ftwbuf->data = leaf->value;
+		}
+		return BFTW_CONTINUE;
 	} else if (state->visit == BFTW_POST) {
 		if (trie_find_str(&state->pruned, ftwbuf->path)) {
 			return BFTW_PRUNE;
@@ -2197,6 +5489,16 @@ static enum bftw_action bftw_ids_callback(const struct BFTW *ftwbuf, void *ptr)
 	enum bftw_action ret = BFTW_CONTINUE;
 	if (ftwbuf->visit == state->visit) {
 		ret = state->delegate(ftwbuf, state->ptr);
+
+		if (ret == BFTW_CONTINUE && ftwbuf->type == BFS_DIR && *ftwbuf->data) {
+			struct trie_leaf *leaf = trie_insert_str(&state->data, ftwbuf->path);
+			if (leaf) {
+				leaf->value = *ftwbuf->data;
+			} else {
+				state->nested.error = errno;
+				ret = BFTW_STOP;
+			}
+		}
 	}
 
 	switch (ret) {
@@ -2223,26 +5525,48 @@ static enum bftw_action bftw_ids_callback(const struct BFTW *ftwbuf, void *ptr)
 	return ret;
 }
 
+/** Iterative deepening filter function. */
+static bool bftw_ids_filter(const struct bfs_dirent *de, size_t depth, void *ptr) {
+	struct bftw_ids_state *state = ptr;
+	return state->filter(de, depth, state->ptr);
+}
+
+/** Iterative deepening stat() hint. */
+static bool bftw_ids_stat_hint(const char *name, void *ptr) {
+	struct bftw_ids_state *state = ptr;
+	return state->stat_hint(name, state->ptr);
+}
+
 /** Initialize iterative deepening state. */
 static int bftw_ids_init(struct bftw_ids_state *state, const struct bftw_args *args) {
 	state->delegate = args->callback;
 	state->ptr = args->ptr;
+	state->filter = args->filter;
+	state->stat_hint = args->stat_hint;
 	state->visit = BFTW_PRE;
 	state->force_visit = false;
 	state->min_depth = 0;
 	state->max_depth = 1;
 	trie_init(&state->pruned);
+	trie_init(&state->data);
 	state->bottom = false;
 
 	struct bftw_args ids_args = *args;
 	ids_args.callback = bftw_ids_callback;
 	ids_args.ptr = state;
+	if (args->filter) {
+		ids_args.filter = bftw_ids_filter;
+	}
+	if (args->stat_hint) {
+		ids_args.stat_hint = bftw_ids_stat_hint;
+	}
 	ids_args.flags &= ~BFTW_POST_ORDER;
 	return bftw_state_init(&state->nested, &ids_args);
 }
 
 /** Finish an iterative deepening search. */
 static int bftw_ids_destroy(struct bftw_ids_state *state) {
+	trie_destroy(&state->data);
 	trie_destroy(&state->pruned);
 	return bftw_state_destroy(&state->nested);
 }
@@ -2317,10 +5641,289 @@ done:
 	return bftw_ids_destroy(&state);
 }
 
+/**
+ * One of the walks of a split bftw().
+ */
+struct bftw_split_walk {
+	/** The shared state. */
+	struct bftw_split *split;
+	/** The arguments for this walk. */
+	struct bftw_args args;
+	/** This walk's progress, written by its thread. */
+	struct bftw_progress progress;
+	/** The last progress reported to the callback. */
+	struct bftw_progress reported;
+	/** This walk's frontier spill count. */
+	size_t spills;
+	/** The walk's thread. */
+	pthread_t thread;
+	/** Whether the thread was started. */
+	bool started;
+	/** The return value of bftw(). */
+	int ret;
+	/** The error that occurred, if any. */
+	int error;
+};
+
+/**
+ * State for walking the roots on each device in parallel (BFTW_SPLIT_ROOTS).
+ */
+struct bftw_split {
+	/** The original arguments. */
+	const struct bftw_args *args;
+	/** Serializes calls to the callback, filter, and stat() hint. */
+	pthread_mutex_t mutex;
+	/** Set when any walk returns BFTW_STOP. */
+	bool stop;
+	/** The walks. */
+	struct bftw_split_walk *walks;
+	/** The number of walks. */
+	size_t nwalks;
+};
+
+/** bftw_split() callback. */
+static enum bftw_action bftw_split_callback(const struct BFTW *ftwbuf, void *ptr) {
+	struct bftw_split_walk *walk = ptr;
+	struct bftw_split *split = walk->split;
+	const struct bftw_args *args = split->args;
+
+	mutex_lock(&split->mutex);
+
+	enum bftw_action ret = BFTW_STOP;
+	if (split->stop) {
+		goto done;
+	}
+
+	if (args->progress) {
+		walk->reported = walk->progress;
+
+		struct bftw_progress total = {0};
+		for (size_t i = 0; i < split->nwalks; ++i) {
+			const struct bftw_progress *progress = &split->walks[i].reported;
+			total.dirs += progress->dirs;
+			total.queued += progress->queued;
+			total.inflight += progress->inflight;
+			total.fds += progress->fds;
+			total.fd_limit += progress->fd_limit;
+		}
+		*args->progress = total;
+	}
+
+	ret = args->callback(ftwbuf, args->ptr);
+	if (ret == BFTW_STOP) {
+		split->stop = true;
+	}
+
+done:
+	mutex_unlock(&split->mutex);
+	return ret;
+}
+
+/** bftw_split() filter. */
+static bool bftw_split_filter(const struct bfs_dirent *de, size_t depth, void *ptr) {
+	struct bftw_split_walk *walk = ptr;
+	struct bftw_split *split = walk->split;
+	const struct bftw_args *args = split->args;
+
+	mutex_lock(&split->mutex);
+	bool ret = args->filter(de, depth, args->ptr);
+	mutex_unlock(&split->mutex);
+	return ret;
+}
+
+/** bftw_split() stat() hint. */
+static bool bftw_split_stat_hint(const char *name, void *ptr) {
+	struct bftw_split_walk *walk = ptr;
+	struct bftw_split *split = walk->split;
+	const struct bftw_args *args = split->args;
+
+	mutex_lock(&split->mutex);
+	bool ret = args->stat_hint(name, args->ptr);
+	mutex_unlock(&split->mutex);
+	return ret;
+}
+
+/** Run one walk of a split bftw(). */
+static void bftw_split_run(struct bftw_split_walk *walk) {
+	walk->ret = bftw(&walk->args);
+	walk->error = walk->ret == 0 ? 0 : errno;
+}
+
+/** bftw_split() thread entry point. */
+static void *bftw_split_thread(void *ptr) {
+	bfs_perf_name("bftw");
+	bftw_split_run(ptr);
+	return NULL;
+}
+
+/** Get the device a root is on, or -1 if it can't be stat()ed. */
+static dev_t bftw_root_dev(const struct bftw_args *args, const char *path) {
+	enum bfs_stat_flags flags = BFS_STAT_NOFOLLOW;
+	if (args->flags & (BFTW_FOLLOW_ROOTS | BFTW_FOLLOW_ALL)) {
+		flags = BFS_STAT_TRYFOLLOW;
+	}
+
+	struct bfs_stat buf;
+	if (bfs_stat(AT_FDCWD, path, flags, &buf) != 0) {
+		return (dev_t)-1;
+	}
+	return buf.dev;
+}
+
+/**
+ * Walk the roots on each device on separate threads, each with its own ioq
+ * and share of the file descriptors.  Calls to the callback are serialized.
+ */
+static int bftw_split(const struct bftw_args *args) {
+	int ret = -1;
+	int error = 0;
+
+	// Group the roots by device, keeping them in order within each group
+	dev_t *devs = ALLOC_ARRAY(dev_t, args->npaths);
+	size_t *groups = ALLOC_ARRAY(size_t, args->npaths);
+	const char **paths = ALLOC_ARRAY(const char *, args->npaths);
+	if (!devs || !groups || !paths) {
+		goto fail;
+	}
+
+	size_t ndevs = 0;
+	for (size_t i = 0; i < args->npaths; ++i) {
+		dev_t dev = bftw_root_dev(args, args->paths[i]);
+
+		size_t j;
+		for (j = 0; j < ndevs; ++j) {
+			if (devs[j] == dev) {
+				break;
+			}
+		}
+		if (j == ndevs) {
+			devs[ndevs++] = dev;
+		}
+		groups[i] = j;
+	}
+
+	// Use one walk per device, up to one per I/O thread
+	size_t nwalks = ndevs;
+	size_t nthreads = args->nthreads > 0 ? args->nthreads : 0;
+	if (nwalks > nthreads) {
+		nwalks = nthreads;
+	}
+	size_t nopenfd = args->nopenfd > 0 ? args->nopenfd : 0;
+	if (nwalks > nopenfd / 2) {
+		nwalks = nopenfd / 2;
+	}
+	if (nwalks < 2) {
+		struct bftw_args serial = *args;
+		serial.flags &= ~BFTW_SPLIT_ROOTS;
+		ret = bftw(&serial);
+		error = errno;
+		goto done;
+	}
+
+	struct bftw_split split = {
+		.args = args,
+		.walks = ALLOC_ARRAY(struct bftw_split_walk, nwalks),
+		.nwalks = nwalks,
+	};
+	if (!split.walks) {
+		goto fail;
+	}
+	if (mutex_init(&split.mutex, NULL) != 0) {
+		free(split.walks);
+		goto fail;
+	}
+
+	// Assign the devices to walks round-robin
+	size_t npaths = 0;
+	for (size_t i = 0; i < nwalks; ++i) {
+		struct bftw_split_walk *walk = &split.walks[i];
+		*walk = (struct bftw_split_walk){
+			.split = &split,
+			.args = *args,
+		};
+
+		walk->args.paths = paths + npaths;
+		for (size_t j = 0; j < args->npaths; ++j) {
+			if (groups[j] % nwalks == i) {
+				paths[npaths++] = args->paths[j];
+			}
+		}
+		walk->args.npaths = paths + npaths - walk->args.paths;
+
+		walk->args.callback = bftw_split_callback;
+		walk->args.ptr = walk;
+		if (args->filter) {
+			walk->args.filter = bftw_split_filter;
+		}
+		if (args->stat_hint) {
+			walk->args.stat_hint = bftw_split_stat_hint;
+		}
+		walk->args.nopenfd = nopenfd / nwalks;
+		walk->args.nthreads = nthreads / nwalks;
+		walk->args.active_threads = args->active_threads / nwalks;
+		if (walk->args.active_threads < 1) {
+			walk->args.active_threads = 1;
+		}
+		walk->args.flags &= ~(BFTW_SPLIT_ROOTS | BFTW_AFFINITY);
+		walk->args.spills = args->spills ? &walk->spills : NULL;
+		walk->args.progress = &walk->progress;
+	}
+
+	// The first walk runs on this thread
+	for (size_t i = 1; i < nwalks; ++i) {
+		struct bftw_split_walk *walk = &split.walks[i];
+		walk->started = thread_create(&walk->thread, NULL, bftw_split_thread, walk) == 0;
+	}
+
+	bftw_split_run(&split.walks[0]);
+
+	ret = 0;
+	for (size_t i = 0; i < nwalks; ++i) {
+		struct bftw_split_walk *walk = &split.walks[i];
+		if (walk->started) {
+			thread_join(walk->thread, NULL);
+		} else if (i > 0) {
+			bftw_split_run(walk);
+		}
+
+		if (args->spills) {
+			*args->spills += walk->spills;
+		}
+		if (walk->ret != 0 && ret == 0) {
+			ret = walk->ret;
+			error = walk->error;
+		}
+	}
+
+	mutex_destroy(&split.mutex);
+	free(split.walks);
+	goto done;
+
+fail:
+	error = errno;
+done:
+	free(paths);
+	free(groups);
+	free(devs);
+	errno = error;
+	return ret;
+}
+
 int bftw(const struct bftw_args *args) {
+	if (args->next_path && (args->strategy == BFTW_IDS || args->strategy == BFTW_EDS || (args->flags & BFTW_SPLIT_ROOTS))) {
+		// These need every starting path up front
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((args->flags & BFTW_SPLIT_ROOTS) && args->npaths > 1 && !args->depths) {
+		return bftw_split(args);
+	}
+
 	switch (args->strategy) {
 	case BFTW_BFS:
 	case BFTW_DFS:
+	case BFTW_BEST:
 		return bftw_walk(args);
 	case BFTW_IDS:
 		return bftw_ids(args);
@@ -9,9 +9,11 @@
 #define BFS_BFTW_H
 
 #include "dir.h"
+#include "fsade.h"
 #include "stat.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * Possible visit occurrences.
@@ -23,6 +25,11 @@ enum bftw_visit {
 	BFTW_POST,
 };
 
+/**
+ * Followed bfs_stat() info shared between symlinks (BFTW_SHARE_TARGETS).
+ */
+struct bftw_targets;
+
 /**
  * Cached bfs_stat() info for a file.
  */
@@ -35,6 +42,12 @@ struct bftw_stat {
 	int stat_err;
 	/** The cached bfs_stat(BFS_STAT_NOFOLLOW) error. */
 	int lstat_err;
+	/** Storage (a dstring) for the cached readlink() target. */
+	char **link_buf;
+	/** The cached readlink() error. */
+	int link_err;
+	/** The symlink targets this file's bfs_stat(BFS_STAT_FOLLOW) may share (or NULL). */
+	struct bftw_targets *targets;
 };
 
 /**
@@ -67,8 +80,47 @@ struct BFTW {
 
 	/** Flags for bfs_stat(). */
 	enum bfs_stat_flags stat_flags;
+	/** The bfs_stat() fields to request. */
+	enum bfs_stat_field stat_mask;
 	/** Cached bfs_stat() info. */
 	struct bftw_stat stat_bufs;
+	/** Checks that were done ahead of time (see bftw_args::fsade_checks). */
+	struct bfs_fsade_probe fsade;
+	/**
+	 * The type of the file system this file is on, if bftw() knows it without
+	 * a stat() (from its parent directory, with bftw_args::mtab), or NULL.
+	 */
+	const char *fstype;
+
+	/**
+	 * For post-order visits of directories, 1 if bftw() found the directory
+	 * to be empty, 0 if it found entries, or -1 if unknown.
+	 */
+	int empty;
+
+	/**
+	 * For post-order visits of directories, the total that the callback
+	 * added to the parent_usage of the directory's children.
+	 */
+	uintmax_t usage;
+	/**
+	 * The parent directory's usage accumulator, or NULL for roots.  The
+	 * callback may add to it, to compute per-directory totals (e.g. disk
+	 * usage) without another traversal.
+	 */
+	uintmax_t *parent_usage;
+
+	/**
+	 * A word of callback state that is saved with this file, if it's a
+	 * directory, and handed to its children as their parent_cookie.
+	 */
+	uint64_t *cookie;
+	/** The parent directory's cookie, or NULL for roots. */
+	const uint64_t *parent_cookie;
+	/** A pointer of callback state, saved and handed down like the cookie. */
+	void **data;
+	/** The parent directory's data, or NULL for roots. */
+	void *const *parent_data;
 };
 
 /**
@@ -97,6 +149,17 @@ const struct bfs_stat *bftw_stat(const struct BFTW *ftwbuf, enum bfs_stat_flags
  */
 const struct bfs_stat *bftw_cached_stat(const struct BFTW *ftwbuf, enum bfs_stat_flags flags);
 
+/**
+ * Get the target of a symbolic link encountered during bftw(), caching the
+ * result for the rest of the visit.
+ *
+ * @param ftwbuf
+ *         bftw() data for the link to read.
+ * @return
+ *         The target of the link, or NULL if the call failed.
+ */
+const char *bftw_readlink(const struct BFTW *ftwbuf);
+
 /**
  * Get the type of a file encountered during bftw(), with flags controlling
  * whether to follow links.  This function will avoid calling bfs_stat() if
@@ -135,6 +198,76 @@ enum bftw_action {
  */
 typedef enum bftw_action bftw_callback(const struct BFTW *ftwbuf, void *ptr);
 
+/**
+ * Filter function type for bftw().
+ *
+ * @param de
+ *         A directory entry, before any allocation, path building, or stat()
+ *         is done for it.
+ * @param depth
+ *         The depth the entry would be visited at.
+ * @param ptr
+ *         The pointer passed to bftw().
+ * @return
+ *         Whether to skip the entry entirely, without visiting it.
+ */
+typedef bool bftw_filter(const struct bfs_dirent *de, size_t depth, void *ptr);
+
+/**
+ * Callback type for bftw_args::stat_hint.
+ *
+ * @param name
+ *         The name of the file.
+ * @param ptr
+ *         The pointer passed to bftw().
+ * @return
+ *         Whether the callback will probably stat() the file, so bftw()
+ *         should do it ahead of time.
+ */
+typedef bool bftw_stat_hint(const char *name, void *ptr);
+
+/** The number of distinct priorities for BFTW_BEST. */
+#define BFTW_PRIORITIES 16
+
+/**
+ * Priority function type for BFTW_BEST.
+ *
+ * @param ftwbuf
+ *         A directory that is about to be queued.
+ * @param ptr
+ *         The pointer passed to bftw().
+ * @return
+ *         The directory's priority, from 0 (searched first) to
+ *         BFTW_PRIORITIES - 1 (searched last).
+ */
+typedef unsigned int bftw_priority(const struct BFTW *ftwbuf, void *ptr);
+
+/**
+ * Checkpoint function type for bftw().
+ *
+ * @param paths
+ *         The directories that have been visited but not yet read.  Together,
+ *         they describe all the remaining work.
+ * @param depths
+ *         The depth of each directory.
+ * @param npaths
+ *         The number of directories.
+ * @param ptr
+ *         The pointer passed to bftw().
+ */
+typedef void bftw_checkpoint(const char **paths, const size_t *depths, size_t npaths, void *ptr);
+
+/**
+ * Function type for streaming more starting paths into bftw().
+ *
+ * @param ptr
+ *         The pointer passed to bftw().
+ * @return
+ *         The next starting path, which must stay valid until the next call,
+ *         or NULL if there are no more (with errno set on error).
+ */
+typedef const char *bftw_next_path(void *ptr);
+
 /**
  * Flags that control bftw() behavior.
  */
@@ -161,6 +294,26 @@ enum bftw_flags {
 	BFTW_BUFFER        = 1 << 9,
 	/** Include whiteouts in the search results. */
 	BFTW_WHITEOUTS     = 1 << 10,
+	/** Use a kernel thread to poll for I/O submissions (io_uring only). */
+	BFTW_SQPOLL        = 1 << 11,
+	/** Pin the I/O threads to their own CPUs. */
+	BFTW_AFFINITY      = 1 << 12,
+	/** Issue asynchronous stat()/open() calls in inode number order. */
+	BFTW_INO_ORDER     = 1 << 13,
+	/** Walk roots on different devices in parallel. */
+	BFTW_SPLIT_ROOTS   = 1 << 14,
+	/** Tune the number of active I/O threads (up to nthreads) at runtime. */
+	BFTW_AUTO_THREADS  = 1 << 15,
+	/** Bulk-load the attributes of every inode on root file systems that support it. */
+	BFTW_BULKSTAT      = 1 << 16,
+	/** Only visit directories (and entries whose type isn't known). */
+	BFTW_DIRS_ONLY     = 1 << 17,
+	/** Apply BFTW_DIRS_ONLY to directories last modified before stale_time. */
+	BFTW_SKIP_STALE    = 1 << 18,
+	/** Share the followed stat() info of symlinks that resolve to the same path. */
+	BFTW_SHARE_TARGETS = 1 << 19,
+	/** Read the targets of buffered symbolic links asynchronously. */
+	BFTW_READLINK      = 1 << 20,
 };
 
 /**
@@ -175,6 +328,34 @@ enum bftw_strategy {
 	BFTW_IDS,
 	/** Exponential deepening search. */
 	BFTW_EDS,
+	/** Best-first search, in bftw_args::priority order. */
+	BFTW_BEST,
+};
+
+/**
+ * A limit on the asynchronous I/O in flight to one type of file system.
+ */
+struct bftw_fslimit {
+	/** The file system type (e.g. "nfs"). */
+	const char *type;
+	/** The maximum number of in-flight requests. */
+	size_t limit;
+};
+
+/**
+ * A snapshot of a walk's progress, e.g. for a status bar.
+ */
+struct bftw_progress {
+	/** The number of directories popped from the queue so far. */
+	size_t dirs;
+	/** The number of directories waiting in the queue (the frontier). */
+	size_t queued;
+	/** The number of asynchronous I/O requests in flight. */
+	size_t inflight;
+	/** The number of directories held open in the cache. */
+	size_t fds;
+	/** The capacity of the open directory cache. */
+	size_t fd_limit;
 };
 
 /**
@@ -185,24 +366,129 @@ struct bftw_args {
 	const char **paths;
 	/** The number of starting paths. */
 	size_t npaths;
+	/**
+	 * If non-NULL, the paths are directories from a checkpoint, at these
+	 * depths.  They are read without being visited again.
+	 */
+	const size_t *depths;
+	/**
+	 * If non-NULL, called for more starting paths after the ones in paths.
+	 * They are read a window at a time, each searched completely before the
+	 * next, so memory use doesn't depend on how many there are.  Only
+	 * supported by BFTW_BFS, BFTW_DFS, and BFTW_BEST, without
+	 * BFTW_SPLIT_ROOTS.
+	 */
+	bftw_next_path *next_path;
 
 	/** The callback to invoke. */
 	bftw_callback *callback;
 	/** A pointer which is passed to the callback. */
 	void *ptr;
+	/** An optional filter for directory entries (also passed ptr). */
+	bftw_filter *filter;
+	/** An optional hint for which files to stat() ahead of time (also passed ptr). */
+	bftw_stat_hint *stat_hint;
+	/**
+	 * The directory priorities for BFTW_BEST (also passed ptr).  Ties are
+	 * broken in breadth-first order.  If NULL, every directory has the
+	 * same priority.
+	 */
+	bftw_priority *priority;
 
 	/** The maximum number of file descriptors to keep open. */
 	int nopenfd;
 	/** The maximum number of threads to use. */
 	int nthreads;
+	/** With BFTW_AUTO_THREADS, the number of threads to start with. */
+	int active_threads;
 
 	/** Flags that control bftw() behaviour. */
 	enum bftw_flags flags;
 	/** The search strategy to use. */
 	enum bftw_strategy strategy;
+	/** The modification time cutoff for BFTW_SKIP_STALE. */
+	struct timespec stale_time;
 
 	/** The parsed mount table, if available. */
 	const struct bfs_mtab *mtab;
+	/** The bfs_stat() fields the callback needs (0 for all). */
+	enum bfs_stat_field stat_mask;
+	/** Checks that the callback will (probably) need, to do in advance. */
+	enum bfs_fsade_check fsade_checks;
+	/** The xattr name for BFS_CHECK_XATTR_NAMED. */
+	const char *fsade_xattr;
+	/** The hash algorithm for BFS_CHECK_HASH. */
+	enum bfs_hash_algo fsade_hash;
+	/** The content search for BFS_CHECK_GREP. */
+	const struct bfs_grep *fsade_grep;
+	/** Per-file-system I/O limits (requires mtab). */
+	const struct bftw_fslimit *fslimits;
+	/** The number of fslimits. */
+	size_t nfslimits;
+	/** File system types where stats may use cached attributes (requires mtab). */
+	char *const *stat_cache;
+	/** The number of stat_cache types. */
+	size_t nstat_cache;
+
+	/**
+	 * The maximum number of directories to queue for a breadth-first
+	 * search (0 for unlimited).  Past this limit, new directories are
+	 * searched in depth-first order until the queue drains to half of it.
+	 */
+	size_t frontier;
+	/** If non-NULL, incremented every time the frontier limit is hit. */
+	size_t *spills;
+	/** If non-NULL, updated before every callback. */
+	struct bftw_progress *progress;
+
+	/**
+	 * The maximum number of files to sort in memory for BFTW_SORT (0 for
+	 * unlimited).  Bigger directories are sorted in runs, which are spilled
+	 * to a temporary file and merged before they are visited.  Only
+	 * supported for breadth-first search.
+	 */
+	size_t sort_limit;
+
+	/**
+	 * The most memory to use for directory buffers (0 for no limit).  This
+	 * bounds how many directories can be read at once, including the
+	 * lookahead.
+	 */
+	size_t dir_memory;
+
+	/**
+	 * The most memory to use for caching directory listings between the
+	 * passes of BFTW_IDS and BFTW_EDS (0 to disable the cache).  Listings
+	 * can go stale if the callback modifies the tree.
+	 */
+	size_t listing_memory;
+
+	/**
+	 * The number of directories to open ahead of time, asynchronously.  If
+	 * 0, the lookahead adapts to the observed I/O latency instead, within
+	 * the limits of nopenfd.
+	 */
+	size_t lookahead;
+	/**
+	 * If non-NULL, limits the rate of I/O, both in the background and for
+	 * directories opened synchronously.
+	 */
+	struct bfs_throttle *throttle;
+	/**
+	 * If nonzero, how long (in nanoseconds) the background threads may
+	 * spend opening a directory or stat()ing a file before giving up on it
+	 * with ETIMEDOUT.
+	 */
+	uint64_t io_timeout;
+
+	/**
+	 * If non-NULL, called periodically with the remaining work, between
+	 * directories.  Only supported for breadth- and depth-first search
+	 * without BFTW_POST_ORDER.
+	 */
+	bftw_checkpoint *checkpoint;
+	/** The time between checkpoints, in nanoseconds. */
+	uint64_t checkpoint_interval;
 };
 
 /**
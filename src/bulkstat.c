@@ -0,0 +1,391 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "bulkstat.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bit.h"
+#include "diag.h"
+#include "perf.h"
+#include "stat.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#if BFS_USE_BULKSTAT
+#  include <sys/ioctl.h>
+#  include <sys/stat.h>
+#  include <sys/statvfs.h>
+#endif
+
+#if BFS_HAS_BTRFS_TREE_SEARCH
+#  include <linux/btrfs.h>
+#  include <linux/btrfs_tree.h>
+#endif
+
+#if BFS_HAS_XFS_BULKSTAT
+#  include <sys/sysmacros.h>
+#  include <xfs/xfs.h>
+#endif
+
+struct bfs_bulkstat {
+	/** The device number of the file system. */
+	dev_t dev;
+	/** The fields to keep. */
+	enum bfs_stat_field mask;
+	/** The size of each slot, in words. */
+	size_t stride;
+	/** The hash table (an inode number, then a packed stat, per slot). */
+	uint64_t *table;
+	/** The capacity of the table (a power of two, or zero). */
+	size_t capacity;
+	/** The number of inodes in the table. */
+	size_t count;
+};
+
+#if BFS_USE_BULKSTAT
+
+/** Hash an inode number. */
+static size_t bulkstat_hash(ino_t ino) {
+	uint64_t hash = (uint64_t)ino * UINT64_C(0x9E3779B97F4A7C15);
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/** Get the inode number in a slot (0 for empty). */
+static ino_t bulkstat_ino(const uint64_t *slot) {
+	return slot[0];
+}
+
+/** Get the packed stat in a slot. */
+static struct bfs_packed_stat *bulkstat_packed(uint64_t *slot) {
+	return (struct bfs_packed_stat *)(slot + 1);
+}
+
+/** Find the slot for an inode, or the empty slot where it would go. */
+static uint64_t *bulkstat_slot(const struct bfs_bulkstat *bulk, ino_t ino) {
+	size_t mask = bulk->capacity - 1;
+	for (size_t i = bulkstat_hash(ino) & mask;; i = (i + 1) & mask) {
+		uint64_t *slot = bulk->table + i * bulk->stride;
+		ino_t cur = bulkstat_ino(slot);
+		if (cur == ino || cur == 0) {
+			return slot;
+		}
+	}
+}
+
+/** Resize the hash table. */
+static int bulkstat_resize(struct bfs_bulkstat *bulk, size_t capacity) {
+	uint64_t *table = ZALLOC_ARRAY(uint64_t, capacity * bulk->stride);
+	if (!table) {
+		return -1;
+	}
+
+	uint64_t *old = bulk->table;
+	size_t old_capacity = bulk->capacity;
+	bulk->table = table;
+	bulk->capacity = capacity;
+
+	size_t size = bulk->stride * sizeof(uint64_t);
+	for (size_t i = 0; i < old_capacity; ++i) {
+		const uint64_t *src = old + i * bulk->stride;
+		ino_t ino = bulkstat_ino(src);
+		if (ino != 0) {
+			memcpy(bulkstat_slot(bulk, ino), src, size);
+		}
+	}
+
+	free(old);
+	return 0;
+}
+
+/** Make room for a number of inodes, keeping the load factor below 3/4. */
+static int bulkstat_reserve(struct bfs_bulkstat *bulk, size_t count) {
+	if (4 * count <= 3 * bulk->capacity) {
+		return 0;
+	}
+
+	size_t capacity = bulk->capacity ? 2 * bulk->capacity : 1024;
+	while (4 * count > 3 * capacity) {
+		capacity *= 2;
+	}
+	return bulkstat_resize(bulk, capacity);
+}
+
+/** Add an inode to the table. */
+static int bulkstat_insert(struct bfs_bulkstat *bulk, const struct bfs_stat *buf) {
+	if (buf->ino == 0) {
+		// Used to mark empty slots
+		return 0;
+	}
+
+	if (bulkstat_reserve(bulk, bulk->count + 1) != 0) {
+		return -1;
+	}
+
+	uint64_t *slot = bulkstat_slot(bulk, buf->ino);
+	if (bulkstat_ino(slot) == 0) {
+		++bulk->count;
+	}
+	slot[0] = buf->ino;
+	bfs_stat_pack(bulkstat_packed(slot), buf, bulk->mask);
+	return 0;
+}
+
+/** Pre-size the table for the number of inodes in use, if known. */
+static int bulkstat_presize(struct bfs_bulkstat *bulk, int fd) {
+	struct statvfs vfs;
+	if (fstatvfs(fd, &vfs) != 0 || vfs.f_files <= vfs.f_ffree) {
+		return 0;
+	}
+
+	return bulkstat_reserve(bulk, vfs.f_files - vfs.f_ffree);
+}
+
+#endif // BFS_USE_BULKSTAT
+
+#if BFS_HAS_XFS_BULKSTAT
+
+/** The number of inodes to ask for per XFS_IOC_BULKSTAT call. */
+#define XFS_BATCH 4096
+
+/** Load an XFS file system with XFS_IOC_BULKSTAT. */
+static int bulkstat_xfs(struct bfs_bulkstat *bulk, int fd) {
+	struct xfs_bulkstat_req *req = ZALLOC_FLEX(struct xfs_bulkstat_req, bulkstat, XFS_BATCH);
+	if (!req) {
+		return -1;
+	}
+
+	int ret = -1;
+	req->hdr.ino = 0;
+	while (true) {
+		req->hdr.icount = XFS_BATCH;
+		req->hdr.ocount = 0;
+
+		uint64_t start = bfs_perf_start();
+		int err = ioctl(fd, XFS_IOC_BULKSTAT, req);
+		bfs_perf_end(BFS_PERF_STAT, start, 0);
+		if (err != 0) {
+			goto fail;
+		} else if (req->hdr.ocount == 0) {
+			break;
+		}
+
+		for (uint32_t i = 0; i < req->hdr.ocount; ++i) {
+			const struct xfs_bulkstat *xbs = &req->bulkstat[i];
+
+			struct bfs_stat buf = {
+				.mask = BFS_STAT_MODE | BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_NLINK
+					| BFS_STAT_GID | BFS_STAT_UID | BFS_STAT_SIZE | BFS_STAT_BLOCKS
+					| BFS_STAT_RDEV | BFS_STAT_ATIME | BFS_STAT_BTIME | BFS_STAT_CTIME
+					| BFS_STAT_MTIME,
+				.mode = xbs->bs_mode,
+				.dev = bulk->dev,
+				.ino = xbs->bs_ino,
+				.nlink = xbs->bs_nlink,
+				.gid = xbs->bs_gid,
+				.uid = xbs->bs_uid,
+				.size = xbs->bs_size,
+				// bs_blocks counts file system blocks, not 512-byte ones
+				.blocks = xbs->bs_blocks * (xbs->bs_blksize / BFS_STAT_BLKSIZE),
+				// XFS encodes device numbers like SysV
+				.rdev = makedev(xbs->bs_rdev >> 18, xbs->bs_rdev & 0x3FFFF),
+				.atime = { .tv_sec = xbs->bs_atime, .tv_nsec = xbs->bs_atime_nsec },
+				.btime = { .tv_sec = xbs->bs_btime, .tv_nsec = xbs->bs_btime_nsec },
+				.ctime = { .tv_sec = xbs->bs_ctime, .tv_nsec = xbs->bs_ctime_nsec },
+				.mtime = { .tv_sec = xbs->bs_mtime, .tv_nsec = xbs->bs_mtime_nsec },
+			};
+
+			if (bulkstat_insert(bulk, &buf) != 0) {
+				goto fail;
+			}
+		}
+	}
+
+	ret = 0;
+fail:
+	free(req);
+	return ret;
+}
+
+#endif // BFS_HAS_XFS_BULKSTAT
+
+#if BFS_HAS_BTRFS_TREE_SEARCH
+
+/** The size of the BTRFS_IOC_TREE_SEARCH_V2 result buffer. */
+#define BTRFS_BUF_SIZE (256 << 10)
+
+/** Convert a little-endian integer to native byte order. */
+#define btrfs_le(n) (ENDIAN_NATIVE == ENDIAN_BIG ? bswap(n) : (n))
+
+/** Convert a btrfs timestamp. */
+static struct timespec btrfs_time(const struct btrfs_timespec *ts) {
+	return (struct timespec) {
+		.tv_sec = (int64_t)btrfs_le((uint64_t)ts->sec),
+		.tv_nsec = btrfs_le((uint32_t)ts->nsec),
+	};
+}
+
+/** Load a btrfs subvolume with BTRFS_IOC_TREE_SEARCH_V2. */
+static int bulkstat_btrfs(struct bfs_bulkstat *bulk, int fd) {
+	struct btrfs_ioctl_search_args_v2 *args = ZALLOC_FLEX(struct btrfs_ioctl_search_args_v2, buf, BTRFS_BUF_SIZE / sizeof(uint64_t));
+	if (!args) {
+		return -1;
+	}
+
+	// Tree 0 is the subvolume containing fd.  Only the inode items are
+	// wanted, and there is exactly one per object ID.
+	struct btrfs_ioctl_search_key key = {
+		.tree_id = 0,
+		.min_objectid = BTRFS_FIRST_FREE_OBJECTID,
+		.max_objectid = BTRFS_LAST_FREE_OBJECTID,
+		.min_offset = 0,
+		.max_offset = UINT64_MAX,
+		.min_transid = 0,
+		.max_transid = UINT64_MAX,
+		.min_type = BTRFS_INODE_ITEM_KEY,
+		.max_type = BTRFS_INODE_ITEM_KEY,
+	};
+
+	int ret = -1;
+	while (key.min_objectid <= key.max_objectid) {
+		args->key = key;
+		args->key.nr_items = UINT32_MAX;
+		args->buf_size = BTRFS_BUF_SIZE;
+
+		uint64_t start = bfs_perf_start();
+		int err = ioctl(fd, BTRFS_IOC_TREE_SEARCH_V2, args);
+		bfs_perf_end(BFS_PERF_STAT, start, 0);
+		if (err != 0) {
+			goto fail;
+		} else if (args->key.nr_items == 0) {
+			break;
+		}
+
+		const char *cur = (const char *)args->buf;
+		for (uint32_t i = 0; i < args->key.nr_items; ++i) {
+			struct btrfs_ioctl_search_header header;
+			memcpy(&header, cur, sizeof(header));
+			cur += sizeof(header);
+
+			if (header.type == BTRFS_INODE_ITEM_KEY && header.len >= sizeof(struct btrfs_inode_item)) {
+				struct btrfs_inode_item item;
+				memcpy(&item, cur, sizeof(item));
+
+				struct bfs_stat buf = {
+					.mask = BFS_STAT_MODE | BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_NLINK
+						| BFS_STAT_GID | BFS_STAT_UID | BFS_STAT_SIZE | BFS_STAT_BLOCKS
+						| BFS_STAT_RDEV | BFS_STAT_ATIME | BFS_STAT_BTIME | BFS_STAT_CTIME
+						| BFS_STAT_MTIME,
+					.mode = btrfs_le((uint32_t)item.mode),
+					.dev = bulk->dev,
+					.ino = header.objectid,
+					.nlink = btrfs_le((uint32_t)item.nlink),
+					.gid = btrfs_le((uint32_t)item.gid),
+					.uid = btrfs_le((uint32_t)item.uid),
+					.size = btrfs_le((uint64_t)item.size),
+					.blocks = btrfs_le((uint64_t)item.nbytes) / BFS_STAT_BLKSIZE,
+					.rdev = btrfs_le((uint64_t)item.rdev),
+					.atime = btrfs_time(&item.atime),
+					.btime = btrfs_time(&item.otime),
+					.ctime = btrfs_time(&item.ctime),
+					.mtime = btrfs_time(&item.mtime),
+				};
+
+				if (bulkstat_insert(bulk, &buf) != 0) {
+					goto fail;
+				}
+			}
+
+			cur += header.len;
+			key.min_objectid = header.objectid + 1;
+		}
+
+		if (key.min_objectid == 0) {
+			// Wrapped around
+			break;
+		}
+	}
+
+	ret = 0;
+fail:
+	free(args);
+	return ret;
+}
+
+#endif // BFS_HAS_BTRFS_TREE_SEARCH
+
+struct bfs_bulkstat *bfs_bulkstat_load(int fd, const char *fstype, enum bfs_stat_field mask) {
+#if BFS_USE_BULKSTAT
+	int (*load)(struct bfs_bulkstat *bulk, int fd) = NULL;
+#  if BFS_HAS_XFS_BULKSTAT
+	if (strcmp(fstype, "xfs") == 0) {
+		load = bulkstat_xfs;
+	}
+#  endif
+#  if BFS_HAS_BTRFS_TREE_SEARCH
+	if (strcmp(fstype, "btrfs") == 0) {
+		load = bulkstat_btrfs;
+	}
+#  endif
+	if (!load) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		return NULL;
+	}
+
+	struct bfs_bulkstat *bulk = ZALLOC(struct bfs_bulkstat);
+	if (!bulk) {
+		return NULL;
+	}
+
+	bulk->dev = sb.st_dev;
+	bulk->mask = mask | BFS_STAT_MODE | BFS_STAT_DEV | BFS_STAT_INO;
+	size_t size = sizeof(uint64_t) + sizeof(struct bfs_packed_stat) + bfs_stat_packed_size(bulk->mask);
+	bulk->stride = align_ceil(sizeof(uint64_t), size) / sizeof(uint64_t);
+
+	if (bulkstat_presize(bulk, fd) != 0 || load(bulk, fd) != 0) {
+		bfs_bulkstat_free(bulk);
+		return NULL;
+	}
+
+	return bulk;
+#else
+	errno = ENOTSUP;
+	return NULL;
+#endif
+}
+
+dev_t bfs_bulkstat_dev(const struct bfs_bulkstat *bulk) {
+	return bulk->dev;
+}
+
+int bfs_bulkstat_find(const struct bfs_bulkstat *bulk, ino_t ino, struct bfs_stat *buf) {
+#if BFS_USE_BULKSTAT
+	if (ino != 0 && bulk->capacity > 0) {
+		uint64_t *slot = bulkstat_slot(bulk, ino);
+		if (bulkstat_ino(slot) == ino) {
+			bfs_stat_unpack(buf, bulkstat_packed(slot));
+			return 0;
+		}
+	}
+#endif
+
+	return -1;
+}
+
+void bfs_bulkstat_free(struct bfs_bulkstat *bulk) {
+	if (bulk) {
+		free(bulk->table);
+		free(bulk);
+	}
+}
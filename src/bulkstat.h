@@ -0,0 +1,72 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Bulk inode attribute loading for whole file systems (BFS_BULKSTAT).
+ */
+
+#ifndef BFS_BULKSTAT_H
+#define BFS_BULKSTAT_H
+
+#include "bfs.h"
+#include "stat.h"
+
+#include <sys/types.h>
+
+/**
+ * Whether any bulk inode enumeration backend is available.
+ */
+#ifndef BFS_USE_BULKSTAT
+#  define BFS_USE_BULKSTAT (BFS_HAS_XFS_BULKSTAT || BFS_HAS_BTRFS_TREE_SEARCH)
+#endif
+
+/**
+ * A table of inode attributes for one file system, keyed by inode number.
+ */
+struct bfs_bulkstat;
+
+/**
+ * Load the attributes of every inode on a file system.
+ *
+ * XFS file systems are enumerated with XFS_IOC_BULKSTAT, and btrfs subvolumes
+ * with BTRFS_IOC_TREE_SEARCH_V2.  Both read the inodes in disk order, but
+ * require CAP_SYS_ADMIN.
+ *
+ * @param fd
+ *         An open file descriptor on the file system.
+ * @param fstype
+ *         The type of the file system, from bfs_fstype().
+ * @param mask
+ *         The bfs_stat() fields to keep (the mode and inode number are always
+ *         kept).
+ * @return
+ *         The loaded table, or NULL on failure (with errno set to ENOTSUP if
+ *         the file system is not supported).
+ */
+struct bfs_bulkstat *bfs_bulkstat_load(int fd, const char *fstype, enum bfs_stat_field mask);
+
+/**
+ * Get the device number of the file system a table describes.
+ */
+dev_t bfs_bulkstat_dev(const struct bfs_bulkstat *bulk);
+
+/**
+ * Look up an inode's attributes.
+ *
+ * @param bulk
+ *         The table to search.
+ * @param ino
+ *         The inode number.
+ * @param[out] buf
+ *         Filled in with the attributes, if found.
+ * @return
+ *         0 if the inode was found, or -1 if it wasn't.
+ */
+int bfs_bulkstat_find(const struct bfs_bulkstat *bulk, ino_t ino, struct bfs_stat *buf);
+
+/**
+ * Free a table.
+ */
+void bfs_bulkstat_free(struct bfs_bulkstat *bulk);
+
+#endif // BFS_BULKSTAT_H
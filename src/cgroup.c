@@ -0,0 +1,189 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "cgroup.h"
+
+#include "bfs.h"
+#include "bfstd.h"
+#include "dstring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Where cgroupfs is normally mounted. */
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+/** Read the first line of a file in a cgroup directory. */
+static char *cgroup_read(const char *dir, const char *name) {
+	dchar *path = dstrprintf("%s/%s", dir, name);
+	if (!path) {
+		return NULL;
+	}
+
+	FILE *file = xfopen(path, O_RDONLY | O_CLOEXEC);
+	dstrfree(path);
+	if (!file) {
+		return NULL;
+	}
+
+	char *line = xgetdelim(file, '\n');
+	fclose(file);
+	return line;
+}
+
+/** Read a single number from a cgroup file, or -1 if it's missing or "max". */
+static long long cgroup_read_num(const char *dir, const char *name) {
+	char *line = cgroup_read(dir, name);
+	if (!line) {
+		return -1;
+	}
+
+	long long value;
+	if (xstrtoll(line, NULL, 10, &value) != 0 || value < 0) {
+		value = -1;
+	}
+	free(line);
+	return value;
+}
+
+/** Tighten a CPU limit. */
+static void limit_cpus(struct bfs_cgroup_limits *limits, long long quota, long long period) {
+	if (quota <= 0 || period <= 0) {
+		return;
+	}
+
+	long long cpus = (quota + period - 1) / period;
+	if (limits->cpus == 0 || cpus < limits->cpus) {
+		limits->cpus = cpus;
+	}
+}
+
+/** Tighten a memory limit. */
+static void limit_memory(struct bfs_cgroup_limits *limits, long long bytes) {
+	// cgroup v1 spells "no limit" as a huge number
+	if (bytes <= 0 || bytes >= (1LL << 62)) {
+		return;
+	}
+
+	if ((unsigned long long)bytes < SIZE_MAX && (limits->memory == 0 || (size_t)bytes < limits->memory)) {
+		limits->memory = bytes;
+	}
+}
+
+/** Read the v2 limits of a single cgroup. */
+static void cgroup2_limits(struct bfs_cgroup_limits *limits, const char *dir) {
+	// cpu.max is "$MAX $PERIOD", where $MAX may be "max"
+	char *line = cgroup_read(dir, "cpu.max");
+	if (line) {
+		char *end;
+		long long quota, period;
+		if (xstrtoll(line, &end, 10, &quota) == 0 && *end == ' '
+		    && xstrtoll(end + 1, NULL, 10, &period) == 0) {
+			limit_cpus(limits, quota, period);
+		}
+		free(line);
+	}
+
+	limit_memory(limits, cgroup_read_num(dir, "memory.max"));
+}
+
+/** Read the v1 limits of a single cgroup. */
+static void cgroup1_limits(struct bfs_cgroup_limits *limits, const char *controller, const char *dir) {
+	if (strcmp(controller, "cpu") == 0) {
+		long long quota = cgroup_read_num(dir, "cpu.cfs_quota_us");
+		long long period = cgroup_read_num(dir, "cpu.cfs_period_us");
+		limit_cpus(limits, quota, period);
+	} else {
+		limit_memory(limits, cgroup_read_num(dir, "memory.limit_in_bytes"));
+	}
+}
+
+/**
+ * Read the limits of a cgroup and its ancestors.  Inside a container, the
+ * path from /proc/self/cgroup may not exist in our view of cgroupfs, but then
+ * one of its parents (eventually the mount point) will.
+ */
+static void cgroup_walk(struct bfs_cgroup_limits *limits, const char *controller, const char *mount, const char *path) {
+	dchar *dir = dstrprintf("%s%s", mount, strcmp(path, "/") == 0 ? "" : path);
+	if (!dir) {
+		return;
+	}
+
+	size_t min = strlen(mount);
+	while (true) {
+		if (controller) {
+			cgroup1_limits(limits, controller, dir);
+		} else {
+			cgroup2_limits(limits, dir);
+		}
+
+		size_t len = dstrlen(dir);
+		if (len <= min) {
+			break;
+		}
+
+		char *slash = strrchr(dir, '/');
+		if (!slash || (size_t)(slash - dir) < min) {
+			break;
+		}
+		dstresize(&dir, slash - dir);
+	}
+
+	dstrfree(dir);
+}
+
+/** Check if a v1 hierarchy's controller list contains a controller. */
+static bool has_controller(const char *list, const char *controller) {
+	size_t len = strlen(controller);
+	while (true) {
+		if (strncmp(list, controller, len) == 0 && (list[len] == ',' || list[len] == '\0')) {
+			return true;
+		}
+
+		list = strchr(list, ',');
+		if (!list) {
+			return false;
+		}
+		++list;
+	}
+}
+
+void bfs_cgroup_limits(struct bfs_cgroup_limits *limits) {
+	limits->cpus = 0;
+	limits->memory = 0;
+
+#if __linux__
+	// Lines look like "$ID:$CONTROLLERS:$PATH"
+	FILE *file = xfopen("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		return;
+	}
+
+	char *line;
+	while ((line = xgetdelim(file, '\n'))) {
+		char *controllers = strchr(line, ':');
+		char *path = controllers ? strchr(controllers + 1, ':') : NULL;
+		if (path) {
+			*controllers++ = '\0';
+			*path++ = '\0';
+
+			if (strcmp(line, "0") == 0 && !*controllers) {
+				// The unified hierarchy is here in hybrid mode
+				cgroup_walk(limits, NULL, CGROUP_ROOT, path);
+				cgroup_walk(limits, NULL, CGROUP_ROOT "/unified", path);
+			} else if (has_controller(controllers, "cpu")) {
+				cgroup_walk(limits, "cpu", CGROUP_ROOT "/cpu", path);
+			} else if (has_controller(controllers, "memory")) {
+				cgroup_walk(limits, "memory", CGROUP_ROOT "/memory", path);
+			}
+		}
+		free(line);
+	}
+
+	fclose(file);
+#endif
+}
@@ -0,0 +1,33 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Resource limits from Linux control groups, for container-aware defaults.
+ */
+
+#ifndef BFS_CGROUP_H
+#define BFS_CGROUP_H
+
+#include <stddef.h>
+
+/**
+ * The resource limits that apply to the current process.
+ */
+struct bfs_cgroup_limits {
+	/** The CPU quota, rounded up to whole CPUs (0 for no limit). */
+	long cpus;
+	/** The memory limit, in bytes (0 for no limit). */
+	size_t memory;
+};
+
+/**
+ * Read the limits of the current process's cgroup and all its ancestors, from
+ * either cgroup v2 (cpu.max, memory.max) or v1 (cpu.cfs_quota_us,
+ * memory.limit_in_bytes).  Anything that can't be read is not a limit.
+ *
+ * @param[out] limits
+ *         Will hold the tightest limits found.
+ */
+void bfs_cgroup_limits(struct bfs_cgroup_limits *limits);
+
+#endif // BFS_CGROUP_H
@@ -0,0 +1,198 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "checkpoint.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "dstring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The checkpoint file format is a header line, the visited count, and then
+ * one "DEPTH PATH" record per directory.  Records are NUL-terminated, since
+ * paths may contain newlines.
+ */
+#define CHECKPOINT_MAGIC "bfs checkpoint 1"
+
+/** Write the records of a checkpoint. */
+static int checkpoint_write(FILE *file, const struct bfs_checkpoint *checkpoint) {
+	if (fprintf(file, "%s\nvisited %zu\n", CHECKPOINT_MAGIC, checkpoint->visited) < 0) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < checkpoint->npaths; ++i) {
+		if (fprintf(file, "%zu %s", checkpoint->depths[i], checkpoint->paths[i]) < 0) {
+			return -1;
+		}
+		if (fputc('\0', file) == EOF) {
+			return -1;
+		}
+	}
+
+	if (fflush(file) != 0) {
+		return -1;
+	}
+
+	// Make sure the data hits the disk before the rename() does
+	return fsync(fileno(file));
+}
+
+int bfs_checkpoint_save(const char *path, const struct bfs_checkpoint *checkpoint) {
+	dchar *tmp = dstrprintf("%s.tmp", path);
+	if (!tmp) {
+		return -1;
+	}
+
+	FILE *file = xfopen(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+	if (!file) {
+		goto fail;
+	}
+
+	int ret = checkpoint_write(file, checkpoint);
+	int error = errno;
+	if (fclose(file) != 0 && ret == 0) {
+		ret = -1;
+		error = errno;
+	}
+	if (ret == 0 && rename(tmp, path) != 0) {
+		ret = -1;
+		error = errno;
+	}
+	if (ret != 0) {
+		unlink(tmp);
+	}
+
+	dstrfree(tmp);
+	errno = error;
+	return ret;
+
+fail:
+	dstrfree(tmp);
+	return -1;
+}
+
+/** Parse a "key value" header line. */
+static int checkpoint_header(FILE *file, const char *key, size_t *value) {
+	char *line = xgetdelim(file, '\n');
+	if (!line) {
+		if (errno == 0) {
+			errno = EINVAL;
+		}
+		return -1;
+	}
+
+	int ret = -1;
+	size_t len = strlen(key);
+	long long ll;
+	if (strncmp(line, key, len) != 0 || line[len] != ' ') {
+		errno = EINVAL;
+	} else if (xstrtoll(line + len + 1, NULL, 10, &ll) == 0) {
+		if (ll < 0) {
+			errno = EINVAL;
+		} else {
+			*value = ll;
+			ret = 0;
+		}
+	}
+
+	free(line);
+	return ret;
+}
+
+/** Parse a "DEPTH PATH" record. */
+static int checkpoint_record(struct bfs_checkpoint *checkpoint, char *record) {
+	char *path;
+	long long depth;
+	if (xstrtoll(record, &path, 10, &depth) != 0 || depth < 0 || *path != ' ' || !path[1]) {
+		errno = EINVAL;
+		return -1;
+	}
+	++path;
+
+	size_t npaths = checkpoint->npaths;
+	size_t *dptr = RESERVE(size_t, &checkpoint->depths, &npaths);
+	if (!dptr) {
+		return -1;
+	}
+	*dptr = depth;
+
+	const char **pptr = RESERVE(const char *, &checkpoint->paths, &checkpoint->npaths);
+	if (!pptr) {
+		return -1;
+	}
+	*pptr = strdup(path);
+	if (!*pptr) {
+		--checkpoint->npaths;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct bfs_checkpoint *bfs_checkpoint_load(const char *path) {
+	struct bfs_checkpoint *checkpoint = ZALLOC(struct bfs_checkpoint);
+	if (!checkpoint) {
+		return NULL;
+	}
+
+	FILE *file = xfopen(path, O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		goto fail;
+	}
+
+	char *magic = xgetdelim(file, '\n');
+	if (!magic || strcmp(magic, CHECKPOINT_MAGIC) != 0) {
+		free(magic);
+		if (errno == 0) {
+			errno = EINVAL;
+		}
+		goto fail_file;
+	}
+	free(magic);
+
+	if (checkpoint_header(file, "visited", &checkpoint->visited) != 0) {
+		goto fail_file;
+	}
+
+	char *record;
+	while ((record = xgetdelim(file, '\0'))) {
+		int ret = checkpoint_record(checkpoint, record);
+		free(record);
+		if (ret != 0) {
+			goto fail_file;
+		}
+	}
+	if (errno != 0) {
+		goto fail_file;
+	}
+
+	fclose(file);
+	return checkpoint;
+
+fail_file:
+	fclose(file);
+fail:
+	bfs_checkpoint_free(checkpoint);
+	return NULL;
+}
+
+void bfs_checkpoint_free(struct bfs_checkpoint *checkpoint) {
+	if (!checkpoint) {
+		return;
+	}
+
+	for (size_t i = 0; i < checkpoint->npaths; ++i) {
+		free((char *)checkpoint->paths[i]);
+	}
+	free(checkpoint->paths);
+	free(checkpoint->depths);
+	free(checkpoint);
+}
@@ -0,0 +1,55 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Saved traversal state, for resuming long searches (-checkpoint, -resume).
+ */
+
+#ifndef BFS_CHECKPOINT_H
+#define BFS_CHECKPOINT_H
+
+#include <stddef.h>
+
+/**
+ * The remaining work of a search.
+ */
+struct bfs_checkpoint {
+	/** The number of files visited before the checkpoint. */
+	size_t visited;
+	/** The directories that were visited, but not yet read. */
+	const char **paths;
+	/** The depth of each directory. */
+	size_t *depths;
+	/** The number of directories. */
+	size_t npaths;
+};
+
+/**
+ * Save a checkpoint.  The file is replaced atomically, so an interrupted save
+ * leaves the previous checkpoint intact.
+ *
+ * @param path
+ *         The path to the checkpoint file.
+ * @param checkpoint
+ *         The checkpoint to save.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_checkpoint_save(const char *path, const struct bfs_checkpoint *checkpoint);
+
+/**
+ * Load a checkpoint.
+ *
+ * @param path
+ *         The path to the checkpoint file.
+ * @return
+ *         The loaded checkpoint, or NULL on failure.
+ */
+struct bfs_checkpoint *bfs_checkpoint_load(const char *path);
+
+/**
+ * Free a loaded checkpoint.
+ */
+void bfs_checkpoint_free(struct bfs_checkpoint *checkpoint);
+
+#endif // BFS_CHECKPOINT_H
@@ -13,7 +13,9 @@
 #include "expr.h"
 #include "fsade.h"
 #include "stat.h"
+#include "trace.h"
 #include "trie.h"
+#include "writer.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -22,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -84,6 +87,8 @@ struct colors {
 	struct esc_seq *multi_hard;
 	struct esc_seq *executable;
 	struct esc_seq *capable;
+	/** Devices that don't support capabilities, for capable. */
+	struct bfs_fsade_cache capable_cache;
 	struct esc_seq *setgid;
 	struct esc_seq *setuid;
 
@@ -110,6 +115,8 @@ struct colors {
 	size_t ext_count;
 	/** Longest extension. */
 	size_t ext_len;
+	/** Whether any extension has a '.' after its first character. */
+	bool ext_dotted;
 	/** Case-sensitive extension trie. */
 	struct trie ext_trie;
 	/** Case-insensitive extension trie. */
@@ -264,6 +271,10 @@ static int set_ext(struct colors *colors, dchar *key, dchar *value) {
 		colors->ext_len = len;
 	}
 
+	if (len > 1 && memchr(key + 1, '.', len - 1)) {
+		colors->ext_dotted = true;
+	}
+
 	return 0;
 
 fail:
@@ -359,9 +370,8 @@ static int build_iext_trie(struct colors *colors) {
 /**
  * Find a color by an extension.
  */
-static const struct esc_seq *get_ext(const struct colors *colors, const char *filename) {
+static const struct esc_seq *find_ext(const struct colors *colors, const char *filename, size_t name_len) {
 	size_t ext_len = colors->ext_len;
-	size_t name_len = strlen(filename);
 	if (name_len < ext_len) {
 		ext_len = name_len;
 	}
@@ -397,6 +407,70 @@ static const struct esc_seq *get_ext(const struct colors *colors, const char *fi
 	return ext ? ext->esc : NULL;
 }
 
+/** The maximum length of a memoized extension. */
+#define EXT_CACHE_LEN 15
+/** The number of memoized extensions. */
+#define EXT_CACHE_SIZE 64
+
+/** A direct-mapped cache of extension colors. */
+struct ext_cache {
+	struct {
+		/** The length of the extension (0 for an empty slot). */
+		unsigned char len;
+		/** The extension itself. */
+		char ext[EXT_CACHE_LEN];
+		/** The color for that extension, possibly NULL. */
+		const struct esc_seq *esc;
+	} slots[EXT_CACHE_SIZE];
+};
+
+/** Get the color for a file by its extension. */
+static const struct esc_seq *get_ext(CFILE *cfile, const char *filename) {
+	const struct colors *colors = cfile->colors;
+	if (colors->ext_count == 0) {
+		return NULL;
+	}
+
+	size_t name_len = strlen(filename);
+	if (colors->ext_dotted) {
+		return find_ext(colors, filename, name_len);
+	}
+
+	// No extension has an inner '.', so any matching suffix lies within
+	// the final .ext.  That makes the color a function of just .ext.
+	const char *dot = strrchr(filename, '.');
+	const char *ext = dot ? dot : filename;
+	size_t len = filename + name_len - ext;
+	if (len > EXT_CACHE_LEN) {
+		return find_ext(colors, filename, name_len);
+	}
+
+	struct ext_cache *cache = cfile->ext_cache;
+	if (!cache) {
+		cache = ZALLOC(struct ext_cache);
+		if (!cache) {
+			return find_ext(colors, filename, name_len);
+		}
+		cfile->ext_cache = cache;
+	}
+
+	size_t hash = len;
+	for (size_t i = 0; i < len; ++i) {
+		hash = 31 * hash + (unsigned char)ext[i];
+	}
+
+	unsigned int i = hash % EXT_CACHE_SIZE;
+	if (cache->slots[i].len == len && memcmp(cache->slots[i].ext, ext, len) == 0) {
+		return cache->slots[i].esc;
+	}
+
+	const struct esc_seq *esc = find_ext(colors, filename, name_len);
+	cache->slots[i].len = len;
+	memcpy(cache->slots[i].ext, ext, len);
+	cache->slots[i].esc = esc;
+	return esc;
+}
+
 /**
  * Parse a chunk of $LS_COLORS that may have escape sequences.  The supported
  * escapes are:
@@ -620,9 +694,11 @@ struct colors *parse_colors(void) {
 	VARENA_INIT(&colors->ext_arena, struct ext_color, ext);
 	trie_init(&colors->names);
 	colors->ext_count = 0;
+	colors->ext_dotted = false;
 	colors->ext_len = 0;
 	trie_init(&colors->ext_trie);
 	trie_init(&colors->iext_trie);
+	bfs_fsade_cache_init(&colors->capable_cache);
 
 	bool fail = false;
 
@@ -689,6 +765,11 @@ struct colors *parse_colors(void) {
 		goto fail;
 	}
 
+	// The extension tries are searched for every colored file name (if
+	// freezing fails, they still work, just a bit slower)
+	trie_freeze(&colors->ext_trie);
+	trie_freeze(&colors->iext_trie);
+
 	if (colors->link && esc_eq(colors->link, "target", strlen("target"))) {
 		colors->link_as_target = true;
 		colors->link->len = 0;
@@ -729,6 +810,151 @@ void free_colors(struct colors *colors) {
 	free(colors);
 }
 
+/**
+ * The stdio buffer size for non-interactive output.  The default is usually
+ * st_blksize, which is only 4 KiB for pipes, so a large buffer saves a lot of
+ * write() calls when printing millions of paths.
+ */
+#define CFILE_BUFSIZE (1 << 20)
+
+/** Static storage for stdout's buffer, which must outlive cfclose(). */
+static char cfile_stdout_buf[CFILE_BUFSIZE];
+
+/** Install a large buffer on a non-interactive stream. */
+static void cfile_setvbuf(CFILE *cfile) {
+	char *buf;
+	if (cfile->close) {
+		buf = malloc(CFILE_BUFSIZE);
+		cfile->vbuf = buf;
+	} else if (cfile->file == stdout) {
+		// Nothing may have been written yet for setvbuf() to be safe
+		if (fflush(stdout) != 0) {
+			return;
+		}
+		buf = cfile_stdout_buf;
+	} else {
+		return;
+	}
+
+	if (!buf) {
+		return;
+	} else if (setvbuf(cfile->file, buf, _IOFBF, CFILE_BUFSIZE) != 0) {
+		free(cfile->vbuf);
+		cfile->vbuf = NULL;
+		return;
+	}
+
+#ifdef F_SETPIPE_SZ
+	// Grow pipes to match, so a whole buffer can be written at once
+	struct stat sb;
+	if (fstat(cfile->fd, &sb) == 0 && S_ISFIFO(sb.st_mode)) {
+		int size = fcntl(cfile->fd, F_GETPIPE_SZ);
+		if (size >= 0 && size < CFILE_BUFSIZE) {
+			// Ignore failures, e.g. from a lower /proc/sys/fs/pipe-max-size
+			fcntl(cfile->fd, F_SETPIPE_SZ, CFILE_BUFSIZE);
+		}
+	}
+#endif
+}
+
+/**
+ * Memoized access checks for link targets in one directory.  Symlink farms tend
+ * to have many broken links into the same missing directories, so remembering
+ * the last intact and missing prefixes saves most of the xfaccessat() calls.
+ */
+struct broken_cache {
+	/** The directory containing the links. */
+	dchar *dir;
+	/** Whether the paths are relative to the directory's fd. */
+	bool at_dir;
+	/** The most recent path found to exist. */
+	dchar *intact;
+	/** The most recent path found to be missing (ENOENT). */
+	dchar *missing;
+};
+
+/** Get the memo for a link's directory, resetting it if the directory changed. */
+static struct broken_cache *broken_cache_get(CFILE *cfile, const struct BFTW *ftwbuf) {
+	struct broken_cache *cache = cfile->broken_cache;
+	if (!cache) {
+		cache = ZALLOC(struct broken_cache);
+		if (!cache) {
+			return NULL;
+		}
+		cfile->broken_cache = cache;
+	}
+
+	bool at_dir = ftwbuf->at_fd != (int)AT_FDCWD;
+	size_t len = ftwbuf->nameoff;
+	if (cache->dir && cache->at_dir == at_dir && dstrlen(cache->dir) == len && memcmp(cache->dir, ftwbuf->path, len) == 0) {
+		return cache;
+	}
+
+	if (dstrxcpy(&cache->dir, ftwbuf->path, len) != 0) {
+		dstrfree(cache->dir);
+		cache->dir = NULL;
+		return NULL;
+	}
+	cache->at_dir = at_dir;
+	dstrfree(cache->intact);
+	cache->intact = NULL;
+	dstrfree(cache->missing);
+	cache->missing = NULL;
+	return cache;
+}
+
+/** Look up a memoized access check: 0 if it exists, an errno, or -1 if unknown. */
+static int broken_cache_lookup(const struct broken_cache *cache, const dchar *path) {
+	if (!cache) {
+		return -1;
+	}
+
+	if (cache->intact && strcmp(cache->intact, path) == 0) {
+		return 0;
+	}
+
+	// Anything under a missing path is missing too
+	if (cache->missing) {
+		size_t len = dstrlen(cache->missing);
+		if (strncmp(cache->missing, path, len) == 0 && (path[len] == '\0' || path[len] == '/')) {
+			return ENOENT;
+		}
+	}
+
+	return -1;
+}
+
+/** Memoize an access check. */
+static void broken_cache_save(struct broken_cache *cache, const dchar *path, int err) {
+	if (!cache) {
+		return;
+	}
+
+	dchar **slot;
+	if (err == 0) {
+		slot = &cache->intact;
+	} else if (err == ENOENT) {
+		slot = &cache->missing;
+	} else {
+		return;
+	}
+
+	if (dstrcpy(slot, path) != 0) {
+		dstrfree(*slot);
+		*slot = NULL;
+	}
+}
+
+/** Free a broken_cache. */
+static void broken_cache_free(struct broken_cache *cache) {
+	if (cache) {
+		dstrfree(cache->dir);
+		dstrfree(cache->intact);
+		dstrfree(cache->missing);
+		free(cache);
+	}
+}
+
 CFILE *cfwrap(FILE *file, const struct colors *colors, bool close) {
 	CFILE *cfile = ALLOC(CFILE);
 	if (!cfile) {
@@ -741,8 +967,13 @@ CFILE *cfwrap(FILE *file, const struct colors *colors, bool close) {
 		return NULL;
 	}
 
+	cfile->scratch = NULL;
 	cfile->file = file;
 	cfile->fd = fileno(file);
+	cfile->vbuf = NULL;
+	cfile->ext_cache = NULL;
+	cfile->broken_cache = NULL;
+	cfile->writer = NULL;
 	cfile->need_reset = false;
 	cfile->close = close;
 
@@ -750,21 +981,81 @@ CFILE *cfwrap(FILE *file, const struct colors *colors, bool close) {
 		cfile->colors = colors;
 	} else {
 		cfile->colors = NULL;
+		cfile_setvbuf(cfile);
 	}
 
 	return cfile;
 }
 
+/** Move a colored file's writes to a background writer. */
+static int cfile_writer(CFILE *cfile) {
+	FILE *stream;
+	struct bfs_writer *writer = bfs_writer_open(cfile->file, cfile->close, &stream);
+	if (!writer) {
+		return -1;
+	}
+
+	// The underlying file is never written to directly, so its buffer can
+	// be shared with the new stream
+	if (cfile->vbuf) {
+		setvbuf(stream, cfile->vbuf, _IOFBF, CFILE_BUFSIZE);
+	}
+
+	cfile->file = stream;
+	cfile->writer = writer;
+	return 0;
+}
+
+void cfasync(CFILE *cfile) {
+	if (!cfile->close || cfile->colors || cfile->writer) {
+		return;
+	}
+
+	cfile_writer(cfile);
+}
+
+int cfcompress(CFILE *cfile, int level, size_t nthreads) {
+	if (cfile->colors) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!cfile->writer && cfile_writer(cfile) != 0) {
+		return -1;
+	}
+
+	return bfs_writer_gzip(cfile->writer, level, nthreads);
+}
+
+int cfflush(CFILE *cfile) {
+	uint64_t start = bfs_trace_begin();
+	int ret = fflush(cfile->file);
+	if (ret == 0 && cfile->writer) {
+		ret = bfs_writer_sync(cfile->writer);
+	}
+	bfs_trace_end("cfflush", start);
+	if (ret != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
 int cfclose(CFILE *cfile) {
 	int ret = 0;
 
 	if (cfile) {
 		dstrfree(cfile->buffer);
+		dstrfree(cfile->scratch);
 
-		if (cfile->close) {
+		// The background writer's stream is always ours to close
+		if (cfile->close || cfile->writer) {
 			ret = fclose(cfile->file);
 		}
 
+		free(cfile->ext_cache);
+		broken_cache_free(cfile->broken_cache);
+		free(cfile->vbuf);
 		free(cfile);
 	}
 
@@ -786,7 +1077,8 @@ bool colors_need_stat(const struct colors *colors) {
 }
 
 /** Get the color for a file. */
-static const struct esc_seq *file_color(const struct colors *colors, const char *filename, const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
+static const struct esc_seq *file_color(CFILE *cfile, const char *filename, const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
+	const struct colors *colors = cfile->colors;
 	enum bfs_type type = bftw_type(ftwbuf, flags);
 	if (type == BFS_ERROR) {
 		goto error;
@@ -808,7 +1100,7 @@ static const struct esc_seq *file_color(const struct colors *colors, const char
 			color = colors->setuid;
 		} else if (colors->setgid && (statbuf->mode & 02000)) {
 			color = colors->setgid;
-		} else if (colors->capable && bfs_check_capabilities(ftwbuf) > 0) {
+		} else if (colors->capable && bfs_check_capabilities(ftwbuf, (struct bfs_fsade_cache *)&colors->capable_cache) > 0) {
 			color = colors->capable;
 		} else if (colors->executable && (statbuf->mode & 00111)) {
 			color = colors->executable;
@@ -817,7 +1109,7 @@ static const struct esc_seq *file_color(const struct colors *colors, const char
 		}
 
 		if (!color) {
-			color = get_ext(colors, filename);
+			color = get_ext(cfile, filename);
 		}
 
 		if (!color) {
@@ -951,7 +1243,7 @@ static int print_colored(CFILE *cfile, const struct esc_seq *esc, const char *st
 }
 
 /** Find the offset of the first broken path component. */
-static ssize_t first_broken_offset(const char *path, const struct BFTW *ftwbuf, enum bfs_stat_flags flags, size_t max) {
+static ssize_t first_broken_offset(CFILE *cfile, const char *path, const struct BFTW *ftwbuf, enum bfs_stat_flags flags, size_t max) {
 	ssize_t ret = max;
 	bfs_assert(ret >= 0);
 
@@ -961,6 +1253,7 @@ static ssize_t first_broken_offset(const char *path, const struct BFTW *ftwbuf,
 
 	dchar *at_path;
 	int at_fd;
+	struct broken_cache *cache = NULL;
 	if (path == ftwbuf->path) {
 		if (ftwbuf->depth == 0) {
 			at_fd = AT_FDCWD;
@@ -972,6 +1265,7 @@ static ssize_t first_broken_offset(const char *path, const struct BFTW *ftwbuf,
 	} else {
 		// We're in print_link_target(), so resolve relative to the link's parent directory
 		at_fd = ftwbuf->at_fd;
+		cache = broken_cache_get(cfile, ftwbuf);
 		if (at_fd == (int)AT_FDCWD && path[0] != '/') {
 			at_path = dstrxdup(ftwbuf->path, ftwbuf->nameoff);
 			if (at_path && dstrxcat(&at_path, path, max) != 0) {
@@ -989,7 +1283,12 @@ static ssize_t first_broken_offset(const char *path, const struct BFTW *ftwbuf,
 	}
 
 	while (ret > 0) {
-		if (xfaccessat(at_fd, at_path, F_OK) == 0) {
+		int err = broken_cache_lookup(cache, at_path);
+		if (err < 0) {
+			err = xfaccessat(at_fd, at_path, F_OK) == 0 ? 0 : errno;
+			broken_cache_save(cache, at_path, err);
+		}
+		if (err == 0) {
 			break;
 		}
 
@@ -997,7 +1296,7 @@ static ssize_t first_broken_offset(const char *path, const struct BFTW *ftwbuf,
 		while (ret && at_path[len - 1] == '/') {
 			--len, --ret;
 		}
-		if (errno != ENOTDIR) {
+		if (err != ENOTDIR) {
 			while (ret && at_path[len - 1] != '/') {
 				--len, --ret;
 			}
@@ -1024,7 +1323,7 @@ static int print_path_colored(CFILE *cfile, const char *path, const struct BFTW
 	const char *name = path + nameoff;
 	size_t pathlen = nameoff + strlen(name);
 
-	ssize_t broken = first_broken_offset(path, ftwbuf, flags, nameoff);
+	ssize_t broken = first_broken_offset(cfile, path, ftwbuf, flags, nameoff);
 	if (broken < 0) {
 		return -1;
 	}
@@ -1040,7 +1339,7 @@ static int print_path_colored(CFILE *cfile, const char *path, const struct BFTW
 			name_color = colors->orphan;
 		}
 	} else {
-		name_color = file_color(cfile->colors, path + nameoff, ftwbuf, flags);
+		name_color = file_color(cfile, path + nameoff, ftwbuf, flags);
 		if (name_color == dirs_color) {
 			split = pathlen;
 		}
@@ -1063,7 +1362,7 @@ static int print_path_colored(CFILE *cfile, const char *path, const struct BFTW
 
 /** Print a file name with colors. */
 static int print_name_colored(CFILE *cfile, const char *name, const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
-	const struct esc_seq *esc = file_color(cfile->colors, name, ftwbuf, flags);
+	const struct esc_seq *esc = file_color(cfile, name, ftwbuf, flags);
 	return print_colored(cfile, esc, name, strlen(name));
 }
 
@@ -1101,23 +1400,16 @@ static int print_path(CFILE *cfile, const struct BFTW *ftwbuf) {
 
 /** Print a link target with the appropriate colors. */
 static int print_link_target(CFILE *cfile, const struct BFTW *ftwbuf) {
-	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-	size_t len = statbuf ? statbuf->size : 0;
-
-	char *target = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
+	const char *target = bftw_readlink(ftwbuf);
 	if (!target) {
 		return -1;
 	}
 
-	int ret;
 	if (cfile->colors) {
-		ret = print_path_colored(cfile, target, ftwbuf, BFS_STAT_FOLLOW);
+		return print_path_colored(cfile, target, ftwbuf, BFS_STAT_FOLLOW);
 	} else {
-		ret = dstrcat(&cfile->buffer, target);
+		return dstrdcat(&cfile->buffer, target);
 	}
-
-	free(target);
-	return ret;
 }
 
 /** Format some colored output to the buffer. */
@@ -1401,6 +1693,22 @@ int cfprintf(CFILE *cfile, const char *format, ...) {
 	return ret;
 }
 
+int cfdcatf(CFILE *cfile, dchar **str, const char *format, ...) {
+	bfs_assert(dstrlen(cfile->buffer) == 0);
+
+	va_list args;
+	va_start(args, format);
+	int ret = cvbuff(cfile, format, args);
+	va_end(args);
+
+	if (ret == 0) {
+		ret = dstrdcat(str, cfile->buffer);
+	}
+
+	dstresize(&cfile->buffer, 0);
+	return ret;
+}
+
 int cfreset(CFILE *cfile) {
 	const struct colors *colors = cfile->colors;
 	if (!colors) {
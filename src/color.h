@@ -43,6 +43,16 @@ typedef struct CFILE {
 	const struct colors *colors;
 	/** A buffer for colored formatting. */
 	dchar *buffer;
+	/** A scratch buffer for short-lived strings, like link targets. */
+	dchar *scratch;
+	/** A large stdio buffer for non-interactive output, if we own one. */
+	char *vbuf;
+	/** Memoized extension colors. */
+	struct ext_cache *ext_cache;
+	/** Memoized broken link target prefixes. */
+	struct broken_cache *broken_cache;
+	/** The background writer, if any. */
+	struct bfs_writer *writer;
 	/** Cached file descriptor number. */
 	int fd;
 	/** Whether the next ${rs} is actually necessary. */
@@ -65,6 +75,41 @@ typedef struct CFILE {
  */
 CFILE *cfwrap(FILE *file, const struct colors *colors, bool close);
 
+/**
+ * Move the writes for a colored file to a background thread, if possible.
+ * Only uncolored files that we own (close == true) and haven't written to yet
+ * are eligible.
+ *
+ * @param cfile
+ *         The colored file to modify.
+ */
+void cfasync(CFILE *cfile);
+
+/**
+ * Compress the output of a colored file with gzip, on background threads.
+ * Only uncolored files that haven't been written to yet are eligible.
+ *
+ * @param cfile
+ *         The colored file to modify.
+ * @param level
+ *         The compression level.
+ * @param nthreads
+ *         The number of compressor threads.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int cfcompress(CFILE *cfile, int level, size_t nthreads);
+
+/**
+ * Flush a colored file, waiting for any background writes.
+ *
+ * @param cfile
+ *         The colored file to flush.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int cfflush(CFILE *cfile);
+
 /**
  * Close a colored file.
  *
@@ -110,6 +155,22 @@ int cfprintf(CFILE *cfile, const char *format, ...);
 _printf(2, 0)
 int cvfprintf(CFILE *cfile, const char *format, va_list args);
 
+/**
+ * cfprintf() variant that appends to a dynamic string instead of writing to
+ * the stream, using the stream's colors.
+ *
+ * @param cfile
+ *         The colored stream whose colors should be used.
+ * @param[in,out] str
+ *         The string to append to.
+ * @param format
+ *         The format string, as in cfprintf().
+ * @return
+ *         0 on success, -1 on failure.
+ */
+_printf(3, 4)
+int cfdcatf(CFILE *cfile, dchar **str, const char *format, ...);
+
 /**
  * Reset the TTY state when terminating abnormally (async-signal-safe).
  */
@@ -0,0 +1,363 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "coproc.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "color.h"
+#include "ctx.h"
+#include "diag.h"
+#include "dlog.h"
+#include "xspawn.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Print some debugging info. */
+_printf(2, 3)
+static void bfs_coproc_debug(const struct bfs_coproc *coproc, const char *format, ...) {
+	const struct bfs_ctx *ctx = coproc->ctx;
+
+	if (!(ctx->debug & DEBUG_EXEC)) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	bfs_dlog_vexec(ctx, coproc->argv[-1], format, args);
+	va_end(args);
+}
+
+/** Highlight part of the command line as an error. */
+static void bfs_coproc_parse_error(const struct bfs_ctx *ctx, char **argv, size_t argc) {
+	if (argv[argc]) {
+		++argc;
+	}
+
+	bool args[ctx->argc];
+	for (size_t i = 0; i < ctx->argc; ++i) {
+		args[i] = false;
+	}
+
+	size_t i = argv - ctx->argv;
+	for (size_t j = 0; j < argc; ++j) {
+		args[i + j] = true;
+	}
+
+	bfs_argv_error(ctx, args);
+}
+
+struct bfs_coproc *bfs_coproc_parse(const struct bfs_ctx *ctx, char **argv, enum bfs_coproc_flags flags) {
+	size_t argc = 1;
+	while (argv[argc] && strcmp(argv[argc], ";") != 0) {
+		++argc;
+	}
+
+	if (!argv[argc]) {
+		bfs_coproc_parse_error(ctx, argv, argc);
+		bfs_error(ctx, "Expected '... ;'.\n");
+		return NULL;
+	} else if (argc == 1) {
+		bfs_coproc_parse_error(ctx, argv, argc);
+		bfs_error(ctx, "Missing command.\n");
+		return NULL;
+	}
+
+	struct bfs_coproc *coproc = ZALLOC(struct bfs_coproc);
+	if (!coproc) {
+		bfs_perror(ctx, "zalloc()");
+		return NULL;
+	}
+
+	coproc->flags = flags;
+	coproc->ctx = ctx;
+	coproc->argc = argc - 1;
+	coproc->pid = -1;
+
+	// Keep argv[-1] pointing at the action name, for debugging
+	coproc->argv = ALLOC_ARRAY(char *, argc + 1);
+	if (!coproc->argv) {
+		bfs_perror(ctx, "alloc()");
+		free(coproc);
+		return NULL;
+	}
+	memcpy(coproc->argv, argv, argc * sizeof(*argv));
+	coproc->argv[argc] = NULL;
+	++coproc->argv;
+
+	return coproc;
+}
+
+/**
+ * Block SIGPIPE while writing to the command, so that we get EPIPE instead of
+ * dying if it exits early.
+ */
+static void sigpipe_block(sigset_t *old) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, old);
+}
+
+/** Discard any SIGPIPE we caused, then restore the signal mask. */
+static void sigpipe_unblock(const sigset_t *old) {
+	int error = errno;
+
+	sigset_t pending;
+	if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) && !sigismember(old, SIGPIPE)) {
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGPIPE);
+		int sig;
+		sigwait(&mask, &sig);
+	}
+
+	pthread_sigmask(SIG_SETMASK, old, NULL);
+	errno = error;
+}
+
+/** Close the command's pipes. */
+static int bfs_coproc_close(struct bfs_coproc *coproc) {
+	int ret = 0;
+
+	sigset_t old;
+	sigpipe_block(&old);
+
+	if (coproc->in) {
+		if (cfclose(coproc->in) != 0) {
+			ret = -1;
+		}
+		coproc->in = NULL;
+	}
+
+	if (coproc->out) {
+		fclose(coproc->out);
+		coproc->out = NULL;
+	}
+
+	sigpipe_unblock(&old);
+	return ret;
+}
+
+/** Start the command, connected to a pipe. */
+static int bfs_coproc_start(struct bfs_coproc *coproc) {
+	const struct bfs_ctx *ctx = coproc->ctx;
+	bool test = coproc->flags & BFS_COPROC_TEST;
+	int error;
+
+	int in[2] = {-1, -1};
+	int out[2] = {-1, -1};
+	if (pipe_cloexec(in) != 0) {
+		return -1;
+	}
+	if (test && pipe_cloexec(out) != 0) {
+		goto fail;
+	}
+
+	struct bfs_spawn spawn;
+	if (bfs_spawn_init(&spawn) != 0) {
+		goto fail;
+	}
+
+	spawn.flags |= BFS_SPAWN_USE_PATH;
+
+	if (bfs_spawn_adddup2(&spawn, in[0], STDIN_FILENO) != 0) {
+		goto fail_spawn;
+	}
+	if (test && bfs_spawn_adddup2(&spawn, out[1], STDOUT_FILENO) != 0) {
+		goto fail_spawn;
+	}
+
+	// Reset RLIMIT_NOFILE if necessary, to avoid breaking applications that use select()
+	if (rlim_cmp(ctx->orig_nofile.rlim_cur, ctx->cur_nofile.rlim_cur) < 0) {
+		if (bfs_spawn_setrlimit(&spawn, RLIMIT_NOFILE, &ctx->orig_nofile) != 0) {
+			goto fail_spawn;
+		}
+	}
+
+	// Flush the context state for consistency with the external process
+	bfs_ctx_flush(ctx);
+
+	bfs_coproc_debug(coproc, "Starting '%s' ... [%zu arguments]\n", coproc->argv[0], coproc->argc - 1);
+
+	coproc->pid = bfs_spawn(coproc->argv[0], &spawn, coproc->argv, NULL);
+	if (coproc->pid < 0) {
+		goto fail_spawn;
+	}
+
+	bfs_spawn_destroy(&spawn);
+	xclose(in[0]);
+	in[0] = -1;
+	if (test) {
+		xclose(out[1]);
+		out[1] = -1;
+	}
+
+	FILE *file = fdopen(in[1], "w");
+	if (!file) {
+		goto fail;
+	}
+	in[1] = -1;
+
+	coproc->in = cfwrap(file, NULL, true);
+	if (!coproc->in) {
+		fclose(file);
+		goto fail;
+	}
+
+	if (test) {
+		coproc->out = fdopen(out[0], "r");
+		if (!coproc->out) {
+			goto fail;
+		}
+		out[0] = -1;
+	} else {
+		// Nobody waits for a verdict, so let the writes happen in the background
+		cfasync(coproc->in);
+	}
+
+	return 0;
+
+fail_spawn:
+	error = errno;
+	bfs_spawn_destroy(&spawn);
+	errno = error;
+fail:
+	error = errno;
+	bfs_coproc_close(coproc);
+	for (int i = 0; i < 2; ++i) {
+		if (in[i] >= 0) {
+			xclose(in[i]);
+		}
+		if (out[i] >= 0) {
+			xclose(out[i]);
+		}
+	}
+	errno = error;
+	return -1;
+}
+
+/** Read the verdict for the last path. */
+static int bfs_coproc_verdict(struct bfs_coproc *coproc) {
+	sigset_t old;
+	sigpipe_block(&old);
+	int ret = cfflush(coproc->in);
+	sigpipe_unblock(&old);
+	if (ret != 0) {
+		return -1;
+	}
+
+	if (getline(&coproc->line, &coproc->line_cap, coproc->out) < 0) {
+		if (!ferror(coproc->out)) {
+			bfs_coproc_debug(coproc, "'%s' stopped responding\n", coproc->argv[0]);
+			errno = EPIPE;
+		}
+		return -1;
+	}
+
+	char c = coproc->line[0];
+	return c == 'y' || c == 'Y';
+}
+
+int bfs_coproc_push(struct bfs_coproc *coproc, const char *path) {
+	if (coproc->pid < 0) {
+		if (coproc->ret != 0) {
+			// We already failed to start it
+			errno = 0;
+			return -1;
+		}
+
+		if (bfs_coproc_start(coproc) != 0) {
+			coproc->ret = -1;
+			return -1;
+		}
+	}
+
+	if (!coproc->in) {
+		errno = 0;
+		return -1;
+	}
+
+	int ret = 1;
+	FILE *file = coproc->in->file;
+	char delim = (coproc->flags & BFS_COPROC_NUL) ? '\0' : '\n';
+	if (fputs(path, file) == EOF || putc(delim, file) == EOF) {
+		ret = -1;
+	} else if (coproc->flags & BFS_COPROC_TEST) {
+		ret = bfs_coproc_verdict(coproc);
+	}
+
+	if (ret < 0) {
+		// Stop talking to it after the first error
+		coproc->ret = -1;
+		bfs_coproc_close(coproc);
+	}
+
+	return ret;
+}
+
+int bfs_coproc_finish(struct bfs_coproc *coproc) {
+	if (coproc->pid < 0) {
+		return coproc->ret;
+	}
+
+	int error = 0;
+	if (bfs_coproc_close(coproc) != 0) {
+		error = errno;
+		coproc->ret = -1;
+	}
+
+	bfs_coproc_debug(coproc, "Waiting for '%s' to exit\n", coproc->argv[0]);
+
+	int wstatus;
+	pid_t pid = coproc->pid;
+	coproc->pid = -1;
+	if (xwaitpid(pid, &wstatus, 0) < 0) {
+		return -1;
+	}
+
+	if (WIFEXITED(wstatus)) {
+		int status = WEXITSTATUS(wstatus);
+		if (status != EXIT_SUCCESS) {
+			bfs_coproc_debug(coproc, "Command '%s' failed with status %d\n", coproc->argv[0], status);
+			coproc->ret = -1;
+		}
+	} else if (WIFSIGNALED(wstatus)) {
+		int sig = WTERMSIG(wstatus);
+		const char *str = strsignal(sig);
+		if (!str) {
+			str = "unknown";
+		}
+		bfs_warning(coproc->ctx, "Command '${ex}%s${rs}' terminated by signal %d (%s)\n", coproc->argv[0], sig, str);
+		coproc->ret = -1;
+	} else {
+		bfs_warning(coproc->ctx, "Command '${ex}%s${rs}' terminated abnormally\n", coproc->argv[0]);
+		coproc->ret = -1;
+	}
+
+	errno = error;
+	return coproc->ret;
+}
+
+void bfs_coproc_free(struct bfs_coproc *coproc) {
+	if (coproc) {
+		if (coproc->pid >= 0) {
+			bfs_coproc_close(coproc);
+			xwaitpid(coproc->pid, NULL, 0);
+		}
+
+		free(coproc->line);
+		free(coproc->argv - 1);
+		free(coproc);
+	}
+}
@@ -0,0 +1,101 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Implementation of -coproc and friends.
+ */
+
+#ifndef BFS_COPROC_H
+#define BFS_COPROC_H
+
+#include "color.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+struct bfs_ctx;
+
+/**
+ * Flags for the -coproc actions.
+ */
+enum bfs_coproc_flags {
+	/** Separate paths with NUL bytes instead of newlines (-coproc0, -coproc-test0). */
+	BFS_COPROC_NUL  = 1 << 0,
+	/** Read a verdict for each path from the command's output (-coproc-test). */
+	BFS_COPROC_TEST = 1 << 1,
+};
+
+/**
+ * A persistent command that paths are streamed to.
+ */
+struct bfs_coproc {
+	/** Flags for this coprocess. */
+	enum bfs_coproc_flags flags;
+
+	/** The bfs context. */
+	const struct bfs_ctx *ctx;
+	/** The command line. */
+	char **argv;
+	/** The number of command line arguments. */
+	size_t argc;
+
+	/** The running command, or -1 if it hasn't been started. */
+	pid_t pid;
+	/** The command's standard input. */
+	CFILE *in;
+	/** The command's standard output, for BFS_COPROC_TEST. */
+	FILE *out;
+	/** Buffer for the responses from out. */
+	char *line;
+	/** Capacity of the line buffer. */
+	size_t line_cap;
+
+	/** The ultimate return value for bfs_coproc_finish(). */
+	int ret;
+};
+
+/**
+ * Parse a coprocess action.
+ *
+ * @param ctx
+ *         The bfs context.
+ * @param argv
+ *         The (bfs) command line argument to parse.
+ * @param flags
+ *         Any flags for this action.
+ * @return
+ *         The parsed action, or NULL on failure.
+ */
+struct bfs_coproc *bfs_coproc_parse(const struct bfs_ctx *ctx, char **argv, enum bfs_coproc_flags flags);
+
+/**
+ * Send a path to a coprocess, starting it if necessary.
+ *
+ * @param coproc
+ *         The coprocess.
+ * @param path
+ *         The path to send.
+ * @return
+ *         1 if the path matched, 0 if it didn't, or -1 on error.  Without
+ *         BFS_COPROC_TEST, every path matches.
+ */
+int bfs_coproc_push(struct bfs_coproc *coproc, const char *path);
+
+/**
+ * Close the coprocess's input and wait for it to exit.
+ *
+ * @param coproc
+ *         The coprocess.
+ * @return
+ *         0 on success, -1 if any errors were encountered.  If the command
+ *         itself failed, errno will be 0.
+ */
+int bfs_coproc_finish(struct bfs_coproc *coproc);
+
+/**
+ * Free a coprocess action.
+ */
+void bfs_coproc_free(struct bfs_coproc *coproc);
+
+#endif // BFS_COPROC_H
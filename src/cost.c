@@ -0,0 +1,238 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "cost.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "bftw.h"
+#include "diag.h"
+#include "perf.h"
+#include "stat.h"
+#include "xregex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *bfs_cost_name(enum bfs_cost cost) {
+	switch (cost) {
+	case BFS_COST_FAST:
+		return "fast";
+	case BFS_COST_FNMATCH:
+		return "fnmatch";
+	case BFS_COST_STAT:
+		return "stat";
+	case BFS_COST_REGEX:
+		return "regex";
+	case BFS_COST_PRINT:
+		return "print";
+
+	case BFS_COSTS:
+		break;
+	}
+
+	bfs_bug("Unknown bfs_cost %d", (int)cost);
+	return "???";
+}
+
+void bfs_costs_init(float costs[BFS_COSTS]) {
+	costs[BFS_COST_FAST] = 40.0;
+	costs[BFS_COST_FNMATCH] = 400.0;
+	costs[BFS_COST_STAT] = 1000.0;
+	costs[BFS_COST_REGEX] = 2000.0;
+	costs[BFS_COST_PRINT] = 20000.0;
+}
+
+/** Parse one line of a cost table. */
+static int costs_parse(float costs[BFS_COSTS], char *line) {
+	line += strspn(line, " \t");
+	if (!line[0] || line[0] == '#') {
+		return 0;
+	}
+
+	size_t len = strcspn(line, " \t");
+	char *end;
+	float cost = strtof(line + len, &end);
+	if (end == line + len || cost < 0.0) {
+		return -1;
+	}
+	end += strspn(end, " \t");
+	if (*end) {
+		return -1;
+	}
+
+	for (int i = 0; i < BFS_COSTS; ++i) {
+		const char *name = bfs_cost_name(i);
+		if (strlen(name) == len && strncmp(line, name, len) == 0) {
+			costs[i] = cost;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int bfs_costs_load(float costs[BFS_COSTS], const char *path) {
+	FILE *file = xfopen(path, O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		return -1;
+	}
+
+	int ret = -1;
+	char *line;
+	while ((line = xgetdelim(file, '\n'))) {
+		int parsed = costs_parse(costs, line);
+		free(line);
+		if (parsed != 0) {
+			errno = EINVAL;
+			goto done;
+		}
+	}
+
+	if (errno == 0) {
+		ret = 0;
+	}
+
+done:
+	fclose(file);
+	return ret;
+}
+
+/** The number of files to sample. */
+#define CALIBRATE_SAMPLES 10000
+
+/** How many times to repeat the cheap measurements, to amortize the clock. */
+#define CALIBRATE_REPS 16
+
+struct bfs_calibration {
+	/** The number of files sampled so far. */
+	size_t samples;
+	/** The total time spent in each class, in nanoseconds. */
+	uint64_t elapsed[BFS_COSTS];
+	/** The number of measurements of each class. */
+	uint64_t count[BFS_COSTS];
+	/** The overhead of reading the clock, in nanoseconds. */
+	uint64_t overhead;
+	/** A regex that forces the engine to run. */
+	struct bfs_regex *regex;
+};
+
+struct bfs_calibration *bfs_calibration_new(void) {
+	struct bfs_calibration *cal = ZALLOC(struct bfs_calibration);
+	if (!cal) {
+		return NULL;
+	}
+
+	// No required literal, so bfs_regexec() can't skip the engine
+	if (bfs_regcomp(&cal->regex, ".*[[:alnum:]]_", BFS_REGEX_POSIX_EXTENDED, 0) != 0) {
+		if (cal->regex) {
+			errno = EINVAL;
+		}
+		bfs_calibration_free(cal);
+		return NULL;
+	}
+
+	cal->overhead = UINT64_MAX;
+	for (int i = 0; i < 1000; ++i) {
+		uint64_t start = bfs_perf_now();
+		uint64_t end = bfs_perf_now();
+		if (end - start < cal->overhead) {
+			cal->overhead = end - start;
+		}
+	}
+
+	return cal;
+}
+
+/** Record a measurement. */
+static void calibrate_add(struct bfs_calibration *cal, enum bfs_cost cost, uint64_t start, uint64_t end, size_t reps) {
+	uint64_t elapsed = end > start + cal->overhead ? end - start - cal->overhead : 0;
+	cal->elapsed[cost] += elapsed;
+	cal->count[cost] += reps;
+}
+
+bool bfs_calibrate(struct bfs_calibration *cal, const struct BFTW *ftwbuf) {
+	const char *name = ftwbuf->path + ftwbuf->nameoff;
+	// Keep the compiler from optimizing the loops away
+	volatile int sink = 0;
+
+	uint64_t start = bfs_perf_now();
+	for (int i = 0; i < CALIBRATE_REPS; ++i) {
+		sink += ftwbuf->type == BFS_REG;
+	}
+	uint64_t end = bfs_perf_now();
+	calibrate_add(cal, BFS_COST_FAST, start, end, CALIBRATE_REPS);
+
+	start = bfs_perf_now();
+	for (int i = 0; i < CALIBRATE_REPS; ++i) {
+		sink += fnmatch("*.c", name, 0);
+	}
+	end = bfs_perf_now();
+	calibrate_add(cal, BFS_COST_FNMATCH, start, end, CALIBRATE_REPS);
+
+	start = bfs_perf_now();
+	for (int i = 0; i < CALIBRATE_REPS; ++i) {
+		sink += bfs_regexec(cal->regex, ftwbuf->path, BFS_REGEX_ANCHOR);
+	}
+	end = bfs_perf_now();
+	calibrate_add(cal, BFS_COST_REGEX, start, end, CALIBRATE_REPS);
+
+	// Only stat() once, since the second time would be cached
+	struct bfs_stat buf;
+	start = bfs_perf_now();
+	if (bfs_stat(ftwbuf->at_fd, ftwbuf->at_path, BFS_STAT_NOFOLLOW, &buf) == 0) {
+		end = bfs_perf_now();
+		calibrate_add(cal, BFS_COST_STAT, start, end, 1);
+	}
+
+	(void)sink;
+	return ++cal->samples >= CALIBRATE_SAMPLES;
+}
+
+int bfs_calibration_save(const struct bfs_calibration *cal, const char *path) {
+	FILE *file = xfopen(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+	if (!file) {
+		return -1;
+	}
+
+	float defaults[BFS_COSTS];
+	bfs_costs_init(defaults);
+
+	if (fprintf(file, "# bfs cost table, calibrated on %zu files (nanoseconds per evaluation)\n", cal->samples) < 0) {
+		goto fail;
+	}
+
+	for (int i = 0; i < BFS_COSTS; ++i) {
+		const char *name = bfs_cost_name(i);
+		int ret;
+		if (cal->count[i] > 0) {
+			double cost = (double)cal->elapsed[i] / cal->count[i];
+			ret = fprintf(file, "%s %.1f\n", name, cost);
+		} else {
+			// Not measured (printing costs depend on where the output goes)
+			ret = fprintf(file, "# %s %.1f\n", name, defaults[i]);
+		}
+		if (ret < 0) {
+			goto fail;
+		}
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+
+fail:
+	fclose(file);
+	return -1;
+}
+
+void bfs_calibration_free(struct bfs_calibration *cal) {
+	if (cal) {
+		bfs_regfree(cal->regex);
+		free(cal);
+	}
+}
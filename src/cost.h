@@ -0,0 +1,103 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Per-class cost estimates for the optimizer (-load-costs, -calibrate).
+ */
+
+#ifndef BFS_COST_H
+#define BFS_COST_H
+
+struct BFTW;
+
+/**
+ * Classes of primaries with similar costs.
+ */
+enum bfs_cost {
+	/** Cheap tests that only look at what bftw() already knows. */
+	BFS_COST_FAST,
+	/** Glob matching (-name, -path, etc.). */
+	BFS_COST_FNMATCH,
+	/** Tests that need to stat() the file. */
+	BFS_COST_STAT,
+	/** Regular expression matching (-regex). */
+	BFS_COST_REGEX,
+	/** Actions that print something. */
+	BFS_COST_PRINT,
+	/** The number of cost classes. */
+	BFS_COSTS,
+};
+
+/**
+ * Get the name of a cost class, as used in cost tables.
+ */
+const char *bfs_cost_name(enum bfs_cost cost);
+
+/**
+ * Initialize a cost table with the built-in estimates.
+ *
+ * @param[out] costs
+ *         The cost of each class, in nanoseconds per evaluation.
+ */
+void bfs_costs_init(float costs[BFS_COSTS]);
+
+/**
+ * Load a cost table from a file.  Each line holds a class name and its cost:
+ *
+ *     fnmatch 412.5
+ *
+ * Blank lines and lines starting with '#' are ignored, and classes that aren't
+ * mentioned keep their current cost.
+ *
+ * @param[in,out] costs
+ *         The cost table to update.
+ * @param path
+ *         The path to the cost table.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_costs_load(float costs[BFS_COSTS], const char *path);
+
+/**
+ * Measurements of the real costs of each class.
+ */
+struct bfs_calibration;
+
+/**
+ * Start calibrating costs.
+ *
+ * @return
+ *         The new calibration state, or NULL on failure.
+ */
+struct bfs_calibration *bfs_calibration_new(void);
+
+/**
+ * Measure the costs of each class on one file.
+ *
+ * @param cal
+ *         The calibration state.
+ * @param ftwbuf
+ *         The file to sample.
+ * @return
+ *         Whether enough files have been sampled.
+ */
+bool bfs_calibrate(struct bfs_calibration *cal, const struct BFTW *ftwbuf);
+
+/**
+ * Save the measured costs to a file, in the format read by bfs_costs_load().
+ *
+ * @param cal
+ *         The calibration state.
+ * @param path
+ *         The path to the cost table.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_calibration_save(const struct bfs_calibration *cal, const char *path);
+
+/**
+ * Free the calibration state.
+ */
+void bfs_calibration_free(struct bfs_calibration *cal);
+
+#endif // BFS_COST_H
@@ -5,18 +5,27 @@
 
 #include "alloc.h"
 #include "bfstd.h"
+#include "cgroup.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "cost.h"
 #include "diag.h"
+#include "dlog.h"
 #include "expr.h"
+#include "index.h"
 #include "list.h"
 #include "mtab.h"
+#include "pathmatch.h"
+#include "profile.h"
 #include "pwcache.h"
 #include "sighook.h"
 #include "stat.h"
+#include "trace.h"
 #include "trie.h"
 
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,10 +33,30 @@
 #include <time.h>
 #include <unistd.h>
 
+#if BFS_HAS_PTHREAD_SETAFFINITY_NP
+#  include <sched.h>
+#endif
+
 /** Get the initial value for ctx->threads (-j). */
-static int bfs_nproc(void) {
+static int bfs_nproc(const struct bfs_cgroup_limits *limits) {
 	long nproc = xsysconf(_SC_NPROCESSORS_ONLN);
 
+#if BFS_HAS_PTHREAD_SETAFFINITY_NP
+	// Don't count CPUs we can't run on (taskset, cpuset cgroups, etc.)
+	cpu_set_t cpus;
+	if (pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0) {
+		long count = CPU_COUNT(&cpus);
+		if (count > 0 && (nproc < 1 || count < nproc)) {
+			nproc = count;
+		}
+	}
+#endif
+
+	// A CPU quota gets throttled if we use more than it allows
+	if (limits->cpus > 0 && (nproc < 1 || limits->cpus < nproc)) {
+		nproc = limits->cpus;
+	}
+
 	if (nproc < 1) {
 		nproc = 1;
 	} else if (nproc > 8) {
@@ -50,8 +79,27 @@ struct bfs_ctx *bfs_ctx_new(void) {
 	ctx->maxdepth = INT_MAX;
 	ctx->flags = BFTW_RECOVER;
 	ctx->strategy = BFTW_BFS;
-	ctx->threads = bfs_nproc();
+
+	struct bfs_cgroup_limits limits;
+	bfs_cgroup_limits(&limits);
+	ctx->threads = bfs_nproc(&limits);
+	ctx->compress_level = -1;
+	ctx->memory_limit = limits.memory;
+
+	ctx->exec_jobs = 1;
+	// A million buffered files is a few hundred MiB
+	ctx->sort_limit = 1 << 20;
+	if (ctx->memory_limit && ctx->sort_limit > ctx->memory_limit / 1024) {
+		// Use at most about a quarter of a cgroup's memory limit
+		ctx->sort_limit = ctx->memory_limit / 1024;
+	}
+	ctx->shard_depth = 1;
+	ctx->checkpoint_interval = 60;
+	ctx->index_fields = BFS_STAT_ALL;
 	ctx->optlevel = 3;
+	ctx->stat_mask = BFS_STAT_ALL;
+	ctx->file_types = true;
+	bfs_costs_init(ctx->costs);
 
 	trie_init(&ctx->files);
 
@@ -85,11 +133,37 @@ fail:
 	return NULL;
 }
 
+const struct colors *bfs_ctx_colors(const struct bfs_ctx *ctx) {
+	struct bfs_ctx *mut = (struct bfs_ctx *)ctx;
+
+	if (mut->colors_error) {
+		errno = mut->colors_error;
+	} else if (!mut->colors) {
+		mut->colors = parse_colors();
+		if (!mut->colors) {
+			mut->colors_error = errno;
+		}
+	}
+
+	return mut->colors;
+}
+
+/** A mount table waiting to be used, from bfs_ctx_warm_mtab(). */
+static struct bfs_mtab *warm_mtab = NULL;
+
+void bfs_ctx_warm_mtab(struct bfs_mtab *mtab) {
+	bfs_mtab_free(warm_mtab);
+	warm_mtab = mtab;
+}
+
 const struct bfs_mtab *bfs_ctx_mtab(const struct bfs_ctx *ctx) {
 	struct bfs_ctx *mut = (struct bfs_ctx *)ctx;
 
 	if (mut->mtab_error) {
 		errno = mut->mtab_error;
+	} else if (!mut->mtab && warm_mtab) {
+		mut->mtab = warm_mtab;
+		warm_mtab = NULL;
 	} else if (!mut->mtab) {
 		mut->mtab = bfs_mtab_parse();
 		if (!mut->mtab) {
@@ -168,6 +242,28 @@ fail:
 	return NULL;
 }
 
+int bfs_ctx_compress(struct bfs_ctx *ctx) {
+	for_trie (leaf, &ctx->files) {
+		struct bfs_ctx_file *ctx_file = leaf->value;
+		CFILE *cfile = ctx_file->cfile;
+		if (cfile == ctx->cerr || isatty(cfile->fd)) {
+			continue;
+		}
+
+		if (cfcompress(cfile, ctx->compress_level, ctx->threads) != 0) {
+			const char *path = ctx_file->path;
+			if (path) {
+				bfs_error(ctx, "${blu}-compress${rs} %pq: %s.\n", path, errstr());
+			} else {
+				bfs_error(ctx, "${blu}-compress${rs} (standard output): %s.\n", errstr());
+			}
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 void bfs_ctx_flush(const struct bfs_ctx *ctx) {
 	// Before executing anything, flush all open streams.  This ensures that
 	// - the user sees everything relevant before an -ok[dir] prompt
@@ -176,7 +272,7 @@ void bfs_ctx_flush(const struct bfs_ctx *ctx) {
 	for_trie (leaf, &ctx->files) {
 		struct bfs_ctx_file *ctx_file = leaf->value;
 		CFILE *cfile = ctx_file->cfile;
-		if (fflush(cfile->file) == 0) {
+		if (cfflush(cfile) == 0) {
 			continue;
 		}
 
@@ -204,7 +300,7 @@ static int bfs_ctx_fflush(CFILE *cfile) {
 		ret = -1;
 		error = EIO;
 	}
-	if (fflush(cfile->file) != 0) {
+	if (cfflush(cfile) != 0) {
 		ret = -1;
 		error = errno;
 	}
@@ -273,6 +369,11 @@ int bfs_ctx_free(struct bfs_ctx *ctx) {
 		bfs_groups_free(ctx->groups);
 		bfs_users_free(ctx->users);
 
+		bfs_profile_free(ctx->profile);
+		bfs_checkpoint_free(ctx->resume);
+		bfs_index_free(ctx->index);
+		bfs_pathmatch_free(ctx->pathmatch);
+
 		for_trie (leaf, &ctx->files) {
 			struct bfs_ctx_file *ctx_file = leaf->value;
 			if (bfs_ctx_fclose(ctx, ctx_file) != 0) {
@@ -282,6 +383,18 @@ int bfs_ctx_free(struct bfs_ctx *ctx) {
 		trie_destroy(&ctx->files);
 
 		cfclose(cout);
+
+		// Close the trace after cout, so its background writer is done
+		if (ctx->trace && bfs_trace_close() != 0) {
+			bfs_error(ctx, "${blu}-trace${rs} %pq: %s.\n", ctx->trace, errstr());
+			ret = -1;
+		}
+
+		if (ctx->debug_log && bfs_dlog_close() != 0) {
+			bfs_error(ctx, "${blu}-debug-log${rs} %pq: %s.\n", ctx->debug_log, errstr());
+			ret = -1;
+		}
+
 		cfclose(cerr);
 		free_colors(ctx->colors);
 
@@ -294,6 +407,23 @@ int bfs_ctx_free(struct bfs_ctx *ctx) {
 			free((char *)ctx->paths[i]);
 		}
 		free(ctx->paths);
+		if (ctx->files0 && ctx->files0 != stdin) {
+			fclose(ctx->files0);
+		}
+
+		for (size_t i = 0; i < ctx->nfslimits; ++i) {
+			free((char *)ctx->fslimits[i].type);
+		}
+		free(ctx->fslimits);
+
+		for (size_t i = 0; i < ctx->nstat_cache; ++i) {
+			free(ctx->stat_cache[i]);
+		}
+		free(ctx->stat_cache);
+		free(ctx->prefixes);
+		free(ctx->stat_guards);
+		free(ctx->goals);
+		free(ctx->prunes);
 
 		free(ctx->argv);
 		free(ctx);
@@ -10,17 +10,67 @@
 
 #include "alloc.h"
 #include "bftw.h"
+#include "cost.h"
 #include "diag.h"
 #include "expr.h"
 #include "trie.h"
 
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <time.h>
 
 struct CFILE;
 
+/**
+ * A literal prefix that every interesting path must be compatible with.
+ */
+struct bfs_prefix {
+	/** The prefix itself (not necessarily NUL-terminated). */
+	const char *str;
+	/** The length of the prefix. */
+	size_t len;
+	/** Whether to compare ASCII letters case-insensitively. */
+	bool casefold;
+};
+
+/**
+ * A literal that -S best searches towards.
+ */
+struct bfs_goal {
+	/** The literal itself (not necessarily NUL-terminated). */
+	const char *str;
+	/** The length of the literal. */
+	size_t len;
+	/** Whether this is a path prefix, rather than part of a file name. */
+	bool path;
+	/** Whether to compare ASCII letters case-insensitively. */
+	bool casefold;
+};
+
+/**
+ * How errors are reported (-errors).
+ */
+enum bfs_errors {
+	/** Write each error as soon as it happens. */
+	BFS_ERRORS_EACH,
+	/** Buffer error messages before writing them. */
+	BFS_ERRORS_BUFFERED,
+	/** Count traversal errors by subtree and errno, and report them at the end. */
+	BFS_ERRORS_SUMMARY,
+};
+
+/**
+ * How output files are compressed (-compress).
+ */
+enum bfs_compress {
+	/** Write output uncompressed. */
+	BFS_COMPRESS_NONE,
+	/** Compress output with gzip. */
+	BFS_COMPRESS_GZIP,
+};
+
 /**
  * The execution context for bfs.
  */
@@ -34,11 +84,23 @@ struct bfs_ctx {
 	const char **paths;
 	/** The number of root paths. */
 	size_t npaths;
+	/** A -files0-from input whose paths are streamed during the search, if any. */
+	FILE *files0;
 
 	/** The main command line expression. */
 	struct bfs_expr *expr;
 	/** An expression for files to filter out. */
 	struct bfs_expr *exclude;
+	/** Whether the exclusions only look at names, depths, and types. */
+	bool exclude_names;
+	/** Name-only tests at the start of the expression that just -prune. */
+	struct bfs_expr **prunes;
+	/** The number of name-only prunes. */
+	size_t nprunes;
+	/** Whether the exclusions or prunes look at file types. */
+	bool filter_types;
+	/** Whether the expressions might look at the types of non-directories. */
+	bool file_types;
 	/** A list of allocated expressions. */
 	struct bfs_exprs expr_list;
 	/** bfs_expr arena. */
@@ -48,6 +110,28 @@ struct bfs_ctx {
 	int mindepth;
 	/** -maxdepth option. */
 	int maxdepth;
+	/** Path prefixes that limit which directories are worth descending into. */
+	struct bfs_prefix *prefixes;
+	/** The number of prefixes (0 for no limit). */
+	size_t nprefixes;
+	/** Name tests that a file must pass to need stat(), for prefetching. */
+	const struct bfs_expr **stat_guards;
+	/** The number of stat_guards (0 for no hint). */
+	size_t nstat_guards;
+	/** Directories modified before this can't hold matching non-directories (BFTW_SKIP_STALE). */
+	struct timespec stale_time;
+	/** The literals that -S best searches towards. */
+	struct bfs_goal *goals;
+	/** The number of goals. */
+	size_t ngoals;
+	/** The -path patterns that are matched incrementally, if any. */
+	struct bfs_pathmatch *pathmatch;
+	/** -shard K/N: the index of this shard, from 0 to N - 1. */
+	size_t shard;
+	/** -shard K/N: the number of shards (0 for no sharding). */
+	size_t shards;
+	/** -shard-depth: the depth at which the tree is partitioned. */
+	size_t shard_depth;
 
 	/** bftw() flags. */
 	enum bftw_flags flags;
@@ -56,18 +140,70 @@ struct bfs_ctx {
 
 	/** Threads (-j). */
 	int threads;
+	/** Whether to tune the number of threads at runtime (-jauto). */
+	bool auto_threads;
+	/** Per-file-system I/O limits (-j TYPE=N). */
+	struct bftw_fslimit *fslimits;
+	/** The number of fslimits. */
+	size_t nfslimits;
+	/** The maximum number of I/O operations per second (-io-rate). */
+	size_t io_rate;
+	/** The maximum number of concurrent I/O operations (-io-depth). */
+	size_t io_depth;
+	/** Whether to use the idle I/O scheduling class (-io-idle). */
+	bool io_idle;
+	/** The number of seconds before background I/O times out (-io-timeout). */
+	int io_timeout;
+	/** File system types whose cached attributes are fresh enough (-stat-cache). */
+	char **stat_cache;
+	/** The number of stat_cache types. */
+	size_t nstat_cache;
+	/** The maximum number of -exec ... + commands to run at once (-exec-jobs). */
+	int exec_jobs;
+	/** Whether to capture the output of concurrent -exec commands (-exec-capture). */
+	bool exec_capture;
+	/** The maximum number of files to sort in memory at once (-sort-limit). */
+	size_t sort_limit;
+	/** The most memory to use for directory buffers (-dir-memory). */
+	size_t dir_memory;
+	/** The memory limit of our cgroup, in bytes (0 for no limit). */
+	size_t memory_limit;
 	/** Optimization level (-O). */
 	int optlevel;
+	/** The bfs_stat() fields that the expression uses. */
+	enum bfs_stat_field stat_mask;
+	/** The fsade checks to do ahead of time. */
+	enum bfs_fsade_check fsade_checks;
+	/** The xattr name for BFS_CHECK_XATTR_NAMED. */
+	const char *fsade_xattr;
+	/** The hash algorithm for BFS_CHECK_HASH. */
+	enum bfs_hash_algo fsade_hash;
+	/** The content search for BFS_CHECK_GREP. */
+	const struct bfs_grep *fsade_grep;
 	/** Debugging flags (-D). */
 	enum debug_flags debug;
 	/** Whether to ignore deletions that race with bfs (-ignore_readdir_race). */
 	bool ignore_races;
 	/** Whether to follow POSIXisms more closely ($POSIXLY_CORRECT). */
 	bool posixly_correct;
+	/** Whether to evaluate the expression on multiple threads (-parallel). */
+	bool parallel;
+	/** Whether to keep the serial output order with -parallel (-ordered). */
+	bool ordered;
 	/** Whether to show a status bar (-status). */
 	bool status;
 	/** Whether to only return unique files (-unique). */
 	bool unique;
+	/** Whether to skip overlapping roots and duplicate mounts (-dedup). */
+	bool dedup;
+	/** Whether files are only ever added to the tree, never modified (-append-only). */
+	bool append_only;
+	/** Whether to prune files matched by .gitignore/.ignore files (-gitignore). */
+	bool gitignore;
+	/** Whether to accumulate per-directory disk usage (-du). */
+	bool du;
+	/** Whether to keep watching for new files after the search (-watch). */
+	bool watch;
 	/** Whether to only handle paths with xargs-safe characters (-X). */
 	bool xargs_safe;
 
@@ -77,10 +213,23 @@ struct bfs_ctx {
 	bool warn;
 	/** Whether to report errors (-noerror). */
 	bool ignore_errors;
+	/** How to report errors (-errors). */
+	enum bfs_errors errors;
+	/** How to compress output files (-compress). */
+	enum bfs_compress compress;
+	/** The compression level, or -1 for the default. */
+	int compress_level;
 	/** Whether any dangerous actions (-delete/-exec) are present. */
 	bool dangerous;
+	/** Whether the expression may modify the tree itself (-delete/-exec/-ok). */
+	bool mutates;
 
-	/** Color data. */
+	/** A callback for the files that match, instead of the implicit -print. */
+	bftw_callback *visit;
+	/** The argument to pass to the visit callback. */
+	void *visit_ptr;
+
+	/** Color data, parsed on first use. */
 	struct colors *colors;
 	/** The error that occurred parsing the color table, if any. */
 	int colors_error;
@@ -89,6 +238,45 @@ struct bfs_ctx {
 	/** Colored stderr. */
 	struct CFILE *cerr;
 
+	/** The estimated cost of each class of primaries (-load-costs). */
+	float costs[BFS_COSTS];
+	/** The socket to serve searches on (-serve). */
+	const char *serve;
+	/** Where to save measured cost estimates (-calibrate). */
+	const char *calibrate;
+
+	/** Measurements to use for optimization (-load-profile). */
+	struct bfs_profile *profile;
+	/** Where to save new measurements (-save-profile). */
+	const char *save_profile;
+	/** Time only one evaluation in this many (-profile-sample). */
+	size_t profile_sample;
+	/** Where to write a timeline trace (-trace). */
+	const char *trace;
+	/** Where to write the recorded debug messages (-debug-log). */
+	const char *debug_log;
+
+	/** Where to periodically save the search state (-checkpoint). */
+	const char *checkpoint;
+	/** How often to save the search state, in seconds (-checkpoint-interval). */
+	int checkpoint_interval;
+	/** The saved search state to continue from (-resume). */
+	struct bfs_checkpoint *resume;
+
+	/** The index to search instead of the filesystem (-index). */
+	struct bfs_index *index;
+	/** The path to that index. */
+	const char *index_path;
+	/** Whether to refresh the index before searching it (-update-index). */
+	bool update_index;
+	/** Where to save a new index (-save-index). */
+	const char *save_index;
+	/** The bfs_stat() fields to save in the index (-index-fields). */
+	enum bfs_stat_field index_fields;
+
+	/** The snapshot to search for changes since (-changed-since). */
+	const char *changed_since;
+
 	/** User cache. */
 	struct bfs_users *users;
 	/** Group table. */
@@ -96,11 +284,16 @@ struct bfs_ctx {
 	/** The error that occurred parsing the group table, if any. */
 	int groups_error;
 
-	/** Table of mounted file systems. */
+	/** Table of mounted file systems, parsed on first use. */
 	struct bfs_mtab *mtab;
 	/** The error that occurred parsing the mount table, if any. */
 	int mtab_error;
 
+	/** The largest command line size exec() has accepted, for -exec ... +. */
+	size_t exec_arg_min;
+	/** The smallest command line size exec() has rejected with E2BIG, or 0. */
+	size_t exec_arg_max;
+
 	/** All the files owned by the context. */
 	struct trie files;
 	/** The number of files owned by the context. */
@@ -126,6 +319,16 @@ struct bfs_ctx {
  */
 struct bfs_ctx *bfs_ctx_new(void);
 
+/**
+ * Get the color table.
+ *
+ * @param ctx
+ *         The bfs context.
+ * @return
+ *         The cached color table, or NULL on failure.
+ */
+const struct colors *bfs_ctx_colors(const struct bfs_ctx *ctx);
+
 /**
  * Get the mount table.
  *
@@ -136,6 +339,15 @@ struct bfs_ctx *bfs_ctx_new(void);
  */
 const struct bfs_mtab *bfs_ctx_mtab(const struct bfs_ctx *ctx);
 
+/**
+ * Use an already-parsed mount table (e.g. from a -serve process) for the next
+ * context that needs one, instead of parsing it again.
+ *
+ * @param mtab
+ *         The mount table, which will be owned by that context.
+ */
+void bfs_ctx_warm_mtab(struct bfs_mtab *mtab);
+
 /**
  * Deduplicate an opened file.
  *
@@ -151,6 +363,17 @@ const struct bfs_mtab *bfs_ctx_mtab(const struct bfs_ctx *ctx);
  */
 struct CFILE *bfs_ctx_dedup(struct bfs_ctx *ctx, struct CFILE *cfile, const char *path);
 
+/**
+ * Compress the output files (-compress).  Terminals and standard error are
+ * left alone.
+ *
+ * @param ctx
+ *         The bfs context.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_ctx_compress(struct bfs_ctx *ctx);
+
 /**
  * Flush any caches for consistency with external processes.
  *
@@ -46,8 +46,12 @@ const char *debug_flag_name(enum debug_flags flag) {
 		return "cost";
 	case DEBUG_EXEC:
 		return "exec";
+	case DEBUG_MEM:
+		return "mem";
 	case DEBUG_OPT:
 		return "opt";
+	case DEBUG_PERF:
+		return "perf";
 	case DEBUG_RATES:
 		return "rates";
 	case DEBUG_SEARCH:
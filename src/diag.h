@@ -137,18 +137,22 @@ enum debug_flags {
 	DEBUG_COST   = 1 << 0,
 	/** Print executed command details. */
 	DEBUG_EXEC   = 1 << 1,
+	/** Print memory usage. */
+	DEBUG_MEM    = 1 << 2,
 	/** Print optimization details. */
-	DEBUG_OPT    = 1 << 2,
+	DEBUG_OPT    = 1 << 3,
+	/** Print system call counters. */
+	DEBUG_PERF   = 1 << 4,
 	/** Print rate information. */
-	DEBUG_RATES  = 1 << 3,
+	DEBUG_RATES  = 1 << 5,
 	/** Trace the filesystem traversal. */
-	DEBUG_SEARCH = 1 << 4,
+	DEBUG_SEARCH = 1 << 6,
 	/** Trace all stat() calls. */
-	DEBUG_STAT   = 1 << 5,
+	DEBUG_STAT   = 1 << 7,
 	/** Print the parse tree. */
-	DEBUG_TREE   = 1 << 6,
+	DEBUG_TREE   = 1 << 8,
 	/** All debug flags. */
-	DEBUG_ALL    = (1 << 7) - 1,
+	DEBUG_ALL    = (1 << 9) - 1,
 };
 
 /**
@@ -4,20 +4,34 @@
 #include "dir.h"
 
 #include "alloc.h"
+#include "atomic.h"
 #include "bfs.h"
 #include "bfstd.h"
 #include "diag.h"
+#include "perf.h"
 #include "sanity.h"
-#include "trie.h"
+#include "stat.h"
 
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if BFS_HAS_OPENAT2_SYSCALL
+#  include <linux/openat2.h>
+#  include <sys/syscall.h>
+#endif
+
+#if BFS_USE_GETATTRLISTBULK
+#  include <sys/attr.h>
+#  include <sys/vnode.h>
+#endif
+
 #if BFS_USE_GETDENTS
 #  if BFS_HAS_GETDENTS64_SYSCALL
 #    include <sys/syscall.h>
@@ -26,6 +40,7 @@
 /** getdents() syscall wrapper. */
 static ssize_t bfs_getdents(int fd, void *buf, size_t size) {
 	sanitize_uninit(buf, size);
+	uint64_t start = bfs_perf_start();
 
 #if BFS_HAS_POSIX_GETDENTS
 	int flags = 0;
@@ -43,6 +58,7 @@ static ssize_t bfs_getdents(int fd, void *buf, size_t size) {
 #  error "No getdents() implementation"
 #endif
 
+	bfs_perf_end(BFS_PERF_GETDENTS, start, ret > 0 ? ret : 0);
 	if (ret > 0) {
 		sanitize_init(buf, ret);
 	}
@@ -52,6 +68,38 @@ static ssize_t bfs_getdents(int fd, void *buf, size_t size) {
 
 #endif // BFS_USE_GETDENTS
 
+#if BFS_USE_GETATTRLISTBULK
+
+/** The attributes to request from getattrlistbulk(). */
+static struct attrlist bfs_bulk_attrs = {
+	.bitmapcount = ATTR_BIT_MAP_COUNT,
+	.commonattr = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_NAME | ATTR_CMN_DEVID
+		| ATTR_CMN_OBJTYPE | ATTR_CMN_CRTIME | ATTR_CMN_MODTIME | ATTR_CMN_CHGTIME
+		| ATTR_CMN_ACCTIME | ATTR_CMN_OWNERID | ATTR_CMN_GRPID | ATTR_CMN_ACCESSMASK
+		| ATTR_CMN_FLAGS | ATTR_CMN_FILEID | ATTR_CMN_ERROR,
+	.dirattr = ATTR_DIR_MOUNTSTATUS,
+	.fileattr = ATTR_FILE_LINKCOUNT | ATTR_FILE_TOTALSIZE | ATTR_FILE_ALLOCSIZE
+		| ATTR_FILE_DEVTYPE,
+};
+
+/** getattrlistbulk() wrapper. */
+static int bfs_getattrlistbulk(int fd, void *buf, size_t size) {
+	sanitize_uninit(buf, size);
+	uint64_t start = bfs_perf_start();
+
+	// Pack invalid attributes too, so every record has the same layout
+	int ret = getattrlistbulk(fd, &bfs_bulk_attrs, buf, size, FSOPT_PACK_INVAL_ATTRS);
+
+	bfs_perf_end(BFS_PERF_GETDENTS, start, 0);
+	if (ret > 0) {
+		sanitize_init(buf, size);
+	}
+
+	return ret;
+}
+
+#endif // BFS_USE_GETATTRLISTBULK
+
 /** Directory entry type for bfs_getdents() */
 #if !BFS_USE_GETDENTS || BFS_HAS_GETDENTS
 typedef struct dirent sys_dirent;
@@ -117,8 +165,152 @@ enum {
 	BFS_DIR_EOF   = BFS_DIR_PRIVATE << 0,
 	/** This directory is a union mount we need to dedup manually. */
 	BFS_DIR_UNION = BFS_DIR_PRIVATE << 1,
+	/** A read-ahead is in flight. */
+	BFS_DIR_AHEAD = BFS_DIR_PRIVATE << 2,
+};
+
+#if BFS_USE_GETDENTS && __FreeBSD__
+
+/**
+ * A slot in a union mount's name set.
+ */
+struct bfs_union_slot {
+	/** The hash of the name. */
+	uint32_t hash;
+	/** The offset of the name in bfs_union::names, plus one (0 if empty). */
+	uint32_t offset;
 };
 
+/**
+ * The names seen so far in a union mount.  The getdents() buffer is reused
+ * for each read, so names are copied into a single string table, which is
+ * much cheaper than a trie node per entry.
+ */
+struct bfs_union {
+	/** The open-addressed hash table. */
+	struct bfs_union_slot *table;
+	/** The capacity of the table (a power of two, or zero). */
+	size_t capacity;
+	/** The number of names in the table. */
+	size_t count;
+	/** The NUL-terminated names, back to back. */
+	char *names;
+	/** The length of the names. */
+	size_t len;
+	/** The capacity of the names. */
+	size_t size;
+};
+
+/** Hash a name (FNV-1a). */
+static uint32_t bfs_union_hash(const char *name, size_t len) {
+	uint32_t hash = 0x811C9DC5;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)name[i];
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+/** Find the slot for a name, or the empty slot where it would go. */
+static struct bfs_union_slot *bfs_union_find(const struct bfs_union *set, const char *name, size_t len, uint32_t hash) {
+	size_t mask = set->capacity - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct bfs_union_slot *slot = &set->table[i];
+		if (slot->offset == 0) {
+			return slot;
+		}
+
+		const char *str = set->names + slot->offset - 1;
+		if (slot->hash == hash && memcmp(str, name, len + 1) == 0) {
+			return slot;
+		}
+	}
+}
+
+/** Grow the hash table. */
+static int bfs_union_grow(struct bfs_union *set) {
+	size_t capacity = set->capacity ? 2 * set->capacity : 64;
+	struct bfs_union_slot *table = ZALLOC_ARRAY(struct bfs_union_slot, capacity);
+	if (!table) {
+		return -1;
+	}
+
+	size_t mask = capacity - 1;
+	for (size_t i = 0; i < set->capacity; ++i) {
+		struct bfs_union_slot *old = &set->table[i];
+		if (old->offset == 0) {
+			continue;
+		}
+
+		size_t j = old->hash & mask;
+		while (table[j].offset != 0) {
+			j = (j + 1) & mask;
+		}
+		table[j] = *old;
+	}
+
+	free(set->table);
+	set->table = table;
+	set->capacity = capacity;
+	return 0;
+}
+
+/**
+ * Add a name to the set.
+ *
+ * @return
+ *         1 if the name was added, 0 if it was already there, or -1 on failure.
+ */
+static int bfs_union_insert(struct bfs_union *set, const char *name, size_t len) {
+	// Keep the load factor below 3/4
+	if (4 * (set->count + 1) > 3 * set->capacity) {
+		if (bfs_union_grow(set) != 0) {
+			return -1;
+		}
+	}
+
+	uint32_t hash = bfs_union_hash(name, len);
+	struct bfs_union_slot *slot = bfs_union_find(set, name, len, hash);
+	if (slot->offset != 0) {
+		return 0;
+	}
+
+	size_t end = set->len + len + 1;
+	if (end >= UINT32_MAX) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	if (end > set->size) {
+		size_t size = set->size ? set->size : 4096;
+		while (size < end) {
+			size *= 2;
+		}
+
+		char *names = REALLOC_ARRAY(char, set->names, set->size, size);
+		if (!names) {
+			return -1;
+		}
+		set->names = names;
+		set->size = size;
+	}
+
+	memcpy(set->names + set->len, name, len + 1);
+	slot->hash = hash;
+	slot->offset = set->len + 1;
+	set->len = end;
+	++set->count;
+	return 1;
+}
+
+/** Free a union name set. */
+static void bfs_union_destroy(struct bfs_union *set) {
+	free(set->names);
+	free(set->table);
+}
+
+#endif // BFS_USE_GETDENTS && __FreeBSD__
+
 struct bfs_dir {
 	unsigned int flags;
 
@@ -126,19 +318,44 @@ struct bfs_dir {
 	int fd;
 	unsigned short pos;
 	unsigned short size;
+	unsigned short bufsize;
+	/** The number of bytes waiting in the read-ahead buffer. */
+	unsigned short ahead_size;
+	/** The buffer currently being read (either buf or ahead). */
+	char *cur;
+	/** The other buffer, for reading ahead (allocated on demand). */
+	char *ahead;
 #  if __FreeBSD__
-	struct trie trie;
+	/** The names seen so far, for BFS_DIR_UNION. */
+	struct bfs_union names;
 #  endif
 	alignas(sys_dirent) char buf[];
+#elif BFS_USE_GETATTRLISTBULK
+	int fd;
+	/** The number of entries left in the buffer. */
+	unsigned int count;
+	/** The offset of the next entry in the buffer. */
+	size_t pos;
+	/** The attributes of the last returned entry. */
+	struct bfs_stat stat;
+	alignas(uint64_t) char buf[];
 #else
 	DIR *dir;
 	struct dirent *de;
 #endif
 };
 
-#if BFS_USE_GETDENTS
+#if BFS_USE_GETDENTS || BFS_USE_GETATTRLISTBULK
 #  define DIR_SIZE (64 << 10)
 #  define BUF_SIZE (DIR_SIZE - sizeof(struct bfs_dir))
+// Start with a small buffer, so that small directories only touch a page or so
+// of their allocation.  Some systems require the getdents() buffer to be at
+// least as big as the file system block size, so only do this on Linux.
+#  if __linux__
+#    define BUF_MIN ((4 << 10) - sizeof(struct bfs_dir))
+#  else
+#    define BUF_MIN BUF_SIZE
+#  endif
 #else
 #  define DIR_SIZE sizeof(struct bfs_dir)
 #endif
@@ -148,13 +365,60 @@ struct bfs_dir *bfs_allocdir(void) {
 }
 
 void bfs_dir_arena(struct arena *arena) {
-	arena_init(arena, alignof(struct bfs_dir), DIR_SIZE);
+	arena_init(arena, alignof(struct bfs_dir), DIR_SIZE, "struct bfs_dir");
+}
+
+#if BFS_HAS_OPENAT2_SYSCALL
+/** openat2() wrapper. */
+static int bfs_openat2(int at_fd, const char *at_path, int oflags, enum bfs_dir_flags flags) {
+	struct open_how how = {
+		.flags = oflags,
+	};
+	if (flags & BFS_DIR_NOFOLLOW) {
+		how.resolve |= RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+	}
+	if (flags & BFS_DIR_NOXDEV) {
+		how.resolve |= RESOLVE_NO_XDEV;
+	}
+
+	return syscall(SYS_openat2, at_fd, at_path, &how, sizeof(how));
+}
+#endif
+
+int bfs_opendirfd(int at_fd, const char *at_path, enum bfs_dir_flags flags) {
+	int oflags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
+	uint64_t start = bfs_perf_start();
+	int fd;
+
+#if BFS_HAS_OPENAT2_SYSCALL
+	static atomic bool has_openat2 = true;
+
+	if ((flags & (BFS_DIR_NOFOLLOW | BFS_DIR_NOXDEV)) && load(&has_openat2, relaxed)) {
+		fd = bfs_openat2(at_fd, at_path, oflags, flags);
+		if (fd < 0 && errno_is_like(ENOSYS)) {
+			store(&has_openat2, false, relaxed);
+		} else {
+			goto done;
+		}
+	}
+#endif
+
+	if (flags & BFS_DIR_NOFOLLOW) {
+		oflags |= O_NOFOLLOW;
+	}
+	fd = openat(at_fd, at_path, oflags);
+
+#if BFS_HAS_OPENAT2_SYSCALL
+done:
+#endif
+	bfs_perf_end(BFS_PERF_OPENAT, start, 0);
+	return fd;
 }
 
 int bfs_opendir(struct bfs_dir *dir, int at_fd, const char *at_path, enum bfs_dir_flags flags) {
 	int fd;
 	if (at_path) {
-		fd = openat(at_fd, at_path, O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+		fd = bfs_opendirfd(at_fd, at_path, flags);
 		if (fd < 0) {
 			return -1;
 		}
@@ -171,14 +435,22 @@ int bfs_opendir(struct bfs_dir *dir, int at_fd, const char *at_path, enum bfs_di
 	dir->fd = fd;
 	dir->pos = 0;
 	dir->size = 0;
+	dir->bufsize = (flags & BFS_DIR_LARGE) ? BUF_SIZE : BUF_MIN;
+	dir->ahead_size = 0;
+	dir->cur = dir->buf;
+	dir->ahead = NULL;
 
 #  if __FreeBSD__ && defined(F_ISUNIONSTACK)
 	if (fcntl(fd, F_ISUNIONSTACK) > 0) {
 		dir->flags |= BFS_DIR_UNION;
-		trie_init(&dir->trie);
+		dir->names = (struct bfs_union){0};
 	}
 #  endif
-#else // !BFS_USE_GETDENTS
+#elif BFS_USE_GETATTRLISTBULK
+	dir->fd = fd;
+	dir->count = 0;
+	dir->pos = 0;
+#else
 	dir->dir = fdopendir(fd);
 	if (!dir->dir) {
 		if (at_path) {
@@ -193,7 +465,7 @@ int bfs_opendir(struct bfs_dir *dir, int at_fd, const char *at_path, enum bfs_di
 }
 
 int bfs_dirfd(const struct bfs_dir *dir) {
-#if BFS_USE_GETDENTS
+#if BFS_USE_GETDENTS || BFS_USE_GETATTRLISTBULK
 	return dir->fd;
 #else
 	return dirfd(dir->dir);
@@ -204,12 +476,26 @@ int bfs_polldir(struct bfs_dir *dir) {
 #if BFS_USE_GETDENTS
 	if (dir->pos < dir->size) {
 		return 1;
+	} else if (dir->ahead_size > 0) {
+		// Switch to the chunk that was read ahead
+		char *buf = dir->cur;
+		dir->cur = dir->ahead;
+		dir->ahead = buf;
+		dir->pos = 0;
+		dir->size = dir->ahead_size;
+		dir->ahead_size = 0;
+		return 1;
+	} else if (dir->flags & BFS_DIR_AHEAD) {
+		// The next chunk is still on its way
+		errno = EAGAIN;
+		return -1;
 	} else if (dir->flags & BFS_DIR_EOF) {
 		return 0;
 	}
 
-	char *buf = (char *)(dir + 1);
-	ssize_t size = bfs_getdents(dir->fd, buf, BUF_SIZE);
+	char *buf = dir->cur;
+	size_t bufsize = dir->bufsize;
+	ssize_t size = bfs_getdents(dir->fd, buf, bufsize);
 	if (size == 0) {
 		dir->flags |= BFS_DIR_EOF;
 		return 0;
@@ -222,7 +508,7 @@ int bfs_polldir(struct bfs_dir *dir) {
 
 	// Like read(), getdents() doesn't indicate EOF until another call returns zero.
 	// Check that eagerly here to hopefully avoid a syscall in the last bfs_readdir().
-	size_t rest = BUF_SIZE - size;
+	size_t rest = bufsize - size;
 	if (rest >= sizeof(sys_dirent)) {
 		size = bfs_getdents(dir->fd, buf + size, rest);
 		if (size > 0) {
@@ -232,8 +518,31 @@ int bfs_polldir(struct bfs_dir *dir) {
 		}
 	}
 
+	// If it didn't all fit, use the whole buffer from now on
+	if (!(dir->flags & BFS_DIR_EOF)) {
+		dir->bufsize = BUF_SIZE;
+	}
+
 	return 1;
-#else // !BFS_USE_GETDENTS
+#elif BFS_USE_GETATTRLISTBULK
+	if (dir->count > 0) {
+		return 1;
+	} else if (dir->flags & BFS_DIR_EOF) {
+		return 0;
+	}
+
+	int count = bfs_getattrlistbulk(dir->fd, dir->buf, BUF_SIZE);
+	if (count == 0) {
+		dir->flags |= BFS_DIR_EOF;
+		return 0;
+	} else if (count < 0) {
+		return -1;
+	}
+
+	dir->count = count;
+	dir->pos = 0;
+	return 1;
+#else
 	if (dir->de) {
 		return 1;
 	} else if (dir->flags & BFS_DIR_EOF) {
@@ -253,13 +562,259 @@ int bfs_polldir(struct bfs_dir *dir) {
 #endif
 }
 
+#if BFS_USE_GETDENTS
+
+size_t bfs_dirbuf(struct bfs_dir *dir, void **buf) {
+	if (dir->pos < dir->size || dir->ahead_size > 0 || (dir->flags & (BFS_DIR_EOF | BFS_DIR_AHEAD))) {
+		return 0;
+	}
+
+	*buf = dir->cur;
+	sanitize_uninit(*buf, dir->bufsize);
+	return dir->bufsize;
+}
+
+int bfs_dirfill(struct bfs_dir *dir, size_t size) {
+	bfs_assert(size <= dir->bufsize);
+
+	if (size == 0) {
+		dir->flags |= BFS_DIR_EOF;
+		return 0;
+	}
+
+	sanitize_init(dir->cur, size);
+	dir->pos = 0;
+	dir->size = size;
+
+	// If the buffer may have filled up, use the whole thing from now on
+	if (dir->bufsize - size < sizeof(sys_dirent)) {
+		dir->bufsize = BUF_SIZE;
+	}
+
+	return 1;
+}
+
+size_t bfs_dirahead(struct bfs_dir *dir, void **buf) {
+	// Only read ahead once the directory has filled a whole buffer, and
+	// while there are still entries to read from the current one
+	if (dir->bufsize < BUF_SIZE || dir->pos >= dir->size || dir->ahead_size > 0) {
+		return 0;
+	} else if (dir->flags & (BFS_DIR_EOF | BFS_DIR_AHEAD)) {
+		return 0;
+	}
+
+	if (!dir->ahead) {
+		dir->ahead = malloc(BUF_SIZE);
+		if (!dir->ahead) {
+			return 0;
+		}
+	}
+
+	dir->flags |= BFS_DIR_AHEAD;
+	*buf = dir->ahead;
+	sanitize_uninit(*buf, BUF_SIZE);
+	return BUF_SIZE;
+}
+
+ssize_t bfs_dirread(const struct bfs_dir *dir, void *buf, size_t size) {
+	return bfs_getdents(dir->fd, buf, size);
+}
+
+void bfs_dirahead_done(struct bfs_dir *dir, ssize_t size) {
+	bfs_assert(dir->flags & BFS_DIR_AHEAD);
+	bfs_assert(size <= (ssize_t)BUF_SIZE);
+	dir->flags &= ~BFS_DIR_AHEAD;
+
+	if (size > 0) {
+		sanitize_init(dir->ahead, size);
+		dir->ahead_size = size;
+	} else if (size == 0) {
+		dir->flags |= BFS_DIR_EOF;
+	}
+}
+
+#endif // BFS_USE_GETDENTS
+
+#if BFS_USE_GETATTRLISTBULK
+
+/** Read an attribute from a getattrlistbulk() record. */
+static void bfs_bulk_attr(const char **cur, void *dest, size_t size) {
+	memcpy(dest, *cur, size);
+	*cur += size;
+}
+
+/** Convert an ATTR_CMN_OBJTYPE to a file type mode. */
+static mode_t bfs_vtype_mode(fsobj_type_t type) {
+	switch (type) {
+	case VREG:
+		return S_IFREG;
+	case VDIR:
+		return S_IFDIR;
+	case VBLK:
+		return S_IFBLK;
+	case VCHR:
+		return S_IFCHR;
+	case VLNK:
+		return S_IFLNK;
+	case VSOCK:
+		return S_IFSOCK;
+	case VFIFO:
+		return S_IFIFO;
+	default:
+		return 0;
+	}
+}
+
+/** The common attributes that must all be returned to fill in a bfs_stat. */
+#define BULK_CMN_STAT (ATTR_CMN_DEVID | ATTR_CMN_OBJTYPE | ATTR_CMN_OWNERID \
+	| ATTR_CMN_GRPID | ATTR_CMN_ACCESSMASK | ATTR_CMN_FILEID)
+
+/** The file attributes that must all be returned to fill in a bfs_stat. */
+#define BULK_FILE_STAT (ATTR_FILE_LINKCOUNT | ATTR_FILE_TOTALSIZE | ATTR_FILE_ALLOCSIZE)
+
+/** Parse the next getattrlistbulk() record. */
+static int bfs_bulkdent(struct bfs_dir *dir, struct bfs_dirent *de) {
+	const char *record = dir->buf + dir->pos;
+	uint32_t length;
+	memcpy(&length, record, sizeof(length));
+	dir->pos += length;
+	--dir->count;
+
+	// The attributes are packed in the order of their bits, starting with
+	// the ATTR_CMN_RETURNED_ATTRS set
+	const char *cur = record + sizeof(length);
+	attribute_set_t returned;
+	bfs_bulk_attr(&cur, &returned, sizeof(returned));
+
+	attrreference_t nameref;
+	const char *name = cur;
+	bfs_bulk_attr(&cur, &nameref, sizeof(nameref));
+	name += nameref.attr_dataoffset;
+
+	dev_t dev;
+	bfs_bulk_attr(&cur, &dev, sizeof(dev));
+	fsobj_type_t objtype;
+	bfs_bulk_attr(&cur, &objtype, sizeof(objtype));
+	struct timespec btime, mtime, ctime, atime;
+	bfs_bulk_attr(&cur, &btime, sizeof(btime));
+	bfs_bulk_attr(&cur, &mtime, sizeof(mtime));
+	bfs_bulk_attr(&cur, &ctime, sizeof(ctime));
+	bfs_bulk_attr(&cur, &atime, sizeof(atime));
+	uid_t uid;
+	bfs_bulk_attr(&cur, &uid, sizeof(uid));
+	gid_t gid;
+	bfs_bulk_attr(&cur, &gid, sizeof(gid));
+	uint32_t access;
+	bfs_bulk_attr(&cur, &access, sizeof(access));
+	uint32_t flags;
+	bfs_bulk_attr(&cur, &flags, sizeof(flags));
+	uint64_t fileid;
+	bfs_bulk_attr(&cur, &fileid, sizeof(fileid));
+	uint32_t error;
+	bfs_bulk_attr(&cur, &error, sizeof(error));
+	uint32_t mntstatus;
+	bfs_bulk_attr(&cur, &mntstatus, sizeof(mntstatus));
+	uint32_t nlink;
+	bfs_bulk_attr(&cur, &nlink, sizeof(nlink));
+	off_t size;
+	bfs_bulk_attr(&cur, &size, sizeof(size));
+	off_t allocsize;
+	bfs_bulk_attr(&cur, &allocsize, sizeof(allocsize));
+	uint32_t rdev;
+	bfs_bulk_attr(&cur, &rdev, sizeof(rdev));
+
+	if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+		return 1;
+	}
+
+	if (!de) {
+		return 0;
+	}
+
+	mode_t type = (returned.commonattr & ATTR_CMN_OBJTYPE) ? bfs_vtype_mode(objtype) : 0;
+	de->type = bfs_mode_to_type(type);
+	de->name = name;
+	de->namelen = strlen(name);
+	de->ino = fileid;
+	de->stat = NULL;
+
+	// Directories don't report their link count or size the same way,
+	// and mount points report the attributes of the covered directory
+	if (type == 0 || type == S_IFDIR || (mntstatus & DIR_MNTSTATUS_MNTPOINT)) {
+		return 0;
+	}
+	if ((returned.commonattr & ATTR_CMN_ERROR) && error != 0) {
+		return 0;
+	}
+	if ((returned.commonattr & BULK_CMN_STAT) != BULK_CMN_STAT) {
+		return 0;
+	}
+	if ((returned.fileattr & BULK_FILE_STAT) != BULK_FILE_STAT) {
+		return 0;
+	}
+
+	struct bfs_stat *buf = &dir->stat;
+	buf->mask = BFS_STAT_MODE | BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_NLINK
+		| BFS_STAT_GID | BFS_STAT_UID | BFS_STAT_SIZE | BFS_STAT_BLOCKS;
+	buf->mode = type | (access & ~S_IFMT);
+	buf->dev = dev;
+	buf->ino = fileid;
+	buf->nlink = nlink;
+	buf->gid = gid;
+	buf->uid = uid;
+	buf->size = size;
+	buf->blocks = allocsize / BFS_STAT_BLKSIZE;
+
+	if (returned.fileattr & ATTR_FILE_DEVTYPE) {
+		buf->mask |= BFS_STAT_RDEV;
+		buf->rdev = rdev;
+	}
+	if (returned.commonattr & ATTR_CMN_FLAGS) {
+		buf->mask |= BFS_STAT_ATTRS;
+		buf->attrs = flags;
+	}
+	if (returned.commonattr & ATTR_CMN_ACCTIME) {
+		buf->mask |= BFS_STAT_ATIME;
+		buf->atime = atime;
+	}
+	if (returned.commonattr & ATTR_CMN_CRTIME) {
+		buf->mask |= BFS_STAT_BTIME;
+		buf->btime = btime;
+	}
+	if (returned.commonattr & ATTR_CMN_CHGTIME) {
+		buf->mask |= BFS_STAT_CTIME;
+		buf->ctime = ctime;
+	}
+	if (returned.commonattr & ATTR_CMN_MODTIME) {
+		buf->mask |= BFS_STAT_MTIME;
+		buf->mtime = mtime;
+	}
+
+	de->stat = buf;
+	return 0;
+}
+
+int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
+	while (true) {
+		int ret = bfs_polldir(dir);
+		if (ret <= 0) {
+			return ret;
+		}
+
+		if (bfs_bulkdent(dir, de) == 0) {
+			return 1;
+		}
+	}
+}
+
+#else // !BFS_USE_GETATTRLISTBULK
+
 /** Read a single directory entry. */
 static int bfs_getdent(struct bfs_dir *dir, const sys_dirent **de) {
 	int ret = bfs_polldir(dir);
 	if (ret > 0) {
 #if BFS_USE_GETDENTS
-		char *buf = (char *)(dir + 1);
-		*de = (const sys_dirent *)(buf + dir->pos);
+		*de = (const sys_dirent *)(dir->cur + dir->pos);
 		dir->pos += (*de)->d_reclen;
 #else
 		*de = dir->de;
@@ -275,13 +830,9 @@ static int bfs_skipdent(struct bfs_dir *dir, const sys_dirent *de) {
 #  if __FreeBSD__
 	// Union mounts on FreeBSD have to be de-duplicated in userspace
 	if (dir->flags & BFS_DIR_UNION) {
-		struct trie_leaf *leaf = trie_insert_str(&dir->trie, de->d_name);
-		if (!leaf) {
-			return -1;
-		} else if (leaf->value) {
-			return 1;
-		} else {
-			leaf->value = leaf;
+		int ret = bfs_union_insert(&dir->names, de->d_name, de->d_namlen);
+		if (ret <= 0) {
+			return ret < 0 ? -1 : 1;
 		}
 	}
 
@@ -311,6 +862,21 @@ static enum bfs_type bfs_d_type(const sys_dirent *de) {
 #endif
 }
 
+/** Get the length of de->d_name. */
+static size_t bfs_d_namlen(const sys_dirent *de) {
+#if BFS_USE_GETDENTS && __FreeBSD__
+	return de->d_namlen;
+#elif BFS_USE_GETDENTS && __linux__
+	// Linux pads each record to a multiple of 8 bytes after the name's
+	// terminating NUL, so only the last few bytes need to be scanned
+	size_t size = de->d_reclen - offsetof(sys_dirent, d_name);
+	size_t skip = size > 8 ? size - 8 : 0;
+	return skip + strlen(de->d_name + skip);
+#else
+	return strlen(de->d_name);
+#endif
+}
+
 int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
 	while (true) {
 		const sys_dirent *sysde;
@@ -329,24 +895,36 @@ int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
 		if (de) {
 			de->type = bfs_d_type(sysde);
 			de->name = sysde->d_name;
+			de->namelen = bfs_d_namlen(sysde);
+			de->ino = sysde->d_ino;
+			de->stat = NULL;
 		}
 
 		return 1;
 	}
 }
 
+#endif // !BFS_USE_GETATTRLISTBULK
+
 static void bfs_destroydir(struct bfs_dir *dir) {
-#if BFS_USE_GETDENTS && __FreeBSD__
+#if BFS_USE_GETDENTS
+	bfs_assert(!(dir->flags & BFS_DIR_AHEAD), "Destroying a directory with a read-ahead in flight");
+
+	// Only one of the two buffers was allocated separately
+	free(dir->cur == dir->buf ? dir->ahead : dir->cur);
+
+#  if __FreeBSD__
 	if (dir->flags & BFS_DIR_UNION) {
-		trie_destroy(&dir->trie);
+		bfs_union_destroy(&dir->names);
 	}
+#  endif
 #endif
 
 	sanitize_uninit(dir, DIR_SIZE);
 }
 
 int bfs_closedir(struct bfs_dir *dir) {
-#if BFS_USE_GETDENTS
+#if BFS_USE_GETDENTS || BFS_USE_GETATTRLISTBULK
 	int ret = xclose(dir->fd);
 #else
 	int ret = closedir(dir->dir);
@@ -361,7 +939,7 @@ int bfs_closedir(struct bfs_dir *dir) {
 
 #if BFS_USE_UNWRAPDIR
 int bfs_unwrapdir(struct bfs_dir *dir) {
-#if BFS_USE_GETDENTS
+#if BFS_USE_GETDENTS || BFS_USE_GETATTRLISTBULK
 	int ret = dir->fd;
 #elif BFS_HAS_FDCLOSEDIR
 	int ret = fdclosedir(dir->dir);
@@ -24,6 +24,14 @@
 #  endif
 #endif
 
+/**
+ * Whether the implementation uses getattrlistbulk() (macOS), which returns most
+ * of the lstat() information along with each entry.
+ */
+#ifndef BFS_USE_GETATTRLISTBULK
+#  define BFS_USE_GETATTRLISTBULK (BFS_HAS_GETATTRLISTBULK && !BFS_USE_GETDENTS)
+#endif
+
 /**
  * A directory.
  */
@@ -64,6 +72,8 @@ enum bfs_type {
  */
 enum bfs_type bfs_mode_to_type(mode_t mode);
 
+struct bfs_stat;
+
 /**
  * A directory entry.
  */
@@ -72,6 +82,12 @@ struct bfs_dirent {
 	enum bfs_type type;
 	/** The name of this file. */
 	const char *name;
+	/** The length of the name. */
+	size_t namelen;
+	/** The inode number of this file (may differ from stat() for mount points). */
+	ino_t ino;
+	/** The bfs_stat(BFS_STAT_NOFOLLOW) info, if the directory listing included it. */
+	const struct bfs_stat *stat;
 };
 
 /**
@@ -98,10 +114,35 @@ void bfs_dir_arena(struct arena *arena);
 enum bfs_dir_flags {
 	/** Include whiteouts in the results. */
 	BFS_DIR_WHITEOUTS = 1 << 0,
+	/** The directory is expected to be large, so read it in big chunks. */
+	BFS_DIR_LARGE     = 1 << 1,
+	/** Don't follow symbolic links anywhere in at_path, or escape at_fd. */
+	BFS_DIR_NOFOLLOW  = 1 << 2,
+	/** Don't cross mount points anywhere in at_path. */
+	BFS_DIR_NOXDEV    = 1 << 3,
 	/** @internal Start of private flags. */
-	BFS_DIR_PRIVATE   = 1 << 1,
+	BFS_DIR_PRIVATE   = 1 << 4,
 };
 
+/**
+ * Open a directory file descriptor.
+ *
+ * On Linux, BFS_DIR_NOFOLLOW and BFS_DIR_NOXDEV are enforced by the kernel for
+ * the whole path with openat2().  Elsewhere (or if openat2() is unavailable),
+ * only the last component of at_path is checked for symbolic links, and mount
+ * points are not checked at all.
+ *
+ * @param at_fd
+ *         The base directory for path resolution.
+ * @param at_path
+ *         The path of the directory to open, relative to at_fd.
+ * @param flags
+ *         BFS_DIR_NOFOLLOW and/or BFS_DIR_NOXDEV (other flags are ignored).
+ * @return
+ *         The open file descriptor, or -1 on failure.
+ */
+int bfs_opendirfd(int at_fd, const char *at_path, enum bfs_dir_flags flags);
+
 /**
  * Open a directory.
  *
@@ -134,6 +175,67 @@ int bfs_dirfd(const struct bfs_dir *dir);
  */
 int bfs_polldir(struct bfs_dir *dir);
 
+#if BFS_USE_GETDENTS
+/**
+ * Get the buffer for the next raw getdents() call, for asynchronous I/O.
+ *
+ * @param dir
+ *         The directory to read.
+ * @param[out] buf
+ *         Will hold the buffer to fill.
+ * @return
+ *         The size of the buffer, or 0 if no I/O is necessary.
+ */
+size_t bfs_dirbuf(struct bfs_dir *dir, void **buf);
+
+/**
+ * Complete an asynchronous getdents() into the buffer from bfs_dirbuf().
+ *
+ * @param dir
+ *         The directory that was read.
+ * @param size
+ *         The number of bytes read.
+ * @return
+ *         1 if there are entries to read, or 0 on EOF.
+ */
+int bfs_dirfill(struct bfs_dir *dir, size_t size);
+
+/**
+ * Get a spare buffer to read the next chunk of a large directory into, while
+ * the current chunk is still being read.  Until bfs_dirahead_done() is called,
+ * bfs_polldir() will fail with EAGAIN rather than block once the current chunk
+ * runs out, and the directory must not be closed.
+ *
+ * @param dir
+ *         The directory to read ahead.
+ * @param[out] buf
+ *         Will hold the buffer to fill.
+ * @return
+ *         The size of the buffer, or 0 if reading ahead isn't worthwhile.
+ */
+size_t bfs_dirahead(struct bfs_dir *dir, void **buf);
+
+/**
+ * Perform a raw getdents() into a buffer from bfs_dirahead().  This only uses
+ * the file descriptor, so it's safe to call from another thread.
+ *
+ * @return
+ *         The number of bytes read, or -1 on failure.
+ */
+ssize_t bfs_dirread(const struct bfs_dir *dir, void *buf, size_t size);
+
+/**
+ * Complete a read-ahead started by bfs_dirahead().
+ *
+ * @param dir
+ *         The directory that was read.
+ * @param size
+ *         The number of bytes read, or a negative value on failure (in which
+ *         case the next bfs_polldir() will retry the read).
+ */
+void bfs_dirahead_done(struct bfs_dir *dir, ssize_t size);
+#endif
+
 /**
  * Read a directory entry.
  *
@@ -158,7 +260,7 @@ int bfs_closedir(struct bfs_dir *dir);
  * Whether the bfs_unwrapdir() function is supported.
  */
 #ifndef BFS_USE_UNWRAPDIR
-#  define BFS_USE_UNWRAPDIR (BFS_USE_GETDENTS || BFS_HAS_FDCLOSEDIR)
+#  define BFS_USE_UNWRAPDIR (BFS_USE_GETDENTS || BFS_USE_GETATTRLISTBULK || BFS_HAS_FDCLOSEDIR)
 #endif
 
 #if BFS_USE_UNWRAPDIR
@@ -0,0 +1,653 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "dlog.h"
+
+#include "alloc.h"
+#include "atomic.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "bftw.h"
+#include "color.h"
+#include "ctx.h"
+#include "diag.h"
+#include "dstring.h"
+#include "perf.h"
+#include "sighook.h"
+#include "stat.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * A binary log record, followed by two NUL-terminated strings:
+ *
+ *     -D stat:   the path, and ""
+ *     -D search: the path, and the root
+ *     -D exec:   the action name, and the message
+ */
+struct dlog_record {
+	/** The total size of the record, including the strings. */
+	uint32_t size;
+	/** The length of the first string, including its terminator. */
+	uint32_t len;
+	/** When the record was logged, for merging the threads' records. */
+	uint64_t ts;
+	/** The debug flag this record belongs to. */
+	uint32_t flag;
+	/** The bfs_stat() flags, or the bftw_visit. */
+	uint32_t flags;
+	/** The error number. */
+	int32_t err;
+	/** The bfs_type. */
+	int16_t type;
+	/** The bftw_action. */
+	uint16_t action;
+	/** The search depth, or the length of the stat() base path. */
+	uint64_t num;
+};
+
+/** Marks a stat() relative to the working directory. */
+#define DLOG_CWD UINT64_MAX
+
+/** The size of each thread's ring buffer. */
+#define DLOG_RING_SIZE ((size_t)1 << 20)
+
+/** A thread's ring buffer of records. */
+struct dlog_ring {
+	/** The next ring in the list. */
+	struct dlog_ring *next;
+	/** The records, which may wrap around. */
+	char *buf;
+	/** The offset just past the newest record. */
+	atomic uint64_t head;
+	/** The offset of the oldest record. */
+	atomic uint64_t tail;
+	/** The number of records overwritten so far. */
+	atomic uint64_t dropped;
+};
+
+/** The header of each thread's records in the log file. */
+struct dlog_chunk {
+	/** The number of records that were overwritten. */
+	uint64_t dropped;
+	/** The number of bytes of records that follow. */
+	uint64_t len;
+};
+
+/** The magic number at the start of a log file. */
+static const char dlog_magic[8] = "bfsdlog1";
+
+bool bfs_dlogging = false;
+
+/** The log file descriptor. */
+static int dlog_fd = -1;
+/** Dumps the rings if we're killed by a signal. */
+static struct sighook *dlog_hook = NULL;
+
+/** The list of rings, which may be walked from a signal handler. */
+static struct dlog_ring *atomic dlog_rings = NULL;
+/** Protects dlog_rings. */
+static pthread_mutex_t dlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The calling thread's ring, allocated on first use. */
+static thread_local struct dlog_ring *dlog_self = NULL;
+
+/** Write out all the rings (async-signal-safe). */
+static int dlog_dump(int fd) {
+	int ret = 0;
+
+	if (xwrite(fd, dlog_magic, sizeof(dlog_magic)) != sizeof(dlog_magic)) {
+		ret = -1;
+	}
+
+	for (struct dlog_ring *ring = load(&dlog_rings, acquire); ring; ring = ring->next) {
+		uint64_t tail = load(&ring->tail, acquire);
+		uint64_t head = load(&ring->head, acquire);
+
+		struct dlog_chunk chunk = {
+			.dropped = load(&ring->dropped, relaxed),
+			.len = head - tail,
+		};
+		if (xwrite(fd, &chunk, sizeof(chunk)) != sizeof(chunk)) {
+			ret = -1;
+		}
+
+		// Write the part up to the end of the buffer, then the rest
+		size_t start = tail % DLOG_RING_SIZE;
+		size_t first = chunk.len;
+		if (first > DLOG_RING_SIZE - start) {
+			first = DLOG_RING_SIZE - start;
+		}
+		if (xwrite(fd, ring->buf + start, first) != first) {
+			ret = -1;
+		}
+		size_t rest = chunk.len - first;
+		if (xwrite(fd, ring->buf, rest) != rest) {
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/** atsigexit() hook. */
+static void dlog_sigexit(int sig, siginfo_t *info, void *arg) {
+	if (dlog_fd >= 0) {
+		dlog_dump(dlog_fd);
+	}
+}
+
+int bfs_dlog_open(const char *path) {
+	dlog_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (dlog_fd < 0) {
+		return -1;
+	}
+
+	dlog_hook = atsigexit(dlog_sigexit, NULL);
+	if (!dlog_hook) {
+		close_quietly(dlog_fd);
+		dlog_fd = -1;
+		return -1;
+	}
+
+	bfs_dlogging = true;
+	return 0;
+}
+
+/** Get the calling thread's ring. */
+static struct dlog_ring *dlog_ring(void) {
+	if (dlog_self) {
+		return dlog_self;
+	}
+
+	int error = errno;
+	struct dlog_ring *ring = ZALLOC(struct dlog_ring);
+	if (!ring) {
+		goto fail;
+	}
+
+	ring->buf = malloc(DLOG_RING_SIZE);
+	if (!ring->buf) {
+		free(ring);
+		goto fail;
+	}
+
+	mutex_lock(&dlog_mutex);
+	ring->next = load(&dlog_rings, relaxed);
+	store(&dlog_rings, ring, release);
+	mutex_unlock(&dlog_mutex);
+
+	dlog_self = ring;
+	return ring;
+
+fail:
+	errno = error;
+	return NULL;
+}
+
+/** Copy data out of a ring, wrapping around if necessary. */
+static void dlog_read(const struct dlog_ring *ring, uint64_t offset, void *dest, size_t size) {
+	size_t start = offset % DLOG_RING_SIZE;
+	size_t first = size;
+	if (first > DLOG_RING_SIZE - start) {
+		first = DLOG_RING_SIZE - start;
+	}
+
+	char *cdest = dest;
+	memcpy(cdest, ring->buf + start, first);
+	memcpy(cdest + first, ring->buf, size - first);
+}
+
+/** Copy data into a ring, wrapping around if necessary. */
+static void dlog_write(struct dlog_ring *ring, uint64_t offset, const void *src, size_t size) {
+	size_t start = offset % DLOG_RING_SIZE;
+	size_t first = size;
+	if (first > DLOG_RING_SIZE - start) {
+		first = DLOG_RING_SIZE - start;
+	}
+
+	const char *csrc = src;
+	memcpy(ring->buf + start, csrc, first);
+	memcpy(ring->buf, csrc + first, size - first);
+}
+
+/** Add a record to the calling thread's ring, overwriting the oldest ones. */
+static void dlog_push(struct dlog_record *rec, const char *str1, const char *str2) {
+	size_t len1 = strlen(str1) + 1;
+	size_t len2 = strlen(str2) + 1;
+	size_t size = sizeof(*rec) + len1 + len2;
+	if (size > DLOG_RING_SIZE / 2) {
+		return;
+	}
+
+	struct dlog_ring *ring = dlog_ring();
+	if (!ring) {
+		return;
+	}
+
+	rec->size = size;
+	rec->len = len1;
+	rec->ts = bfs_perf_now();
+
+	uint64_t head = load(&ring->head, relaxed);
+	uint64_t tail = load(&ring->tail, relaxed);
+	if (head + size - tail > DLOG_RING_SIZE) {
+		uint64_t dropped = 0;
+		do {
+			uint32_t old;
+			dlog_read(ring, tail, &old, sizeof(old));
+			tail += old;
+			++dropped;
+		} while (head + size - tail > DLOG_RING_SIZE);
+
+		// Retire the old records before we overwrite them
+		store(&ring->tail, tail, relaxed);
+		fetch_add(&ring->dropped, dropped, relaxed);
+		thread_fence(&ring->tail, seq_cst);
+	}
+
+	dlog_write(ring, head, rec, sizeof(*rec));
+	dlog_write(ring, head + sizeof(*rec), str1, len1);
+	dlog_write(ring, head + sizeof(*rec) + len1, str2, len2);
+	store(&ring->head, head + size, release);
+}
+
+/** Print the -D prefix for a record. */
+static void dlog_prefix(const struct bfs_ctx *ctx, CFILE *cfile, enum debug_flags flag) {
+	const char *cmd = ctx->argv[0] + xbaseoff(ctx->argv[0]);
+	cfprintf(cfile, "${bld}%s:${rs} ${cyn}-D %s${rs}: ", cmd, debug_flag_name(flag));
+}
+
+#define DEBUG_FLAG(file, flags, flag) \
+	do { \
+		if ((flags & flag) || flags == flag) { \
+			fputs(#flag, file); \
+			flags ^= flag; \
+			if (flags) { \
+				fputs(" | ", file); \
+			} \
+		} \
+	} while (0)
+
+/** Print a -D stat record. */
+static void dlog_print_stat(FILE *file, const struct dlog_record *rec, const char *path) {
+	fprintf(file, "bfs_stat(");
+	const char *at_path = path;
+	if (rec->num == DLOG_CWD) {
+		fprintf(file, "AT_FDCWD");
+	} else {
+		fprintf(file, "\"");
+		fwrite(path, 1, rec->num, file);
+		fprintf(file, "\"");
+		at_path += rec->num;
+	}
+
+	fprintf(file, ", \"%s\", ", at_path);
+
+	enum bfs_stat_flags flags = rec->flags;
+	DEBUG_FLAG(file, flags, BFS_STAT_FOLLOW);
+	DEBUG_FLAG(file, flags, BFS_STAT_NOFOLLOW);
+	DEBUG_FLAG(file, flags, BFS_STAT_TRYFOLLOW);
+	DEBUG_FLAG(file, flags, BFS_STAT_NOSYNC);
+
+	fprintf(file, ") == %d", rec->err == 0 ? 0 : -1);
+
+	if (rec->err) {
+		fprintf(file, " [%d]", (int)rec->err);
+	}
+
+	fprintf(file, "\n");
+}
+
+#define DUMP_MAP(value) [value] = #value
+
+/**
+ * Dump the bfs_type for -D search.
+ */
+static const char *dump_bfs_type(enum bfs_type type) {
+	static const char *types[] = {
+		DUMP_MAP(BFS_UNKNOWN),
+		DUMP_MAP(BFS_BLK),
+		DUMP_MAP(BFS_CHR),
+		DUMP_MAP(BFS_DIR),
+		DUMP_MAP(BFS_DOOR),
+		DUMP_MAP(BFS_FIFO),
+		DUMP_MAP(BFS_LNK),
+		DUMP_MAP(BFS_PORT),
+		DUMP_MAP(BFS_REG),
+		DUMP_MAP(BFS_SOCK),
+		DUMP_MAP(BFS_WHT),
+	};
+
+	if (type == BFS_ERROR) {
+		return "BFS_ERROR";
+	} else if ((size_t)type < countof(types) && types[type]) {
+		return types[type];
+	} else {
+		return "???";
+	}
+}
+
+/**
+ * Dump the bftw_visit for -D search.
+ */
+static const char *dump_bftw_visit(enum bftw_visit visit) {
+	static const char *visits[] = {
+		DUMP_MAP(BFTW_PRE),
+		DUMP_MAP(BFTW_POST),
+	};
+
+	if ((size_t)visit < countof(visits)) {
+		return visits[visit];
+	} else {
+		return "???";
+	}
+}
+
+/**
+ * Dump the bftw_action for -D search.
+ */
+static const char *dump_bftw_action(enum bftw_action action) {
+	static const char *actions[] = {
+		DUMP_MAP(BFTW_CONTINUE),
+		DUMP_MAP(BFTW_PRUNE),
+		DUMP_MAP(BFTW_STOP),
+	};
+
+	if ((size_t)action < countof(actions)) {
+		return actions[action];
+	} else {
+		return "???";
+	}
+}
+
+/** Print a -D search record. */
+static void dlog_print_search(CFILE *cfile, const struct dlog_record *rec, const char *path, const char *root) {
+	cfprintf(cfile, "eval_callback({\n");
+
+	FILE *file = cfile->file;
+	fprintf(file, "\t.path = \"%s\",\n", path);
+	fprintf(file, "\t.root = \"%s\",\n", root);
+	fprintf(file, "\t.depth = %zu,\n", (size_t)rec->num);
+	fprintf(file, "\t.visit = %s,\n", dump_bftw_visit(rec->flags));
+	fprintf(file, "\t.type = %s,\n", dump_bfs_type(rec->type));
+	fprintf(file, "\t.error = %d,\n", (int)rec->err);
+	fprintf(file, "}) == %s\n", dump_bftw_action(rec->action));
+}
+
+/** Print a record in the usual text format. */
+static void dlog_print(const struct bfs_ctx *ctx, CFILE *cfile, const struct dlog_record *rec, const char *str1, const char *str2) {
+	dlog_prefix(ctx, cfile, rec->flag);
+
+	switch (rec->flag) {
+	case DEBUG_STAT:
+		dlog_print_stat(cfile->file, rec, str1);
+		break;
+	case DEBUG_SEARCH:
+		dlog_print_search(cfile, rec, str1, str2);
+		break;
+	default:
+		cfprintf(cfile, "${blu}%s${rs}: ", str1);
+		fputs(str2, cfile->file);
+		break;
+	}
+}
+
+void bfs_dlog_stat(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf, enum bfs_stat_flags flags, int err) {
+	struct dlog_record rec = {
+		.flag = DEBUG_STAT,
+		.flags = flags,
+		.err = err,
+		.num = DLOG_CWD,
+	};
+
+	if (ftwbuf->at_fd != (int)AT_FDCWD) {
+		rec.num = strlen(ftwbuf->path) - strlen(ftwbuf->at_path);
+	}
+
+	if (bfs_dlogging) {
+		dlog_push(&rec, ftwbuf->path, "");
+	} else {
+		dlog_print(ctx, ctx->cerr, &rec, ftwbuf->path, "");
+	}
+}
+
+void bfs_dlog_search(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf, enum bftw_action action) {
+	struct dlog_record rec = {
+		.flag = DEBUG_SEARCH,
+		.flags = ftwbuf->visit,
+		.err = ftwbuf->error,
+		.type = ftwbuf->type,
+		.action = action,
+		.num = ftwbuf->depth,
+	};
+
+	if (bfs_dlogging) {
+		dlog_push(&rec, ftwbuf->path, ftwbuf->root);
+	} else {
+		dlog_print(ctx, ctx->cerr, &rec, ftwbuf->path, ftwbuf->root);
+	}
+}
+
+void bfs_dlog_vexec(const struct bfs_ctx *ctx, const char *label, const char *format, va_list args) {
+	struct dlog_record rec = {
+		.flag = DEBUG_EXEC,
+	};
+
+	if (bfs_dlogging) {
+		// Commands are slow enough that formatting the message doesn't matter
+		char msg[1024];
+		vsnprintf(msg, sizeof(msg), format, args);
+		dlog_push(&rec, label, msg);
+	} else {
+		dlog_prefix(ctx, ctx->cerr, DEBUG_EXEC);
+		cfprintf(ctx->cerr, "${blu}%s${rs}: ", label);
+		vfprintf(stderr, format, args);
+	}
+}
+
+int bfs_dlog_close(void) {
+	if (dlog_fd < 0) {
+		return 0;
+	}
+
+	bfs_dlogging = false;
+	sigunhook(dlog_hook);
+	dlog_hook = NULL;
+
+	int ret = dlog_dump(dlog_fd);
+	int error = errno;
+
+	if (xclose(dlog_fd) != 0 && ret == 0) {
+		ret = -1;
+		error = errno;
+	}
+	dlog_fd = -1;
+
+	struct dlog_ring *next;
+	for (struct dlog_ring *ring = load(&dlog_rings, relaxed); ring; ring = next) {
+		next = ring->next;
+		free(ring->buf);
+		free(ring);
+	}
+	store(&dlog_rings, NULL, relaxed);
+	dlog_self = NULL;
+
+	errno = error;
+	return ret;
+}
+
+/** A record found while decoding. */
+struct dlog_entry {
+	/** The record header. */
+	struct dlog_record rec;
+	/** The strings that follow it. */
+	const char *str1, *str2;
+	/** The order it was read in, to break ties. */
+	size_t seq;
+};
+
+/** qsort() comparator for log entries. */
+static int dlog_entry_cmp(const void *a, const void *b) {
+	const struct dlog_entry *x = a;
+	const struct dlog_entry *y = b;
+
+	if (x->rec.ts != y->rec.ts) {
+		return x->rec.ts < y->rec.ts ? -1 : 1;
+	} else {
+		return (x->seq > y->seq) - (x->seq < y->seq);
+	}
+}
+
+/** Parse one thread's records. */
+static int dlog_parse_chunk(const char *buf, size_t len, struct dlog_entry **entries, size_t *count) {
+	while (len > 0) {
+		struct dlog_entry entry;
+		if (len < sizeof(entry.rec)) {
+			return -1;
+		}
+		memcpy(&entry.rec, buf, sizeof(entry.rec));
+
+		const struct dlog_record *rec = &entry.rec;
+		if (rec->size < sizeof(*rec) + 2 || rec->size > len || rec->len < 1 || rec->len > rec->size - sizeof(*rec) - 1) {
+			return -1;
+		}
+
+		const char *str1 = buf + sizeof(*rec);
+		const char *str2 = str1 + rec->len;
+		const char *end = buf + rec->size;
+		if (str2[-1] != '\0' || end[-1] != '\0' || memchr(str2, '\0', end - str2) != end - 1) {
+			return -1;
+		}
+
+		if (rec->flag != DEBUG_STAT && rec->flag != DEBUG_SEARCH && rec->flag != DEBUG_EXEC) {
+			return -1;
+		} else if (rec->flag == DEBUG_STAT && rec->num != DLOG_CWD && rec->num >= rec->len) {
+			return -1;
+		}
+
+		entry.str1 = str1;
+		entry.str2 = str2;
+		entry.seq = *count;
+
+		struct dlog_entry *slot = RESERVE(struct dlog_entry, entries, count);
+		if (!slot) {
+			return -1;
+		}
+		*slot = entry;
+
+		buf += rec->size;
+		len -= rec->size;
+	}
+
+	return 0;
+}
+
+/** Read a whole file into memory. */
+static char *dlog_slurp(const char *path, size_t *len) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	char *buf = NULL;
+	size_t cap = 0;
+	*len = 0;
+
+	while (true) {
+		if (*len == cap) {
+			cap = cap ? 2 * cap : 64 << 10;
+			char *new = realloc(buf, cap);
+			if (!new) {
+				goto fail;
+			}
+			buf = new;
+		}
+
+		size_t size = xread(fd, buf + *len, cap - *len);
+		if (size == (size_t)-1) {
+			goto fail;
+		}
+		*len += size;
+		if (*len < cap) {
+			break;
+		}
+	}
+
+	close_quietly(fd);
+	return buf;
+
+fail:
+	free(buf);
+	close_quietly(fd);
+	return NULL;
+}
+
+int bfs_dlog_decode(const struct bfs_ctx *ctx, const char *path) {
+	size_t len;
+	char *buf = dlog_slurp(path, &len);
+	if (!buf) {
+		return -1;
+	}
+
+	int ret = -1;
+	struct dlog_entry *entries = NULL;
+	size_t count = 0;
+	uint64_t dropped = 0;
+
+	if (len < sizeof(dlog_magic) || memcmp(buf, dlog_magic, sizeof(dlog_magic)) != 0) {
+		errno = EINVAL;
+		goto done;
+	}
+
+	for (size_t i = sizeof(dlog_magic); i < len;) {
+		struct dlog_chunk chunk;
+		if (len - i < sizeof(chunk)) {
+			errno = EINVAL;
+			goto done;
+		}
+		memcpy(&chunk, buf + i, sizeof(chunk));
+		i += sizeof(chunk);
+
+		if (chunk.len > len - i) {
+			errno = EINVAL;
+			goto done;
+		}
+
+		errno = EINVAL;
+		if (dlog_parse_chunk(buf + i, chunk.len, &entries, &count) != 0) {
+			goto done;
+		}
+		i += chunk.len;
+		dropped += chunk.dropped;
+	}
+
+	if (dropped > 0) {
+		bfs_warning(ctx, "%pq: The oldest %zu record(s) were overwritten.\n\n", path, (size_t)dropped);
+	}
+
+	if (count > 0) {
+		qsort(entries, count, sizeof(*entries), dlog_entry_cmp);
+	}
+
+	CFILE *cout = ctx->cout;
+	for (size_t i = 0; i < count; ++i) {
+		const struct dlog_entry *entry = &entries[i];
+		dlog_print(ctx, cout, &entry->rec, entry->str1, entry->str2);
+	}
+
+	ret = 0;
+done:
+	free(entries);
+	free(buf);
+	return ret;
+}
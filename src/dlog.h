@@ -0,0 +1,81 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Debug logging for -D stat, search, and exec.
+ *
+ * Normally these messages are printed to stderr as they happen.  With
+ * -debug-log, they are instead recorded as compact binary records in a ring
+ * buffer per thread, which is written out at exit (or when bfs is killed by a
+ * signal), and turned back into text later by -debug-decode.
+ */
+
+#ifndef BFS_DLOG_H
+#define BFS_DLOG_H
+
+#include "bftw.h"
+#include "stat.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+struct bfs_ctx;
+
+/** Whether debug messages are being recorded. */
+extern bool bfs_dlogging;
+
+/**
+ * Start recording debug messages.  Must be called before any other threads are
+ * started.
+ *
+ * @param path
+ *         The path to the log file to write.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_dlog_open(const char *path);
+
+/**
+ * Log a stat() call (-D stat).
+ */
+void bfs_dlog_stat(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf, enum bfs_stat_flags flags, int err);
+
+/**
+ * Log a visited file (-D search).
+ */
+void bfs_dlog_search(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf, enum bftw_action action);
+
+/**
+ * Log a message from -exec or a similar action (-D exec).
+ *
+ * @param label
+ *         The name of the action, e.g. "-execdir".
+ * @param format
+ *         The message format string.
+ * @param args
+ *         The message arguments.
+ */
+_printf(3, 0)
+void bfs_dlog_vexec(const struct bfs_ctx *ctx, const char *label, const char *format, va_list args);
+
+/**
+ * Write out the log file.  Must only be called once all other threads have
+ * finished.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_dlog_close(void);
+
+/**
+ * Print the messages from a log file to stdout, in the same format they would
+ * have had on stderr (-debug-decode).
+ *
+ * @param path
+ *         The path to the log file.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_dlog_decode(const struct bfs_ctx *ctx, const char *path);
+
+#endif // BFS_DLOG_H
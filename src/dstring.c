@@ -6,6 +6,7 @@
 #include "alloc.h"
 #include "bit.h"
 #include "diag.h"
+#include "perf.h"
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -13,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /**
  * The memory representation of a dynamic string.  Users get a pointer to str.
@@ -295,3 +297,28 @@ dchar *dstrepeat(const char *str, size_t n) {
 
 	return ret;
 }
+
+int dstreadlinkat(dchar **dest, int fd, const char *path, size_t size) {
+	if (size == 0) {
+		size = 63;
+	}
+
+	while (true) {
+		if (dstreserve(dest, size) != 0) {
+			return -1;
+		}
+
+		// The capacity includes the NUL terminator
+		size_t cap = dstrheader(*dest)->cap;
+		uint64_t start = bfs_perf_start();
+		ssize_t len = readlinkat(fd, path, *dest, cap);
+		bfs_perf_end(BFS_PERF_READLINK, start, 0);
+		if (len < 0) {
+			return -1;
+		} else if ((size_t)len < cap) {
+			return dstresize(dest, len);
+		}
+
+		size = 2 * cap;
+	}
+}
@@ -325,4 +325,20 @@ int dstrnescat(dchar **dest, const char *str, size_t n, enum wesc_flags flags);
  */
 dchar *dstrepeat(const char *str, size_t n);
 
+/**
+ * Read a symbolic link into a dynamic string, reusing its capacity.
+ *
+ * @param dest
+ *         The dynamic string to overwrite (may point to NULL).
+ * @param fd
+ *         The base directory descriptor.
+ * @param path
+ *         The path to the link, relative to fd.
+ * @param size
+ *         An estimate for the size of the link target (0 if unknown).
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int dstreadlinkat(dchar **dest, int fd, const char *path, size_t size);
+
 #endif // BFS_DSTRING_H
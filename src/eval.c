@@ -7,32 +7,56 @@
 
 #include "eval.h"
 
+#include "alloc.h"
 #include "atomic.h"
 #include "bar.h"
 #include "bfs.h"
 #include "bfstd.h"
 #include "bftw.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "coproc.h"
+#include "cost.h"
 #include "ctx.h"
 #include "diag.h"
+#include "dlog.h"
 #include "dir.h"
 #include "dstring.h"
 #include "exec.h"
 #include "expr.h"
 #include "fsade.h"
+#include "grep.h"
+#include "hash.h"
+#include "idset.h"
+#include "ignore.h"
+#include "index.h"
+#include "ioq.h"
+#include "list.h"
 #include "mtab.h"
+#include "nameset.h"
+#include "pathmatch.h"
+#include "perf.h"
 #include "printf.h"
+#include "profile.h"
 #include "pwcache.h"
 #include "sanity.h"
 #include "sighook.h"
+#include "snapdiff.h"
 #include "stat.h"
+#include "thread.h"
+#include "throttle.h"
+#include "top.h"
+#include "trace.h"
 #include "trie.h"
+#include "watch.h"
 #include "xregex.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <fnmatch.h>
 #include <grp.h>
+#include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -42,6 +66,7 @@
 #include <string.h>
 #include <strings.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -60,6 +85,24 @@ struct bfs_eval {
 	size_t *nerrors;
 	/** Whether to quit immediately. */
 	bool quit;
+	/** Whether other threads may be evaluating concurrently (-parallel). */
+	bool parallel;
+	/** Whether to time each evaluation (-D rates, or adaptive reordering). */
+	bool profile;
+	/** How many evaluations each timed one stands for (-profile-sample). */
+	size_t profile_scale;
+	/** Captured output, for -ordered. */
+	struct eval_output *out;
+	/** Background -delete state, if any. */
+	struct eval_unlinker *unlinker;
+	/** The disk usage of the current file and its descendants, in bytes (-du). */
+	uintmax_t du;
+	/** The incremental -path matching state for the current file. */
+	uint64_t pathstate;
+	/** Which common subexpressions have been evaluated for this file. */
+	uint64_t cse_known;
+	/** The results of the evaluated common subexpressions. */
+	uint64_t cse_values;
 };
 
 /**
@@ -78,6 +121,9 @@ static void eval_error(struct bfs_eval *state, const char *format, ...) {
 	*state->ret = EXIT_FAILURE;
 
 	CFILE *cerr = ctx->cerr;
+	if (state->parallel) {
+		flockfile(cerr->file);
+	}
 
 	bfs_error(ctx, "%pP: ", state->ftwbuf);
 
@@ -85,6 +131,10 @@ static void eval_error(struct bfs_eval *state, const char *format, ...) {
 	va_start(args, format);
 	cvfprintf(cerr, format, args);
 	va_end(args);
+
+	if (state->parallel) {
+		funlockfile(cerr->file);
+	}
 }
 
 /**
@@ -119,6 +169,66 @@ static void eval_io_error(const struct bfs_expr *expr, struct bfs_eval *state) {
 	clearerr(expr->cfile->file);
 }
 
+/**
+ * Output captured for a single stream.
+ */
+struct eval_segment {
+	/** The stream to write to. */
+	CFILE *cfile;
+	/** The captured output. */
+	dchar *str;
+};
+
+/**
+ * Output captured from evaluating a single file, so it can be printed in
+ * order later (-ordered).
+ */
+struct eval_output {
+	/** The captured output, in order. */
+	struct eval_segment *segs;
+	/** The number of segments. */
+	size_t nsegs;
+};
+
+/** Get the buffer to capture output to a stream. */
+static dchar **eval_capture(struct bfs_eval *state, CFILE *cfile) {
+	struct eval_output *out = state->out;
+	if (out->nsegs > 0) {
+		struct eval_segment *last = &out->segs[out->nsegs - 1];
+		if (last->cfile == cfile) {
+			return &last->str;
+		}
+	}
+
+	dchar *str = dstralloc(0);
+	if (!str) {
+		return NULL;
+	}
+
+	struct eval_segment *seg = RESERVE(struct eval_segment, &out->segs, &out->nsegs);
+	if (!seg) {
+		dstrfree(str);
+		return NULL;
+	}
+
+	seg->cfile = cfile;
+	seg->str = str;
+	return &seg->str;
+}
+
+/** Write out and free some captured output. */
+static void eval_output_flush(struct eval_output *out) {
+	for (size_t i = 0; i < out->nsegs; ++i) {
+		struct eval_segment *seg = &out->segs[i];
+		// Errors are caught by ferror() in bfs_ctx_free()
+		fwrite(seg->str, 1, dstrlen(seg->str), seg->cfile->file);
+		dstrfree(seg->str);
+	}
+	free(out->segs);
+	out->segs = NULL;
+	out->nsegs = 0;
+}
+
 /**
  * Perform a bfs_stat() call if necessary.
  */
@@ -157,17 +267,57 @@ bool bfs_expr_cmp(const struct bfs_expr *expr, long long n) {
 }
 
 /** Common code for fnmatch() tests. */
-static bool eval_fnmatch(const struct bfs_expr *expr, const char *str) {
-	if (expr->literal) {
-#ifdef FNM_CASEFOLD
-		if (expr->fnm_flags & FNM_CASEFOLD) {
-			return strcasecmp(expr->pattern, str) == 0;
+/** Match a string against a pattern with a known shape, byte by byte. */
+static bool eval_glob_shape(const struct bfs_expr *expr, const char *pattern, const char *str) {
+	size_t len = expr->pattern_len;
+
+	switch (expr->glob) {
+	case BFS_GLOB_LITERAL:
+		return strcmp(pattern, str) == 0;
+
+	case BFS_GLOB_AFFIX: {
+		size_t prefix = expr->prefix_len;
+		size_t suffix = expr->suffix_len;
+		if (strncmp(str, pattern, prefix) != 0) {
+			return false;
 		}
-#endif
-		return strcmp(expr->pattern, str) == 0;
-	} else {
+		size_t n = prefix + strlen(str + prefix);
+		return n >= prefix + suffix
+			&& memcmp(str + n - suffix, pattern + len - suffix, suffix) == 0;
+	}
+
+	case BFS_GLOB_INFIX:
+		return memmem(str, strlen(str), pattern + 1, len - 2);
+
+	case BFS_GLOB_FNMATCH:
+		break;
+	}
+
+	bfs_bug("Invalid glob shape");
+	return false;
+}
+
+/** The longest string that eval_fnmatch() will case-fold on the stack. */
+#define EVAL_FOLD_MAX 4096
+
+static bool eval_fnmatch(const struct bfs_expr *expr, const char *str) {
+	if (expr->glob == BFS_GLOB_FNMATCH) {
 		return fnmatch(expr->pattern, str, expr->fnm_flags) == 0;
+	} else if (!expr->folded) {
+		return eval_glob_shape(expr, expr->pattern, str);
+	}
+
+	// The pattern was folded at parse time; fold pure-ASCII strings too
+	size_t len = strlen(str);
+	if (len < EVAL_FOLD_MAX && asciinlen(str, len) == len) {
+		char buf[EVAL_FOLD_MAX];
+		for (size_t i = 0; i <= len; ++i) {
+			buf[i] = ascii_tolower(str[i]);
+		}
+		return eval_glob_shape(expr, expr->folded, buf);
 	}
+
+	return fnmatch(expr->pattern, str, expr->fnm_flags) == 0;
 }
 
 /**
@@ -192,11 +342,16 @@ bool eval_access(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return xfaccessat(ftwbuf->at_fd, ftwbuf->at_path, expr->num) == 0;
 }
 
+/** Get the (mutable) cache of unsupported devices for an expression. */
+static struct bfs_fsade_cache *eval_fsade_cache(const struct bfs_expr *expr) {
+	return (struct bfs_fsade_cache *)&expr->fsade;
+}
+
 /**
  * -acl test.
  */
 bool eval_acl(const struct bfs_expr *expr, struct bfs_eval *state) {
-	int ret = bfs_check_acl(state->ftwbuf);
+	int ret = bfs_check_acl(state->ftwbuf, eval_fsade_cache(expr));
 	if (ret >= 0) {
 		return ret;
 	} else {
@@ -209,7 +364,7 @@ bool eval_acl(const struct bfs_expr *expr, struct bfs_eval *state) {
  * -capable test.
  */
 bool eval_capable(const struct bfs_expr *expr, struct bfs_eval *state) {
-	int ret = bfs_check_capabilities(state->ftwbuf);
+	int ret = bfs_check_capabilities(state->ftwbuf, eval_fsade_cache(expr));
 	if (ret >= 0) {
 		return ret;
 	} else {
@@ -373,28 +528,35 @@ bool eval_nouser(const struct bfs_expr *expr, struct bfs_eval *state) {
 }
 
 /**
- * -delete action.
+ * -chmod action.
  */
-bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state) {
+bool eval_chmod(const struct bfs_expr *expr, struct bfs_eval *state) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
 
-	// Don't try to delete the current directory
-	if (strcmp(ftwbuf->path, ".") == 0) {
-		return true;
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
 	}
 
-	int flag = 0;
+	// Symbolic links don't have their own permissions
+	if (S_ISLNK(statbuf->mode)) {
+		return true;
+	}
 
-	// We need to know the actual type of the path, not what it points to
-	enum bfs_type type = bftw_type(ftwbuf, BFS_STAT_NOFOLLOW);
-	if (type == BFS_DIR) {
-		flag |= AT_REMOVEDIR;
-	} else if (type == BFS_ERROR) {
+	mode_t old = statbuf->mode & 07777;
+	mode_t file_mode = old;
+	mode_t dir_mode = old;
+	if (xstrtomode(expr->argv[1], state->ctx->umask, &file_mode, &dir_mode) != 0) {
 		eval_report_error(state);
 		return false;
 	}
 
-	if (unlinkat(ftwbuf->at_fd, ftwbuf->at_path, flag) != 0) {
+	mode_t mode = S_ISDIR(statbuf->mode) ? dir_mode : file_mode;
+	if (mode == old) {
+		return true;
+	}
+
+	if (fchmodat(ftwbuf->at_fd, ftwbuf->at_path, mode, 0) != 0) {
 		eval_report_error(state);
 		return false;
 	}
@@ -402,1015 +564,4022 @@ bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return true;
 }
 
-/** Finish any pending -exec ... + operations. */
-static int eval_exec_finish(const struct bfs_expr *expr, const struct bfs_ctx *ctx) {
-	int ret = 0;
+/**
+ * -chown action.
+ */
+bool eval_chown(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
 
-	if (expr->eval_fn == eval_exec) {
-		if (bfs_exec_finish(expr->exec) != 0) {
-			if (errno != 0) {
-				bfs_error(ctx, "%s %s: %s.\n", expr->argv[0], expr->argv[1], errstr());
-			}
-			ret = -1;
-		}
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
 	}
 
-	for_expr (child, expr) {
-		if (eval_exec_finish(child, ctx) != 0) {
-			ret = -1;
-		}
+	uid_t uid = expr->chown_uid;
+	if (uid == statbuf->uid) {
+		uid = -1;
 	}
 
-	return ret;
+	gid_t gid = expr->chown_gid;
+	if (gid == statbuf->gid) {
+		gid = -1;
+	}
+
+	if (uid == (uid_t)-1 && gid == (gid_t)-1) {
+		return true;
+	}
+
+	int flags = 0;
+	if (S_ISLNK(statbuf->mode)) {
+		flags |= AT_SYMLINK_NOFOLLOW;
+	}
+
+	if (fchownat(ftwbuf->at_fd, ftwbuf->at_path, uid, gid, flags) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
 }
 
 /**
- * -exec[dir]/-ok[dir] actions.
+ * A copy of the bftw() data that outlives the callback.
  */
-bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = bfs_exec(expr->exec, state->ftwbuf) == 0;
-	if (errno != 0) {
-		eval_error(state, "%s %s: %s.\n", expr->argv[0], expr->argv[1], errstr());
+struct eval_copy {
+	/** The copied bftw() data. */
+	struct BFTW ftwbuf;
+	/** Storage for bfs_stat(BFS_STAT_FOLLOW). */
+	struct bfs_stat stat_buf;
+	/** Storage for bfs_stat(BFS_STAT_NOFOLLOW). */
+	struct bfs_stat lstat_buf;
+	/** Storage for the link target. */
+	dchar *link_buf;
+	/** Storage for the digest from BFS_CHECK_HASH. */
+	unsigned char digest[BFS_HASH_MAX];
+};
+
+/** Copy the bftw() data, with new storage for the path. */
+static void eval_copy_init(struct eval_copy *file, const struct BFTW *ftwbuf, const char *path, int at_fd, const char *at_path) {
+	struct BFTW *copy = &file->ftwbuf;
+	*copy = *ftwbuf;
+	copy->path = path;
+	copy->at_fd = at_fd;
+	copy->at_path = at_path;
+
+	const struct bftw_stat *src = &ftwbuf->stat_bufs;
+	struct bftw_stat *bufs = &copy->stat_bufs;
+	bufs->stat_buf = &file->stat_buf;
+	bufs->lstat_buf = &file->lstat_buf;
+	if (src->stat_err == 0) {
+		file->stat_buf = *src->stat_buf;
+	}
+	if (src->lstat_err == 0) {
+		file->lstat_buf = *src->lstat_buf;
+	}
+
+	// The target cache belongs to the bftw() thread
+	bufs->targets = NULL;
+
+	// So do the digest and the per-directory state, which may be freed
+	// before the copy is used
+	struct bfs_fsade_probe *probe = &copy->fsade;
+	if (probe->digest) {
+		memcpy(file->digest, probe->digest, sizeof(file->digest));
+		probe->digest = file->digest;
+	}
+	copy->parent_usage = NULL;
+	copy->cookie = NULL;
+	copy->parent_cookie = NULL;
+	copy->data = NULL;
+	copy->parent_data = NULL;
+
+	file->link_buf = NULL;
+	bufs->link_buf = &file->link_buf;
+	if (src->link_err == 0) {
+		file->link_buf = dstrddup(*src->link_buf);
+		if (!file->link_buf) {
+			// It can be read again
+			bufs->link_err = -1;
+		}
 	}
-	return ret;
+}
+
+/** Free a copy of the bftw() data. */
+static void eval_copy_destroy(struct eval_copy *file) {
+	dstrfree(file->link_buf);
 }
 
 /**
- * -exit action.
+ * A directory that -delete is removing files from in the background.
  */
-bool eval_exit(const struct bfs_expr *expr, struct bfs_eval *state) {
-	state->action = BFTW_STOP;
-	*state->ret = expr->num;
-	state->quit = true;
-	return true;
-}
+struct eval_unlink_dir {
+	/** A dup() of the directory's file descriptor, or -1 to use full paths. */
+	int fd;
+	/** The number of queued unlinks that refer to this directory, plus one if it's current. */
+	size_t refs;
+	/** The number of those unlinks that haven't completed yet. */
+	size_t pending;
+	/** The length of the directory's path prefix. */
+	size_t len;
+	/** The directory's path prefix (everything before the file names). */
+	char path[];
+};
 
 /**
- * -depth N test.
+ * A queued background -delete.
  */
-bool eval_depth(const struct bfs_expr *expr, struct bfs_eval *state) {
-	return bfs_expr_cmp(expr, state->ftwbuf->depth);
-}
+struct eval_unlink {
+	/** The next queued unlink, in submission order. */
+	struct eval_unlink *next;
+	/** The directory containing the file. */
+	struct eval_unlink_dir *dir;
+	/** A copy of the bftw() data, for error messages. */
+	struct eval_copy file;
+	/** The result of unlinkat(), once it completes. */
+	int result;
+	/** Whether the unlink has completed. */
+	bool done;
+	/** The path to the file. */
+	char path[];
+};
 
 /**
- * -empty test.
+ * Background -delete state.
  */
-bool eval_empty(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct BFTW *ftwbuf = state->ftwbuf;
-	const struct bfs_stat *statbuf;
-	struct bfs_dir *dir;
+struct eval_unlinker {
+	/** The bfs context. */
+	const struct bfs_ctx *ctx;
+	/** The I/O queue that performs the unlinks. */
+	struct ioq *ioq;
+
+	/** Queued unlinks, in submission order. */
+	struct {
+		struct eval_unlink *head;
+		struct eval_unlink **tail;
+	} queue;
+
+	/** The directory of the most recent unlink. */
+	struct eval_unlink_dir *cur;
+	/** All the live directories. */
+	struct eval_unlink_dir *dirs[BFS_DELETE_DIRS];
+	/** The number of live directories. */
+	size_t ndirs;
 
-	switch (ftwbuf->type) {
-	case BFS_REG:
-		statbuf = eval_stat(state);
-		return statbuf && statbuf->size == 0;
+	/** The number of errors that have occurred. */
+	size_t *nerrors;
+	/** The bfs_eval() return value. */
+	int *ret;
+};
 
-	case BFS_DIR:
-		dir = bfs_allocdir();
-		if (!dir) {
-			goto error;
-		}
+/** Create the background -delete state. */
+static struct eval_unlinker *eval_unlinker_create(const struct bfs_ctx *ctx, size_t nthreads, struct bfs_throttle *throttle, size_t *nerrors, int *ret) {
+	struct eval_unlinker *unlinker = ZALLOC(struct eval_unlinker);
+	if (!unlinker) {
+		return NULL;
+	}
 
-		if (bfs_opendir(dir, ftwbuf->at_fd, ftwbuf->at_path, 0) != 0) {
-			goto error;
-		}
+	unlinker->ioq = ioq_create(4096, nthreads, 0, throttle, 0);
+	if (!unlinker->ioq) {
+		free(unlinker);
+		return NULL;
+	}
 
-		int did_read = bfs_readdir(dir, NULL);
-		bfs_closedir(dir);
+	unlinker->ctx = ctx;
+	SLIST_INIT(&unlinker->queue);
+	unlinker->nerrors = nerrors;
+	unlinker->ret = ret;
+	return unlinker;
+}
 
-		if (did_read < 0) {
-			goto error;
-		}
+/** Drop a reference to a directory. */
+static void eval_unlink_dir_unref(struct eval_unlinker *unlinker, struct eval_unlink_dir *dir) {
+	if (--dir->refs > 0) {
+		return;
+	}
 
-		free(dir);
-		return did_read == 0;
-	error:
-		eval_report_error(state);
-		free(dir);
-		return false;
+	for (size_t i = 0; i < unlinker->ndirs; ++i) {
+		if (unlinker->dirs[i] == dir) {
+			unlinker->dirs[i] = unlinker->dirs[--unlinker->ndirs];
+			break;
+		}
+	}
 
-	default:
-		return false;
+	if (dir->fd >= 0) {
+		xclose(dir->fd);
 	}
+	free(dir);
 }
 
-/**
- * -flags test.
- */
-bool eval_flags(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+/** Report the result of a completed unlink. */
+static void eval_unlink_report(struct eval_unlinker *unlinker, const struct eval_unlink *unlink) {
+	const struct bfs_ctx *ctx = unlinker->ctx;
+
+	if (unlink->result >= 0) {
+		return;
 	}
 
-	if (!(statbuf->mask & BFS_STAT_ATTRS)) {
-		eval_error(state, "Couldn't get file %s.\n", bfs_stat_field_name(BFS_STAT_ATTRS));
-		return false;
+	const struct BFTW *ftwbuf = &unlink->file.ftwbuf;
+	int error = -unlink->result;
+	if (ctx->ignore_races && error_is_like(error, ENOENT) && ftwbuf->depth > 0) {
+		return;
 	}
 
-	unsigned long flags = statbuf->attrs;
-	unsigned long set = expr->set_flags;
-	unsigned long clear = expr->clear_flags;
+	++*unlinker->nerrors;
+	if (ctx->ignore_errors) {
+		return;
+	}
 
-	switch (expr->flags_cmp) {
-	case BFS_MODE_EQUAL:
-		return flags == set && !(flags & clear);
+	*unlinker->ret = EXIT_FAILURE;
+	bfs_error(ctx, "%pP: %s.\n", ftwbuf, xstrerror(error));
+}
 
-	case BFS_MODE_ALL:
-		return (flags & set) == set && !(flags & clear);
+/** Collect completed unlinks, reporting any errors in submission order. */
+static void eval_unlink_reap(struct eval_unlinker *unlinker, bool block) {
+	struct ioq *ioq = unlinker->ioq;
 
-	case BFS_MODE_ANY:
-		return (flags & set) || (flags & clear) != clear;
+	struct ioq_ent *batch[IOQ_BATCH];
+	size_t size = ioq_pop_batch(ioq, batch, IOQ_BATCH, block);
+	for (size_t i = 0; i < size; ++i) {
+		struct eval_unlink *unlink = batch[i]->ptr;
+		unlink->result = batch[i]->result;
+		unlink->done = true;
+		--unlink->dir->pending;
 	}
+	ioq_free_batch(ioq, batch, size);
 
-	bfs_bug("Invalid comparison mode");
-	return false;
+	struct eval_unlink *unlink;
+	while ((unlink = unlinker->queue.head) && unlink->done) {
+		SLIST_POP(&unlinker->queue);
+		eval_unlink_report(unlinker, unlink);
+		eval_unlink_dir_unref(unlinker, unlink->dir);
+		eval_copy_destroy(&unlink->file);
+		free(unlink);
+	}
+}
+
+/** Trim the trailing slashes from a path prefix, for comparisons. */
+static size_t eval_unlink_trim(const char *path, size_t len) {
+	while (len > 1 && path[len - 1] == '/') {
+		--len;
+	}
+	return len;
 }
 
 /**
- * -fstype test.
+ * Wait for the pending unlinks inside a directory, before it's evaluated in
+ * post-order.  Subdirectories did the same on their own post-order visits, so
+ * only the immediate children need to be checked.
  */
-bool eval_fstype(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+static void eval_unlink_wait(struct eval_unlinker *unlinker, const char *path) {
+	size_t len = eval_unlink_trim(path, strlen(path));
+
+	bool pending;
+	do {
+		pending = false;
+		for (size_t i = 0; i < unlinker->ndirs; ++i) {
+			struct eval_unlink_dir *dir = unlinker->dirs[i];
+			if (dir->pending > 0 && dir->len > 0
+			    && eval_unlink_trim(dir->path, dir->len) == len
+			    && memcmp(dir->path, path, len) == 0) {
+				pending = true;
+				break;
+			}
+		}
+
+		if (pending) {
+			eval_unlink_reap(unlinker, true);
+		}
+	} while (pending);
+}
+
+/** Get the directory for a file that's about to be deleted. */
+static struct eval_unlink_dir *eval_unlink_dir(struct eval_unlinker *unlinker, const struct BFTW *ftwbuf) {
+	size_t len = ftwbuf->nameoff;
+
+	struct eval_unlink_dir *dir = unlinker->cur;
+	if (dir) {
+		if (dir->len == len && memcmp(dir->path, ftwbuf->path, len) == 0) {
+			return dir;
+		}
+		unlinker->cur = NULL;
+		eval_unlink_dir_unref(unlinker, dir);
 	}
 
-	const struct bfs_mtab *mtab = bfs_ctx_mtab(state->ctx);
-	if (!mtab) {
-		eval_report_error(state);
-		return false;
+	// Limit the number of open directories
+	while (unlinker->ndirs >= BFS_DELETE_DIRS) {
+		eval_unlink_reap(unlinker, true);
 	}
 
-	const char *type = bfs_fstype(mtab, statbuf);
-	if (!type) {
-		eval_report_error(state);
-		return false;
+	dir = ALLOC_FLEX(struct eval_unlink_dir, path, len + 1);
+	if (!dir) {
+		return NULL;
 	}
 
-	return strcmp(type, expr->argv[1]) == 0;
-}
+	dir->fd = -1;
+	if (ftwbuf->at_fd != (int)AT_FDCWD) {
+		// bftw() may close at_fd before the unlink happens
+		dir->fd = dup_cloexec(ftwbuf->at_fd);
+		if (dir->fd < 0) {
+			free(dir);
+			return NULL;
+		}
+	}
 
-/**
- * -hidden test.
- */
-bool eval_hidden(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct BFTW *ftwbuf = state->ftwbuf;
-	const char *name = ftwbuf->path + ftwbuf->nameoff;
+	dir->refs = 1;
+	dir->pending = 0;
+	dir->len = len;
+	memcpy(dir->path, ftwbuf->path, len);
+	dir->path[len] = '\0';
 
-	// Don't treat "." or ".." as hidden directories.  Otherwise we'd filter
-	// out everything when given
-	//
-	//     $ bfs . -nohidden
-	//     $ bfs .. -nohidden
-	return name[0] == '.' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+	unlinker->dirs[unlinker->ndirs++] = dir;
+	unlinker->cur = dir;
+	return dir;
 }
 
-/**
- * -inum test.
- */
-bool eval_inum(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+/** Queue a file to be deleted in the background. */
+static int eval_unlink_push(struct eval_unlinker *unlinker, const struct BFTW *ftwbuf, int flag) {
+	struct eval_unlink_dir *dir = eval_unlink_dir(unlinker, ftwbuf);
+	if (!dir) {
+		return -1;
 	}
 
-	return bfs_expr_cmp(expr, statbuf->ino);
-}
+	size_t len = strlen(ftwbuf->path);
+	struct eval_unlink *unlink = ALLOC_FLEX(struct eval_unlink, path, len + 1);
+	if (!unlink) {
+		return -1;
+	}
 
-/**
- * -links test.
- */
-bool eval_links(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+	SLIST_ITEM_INIT(unlink);
+	unlink->dir = dir;
+	unlink->result = 0;
+	unlink->done = false;
+	memcpy(unlink->path, ftwbuf->path, len + 1);
+
+	int dfd = (int)AT_FDCWD;
+	const char *path = unlink->path;
+	if (dir->fd >= 0) {
+		dfd = dir->fd;
+		path += ftwbuf->nameoff;
 	}
+	eval_copy_init(&unlink->file, ftwbuf, unlink->path, dfd, path);
 
-	return bfs_expr_cmp(expr, statbuf->nlink);
-}
+	struct ioq *ioq = unlinker->ioq;
+	while (ioq_capacity(ioq) == 0) {
+		eval_unlink_reap(unlinker, true);
+	}
+
+	if (ioq_unlink(ioq, dfd, path, flag, unlink) != 0) {
+		eval_copy_destroy(&unlink->file);
+		free(unlink);
+		return -1;
+	}
+
+	++dir->refs;
+	++dir->pending;
+	SLIST_APPEND(&unlinker->queue, unlink);
+
+	eval_unlink_reap(unlinker, false);
+	return 0;
+}
+
+/** Wait for all background unlinks, then free the state. */
+static void eval_unlinker_destroy(struct eval_unlinker *unlinker) {
+	if (!unlinker) {
+		return;
+	}
+
+	while (!SLIST_EMPTY(&unlinker->queue)) {
+		eval_unlink_reap(unlinker, true);
+	}
+
+	if (unlinker->cur) {
+		eval_unlink_dir_unref(unlinker, unlinker->cur);
+	}
+
+	ioq_destroy(unlinker->ioq);
+	free(unlinker);
+}
 
 /**
- * -i?lname test.
+ * -delete action.
  */
-bool eval_lname(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = false;
-	char *name = NULL;
-
+bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
-	if (ftwbuf->type != BFS_LNK) {
-		goto done;
+
+	// Don't try to delete the current directory
+	if (strcmp(ftwbuf->path, ".") == 0) {
+		return true;
 	}
 
-	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-	size_t len = statbuf ? statbuf->size : 0;
+	int flag = 0;
 
-	name = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
-	if (!name) {
+	// We need to know the actual type of the path, not what it points to
+	enum bfs_type type = bftw_type(ftwbuf, BFS_STAT_NOFOLLOW);
+	if (type == BFS_DIR) {
+		flag |= AT_REMOVEDIR;
+	} else if (type == BFS_ERROR) {
 		eval_report_error(state);
-		goto done;
+		return false;
 	}
 
-	ret = eval_fnmatch(expr, name);
+	// If the result is ignored, errors can be reported later
+	if (expr->background && state->unlinker) {
+		if (eval_unlink_push(state->unlinker, ftwbuf, flag) == 0) {
+			return true;
+		}
+	}
+
+	uint64_t start = bfs_perf_start();
+	int ret = unlinkat(ftwbuf->at_fd, ftwbuf->at_path, flag);
+	bfs_perf_end(BFS_PERF_UNLINK, start, 0);
+	if (ret != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/** Finish any pending -exec ... + operations and coprocesses. */
+static int eval_exec_finish(const struct bfs_expr *expr, const struct bfs_ctx *ctx) {
+	int ret = 0;
+
+	if (expr->eval_fn == eval_exec) {
+		if (bfs_exec_finish(expr->exec) != 0) {
+			if (errno != 0) {
+				bfs_error(ctx, "%s %s: %s.\n", expr->argv[0], expr->argv[1], errstr());
+			}
+			ret = -1;
+		}
+	} else if (expr->eval_fn == eval_coproc) {
+		if (bfs_coproc_finish(expr->coproc) != 0) {
+			if (errno != 0) {
+				bfs_error(ctx, "%s %s: %s.\n", expr->argv[0], expr->argv[1], errstr());
+			}
+			ret = -1;
+		}
+	}
+
+	for_expr (child, expr) {
+		if (eval_exec_finish(child, ctx) != 0) {
+			ret = -1;
+		}
+	}
 
-done:
-	free(name);
 	return ret;
 }
 
 /**
- * -i?name test.
+ * -coproc[0] and -coproc-test[0] actions.
  */
-bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = false;
+bool eval_coproc(const struct bfs_expr *expr, struct bfs_eval *state) {
+	int ret = bfs_coproc_push(expr->coproc, state->ftwbuf->path);
+	if (ret < 0 && errno != 0) {
+		eval_error(state, "%s %s: %s.\n", expr->argv[0], expr->argv[1], errstr());
+	}
+	return ret > 0;
+}
+
+/**
+ * -exec[dir]/-ok[dir] actions.
+ */
+bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state) {
+	bool ret = bfs_exec(expr->exec, state->ftwbuf) == 0;
+	if (errno != 0) {
+		eval_error(state, "%s %s: %s.\n", expr->argv[0], expr->argv[1], errstr());
+	}
+	return ret;
+}
+
+/**
+ * -count action.
+ */
+bool eval_count(const struct bfs_expr *expr, struct bfs_eval *state) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
+	struct bfs_expr *mut = (struct bfs_expr *)expr;
+	++mut->count;
 
-	const char *name = ftwbuf->path + ftwbuf->nameoff;
-	char *copy = NULL;
-	if (ftwbuf->depth == 0) {
-		// Any trailing slashes are not part of the name.  This can only
-		// happen for the root path.
-		name = copy = xbasename(name);
-		if (!name) {
-			eval_report_error(state);
-			goto done;
+	switch (expr->count_by) {
+	case BFS_COUNT_TOTAL:
+		break;
+
+	case BFS_COUNT_ROOT: {
+		struct trie_leaf *leaf = expr->last_root;
+		if (!leaf || strcmp(leaf->key, ftwbuf->root) != 0) {
+			leaf = trie_insert_str(expr->root_counts, ftwbuf->root);
+			if (!leaf) {
+				eval_report_error(state);
+				break;
+			}
+			mut->last_root = leaf;
 		}
+		leaf->value = (void *)((uintptr_t)leaf->value + 1);
+		break;
 	}
 
-	ret = eval_fnmatch(expr, name);
+	case BFS_COUNT_DEPTH:
+		while (ftwbuf->depth >= expr->ndepths) {
+			size_t *count = RESERVE(size_t, &mut->depth_counts, &mut->ndepths);
+			if (!count) {
+				eval_report_error(state);
+				return true;
+			}
+			*count = 0;
+		}
+		++expr->depth_counts[ftwbuf->depth];
+		break;
+	}
 
-done:
-	free(copy);
-	return ret;
+	return true;
 }
 
 /**
- * -i?path test.
+ * Print the results of any -count actions.  Write errors are reported when the
+ * output is closed, like any other action's.
  */
-bool eval_path(const struct bfs_expr *expr, struct bfs_eval *state) {
-	return eval_fnmatch(expr, state->ftwbuf->path);
+static void eval_count_finish(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_count) {
+		CFILE *cfile = expr->cfile;
+
+		switch (expr->count_by) {
+		case BFS_COUNT_TOTAL:
+			cfprintf(cfile, "%zu\n", expr->count);
+			break;
+
+		case BFS_COUNT_ROOT:
+			for_trie (leaf, expr->root_counts) {
+				cfprintf(cfile, "%zu\t%s\n", (size_t)(uintptr_t)leaf->value, leaf->key);
+			}
+			break;
+
+		case BFS_COUNT_DEPTH:
+			for (size_t i = 0; i < expr->ndepths; ++i) {
+				if (expr->depth_counts[i] > 0) {
+					cfprintf(cfile, "%zu\t%zu\n", expr->depth_counts[i], i);
+				}
+			}
+			break;
+		}
+	}
+
+	for_expr (child, expr) {
+		eval_count_finish(child);
+	}
 }
 
 /**
- * -perm test.
+ * -du action.
  */
-bool eval_perm(const struct bfs_expr *expr, struct bfs_eval *state) {
+bool eval_du(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (!bftw_stat(ftwbuf, ftwbuf->stat_flags)) {
+		eval_report_error(state);
+		return true;
+	}
+
+	char kib[32];
+	snprintf(kib, sizeof(kib), "%ju", (state->du + 1023) / 1024);
+	if (cfprintf(expr->cfile, "%s\t%pP\n", kib, ftwbuf) < 0) {
+		eval_io_error(expr, state);
+	}
+	return true;
+}
+
+/**
+ * -exit action.
+ */
+bool eval_exit(const struct bfs_expr *expr, struct bfs_eval *state) {
+	state->action = BFTW_STOP;
+	*state->ret = expr->num;
+	state->quit = true;
+	return true;
+}
+
+/**
+ * -depth N test.
+ */
+bool eval_depth(const struct bfs_expr *expr, struct bfs_eval *state) {
+	return bfs_expr_cmp(expr, state->ftwbuf->depth);
+}
+
+/**
+ * -empty test.
+ */
+bool eval_empty(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const struct bfs_stat *statbuf;
+	struct bfs_dir *dir;
+
+	switch (ftwbuf->type) {
+	case BFS_REG:
+		statbuf = eval_stat(state);
+		return statbuf && statbuf->size == 0;
+
+	case BFS_DIR:
+		// bftw() may have already read the whole directory
+		if (ftwbuf->empty > 0) {
+			return true;
+		} else if (ftwbuf->empty == 0 && !state->ctx->mutates) {
+			return false;
+		}
+
+		dir = bfs_allocdir();
+		if (!dir) {
+			goto error;
+		}
+
+		if (bfs_opendir(dir, ftwbuf->at_fd, ftwbuf->at_path, 0) != 0) {
+			goto error;
+		}
+
+		int did_read = bfs_readdir(dir, NULL);
+		bfs_closedir(dir);
+
+		if (did_read < 0) {
+			goto error;
+		}
+
+		free(dir);
+		return did_read == 0;
+	error:
+		eval_report_error(state);
+		free(dir);
+		return false;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * -flags test.
+ */
+bool eval_flags(const struct bfs_expr *expr, struct bfs_eval *state) {
 	const struct bfs_stat *statbuf = eval_stat(state);
 	if (!statbuf) {
 		return false;
 	}
 
-	mode_t mode = statbuf->mode;
-	mode_t target;
-	if (state->ftwbuf->type == BFS_DIR) {
-		target = expr->dir_mode;
-	} else {
-		target = expr->file_mode;
+	if (!(statbuf->mask & BFS_STAT_ATTRS)) {
+		eval_error(state, "Couldn't get file %s.\n", bfs_stat_field_name(BFS_STAT_ATTRS));
+		return false;
 	}
 
-	switch (expr->mode_cmp) {
+	unsigned long flags = statbuf->attrs;
+	unsigned long set = expr->set_flags;
+	unsigned long clear = expr->clear_flags;
+
+	switch (expr->flags_cmp) {
 	case BFS_MODE_EQUAL:
-		return (mode & 07777) == target;
+		return flags == set && !(flags & clear);
 
 	case BFS_MODE_ALL:
-		return (mode & target) == target;
+		return (flags & set) == set && !(flags & clear);
 
 	case BFS_MODE_ANY:
-		return !(mode & target) == !target;
+		return (flags & set) || (flags & clear) != clear;
 	}
 
 	bfs_bug("Invalid comparison mode");
 	return false;
 }
 
-/** Print a user/group name/id, and update the column width. */
-static int print_owner(FILE *file, const char *name, uintmax_t id, int *width) {
-	if (name) {
-		int len = xstrwidth(name);
-		if (*width < len) {
-			*width = len;
-		}
+/**
+ * -fstype test.
+ */
+bool eval_fstype(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const char *type = state->ftwbuf->fstype;
+	if (type) {
+		return strcmp(type, expr->argv[1]) == 0;
+	}
+
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	const struct bfs_mtab *mtab = bfs_ctx_mtab(state->ctx);
+	if (!mtab) {
+		eval_report_error(state);
+		return false;
+	}
+
+	type = bfs_fstype(mtab, statbuf);
+	if (!type) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return strcmp(type, expr->argv[1]) == 0;
+}
+
+/**
+ * -grep and -grep-regex tests.
+ */
+bool eval_grep(const struct bfs_expr *expr, struct bfs_eval *state) {
+	int ret = bfs_check_grep(state->ftwbuf, expr->grep);
+	if (ret < 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return ret;
+}
+
+/**
+ * -hash test.
+ */
+bool eval_hash(const struct bfs_expr *expr, struct bfs_eval *state) {
+	unsigned char digest[BFS_HASH_MAX];
+	int ret = bfs_check_hash(state->ftwbuf, expr->hash_algo, digest);
+	if (ret < 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return ret && memcmp(digest, expr->digest, bfs_hash_size(expr->hash_algo)) == 0;
+}
+
+/**
+ * -hidden test.
+ */
+bool eval_hidden(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const char *name = ftwbuf->path + ftwbuf->nameoff;
+
+	// Don't treat "." or ".." as hidden directories.  Otherwise we'd filter
+	// out everything when given
+	//
+	//     $ bfs . -nohidden
+	//     $ bfs .. -nohidden
+	return name[0] == '.' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+/**
+ * -inum test.
+ */
+bool eval_inum(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	return bfs_expr_cmp(expr, statbuf->ino);
+}
+
+/**
+ * -links test.
+ */
+bool eval_links(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	return bfs_expr_cmp(expr, statbuf->nlink);
+}
+
+/**
+ * -i?lname test.
+ */
+bool eval_lname(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (ftwbuf->type != BFS_LNK) {
+		return false;
+	}
+
+	if (expr->glob == BFS_GLOB_LITERAL && !expr->fnm_flags) {
+		// A link's st_size is the length of its target (though some
+		// special files, like those in /proc, report 0)
+		const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
+		bool sized = statbuf && (statbuf->mask & BFS_STAT_SIZE) && statbuf->size != 0;
+		if (sized && (uintmax_t)statbuf->size != expr->pattern_len) {
+			return false;
+		}
+	}
+
+	const char *name = bftw_readlink(ftwbuf);
+	if (!name) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return eval_fnmatch(expr, name);
+}
+
+/**
+ * -i?name test.
+ */
+bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state) {
+	bool ret = false;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	const char *name = ftwbuf->path + ftwbuf->nameoff;
+	char *copy = NULL;
+	if (ftwbuf->depth == 0) {
+		// Any trailing slashes are not part of the name.  This can only
+		// happen for the root path.
+		name = copy = xbasename(name);
+		if (!name) {
+			eval_report_error(state);
+			goto done;
+		}
+	}
+
+	ret = eval_fnmatch(expr, name);
+
+done:
+	free(copy);
+	return ret;
+}
+
+/**
+ * Merged -i?name tests.
+ */
+bool eval_names(const struct bfs_expr *expr, struct bfs_eval *state) {
+	bool ret = false;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	const char *name = ftwbuf->path + ftwbuf->nameoff;
+	char *copy = NULL;
+	if (ftwbuf->depth == 0) {
+		name = copy = xbasename(name);
+		if (!name) {
+			eval_report_error(state);
+			goto done;
+		}
+	}
+
+	ret = bfs_nameset_match(expr->nameset, name);
+
+done:
+	free(copy);
+	return ret;
+}
+
+/**
+ * -name-from test.
+ */
+bool eval_name_from(const struct bfs_expr *expr, struct bfs_eval *state) {
+	bool ret = false;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	const char *name = ftwbuf->path + ftwbuf->nameoff;
+	char *copy = NULL;
+	if (ftwbuf->depth == 0) {
+		name = copy = xbasename(name);
+		if (!name) {
+			eval_report_error(state);
+			goto done;
+		}
+	}
+
+	ret = trie_find_str(expr->literals, name);
+
+done:
+	free(copy);
+	return ret;
+}
+
+/**
+ * -i?path test.
+ */
+bool eval_path(const struct bfs_expr *expr, struct bfs_eval *state) {
+	if (expr->pathmatch_id >= 0) {
+		int ret = bfs_pathmatch_result(state->ctx->pathmatch, state->pathstate, expr->pathmatch_id);
+		if (ret >= 0) {
+			return ret;
+		}
+	}
+
+	return eval_fnmatch(expr, state->ftwbuf->path);
+}
+
+/**
+ * -path-from test.
+ */
+bool eval_path_from(const struct bfs_expr *expr, struct bfs_eval *state) {
+	return trie_find_str(expr->literals, state->ftwbuf->path);
+}
+
+/**
+ * -perm test.
+ */
+bool eval_perm(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	mode_t mode = statbuf->mode;
+	mode_t target;
+	if (state->ftwbuf->type == BFS_DIR) {
+		target = expr->dir_mode;
+	} else {
+		target = expr->file_mode;
+	}
+
+	switch (expr->mode_cmp) {
+	case BFS_MODE_EQUAL:
+		return (mode & 07777) == target;
+
+	case BFS_MODE_ALL:
+		return (mode & target) == target;
+
+	case BFS_MODE_ANY:
+		return !(mode & target) == !target;
+	}
+
+	bfs_bug("Invalid comparison mode");
+	return false;
+}
+
+/** Buffered output for a -ls line. */
+struct ls_buf {
+	/** The file to write to. */
+	FILE *file;
+	/** The number of buffered bytes. */
+	size_t len;
+	/** The buffered bytes. */
+	char buf[256];
+};
+
+/** Write out the buffered part of a -ls line. */
+static int ls_flush(struct ls_buf *ls) {
+	size_t len = ls->len;
+	ls->len = 0;
+	return fwrite(ls->buf, 1, len, ls->file) == len ? 0 : -1;
+}
+
+/** Append some text to a -ls line. */
+static int ls_write(struct ls_buf *ls, const char *str, size_t len) {
+	if (ls->len + len > sizeof(ls->buf)) {
+		if (ls_flush(ls) != 0) {
+			return -1;
+		}
+		if (len > sizeof(ls->buf)) {
+			return fwrite(str, 1, len, ls->file) == len ? 0 : -1;
+		}
+	}
+
+	memcpy(ls->buf + ls->len, str, len);
+	ls->len += len;
+	return 0;
+}
+
+/** Append some padding to a -ls line. */
+static int ls_pad(struct ls_buf *ls, int width) {
+	static const char spaces[] = "                                ";
+
+	while (width > 0) {
+		size_t len = width;
+		if (len > sizeof(spaces) - 1) {
+			len = sizeof(spaces) - 1;
+		}
+		if (ls_write(ls, spaces, len) != 0) {
+			return -1;
+		}
+		width -= len;
+	}
+
+	return 0;
+}
+
+/**
+ * Append an unsigned integer to a -ls line, like "%*ju" (or "%-*ju").
+ *
+ * @return
+ *         The number of digits written, or -1 on error.
+ */
+static int ls_uint(struct ls_buf *ls, uintmax_t n, int width, bool left) {
+	char buf[sizeof(n) * CHAR_BIT];
+	char *end = buf + sizeof(buf);
+	char *str = end;
+	do {
+		*--str = '0' + n % 10;
+		n /= 10;
+	} while (n > 0);
+	int len = end - str;
+
+	if (!left && ls_pad(ls, width - len) != 0) {
+		return -1;
+	}
+	if (ls_write(ls, str, len) != 0) {
+		return -1;
+	}
+	if (left && ls_pad(ls, width - len) != 0) {
+		return -1;
+	}
+	return len;
+}
+
+/** A memoized user/group name. */
+struct ls_owner {
+	/** Whether the cache is filled. */
+	bool valid;
+	/** The cached user/group ID. */
+	uintmax_t id;
+	/** The name, or NULL if it has none. */
+	const char *name;
+	/** The length of the name. */
+	size_t len;
+	/** The display width of the name. */
+	int width;
+};
+
+/**
+ * Owners tend to repeat from file to file, so remember the last name for each
+ * column, along with its measurements.
+ */
+static thread_local struct ls_owner ls_user, ls_group;
+
+/** Append a user/group name/id to a -ls line, and update the column width. */
+static int ls_owner(struct ls_buf *ls, const struct ls_owner *owner, int *width) {
+	if (owner->name) {
+		if (*width < owner->width) {
+			*width = owner->width;
+		}
+
+		if (ls_write(ls, " ", 1) != 0 || ls_write(ls, owner->name, owner->len) != 0) {
+			return -1;
+		}
+		return ls_pad(ls, *width - owner->width);
+	} else {
+		if (ls_write(ls, " ", 1) != 0) {
+			return -1;
+		}
+		int len = ls_uint(ls, owner->id, *width, true);
+		if (len < 0) {
+			return -1;
+		}
+		if (*width < len) {
+			*width = len;
+		}
+		return 0;
+	}
+}
+
+/** Look up a user name for -ls. */
+static const struct ls_owner *ls_getpwuid(const struct bfs_ctx *ctx, uid_t uid) {
+	struct ls_owner *owner = &ls_user;
+
+	if (!owner->valid || owner->id != (uintmax_t)uid) {
+		const struct passwd *pwd = bfs_getpwuid(ctx->users, uid);
+		owner->valid = true;
+		owner->id = uid;
+		owner->name = pwd ? pwd->pw_name : NULL;
+		if (owner->name) {
+			owner->len = strlen(owner->name);
+			owner->width = xstrwidth(owner->name);
+		}
+	}
+
+	return owner;
+}
+
+/** Look up a group name for -ls. */
+static const struct ls_owner *ls_getgrgid(const struct bfs_ctx *ctx, gid_t gid) {
+	struct ls_owner *owner = &ls_group;
+
+	if (!owner->valid || owner->id != (uintmax_t)gid) {
+		const struct group *grp = bfs_getgrgid(ctx->groups, gid);
+		owner->valid = true;
+		owner->id = gid;
+		owner->name = grp ? grp->gr_name : NULL;
+		if (owner->name) {
+			owner->len = strlen(owner->name);
+			owner->width = xstrwidth(owner->name);
+		}
+	}
+
+	return owner;
+}
+
+/** A memoized -ls timestamp. */
+struct ls_time {
+	/** Whether the cache is filled. */
+	bool valid;
+	/** The cached time. */
+	time_t sec;
+	/** The length of the formatted string. */
+	size_t len;
+	/** The formatted string. */
+	char str[256];
+};
+
+/** Files in a tree tend to share timestamps, so remember the last one. */
+static thread_local struct ls_time ls_time;
+
+/** Format a -ls timestamp. */
+static const struct ls_time *ls_strftime(const struct bfs_ctx *ctx, time_t time) {
+	struct ls_time *cache = &ls_time;
+	if (cache->valid && cache->sec == time) {
+		return cache;
+	}
+
+	time_t now = ctx->now.tv_sec;
+	time_t six_months_ago = now - 6 * 30 * 24 * 60 * 60;
+	time_t tomorrow = now + 24 * 60 * 60;
+	struct tm tm;
+	if (!localtime_r(&time, &tm)) {
+		return NULL;
+	}
+
+	size_t len;
+	if (time <= six_months_ago || time >= tomorrow) {
+		len = strftime(cache->str, sizeof(cache->str), "%b %e  %Y", &tm);
+	} else {
+		len = strftime(cache->str, sizeof(cache->str), "%b %e %H:%M", &tm);
+	}
+	if (len == 0) {
+		cache->valid = false;
+		errno = EOVERFLOW;
+		return NULL;
+	}
+
+	cache->valid = true;
+	cache->sec = time;
+	cache->len = len;
+	return cache;
+}
+
+/**
+ * -f?ls action.
+ */
+bool eval_fls(const struct bfs_expr *expr, struct bfs_eval *state) {
+	CFILE *cfile = expr->cfile;
+	const struct bfs_ctx *ctx = state->ctx;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		goto done;
+	}
+
+	// ls -l prints non-path text in the "normal" color, so do the same
+	if (cfprintf(cfile, "${no}") < 0) {
+		goto error;
+	}
+
+	// Format the columns directly, since fprintf() is relatively slow
+	struct ls_buf ls;
+	ls.file = cfile->file;
+	ls.len = 0;
+
+	uintmax_t ino = statbuf->ino;
+	if (ls_uint(&ls, ino, 9, false) < 0) {
+		goto error;
+	}
+
+	uintmax_t block_size = ctx->posixly_correct ? 512 : 1024;
+	uintmax_t blocks = ((uintmax_t)statbuf->blocks * BFS_STAT_BLKSIZE + block_size - 1) / block_size;
+	if (ls_write(&ls, " ", 1) != 0 || ls_uint(&ls, blocks, 6, false) < 0) {
+		goto error;
+	}
+
+	char mode[12];
+	xstrmode(statbuf->mode, mode + 1);
+	mode[0] = ' ';
+	mode[11] = bfs_check_acl(ftwbuf, NULL) > 0 ? '+' : ' ';
+	if (ls_write(&ls, mode, sizeof(mode)) != 0) {
+		goto error;
+	}
+
+	uintmax_t nlink = statbuf->nlink;
+	if (ls_write(&ls, " ", 1) != 0 || ls_uint(&ls, nlink, 2, false) < 0) {
+		goto error;
+	}
+
+	static int uwidth = 8;
+	if (ls_owner(&ls, ls_getpwuid(ctx, statbuf->uid), &uwidth) != 0) {
+		goto error;
+	}
+
+	static int gwidth = 8;
+	if (ls_owner(&ls, ls_getgrgid(ctx, statbuf->gid), &gwidth) != 0) {
+		goto error;
+	}
+
+	if (ftwbuf->type == BFS_BLK || ftwbuf->type == BFS_CHR) {
+		int ma = xmajor(statbuf->rdev);
+		int mi = xminor(statbuf->rdev);
+		if (ma < 0 || mi < 0) {
+			char dev[64];
+			int len = snprintf(dev, sizeof(dev), " %3d, %3d", ma, mi);
+			if (len < 0 || ls_write(&ls, dev, len) != 0) {
+				goto error;
+			}
+		} else if (ls_write(&ls, " ", 1) != 0
+			   || ls_uint(&ls, ma, 3, false) < 0
+			   || ls_write(&ls, ", ", 2) != 0
+			   || ls_uint(&ls, mi, 3, false) < 0) {
+			goto error;
+		}
+	} else {
+		uintmax_t size = statbuf->size;
+		if (ls_write(&ls, " ", 1) != 0 || ls_uint(&ls, size, 8, false) < 0) {
+			goto error;
+		}
+	}
+
+	const struct ls_time *time = ls_strftime(ctx, statbuf->mtime.tv_sec);
+	if (!time) {
+		goto error;
+	}
+	if (ls_write(&ls, " ", 1) != 0 || ls_write(&ls, time->str, time->len) != 0) {
+		goto error;
+	}
+
+	if (ls_flush(&ls) != 0) {
+		goto error;
+	}
+
+	if (cfprintf(cfile, "${rs} %pP", ftwbuf) < 0) {
+		goto error;
+	}
+
+	if (ftwbuf->type == BFS_LNK) {
+		if (cfprintf(cfile, " -> %pL", ftwbuf) < 0) {
+			goto error;
+		}
+	}
+
+	if (fputc('\n', cfile->file) == EOF) {
+		goto error;
+	}
+
+done:
+	return true;
+
+error:
+	eval_io_error(expr, state);
+	return true;
+}
+
+/** Write a JSON string, escaping invalid UTF-8 as lone surrogates (\uDCXX). */
+static int json_string(FILE *file, const char *str) {
+	if (putc('"', file) == EOF) {
+		return -1;
+	}
+
+	const unsigned char *s = (const unsigned char *)str;
+	while (*s) {
+		unsigned char c = *s;
+
+		// Copy a run of plain characters at once
+		size_t n = 0;
+		while (s[n] >= 0x20 && s[n] < 0x80 && s[n] != '"' && s[n] != '\\') {
+			++n;
+		}
+		if (n > 0) {
+			if (fwrite(s, 1, n, file) != n) {
+				return -1;
+			}
+			s += n;
+			continue;
+		}
+
+		if (c >= 0x80) {
+			// Validate a UTF-8 sequence
+			n = 0;
+			unsigned char lo = 0x80, hi = 0xBF;
+			if (c >= 0xC2 && c <= 0xDF) {
+				n = 2;
+			} else if (c >= 0xE0 && c <= 0xEF) {
+				n = 3;
+				lo = c == 0xE0 ? 0xA0 : 0x80;
+				hi = c == 0xED ? 0x9F : 0xBF;
+			} else if (c >= 0xF0 && c <= 0xF4) {
+				n = 4;
+				lo = c == 0xF0 ? 0x90 : 0x80;
+				hi = c == 0xF4 ? 0x8F : 0xBF;
+			}
+
+			bool valid = n > 0 && s[1] >= lo && s[1] <= hi;
+			for (size_t i = 2; valid && i < n; ++i) {
+				valid = s[i] >= 0x80 && s[i] <= 0xBF;
+			}
+
+			if (valid) {
+				if (fwrite(s, 1, n, file) != n) {
+					return -1;
+				}
+				s += n;
+			} else {
+				if (fprintf(file, "\\udc%02x", c) < 0) {
+					return -1;
+				}
+				++s;
+			}
+			continue;
+		}
+
+		int ret;
+		switch (c) {
+		case '"':
+		case '\\':
+			ret = fprintf(file, "\\%c", c);
+			break;
+		case '\b':
+			ret = fputs("\\b", file);
+			break;
+		case '\f':
+			ret = fputs("\\f", file);
+			break;
+		case '\n':
+			ret = fputs("\\n", file);
+			break;
+		case '\r':
+			ret = fputs("\\r", file);
+			break;
+		case '\t':
+			ret = fputs("\\t", file);
+			break;
+		default:
+			ret = fprintf(file, "\\u%04x", c);
+			break;
+		}
+		if (ret < 0) {
+			return -1;
+		}
+		++s;
+	}
+
+	if (putc('"', file) == EOF) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Get the -printjson name for a file type (the same as -printf %y). */
+static const char *json_type(enum bfs_type type) {
+	const char *const names[] = {
+		[BFS_BLK] = "b",
+		[BFS_CHR] = "c",
+		[BFS_DIR] = "d",
+		[BFS_DOOR] = "D",
+		[BFS_FIFO] = "p",
+		[BFS_LNK] = "l",
+		[BFS_PORT] = "P",
+		[BFS_REG] = "f",
+		[BFS_SOCK] = "s",
+		[BFS_WHT] = "w",
+	};
+
+	const char *name = NULL;
+	if ((size_t)type < countof(names)) {
+		name = names[type];
+	}
+
+	return name ? name : "U";
+}
+
+/** Write a JSON timestamp as a pair of integer fields. */
+static int json_time(FILE *file, const char *name, const struct bfs_stat *statbuf, enum bfs_stat_field field) {
+	const struct timespec *ts = bfs_stat_time(statbuf, field);
+	if (!ts) {
+		return 0;
+	}
+
+	return fprintf(file, ",\"%s\":%lld,\"%s_nsec\":%ld", name, (long long)ts->tv_sec, name, (long)ts->tv_nsec);
+}
+
+/**
+ * -f?printjson action.
+ */
+bool eval_fprintjson(const struct bfs_expr *expr, struct bfs_eval *state) {
+	FILE *file = expr->cfile->file;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return true;
+	}
+
+	if (fputs("{\"path\":", file) == EOF) {
+		goto error;
+	}
+	if (json_string(file, ftwbuf->path) != 0) {
+		goto error;
+	}
+
+	if (fprintf(file, ",\"depth\":%zu,\"type\":\"%s\",\"mode\":%u", ftwbuf->depth, json_type(ftwbuf->type), (unsigned int)(statbuf->mode & 07777)) < 0) {
+		goto error;
+	}
+
+	if (fprintf(file, ",\"size\":%ju,\"blocks\":%ju,\"nlink\":%ju,\"uid\":%ju,\"gid\":%ju,\"ino\":%ju,\"dev\":%ju",
+			(uintmax_t)statbuf->size,
+			(uintmax_t)statbuf->blocks * BFS_STAT_BLKSIZE / 512,
+			(uintmax_t)statbuf->nlink,
+			(uintmax_t)statbuf->uid,
+			(uintmax_t)statbuf->gid,
+			(uintmax_t)statbuf->ino,
+			(uintmax_t)statbuf->dev) < 0) {
+		goto error;
+	}
+
+	if (json_time(file, "atime", statbuf, BFS_STAT_ATIME) < 0
+	    || json_time(file, "mtime", statbuf, BFS_STAT_MTIME) < 0
+	    || json_time(file, "ctime", statbuf, BFS_STAT_CTIME) < 0) {
+		goto error;
+	}
+
+	if (fputs("}\n", file) == EOF) {
+		goto error;
+	}
+
+	return true;
+
+error:
+	eval_io_error(expr, state);
+	return true;
+}
+
+/**
+ * -f?print action.
+ */
+bool eval_fprint(const struct bfs_expr *expr, struct bfs_eval *state) {
+	FILE *file = expr->cfile->file;
+	if (state->parallel) {
+		// Keep lines from different threads from interleaving
+		flockfile(file);
+	}
+
+	if (state->out) {
+		const char *path = state->ftwbuf->path;
+		dchar **buf = eval_capture(state, expr->cfile);
+		int ret = -1;
+		if (buf && expr->cfile->colors) {
+			ret = cfdcatf(expr->cfile, buf, "%pP\n", state->ftwbuf);
+		} else if (buf && dstrcat(buf, path) == 0) {
+			ret = dstrapp(buf, '\n');
+		}
+		if (ret != 0) {
+			eval_io_error(expr, state);
+		}
+	} else if (expr->cfile->colors) {
+		if (cfprintf(expr->cfile, "%pP\n", state->ftwbuf) < 0) {
+			eval_io_error(expr, state);
+		}
+	} else {
+		// Uncolored output doesn't need the formatting machinery
+		const char *path = state->ftwbuf->path;
+		size_t length = strlen(path);
+		if (fwrite(path, 1, length, file) != length || putc('\n', file) == EOF) {
+			eval_io_error(expr, state);
+		}
+	}
+
+	if (state->parallel) {
+		funlockfile(file);
+	}
+	return true;
+}
+
+/**
+ * -f?print0 action.
+ */
+bool eval_fprint0(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const char *path = state->ftwbuf->path;
+	size_t length = strlen(path) + 1;
+
+	if (state->out) {
+		dchar **buf = eval_capture(state, expr->cfile);
+		if (!buf || dstrxcat(buf, path, length) != 0) {
+			eval_io_error(expr, state);
+		}
+		return true;
+	}
+	if (fwrite(path, 1, length, expr->cfile->file) != length) {
+		eval_io_error(expr, state);
+	}
+	return true;
+}
+
+/**
+ * -f?printf action.
+ */
+bool eval_fprintf(const struct bfs_expr *expr, struct bfs_eval *state) {
+	if (bfs_printf(expr->cfile, expr->printf, state->ftwbuf) != 0) {
+		eval_io_error(expr, state);
+	}
+
+	return true;
+}
+
+/**
+ * -printx action.
+ */
+bool eval_fprintx(const struct bfs_expr *expr, struct bfs_eval *state) {
+	FILE *file = expr->cfile->file;
+	const char *path = state->ftwbuf->path;
+
+	while (true) {
+		size_t span = strcspn(path, " \t\n\\$'\"`");
+		if (fwrite(path, 1, span, file) != span) {
+			goto error;
+		}
+		path += span;
+
+		char c = path[0];
+		if (!c) {
+			break;
+		}
+
+		char escaped[] = {'\\', c};
+		if (fwrite(escaped, 1, sizeof(escaped), file) != sizeof(escaped)) {
+			goto error;
+		}
+		++path;
+	}
+
+	if (fputc('\n', file) == EOF) {
+		goto error;
+	}
+
+	return true;
+
+error:
+	eval_io_error(expr, state);
+	return true;
+}
+
+/**
+ * -limit action.
+ */
+bool eval_limit(const struct bfs_expr *expr, struct bfs_eval *state) {
+	long long evals = expr->evaluations + 1;
+	if (evals >= expr->num) {
+		state->action = BFTW_STOP;
+		state->quit = true;
+	}
+
+	return true;
+}
+
+/**
+ * -prune action.
+ */
+bool eval_prune(const struct bfs_expr *expr, struct bfs_eval *state) {
+	state->action = BFTW_PRUNE;
+	return true;
+}
+
+/**
+ * -top/-bottom actions.
+ */
+bool eval_top(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return true;
+	}
+
+	struct bfs_top_key key = {0};
+	enum bfs_stat_field field = expr->top_field;
+	if (field & BFS_STAT_TIMES) {
+		const struct timespec *time = eval_stat_time(statbuf, field, state);
+		if (!time) {
+			return true;
+		}
+		key.value = time->tv_sec;
+		key.nsec = time->tv_nsec;
+	} else if (field == BFS_STAT_SIZE) {
+		key.value = statbuf->size;
+	} else if (field == BFS_STAT_BLOCKS) {
+		key.value = statbuf->blocks;
+	} else if (field == BFS_STAT_NLINK) {
+		key.value = statbuf->nlink;
+	} else if (field == BFS_STAT_INO) {
+		key.value = statbuf->ino;
+	} else if (field == BFS_STAT_UID) {
+		key.value = statbuf->uid;
+	} else if (field == BFS_STAT_GID) {
+		key.value = statbuf->gid;
+	} else {
+		bfs_bug("Invalid field %d", (int)field);
+	}
+
+	if (bfs_top_add(expr->top, &key, state->ftwbuf->path) != 0) {
+		eval_error(state, "%s: %s.\n", expr->argv[0], errstr());
+	}
+
+	return true;
+}
+
+/** Print the results of any -top/-bottom actions. */
+static void eval_top_finish(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_top) {
+		size_t count;
+		const struct bfs_top_entry *entries = bfs_top_sort(expr->top, &count);
+
+		for (size_t i = 0; i < count; ++i) {
+			const struct bfs_top_entry *entry = &entries[i];
+			char value[64];
+			if (expr->top_field & BFS_STAT_TIMES) {
+				snprintf(value, sizeof(value), "%jd.%09ld", entry->key.value, entry->key.nsec);
+			} else {
+				snprintf(value, sizeof(value), "%jd", entry->key.value);
+			}
+			cfprintf(expr->cfile, "%s\t%s\n", value, entry->path);
+		}
+	}
+
+	for_expr (child, expr) {
+		eval_top_finish(child);
+	}
+}
+
+/**
+ * -touch action.
+ */
+bool eval_touch(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	// -touch-time sets an explicit time, -touch uses the current time
+	struct timespec times[2];
+	const struct timespec *ptimes = NULL;
+	if (expr->argc > 1) {
+		times[0] = expr->reftime;
+		times[1] = expr->reftime;
+		ptimes = times;
+	}
+
+	int flags = 0;
+	if (ftwbuf->type == BFS_LNK) {
+		flags |= AT_SYMLINK_NOFOLLOW;
+	}
+
+	if (utimensat(ftwbuf->at_fd, ftwbuf->at_path, ptimes, flags) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * -quit action.
+ */
+bool eval_quit(const struct bfs_expr *expr, struct bfs_eval *state) {
+	state->action = BFTW_STOP;
+	state->quit = true;
+	return true;
+}
+
+/**
+ * Implicit action for bfs_parse_query().
+ */
+bool eval_visit(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_ctx *ctx = state->ctx;
+
+	switch (ctx->visit(state->ftwbuf, ctx->visit_ptr)) {
+	case BFTW_CONTINUE:
+		break;
+	case BFTW_PRUNE:
+		state->action = BFTW_PRUNE;
+		break;
+	case BFTW_STOP:
+		state->action = BFTW_STOP;
+		state->quit = true;
+		break;
+	}
+
+	return true;
+}
+
+/**
+ * -i?regex test.
+ */
+bool eval_regex(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const char *path = state->ftwbuf->path;
+
+	int ret = bfs_regexec(expr->regex, path, BFS_REGEX_ANCHOR);
+	if (ret < 0) {
+		char *str = bfs_regerror(expr->regex);
+		if (str) {
+			eval_error(state, "%s.\n", str);
+			free(str);
+		} else {
+			eval_error(state, "bfs_regerror(): %s.\n", errstr());
+		}
+	}
+
+	return ret > 0;
+}
+
+/**
+ * Merged -i?regex tests.
+ */
+bool eval_regexes(const struct bfs_expr *expr, struct bfs_eval *state) {
+	return eval_regex(expr, state);
+}
+
+/**
+ * -samefile test.
+ */
+bool eval_samefile(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	if (statbuf->dev != expr->dev || statbuf->ino != expr->ino) {
+		return false;
+	}
+
+	if (expr->samefile_left > 0) {
+		// Every name has been found once the count reaches zero
+		struct bfs_expr *mut = (struct bfs_expr *)expr;
+		if (--mut->samefile_left == 0) {
+			state->action = BFTW_STOP;
+		}
+	}
+
+	return true;
+}
+
+/** The size of each -size unit. */
+static const off_t size_scales[] = {
+	[BFS_BLOCKS] = 512,
+	[BFS_BYTES] = 1,
+	[BFS_WORDS] = 2,
+	[BFS_KB] = 1LL << 10,
+	[BFS_MB] = 1LL << 20,
+	[BFS_GB] = 1LL << 30,
+	[BFS_TB] = 1LL << 40,
+	[BFS_PB] = 1LL << 50,
+};
+
+/**
+ * -size test.
+ */
+bool eval_size(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	off_t scale = size_scales[expr->size_unit];
+	off_t size = (statbuf->size + scale - 1) / scale; // Round up
+	return bfs_expr_cmp(expr, size);
+}
+
+/**
+ * -sparse test.
+ */
+bool eval_sparse(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	blkcnt_t expected = (statbuf->size + BFS_STAT_BLKSIZE - 1) / BFS_STAT_BLKSIZE;
+	return statbuf->blocks < expected;
+}
+
+/**
+ * -type test.
+ */
+bool eval_type(const struct bfs_expr *expr, struct bfs_eval *state) {
+	return (1 << state->ftwbuf->type) & expr->num;
+}
+
+/**
+ * -xattr test.
+ */
+bool eval_xattr(const struct bfs_expr *expr, struct bfs_eval *state) {
+	int ret = bfs_check_xattrs(state->ftwbuf, eval_fsade_cache(expr));
+	if (ret >= 0) {
+		return ret;
+	} else {
+		eval_report_error(state);
+		return false;
+	}
+}
+
+/**
+ * -xattrname test.
+ */
+bool eval_xattrname(const struct bfs_expr *expr, struct bfs_eval *state) {
+	int ret = bfs_check_xattr_named(state->ftwbuf, expr->argv[1], eval_fsade_cache(expr));
+	if (ret >= 0) {
+		return ret;
+	} else {
+		eval_report_error(state);
+		return false;
+	}
+}
+
+/**
+ * -xtype test.
+ */
+bool eval_xtype(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	enum bfs_stat_flags flags = ftwbuf->stat_flags ^ (BFS_STAT_NOFOLLOW | BFS_STAT_TRYFOLLOW);
+	enum bfs_type type = bftw_type(ftwbuf, flags);
+
+	// GNU find treats ELOOP as a broken symbolic link for -xtype l
+	// (but not -L -type l)
+	if ((flags & BFS_STAT_TRYFOLLOW) && type == BFS_ERROR && errno == ELOOP) {
+		type = BFS_LNK;
+	}
+
+	if (type == BFS_ERROR) {
+		eval_report_error(state);
+		return false;
+	} else {
+		return (1 << type) & expr->num;
+	}
+}
+
+/**
+ * clock_gettime() wrapper.
+ */
+static int eval_gettime(struct bfs_eval *state, struct timespec *ts) {
+	clockid_t clock = CLOCK_REALTIME;
+
+#if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0
+	if (sysoption(MONOTONIC_CLOCK) > 0) {
+		clock = CLOCK_MONOTONIC;
+	}
+#endif
+
+	int ret = clock_gettime(clock, ts);
+	if (ret != 0) {
+		bfs_warning(state->ctx, "%pP: clock_gettime(): %s.\n", state->ftwbuf, errstr());
+	}
+	return ret;
+}
+
+/**
+ * Record an elapsed time, scaled up by some factor.
+ */
+static void timespec_elapsed(struct timespec *elapsed, const struct timespec *start, const struct timespec *end, size_t scale) {
+	long long ns = 1000000000LL * (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec);
+	ns *= (long long)scale;
+	elapsed->tv_sec += ns / 1000000000LL;
+	elapsed->tv_nsec += ns % 1000000000LL;
+	if (elapsed->tv_nsec < 0) {
+		elapsed->tv_nsec += 1000000000L;
+		--elapsed->tv_sec;
+	} else if (elapsed->tv_nsec >= 1000000000L) {
+		elapsed->tv_nsec -= 1000000000L;
+		++elapsed->tv_sec;
+	}
+}
+
+/**
+ * Evaluate an expression.
+ */
+static bool eval_expr(struct bfs_expr *expr, struct bfs_eval *state) {
+	// Copies of the same pure expression only need to be evaluated once
+	uint64_t cse = 0;
+	if (expr->cse >= 0) {
+		cse = (uint64_t)1 << expr->cse;
+		if (state->cse_known & cse) {
+			return state->cse_values & cse;
+		}
+	}
+
+	struct timespec start, end;
+	bool time = state->profile;
+	if (time) {
+		if (eval_gettime(state, &start) != 0) {
+			time = false;
+		}
+	}
+
+	bfs_assert(!state->quit);
+
+	bool ret = expr->eval_fn(expr, state);
+
+	if (time) {
+		if (eval_gettime(state, &end) == 0) {
+			timespec_elapsed(&expr->elapsed, &start, &end, state->profile_scale);
+		}
+	}
+
+	// These are only reported by -D rates, which disables -parallel
+	if (!state->parallel) {
+		++expr->evaluations;
+		if (ret) {
+			++expr->successes;
+		}
+	}
+
+	if (bfs_expr_never_returns(expr)) {
+		bfs_assert(state->quit);
+	} else if (!state->quit) {
+		bfs_assert(!expr->always_true || ret);
+		bfs_assert(!expr->always_false || !ret);
+	}
+
+	if (cse && !state->quit) {
+		state->cse_known |= cse;
+		if (ret) {
+			state->cse_values |= cse;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Evaluate a negation.
+ */
+bool eval_not(const struct bfs_expr *expr, struct bfs_eval *state) {
+	return !eval_expr(bfs_expr_children(expr), state);
+}
+
+/**
+ * Evaluate a conjunction.
+ */
+bool eval_and(const struct bfs_expr *expr, struct bfs_eval *state) {
+	for_expr (child, expr) {
+		if (!eval_expr(child, state) || state->quit) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Evaluate a disjunction.
+ */
+bool eval_or(const struct bfs_expr *expr, struct bfs_eval *state) {
+	for_expr (child, expr) {
+		if (eval_expr(child, state) || state->quit) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Evaluate the comma operator.
+ */
+bool eval_comma(const struct bfs_expr *expr, struct bfs_eval *state) {
+	bool ret uninit(false);
+
+	for_expr (child, expr) {
+		ret = eval_expr(child, state);
+		if (state->quit) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Instructions for compiled expressions.
+ */
+enum eval_opcode {
+	/** Call eval_expr(), for primaries that rely on its bookkeeping. */
+	EVAL_EXPR,
+	/** Call expr->eval_fn() indirectly. */
+	EVAL_CALL,
+	/** Call eval_name() directly. */
+	EVAL_NAME,
+	/** Call eval_size() directly. */
+	EVAL_SIZE,
+	/** Call eval_type() directly. */
+	EVAL_TYPE,
+	/** Check a run of fused stat() comparisons. */
+	EVAL_RANGES,
+	/** Negate the result. */
+	EVAL_NOT,
+	/** Jump to the target if the result is false. */
+	EVAL_JUMP_FALSE,
+	/** Jump to the target if the result is true. */
+	EVAL_JUMP_TRUE,
+};
+
+/**
+ * A single compiled instruction.
+ */
+struct eval_op {
+	/** The opcode. */
+	enum eval_opcode opcode;
+	/** The jump target, for EVAL_JUMP_*, or the first range, for EVAL_RANGES. */
+	size_t target;
+	/** The number of ranges, for EVAL_RANGES. */
+	size_t count;
+	/** The expression to evaluate, for EVAL_CALL etc. */
+	struct bfs_expr *expr;
+};
+
+/**
+ * The stat() field checked by a fused comparison.
+ */
+enum eval_key {
+	EVAL_KEY_SIZE,
+	EVAL_KEY_UID,
+	EVAL_KEY_GID,
+	EVAL_KEY_LINKS,
+	EVAL_KEY_INO,
+	/** A timestamp, rounded up to whole seconds past the reference time. */
+	EVAL_KEY_TIME,
+};
+
+/**
+ * A stat() comparison, reduced to an inclusive range of raw field values.
+ */
+struct eval_range {
+	/** The field to check. */
+	enum eval_key key;
+	/** The timestamp, for EVAL_KEY_TIME. */
+	enum bfs_stat_field field;
+	/** The reference nanoseconds, for EVAL_KEY_TIME. */
+	long nsec;
+	/** The smallest matching value. */
+	long long min;
+	/** The largest matching value. */
+	long long max;
+	/** The original expression. */
+	const struct bfs_expr *expr;
+};
+
+/**
+ * An expression compiled to a flat program.  Short-circuiting operators become
+ * forward jumps, so evaluation is a single loop with no recursion.
+ */
+struct eval_prog {
+	/** The instructions. */
+	struct eval_op *ops;
+	/** The number of instructions. */
+	size_t len;
+	/** The ranges for EVAL_RANGES instructions. */
+	struct eval_range *ranges;
+	/** The number of ranges. */
+	size_t nranges;
+};
+
+/** Saturating addition. */
+static long long sat_add(long long a, long long b) {
+	if (b > 0 && a > LLONG_MAX - b) {
+		return LLONG_MAX;
+	} else if (b < 0 && a < LLONG_MIN - b) {
+		return LLONG_MIN;
+	} else {
+		return a + b;
+	}
+}
+
+/** Saturating subtraction. */
+static long long sat_sub(long long a, long long b) {
+	if (b < 0 && a > LLONG_MAX + b) {
+		return LLONG_MAX;
+	} else if (b > 0 && a < LLONG_MIN + b) {
+		return LLONG_MIN;
+	} else {
+		return a - b;
+	}
+}
+
+/** Saturating multiplication by a positive number. */
+static long long sat_mul(long long a, long long b) {
+	if (a > LLONG_MAX / b) {
+		return LLONG_MAX;
+	} else if (a < LLONG_MIN / b) {
+		return LLONG_MIN;
+	} else {
+		return a * b;
+	}
+}
+
+/**
+ * Set a range from a comparison, given the range [lo, hi] that compares equal.
+ * Saturated bounds mean the equal range extends past the representable values.
+ */
+static void eval_range_cmp(struct eval_range *range, enum bfs_int_cmp cmp, long long lo, long long hi) {
+	switch (cmp) {
+	case BFS_INT_EQUAL:
+		range->min = lo;
+		range->max = hi;
+		return;
+	case BFS_INT_LESS:
+		if (lo == LLONG_MIN) {
+			range->min = LLONG_MAX;
+			range->max = LLONG_MIN;
+		} else {
+			range->min = LLONG_MIN;
+			range->max = lo - 1;
+		}
+		return;
+	case BFS_INT_GREATER:
+		if (hi == LLONG_MAX) {
+			range->min = LLONG_MAX;
+			range->max = LLONG_MIN;
+		} else {
+			range->min = hi + 1;
+			range->max = LLONG_MAX;
+		}
+		return;
+	}
+
+	bfs_bug("Invalid comparison mode");
+}
+
+/** Reduce a stat() comparison to a range, if possible. */
+static bool eval_range_init(struct eval_range *range, const struct bfs_expr *expr) {
+	bfs_eval_fn *fn = expr->eval_fn;
+	long long n = expr->num;
+
+	if (expr->cse >= 0) {
+		return false;
+	}
+
+	range->expr = expr;
+	range->field = 0;
+	range->nsec = 0;
+
+	if (fn == eval_size) {
+		// ceil(size / scale) == n  <=>  (n - 1) * scale < size <= n * scale
+		long long scale = size_scales[expr->size_unit];
+		long long hi = sat_mul(n, scale);
+		long long lo = sat_add(sat_mul(sat_sub(n, 1), scale), 1);
+		range->key = EVAL_KEY_SIZE;
+		eval_range_cmp(range, expr->int_cmp, lo, hi);
+		return true;
+	} else if (fn == eval_uid) {
+		range->key = EVAL_KEY_UID;
+	} else if (fn == eval_gid) {
+		range->key = EVAL_KEY_GID;
+	} else if (fn == eval_links) {
+		range->key = EVAL_KEY_LINKS;
+	} else if (fn == eval_inum) {
+		range->key = EVAL_KEY_INO;
+	} else if (fn == eval_time || fn == eval_newer) {
+		// With t rounded up to whole seconds past the reference nanoseconds,
+		// timespec_diff(ref, t) == ref.tv_sec - t
+		range->key = EVAL_KEY_TIME;
+		range->field = expr->stat_field;
+		range->nsec = expr->reftime.tv_nsec;
+		long long ref = expr->reftime.tv_sec;
+
+		if (fn == eval_newer) {
+			eval_range_cmp(range, BFS_INT_GREATER, ref, ref);
+			return true;
+		}
+
+		long long unit = 1;
+		switch (expr->time_unit) {
+		case BFS_DAYS:
+			unit = 60 * 60 * 24;
+			break;
+		case BFS_MINUTES:
+			unit = 60;
+			break;
+		case BFS_SECONDS:
+			break;
+		}
+
+		// The differences that truncate to n
+		long long dlo, dhi;
+		if (n > 0) {
+			dlo = sat_mul(n, unit);
+			dhi = sat_add(dlo, unit - 1);
+		} else if (n < 0) {
+			dhi = sat_mul(n, unit);
+			dlo = sat_sub(dhi, unit - 1);
+		} else {
+			dlo = 1 - unit;
+			dhi = unit - 1;
+		}
+
+		// The difference decreases as the time increases
+		enum bfs_int_cmp cmp = expr->int_cmp;
+		if (cmp == BFS_INT_LESS) {
+			cmp = BFS_INT_GREATER;
+		} else if (cmp == BFS_INT_GREATER) {
+			cmp = BFS_INT_LESS;
+		}
+		eval_range_cmp(range, cmp, sat_sub(ref, dhi), sat_sub(ref, dlo));
+		return true;
+	} else {
+		return false;
+	}
+
+	eval_range_cmp(range, expr->int_cmp, n, n);
+	return true;
+}
+
+/** Get the value of a range's field. */
+static long long eval_range_key(const struct eval_range *range, const struct bfs_stat *statbuf) {
+	switch (range->key) {
+	case EVAL_KEY_SIZE:
+		return statbuf->size;
+	case EVAL_KEY_UID:
+		return statbuf->uid;
+	case EVAL_KEY_GID:
+		return statbuf->gid;
+	case EVAL_KEY_LINKS:
+		return statbuf->nlink;
+	case EVAL_KEY_INO:
+		return statbuf->ino;
+	case EVAL_KEY_TIME: {
+		const struct timespec *time = bfs_stat_time(statbuf, range->field);
+		return (long long)time->tv_sec + (time->tv_nsec > range->nsec);
+	}
+	}
+
+	bfs_bug("Invalid range key");
+	return 0;
+}
+
+/**
+ * Check a run of fused stat() comparisons, with a single bftw_stat() and no
+ * calls per comparison.
+ */
+static bool eval_ranges(const struct eval_range *ranges, size_t count, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		const struct eval_range *range = &ranges[i];
+		if ((statbuf->mask & range->field) != range->field) {
+			// Let the original test report the missing timestamp
+			return range->expr->eval_fn(range->expr, state);
+		}
+
+		long long key = eval_range_key(range, statbuf);
+		if (key < range->min || key > range->max) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Append an instruction to a program. */
+static struct eval_op *eval_emit(struct eval_prog *prog, enum eval_opcode opcode, struct bfs_expr *expr) {
+	struct eval_op *op = RESERVE(struct eval_op, &prog->ops, &prog->len);
+	if (op) {
+		op->opcode = opcode;
+		op->target = SIZE_MAX;
+		op->count = 0;
+		op->expr = expr;
+	}
+	return op;
+}
+
+/**
+ * Fuse a run of stat() comparisons in a conjunction into one instruction.
+ *
+ * @param child
+ *         The first operand of the run.
+ * @param[out] next
+ *         Will hold the operand after the run, if any were fused.
+ * @return
+ *         1 if the run was fused, 0 if it was too short, or -1 on error.
+ */
+static int eval_compile_ranges(struct eval_prog *prog, struct bfs_expr *child, struct bfs_expr **next) {
+	size_t start = prog->nranges;
+
+	struct eval_range range;
+	struct bfs_expr *expr;
+	for (expr = child; expr && eval_range_init(&range, expr); expr = expr->next) {
+		struct eval_range *slot = RESERVE(struct eval_range, &prog->ranges, &prog->nranges);
+		if (!slot) {
+			return -1;
+		}
+		*slot = range;
+	}
+
+	size_t count = prog->nranges - start;
+	if (count < 2) {
+		// A lone comparison is just as fast as a direct call
+		prog->nranges = start;
+		return 0;
+	}
+
+	struct eval_op *op = eval_emit(prog, EVAL_RANGES, child);
+	if (!op) {
+		return -1;
+	}
+	op->target = start;
+	op->count = count;
+
+	*next = expr;
+	return 1;
+}
+
+/** Compile an expression into a program. */
+static int eval_compile_expr(struct eval_prog *prog, struct bfs_expr *expr) {
+	bfs_eval_fn *fn = expr->eval_fn;
+	struct bfs_expr *children = bfs_expr_children(expr);
+
+	if (expr->cse >= 0) {
+		// eval_expr() remembers the results of common subexpressions
+		return eval_emit(prog, EVAL_EXPR, expr) ? 0 : -1;
+	}
+
+	if (fn == eval_not) {
+		if (eval_compile_expr(prog, children) != 0) {
+			return -1;
+		}
+		return eval_emit(prog, EVAL_NOT, NULL) ? 0 : -1;
+	}
+
+	if (children && (fn == eval_and || fn == eval_or || fn == eval_comma)) {
+		enum eval_opcode jump = fn == eval_and ? EVAL_JUMP_FALSE : EVAL_JUMP_TRUE;
+
+		// The pending jumps are chained together through their targets
+		size_t chain = SIZE_MAX;
+		for (struct bfs_expr *child = children, *next; child; child = next) {
+			next = child->next;
+
+			int fused = fn == eval_and ? eval_compile_ranges(prog, child, &next) : 0;
+			if (fused < 0) {
+				return -1;
+			} else if (!fused && eval_compile_expr(prog, child) != 0) {
+				return -1;
+			}
+
+			if (fn != eval_comma && next) {
+				struct eval_op *op = eval_emit(prog, jump, NULL);
+				if (!op) {
+					return -1;
+				}
+				op->target = chain;
+				chain = prog->len - 1;
+			}
+		}
+
+		// Point all the jumps past the end
+		while (chain != SIZE_MAX) {
+			struct eval_op *op = &prog->ops[chain];
+			chain = op->target;
+			op->target = prog->len;
+		}
+		return 0;
+	}
+
+	enum eval_opcode opcode = EVAL_CALL;
+	if (fn == eval_limit) {
+		// -limit counts its own evaluations
+		opcode = EVAL_EXPR;
+	} else if (fn == eval_name) {
+		opcode = EVAL_NAME;
+	} else if (fn == eval_size) {
+		opcode = EVAL_SIZE;
+	} else if (fn == eval_type) {
+		opcode = EVAL_TYPE;
+	}
+	return eval_emit(prog, opcode, expr) ? 0 : -1;
+}
+
+/** Free a compiled program. */
+static void eval_prog_free(struct eval_prog *prog) {
+	free(prog->ranges);
+	prog->ranges = NULL;
+	prog->nranges = 0;
+
+	free(prog->ops);
+	prog->ops = NULL;
+	prog->len = 0;
+}
+
+/** Compile an expression, or leave the program empty on failure. */
+static void eval_compile(struct eval_prog *prog, struct bfs_expr *expr) {
+	prog->ops = NULL;
+	prog->len = 0;
+	prog->ranges = NULL;
+	prog->nranges = 0;
+
+	if (eval_compile_expr(prog, expr) != 0) {
+		eval_prog_free(prog);
+	}
+}
+
+/** Run a compiled program. */
+static void eval_prog_run(const struct eval_prog *prog, struct bfs_eval *state) {
+	const struct eval_op *ops = prog->ops;
+	size_t len = prog->len;
+	bool ret = true;
+
+	for (size_t i = 0; i < len;) {
+		const struct eval_op *op = &ops[i++];
+
+		switch (op->opcode) {
+		case EVAL_EXPR:
+			ret = eval_expr(op->expr, state);
+			break;
+		case EVAL_CALL:
+			ret = op->expr->eval_fn(op->expr, state);
+			break;
+		case EVAL_NAME:
+			ret = eval_name(op->expr, state);
+			break;
+		case EVAL_SIZE:
+			ret = eval_size(op->expr, state);
+			break;
+		case EVAL_TYPE:
+			ret = eval_type(op->expr, state);
+			break;
+		case EVAL_RANGES:
+			ret = eval_ranges(prog->ranges + op->target, op->count, state);
+			break;
+
+		case EVAL_NOT:
+			ret = !ret;
+			continue;
+		case EVAL_JUMP_FALSE:
+			if (!ret) {
+				i = op->target;
+			}
+			continue;
+		case EVAL_JUMP_TRUE:
+			if (ret) {
+				i = op->target;
+			}
+			continue;
+		}
+
+		if (state->quit) {
+			break;
+		}
+	}
+}
+
+/** Evaluate the main expression, with the compiled program if we have one. */
+static void eval_main(const struct eval_prog *prog, struct bfs_eval *state) {
+	if (prog->ops) {
+		eval_prog_run(prog, state);
+	} else {
+		eval_expr(state->ctx->expr, state);
+	}
+}
+
+/** How often to update the status bar (0.1s). */
+#define STATUS_INTERVAL 100000000L
+
+/**
+ * A background thread that tells the main thread when to update the status
+ * bar, so the hot path only has to check a flag.
+ */
+struct status_ticker {
+	/** Set periodically by the ticker thread. */
+	atomic bool tick;
+
+	/** Whether the thread is running. */
+	bool running;
+	/** The ticker thread. */
+	pthread_t thread;
+	/** Protects stop. */
+	pthread_mutex_t mutex;
+	/** Signalled to stop the thread. */
+	pthread_cond_t cond;
+	/** Whether the thread should stop. */
+	bool stop;
+
+	/** The time of the last status update. */
+	struct timespec last;
+	/** The number of files visited at the last update. */
+	size_t last_count;
+	/** The smoothed visit rate, in files per second. */
+	double rate;
+	/** The number of directories read at the last update. */
+	size_t last_dirs;
+	/** The smoothed directory rate, in directories per second. */
+	double dir_rate;
+};
+
+/** Ticker thread entry point. */
+static void *status_ticker_fn(void *ptr) {
+	struct status_ticker *ticker = ptr;
+
+	mutex_lock(&ticker->mutex);
+	while (!ticker->stop) {
+		struct timespec deadline;
+		if (clock_gettime(CLOCK_REALTIME, &deadline) != 0) {
+			break;
+		}
+		deadline.tv_nsec += STATUS_INTERVAL;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			++deadline.tv_sec;
+		}
+
+		int ret = pthread_cond_timedwait(&ticker->cond, &ticker->mutex, &deadline);
+		if (ret == ETIMEDOUT) {
+			store(&ticker->tick, true, relaxed);
+		}
+	}
+	mutex_unlock(&ticker->mutex);
+
+	return NULL;
+}
+
+/** Start the status ticker, if it isn't already running. */
+static void status_ticker_start(struct status_ticker *ticker, size_t count, size_t dirs) {
+	if (ticker->running) {
+		return;
+	}
+
+	ticker->stop = false;
+	ticker->last = (struct timespec){0};
+	ticker->last_count = count;
+	ticker->rate = 0.0;
+	ticker->last_dirs = dirs;
+	ticker->dir_rate = 0.0;
+
+	// Draw the bar once right away
+	store(&ticker->tick, true, relaxed);
+
+	if (mutex_init(&ticker->mutex, NULL) != 0) {
+		return;
+	}
+	if (cond_init(&ticker->cond, NULL) != 0) {
+		mutex_destroy(&ticker->mutex);
+		return;
+	}
+	if (thread_create(&ticker->thread, NULL, status_ticker_fn, ticker) != 0) {
+		cond_destroy(&ticker->cond);
+		mutex_destroy(&ticker->mutex);
+		return;
+	}
+
+	ticker->running = true;
+}
+
+/** Stop the status ticker. */
+static void status_ticker_stop(struct status_ticker *ticker) {
+	if (!ticker->running) {
+		return;
+	}
+
+	mutex_lock(&ticker->mutex);
+	ticker->stop = true;
+	cond_signal(&ticker->cond);
+	mutex_unlock(&ticker->mutex);
+
+	thread_join(ticker->thread, NULL);
+	cond_destroy(&ticker->cond);
+	mutex_destroy(&ticker->mutex);
+	ticker->running = false;
+}
+
+/** Get the total size of all the arena slabs, in KiB. */
+static size_t eval_arena_kib(void) {
+	size_t count;
+	const struct arena_stats *stats = arena_stats(&count);
+
+	size_t bytes = 0;
+	for (size_t i = 0; i < count; ++i) {
+		bytes += stats[i].bytes - stats[i].trimmed;
+	}
+	return (bytes + 1023) / 1024;
+}
+
+/** Update a smoothed rate. */
+static double status_rate(double old, size_t delta, double secs) {
+	double rate = delta / secs;
+	if (old > 0.0) {
+		// Smooth out the rate over roughly the last second
+		rate = 0.9 * old + 0.1 * rate;
+	}
+	return rate;
+}
+
+/** Format the right-hand side of the status bar. */
+static dchar *eval_status_rhs(const struct bfs_eval *state, const struct status_ticker *ticker, size_t count, const struct bftw_progress *progress, bool verbose) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	dchar *rhs;
+	if (verbose) {
+		rhs = dstrprintf(" (visited: %'zu; depth: %2zu; %'.0f/s; dirs: %'zu, %'.0f/s; queued: %'zu; io: %zu; fds: %zu/%zu",
+			count, ftwbuf->depth, ticker->rate,
+			progress->dirs, ticker->dir_rate, progress->queued,
+			progress->inflight, progress->fds, progress->fd_limit);
+	} else {
+		rhs = dstrprintf(" (visited: %'zu; depth: %2zu; %'.0f/s", count, ftwbuf->depth, ticker->rate);
+	}
+	if (!rhs) {
+		return NULL;
+	}
+
+	int ret;
+	if (state->ctx->debug & DEBUG_MEM) {
+		ret = dstrcatf(&rhs, "; mem: %'zu KiB)", eval_arena_kib());
+	} else {
+		ret = dstrcat(&rhs, ")");
+	}
+	if (ret != 0) {
+		dstrfree(rhs);
+		return NULL;
+	}
+
+	return rhs;
+}
+
+/** Update the status bar. */
+static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct status_ticker *ticker, size_t count, const struct bftw_progress *progress) {
+	struct timespec now;
+	if (eval_gettime(state, &now) == 0) {
+		struct timespec elapsed = {0};
+		timespec_elapsed(&elapsed, &ticker->last, &now, 1);
+
+		double secs = elapsed.tv_sec + elapsed.tv_nsec / 1.0e9;
+		bool first = ticker->last.tv_sec == 0 && ticker->last.tv_nsec == 0;
+		if (!first && secs > 0.0) {
+			ticker->rate = status_rate(ticker->rate, count - ticker->last_count, secs);
+			ticker->dir_rate = status_rate(ticker->dir_rate, progress->dirs - ticker->last_dirs, secs);
+		}
+
+		ticker->last = now;
+		ticker->last_count = count;
+		ticker->last_dirs = progress->dirs;
+	}
+
+	size_t width = bfs_bar_width(bar);
+	if (width < 3) {
+		return;
+	}
+
+	const struct BFTW *ftwbuf = state->ftwbuf;
+
+	dchar *status = NULL;
+	dchar *rhs = eval_status_rhs(state, ticker, count, progress, true);
+	if (!rhs) {
+		return;
+	}
+
+	// Leave some room for the path, or fall back to the short form
+	size_t rhslen = xstrwidth(rhs);
+	if (3 + rhslen + width / 4 > width) {
+		dstrfree(rhs);
+		rhs = eval_status_rhs(state, ticker, count, progress, false);
+		if (!rhs) {
+			return;
+		}
+		rhslen = xstrwidth(rhs);
+	}
+
+	if (3 + rhslen > width) {
+		dstresize(&rhs, 0);
+		rhslen = 0;
+	}
+
+	status = dstralloc(0);
+	if (!status) {
+		goto out;
+	}
+
+	const char *path = ftwbuf->path;
+	size_t pathlen = ftwbuf->nameoff;
+	if (ftwbuf->depth == 0) {
+		pathlen = strlen(path);
+	}
+
+	// Escape weird filename characters
+	if (dstrnescat(&status, path, pathlen, WESC_TTY) != 0) {
+		goto out;
+	}
+	pathlen = dstrlen(status);
+
+	// Try to make sure even wide characters fit in the status bar
+	size_t pathmax = width - rhslen - 3;
+	size_t pathwidth = 0;
+	size_t lhslen = 0;
+	mbstate_t mb = {0};
+	for (size_t i = lhslen; lhslen < pathlen; lhslen = i) {
+		wint_t wc = xmbrtowc(status, &i, pathlen, &mb);
+		int cwidth;
+		if (wc == WEOF) {
+			// Invalid byte sequence, assume a single-width '?'
+			cwidth = 1;
+		} else {
+			cwidth = xwcwidth(wc);
+			if (cwidth < 0) {
+				cwidth = 0;
+			}
+		}
+
+		if (pathwidth + cwidth > pathmax) {
+			break;
+		}
+		pathwidth += cwidth;
+	}
+	dstresize(&status, lhslen);
+
+	if (dstrcat(&status, "...") != 0) {
+		goto out;
+	}
+
+	while (pathwidth < pathmax) {
+		if (dstrapp(&status, ' ') != 0) {
+			goto out;
+		}
+		++pathwidth;
+	}
+
+	if (dstrdcat(&status, rhs) != 0) {
+		goto out;
+	}
+
+	bfs_bar_update(bar, status);
+
+out:
+	dstrfree(status);
+	dstrfree(rhs);
+}
+
+/** Check if we've seen a file before. */
+static bool eval_file_unique(struct bfs_eval *state, struct idfilter *seen) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
 
-		return fprintf(file, " %s%*s", name, *width - len, "");
+	int ret = idfilter_insert(seen, statbuf->dev, statbuf->ino);
+	if (ret < 0) {
+		eval_report_error(state);
+		return false;
+	} else if (ret == 0) {
+		state->action = BFTW_PRUNE;
+		return false;
 	} else {
-		int ret = fprintf(file, " %-*ju", *width, id);
-		if (ret >= 0 && *width < ret - 1) {
-			*width = ret - 1;
-		}
-		return ret;
+		return true;
 	}
 }
 
-/**
- * -f?ls action.
- */
-bool eval_fls(const struct bfs_expr *expr, struct bfs_eval *state) {
-	CFILE *cfile = expr->cfile;
-	FILE *file = cfile->file;
-	const struct bfs_ctx *ctx = state->ctx;
+/** Check if we've already descended into a directory that's mounted more than once. */
+static bool eval_mount_unique(struct bfs_eval *state, const struct idset *mounts, struct idset *mounted) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (bftw_type(ftwbuf, ftwbuf->stat_flags) != BFS_DIR) {
+		return true;
+	}
+
 	const struct bfs_stat *statbuf = eval_stat(state);
 	if (!statbuf) {
-		goto done;
+		return false;
+	} else if (!idset_contains(mounts, statbuf->dev, statbuf->ino)) {
+		return true;
 	}
 
-	// ls -l prints non-path text in the "normal" color, so do the same
-	if (cfprintf(cfile, "${no}") < 0) {
-		goto error;
+	int ret = idset_insert(mounted, statbuf->dev, statbuf->ino);
+	if (ret < 0) {
+		eval_report_error(state);
+		return false;
+	} else if (ret == 0) {
+		state->action = BFTW_PRUNE;
+		return false;
+	} else {
+		return true;
 	}
+}
 
-	uintmax_t ino = statbuf->ino;
-	uintmax_t block_size = ctx->posixly_correct ? 512 : 1024;
-	uintmax_t blocks = ((uintmax_t)statbuf->blocks * BFS_STAT_BLKSIZE + block_size - 1) / block_size;
-	char mode[11];
-	xstrmode(statbuf->mode, mode);
-	char acl = bfs_check_acl(ftwbuf) > 0 ? '+' : ' ';
-	uintmax_t nlink = statbuf->nlink;
-	if (fprintf(file, "%9ju %6ju %s%c %2ju", ino, blocks, mode, acl, nlink) < 0) {
-		goto error;
+/** A root of the search, for -dedup. */
+struct eval_root {
+	/** The IDs of the root and each of its ancestors, up to the root directory. */
+	struct idset_slot *chain;
+	/** The length of the chain (0 if we couldn't find it). */
+	size_t len;
+};
+
+/** Add a file ID to a root's chain. */
+static int eval_root_push(struct eval_root *root, const struct bfs_stat *buf) {
+	struct idset_slot *slot = RESERVE(struct idset_slot, &root->chain, &root->len);
+	if (!slot) {
+		return -1;
 	}
 
-	const struct passwd *pwd = bfs_getpwuid(ctx->users, statbuf->uid);
-	static int uwidth = 8;
-	if (print_owner(file, pwd ? pwd->pw_name : NULL, statbuf->uid, &uwidth) < 0) {
-		goto error;
+	slot->dev = buf->dev;
+	slot->ino = buf->ino;
+	return 0;
+}
+
+/** Find the ancestors of a root by following "..". */
+static int eval_root_chain(const struct bfs_ctx *ctx, const char *path, struct eval_root *root) {
+	enum bfs_stat_flags sflags = BFS_STAT_NOFOLLOW;
+	if (ctx->flags & (BFTW_FOLLOW_ROOTS | BFTW_FOLLOW_ALL)) {
+		sflags = BFS_STAT_TRYFOLLOW;
 	}
 
-	const struct group *grp = bfs_getgrgid(ctx->groups, statbuf->gid);
-	static int gwidth = 8;
-	if (print_owner(file, grp ? grp->gr_name : NULL, statbuf->gid, &gwidth) < 0) {
-		goto error;
+	struct bfs_stat buf;
+	if (bfs_stat(AT_FDCWD, path, sflags, &buf) != 0 || eval_root_push(root, &buf) != 0) {
+		return -1;
 	}
 
-	if (ftwbuf->type == BFS_BLK || ftwbuf->type == BFS_CHR) {
-		int ma = xmajor(statbuf->rdev);
-		int mi = xminor(statbuf->rdev);
-		if (fprintf(file, " %3d, %3d", ma, mi) < 0) {
-			goto error;
+	const int oflags = O_SEARCH | O_CLOEXEC | O_DIRECTORY;
+	int fd;
+	if (S_ISDIR(buf.mode)) {
+		int dfd = open(path, oflags);
+		if (dfd < 0) {
+			return -1;
 		}
+		fd = openat(dfd, "..", oflags);
+		xclose(dfd);
 	} else {
-		uintmax_t size = statbuf->size;
-		if (fprintf(file, " %8ju", size) < 0) {
-			goto error;
+		char *dir = xdirname(path);
+		if (!dir) {
+			return -1;
 		}
+		fd = open(dir, oflags);
+		free(dir);
 	}
 
-	time_t time = statbuf->mtime.tv_sec;
-	time_t now = ctx->now.tv_sec;
-	time_t six_months_ago = now - 6 * 30 * 24 * 60 * 60;
-	time_t tomorrow = now + 24 * 60 * 60;
-	struct tm tm;
-	if (!localtime_r(&time, &tm)) {
-		goto error;
-	}
-	char time_str[256];
-	size_t time_ret;
-	if (time <= six_months_ago || time >= tomorrow) {
-		time_ret = strftime(time_str, sizeof(time_str), "%b %e  %Y", &tm);
-	} else {
-		time_ret = strftime(time_str, sizeof(time_str), "%b %e %H:%M", &tm);
-	}
-	if (time_ret == 0) {
-		errno = EOVERFLOW;
-		goto error;
-	}
-	if (cfprintf(cfile, " %s${rs}", time_str) < 0) {
-		goto error;
-	}
+	int ret = -1;
+	while (fd >= 0) {
+		if (bfs_stat(fd, NULL, BFS_STAT_NOSYNC, &buf) != 0) {
+			goto fail;
+		}
 
-	if (cfprintf(cfile, " %pP", ftwbuf) < 0) {
-		goto error;
-	}
+		// The root directory is its own parent
+		const struct idset_slot *last = &root->chain[root->len - 1];
+		if (last->dev == buf.dev && last->ino == buf.ino) {
+			ret = 0;
+			break;
+		}
 
-	if (ftwbuf->type == BFS_LNK) {
-		if (cfprintf(cfile, " -> %pL", ftwbuf) < 0) {
-			goto error;
+		if (eval_root_push(root, &buf) != 0) {
+			goto fail;
 		}
-	}
 
-	if (fputc('\n', file) == EOF) {
-		goto error;
+		int parent = openat(fd, "..", oflags);
+		xclose(fd);
+		fd = parent;
 	}
 
-done:
-	return true;
-
-error:
-	eval_io_error(expr, state);
-	return true;
+fail:
+	if (fd >= 0) {
+		xclose(fd);
+	}
+	if (ret != 0) {
+		free(root->chain);
+		root->chain = NULL;
+		root->len = 0;
+	}
+	return ret;
 }
 
-/**
- * -f?print action.
- */
-bool eval_fprint(const struct bfs_expr *expr, struct bfs_eval *state) {
-	if (cfprintf(expr->cfile, "%pP\n", state->ftwbuf) < 0) {
-		eval_io_error(expr, state);
+/** Check whether a root is covered by another root at the given position of its chain. */
+static bool eval_root_covered(const struct bfs_ctx *ctx, const struct eval_root *root, size_t i) {
+	if (!(ctx->flags & (BFTW_PRUNE_MOUNTS | BFTW_SKIP_MOUNTS))) {
+		return true;
 	}
-	return true;
-}
 
-/**
- * -f?print0 action.
- */
-bool eval_fprint0(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const char *path = state->ftwbuf->path;
-	size_t length = strlen(path) + 1;
-	if (fwrite(path, 1, length, expr->cfile->file) != length) {
-		eval_io_error(expr, state);
+	// -xdev won't cross any mount points on the way down
+	for (size_t j = 1; j <= i; ++j) {
+		if (root->chain[j].dev != root->chain[0].dev) {
+			return false;
+		}
 	}
+
 	return true;
 }
 
 /**
- * -f?printf action.
+ * Skip any roots that are beneath, or the same as, another root (-dedup).
+ *
+ * @param ctx
+ *         The bfs context.
+ * @param[out] npaths
+ *         Will hold the number of remaining roots.
+ * @return
+ *         The remaining roots (to be free()'d), or NULL on failure.
  */
-bool eval_fprintf(const struct bfs_expr *expr, struct bfs_eval *state) {
-	if (bfs_printf(expr->cfile, expr->printf, state->ftwbuf) != 0) {
-		eval_io_error(expr, state);
+static const char **eval_dedup_roots(const struct bfs_ctx *ctx, size_t *npaths) {
+	const char **paths = ALLOC_ARRAY(const char *, ctx->npaths);
+	struct eval_root *roots = ZALLOC_ARRAY(struct eval_root, ctx->npaths);
+	if ((!paths || !roots) && ctx->npaths > 0) {
+		free(roots);
+		free(paths);
+		return NULL;
+	}
+
+	struct idset ids, firsts;
+	idset_init(&ids);
+	idset_init(&firsts);
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < ctx->npaths; ++i) {
+		struct eval_root *root = &roots[i];
+		if (eval_root_chain(ctx, ctx->paths[i], root) == 0) {
+			ok = idset_insert(&ids, root->chain[0].dev, root->chain[0].ino) >= 0;
+		} else if (errno == ENOMEM) {
+			ok = false;
+		}
 	}
 
-	return true;
-}
+	// With -maxdepth, a covering root might not reach as deep, but
+	// identical roots still cover each other
+	if (ctx->maxdepth < INT_MAX) {
+		idset_destroy(&ids);
+		idset_init(&ids);
+	}
 
-/**
- * -printx action.
- */
-bool eval_fprintx(const struct bfs_expr *expr, struct bfs_eval *state) {
-	FILE *file = expr->cfile->file;
-	const char *path = state->ftwbuf->path;
+	*npaths = 0;
+	for (size_t i = 0; ok && i < ctx->npaths; ++i) {
+		const char *path = ctx->paths[i];
+		const struct eval_root *root = &roots[i];
 
-	while (true) {
-		size_t span = strcspn(path, " \t\n\\$'\"`");
-		if (fwrite(path, 1, span, file) != span) {
-			goto error;
+		bool covered = false;
+		for (size_t j = 1; j < root->len && !covered; ++j) {
+			const struct idset_slot *slot = &root->chain[j];
+			covered = idset_contains(&ids, slot->dev, slot->ino) && eval_root_covered(ctx, root, j);
 		}
-		path += span;
 
-		char c = path[0];
-		if (!c) {
-			break;
+		if (!covered && root->len > 0) {
+			int ret = idset_insert(&firsts, root->chain[0].dev, root->chain[0].ino);
+			ok = ret >= 0;
+			covered = ret == 0;
 		}
 
-		char escaped[] = {'\\', c};
-		if (fwrite(escaped, 1, sizeof(escaped), file) != sizeof(escaped)) {
-			goto error;
+		if (covered) {
+			bfs_debug(ctx, DEBUG_SEARCH, "Skipping %pq, since another root covers it\n", path);
+		} else {
+			paths[(*npaths)++] = path;
 		}
-		++path;
 	}
 
-	if (fputc('\n', file) == EOF) {
-		goto error;
+	idset_destroy(&firsts);
+	idset_destroy(&ids);
+	for (size_t i = 0; i < ctx->npaths; ++i) {
+		free(roots[i].chain);
 	}
+	free(roots);
 
-	return true;
-
-error:
-	eval_io_error(expr, state);
-	return true;
+	if (!ok) {
+		free(paths);
+		return NULL;
+	}
+	return paths;
 }
 
+#define DEBUG_FLAG(flags, flag) \
+	do { \
+		if ((flags & flag) || flags == flag) { \
+			fputs(#flag, stderr); \
+			flags ^= flag; \
+			if (flags) { \
+				fputs(" | ", stderr); \
+			} \
+		} \
+	} while (0)
+
 /**
- * -limit action.
+ * Log any stat() calls that happened.
  */
-bool eval_limit(const struct bfs_expr *expr, struct bfs_eval *state) {
-	long long evals = expr->evaluations + 1;
-	if (evals >= expr->num) {
-		state->action = BFTW_STOP;
-		state->quit = true;
+static void debug_stats(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
+	if (!(ctx->debug & DEBUG_STAT)) {
+		return;
 	}
 
-	return true;
+	const struct bftw_stat *bufs = &ftwbuf->stat_bufs;
+
+	if (bufs->stat_err >= 0) {
+		bfs_dlog_stat(ctx, ftwbuf, BFS_STAT_FOLLOW, bufs->stat_err);
+	}
+
+	if (bufs->lstat_err >= 0) {
+		bfs_dlog_stat(ctx, ftwbuf, BFS_STAT_NOFOLLOW, bufs->lstat_err);
+	}
 }
 
+#define DUMP_MAP(value) [value] = #value
+
 /**
- * -prune action.
+ * A file whose evaluation has been handed off to another thread (-parallel).
  */
-bool eval_prune(const struct bfs_expr *expr, struct bfs_eval *state) {
-	state->action = BFTW_PRUNE;
-	return true;
-}
+struct eval_job {
+	/** The next job in the queue. */
+	struct eval_job *next;
+	/** The sequence number of this job, for -ordered. */
+	size_t seq;
+	/** The incremental -path matching state. */
+	uint64_t pathstate;
+	/** A copy of the bftw() data. */
+	struct eval_copy file;
+	/** The path to the file. */
+	char path[];
+};
 
 /**
- * -quit action.
+ * A slot in the -ordered reorder window.
  */
-bool eval_quit(const struct bfs_expr *expr, struct bfs_eval *state) {
-	state->action = BFTW_STOP;
-	state->quit = true;
-	return true;
-}
+struct eval_slot {
+	/** Whether this evaluation has completed. */
+	bool done;
+	/** Its captured output. */
+	struct eval_output out;
+};
 
 /**
- * -i?regex test.
+ * An evaluator thread.
  */
-bool eval_regex(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const char *path = state->ftwbuf->path;
+struct eval_worker {
+	/** The thread handle. */
+	pthread_t id;
+	/** The pool this thread belongs to. */
+	struct eval_pool *pool;
+	/** The number of errors that have occurred on this thread. */
+	size_t nerrors;
+	/** This thread's contribution to the bfs_eval() return value. */
+	int ret;
+};
 
-	int ret = bfs_regexec(expr->regex, path, BFS_REGEX_ANCHOR);
-	if (ret < 0) {
-		char *str = bfs_regerror(expr->regex);
-		if (str) {
-			eval_error(state, "%s.\n", str);
-			free(str);
-		} else {
-			eval_error(state, "bfs_regerror(): %s.\n", errstr());
+/**
+ * A pool of evaluator threads.
+ */
+struct eval_pool {
+	/** The bfs context. */
+	const struct bfs_ctx *ctx;
+	/** The compiled expression. */
+	const struct eval_prog *prog;
+
+	/** Protects the fields below. */
+	pthread_mutex_t mutex;
+	/** Signalled when a job is pushed, or the pool is stopped. */
+	pthread_cond_t jobs_cond;
+	/** Signalled when a job is popped. */
+	pthread_cond_t space_cond;
+	/** The job queue. */
+	struct {
+		struct eval_job *head;
+		struct eval_job **tail;
+	} jobs;
+	/** The number of queued jobs. */
+	size_t size;
+	/** The maximum number of queued jobs. */
+	size_t capacity;
+	/** Whether the pool is shutting down. */
+	bool stop;
+
+	/** Whether to print output in the serial order (-ordered). */
+	bool ordered;
+	/** Protects the reorder window. */
+	pthread_mutex_t order_mutex;
+	/** Signalled when the window has room. */
+	pthread_cond_t order_cond;
+	/** The next sequence number to hand out. */
+	size_t seq_next;
+	/** The next sequence number to print. */
+	size_t seq_print;
+	/** The size of the reorder window. */
+	size_t window_size;
+	/** Completed evaluations waiting to be printed, indexed by seq % window_size. */
+	struct eval_slot *window;
+
+	/** The number of threads. */
+	size_t nthreads;
+	/** The threads themselves. */
+	struct eval_worker workers[];
+};
+
+/** Pop a job from the pool, blocking until one is available. */
+static struct eval_job *eval_pool_pop(struct eval_pool *pool) {
+	mutex_lock(&pool->mutex);
+
+	while (pool->size == 0 && !pool->stop) {
+		cond_wait(&pool->jobs_cond, &pool->mutex);
+	}
+
+	struct eval_job *job = SLIST_POP(&pool->jobs);
+	if (job) {
+		if (pool->size-- == pool->capacity) {
+			cond_signal(&pool->space_cond);
 		}
 	}
 
-	return ret > 0;
+	mutex_unlock(&pool->mutex);
+	return job;
 }
 
-/**
- * -samefile test.
- */
-bool eval_samefile(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+/** Reserve a sequence number for an evaluation, for -ordered. */
+static size_t eval_pool_reserve(struct eval_pool *pool) {
+	mutex_lock(&pool->order_mutex);
+
+	// Wait for the oldest evaluations to be printed if the window is full
+	while (pool->seq_next - pool->seq_print >= pool->window_size) {
+		cond_wait(&pool->order_cond, &pool->order_mutex);
 	}
 
-	return statbuf->dev == expr->dev && statbuf->ino == expr->ino;
+	size_t seq = pool->seq_next++;
+	mutex_unlock(&pool->order_mutex);
+	return seq;
 }
 
-/**
- * -size test.
- */
-bool eval_size(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
+/** Complete an evaluation, printing everything that is now in order. */
+static void eval_pool_finish(struct eval_pool *pool, size_t seq, struct eval_output *out) {
+	mutex_lock(&pool->order_mutex);
+
+	struct eval_slot *slot = &pool->window[seq % pool->window_size];
+	bfs_assert(!slot->done);
+	slot->done = true;
+	slot->out = *out;
+
+	bool printed = false;
+	while (true) {
+		slot = &pool->window[pool->seq_print % pool->window_size];
+		if (!slot->done) {
+			break;
+		}
+
+		eval_output_flush(&slot->out);
+		slot->done = false;
+		++pool->seq_print;
+		printed = true;
+	}
+
+	if (printed) {
+		cond_signal(&pool->order_cond);
+	}
+
+	mutex_unlock(&pool->order_mutex);
+}
+
+/** Evaluator thread entry point. */
+static void *eval_work(void *ptr) {
+	struct eval_worker *worker = ptr;
+	struct eval_pool *pool = worker->pool;
+	const struct bfs_ctx *ctx = pool->ctx;
+	bfs_perf_name("eval");
+
+	struct eval_job *job;
+	while ((job = eval_pool_pop(pool))) {
+		struct eval_output out = {0};
+		struct bfs_eval state = {
+			.ftwbuf = &job->file.ftwbuf,
+			.ctx = ctx,
+			.action = BFTW_CONTINUE,
+			.ret = &worker->ret,
+			.nerrors = &worker->nerrors,
+			.parallel = true,
+			.out = pool->ordered ? &out : NULL,
+			.pathstate = job->pathstate,
+		};
+		eval_main(pool->prog, &state);
+		if (pool->ordered) {
+			eval_pool_finish(pool, job->seq, &out);
+		}
+		eval_copy_destroy(&job->file);
+		free(job);
+	}
+
+	return NULL;
+}
+
+/** Check if an expression can be evaluated by the pool. */
+static bool eval_parallel_safe(const struct bfs_expr *expr) {
+	/**
+	 * Primaries that only read the file and immutable bfs_ctx state.  In
+	 * particular, nothing that uses the lazy mtab, and no
+	 * actions with side effects whose order matters.
+	 */
+	static bfs_eval_fn *const safe[] = {
+		eval_access,
+		eval_acl,
+		eval_and,
+		eval_capable,
+		eval_comma,
+		eval_context,
+		eval_depth,
+		eval_empty,
+		eval_false,
+		eval_flags,
+		eval_fprint,
+		eval_fprint0,
+		eval_gid,
+		eval_grep,
+		eval_hash,
+		eval_hidden,
+		eval_inum,
+		eval_links,
+		eval_lname,
+		eval_name,
+		eval_name_from,
+		eval_names,
+		eval_newer,
+		eval_nogroup,
+		eval_not,
+		eval_nouser,
+		eval_or,
+		eval_path,
+		eval_path_from,
+		eval_perm,
+		eval_regex,
+		eval_regexes,
+		eval_samefile,
+		eval_size,
+		eval_sparse,
+		eval_time,
+		eval_top,
+		eval_true,
+		eval_type,
+		eval_uid,
+		eval_used,
+		eval_xattr,
+		eval_xattrname,
+		eval_xtype,
+	};
+
+	bool found = false;
+	for (size_t i = 0; i < countof(safe); ++i) {
+		if (expr->eval_fn == safe[i]) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		return false;
+	}
+
+	// Counting -samefile matches isn't thread-safe
+	if (expr->eval_fn == eval_samefile && expr->samefile_left > 0) {
 		return false;
 	}
 
-	static const off_t scales[] = {
-		[BFS_BLOCKS] = 512,
-		[BFS_BYTES] = 1,
-		[BFS_WORDS] = 2,
-		[BFS_KB] = 1LL << 10,
-		[BFS_MB] = 1LL << 20,
-		[BFS_GB] = 1LL << 30,
-		[BFS_TB] = 1LL << 40,
-		[BFS_PB] = 1LL << 50,
-	};
+	for_expr (child, expr) {
+		if (!eval_parallel_safe(child)) {
+			return false;
+		}
+	}
 
-	off_t scale = scales[expr->size_unit];
-	off_t size = (statbuf->size + scale - 1) / scale; // Round up
-	return bfs_expr_cmp(expr, size);
+	return true;
 }
 
-/**
- * -sparse test.
- */
-bool eval_sparse(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
+/** Count the primaries that add or remove files. */
+static size_t eval_count_mutators(const struct bfs_expr *expr, bool *background) {
+	if (expr->eval_fn == eval_delete) {
+		*background |= expr->background;
+		return 1;
+	} else if (expr->eval_fn == eval_exec || expr->eval_fn == eval_coproc) {
+		return 1;
 	}
 
-	blkcnt_t expected = (statbuf->size + BFS_STAT_BLKSIZE - 1) / BFS_STAT_BLKSIZE;
-	return statbuf->blocks < expected;
+	size_t count = 0;
+	for_expr (child, expr) {
+		count += eval_count_mutators(child, background);
+	}
+	return count;
 }
 
 /**
- * -type test.
+ * Check whether -delete can run in the background.  Its result must be
+ * ignored, and nothing else may depend on when files disappear.
  */
-bool eval_type(const struct bfs_expr *expr, struct bfs_eval *state) {
-	return (1 << state->ftwbuf->type) & expr->num;
+static bool eval_background_delete(const struct bfs_ctx *ctx) {
+	bool background = false;
+	size_t count = eval_count_mutators(ctx->exclude, &background)
+		+ eval_count_mutators(ctx->expr, &background);
+	return count == 1 && background;
 }
 
-/**
- * -xattr test.
- */
-bool eval_xattr(const struct bfs_expr *expr, struct bfs_eval *state) {
-	int ret = bfs_check_xattrs(state->ftwbuf);
-	if (ret >= 0) {
-		return ret;
-	} else {
-		eval_report_error(state);
-		return false;
+/** Destroy an evaluator pool, waiting for any queued jobs to finish. */
+static void eval_pool_destroy(struct eval_pool *pool, size_t *nerrors, int *ret) {
+	if (!pool) {
+		return;
 	}
-}
 
-/**
- * -xattrname test.
- */
-bool eval_xattrname(const struct bfs_expr *expr, struct bfs_eval *state) {
-	int ret = bfs_check_xattr_named(state->ftwbuf, expr->argv[1]);
-	if (ret >= 0) {
-		return ret;
-	} else {
-		eval_report_error(state);
-		return false;
-	}
-}
+	mutex_lock(&pool->mutex);
+	pool->stop = true;
+	cond_broadcast(&pool->jobs_cond);
+	mutex_unlock(&pool->mutex);
 
-/**
- * -xtype test.
- */
-bool eval_xtype(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct BFTW *ftwbuf = state->ftwbuf;
-	enum bfs_stat_flags flags = ftwbuf->stat_flags ^ (BFS_STAT_NOFOLLOW | BFS_STAT_TRYFOLLOW);
-	enum bfs_type type = bftw_type(ftwbuf, flags);
+	for (size_t i = 0; i < pool->nthreads; ++i) {
+		struct eval_worker *worker = &pool->workers[i];
+		thread_join(worker->id, NULL);
 
-	// GNU find treats ELOOP as a broken symbolic link for -xtype l
-	// (but not -L -type l)
-	if ((flags & BFS_STAT_TRYFOLLOW) && type == BFS_ERROR && errno == ELOOP) {
-		type = BFS_LNK;
+		*nerrors += worker->nerrors;
+		if (worker->ret != EXIT_SUCCESS) {
+			*ret = worker->ret;
+		}
 	}
 
-	if (type == BFS_ERROR) {
-		eval_report_error(state);
-		return false;
-	} else {
-		return (1 << type) & expr->num;
-	}
+	bfs_assert(pool->size == 0);
+	bfs_assert(pool->seq_print == pool->seq_next);
+
+	free(pool->window);
+	cond_destroy(&pool->order_cond);
+	mutex_destroy(&pool->order_mutex);
+	cond_destroy(&pool->space_cond);
+	cond_destroy(&pool->jobs_cond);
+	mutex_destroy(&pool->mutex);
+	free(pool);
 }
 
-/**
- * clock_gettime() wrapper.
- */
-static int eval_gettime(struct bfs_eval *state, struct timespec *ts) {
-	clockid_t clock = CLOCK_REALTIME;
+/** Create an evaluator pool for -parallel. */
+static struct eval_pool *eval_pool_create(const struct bfs_ctx *ctx, const struct eval_prog *prog, size_t nthreads) {
+	struct eval_pool *pool = ZALLOC_FLEX(struct eval_pool, workers, nthreads);
+	if (!pool) {
+		return NULL;
+	}
 
-#if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0
-	if (sysoption(MONOTONIC_CLOCK) > 0) {
-		clock = CLOCK_MONOTONIC;
+	pool->ctx = ctx;
+	pool->prog = prog;
+	SLIST_INIT(&pool->jobs);
+	pool->capacity = 1024 * nthreads;
+
+	// Leave room for every queued job, plus the ones being evaluated
+	pool->ordered = ctx->ordered;
+	pool->window_size = 2 * pool->capacity;
+
+	if (mutex_init(&pool->mutex, NULL) != 0) {
+		goto fail_mutex;
+	}
+	if (cond_init(&pool->jobs_cond, NULL) != 0) {
+		goto fail_jobs;
+	}
+	if (cond_init(&pool->space_cond, NULL) != 0) {
+		goto fail_space;
+	}
+	if (mutex_init(&pool->order_mutex, NULL) != 0) {
+		goto fail_order_mutex;
+	}
+	if (cond_init(&pool->order_cond, NULL) != 0) {
+		goto fail_order_cond;
+	}
+	if (pool->ordered) {
+		pool->window = ZALLOC_ARRAY(struct eval_slot, pool->window_size);
+		if (!pool->window) {
+			goto fail_window;
+		}
 	}
-#endif
 
-	int ret = clock_gettime(clock, ts);
-	if (ret != 0) {
-		bfs_warning(state->ctx, "%pP: clock_gettime(): %s.\n", state->ftwbuf, errstr());
+	for (size_t i = 0; i < nthreads; ++i) {
+		struct eval_worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->ret = EXIT_SUCCESS;
+		if (thread_create(&worker->id, NULL, eval_work, worker) != 0) {
+			break;
+		}
+		++pool->nthreads;
 	}
-	return ret;
-}
 
-/**
- * Record an elapsed time.
- */
-static void timespec_elapsed(struct timespec *elapsed, const struct timespec *start, const struct timespec *end) {
-	elapsed->tv_sec += end->tv_sec - start->tv_sec;
-	elapsed->tv_nsec += end->tv_nsec - start->tv_nsec;
-	if (elapsed->tv_nsec < 0) {
-		elapsed->tv_nsec += 1000000000L;
-		--elapsed->tv_sec;
-	} else if (elapsed->tv_nsec >= 1000000000L) {
-		elapsed->tv_nsec -= 1000000000L;
-		++elapsed->tv_sec;
+	if (pool->nthreads == 0) {
+		eval_pool_destroy(pool, &(size_t){0}, &(int){0});
+		return NULL;
 	}
+
+	return pool;
+
+fail_window:
+	cond_destroy(&pool->order_cond);
+fail_order_cond:
+	mutex_destroy(&pool->order_mutex);
+fail_order_mutex:
+	cond_destroy(&pool->space_cond);
+fail_space:
+	cond_destroy(&pool->jobs_cond);
+fail_jobs:
+	mutex_destroy(&pool->mutex);
+fail_mutex:
+	free(pool);
+	return NULL;
 }
 
 /**
- * Evaluate an expression.
+ * Hand a file off to the pool.  Only non-directories can be deferred, since
+ * the bftw() callback needs the result for directories to decide whether to
+ * prune them.
  */
-static bool eval_expr(struct bfs_expr *expr, struct bfs_eval *state) {
-	struct timespec start, end;
-	bool time = state->ctx->debug & DEBUG_RATES;
-	if (time) {
-		if (eval_gettime(state, &start) != 0) {
-			time = false;
-		}
+static int eval_pool_push(struct eval_pool *pool, const struct bfs_eval *state, size_t seq) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (ftwbuf->type == BFS_DIR || ftwbuf->type == BFS_UNKNOWN) {
+		return -1;
 	}
 
-	bfs_assert(!state->quit);
-
-	bool ret = expr->eval_fn(expr, state);
+	// The copy is opened relative to the working directory, since the
+	// parent fd may be closed by the time it is evaluated
+	size_t len = strlen(ftwbuf->path) + 1;
+	if (len > PATH_MAX) {
+		return -1;
+	}
 
-	if (time) {
-		if (eval_gettime(state, &end) == 0) {
-			timespec_elapsed(&expr->elapsed, &start, &end);
-		}
+	struct eval_job *job = ALLOC_FLEX(struct eval_job, path, len);
+	if (!job) {
+		return -1;
 	}
 
-	++expr->evaluations;
-	if (ret) {
-		++expr->successes;
+	SLIST_ITEM_INIT(job);
+	job->seq = seq;
+	job->pathstate = state->pathstate;
+	memcpy(job->path, ftwbuf->path, len);
+	eval_copy_init(&job->file, ftwbuf, job->path, (int)AT_FDCWD, job->path);
+
+	mutex_lock(&pool->mutex);
+
+	while (pool->size >= pool->capacity) {
+		cond_wait(&pool->space_cond, &pool->mutex);
 	}
 
-	if (bfs_expr_never_returns(expr)) {
-		bfs_assert(state->quit);
-	} else if (!state->quit) {
-		bfs_assert(!expr->always_true || ret);
-		bfs_assert(!expr->always_false || !ret);
+	SLIST_APPEND(&pool->jobs, job);
+	if (pool->size++ == 0) {
+		cond_signal(&pool->jobs_cond);
 	}
 
-	return ret;
+	mutex_unlock(&pool->mutex);
+	return 0;
 }
 
 /**
- * Evaluate a negation.
+ * Type passed as the argument to the bftw() callback.
  */
-bool eval_not(const struct bfs_expr *expr, struct bfs_eval *state) {
-	return !eval_expr(bfs_expr_children(expr), state);
-}
+struct callback_args {
+	/** The bfs context. */
+	const struct bfs_ctx *ctx;
+
+	/** The status bar. */
+	struct bfs_bar *bar;
+	/** Tells us when to update the status bar. */
+	struct status_ticker ticker;
+	/** Flag set by SIGINFO hook. */
+	atomic bool info_flag;
+
+	/** The number of files visited so far. */
+	size_t count;
+	/** The progress of the walk, for the status bar. */
+	struct bftw_progress progress;
+
+	/** The set of seen files. */
+	struct idfilter *seen;
+	/** The IDs of directories that are mounted more than once (-dedup). */
+	const struct idset *mounts;
+	/** The mounted directories we've descended into already (-dedup). */
+	struct idset *mounted;
+
+	/** The compiled expression. */
+	struct eval_prog prog;
+
+	/** Whether to adaptively reorder the expression (-O4). */
+	bool adapt;
+	/** Whether we are currently measuring the expression. */
+	bool profiling;
+	/** Evaluations left until the next phase of adaptive reordering. */
+	size_t adapt_left;
+	/** Files left to skip until the next timed one (-profile-sample). */
+	size_t sample_left;
+
+	/** The evaluator pool, for -parallel. */
+	struct eval_pool *pool;
+	/** Background -delete state. */
+	struct eval_unlinker *unlinker;
+	/** The index being saved (-save-index). */
+	struct bfs_index_writer *index;
+	/** The cost measurements (-calibrate). */
+	struct bfs_calibration *calibration;
+	/** The watched directories (-watch). */
+	struct bfs_watch *watch;
+	/** The I/O throttle (-io-rate, -io-depth). */
+	struct bfs_throttle *throttle;
+	/** Whether the search was stopped early (e.g. -quit). */
+	bool quit;
+
+	/** The number of errors that have occurred. */
+	size_t nerrors;
+	/** Traversal error counts, keyed by subtree and errno (-errors summary). */
+	struct trie errsum;
+	/** The last root streamed from -files0-from. */
+	char *root;
+	/** The ignore rules loaded so far (-gitignore). */
+	struct bfs_ignore **ignores;
+	/** The number of loaded ignore rule sets. */
+	size_t nignores;
+	/** Eventual return value from bfs_eval(). */
+	int ret;
+};
 
 /**
- * Evaluate a conjunction.
+ * Get the length of the subtree that an error is counted under for
+ * -errors summary: the top-level entry under the root, or the root itself.
  */
-bool eval_and(const struct bfs_expr *expr, struct bfs_eval *state) {
-	for_expr (child, expr) {
-		if (!eval_expr(child, state) || state->quit) {
-			return false;
-		}
+static size_t eval_errsum_len(const struct BFTW *ftwbuf) {
+	const char *path = ftwbuf->path;
+	if (ftwbuf->depth == 0) {
+		return strlen(path);
 	}
 
-	return true;
+	size_t len = strlen(ftwbuf->root);
+	len += strspn(path + len, "/");
+	len += strcspn(path + len, "/");
+	return len;
 }
 
 /**
- * Evaluate a disjunction.
+ * Count a traversal error for -errors summary.
  */
-bool eval_or(const struct bfs_expr *expr, struct bfs_eval *state) {
-	for_expr (child, expr) {
-		if (eval_expr(child, state) || state->quit) {
-			return true;
-		}
+static int eval_errsum_add(struct callback_args *args, const struct BFTW *ftwbuf) {
+	// The key is the NUL-terminated subtree, followed by the errno value
+	size_t len = eval_errsum_len(ftwbuf);
+	int error = ftwbuf->error;
+	char key[PATH_MAX + 1 + sizeof(error)];
+	if (len > PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
 	}
 
-	return false;
+	memcpy(key, ftwbuf->path, len);
+	key[len] = '\0';
+	memcpy(key + len + 1, &error, sizeof(error));
+
+	struct trie_leaf *leaf = trie_insert_mem(&args->errsum, key, len + 1 + sizeof(error));
+	if (!leaf) {
+		return -1;
+	}
+
+	leaf->value = (void *)((uintptr_t)leaf->value + 1);
+	++args->nerrors;
+	args->ret = EXIT_FAILURE;
+	return 0;
 }
 
 /**
- * Evaluate the comma operator.
+ * Report the errors counted by -errors summary.
  */
-bool eval_comma(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret uninit(false);
+static void eval_errsum_report(const struct callback_args *args) {
+	const struct bfs_ctx *ctx = args->ctx;
 
-	for_expr (child, expr) {
-		ret = eval_expr(child, state);
-		if (state->quit) {
-			break;
-		}
+	for_trie (leaf, &args->errsum) {
+		int error;
+		memcpy(&error, leaf->key + strlen(leaf->key) + 1, sizeof(error));
+		size_t count = (uintptr_t)leaf->value;
+		bfs_error(ctx, "%zu %s under %pq: %s.\n", count, count == 1 ? "error" : "errors", leaf->key, xstrerror(error));
 	}
-
-	return ret;
 }
 
-/** Update the status bar. */
-static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct timespec *last_status, size_t count) {
-	struct timespec now;
-	if (eval_gettime(state, &now) == 0) {
-		struct timespec elapsed = {0};
-		timespec_elapsed(&elapsed, last_status, &now);
+/**
+ * Apply -gitignore to the current file, and load the ignore files of the
+ * directories it doesn't ignore.
+ *
+ * @return
+ *         Whether the file is ignored.
+ */
+static bool eval_ignored(struct bfs_eval *state, struct callback_args *args) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
 
-		// Update every 0.1s
-		if (elapsed.tv_sec > 0 || elapsed.tv_nsec >= 100000000L) {
-			*last_status = now;
-		} else {
-			return;
-		}
+	struct bfs_ignore *parent = NULL;
+	if (ftwbuf->parent_data) {
+		parent = *ftwbuf->parent_data;
 	}
 
-	size_t width = bfs_bar_width(bar);
-	if (width < 3) {
-		return;
+	bool dir = ftwbuf->type == BFS_DIR;
+	if (parent && bfs_ignored(parent, ftwbuf->path, dir)) {
+		return true;
 	}
 
-	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (!dir || ftwbuf->visit != BFTW_PRE || !ftwbuf->data) {
+		return false;
+	}
 
-	dchar *status = NULL;
-	dchar *rhs = dstrprintf(" (visited: %'zu; depth: %2zu)", count, ftwbuf->depth);
-	if (!rhs) {
-		return;
+	const char *path = ftwbuf->path;
+	size_t base = strlen(path);
+	if (base > 0 && path[base - 1] != '/') {
+		++base;
 	}
 
-	size_t rhslen = xstrwidth(rhs);
-	if (3 + rhslen > width) {
-		dstresize(&rhs, 0);
-		rhslen = 0;
+	struct bfs_ignore *ignore;
+	if (bfs_ignore_load(&ignore, parent, ftwbuf->at_fd, ftwbuf->at_path, base) != 0) {
+		eval_error(state, "${blu}-gitignore${rs}: %s.\n", errstr());
 	}
 
-	status = dstralloc(0);
-	if (!status) {
-		goto out;
+	if (ignore != parent) {
+		struct bfs_ignore **slot = RESERVE(struct bfs_ignore *, &args->ignores, &args->nignores);
+		if (slot) {
+			*slot = ignore;
+		} else {
+			eval_error(state, "${blu}-gitignore${rs}: %s.\n", errstr());
+			bfs_ignore_free(ignore);
+			ignore = parent;
+		}
 	}
 
-	const char *path = ftwbuf->path;
-	size_t pathlen = ftwbuf->nameoff;
-	if (ftwbuf->depth == 0) {
-		pathlen = strlen(path);
+	*ftwbuf->data = ignore;
+	return false;
+}
+
+/** The number of files to measure before adaptively reordering. */
+#define ADAPT_SAMPLE 1024
+/** The number of files to evaluate between measurements. */
+#define ADAPT_PERIOD (16 * ADAPT_SAMPLE)
+
+/** Check if a should be evaluated before b, based on their measurements. */
+static bool eval_adapt_before(const struct bfs_expr *parent, const struct bfs_expr *a, const struct bfs_expr *b) {
+	double ca = (1.0e9 * a->elapsed.tv_sec + a->elapsed.tv_nsec) / a->evaluations;
+	double cb = (1.0e9 * b->elapsed.tv_sec + b->elapsed.tv_nsec) / b->evaluations;
+	double pa = (double)a->successes / a->evaluations;
+	double pb = (double)b->successes / b->evaluations;
+
+	// Compare the expected cost of (a op b) to (b op a)
+	if (parent->eval_fn == eval_and) {
+		return ca * (1.0 - pb) < cb * (1.0 - pa);
+	} else {
+		return ca * pb < cb * pa;
 	}
+}
 
-	// Escape weird filename characters
-	if (dstrnescat(&status, path, pathlen, WESC_TTY) != 0) {
-		goto out;
+/** Check if an operand may be reordered based on measurements. */
+static bool eval_adapt_movable(const struct bfs_expr *expr) {
+	return expr->pure && expr->evaluations > 0;
+}
+
+/**
+ * Re-sort the pure operands of every conjunction and disjunction by their
+ * measured cost and selectivity.  Impure operands stay where they are, and
+ * nothing moves across them.
+ *
+ * @return
+ *         Whether anything was reordered.
+ */
+static bool eval_adapt(struct bfs_expr *expr) {
+	if (!bfs_expr_is_parent(expr)) {
+		return false;
 	}
-	pathlen = dstrlen(status);
 
-	// Try to make sure even wide characters fit in the status bar
-	size_t pathmax = width - rhslen - 3;
-	size_t pathwidth = 0;
-	size_t lhslen = 0;
-	mbstate_t mb = {0};
-	for (size_t i = lhslen; lhslen < pathlen; lhslen = i) {
-		wint_t wc = xmbrtowc(status, &i, pathlen, &mb);
-		int cwidth;
-		if (wc == WEOF) {
-			// Invalid byte sequence, assume a single-width '?'
-			cwidth = 1;
-		} else {
-			cwidth = xwcwidth(wc);
-			if (cwidth < 0) {
-				cwidth = 0;
-			}
+	bool changed = false;
+	for_expr (child, expr) {
+		changed |= eval_adapt(child);
+	}
+
+	if (expr->eval_fn != eval_and && expr->eval_fn != eval_or) {
+		return changed;
+	}
+
+	struct bfs_exprs children;
+	SLIST_INIT(&children);
+	SLIST_EXTEND(&children, &expr->children);
+
+	// Insertion sort each run of movable children
+	struct bfs_expr **run = NULL;
+	struct bfs_expr *child;
+	while ((child = SLIST_POP(&children))) {
+		if (!eval_adapt_movable(child)) {
+			run = NULL;
+			SLIST_APPEND(&expr->children, child);
+			continue;
 		}
 
-		if (pathwidth + cwidth > pathmax) {
-			break;
+		if (!run) {
+			run = expr->children.tail;
+		}
+
+		struct bfs_expr **cursor = run;
+		while (*cursor && !eval_adapt_before(expr, child, *cursor)) {
+			cursor = &(*cursor)->next;
+		}
+		cursor = SLIST_INSERT(&expr->children, cursor, child);
+		if (*cursor) {
+			changed = true;
 		}
-		pathwidth += cwidth;
 	}
-	dstresize(&status, lhslen);
 
-	if (dstrcat(&status, "...") != 0) {
-		goto out;
+	return changed;
+}
+
+/** Advance the adaptive reordering state after an evaluation. */
+static void eval_adapt_tick(struct callback_args *args) {
+	if (--args->adapt_left > 0) {
+		return;
 	}
 
-	while (pathwidth < pathmax) {
-		if (dstrapp(&status, ' ') != 0) {
-			goto out;
+	const struct bfs_ctx *ctx = args->ctx;
+
+	if (args->profiling) {
+		if (eval_adapt(ctx->expr)) {
+			bfs_debug(ctx, DEBUG_OPT, "Reordered from measurements: %pe\n", ctx->expr);
+			eval_prog_free(&args->prog);
+			eval_compile(&args->prog, ctx->expr);
 		}
-		++pathwidth;
+		args->profiling = false;
+		args->adapt_left = ADAPT_PERIOD;
+	} else {
+		args->profiling = true;
+		args->adapt_left = ADAPT_SAMPLE;
 	}
+}
 
-	if (dstrdcat(&status, rhs) != 0) {
-		goto out;
-	}
+/** Check whether every evaluation must be timed and counted. */
+static bool eval_must_measure(const struct bfs_ctx *ctx) {
+	return (ctx->debug & DEBUG_RATES) || ctx->save_profile;
+}
 
-	bfs_bar_update(bar, status);
+/**
+ * Check whether to time the evaluation of the current file.
+ *
+ * @param args
+ *         The callback arguments.
+ * @param[out] scale
+ *         Will hold the number of evaluations that this one stands for.
+ */
+static bool eval_should_time(struct callback_args *args, size_t *scale) {
+	*scale = 1;
 
-out:
-	dstrfree(status);
-	dstrfree(rhs);
-}
+	// Adaptive reordering needs every evaluation in its sample
+	if (args->profiling) {
+		return true;
+	}
 
-/** Check if we've seen a file before. */
-static bool eval_file_unique(struct bfs_eval *state, struct trie *seen) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
+	const struct bfs_ctx *ctx = args->ctx;
+	if (!eval_must_measure(ctx)) {
 		return false;
 	}
 
-	bfs_file_id id;
-	bfs_stat_id(statbuf, &id);
+	size_t rate = ctx->profile_sample;
+	if (rate <= 1) {
+		return true;
+	}
 
-	struct trie_leaf *leaf = trie_insert_mem(seen, id, sizeof(id));
-	if (!leaf) {
-		eval_report_error(state);
+	if (args->sample_left > 0) {
+		--args->sample_left;
 		return false;
 	}
 
-	if (leaf->value) {
-		state->action = BFTW_PRUNE;
-		return false;
-	} else {
-		leaf->value = leaf;
-		return true;
+	args->sample_left = rate - 1;
+	*scale = rate;
+	return true;
+}
+
+/** Save the measurements for -save-profile. */
+static int eval_save_profile(const struct bfs_ctx *ctx) {
+	struct bfs_profile *profile = bfs_profile_new();
+	if (!profile) {
+		return -1;
 	}
+
+	int ret = -1;
+	if (bfs_profile_record(profile, ctx->exclude) != 0) {
+		goto done;
+	}
+	if (bfs_profile_record(profile, ctx->expr) != 0) {
+		goto done;
+	}
+	ret = bfs_profile_save(profile, ctx->save_profile);
+
+done:
+	bfs_profile_free(profile);
+	return ret;
 }
 
-#define DEBUG_FLAG(flags, flag) \
-	do { \
-		if ((flags & flag) || flags == flag) { \
-			fputs(#flag, stderr); \
-			flags ^= flag; \
-			if (flags) { \
-				fputs(" | ", stderr); \
-			} \
-		} \
-	} while (0)
+/** Check whether eval_filter() should be used. */
+static bool eval_can_filter(const struct bfs_ctx *ctx) {
+	// -unique must see excluded files too, to remember their IDs
+	return (ctx->exclude_names || ctx->nprunes > 0) && !ctx->unique;
+}
 
 /**
- * Log a stat() call.
+ * Advance the incremental -path automaton from the parent directory's state
+ * over the current file's name, and save the state for its children.  The
+ * parent's state may be missing (zero) if we never saw it, e.g. when iterative
+ * deepening skips the shallower levels.
  */
-static void debug_stat(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf, enum bfs_stat_flags flags, int err) {
-	bfs_debug_prefix(ctx, DEBUG_STAT);
+static uint64_t eval_pathmatch(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
+	const struct bfs_pathmatch *pm = ctx->pathmatch;
+	if (!pm) {
+		return 0;
+	}
 
-	fprintf(stderr, "bfs_stat(");
-	if (ftwbuf->at_fd == (int)AT_FDCWD) {
-		fprintf(stderr, "AT_FDCWD");
+	const char *path = ftwbuf->path;
+	uint64_t state;
+	if (ftwbuf->parent_cookie && *ftwbuf->parent_cookie) {
+		state = bfs_pathmatch_advance(pm, *ftwbuf->parent_cookie, path + ftwbuf->nameoff);
 	} else {
-		size_t baselen = strlen(ftwbuf->path) - strlen(ftwbuf->at_path);
-		fprintf(stderr, "\"");
-		fwrite(ftwbuf->path, 1, baselen, stderr);
-		fprintf(stderr, "\"");
+		state = bfs_pathmatch_advance(pm, bfs_pathmatch_start(pm), path);
 	}
 
-	fprintf(stderr, ", \"%s\", ", ftwbuf->at_path);
+	// Post-order visits have nothing new to save
+	if (ftwbuf->cookie && ftwbuf->visit == BFTW_PRE) {
+		uint64_t cookie = state;
+		size_t len = strlen(path);
+		if (len == 0 || path[len - 1] != '/') {
+			cookie = bfs_pathmatch_advance(pm, cookie, "/");
+		}
+		*ftwbuf->cookie = cookie;
+	}
 
-	DEBUG_FLAG(flags, BFS_STAT_FOLLOW);
-	DEBUG_FLAG(flags, BFS_STAT_NOFOLLOW);
-	DEBUG_FLAG(flags, BFS_STAT_TRYFOLLOW);
-	DEBUG_FLAG(flags, BFS_STAT_NOSYNC);
+	return state;
+}
 
-	fprintf(stderr, ") == %d", err == 0 ? 0 : -1);
+/** bftw() filter function that skips excluded or pruned directory entries. */
+static bool eval_filter(const struct bfs_dirent *de, size_t depth, void *ptr) {
+	struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
 
-	if (err) {
-		fprintf(stderr, " [%d]", err);
+	if (ctx->filter_types) {
+		// The callback will find out the real type
+		if (de->type == BFS_UNKNOWN) {
+			return false;
+		} else if (de->type == BFS_LNK && (ctx->flags & BFTW_FOLLOW_ALL)) {
+			return false;
+		}
 	}
 
-	fprintf(stderr, "\n");
-}
+	struct BFTW ftwbuf = {
+		.path = de->name,
+		.nameoff = 0,
+		.root = de->name,
+		.depth = depth,
+		.visit = BFTW_PRE,
+		.type = de->type,
+		.at_fd = -1,
+		.at_path = de->name,
+		.empty = -1,
+	};
 
-/**
- * Log any stat() calls that happened.
- */
-static void debug_stats(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
-	if (!(ctx->debug & DEBUG_STAT)) {
-		return;
+	struct bfs_eval state = {
+		.ftwbuf = &ftwbuf,
+		.ctx = ctx,
+		.action = BFTW_CONTINUE,
+		.ret = &args->ret,
+		.nerrors = &args->nerrors,
+	};
+	state.profile = eval_should_time(args, &state.profile_scale);
+
+	if (ctx->exclude_names && eval_expr(ctx->exclude, &state)) {
+		return true;
 	}
 
-	const struct bftw_stat *bufs = &ftwbuf->stat_bufs;
+	// Shallower files won't even be evaluated, let alone pruned
+	if (depth < (size_t)ctx->mindepth) {
+		return false;
+	}
 
-	if (bufs->stat_err >= 0) {
-		debug_stat(ctx, ftwbuf, BFS_STAT_FOLLOW, bufs->stat_err);
+	for (size_t i = 0; i < ctx->nprunes; ++i) {
+		if (eval_expr(ctx->prunes[i], &state)) {
+			return true;
+		}
 	}
 
-	if (bufs->lstat_err >= 0) {
-		debug_stat(ctx, ftwbuf, BFS_STAT_NOFOLLOW, bufs->lstat_err);
+	return false;
+}
+
+/** bftw() stat() hint that prefetches the files that pass the stat() guards. */
+static bool eval_stat_hint(const char *name, void *ptr) {
+	const struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
+
+	for (size_t i = 0; i < ctx->nstat_guards; ++i) {
+		const struct bfs_expr *test = ctx->stat_guards[i];
+		if (test->eval_fn == eval_names) {
+			if (bfs_nameset_match(test->nameset, name)) {
+				return true;
+			}
+		} else if (eval_fnmatch(test, name)) {
+			return true;
+		}
 	}
+
+	return false;
 }
 
-#define DUMP_MAP(value) [value] = #value
+/** Check whether eval_filter() has already taken care of -exclude. */
+static bool eval_filtered(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
+	// Without types, eval_filter() always gives the definitive answer
+	return eval_can_filter(ctx) && ctx->exclude_names && !ctx->filter_types && ftwbuf->depth > 0;
+}
 
-/**
- * Dump the bfs_type for -D search.
- */
-static const char *dump_bfs_type(enum bfs_type type) {
-	static const char *types[] = {
-		DUMP_MAP(BFS_UNKNOWN),
-		DUMP_MAP(BFS_BLK),
-		DUMP_MAP(BFS_CHR),
-		DUMP_MAP(BFS_DIR),
-		DUMP_MAP(BFS_DOOR),
-		DUMP_MAP(BFS_FIFO),
-		DUMP_MAP(BFS_LNK),
-		DUMP_MAP(BFS_PORT),
-		DUMP_MAP(BFS_REG),
-		DUMP_MAP(BFS_SOCK),
-		DUMP_MAP(BFS_WHT),
-	};
+/** Check whether any descendant of a directory could have a required prefix. */
+static bool eval_prefix_compatible(const struct bfs_prefix *prefix, const char *path, size_t len) {
+	// Every descendant's path starts with "${path}/"
+	bool slash = len > 0 && path[len - 1] == '/';
+
+	for (size_t i = 0; i < prefix->len; ++i) {
+		char p = prefix->str[i];
+		char c;
+		if (i < len) {
+			c = path[i];
+		} else if (i == len && !slash) {
+			c = '/';
+		} else {
+			break;
+		}
 
-	if (type == BFS_ERROR) {
-		return "BFS_ERROR";
-	} else {
-		return types[type];
+		if (prefix->casefold) {
+			p = ascii_tolower(p);
+			c = ascii_tolower(c);
+		}
+		if (p != c) {
+			return false;
+		}
 	}
+
+	return true;
 }
 
-/**
- * Dump the bftw_visit for -D search.
- */
-static const char *dump_bftw_visit(enum bftw_visit visit) {
-	static const char *visits[] = {
-		DUMP_MAP(BFTW_PRE),
-		DUMP_MAP(BFTW_POST),
-	};
-	return visits[visit];
+/** Check whether a directory's descendants could match the expression. */
+static bool eval_may_descend(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
+	if (ctx->nprefixes == 0) {
+		return true;
+	}
+
+	const char *path = ftwbuf->path;
+	size_t len = strlen(path);
+	for (size_t i = 0; i < ctx->nprefixes; ++i) {
+		if (eval_prefix_compatible(&ctx->prefixes[i], path, len)) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
-/**
- * Dump the bftw_action for -D search.
- */
-static const char *dump_bftw_action(enum bftw_action action) {
-	static const char *actions[] = {
-		DUMP_MAP(BFTW_CONTINUE),
-		DUMP_MAP(BFTW_PRUNE),
-		DUMP_MAP(BFTW_STOP),
-	};
-	return actions[action];
+/** Get the length of the longest common substring of a name and a -S best goal. */
+static size_t eval_goal_common(const struct bfs_goal *goal, const char *name, size_t len) {
+	size_t best = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		for (size_t j = 0; j < goal->len; ++j) {
+			size_t k = 0;
+			while (i + k < len && j + k < goal->len) {
+				char c = name[i + k];
+				char g = goal->str[j + k];
+				if (goal->casefold) {
+					c = ascii_tolower(c);
+					g = ascii_tolower(g);
+				}
+				if (c != g) {
+					break;
+				}
+				++k;
+			}
+
+			if (k > best) {
+				best = k;
+			}
+		}
+	}
+
+	return best;
 }
 
-/**
- * Type passed as the argument to the bftw() callback.
- */
-struct callback_args {
-	/** The bfs context. */
-	const struct bfs_ctx *ctx;
+/** bftw() priority function for -S best. */
+static unsigned int eval_priority(const struct BFTW *ftwbuf, void *ptr) {
+	const struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
 
-	/** The status bar. */
-	struct bfs_bar *bar;
-	/** The time of the last status update. */
-	struct timespec last_status;
-	/** Flag set by SIGINFO hook. */
-	atomic bool info_flag;
+	const char *path = ftwbuf->path;
+	size_t len = strlen(path);
+	const char *name = path + ftwbuf->nameoff;
+	size_t namelen = len - ftwbuf->nameoff;
+
+	// Directories that have nothing in common with any goal go last
+	unsigned int prio = BFTW_PRIORITIES - 1;
+
+	for (size_t i = 0; i < ctx->ngoals; ++i) {
+		const struct bfs_goal *goal = &ctx->goals[i];
+
+		if (goal->path) {
+			struct bfs_prefix prefix = {
+				.str = goal->str,
+				.len = goal->len,
+				.casefold = goal->casefold,
+			};
+			if (eval_prefix_compatible(&prefix, path, len)) {
+				// On the way to a -path match
+				return 0;
+			}
+			continue;
+		}
 
-	/** The number of files visited so far. */
-	size_t count;
+		// A single character in common is too weak a signal
+		size_t common = eval_goal_common(goal, name, namelen);
+		if (common < 2) {
+			continue;
+		}
 
-	/** The set of seen files. */
-	struct trie *seen;
+		unsigned int score = common < BFTW_PRIORITIES - 1 ? BFTW_PRIORITIES - common : 1;
+		if (score < prio) {
+			prio = score;
+		}
+	}
 
-	/** The number of errors that have occurred. */
-	size_t nerrors;
-	/** Eventual return value from bfs_eval(). */
-	int ret;
-};
+	return prio;
+}
+
+/** Hash a path for -shard (64-bit FNV-1a, so it's the same on every host). */
+static uint64_t eval_shard_hash(const char *path) {
+	uint64_t hash = UINT64_C(0xCBF29CE484222325);
+	for (const char *c = path; *c; ++c) {
+		hash ^= (unsigned char)*c;
+		hash *= UINT64_C(0x100000001B3);
+	}
+	return hash;
+}
+
+/** Check whether a file belongs to this -shard. */
+static bool eval_shard_owned(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
+	if (ctx->shards == 0) {
+		return true;
+	}
+
+	// Deeper files are only reached through an owned ancestor
+	if (ftwbuf->depth > ctx->shard_depth) {
+		return true;
+	}
+
+	return eval_shard_hash(ftwbuf->path) % ctx->shards == ctx->shard;
+}
 
 /**
- * bftw() callback.
+ * Visit a file.  The rarely used features are only checked for if full is set,
+ * so that the compiler can drop them from the specialized callbacks below.
  */
-static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
-	struct callback_args *args = ptr;
+static _always_inline enum bftw_action eval_file(const struct BFTW *ftwbuf, struct callback_args *args, bool full) {
+	uint64_t start = bfs_trace_begin();
 	++args->count;
 
 	const struct bfs_ctx *ctx = args->ctx;
@@ -1422,22 +4591,53 @@ static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
 	state.ret = &args->ret;
 	state.nerrors = &args->nerrors;
 	state.quit = false;
+	state.parallel = args->pool;
+	if (full) {
+		state.profile = eval_should_time(args, &state.profile_scale);
+	} else {
+		state.profile = false;
+		state.profile_scale = 1;
+	}
+	state.out = NULL;
+	state.unlinker = args->unlinker;
+	state.du = 0;
+	state.pathstate = eval_pathmatch(ctx, ftwbuf);
+	state.cse_known = 0;
+	state.cse_values = 0;
 
 	// Check whether SIGINFO was delivered and show/hide the bar
-	if (exchange(&args->info_flag, false, relaxed)) {
+	if (load(&args->info_flag, relaxed) && exchange(&args->info_flag, false, relaxed)) {
 		if (args->bar) {
+			status_ticker_stop(&args->ticker);
 			bfs_bar_hide(args->bar);
 			args->bar = NULL;
 		} else {
 			args->bar = bfs_bar_show();
-			if (!args->bar) {
+			if (args->bar) {
+				status_ticker_start(&args->ticker, args->count, args->progress.dirs);
+			} else {
 				bfs_warning(ctx, "Couldn't show status bar: %s.\n", errstr());
 			}
 		}
 	}
 
-	if (args->bar) {
-		eval_status(&state, args->bar, &args->last_status, args->count);
+	if (args->bar && load(&args->ticker.tick, relaxed) && exchange(&args->ticker.tick, false, relaxed)) {
+		eval_status(&state, args->bar, &args->ticker, args->count, &args->progress);
+	}
+
+	if (full && !eval_shard_owned(ctx, ftwbuf)) {
+		// Every shard walks the directories above the shard depth, but
+		// only the owner evaluates them or reports their errors
+		if (ftwbuf->depth >= ctx->shard_depth || ftwbuf->type == BFS_ERROR) {
+			state.action = BFTW_PRUNE;
+		} else if (!eval_filtered(ctx, ftwbuf) && eval_expr(ctx->exclude, &state)) {
+			state.action = BFTW_PRUNE;
+		} else if (ctx->maxdepth < 0 || ftwbuf->depth >= (size_t)ctx->maxdepth) {
+			state.action = BFTW_PRUNE;
+		} else if (ftwbuf->visit == BFTW_PRE && ftwbuf->type == BFS_DIR && !eval_may_descend(ctx, ftwbuf)) {
+			state.action = BFTW_PRUNE;
+		}
+		goto done;
 	}
 
 	if (ftwbuf->type == BFS_ERROR) {
@@ -1452,61 +4652,219 @@ static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
 			}
 		} else if (eval_should_ignore(&state, ftwbuf->error)) {
 			goto done;
+		} else if (ctx->errors == BFS_ERRORS_SUMMARY && !ctx->ignore_errors && eval_errsum_add(args, ftwbuf) == 0) {
+			goto done;
 		}
 
 		eval_error(&state, "%s.\n", xstrerror(ftwbuf->error));
 		goto done;
 	}
 
-	if (ctx->unique && ftwbuf->visit == BFTW_PRE) {
-		if (!eval_file_unique(&state, args->seen)) {
-			goto done;
-		}
+	if (full && ctx->gitignore && eval_ignored(&state, args)) {
+		state.action = BFTW_PRUNE;
+		goto done;
+	}
+
+	if (full && args->unlinker && ftwbuf->visit == BFTW_POST) {
+		// Don't let anything observe a partially deleted directory
+		eval_unlink_wait(args->unlinker, ftwbuf->path);
+	}
+
+	if (full && args->mounts && ftwbuf->visit == BFTW_PRE) {
+		if (!eval_mount_unique(&state, args->mounts, args->mounted)) {
+			goto done;
+		}
+	}
+
+	if (full && ctx->unique && ftwbuf->visit == BFTW_PRE) {
+		if (!eval_file_unique(&state, args->seen)) {
+			goto done;
+		}
+	}
+
+	if (!eval_filtered(ctx, ftwbuf) && eval_expr(ctx->exclude, &state)) {
+		state.action = BFTW_PRUNE;
+		goto done;
+	}
+
+	if (full && args->index && ftwbuf->visit == BFTW_PRE && bfs_index_add(args->index, ftwbuf) != 0) {
+		eval_error(&state, "${blu}-save-index${rs} %pq: %s.\n", ctx->save_index, errstr());
+		bfs_index_close(args->index);
+		args->index = NULL;
+	}
+
+	if (full && ctx->xargs_safe && strpbrk(ftwbuf->path, " \t\n\'\"\\")) {
+		eval_error(&state, "Path is not safe for xargs.\n");
+		state.action = BFTW_PRUNE;
+		goto done;
+	}
+
+	if (ctx->maxdepth < 0 || ftwbuf->depth >= (size_t)ctx->maxdepth) {
+		state.action = BFTW_PRUNE;
+	} else if (ftwbuf->visit == BFTW_PRE && ftwbuf->type == BFS_DIR && !eval_may_descend(ctx, ftwbuf)) {
+		state.action = BFTW_PRUNE;
+	}
+
+	// In -depth mode, only handle directories on the BFTW_POST visit
+	// (unless they're pruned, since there won't be one)
+	enum bftw_visit expected_visit = BFTW_PRE;
+	if ((ctx->flags & BFTW_POST_ORDER)
+	    && (ctx->strategy == BFTW_IDS || ftwbuf->type == BFS_DIR)
+	    && state.action != BFTW_PRUNE) {
+		expected_visit = BFTW_POST;
+	}
+
+	// For -du, each file counts once, on the same visit the expression sees
+	bool du = full && ctx->du && ftwbuf->visit == expected_visit;
+	if (du) {
+		state.du = ftwbuf->usage;
+		const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+		if (statbuf) {
+			state.du += (uintmax_t)statbuf->blocks * BFS_STAT_BLKSIZE;
+		}
+	}
+
+	if (ftwbuf->visit == expected_visit
+	    && ftwbuf->depth >= (size_t)ctx->mindepth
+	    && ftwbuf->depth <= (size_t)ctx->maxdepth) {
+		struct eval_pool *pool = args->pool;
+		if (full && args->profiling) {
+			eval_expr(ctx->expr, &state);
+		} else if (pool && pool->ordered) {
+			size_t seq = eval_pool_reserve(pool);
+			if (eval_pool_push(pool, &state, seq) != 0) {
+				struct eval_output out = {0};
+				state.out = &out;
+				eval_main(&args->prog, &state);
+				state.out = NULL;
+				eval_pool_finish(pool, seq, &out);
+			}
+		} else if (!pool || eval_pool_push(pool, &state, 0) != 0) {
+			eval_main(&args->prog, &state);
+		}
+
+		if (full && args->adapt) {
+			eval_adapt_tick(args);
+		}
+	}
+
+	if (du && ftwbuf->parent_usage) {
+		*ftwbuf->parent_usage += state.du;
+	}
+
+	// Stop once -calibrate has seen enough files
+	if (full && args->calibration && ftwbuf->visit == BFTW_PRE && bfs_calibrate(args->calibration, ftwbuf)) {
+		state.action = BFTW_STOP;
+	}
+
+done:
+	if (state.action == BFTW_STOP) {
+		args->quit = true;
+	} else if (full && args->watch && state.action == BFTW_CONTINUE && ftwbuf->visit == BFTW_PRE && ftwbuf->type == BFS_DIR) {
+		if (bfs_watch_add(args->watch, ftwbuf) != 0) {
+			eval_error(&state, "${blu}-watch${rs}: %s.\n", errstr());
+		}
+	}
+
+	if (full) {
+		debug_stats(ctx, ftwbuf);
+	}
+
+	if (full && (ctx->debug & DEBUG_SEARCH)) {
+		bfs_dlog_search(ctx, ftwbuf, state.action);
+	}
+
+	bfs_trace_end("eval_callback", start);
+	return state.action;
+}
+
+/**
+ * bftw() callback.
+ */
+static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
+	return eval_file(ftwbuf, ptr, true);
+}
+
+/**
+ * Stream the next root from -files0-from.
+ */
+static const char *eval_next_root(void *ptr) {
+	struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
+
+	free(args->root);
+	args->root = xgetdelim(ctx->files0, '\0');
+	if (!args->root && errno) {
+		// Report the error here, and finish the search with the roots we have
+		bfs_error(ctx, "${blu}-files0-from${rs}: %s.\n", errstr());
+		args->ret = EXIT_FAILURE;
+		errno = 0;
 	}
+	return args->root;
+}
 
-	if (eval_expr(ctx->exclude, &state)) {
-		state.action = BFTW_PRUNE;
-		goto done;
-	}
+/**
+ * bftw() callback for searches that don't use any of the rarely used features
+ * (see eval_callback_simple()).
+ */
+static enum bftw_action eval_callback_fast(const struct BFTW *ftwbuf, void *ptr) {
+	return eval_file(ftwbuf, ptr, false);
+}
 
-	if (ctx->xargs_safe && strpbrk(ftwbuf->path, " \t\n\'\"\\")) {
-		eval_error(&state, "Path is not safe for xargs.\n");
-		state.action = BFTW_PRUNE;
-		goto done;
-	}
+/**
+ * Check whether eval_callback_fast() can be used instead of eval_callback().
+ */
+static bool eval_callback_simple(const struct callback_args *args) {
+	const struct bfs_ctx *ctx = args->ctx;
 
-	if (ctx->maxdepth < 0 || ftwbuf->depth >= (size_t)ctx->maxdepth) {
-		state.action = BFTW_PRUNE;
-	}
+	return ctx->shards == 0
+		&& !ctx->unique
+		&& !ctx->gitignore
+		&& !ctx->xargs_safe
+		&& !ctx->du
+		&& !(ctx->debug & (DEBUG_STAT | DEBUG_SEARCH))
+		&& !eval_must_measure(ctx)
+		&& !args->unlinker
+		&& !args->mounts
+		&& !args->index
+		&& !args->profiling
+		&& !args->adapt
+		&& !args->calibration
+		&& !args->watch;
+}
 
-	// In -depth mode, only handle directories on the BFTW_POST visit
-	enum bftw_visit expected_visit = BFTW_PRE;
-	if ((ctx->flags & BFTW_POST_ORDER)
-	    && (ctx->strategy == BFTW_IDS || ftwbuf->type == BFS_DIR)
-	    && ftwbuf->depth < (size_t)ctx->maxdepth) {
-		expected_visit = BFTW_POST;
+/** Run any buffered -exec ... + commands, before they're lost to a checkpoint. */
+static void eval_exec_sync(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_exec) {
+		bfs_exec_sync(expr->exec);
 	}
 
-	if (ftwbuf->visit == expected_visit
-	    && ftwbuf->depth >= (size_t)ctx->mindepth
-	    && ftwbuf->depth <= (size_t)ctx->maxdepth) {
-		eval_expr(ctx->expr, &state);
+	for_expr (child, expr) {
+		eval_exec_sync(child);
 	}
+}
 
-done:
-	debug_stats(ctx, ftwbuf);
+/** Save the remaining work (-checkpoint). */
+static void eval_checkpoint(const char **paths, const size_t *depths, size_t npaths, void *ptr) {
+	struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
 
-	if (bfs_debug(ctx, DEBUG_SEARCH, "eval_callback({\n")) {
-		fprintf(stderr, "\t.path = \"%s\",\n", ftwbuf->path);
-		fprintf(stderr, "\t.root = \"%s\",\n", ftwbuf->root);
-		fprintf(stderr, "\t.depth = %zu,\n", ftwbuf->depth);
-		fprintf(stderr, "\t.visit = %s,\n", dump_bftw_visit(ftwbuf->visit));
-		fprintf(stderr, "\t.type = %s,\n", dump_bfs_type(ftwbuf->type));
-		fprintf(stderr, "\t.error = %d,\n", ftwbuf->error);
-		fprintf(stderr, "}) == %s\n", dump_bftw_action(state.action));
-	}
+	// Everything visited so far must be finished before it's forgotten
+	eval_exec_sync(ctx->expr);
+	bfs_ctx_flush(ctx);
 
-	return state.action;
+	struct bfs_checkpoint checkpoint = {
+		.visited = args->count,
+		.paths = paths,
+		.depths = (size_t *)depths,
+		.npaths = npaths,
+	};
+
+	if (bfs_checkpoint_save(ctx->checkpoint, &checkpoint) != 0) {
+		bfs_error(ctx, "${blu}-checkpoint${rs} %pq: %s.\n", ctx->checkpoint, errstr());
+		++args->nerrors;
+		args->ret = EXIT_FAILURE;
+	}
 }
 
 /** Show/hide the bar in response to SIGINFO. */
@@ -1562,6 +4920,21 @@ static void reserve_fds(int limit) {
 	}
 }
 
+/**
+ * Shrink a default budget (0 for unlimited) to fit in 1/share of our cgroup's
+ * memory limit, if it has one.
+ */
+static size_t eval_memory_budget(const struct bfs_ctx *ctx, size_t budget, size_t share) {
+	size_t cap = ctx->memory_limit / share;
+	if (cap == 0) {
+		return budget;
+	} else if (budget == 0 || budget > cap) {
+		return cap;
+	} else {
+		return budget;
+	}
+}
+
 /** Infer the number of file descriptors available to bftw(). */
 static int infer_fdlimit(const struct bfs_ctx *ctx, int limit) {
 	// 3 for std{in,out,err}
@@ -1593,6 +4966,11 @@ done:
 	ret -= ctx->expr->persistent_fds;
 	ret -= ctx->expr->ephemeral_fds;
 
+	// Pipes for the captured output of each running command
+	if (ctx->exec_capture) {
+		ret -= 2 * ctx->exec_jobs;
+	}
+
 	// bftw() needs at least 2 available fds
 	if (ret < 2) {
 		ret = 2;
@@ -1617,6 +4995,16 @@ static void dump_bftw_flags(enum bftw_flags flags) {
 	DEBUG_FLAG(flags, BFTW_SORT);
 	DEBUG_FLAG(flags, BFTW_BUFFER);
 	DEBUG_FLAG(flags, BFTW_WHITEOUTS);
+	DEBUG_FLAG(flags, BFTW_SQPOLL);
+	DEBUG_FLAG(flags, BFTW_AFFINITY);
+	DEBUG_FLAG(flags, BFTW_INO_ORDER);
+	DEBUG_FLAG(flags, BFTW_SPLIT_ROOTS);
+	DEBUG_FLAG(flags, BFTW_AUTO_THREADS);
+	DEBUG_FLAG(flags, BFTW_BULKSTAT);
+	DEBUG_FLAG(flags, BFTW_DIRS_ONLY);
+	DEBUG_FLAG(flags, BFTW_SKIP_STALE);
+	DEBUG_FLAG(flags, BFTW_SHARE_TARGETS);
+	DEBUG_FLAG(flags, BFTW_READLINK);
 
 	bfs_assert(flags == 0, "Missing bftw flag 0x%X", flags);
 }
@@ -1630,6 +5018,7 @@ static const char *dump_bftw_strategy(enum bftw_strategy strategy) {
 		DUMP_MAP(BFTW_DFS),
 		DUMP_MAP(BFTW_IDS),
 		DUMP_MAP(BFTW_EDS),
+		DUMP_MAP(BFTW_BEST),
 	};
 	return strategies[strategy];
 }
@@ -1660,19 +5049,402 @@ static bool eval_must_buffer(const struct bfs_expr *expr) {
 	return false;
 }
 
+/** A bftw() search of a new directory for -watch. */
+struct watch_walk {
+	/** The main callback arguments. */
+	struct callback_args *args;
+	/** The depth of the new directory. */
+	size_t depth;
+	/** The root it was found under. */
+	const char *root;
+};
+
+/** bftw() callback for new directories, which forwards to eval_callback(). */
+static enum bftw_action watch_callback(const struct BFTW *ftwbuf, void *ptr) {
+	const struct watch_walk *walk = ptr;
+
+	// Make it look like part of the original search
+	struct BFTW copy = *ftwbuf;
+	copy.root = walk->root;
+	copy.depth += walk->depth;
+	return eval_callback(&copy, walk->args);
+}
+
+/** Evaluate the expression on a file from -watch. */
+static void eval_watch_event(struct callback_args *args, const struct bftw_args *bftw_args, const struct bfs_watch_event *event) {
+	const struct bfs_ctx *ctx = args->ctx;
+
+	if (event->type == BFS_DIR) {
+		// Search new directories in full, since things may have been
+		// created in them before we started watching them
+		struct watch_walk walk = {
+			.args = args,
+			.depth = event->depth,
+			.root = event->root,
+		};
+
+		const char *path = event->path;
+		struct bftw_args walk_args = *bftw_args;
+		walk_args.paths = &path;
+		walk_args.npaths = 1;
+		walk_args.callback = watch_callback;
+		walk_args.ptr = &walk;
+		walk_args.filter = NULL;
+		walk_args.stat_hint = NULL;
+		walk_args.priority = NULL;
+		walk_args.spills = NULL;
+		walk_args.progress = NULL;
+
+		if (bftw(&walk_args) != 0) {
+			args->ret = EXIT_FAILURE;
+			bfs_perror(ctx, "bftw()");
+		}
+		return;
+	}
+
+	// Scratch space for stat() and readlink() info
+	struct bfs_stat scratch[2];
+	dchar *link_buf = NULL;
+
+	struct BFTW ftwbuf = {
+		.path = event->path,
+		.nameoff = event->nameoff,
+		.root = event->root,
+		.depth = event->depth,
+		.visit = BFTW_PRE,
+		.at_fd = AT_FDCWD,
+		.at_path = event->path,
+		.stat_flags = (ctx->flags & BFTW_FOLLOW_ALL) ? BFS_STAT_TRYFOLLOW : BFS_STAT_NOFOLLOW,
+		.stat_mask = bftw_args->stat_mask,
+		.stat_bufs = {
+			.stat_buf = &scratch[0],
+			.lstat_buf = &scratch[1],
+			.stat_err = -1,
+			.lstat_err = -1,
+			.link_buf = &link_buf,
+			.link_err = -1,
+		},
+		.empty = -1,
+	};
+
+	const struct bfs_stat *buf = bftw_stat(&ftwbuf, ftwbuf.stat_flags);
+	if (!buf) {
+		// Already gone
+		return;
+	}
+	ftwbuf.type = bfs_mode_to_type(buf->mode);
+
+	eval_callback(&ftwbuf, args);
+	dstrfree(link_buf);
+}
+
+/** Keep evaluating the expression on new and modified files (-watch). */
+static void eval_watch(struct callback_args *args, const struct bftw_args *bftw_args) {
+	const struct bfs_ctx *ctx = args->ctx;
+
+	while (!args->quit) {
+		// Show the results so far before we block
+		bfs_ctx_flush(ctx);
+
+		struct bfs_watch_event event;
+		int ret = bfs_watch_wait(args->watch, &event);
+		if (ret == 0) {
+			break;
+		} else if (ret > 0) {
+			eval_watch_event(args, bftw_args, &event);
+		} else if (errno == EOVERFLOW) {
+			bfs_warning(ctx, "${blu}-watch${rs}: Too many changes at once, some were missed.\n");
+		} else {
+			bfs_error(ctx, "${blu}-watch${rs}: %s.\n", errstr());
+			args->ret = EXIT_FAILURE;
+			break;
+		}
+	}
+}
+
+/** Bring the -update-index up to date before searching it. */
+static int eval_update_index(struct bfs_ctx *ctx, const struct bftw_args *bftw_args) {
+	const char *path = ctx->index_path;
+	int error;
+
+	// Write the new index next to the old one, then replace it atomically
+	dchar *tmp = dstrprintf("%s.XXXXXX", path);
+	if (!tmp) {
+		goto fail;
+	}
+
+	int fd = mkstemp(tmp);
+	if (fd < 0) {
+		goto fail;
+	}
+	xclose(fd);
+
+	struct bfs_index_writer *writer = bfs_index_create(tmp, bfs_index_fields(ctx->index));
+	if (!writer) {
+		goto fail_tmp;
+	}
+
+	int ret = bfs_index_refresh(ctx->index, writer, bftw_args);
+	error = errno;
+	if (bfs_index_close(writer) != 0) {
+		ret = -1;
+	} else {
+		errno = error;
+	}
+	if (ret != 0) {
+		goto fail_tmp;
+	}
+
+	if (rename(tmp, path) != 0) {
+		goto fail_tmp;
+	}
+	dstrfree(tmp);
+	tmp = NULL;
+
+	struct bfs_index *index = bfs_index_open(path);
+	if (!index) {
+		goto fail;
+	}
+	bfs_index_free(ctx->index);
+	ctx->index = index;
+	return 0;
+
+fail_tmp:
+	error = errno;
+	unlink(tmp);
+	errno = error;
+fail:
+	bfs_error(ctx, "${blu}-update-index${rs} %pq: %s.\n", path, errstr());
+	dstrfree(tmp);
+	return -1;
+}
+
+/** Print the arena memory usage (-D mem). */
+static void eval_dump_mem(const struct bfs_ctx *ctx) {
+	if (!(ctx->debug & DEBUG_MEM)) {
+		return;
+	}
+
+	size_t count;
+	const struct arena_stats *stats = arena_stats(&count);
+	for (size_t i = 0; i < count; ++i) {
+		const struct arena_stats *arena = &stats[i];
+		bfs_debug(ctx, DEBUG_MEM, "${blu}%s${rs}: %zu live (peak %zu), %zu slab(s), %zu KiB (peak %zu KiB)\n",
+			arena->name, arena->live, arena->peak, arena->nslabs,
+			(arena->bytes + 1023) / 1024, (arena->peak_bytes + 1023) / 1024);
+	}
+}
+
+/** Print one line of system call counters (-D perf). */
+static void eval_dump_counter(const struct bfs_ctx *ctx, const char *indent, const char *name, size_t index, const struct bfs_perf_counter *counter) {
+	if (counter->calls == 0) {
+		return;
+	}
+
+	CFILE *cerr = ctx->cerr;
+	if (!bfs_debug_prefix(ctx, DEBUG_PERF)) {
+		return;
+	}
+
+	cfprintf(cerr, "%s${blu}%s${rs}", indent, name);
+	if (index > 0) {
+		cfprintf(cerr, " ${blu}#%zu${rs}", index);
+	}
+
+	cfprintf(cerr, ": %zu call(s), %g ms", (size_t)counter->calls, counter->sum / 1.0e6);
+	if (counter->bytes > 0) {
+		cfprintf(cerr, ", %zu KiB", (size_t)((counter->bytes + 1023) / 1024));
+	}
+
+	cfprintf(cerr, " (p50 %g us, p90 %g us, p99 %g us)\n",
+		bfs_perf_percentile(counter, 50) / 1.0e3,
+		bfs_perf_percentile(counter, 90) / 1.0e3,
+		bfs_perf_percentile(counter, 99) / 1.0e3);
+}
+
+/** Print the system call counters (-D perf). */
+static void eval_dump_perf(const struct bfs_ctx *ctx) {
+	if (!(ctx->debug & DEBUG_PERF)) {
+		return;
+	}
+
+	const struct bfs_perf_thread *threads = bfs_perf_threads();
+
+	for (enum bfs_perf_op op = 0; op < BFS_PERF_OPS; ++op) {
+		struct bfs_perf_counter total = {0};
+		struct bfs_perf_counter sync = {0};
+		struct bfs_perf_counter async = {0};
+		size_t nthreads = 0;
+
+		for (const struct bfs_perf_thread *thread = threads; thread; thread = thread->next) {
+			const struct bfs_perf_counter *counter = &thread->ops[op];
+			if (counter->calls == 0) {
+				continue;
+			}
+
+			++nthreads;
+			bfs_perf_merge(&total, counter);
+			if (strcmp(thread->name, "ioq") == 0) {
+				bfs_perf_merge(&async, counter);
+			} else {
+				bfs_perf_merge(&sync, counter);
+			}
+		}
+
+		eval_dump_counter(ctx, "", bfs_perf_op_name(op), 0, &total);
+		if (sync.calls > 0 && async.calls > 0) {
+			eval_dump_counter(ctx, "    ", "sync", 0, &sync);
+			eval_dump_counter(ctx, "    ", "ioq", 0, &async);
+		}
+		if (nthreads > 1) {
+			for (const struct bfs_perf_thread *thread = threads; thread; thread = thread->next) {
+				eval_dump_counter(ctx, "    ", thread->name, thread->index + 1, &thread->ops[op]);
+			}
+		}
+	}
+
+	for (enum ioq_op op = IOQ_CLOSE; op <= IOQ_READLINK; ++op) {
+		struct bfs_perf_counter phases[BFS_PERF_PHASES] = {0};
+		for (const struct bfs_perf_thread *thread = threads; thread; thread = thread->next) {
+			for (enum bfs_perf_phase phase = 0; phase < BFS_PERF_PHASES; ++phase) {
+				bfs_perf_merge(&phases[phase], &thread->ioq[op][phase]);
+			}
+		}
+
+		if (phases[BFS_PERF_TOTAL].calls == 0) {
+			continue;
+		}
+
+		bfs_debug(ctx, DEBUG_PERF, "${blu}ioq %s${rs}:\n", ioq_op_name(op));
+		for (enum bfs_perf_phase phase = 0; phase < BFS_PERF_PHASES; ++phase) {
+			eval_dump_counter(ctx, "    ", bfs_perf_phase_name(phase), 0, &phases[phase]);
+		}
+	}
+
+	for (enum bfs_perf_gauge gauge = 0; gauge < BFS_PERF_GAUGES; ++gauge) {
+		struct bfs_perf_counter total = {0};
+		for (const struct bfs_perf_thread *thread = threads; thread; thread = thread->next) {
+			bfs_perf_merge(&total, &thread->gauges[gauge]);
+		}
+
+		if (total.calls == 0) {
+			continue;
+		}
+
+		bfs_debug(ctx, DEBUG_PERF, "${blu}ioq %s${rs}: %zu sample(s), mean %g (p50 < %zu, p90 < %zu, p99 < %zu)\n",
+			bfs_perf_gauge_name(gauge), (size_t)total.calls, (double)total.sum / total.calls,
+			(size_t)bfs_perf_percentile(&total, 50),
+			(size_t)bfs_perf_percentile(&total, 90),
+			(size_t)bfs_perf_percentile(&total, 99));
+	}
+
+	for (enum bfs_perf_event event = 0; event < BFS_PERF_EVENTS; ++event) {
+		uint64_t count = 0;
+		for (const struct bfs_perf_thread *thread = threads; thread; thread = thread->next) {
+			count += thread->events[event];
+		}
+
+		if (count > 0) {
+			bfs_debug(ctx, DEBUG_PERF, "${blu}%s${rs}: %zu\n", bfs_perf_event_name(event), (size_t)count);
+		}
+	}
+}
+
 int bfs_eval(struct bfs_ctx *ctx) {
 	if (!ctx->expr) {
 		return EXIT_SUCCESS;
 	}
 
+	if (ctx->debug & DEBUG_PERF) {
+		bfs_perf_enable();
+	}
+
 	struct callback_args args = {
 		.ctx = ctx,
 		.ret = EXIT_SUCCESS,
 	};
 
+	if (ctx->index && (ctx->flags & BFTW_POST_ORDER)) {
+		bfs_error(ctx, "${blu}-index${rs} can't be searched in post-order (${blu}-depth${rs}, ${blu}-delete${rs}).\n");
+		return EXIT_FAILURE;
+	}
+
+	if (ctx->watch) {
+		args.watch = bfs_watch_new();
+		if (!args.watch) {
+			bfs_error(ctx, "${blu}-watch${rs}: %s.\n", errstr());
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (ctx->save_index) {
+		args.index = bfs_index_create(ctx->save_index, ctx->index_fields);
+		if (!args.index) {
+			bfs_error(ctx, "${blu}-save-index${rs} %pq: %s.\n", ctx->save_index, errstr());
+			bfs_watch_free(args.watch);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (ctx->calibrate) {
+		args.calibration = bfs_calibration_new();
+		if (!args.calibration) {
+			bfs_error(ctx, "${blu}-calibrate${rs} %pq: %s.\n", ctx->calibrate, errstr());
+			bfs_index_close(args.index);
+			bfs_watch_free(args.watch);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (ctx->io_rate || ctx->io_depth) {
+		args.throttle = bfs_throttle_new(ctx->io_rate, ctx->io_depth);
+		if (!args.throttle) {
+			bfs_perror(ctx, "bfs_throttle_new()");
+			bfs_calibration_free(args.calibration);
+			bfs_index_close(args.index);
+			bfs_watch_free(args.watch);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (ctx->io_idle && bfs_ioprio_idle() != 0) {
+		bfs_warning(ctx, "${blu}-io-idle${rs}: %s.\n\n", errstr());
+	}
+
+	if (ctx->trace && bfs_trace_open(ctx->trace) != 0) {
+		bfs_error(ctx, "${blu}-trace${rs} %pq: %s.\n", ctx->trace, errstr());
+		bfs_throttle_free(args.throttle);
+		bfs_calibration_free(args.calibration);
+		bfs_index_close(args.index);
+		bfs_watch_free(args.watch);
+		return EXIT_FAILURE;
+	}
+
+	if (ctx->debug_log && bfs_dlog_open(ctx->debug_log) != 0) {
+		bfs_error(ctx, "${blu}-debug-log${rs} %pq: %s.\n", ctx->debug_log, errstr());
+		bfs_throttle_free(args.throttle);
+		bfs_calibration_free(args.calibration);
+		bfs_index_close(args.index);
+		bfs_watch_free(args.watch);
+		return EXIT_FAILURE;
+	}
+
+	if (ctx->resume) {
+		args.count = ctx->resume->visited;
+	}
+
+	trie_init(&args.errsum);
+	if (ctx->errors != BFS_ERRORS_EACH) {
+		// stderr starts out unbuffered, so nothing is pending yet.  The
+		// buffer is flushed before -exec/-ok, and when bfs exits.
+		setvbuf(ctx->cerr->file, NULL, _IOFBF, BUFSIZ);
+	}
+
 	if (ctx->status) {
 		args.bar = bfs_bar_show();
-		if (!args.bar) {
+		if (args.bar) {
+			status_ticker_start(&args.ticker, args.count, 0);
+		} else {
 			bfs_warning(ctx, "Couldn't show status bar: %s.\n\n", errstr());
 		}
 	}
@@ -1684,9 +5456,9 @@ int bfs_eval(struct bfs_ctx *ctx) {
 #endif
 	struct sighook *info_hook = sighook(siginfo, eval_siginfo, &args, SH_CONTINUE);
 
-	struct trie seen;
+	struct idfilter seen;
 	if (ctx->unique) {
-		trie_init(&seen);
+		idfilter_init(&seen);
 		args.seen = &seen;
 	}
 
@@ -1694,9 +5466,56 @@ int bfs_eval(struct bfs_ctx *ctx) {
 	reserve_fds(fdlimit);
 	fdlimit = infer_fdlimit(ctx, fdlimit);
 
+	// -D rates needs to time and count every evaluation, so keep walking
+	// the tree in that case
+	if (!eval_must_measure(ctx)) {
+		eval_compile(&args.prog, ctx->expr);
+		bfs_debug(ctx, DEBUG_OPT, "Compiled expression to %zu instruction(s), fusing %zu stat() comparison(s)\n", args.prog.len, args.prog.nranges);
+	}
+
 	// -1 for the main thread
 	int nthreads = ctx->threads - 1;
 
+	// -D rates, search, and stat need to see every evaluation in order
+	enum debug_flags serial_debug = DEBUG_MEM | DEBUG_RATES | DEBUG_SEARCH | DEBUG_STAT;
+	// Checkpoints must not miss files that are still being evaluated
+	bool checkpoint = ctx->checkpoint;
+	if (ctx->parallel && nthreads > 0 && !(ctx->debug & serial_debug) && !ctx->save_profile && !ctx->watch && !checkpoint) {
+		if (eval_parallel_safe(ctx->expr)) {
+			// -nouser and -nogroup look things up from the workers
+			bfs_users_share(ctx->users);
+			bfs_groups_share(ctx->groups);
+			args.pool = eval_pool_create(ctx, &args.prog, nthreads);
+			if (!args.pool) {
+				bfs_warning(ctx, "Couldn't start evaluator threads: %s.\n\n", errstr());
+			}
+		} else {
+			bfs_debug(ctx, DEBUG_OPT, "Expression is not safe to evaluate in parallel\n");
+		}
+	}
+
+	if (nthreads > 0 && !checkpoint && eval_background_delete(ctx)) {
+		args.unlinker = eval_unlinker_create(ctx, nthreads, args.throttle, &args.nerrors, &args.ret);
+		if (args.unlinker) {
+			bfs_debug(ctx, DEBUG_OPT, "Deleting files in the background\n");
+		}
+	}
+
+	// Adaptive reordering mutates the expression, so not with -parallel
+	if (ctx->optlevel >= 4 && args.prog.ops && !args.pool) {
+		args.adapt = true;
+		args.profiling = true;
+		args.adapt_left = ADAPT_SAMPLE;
+	}
+
+	size_t spills = 0;
+
+	// Don't parse the mount table unless bftw() needs it
+	const struct bfs_mtab *mtab = NULL;
+	if (ctx->file_types || ctx->nfslimits > 0 || ctx->nstat_cache > 0 || (ctx->flags & (BFTW_BULKSTAT | BFTW_DIRS_ONLY))) {
+		mtab = bfs_ctx_mtab(ctx);
+	}
+
 	struct bftw_args bftw_args = {
 		.paths = ctx->paths,
 		.npaths = ctx->npaths,
@@ -1706,13 +5525,101 @@ int bfs_eval(struct bfs_ctx *ctx) {
 		.nthreads = nthreads,
 		.flags = ctx->flags,
 		.strategy = ctx->strategy,
-		.mtab = bfs_ctx_mtab(ctx),
+		.stale_time = ctx->stale_time,
+		.mtab = mtab,
+		.stat_mask = ctx->stat_mask,
+		.fsade_checks = ctx->fsade_checks,
+		.fsade_xattr = ctx->fsade_xattr,
+		.fsade_hash = ctx->fsade_hash,
+		.fsade_grep = ctx->fsade_grep,
+		.fslimits = ctx->fslimits,
+		.nfslimits = ctx->nfslimits,
+		.stat_cache = ctx->stat_cache,
+		.nstat_cache = ctx->nstat_cache,
+		// A million queued directories is a few hundred MiB
+		.frontier = eval_memory_budget(ctx, 1 << 20, 1024),
+		.spills = &spills,
+		.progress = &args.progress,
+		.sort_limit = ctx->sort_limit,
+		.dir_memory = ctx->dir_memory ? ctx->dir_memory : eval_memory_budget(ctx, 0, 16),
+		// Stale listings would confuse -delete and friends
+		.listing_memory = ctx->mutates ? 0 : eval_memory_budget(ctx, 64 << 20, 16),
+		.throttle = args.throttle,
+		.io_timeout = 1000000000ULL * ctx->io_timeout,
 	};
 
+	if (eval_can_filter(ctx)) {
+		bftw_args.filter = eval_filter;
+	}
+
+	if (ctx->nstat_guards > 0) {
+		bftw_args.stat_hint = eval_stat_hint;
+	}
+
+	if (ctx->ngoals > 0) {
+		bftw_args.priority = eval_priority;
+	}
+
+	if (ctx->auto_threads) {
+		// Start where -j would, but allow up to 64 I/O threads for
+		// slow network file systems
+		bftw_args.flags |= BFTW_AUTO_THREADS;
+		bftw_args.active_threads = nthreads > 0 ? nthreads : 1;
+		bftw_args.nthreads = 64;
+	}
+
+	if (ctx->files0) {
+		bftw_args.next_path = eval_next_root;
+	}
+
+	if (ctx->resume) {
+		bftw_args.paths = ctx->resume->paths;
+		bftw_args.npaths = ctx->resume->npaths;
+		bftw_args.depths = ctx->resume->depths;
+	}
+
+	const char **dedup_paths = NULL;
+	struct idset mounts, mounted;
+	idset_init(&mounts);
+	idset_init(&mounted);
+	if (ctx->dedup) {
+		if (!ctx->resume) {
+			dedup_paths = eval_dedup_roots(ctx, &bftw_args.npaths);
+			if (dedup_paths) {
+				bftw_args.paths = dedup_paths;
+			} else {
+				bfs_warning(ctx, "${blu}-dedup${rs}: %s.\n\n", errstr());
+			}
+		}
+
+		const struct bfs_mtab *dedup_mtab = bfs_ctx_mtab(ctx);
+		if (!dedup_mtab || bfs_mtab_shared_roots(dedup_mtab, &mounts) != 0) {
+			bfs_warning(ctx, "${blu}-dedup${rs}: Couldn't find duplicate mounts: %s.\n\n", errstr());
+		}
+		if (mounts.count > 0) {
+			args.mounts = &mounts;
+			args.mounted = &mounted;
+		}
+	}
+
+	if (checkpoint) {
+		bftw_args.checkpoint = eval_checkpoint;
+		bftw_args.checkpoint_interval = 1000000000ULL * ctx->checkpoint_interval;
+	}
+
+	// Make sure bftw() fetches the fields the index should save
+	if (args.index && bftw_args.stat_mask) {
+		bftw_args.stat_mask |= ctx->index_fields;
+	}
+
 	if (eval_must_buffer(ctx->expr)) {
 		bftw_args.flags |= BFTW_BUFFER;
 	}
 
+	if (eval_callback_simple(&args)) {
+		bftw_args.callback = eval_callback_fast;
+	}
+
 	if (bfs_debug(ctx, DEBUG_SEARCH, "bftw({\n")) {
 		fprintf(stderr, "\t.paths = {\n");
 		for (size_t i = 0; i < bftw_args.npaths; ++i) {
@@ -1720,40 +5627,170 @@ int bfs_eval(struct bfs_ctx *ctx) {
 		}
 		fprintf(stderr, "\t},\n");
 		fprintf(stderr, "\t.npaths = %zu,\n", bftw_args.npaths);
-		fprintf(stderr, "\t.callback = eval_callback,\n");
+		if (bftw_args.next_path) {
+			fprintf(stderr, "\t.next_path = eval_next_root,\n");
+		}
+		if (bftw_args.depths) {
+			fprintf(stderr, "\t.depths = ctx->resume->depths,\n");
+		}
+		fprintf(stderr, "\t.callback = %s,\n", bftw_args.callback == eval_callback_fast ? "eval_callback_fast" : "eval_callback");
 		fprintf(stderr, "\t.ptr = &args,\n");
+		if (bftw_args.filter) {
+			fprintf(stderr, "\t.filter = eval_filter,\n");
+		}
+		if (bftw_args.stat_hint) {
+			fprintf(stderr, "\t.stat_hint = eval_stat_hint,\n");
+		}
+		if (bftw_args.priority) {
+			fprintf(stderr, "\t.priority = eval_priority,\n");
+		}
 		fprintf(stderr, "\t.nopenfd = %d,\n", bftw_args.nopenfd);
 		fprintf(stderr, "\t.nthreads = %d,\n", bftw_args.nthreads);
+		if (bftw_args.flags & BFTW_AUTO_THREADS) {
+			fprintf(stderr, "\t.active_threads = %d,\n", bftw_args.active_threads);
+		}
 		fprintf(stderr, "\t.flags = ");
 		dump_bftw_flags(bftw_args.flags);
 		fprintf(stderr, ",\n\t.strategy = %s,\n", dump_bftw_strategy(bftw_args.strategy));
+		if (bftw_args.flags & BFTW_SKIP_STALE) {
+			fprintf(stderr, "\t.stale_time = {%lld, %ld},\n", (long long)bftw_args.stale_time.tv_sec, (long)bftw_args.stale_time.tv_nsec);
+		}
 		fprintf(stderr, "\t.mtab = ");
 		if (bftw_args.mtab) {
 			fprintf(stderr, "ctx->mtab");
 		} else {
 			fprintf(stderr, "NULL");
 		}
-		fprintf(stderr, ",\n})\n");
+		fprintf(stderr, ",\n\t.stat_mask = 0x%x", (unsigned int)bftw_args.stat_mask);
+		fprintf(stderr, ",\n\t.fsade_checks = 0x%x", (unsigned int)bftw_args.fsade_checks);
+		if (bftw_args.fsade_xattr) {
+			fprintf(stderr, ",\n\t.fsade_xattr = \"%s\"", bftw_args.fsade_xattr);
+		}
+		if (bftw_args.fsade_checks & BFS_CHECK_HASH) {
+			fprintf(stderr, ",\n\t.fsade_hash = %s", bfs_hash_name(bftw_args.fsade_hash));
+		}
+		if (bftw_args.fsade_grep) {
+			fprintf(stderr, ",\n\t.fsade_grep = ctx->fsade_grep");
+		}
+		fprintf(stderr, ",\n\t.fslimits = {");
+		for (size_t i = 0; i < bftw_args.nfslimits; ++i) {
+			const struct bftw_fslimit *fslimit = &bftw_args.fslimits[i];
+			fprintf(stderr, "\n\t\t{\"%s\", %zu},", fslimit->type, fslimit->limit);
+		}
+		if (bftw_args.nfslimits > 0) {
+			fprintf(stderr, "\n\t");
+		}
+		fprintf(stderr, "},\n\t.nfslimits = %zu,\n", bftw_args.nfslimits);
+		if (bftw_args.nstat_cache > 0) {
+			fprintf(stderr, "\t.stat_cache = {");
+			for (size_t i = 0; i < bftw_args.nstat_cache; ++i) {
+				fprintf(stderr, "\"%s\", ", bftw_args.stat_cache[i]);
+			}
+			fprintf(stderr, "},\n\t.nstat_cache = %zu,\n", bftw_args.nstat_cache);
+		}
+		fprintf(stderr, "\t.frontier = %zu,\n", bftw_args.frontier);
+		fprintf(stderr, "\t.spills = &spills,\n");
+		fprintf(stderr, "\t.progress = &args.progress,\n");
+		fprintf(stderr, "\t.sort_limit = %zu,\n", bftw_args.sort_limit);
+		fprintf(stderr, "\t.dir_memory = %zu,\n", bftw_args.dir_memory);
+		fprintf(stderr, "\t.listing_memory = %zu,\n", bftw_args.listing_memory);
+		fprintf(stderr, "\t.lookahead = %zu,\n", bftw_args.lookahead);
+		if (bftw_args.throttle) {
+			fprintf(stderr, "\t.throttle = args.throttle,\n");
+		}
+		if (bftw_args.io_timeout) {
+			fprintf(stderr, "\t.io_timeout = %llu,\n", (unsigned long long)bftw_args.io_timeout);
+		}
+		if (bftw_args.checkpoint) {
+			fprintf(stderr, "\t.checkpoint = eval_checkpoint,\n");
+			fprintf(stderr, "\t.checkpoint_interval = %llu,\n", (unsigned long long)bftw_args.checkpoint_interval);
+		}
+		fprintf(stderr, "})\n");
 	}
 
-	if (bftw(&bftw_args) != 0) {
+	if (ctx->index) {
+		if (ctx->update_index && eval_update_index(ctx, &bftw_args) != 0) {
+			args.ret = EXIT_FAILURE;
+		} else if (bfs_index_walk(ctx->index, &bftw_args) != 0) {
+			args.ret = EXIT_FAILURE;
+			bfs_error(ctx, "${blu}-index${rs} %pq: %s.\n", ctx->index_path, errstr());
+		}
+	} else if (ctx->changed_since) {
+		if (bfs_snapdiff_walk(ctx->changed_since, bfs_ctx_mtab(ctx), &bftw_args) != 0) {
+			args.ret = EXIT_FAILURE;
+			bfs_error(ctx, "${blu}-changed-since${rs} %pq: %s.\n", ctx->changed_since, errstr());
+		}
+	} else if (bftw(&bftw_args) != 0) {
 		args.ret = EXIT_FAILURE;
 		bfs_perror(ctx, "bftw()");
+	} else if (checkpoint && !args.quit) {
+		// Leave behind an empty checkpoint, so -resume has nothing to do
+		eval_checkpoint(NULL, NULL, 0, &args);
+	}
+
+	if (args.watch && !args.quit) {
+		eval_watch(&args, &bftw_args);
+	}
+	bfs_watch_free(args.watch);
+
+	if (args.index && bfs_index_close(args.index) != 0) {
+		bfs_error(ctx, "${blu}-save-index${rs} %pq: %s.\n", ctx->save_index, errstr());
+		args.ret = EXIT_FAILURE;
+	}
+
+	if (args.calibration && bfs_calibration_save(args.calibration, ctx->calibrate) != 0) {
+		bfs_error(ctx, "${blu}-calibrate${rs} %pq: %s.\n", ctx->calibrate, errstr());
+		args.ret = EXIT_FAILURE;
 	}
+	bfs_calibration_free(args.calibration);
+
+	if (spills > 0) {
+		bfs_debug(ctx, DEBUG_SEARCH, "Frontier limit reached %zu time(s), searched depth-first in the meantime\n", spills);
+	}
+
+	eval_pool_destroy(args.pool, &args.nerrors, &args.ret);
+	eval_unlinker_destroy(args.unlinker);
+	bfs_throttle_free(args.throttle);
+	eval_prog_free(&args.prog);
 
 	if (eval_exec_finish(ctx->expr, ctx) != 0) {
 		args.ret = EXIT_FAILURE;
 	}
 
+	eval_count_finish(ctx->expr);
+	eval_top_finish(ctx->expr);
+
 	bfs_ctx_dump(ctx, DEBUG_RATES);
+	eval_dump_mem(ctx);
+	eval_dump_perf(ctx);
+
+	if (ctx->save_profile && eval_save_profile(ctx) != 0) {
+		bfs_error(ctx, "${blu}-save-profile${rs} %pq: %s.\n", ctx->save_profile, errstr());
+		args.ret = EXIT_FAILURE;
+	}
 
 	if (ctx->unique) {
-		trie_destroy(&seen);
+		idfilter_destroy(&seen);
 	}
 
+	idset_destroy(&mounted);
+	idset_destroy(&mounts);
+	free(dedup_paths);
+
 	sigunhook(info_hook);
+	status_ticker_stop(&args.ticker);
 	bfs_bar_hide(args.bar);
 
+	eval_errsum_report(&args);
+	trie_destroy(&args.errsum);
+
+	free(args.root);
+
+	for (size_t i = 0; i < args.nignores; ++i) {
+		bfs_ignore_free(args.ignores[i]);
+	}
+	free(args.ignores);
+
 	if (ctx->ignore_errors && args.nerrors > 0) {
 		bfs_warning(ctx, "Suppressed errors: %zu\n", args.nerrors);
 	}
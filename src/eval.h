@@ -17,6 +17,9 @@ struct bfs_expr;
  */
 struct bfs_eval;
 
+/** The most common subexpressions whose results can be remembered per file. */
+#define BFS_CSE_MAX 64
+
 /**
  * Expression evaluation function.
  *
@@ -39,6 +42,11 @@ typedef bool bfs_eval_fn(const struct bfs_expr *expr, struct bfs_eval *state);
  */
 int bfs_eval(struct bfs_ctx *ctx);
 
+/**
+ * The number of directories that -delete may keep open for background unlinks.
+ */
+#define BFS_DELETE_DIRS 4
+
 // Predicate evaluation functions
 
 bool eval_true(const struct bfs_expr *expr, struct bfs_eval *state);
@@ -65,6 +73,8 @@ bool eval_depth(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_empty(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_flags(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fstype(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_grep(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_hash(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_hidden(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_inum(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_links(const struct bfs_expr *expr, struct bfs_eval *state);
@@ -76,20 +86,33 @@ bool eval_xtype(const struct bfs_expr *expr, struct bfs_eval *state);
 
 bool eval_lname(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_names(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_name_from(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_path(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_path_from(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_regex(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_regexes(const struct bfs_expr *expr, struct bfs_eval *state);
 
+bool eval_chmod(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_chown(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_coproc(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_count(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_du(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_exit(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fls(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprint(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprint0(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_fprintjson(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprintf(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprintx(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_limit(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_prune(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_quit(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_top(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_touch(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_visit(const struct bfs_expr *expr, struct bfs_eval *state);
 
 // Operator evaluation functions
 bool eval_not(const struct bfs_expr *expr, struct bfs_eval *state);
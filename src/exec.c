@@ -10,11 +10,14 @@
 #include "color.h"
 #include "ctx.h"
 #include "diag.h"
+#include "dlog.h"
 #include "dstring.h"
+#include "trace.h"
 #include "xspawn.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,23 +31,20 @@ _printf(2, 3)
 static void bfs_exec_debug(const struct bfs_exec *execbuf, const char *format, ...) {
 	const struct bfs_ctx *ctx = execbuf->ctx;
 
-	if (!bfs_debug(ctx, DEBUG_EXEC, "${blu}")) {
+	if (!(ctx->debug & DEBUG_EXEC)) {
 		return;
 	}
 
+	const char *label;
 	if (execbuf->flags & BFS_EXEC_CONFIRM) {
-		fputs("-ok", stderr);
+		label = execbuf->flags & BFS_EXEC_CHDIR ? "-okdir" : "-ok";
 	} else {
-		fputs("-exec", stderr);
+		label = execbuf->flags & BFS_EXEC_CHDIR ? "-execdir" : "-exec";
 	}
-	if (execbuf->flags & BFS_EXEC_CHDIR) {
-		fputs("dir", stderr);
-	}
-	cfprintf(ctx->cerr, "${rs}: ");
 
 	va_list args;
 	va_start(args, format);
-	vfprintf(stderr, format, args);
+	bfs_dlog_vexec(ctx, label, format, args);
 	va_end(args);
 }
 
@@ -56,8 +56,19 @@ static size_t bfs_exec_arg_size(const char *arg) {
 /** Even if we can pass a bigger argument list, cap it here. */
 #define BFS_EXEC_ARG_MAX (16 << 20)
 
-/** Determine the maximum argv size. */
-static size_t bfs_exec_arg_max(const struct bfs_exec *execbuf) {
+/** Clamp an ARG_MAX estimate to a sensible range. */
+static size_t bfs_exec_clamp_max(long arg_max) {
+	if (arg_max < 0) {
+		return 0;
+	} else if (arg_max > BFS_EXEC_ARG_MAX) {
+		return BFS_EXEC_ARG_MAX;
+	} else {
+		return arg_max;
+	}
+}
+
+/** Determine the initial bounds for the maximum argv size. */
+static void bfs_exec_arg_max(struct bfs_exec *execbuf) {
 	long arg_max = xsysconf(_SC_ARG_MAX);
 	bfs_exec_debug(execbuf, "ARG_MAX: %ld according to sysconf()\n", arg_max);
 	if (arg_max < 0) {
@@ -65,22 +76,31 @@ static size_t bfs_exec_arg_max(const struct bfs_exec *execbuf) {
 		bfs_exec_debug(execbuf, "ARG_MAX: %ld assumed\n", arg_max);
 	}
 
+	long fixed = 0;
+
 	// We have to share space with the environment variables
 	extern char **environ;
 	for (char **envp = environ; *envp; ++envp) {
-		arg_max -= bfs_exec_arg_size(*envp);
+		fixed += bfs_exec_arg_size(*envp);
 	}
 	// Account for the terminating NULL entry
-	arg_max -= sizeof(char *);
-	bfs_exec_debug(execbuf, "ARG_MAX: %ld remaining after environment variables\n", arg_max);
+	fixed += sizeof(char *);
+	bfs_exec_debug(execbuf, "ARG_MAX: %ld remaining after environment variables\n", arg_max - fixed);
 
 	// Account for the fixed arguments
 	for (size_t i = 0; i < execbuf->tmpl_argc - 1; ++i) {
-		arg_max -= bfs_exec_arg_size(execbuf->tmpl_argv[i]);
+		fixed += bfs_exec_arg_size(execbuf->tmpl_argv[i]);
 	}
 	// Account for the terminating NULL entry
-	arg_max -= sizeof(char *);
-	bfs_exec_debug(execbuf, "ARG_MAX: %ld remaining after fixed arguments\n", arg_max);
+	fixed += sizeof(char *);
+	bfs_exec_debug(execbuf, "ARG_MAX: %ld remaining after fixed arguments\n", arg_max - fixed);
+
+	execbuf->arg_fixed = fixed;
+	arg_max -= fixed;
+
+	// The kernel may count arguments exactly, so the real limit could be
+	// this high.  We'll find out by calibrating against E2BIG.
+	execbuf->arg_max = bfs_exec_clamp_max(arg_max);
 
 	// Assume arguments are counted with the granularity of a single page,
 	// so allow a one page cushion to account for rounding up
@@ -95,14 +115,10 @@ static size_t bfs_exec_arg_max(const struct bfs_exec *execbuf) {
 	arg_max -= 2048;
 	bfs_exec_debug(execbuf, "ARG_MAX: %ld remaining after headroom\n", arg_max);
 
-	if (arg_max < 0) {
-		arg_max = 0;
-	} else if (arg_max > BFS_EXEC_ARG_MAX) {
-		arg_max = BFS_EXEC_ARG_MAX;
-	}
+	// The conservative estimate is our initial guess for the lower bound
+	execbuf->arg_min = bfs_exec_clamp_max(arg_max);
 
-	bfs_exec_debug(execbuf, "ARG_MAX: %ld final value\n", arg_max);
-	return arg_max;
+	bfs_exec_debug(execbuf, "ARG_MAX between [%zu, %zu] initially\n", execbuf->arg_min, execbuf->arg_max);
 }
 
 /** Highlight part of the command line as an error. */
@@ -187,8 +203,7 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
 		}
 		execbuf->argc = execbuf->tmpl_argc - 1;
 
-		execbuf->arg_max = bfs_exec_arg_max(execbuf);
-		execbuf->arg_min = execbuf->arg_max;
+		bfs_exec_arg_max(execbuf);
 	}
 
 	return execbuf;
@@ -327,8 +342,111 @@ static void bfs_exec_closewd(struct bfs_exec *execbuf, const struct BFTW *ftwbuf
 	}
 }
 
-/** Actually spawn the process. */
-static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
+/** Set up the spawn attributes and actions that don't depend on the file. */
+static int bfs_exec_prepare(const struct bfs_exec *execbuf, struct bfs_spawn *spawn) {
+	const struct bfs_ctx *ctx = execbuf->ctx;
+
+	if (bfs_spawn_init(spawn) != 0) {
+		return -1;
+	}
+
+	if (execbuf->wd_fd >= 0) {
+		if (bfs_spawn_addfchdir(spawn, execbuf->wd_fd) != 0) {
+			goto fail;
+		}
+	}
+
+	// Reset RLIMIT_NOFILE if necessary, to avoid breaking applications that use select()
+	if (rlim_cmp(ctx->orig_nofile.rlim_cur, ctx->cur_nofile.rlim_cur) < 0) {
+		if (bfs_spawn_setrlimit(spawn, RLIMIT_NOFILE, &ctx->orig_nofile) != 0) {
+			goto fail;
+		}
+	}
+
+	return 0;
+
+fail:;
+	int error = errno;
+	bfs_spawn_destroy(spawn);
+	errno = error;
+	return -1;
+}
+
+/**
+ * Get the spawn template for the current working directory.  It only has to
+ * be rebuilt when wd_fd changes, which for -execdir is at most once per
+ * directory.
+ */
+static struct bfs_spawn *bfs_exec_template(struct bfs_exec *execbuf) {
+	if (execbuf->spawn_ready) {
+		if (execbuf->spawn_wd == execbuf->wd_fd) {
+			return &execbuf->spawn;
+		}
+
+		bfs_spawn_destroy(&execbuf->spawn);
+		execbuf->spawn_ready = false;
+	}
+
+	if (bfs_exec_prepare(execbuf, &execbuf->spawn) != 0) {
+		return NULL;
+	}
+
+	execbuf->spawn_ready = true;
+	execbuf->spawn_wd = execbuf->wd_fd;
+	return &execbuf->spawn;
+}
+
+/**
+ * Get the resolved executable, if the command can reuse it.  The $PATH is only
+ * searched once, since -execdir rejects relative $PATH entries and -exec never
+ * changes directory.
+ */
+static const char *bfs_exec_exe(struct bfs_exec *execbuf) {
+	const char *name = execbuf->argv[0];
+	if (name != execbuf->tmpl_argv[0] || strchr(name, '/')) {
+		// Either it depends on the file, or it's not looked up anyway
+		return NULL;
+	}
+
+	if (!execbuf->exe_resolved) {
+		execbuf->exe_resolved = true;
+		execbuf->exe = bfs_spawn_resolve(name);
+		if (execbuf->exe) {
+			bfs_exec_debug(execbuf, "Resolved '%s' to '%s'\n", name, execbuf->exe);
+		}
+	}
+
+	return execbuf->exe;
+}
+
+/** Spawn the command, preferring the executable that was already resolved. */
+static pid_t bfs_exec_spawn_with(struct bfs_exec *execbuf, struct bfs_spawn *spawn) {
+	const char *exe = bfs_exec_exe(execbuf);
+	if (exe) {
+		// bfs_spawn() still checks that the file is executable, which is
+		// much cheaper than searching the whole $PATH again
+		spawn->flags &= ~BFS_SPAWN_USE_PATH;
+		pid_t pid = bfs_spawn(exe, spawn, execbuf->argv, NULL);
+		if (pid >= 0 || (errno != ENOENT && errno != EACCES)) {
+			return pid;
+		}
+
+		// It went away, so look it up again next time
+		bfs_exec_debug(execbuf, "'%s' is no longer executable\n", exe);
+		free(execbuf->exe);
+		execbuf->exe = NULL;
+		execbuf->exe_resolved = false;
+	}
+
+	spawn->flags |= BFS_SPAWN_USE_PATH;
+	return bfs_spawn(execbuf->argv[0], spawn, execbuf->argv, NULL);
+}
+
+/**
+ * Start the process, returning its pid.  If fds is non-NULL, the command's
+ * stdout and stderr are connected to pipes whose read ends are stored there.
+ */
+static pid_t bfs_exec_start(struct bfs_exec *execbuf, int fds[2]) {
 	const struct bfs_ctx *ctx = execbuf->ctx;
 
 	// Flush the context state for consistency with the external process
@@ -358,37 +476,59 @@ static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
 	}
 
 	pid_t pid = -1;
-
-	struct bfs_spawn spawn;
-	if (bfs_spawn_init(&spawn) != 0) {
-		return -1;
-	}
-
-	spawn.flags |= BFS_SPAWN_USE_PATH;
-
-	if (execbuf->wd_fd >= 0) {
-		if (bfs_spawn_addfchdir(&spawn, execbuf->wd_fd) != 0) {
-			goto fail;
+	int pipes[2][2] = {{-1, -1}, {-1, -1}};
+
+	// Captured output needs fresh pipes for every command, so only
+	// uncaptured commands can use the template as-is
+	struct bfs_spawn capture;
+	struct bfs_spawn *spawn;
+	if (fds) {
+		spawn = &capture;
+		if (bfs_exec_prepare(execbuf, spawn) != 0) {
+			return -1;
 		}
-	}
 
-	// Reset RLIMIT_NOFILE if necessary, to avoid breaking applications that use select()
-	if (rlim_cmp(ctx->orig_nofile.rlim_cur, ctx->cur_nofile.rlim_cur) < 0) {
-		if (bfs_spawn_setrlimit(&spawn, RLIMIT_NOFILE, &ctx->orig_nofile) != 0) {
-			goto fail;
+		for (int i = 0; i < 2; ++i) {
+			if (pipe_cloexec(pipes[i]) != 0) {
+				goto fail;
+			}
+			if (bfs_spawn_adddup2(spawn, pipes[i][1], STDOUT_FILENO + i) != 0) {
+				goto fail;
+			}
+		}
+	} else {
+		spawn = bfs_exec_template(execbuf);
+		if (!spawn) {
+			return -1;
 		}
 	}
 
-	pid = bfs_spawn(execbuf->argv[0], &spawn, execbuf->argv, NULL);
+	uint64_t start = bfs_trace_begin();
+	pid = bfs_exec_spawn_with(execbuf, spawn);
+	bfs_trace_end("bfs_spawn", start);
 
 fail:;
 	int error = errno;
-
-	bfs_spawn_destroy(&spawn);
-	if (pid < 0) {
-		errno = error;
-		return -1;
+	if (spawn == &capture) {
+		bfs_spawn_destroy(spawn);
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (pipes[i][1] >= 0) {
+			xclose(pipes[i][1]);
+		}
+		if (fds && pid >= 0) {
+			fds[i] = pipes[i][0];
+		} else if (pipes[i][0] >= 0) {
+			xclose(pipes[i][0]);
+		}
 	}
+	errno = error;
+	return pid;
+}
+
+/** Wait for a process to exit, and check its status. */
+static int bfs_exec_wait(const struct bfs_exec *execbuf, pid_t pid) {
+	const struct bfs_ctx *ctx = execbuf->ctx;
 
 	int wstatus;
 	if (xwaitpid(pid, &wstatus, 0) < 0) {
@@ -419,6 +559,177 @@ fail:;
 	return ret;
 }
 
+/** Actually spawn the process. */
+static int bfs_exec_spawn(struct bfs_exec *execbuf) {
+	pid_t pid = bfs_exec_start(execbuf, NULL);
+	if (pid < 0) {
+		return -1;
+	}
+
+	return bfs_exec_wait(execbuf, pid);
+}
+
+/** Read some captured output from a running command. */
+static void bfs_exec_drain(struct bfs_exec_job *job, int i) {
+	char buf[4096];
+	ssize_t len = read(job->fds[i], buf, sizeof(buf));
+	if (len < 0 && errno == EINTR) {
+		return;
+	}
+
+	if (len > 0 && !job->bufs[i]) {
+		job->bufs[i] = dstralloc(len);
+	}
+
+	if (len <= 0 || !job->bufs[i] || dstrxcat(&job->bufs[i], buf, len) != 0) {
+		// EOF or error, stop capturing this stream
+		xclose(job->fds[i]);
+		job->fds[i] = -1;
+	}
+}
+
+/**
+ * Collect captured output from the running commands.
+ *
+ * @param execbuf
+ *         The exec buffer.
+ * @param wait
+ *         Whether to block until the oldest command has closed its output
+ *         (otherwise, only read what is already available).
+ */
+static void bfs_exec_capture(struct bfs_exec *execbuf, bool wait) {
+	struct bfs_exec_job *oldest = &execbuf->jobs[0];
+
+	while (true) {
+		struct pollfd pfds[2 * execbuf->njobs];
+		size_t npfds = 0;
+		for (size_t i = 0; i < execbuf->njobs; ++i) {
+			for (int j = 0; j < 2; ++j) {
+				int fd = execbuf->jobs[i].fds[j];
+				if (fd >= 0) {
+					pfds[npfds++] = (struct pollfd) {
+						.fd = fd,
+						.events = POLLIN,
+					};
+				}
+			}
+		}
+
+		bool done = oldest->fds[0] < 0 && oldest->fds[1] < 0;
+		if (npfds == 0 || (wait && done)) {
+			break;
+		}
+
+		int ret = poll(pfds, npfds, wait ? -1 : 0);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			break;
+		}
+
+		size_t k = 0;
+		for (size_t i = 0; i < execbuf->njobs; ++i) {
+			struct bfs_exec_job *job = &execbuf->jobs[i];
+			for (int j = 0; j < 2; ++j) {
+				if (job->fds[j] < 0) {
+					continue;
+				}
+				if (pfds[k++].revents) {
+					bfs_exec_drain(job, j);
+				}
+			}
+		}
+
+		if (!wait) {
+			break;
+		}
+	}
+}
+
+/** Write out the captured output of a finished command. */
+static void bfs_exec_emit(const struct bfs_exec *execbuf, struct bfs_exec_job *job) {
+	const struct bfs_ctx *ctx = execbuf->ctx;
+	FILE *files[] = {ctx->cout->file, ctx->cerr->file};
+
+	for (int i = 0; i < 2; ++i) {
+		if (job->fds[i] >= 0) {
+			xclose(job->fds[i]);
+			job->fds[i] = -1;
+		}
+
+		if (job->bufs[i]) {
+			fwrite(job->bufs[i], 1, dstrlen(job->bufs[i]), files[i]);
+			fflush(files[i]);
+		}
+
+		dstrfree(job->bufs[i]);
+		job->bufs[i] = NULL;
+	}
+}
+
+/** Wait for the oldest running command. */
+static void bfs_exec_reap(struct bfs_exec *execbuf) {
+	bfs_assert(execbuf->njobs > 0);
+
+	struct bfs_exec_job *job = &execbuf->jobs[0];
+
+	// Keep draining every command's output while we wait, so none of them
+	// can block on a full pipe
+	bfs_exec_capture(execbuf, true);
+
+	if (bfs_exec_wait(execbuf, job->pid) != 0) {
+		execbuf->ret = -1;
+	}
+
+	bfs_exec_emit(execbuf, job);
+
+	--execbuf->njobs;
+	memmove(execbuf->jobs, execbuf->jobs + 1, execbuf->njobs * sizeof(*execbuf->jobs));
+}
+
+/**
+ * Spawn the process for a BFS_EXEC_MULTI or BFS_EXEC_ASYNC execbuf.  With
+ * -exec-jobs, this returns as soon as the command is started, and its exit
+ * status is collected later by bfs_exec_reap().  With -exec-capture, the
+ * output of each command is buffered and written out in submission order as
+ * the commands are reaped.
+ */
+static int bfs_exec_spawn_async(struct bfs_exec *execbuf) {
+	size_t max = execbuf->ctx->exec_jobs;
+	if (max <= 1) {
+		return bfs_exec_spawn(execbuf);
+	}
+
+	if (!execbuf->jobs) {
+		execbuf->jobs = ALLOC_ARRAY(struct bfs_exec_job, max);
+		if (!execbuf->jobs) {
+			return -1;
+		}
+	}
+
+	bool capture = execbuf->ctx->exec_capture;
+	if (capture && execbuf->njobs > 0) {
+		bfs_exec_capture(execbuf, false);
+	}
+
+	while (execbuf->njobs >= max) {
+		bfs_exec_reap(execbuf);
+	}
+
+	struct bfs_exec_job *job = &execbuf->jobs[execbuf->njobs];
+	*job = (struct bfs_exec_job) {
+		.fds = {-1, -1},
+	};
+
+	job->pid = bfs_exec_start(execbuf, capture ? job->fds : NULL);
+	if (job->pid < 0) {
+		return -1;
+	}
+
+	++execbuf->njobs;
+	return 0;
+}
+
 /** exec() a command for a single file. */
 static int bfs_exec_single(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	int ret = -1, error = 0;
@@ -444,7 +755,11 @@ static int bfs_exec_single(struct bfs_exec *execbuf, const struct BFTW *ftwbuf)
 		}
 	}
 
-	ret = bfs_exec_spawn(execbuf);
+	if (execbuf->flags & BFS_EXEC_ASYNC) {
+		ret = bfs_exec_spawn_async(execbuf);
+	} else {
+		ret = bfs_exec_spawn(execbuf);
+	}
 
 out_free:
 	error = errno;
@@ -468,22 +783,61 @@ static bool bfs_exec_args_remain(const struct bfs_exec *execbuf) {
 	return execbuf->argc >= execbuf->tmpl_argc;
 }
 
+/**
+ * Pull in the ARG_MAX calibration from other commands.  The context tracks the
+ * total size of the command lines (including the environment) that exec() has
+ * accepted and rejected, so what one -exec ... + learns applies to the others.
+ */
+static void bfs_exec_calibrate(struct bfs_exec *execbuf) {
+	const struct bfs_ctx *ctx = execbuf->ctx;
+	size_t fixed = execbuf->arg_fixed;
+
+	if (ctx->exec_arg_max > fixed) {
+		size_t max = ctx->exec_arg_max - fixed - 1;
+		if (max < execbuf->arg_max) {
+			execbuf->arg_max = max;
+		}
+	}
+
+	if (ctx->exec_arg_min > fixed) {
+		size_t min = ctx->exec_arg_min - fixed;
+		if (min > execbuf->arg_min) {
+			execbuf->arg_min = min;
+		}
+	}
+
+	// Don't let min exceed max
+	if (execbuf->arg_min > execbuf->arg_max) {
+		execbuf->arg_min = execbuf->arg_max;
+	}
+}
+
 /** Compute the current ARG_MAX estimate for binary search. */
 static size_t bfs_exec_estimate_max(const struct bfs_exec *execbuf) {
 	size_t min = execbuf->arg_min;
 	size_t max = execbuf->arg_max;
-	return min + (max - min) / 2;
+	return min + (max - min + 1) / 2;
 }
 
 /** Update the ARG_MAX lower bound from a successful execution. */
 static void bfs_exec_update_min(struct bfs_exec *execbuf) {
+	// Remember the total size for the rest of the run
+	struct bfs_ctx *ctx = (struct bfs_ctx *)execbuf->ctx;
+	size_t total = execbuf->arg_fixed + execbuf->arg_size;
+	if (total > ctx->exec_arg_min) {
+		ctx->exec_arg_min = total;
+	}
+
+	// Track the achieved batch sizes
+	++execbuf->batches;
+	execbuf->batch_total += execbuf->arg_size;
+	if (execbuf->arg_size > execbuf->batch_max) {
+		execbuf->batch_max = execbuf->arg_size;
+	}
+
 	if (execbuf->arg_size > execbuf->arg_min) {
 		execbuf->arg_min = execbuf->arg_size;
-
-		// Don't let min exceed max
-		if (execbuf->arg_min > execbuf->arg_max) {
-			execbuf->arg_min = execbuf->arg_max;
-		}
+		bfs_exec_calibrate(execbuf);
 
 		size_t estimate = bfs_exec_estimate_max(execbuf);
 		bfs_exec_debug(execbuf, "ARG_MAX between [%zu, %zu], trying %zu\n",
@@ -495,23 +849,25 @@ static void bfs_exec_update_min(struct bfs_exec *execbuf) {
 static size_t bfs_exec_update_max(struct bfs_exec *execbuf) {
 	bfs_exec_debug(execbuf, "Got E2BIG, shrinking argument list...\n");
 
+	// Remember the total size for the rest of the run
+	struct bfs_ctx *ctx = (struct bfs_ctx *)execbuf->ctx;
+	size_t total = execbuf->arg_fixed + execbuf->arg_size;
+	if (ctx->exec_arg_max == 0 || total < ctx->exec_arg_max) {
+		ctx->exec_arg_max = total;
+	}
+
 	size_t size = execbuf->arg_size;
 	if (size <= execbuf->arg_min) {
 		// Lower bound was wrong, restart binary search.
 		execbuf->arg_min = 0;
 	}
 
-	// Trim a fraction off the max size to avoid repeated failures near the
-	// top end of the working range
-	size -= size / 16;
-	if (size < execbuf->arg_max) {
-		execbuf->arg_max = size;
-
-		// Don't let min exceed max
-		if (execbuf->arg_min > execbuf->arg_max) {
-			execbuf->arg_min = execbuf->arg_max;
-		}
+	// Anything at least this big fails, so the search converges on the
+	// real limit rather than settling short of it
+	if (size > 0 && size - 1 < execbuf->arg_max) {
+		execbuf->arg_max = size - 1;
 	}
+	bfs_exec_calibrate(execbuf);
 
 	// Binary search for a more precise bound
 	size_t estimate = bfs_exec_estimate_max(execbuf);
@@ -527,7 +883,7 @@ static int bfs_exec_flush(struct bfs_exec *execbuf) {
 	size_t orig_argc = execbuf->argc;
 	while (bfs_exec_args_remain(execbuf)) {
 		execbuf->argv[execbuf->argc] = NULL;
-		ret = bfs_exec_spawn(execbuf);
+		ret = bfs_exec_spawn_async(execbuf);
 		error = errno;
 		if (ret == 0) {
 			bfs_exec_update_min(execbuf);
@@ -571,12 +927,20 @@ static int bfs_exec_flush(struct bfs_exec *execbuf) {
 	return ret;
 }
 
-/** Check if we need to flush the execbuf because we're changing directories. */
+/** Check if a file is in a working directory. */
+static bool bfs_exec_in_dir(const char *wd_path, size_t wd_len, const struct BFTW *ftwbuf) {
+	if (ftwbuf->nameoff > wd_len) {
+		return false;
+	}
+
+	return !wd_path || strncmp(ftwbuf->path, wd_path, wd_len) == 0;
+}
+
+/** Check if we need to switch command lines because we're changing directories. */
 static bool bfs_exec_changed_dirs(const struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	if (execbuf->flags & BFS_EXEC_CHDIR) {
-		if (ftwbuf->nameoff > execbuf->wd_len
-		    || (execbuf->wd_path && strncmp(ftwbuf->path, execbuf->wd_path, execbuf->wd_len) != 0)) {
-			bfs_exec_debug(execbuf, "Changed directories, executing buffered command\n");
+		if (!bfs_exec_in_dir(execbuf->wd_path, execbuf->wd_len, ftwbuf)) {
+			bfs_exec_debug(execbuf, "Changed directories\n");
 			return true;
 		}
 	}
@@ -584,8 +948,124 @@ static bool bfs_exec_changed_dirs(const struct bfs_exec *execbuf, const struct B
 	return false;
 }
 
+/** Swap the current command line with a pending one. */
+static void bfs_exec_swap_dir(struct bfs_exec *execbuf, struct bfs_exec_dir *dir) {
+	struct bfs_exec_dir cur = {
+		.argv = execbuf->argv,
+		.argc = execbuf->argc,
+		.argv_cap = execbuf->argv_cap,
+		.arg_size = execbuf->arg_size,
+		.wd_fd = execbuf->wd_fd,
+		.wd_path = execbuf->wd_path,
+		.wd_len = execbuf->wd_len,
+	};
+
+	execbuf->argv = dir->argv;
+	execbuf->argc = dir->argc;
+	execbuf->argv_cap = dir->argv_cap;
+	execbuf->arg_size = dir->arg_size;
+	execbuf->wd_fd = dir->wd_fd;
+	execbuf->wd_path = dir->wd_path;
+	execbuf->wd_len = dir->wd_len;
+
+	*dir = cur;
+}
+
+/** Remove a pending directory from the list. */
+static void bfs_exec_remove_dir(struct bfs_exec *execbuf, size_t i) {
+	--execbuf->ndirs;
+	memmove(execbuf->dirs + i, execbuf->dirs + i + 1, (execbuf->ndirs - i) * sizeof(*execbuf->dirs));
+}
+
+/** Execute and close the least recently used pending directory. */
+static int bfs_exec_evict_dir(struct bfs_exec *execbuf) {
+	int ret = 0;
+
+	bfs_exec_debug(execbuf, "Too many pending directories, executing buffered command\n");
+
+	bfs_exec_swap_dir(execbuf, &execbuf->dirs[0]);
+	while (bfs_exec_args_remain(execbuf)) {
+		ret |= bfs_exec_flush(execbuf);
+	}
+	bfs_exec_closewd(execbuf, NULL);
+	bfs_exec_swap_dir(execbuf, &execbuf->dirs[0]);
+
+	free(execbuf->dirs[0].argv);
+	bfs_exec_remove_dir(execbuf, 0);
+	return ret;
+}
+
+/**
+ * Switch to the command line for a new directory.  Under breadth-first
+ * ordering, files from a few directories can be interleaved, so rather than
+ * executing the current command right away, we keep it pending with its
+ * working directory open, in case we come back to it.
+ */
+static int bfs_exec_switch_dir(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
+	int ret = 0;
+
+	if (!bfs_exec_args_remain(execbuf)) {
+		// Nothing to save
+		bfs_exec_closewd(execbuf, ftwbuf);
+	} else {
+		if (!execbuf->dirs) {
+			execbuf->dirs = ALLOC_ARRAY(struct bfs_exec_dir, BFS_EXEC_DIRS);
+			if (!execbuf->dirs) {
+				goto flush;
+			}
+		}
+
+		if (execbuf->ndirs == BFS_EXEC_DIRS) {
+			ret |= bfs_exec_evict_dir(execbuf);
+		}
+
+		// Start a fresh command line with just the template arguments
+		size_t argc = execbuf->tmpl_argc - 1;
+		size_t cap = execbuf->tmpl_argc + 1;
+		char **argv = ALLOC_ARRAY(char *, cap);
+		if (!argv) {
+			goto flush;
+		}
+		memcpy(argv, execbuf->argv, argc * sizeof(*argv));
+
+		struct bfs_exec_dir *dir = &execbuf->dirs[execbuf->ndirs++];
+		*dir = (struct bfs_exec_dir) {
+			.argv = argv,
+			.argc = argc,
+			.argv_cap = cap,
+			.wd_fd = -1,
+		};
+		bfs_exec_swap_dir(execbuf, dir);
+	}
+
+	// Resume a pending command for the new directory, if we have one
+	for (size_t i = 0; i < execbuf->ndirs; ++i) {
+		struct bfs_exec_dir *dir = &execbuf->dirs[i];
+		if (bfs_exec_in_dir(dir->wd_path, dir->wd_len, ftwbuf)) {
+			bfs_exec_debug(execbuf, "Resuming buffered command\n");
+			bfs_exec_closewd(execbuf, ftwbuf);
+			free(execbuf->argv);
+			bfs_exec_swap_dir(execbuf, dir);
+			bfs_exec_remove_dir(execbuf, i);
+			break;
+		}
+	}
+
+	return ret;
+
+flush:
+	bfs_exec_debug(execbuf, "Executing buffered command\n");
+	while (bfs_exec_args_remain(execbuf)) {
+		ret |= bfs_exec_flush(execbuf);
+	}
+	bfs_exec_closewd(execbuf, ftwbuf);
+	return ret;
+}
+
 /** Check if we need to flush the execbuf because we're too big. */
-static bool bfs_exec_would_overflow(const struct bfs_exec *execbuf, const char *arg) {
+static bool bfs_exec_would_overflow(struct bfs_exec *execbuf, const char *arg) {
+	bfs_exec_calibrate(execbuf);
+
 	size_t arg_max = bfs_exec_estimate_max(execbuf);
 	size_t next_size = execbuf->arg_size + bfs_exec_arg_size(arg);
 	if (next_size > arg_max) {
@@ -627,10 +1107,7 @@ static int bfs_exec_multi(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	}
 
 	if (bfs_exec_changed_dirs(execbuf, ftwbuf)) {
-		while (bfs_exec_args_remain(execbuf)) {
-			ret |= bfs_exec_flush(execbuf);
-		}
-		bfs_exec_closewd(execbuf, ftwbuf);
+		ret |= bfs_exec_switch_dir(execbuf, ftwbuf);
 	} else if (bfs_exec_would_overflow(execbuf, arg)) {
 		ret |= bfs_exec_flush(execbuf);
 	}
@@ -670,15 +1147,41 @@ int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	}
 }
 
-int bfs_exec_finish(struct bfs_exec *execbuf) {
+void bfs_exec_sync(struct bfs_exec *execbuf) {
 	if (execbuf->flags & BFS_EXEC_MULTI) {
-		bfs_exec_debug(execbuf, "Finishing execution, executing buffered command\n");
 		while (bfs_exec_args_remain(execbuf)) {
 			execbuf->ret |= bfs_exec_flush(execbuf);
 		}
+		while (execbuf->ndirs > 0) {
+			execbuf->ret |= bfs_exec_evict_dir(execbuf);
+		}
+	}
+
+	while (execbuf->njobs > 0) {
+		bfs_exec_reap(execbuf);
+	}
+}
+
+int bfs_exec_finish(struct bfs_exec *execbuf) {
+	if (execbuf->flags & BFS_EXEC_MULTI) {
+		bfs_exec_debug(execbuf, "Finishing execution, executing buffered command\n");
+		bfs_exec_sync(execbuf);
+		if (execbuf->batches > 0) {
+			bfs_exec_debug(execbuf, "Executed %zu batch(es), average size %zu, largest %zu, ARG_MAX between [%zu, %zu]\n",
+				execbuf->batches, execbuf->batch_total / execbuf->batches, execbuf->batch_max,
+				execbuf->arg_min, execbuf->arg_max);
+		}
 		if (execbuf->ret != 0) {
 			bfs_exec_debug(execbuf, "One or more executions of '%s' failed\n", execbuf->argv[0]);
 		}
+	} else if (execbuf->njobs > 0) {
+		bfs_exec_debug(execbuf, "Finishing execution, waiting for %zu background command(s)\n", execbuf->njobs);
+		while (execbuf->njobs > 0) {
+			bfs_exec_reap(execbuf);
+		}
+		if (execbuf->ret != 0) {
+			bfs_exec_debug(execbuf, "One or more executions of '%s' failed\n", execbuf->tmpl_argv[0]);
+		}
 	}
 	return execbuf->ret;
 }
@@ -686,6 +1189,28 @@ int bfs_exec_finish(struct bfs_exec *execbuf) {
 void bfs_exec_free(struct bfs_exec *execbuf) {
 	if (execbuf) {
 		bfs_exec_closewd(execbuf, NULL);
+
+		for (size_t i = 0; i < execbuf->ndirs; ++i) {
+			bfs_exec_swap_dir(execbuf, &execbuf->dirs[i]);
+			for (size_t j = execbuf->tmpl_argc - 1; j < execbuf->argc; ++j) {
+				free(execbuf->argv[j]);
+			}
+			bfs_exec_closewd(execbuf, NULL);
+			bfs_exec_swap_dir(execbuf, &execbuf->dirs[i]);
+			free(execbuf->dirs[i].argv);
+		}
+		free(execbuf->dirs);
+
+		for (size_t i = 0; i < execbuf->njobs; ++i) {
+			bfs_exec_emit(execbuf, &execbuf->jobs[i]);
+		}
+		free(execbuf->jobs);
+
+		if (execbuf->spawn_ready) {
+			bfs_spawn_destroy(&execbuf->spawn);
+		}
+		free(execbuf->exe);
+
 		free(execbuf->argv);
 		free(execbuf);
 	}
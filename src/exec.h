@@ -8,7 +8,11 @@
 #ifndef BFS_EXEC_H
 #define BFS_EXEC_H
 
+#include "xspawn.h"
+
+#include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 struct BFTW;
 struct bfs_ctx;
@@ -23,6 +27,46 @@ enum bfs_exec_flags {
 	BFS_EXEC_CHDIR   = 1 << 1,
 	/** Pass multiple files at once to the command (-exec ... {} +). */
 	BFS_EXEC_MULTI   = 1 << 2,
+	/** The result is ignored, so the command may run in the background (-exec-jobs). */
+	BFS_EXEC_ASYNC   = 1 << 3,
+};
+
+/**
+ * The maximum number of directories with pending -execdir ... + commands.
+ */
+#define BFS_EXEC_DIRS 8
+
+/**
+ * A pending -execdir ... + command for a directory other than the current one.
+ */
+struct bfs_exec_dir {
+	/** The built command line. */
+	char **argv;
+	/** Number of command line arguments. */
+	size_t argc;
+	/** Capacity of argv. */
+	size_t argv_cap;
+	/** Current size of all arguments. */
+	size_t arg_size;
+
+	/** A file descriptor for the working directory. */
+	int wd_fd;
+	/** The path to the working directory. */
+	char *wd_path;
+	/** Length of the working directory path. */
+	size_t wd_len;
+};
+
+/**
+ * A command running in the background, for -exec-jobs.
+ */
+struct bfs_exec_job {
+	/** The process ID. */
+	pid_t pid;
+	/** Pipes from the command's stdout and stderr (-exec-capture), or -1. */
+	int fds[2];
+	/** The output captured from each pipe. */
+	char *bufs[2];
 };
 
 /**
@@ -52,6 +96,15 @@ struct bfs_exec {
 	size_t arg_max;
 	/** Lower bound for arg_max. */
 	size_t arg_min;
+	/** Size of the environment and fixed arguments. */
+	size_t arg_fixed;
+
+	/** The number of commands executed, for debugging. */
+	size_t batches;
+	/** The total arg_size of all executed commands. */
+	size_t batch_total;
+	/** The largest arg_size executed so far. */
+	size_t batch_max;
 
 	/** A file descriptor for the working directory, for BFS_EXEC_CHDIR. */
 	int wd_fd;
@@ -60,6 +113,27 @@ struct bfs_exec {
 	/** Length of the working directory path. */
 	size_t wd_len;
 
+	/** The spawn attributes and actions shared by every command, once prepared. */
+	struct bfs_spawn spawn;
+	/** Whether the spawn template has been prepared. */
+	bool spawn_ready;
+	/** The wd_fd that the spawn template changes to. */
+	int spawn_wd;
+	/** Whether the executable has been looked up in the $PATH. */
+	bool exe_resolved;
+	/** The resolved executable, if every command can reuse it. */
+	char *exe;
+
+	/** Other directories with pending commands, least recently used first. */
+	struct bfs_exec_dir *dirs;
+	/** The number of pending directories. */
+	size_t ndirs;
+
+	/** Running commands, oldest first, for -exec-jobs. */
+	struct bfs_exec_job *jobs;
+	/** The number of running commands. */
+	size_t njobs;
+
 	/** The ultimate return value for bfs_exec_finish(). */
 	int ret;
 };
@@ -91,6 +165,15 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
  */
 int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf);
 
+/**
+ * Run any buffered commands now, and wait for all running commands to finish.
+ * Errors are remembered for bfs_exec_finish().
+ *
+ * @param execbuf
+ *         The parsed exec action.
+ */
+void bfs_exec_sync(struct bfs_exec *execbuf);
+
 /**
  * Finish executing any commands.
  *
@@ -4,14 +4,20 @@
 #include "expr.h"
 
 #include "alloc.h"
+#include "coproc.h"
 #include "ctx.h"
 #include "diag.h"
 #include "eval.h"
 #include "exec.h"
+#include "grep.h"
 #include "list.h"
+#include "nameset.h"
 #include "printf.h"
+#include "top.h"
+#include "trie.h"
 #include "xregex.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 struct bfs_expr *bfs_expr_new(struct bfs_ctx *ctx, bfs_eval_fn *eval_fn, size_t argc, char **argv, enum bfs_kind kind) {
@@ -28,6 +34,7 @@ struct bfs_expr *bfs_expr_new(struct bfs_ctx *ctx, bfs_eval_fn *eval_fn, size_t
 	expr->argv = argv;
 	expr->kind = kind;
 	expr->probability = 0.5;
+	expr->cse = -1;
 	SLIST_PREPEND(&ctx->expr_list, expr, freelist);
 
 	if (bfs_expr_is_parent(expr)) {
@@ -82,9 +89,34 @@ bool bfs_expr_never_returns(const struct bfs_expr *expr) {
 void bfs_expr_clear(struct bfs_expr *expr) {
 	if (expr->eval_fn == eval_exec) {
 		bfs_exec_free(expr->exec);
+	} else if (expr->eval_fn == eval_coproc) {
+		bfs_coproc_free(expr->coproc);
 	} else if (expr->eval_fn == eval_fprintf) {
 		bfs_printf_free(expr->printf);
+	} else if (expr->eval_fn == eval_grep) {
+		bfs_grep_free(expr->grep);
 	} else if (expr->eval_fn == eval_regex) {
 		bfs_regfree(expr->regex);
+	} else if (expr->eval_fn == eval_regexes) {
+		bfs_regfree(expr->regex);
+		free(expr->argv);
+	} else if (expr->eval_fn == eval_names) {
+		bfs_nameset_free(expr->nameset);
+		free(expr->argv);
+	} else if (expr->eval_fn == eval_name || expr->eval_fn == eval_lname || expr->eval_fn == eval_path) {
+		free(expr->folded);
+	} else if (expr->eval_fn == eval_top) {
+		bfs_top_free(expr->top);
+	} else if (expr->eval_fn == eval_count) {
+		free(expr->depth_counts);
+		if (expr->root_counts) {
+			trie_destroy(expr->root_counts);
+			free(expr->root_counts);
+		}
+	} else if (expr->eval_fn == eval_name_from || expr->eval_fn == eval_path_from) {
+		if (expr->literals) {
+			trie_destroy(expr->literals);
+			free(expr->literals);
+		}
 	}
 }
@@ -10,6 +10,8 @@
 
 #include "color.h"
 #include "eval.h"
+#include "fsade.h"
+#include "hash.h"
 #include "stat.h"
 
 #include <sys/types.h>
@@ -60,6 +62,18 @@ enum bfs_mode_cmp {
 	BFS_MODE_ANY,
 };
 
+/**
+ * What -count counts by.
+ */
+enum bfs_count_by {
+	/** Just the total (-count). */
+	BFS_COUNT_TOTAL,
+	/** Each root path (-count-by root). */
+	BFS_COUNT_ROOT,
+	/** Each depth (-count-by depth). */
+	BFS_COUNT_DEPTH,
+};
+
 /**
  * Possible time units.
  */
@@ -94,6 +108,20 @@ enum bfs_size_unit {
 	BFS_PB,
 };
 
+/**
+ * Glob pattern shapes that can be matched without fnmatch().
+ */
+enum bfs_glob {
+	/** A general pattern that needs fnmatch(). */
+	BFS_GLOB_FNMATCH,
+	/** A literal string with no wildcards. */
+	BFS_GLOB_LITERAL,
+	/** A prefix and/or suffix around a single star, like prefix*suffix. */
+	BFS_GLOB_AFFIX,
+	/** A literal surrounded by stars, like *infix*. */
+	BFS_GLOB_INFIX,
+};
+
 /**
  * A linked list of expressions.
  */
@@ -134,6 +162,8 @@ struct bfs_expr {
 	bool always_false;
 	/** Whether this expression uses stat(). */
 	bool calls_stat;
+	/** The bfs_eval result slot shared by copies of this expression, or -1. */
+	int cse;
 
 	/** Estimated cost. */
 	float cost;
@@ -175,8 +205,18 @@ struct bfs_expr {
 			const char *pattern;
 			/** fnmatch() flags. */
 			int fnm_flags;
-			/** Whether strcmp() can be used instead of fnmatch(). */
-			bool literal;
+			/** The shape of the pattern. */
+			enum bfs_glob glob;
+			/** The length of the pattern. */
+			size_t pattern_len;
+			/** The length of the literal prefix, for BFS_GLOB_AFFIX. */
+			size_t prefix_len;
+			/** The length of the literal suffix, for BFS_GLOB_AFFIX. */
+			size_t suffix_len;
+			/** The ASCII-folded pattern, for case-insensitive shapes. */
+			char *folded;
+			/** The pattern's ID in bfs_ctx::pathmatch, for -path, or -1. */
+			int pathmatch_id;
 		};
 
 		/** Printing actions. */
@@ -187,11 +227,46 @@ struct bfs_expr {
 			const char *path;
 			/** Optional -printf format. */
 			struct bfs_printf *printf;
+
+			/** What -count counts by. */
+			enum bfs_count_by count_by;
+			/** The total -count. */
+			size_t count;
+			/** The -count for each depth. */
+			size_t *depth_counts;
+			/** The number of depth_counts. */
+			size_t ndepths;
+			/** The -count for each root, stored in the leaf values. */
+			struct trie *root_counts;
+			/** The most recent root, to skip most lookups. */
+			struct trie_leaf *last_root;
+
+			/** The -top/-bottom heap. */
+			struct bfs_top *top;
+			/** The stat field that -top/-bottom sorts by. */
+			enum bfs_stat_field top_field;
 		};
 
 		/** -exec data. */
 		struct bfs_exec *exec;
 
+		/** -coproc data. */
+		struct bfs_coproc *coproc;
+
+		/** -chown data. */
+		struct {
+			/** The new owner, or -1 to leave it unchanged. */
+			uid_t chown_uid;
+			/** The new group, or -1 to leave it unchanged. */
+			gid_t chown_gid;
+		};
+
+		/** -delete data. */
+		struct {
+			/** Whether the result is ignored, so the unlink may happen in the background. */
+			bool background;
+		};
+
 		/** -flags data. */
 		struct {
 			/** The comparison mode. */
@@ -215,12 +290,36 @@ struct bfs_expr {
 		/** -regex data. */
 		struct bfs_regex *regex;
 
+		/** Merged -name data. */
+		struct bfs_nameset *nameset;
+
+		/** -name-from and -path-from data. */
+		struct trie *literals;
+
+		/** -acl, -capable, -xattr, and -xattrname data. */
+		struct bfs_fsade_cache fsade;
+
+		/** -grep and -grep-regex data. */
+		struct bfs_grep *grep;
+
+		/** -hash data. */
+		struct {
+			/** The hash algorithm. */
+			enum bfs_hash_algo hash_algo;
+			/** The expected digest. */
+			unsigned char digest[BFS_HASH_MAX];
+		};
+
 		/** -samefile data. */
 		struct {
 			/** Device number of the target file. */
 			dev_t dev;
 			/** Inode number of the target file. */
 			ino_t ino;
+			/** The number of names the target file has. */
+			nlink_t nlink;
+			/** The number of names left to find before stopping, if non-zero. */
+			nlink_t samefile_left;
 		};
 	};
 };
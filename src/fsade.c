@@ -9,11 +9,15 @@
 #include "bftw.h"
 #include "dir.h"
 #include "dstring.h"
+#include "perf.h"
 #include "sanity.h"
+#include "stat.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #if BFS_CAN_CHECK_ACL
@@ -123,6 +127,75 @@ static bool is_absence_error(int error) {
 	return false;
 }
 
+void bfs_fsade_cache_init(struct bfs_fsade_cache *cache) {
+	for (size_t i = 0; i < countof(cache->devs); ++i) {
+		store(&cache->devs[i], (dev_t)-1, relaxed);
+	}
+}
+
+/** Get the cache slot for a device. */
+_maybe_unused
+static atomic dev_t *fsade_cache_slot(struct bfs_fsade_cache *cache, dev_t dev) {
+	uint64_t hash = (uint64_t)dev * UINT64_C(0x9E3779B97F4A7C15);
+	return &cache->devs[(hash >> 32) % countof(cache->devs)];
+}
+
+/** Get a file's already-cached stat() info, if any. */
+_maybe_unused
+static const struct bfs_stat *fsade_cached_stat(const struct BFTW *ftwbuf) {
+	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, ftwbuf->stat_flags);
+	if (statbuf && statbuf->dev == (dev_t)-1) {
+		// Don't confuse it with an empty slot
+		return NULL;
+	}
+	return statbuf;
+}
+
+/** Check if a file is on a device that's known not to support a feature. */
+_maybe_unused
+static bool fsade_cache_hit(struct bfs_fsade_cache *cache, const struct BFTW *ftwbuf) {
+	if (!cache) {
+		return false;
+	}
+
+	const struct bfs_stat *statbuf = fsade_cached_stat(ftwbuf);
+	if (!statbuf) {
+		return false;
+	}
+
+	return load(fsade_cache_slot(cache, statbuf->dev), relaxed) == statbuf->dev;
+}
+
+/** Remember that a file's device doesn't support a feature, if that's why it failed. */
+_maybe_unused
+static void fsade_cache_miss(struct bfs_fsade_cache *cache, const struct BFTW *ftwbuf, int error) {
+	// Symbolic links may not support things that other files on the same
+	// file system do
+	if (!cache || error != ENOTSUP || ftwbuf->type == BFS_LNK) {
+		return;
+	}
+
+	const struct bfs_stat *statbuf = fsade_cached_stat(ftwbuf);
+	if (statbuf) {
+		store(fsade_cache_slot(cache, statbuf->dev), statbuf->dev, relaxed);
+	}
+}
+
+/** Get the result of a check that was done ahead of time, or -1 if it wasn't. */
+_maybe_unused
+static int fsade_probed(const struct BFTW *ftwbuf, enum bfs_fsade_check check, const char *name) {
+	const struct bfs_fsade_probe *probe = &ftwbuf->fsade;
+	if (!(probe->checked & check)) {
+		return -1;
+	}
+
+	if (name && name != probe->name && strcmp(name, probe->name) != 0) {
+		return -1;
+	}
+
+	return !!(probe->found & check);
+}
+
 #if BFS_CAN_CHECK_ACL
 
 #if BFS_HAS_ACL_GET_FILE
@@ -234,12 +307,18 @@ static int bfs_check_acl_type(acl_t acl, acl_type_t type) {
 
 #endif // BFS_HAS_ACL_GET_FILE
 
-int bfs_check_acl(const struct BFTW *ftwbuf) {
-	if (ftwbuf->type == BFS_LNK) {
+int bfs_check_acl(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache) {
+	if (ftwbuf->type == BFS_LNK || fsade_cache_hit(cache, ftwbuf)) {
 		return 0;
 	}
 
+	int probed = fsade_probed(ftwbuf, BFS_CHECK_ACL, NULL);
+	if (probed >= 0) {
+		return probed;
+	}
+
 	const char *path = fake_at(ftwbuf);
+	uint64_t start = bfs_perf_start();
 
 #if BFS_HAS_ACL_TRIVIAL
 	int ret = acl_trivial(path);
@@ -286,14 +365,18 @@ int bfs_check_acl(const struct BFTW *ftwbuf) {
 	}
 #endif
 
+	bfs_perf_end(BFS_PERF_ACL, start, 0);
 	free_fake_at(ftwbuf, path);
+	if (ret == 0) {
+		fsade_cache_miss(cache, ftwbuf, error);
+	}
 	errno = error;
 	return ret;
 }
 
 #else // !BFS_CAN_CHECK_ACL
 
-int bfs_check_acl(const struct BFTW *ftwbuf) {
+int bfs_check_acl(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache) {
 	errno = ENOTSUP;
 	return -1;
 }
@@ -302,18 +385,26 @@ int bfs_check_acl(const struct BFTW *ftwbuf) {
 
 #if BFS_CAN_CHECK_CAPABILITIES
 
-int bfs_check_capabilities(const struct BFTW *ftwbuf) {
-	if (ftwbuf->type == BFS_LNK) {
+int bfs_check_capabilities(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache) {
+	if (ftwbuf->type == BFS_LNK || fsade_cache_hit(cache, ftwbuf)) {
 		return 0;
 	}
 
+	int probed = fsade_probed(ftwbuf, BFS_CHECK_CAPABILITIES, NULL);
+	if (probed >= 0) {
+		return probed;
+	}
+
 	int ret = -1, error;
 	const char *path = fake_at(ftwbuf);
 
+	uint64_t start = bfs_perf_start();
 	cap_t caps = cap_get_file(path);
+	bfs_perf_end(BFS_PERF_CAPS, start, 0);
 	if (!caps) {
 		error = errno;
 		if (is_absence_error(error)) {
+			fsade_cache_miss(cache, ftwbuf, error);
 			ret = 0;
 		}
 		goto out_path;
@@ -339,7 +430,7 @@ out_path:
 
 #else // !BFS_CAN_CHECK_CAPABILITIES
 
-int bfs_check_capabilities(const struct BFTW *ftwbuf) {
+int bfs_check_capabilities(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache) {
 	errno = ENOTSUP;
 	return -1;
 }
@@ -396,8 +487,18 @@ static ssize_t bfs_extattr_get(const char *path, enum bfs_type type, int namespa
 
 #endif // BFS_USE_EXTATTR
 
-int bfs_check_xattrs(const struct BFTW *ftwbuf) {
+int bfs_check_xattrs(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache) {
+	if (fsade_cache_hit(cache, ftwbuf)) {
+		return 0;
+	}
+
+	int probed = fsade_probed(ftwbuf, BFS_CHECK_XATTRS, NULL);
+	if (probed >= 0) {
+		return probed;
+	}
+
 	const char *path = fake_at(ftwbuf);
+	uint64_t start = bfs_perf_start();
 	ssize_t len;
 
 #if BFS_USE_EXTATTR
@@ -417,12 +518,15 @@ int bfs_check_xattrs(const struct BFTW *ftwbuf) {
 #endif
 
 	int error = errno;
-
+	bfs_perf_end(BFS_PERF_XATTR, start, 0);
 	free_fake_at(ftwbuf, path);
 
 	if (len > 0) {
 		return 1;
-	} else if (len == 0 || is_absence_error(error)) {
+	} else if (len == 0) {
+		return 0;
+	} else if (is_absence_error(error)) {
+		fsade_cache_miss(cache, ftwbuf, error);
 		return 0;
 	} else if (error == E2BIG) {
 		return 1;
@@ -432,8 +536,18 @@ int bfs_check_xattrs(const struct BFTW *ftwbuf) {
 	}
 }
 
-int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
+int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name, struct bfs_fsade_cache *cache) {
+	if (fsade_cache_hit(cache, ftwbuf)) {
+		return 0;
+	}
+
+	int probed = fsade_probed(ftwbuf, BFS_CHECK_XATTR_NAMED, name);
+	if (probed >= 0) {
+		return probed;
+	}
+
 	const char *path = fake_at(ftwbuf);
+	uint64_t start = bfs_perf_start();
 	ssize_t len;
 
 #if BFS_USE_EXTATTR
@@ -453,12 +567,13 @@ int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
 #endif
 
 	int error = errno;
-
+	bfs_perf_end(BFS_PERF_XATTR, start, 0);
 	free_fake_at(ftwbuf, path);
 
 	if (len >= 0) {
 		return 1;
 	} else if (is_absence_error(error)) {
+		fsade_cache_miss(cache, ftwbuf, error);
 		return 0;
 	} else if (error == E2BIG) {
 		return 1;
@@ -470,18 +585,88 @@ int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
 
 #else // !BFS_CAN_CHECK_XATTRS
 
-int bfs_check_xattrs(const struct BFTW *ftwbuf) {
+int bfs_check_xattrs(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache) {
 	errno = ENOTSUP;
 	return -1;
 }
 
-int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
+int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name, struct bfs_fsade_cache *cache) {
 	errno = ENOTSUP;
 	return -1;
 }
 
 #endif
 
+/** Do one check ahead of time. */
+static void fsade_probe_one(struct bfs_fsade_probe *probe, enum bfs_fsade_check check, int ret) {
+	if (ret >= 0) {
+		probe->checked |= check;
+	}
+	if (ret > 0) {
+		probe->found |= check;
+	}
+}
+
+void bfs_fsade_probe(int dfd, const char *path, enum bfs_type type, enum bfs_stat_flags flags, enum bfs_fsade_check checks, struct bfs_fsade_probe *probe) {
+	probe->checked = 0;
+	probe->found = 0;
+
+	if (type == BFS_UNKNOWN) {
+		struct bfs_stat buf;
+		if (bfs_stat(dfd, path, flags, &buf) != 0) {
+			return;
+		}
+		type = bfs_mode_to_type(buf.mode);
+	}
+
+	struct BFTW ftwbuf = {
+		.path = path,
+		.type = type,
+		.at_fd = dfd,
+		.at_path = path,
+		.stat_bufs = {
+			.stat_err = -1,
+			.lstat_err = -1,
+			.link_err = -1,
+		},
+	};
+
+	if (dfd != (int)AT_FDCWD) {
+		// Resolve the path once, rather than once per check
+		const char *fake = fake_at(&ftwbuf);
+		if (fake == path) {
+			// The path is only valid relative to dfd
+			return;
+		}
+		ftwbuf.path = fake;
+		ftwbuf.at_fd = AT_FDCWD;
+		ftwbuf.at_path = fake;
+	}
+
+	if (checks & BFS_CHECK_ACL) {
+		fsade_probe_one(probe, BFS_CHECK_ACL, bfs_check_acl(&ftwbuf, NULL));
+	}
+	if (checks & BFS_CHECK_CAPABILITIES) {
+		fsade_probe_one(probe, BFS_CHECK_CAPABILITIES, bfs_check_capabilities(&ftwbuf, NULL));
+	}
+	if (checks & BFS_CHECK_XATTRS) {
+		fsade_probe_one(probe, BFS_CHECK_XATTRS, bfs_check_xattrs(&ftwbuf, NULL));
+	}
+	if (checks & BFS_CHECK_XATTR_NAMED) {
+		fsade_probe_one(probe, BFS_CHECK_XATTR_NAMED, bfs_check_xattr_named(&ftwbuf, probe->name, NULL));
+	}
+	if (checks & BFS_CHECK_HASH) {
+		fsade_probe_one(probe, BFS_CHECK_HASH, bfs_check_hash(&ftwbuf, probe->hash, probe->digest));
+	}
+	if (checks & BFS_CHECK_GREP) {
+		fsade_probe_one(probe, BFS_CHECK_GREP, bfs_check_grep(&ftwbuf, probe->grep));
+	}
+
+	if (ftwbuf.path != path) {
+		dstrfree((dchar *)ftwbuf.path);
+	}
+}
+
 char *bfs_getfilecon(const struct BFTW *ftwbuf) {
 #if BFS_CAN_CHECK_CONTEXT
 	const char *path = fake_at(ftwbuf);
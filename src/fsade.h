@@ -9,7 +9,14 @@
 #ifndef BFS_FSADE_H
 #define BFS_FSADE_H
 
+#include "atomic.h"
 #include "bfs.h"
+#include "dir.h"
+#include "grep.h"
+#include "hash.h"
+#include "stat.h"
+
+#include <sys/types.h>
 
 #define BFS_CAN_CHECK_ACL (BFS_HAS_ACL_GET_FILE || BFS_HAS_ACL_TRIVIAL)
 
@@ -19,39 +26,120 @@
 
 #if __has_include(<sys/extattr.h>) || __has_include(<sys/xattr.h>)
 #  define BFS_CAN_CHECK_XATTRS true
+#else
+#  define BFS_CAN_CHECK_XATTRS false
 #endif
 
 struct BFTW;
 
+/**
+ * A small, lossy cache of the devices that don't support a feature at all
+ * (i.e. that failed with ENOTSUP).  It uses only the already-cached stat()
+ * info for each file, and is safe to share between threads.
+ */
+struct bfs_fsade_cache {
+	/** The cached devices, or -1 for empty slots. */
+	atomic dev_t devs[8];
+};
+
+/**
+ * Initialize an empty cache.
+ */
+void bfs_fsade_cache_init(struct bfs_fsade_cache *cache);
+
+/**
+ * Checks that can be done ahead of time, e.g. by bftw() on an I/O thread.
+ */
+enum bfs_fsade_check {
+	/** bfs_check_acl(). */
+	BFS_CHECK_ACL          = 1 << 0,
+	/** bfs_check_capabilities(). */
+	BFS_CHECK_CAPABILITIES = 1 << 1,
+	/** bfs_check_xattrs(). */
+	BFS_CHECK_XATTRS       = 1 << 2,
+	/** bfs_check_xattr_named(). */
+	BFS_CHECK_XATTR_NAMED  = 1 << 3,
+	/** bfs_check_hash(). */
+	BFS_CHECK_HASH         = 1 << 4,
+	/** bfs_check_grep(). */
+	BFS_CHECK_GREP         = 1 << 5,
+};
+
+/**
+ * The results of checks done ahead of time.
+ */
+struct bfs_fsade_probe {
+	/** The checks that were done successfully. */
+	enum bfs_fsade_check checked;
+	/** The checks that found something. */
+	enum bfs_fsade_check found;
+	/** The xattr name for BFS_CHECK_XATTR_NAMED. */
+	const char *name;
+	/** Where to store the digest for BFS_CHECK_HASH. */
+	unsigned char *digest;
+	/** The hash algorithm for BFS_CHECK_HASH. */
+	enum bfs_hash_algo hash;
+	/** The search for BFS_CHECK_GREP. */
+	const struct bfs_grep *grep;
+};
+
+/**
+ * Do some checks ahead of time.  This is safe to call from any thread.
+ *
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to the file, relative to dfd.
+ * @param type
+ *         The type of the file (BFS_LNK to check the link itself), or
+ *         BFS_UNKNOWN to look it up.
+ * @param flags
+ *         The bfs_stat() flags for looking up an unknown type.
+ * @param checks
+ *         The checks to do.
+ * @param[in,out] probe
+ *         Gets the results.  probe->name should already be set for
+ *         BFS_CHECK_XATTR_NAMED, probe->digest and probe->hash for
+ *         BFS_CHECK_HASH, and probe->grep for BFS_CHECK_GREP.  Checks that fail are left out of
+ *         probe->checked, so they can be retried (and reported) later.
+ */
+void bfs_fsade_probe(int dfd, const char *path, enum bfs_type type, enum bfs_stat_flags flags, enum bfs_fsade_check checks, struct bfs_fsade_probe *probe);
+
 /**
  * Check if a file has a non-trivial Access Control List.
  *
  * @param ftwbuf
  *         The file to check.
+ * @param cache
+ *         The cache of unsupported devices (may be NULL).
  * @return
  *         1 if it does, 0 if it doesn't, or -1 if an error occurred.
  */
-int bfs_check_acl(const struct BFTW *ftwbuf);
+int bfs_check_acl(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache);
 
 /**
  * Check if a file has a non-trivial capability set.
  *
  * @param ftwbuf
  *         The file to check.
+ * @param cache
+ *         The cache of unsupported devices (may be NULL).
  * @return
  *         1 if it does, 0 if it doesn't, or -1 if an error occurred.
  */
-int bfs_check_capabilities(const struct BFTW *ftwbuf);
+int bfs_check_capabilities(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache);
 
 /**
  * Check if a file has any extended attributes set.
  *
  * @param ftwbuf
  *         The file to check.
+ * @param cache
+ *         The cache of unsupported devices (may be NULL).
  * @return
  *         1 if it does, 0 if it doesn't, or -1 if an error occurred.
  */
-int bfs_check_xattrs(const struct BFTW *ftwbuf);
+int bfs_check_xattrs(const struct BFTW *ftwbuf, struct bfs_fsade_cache *cache);
 
 /**
  * Check if a file has an extended attribute with the given name.
@@ -60,10 +148,12 @@ int bfs_check_xattrs(const struct BFTW *ftwbuf);
  *         The file to check.
  * @param name
  *         The name of the xattr to check.
+ * @param cache
+ *         The cache of devices that don't support this xattr (may be NULL).
  * @return
  *         1 if it does, 0 if it doesn't, or -1 if an error occurred.
  */
-int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name);
+int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name, struct bfs_fsade_cache *cache);
 
 /**
  * Get a file's SELinux context
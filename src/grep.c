@@ -0,0 +1,195 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "grep.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "bftw.h"
+#include "fsade.h"
+#include "xregex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct bfs_grep {
+	/** The regex to match against each line, or NULL for a literal search. */
+	struct bfs_regex *regex;
+	/** The length of the literal. */
+	size_t len;
+	/** The literal to search for. */
+	char literal[];
+};
+
+struct bfs_grep *bfs_grep_new(const char *pattern, struct bfs_regex *regex) {
+	size_t len = regex ? 0 : strlen(pattern);
+	struct bfs_grep *grep = ALLOC_FLEX(struct bfs_grep, literal, len + 1);
+	if (!grep) {
+		return NULL;
+	}
+
+	grep->regex = regex;
+	grep->len = len;
+	memcpy(grep->literal, regex ? "" : pattern, len + 1);
+	return grep;
+}
+
+bool bfs_grep_equal(const struct bfs_grep *a, const struct bfs_grep *b) {
+	if (a->regex || b->regex) {
+		return a->regex && b->regex && bfs_regex_equal(a->regex, b->regex);
+	} else {
+		return a->len == b->len && memcmp(a->literal, b->literal, a->len) == 0;
+	}
+}
+
+/** The size of the buffer for reading files. */
+#define GREP_BUFSIZE (128 << 10)
+
+/** Match the complete lines in a buffer, returning the length of the rest. */
+static int grep_lines(const struct bfs_grep *grep, char *buf, size_t len, size_t *rest) {
+	char *end = buf + len;
+	char *line = buf;
+	while (true) {
+		char *nl = memchr(line, '\n', end - line);
+		if (!nl) {
+			break;
+		}
+
+		*nl = '\0';
+		int ret = bfs_regexec(grep->regex, line, 0);
+		if (ret != 0) {
+			return ret;
+		}
+		line = nl + 1;
+	}
+
+	*rest = end - line;
+	memmove(buf, line, *rest);
+	return 0;
+}
+
+/** Search the contents of an open file. */
+static int grep_fd(int fd, const struct bfs_grep *grep) {
+	// Keep enough room to search across reads, plus a terminator for
+	// the last line
+	size_t cap = GREP_BUFSIZE;
+	if (cap < 2 * grep->len) {
+		cap = 2 * grep->len;
+	}
+
+	char *buf = malloc(cap + 1);
+	if (!buf) {
+		return -1;
+	}
+
+	int ret = 0;
+	size_t len = 0;
+	while (true) {
+		if (len == cap) {
+			// A line that doesn't fit in the buffer
+			char *new = realloc(buf, 2 * cap + 1);
+			if (!new) {
+				ret = -1;
+				break;
+			}
+			buf = new;
+			cap *= 2;
+		}
+
+		ssize_t size = read(fd, buf + len, cap - len);
+		if (size < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ret = -1;
+			break;
+		}
+
+		if (grep->regex) {
+			if (size == 0) {
+				// The last line, without a trailing newline
+				if (len > 0) {
+					buf[len] = '\0';
+					ret = bfs_regexec(grep->regex, buf, 0);
+				}
+				break;
+			}
+
+			ret = grep_lines(grep, buf, len + size, &len);
+			if (ret != 0) {
+				break;
+			}
+		} else {
+			if (size == 0) {
+				break;
+			}
+
+			len += size;
+			if (memmem(buf, len, grep->literal, grep->len)) {
+				ret = 1;
+				break;
+			}
+
+			// Keep the tail, in case the literal spans two reads
+			size_t keep = grep->len - 1;
+			if (keep > len) {
+				keep = len;
+			}
+			memmove(buf, buf + len - keep, keep);
+			len = keep;
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+int bfs_check_grep(const struct BFTW *ftwbuf, const struct bfs_grep *grep) {
+	const struct bfs_fsade_probe *probe = &ftwbuf->fsade;
+	if ((probe->checked & BFS_CHECK_GREP) && bfs_grep_equal(probe->grep, grep)) {
+		return !!(probe->found & BFS_CHECK_GREP);
+	}
+
+	if (ftwbuf->type != BFS_REG) {
+		return 0;
+	}
+
+	// O_NONBLOCK in case it was replaced with a FIFO
+	int fd = openat(ftwbuf->at_fd, ftwbuf->at_path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int ret = -1;
+	struct stat buf;
+	if (fstat(fd, &buf) != 0) {
+		goto done;
+	} else if (!S_ISREG(buf.st_mode)) {
+		ret = 0;
+		goto done;
+	}
+
+	if (grep->len == 0 && !grep->regex) {
+		// The empty string is in every file
+		ret = 1;
+		goto done;
+	}
+
+	ret = grep_fd(fd, grep);
+
+done:
+	close_quietly(fd);
+	return ret;
+}
+
+void bfs_grep_free(struct bfs_grep *grep) {
+	if (grep) {
+		bfs_regfree(grep->regex);
+		free(grep);
+	}
+}
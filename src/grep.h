@@ -0,0 +1,59 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * File content searching (-grep and -grep-regex).
+ */
+
+#ifndef BFS_GREP_H
+#define BFS_GREP_H
+
+#include <stdbool.h>
+
+struct BFTW;
+struct bfs_regex;
+
+/**
+ * A compiled content search.
+ */
+struct bfs_grep;
+
+/**
+ * Create a content search.
+ *
+ * @param pattern
+ *         The literal string to search for, if regex is NULL.
+ * @param regex
+ *         A regex to match against each line, or NULL to search for a literal
+ *         string.  Ownership is transferred to the new search on success.
+ * @return
+ *         The new search, or NULL on failure.
+ */
+struct bfs_grep *bfs_grep_new(const char *pattern, struct bfs_regex *regex);
+
+/**
+ * Check whether two searches look for the same thing.
+ */
+bool bfs_grep_equal(const struct bfs_grep *a, const struct bfs_grep *b);
+
+/**
+ * Search the contents of a file encountered during bftw(), unless bftw()
+ * already did it ahead of time.
+ *
+ * @param ftwbuf
+ *         The file to search.  Like the other fsade checks, BFS_LNK means the
+ *         link itself.
+ * @param grep
+ *         The search to do.
+ * @return
+ *         1 if the file matches, 0 if it doesn't or it's not a regular file,
+ *         or -1 if an error occurred.
+ */
+int bfs_check_grep(const struct BFTW *ftwbuf, const struct bfs_grep *grep);
+
+/**
+ * Free a content search.
+ */
+void bfs_grep_free(struct bfs_grep *grep);
+
+#endif // BFS_GREP_H
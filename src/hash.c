@@ -0,0 +1,628 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "hash.h"
+
+#include "bfs.h"
+#include "bfstd.h"
+#include "bftw.h"
+#include "bit.h"
+#include "diag.h"
+#include "fsade.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Algorithm names. */
+static const char *const hash_names[] = {
+	[BFS_HASH_BLAKE3] = "blake3",
+	[BFS_HASH_SHA256] = "sha256",
+	[BFS_HASH_XXH64] = "xxh64",
+};
+
+/** Digest sizes. */
+static const size_t hash_sizes[] = {
+	[BFS_HASH_BLAKE3] = 32,
+	[BFS_HASH_SHA256] = 32,
+	[BFS_HASH_XXH64] = 8,
+};
+
+static_assert(countof(hash_names) == BFS_HASH_ALGOS, "Missing hash names");
+static_assert(countof(hash_sizes) == BFS_HASH_ALGOS, "Missing hash sizes");
+
+int bfs_hash_parse(const char *name, enum bfs_hash_algo *algo) {
+	for (size_t i = 0; i < countof(hash_names); ++i) {
+		if (strcmp(name, hash_names[i]) == 0) {
+			*algo = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+const char *bfs_hash_name(enum bfs_hash_algo algo) {
+	bfs_assert(algo < BFS_HASH_ALGOS);
+	return hash_names[algo];
+}
+
+size_t bfs_hash_size(enum bfs_hash_algo algo) {
+	bfs_assert(algo < BFS_HASH_ALGOS);
+	return hash_sizes[algo];
+}
+
+/** Load a little-endian 32-bit word. */
+static uint32_t load_le32(const unsigned char *p) {
+	return (uint32_t)p[0]
+		| ((uint32_t)p[1] << 8)
+		| ((uint32_t)p[2] << 16)
+		| ((uint32_t)p[3] << 24);
+}
+
+/** Load a little-endian 64-bit word. */
+static uint64_t load_le64(const unsigned char *p) {
+	return load_le32(p) | ((uint64_t)load_le32(p + 4) << 32);
+}
+
+/** Load a big-endian 32-bit word. */
+static uint32_t load_be32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24)
+		| ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8)
+		| (uint32_t)p[3];
+}
+
+/** Store a little-endian 32-bit word. */
+static void store_le32(unsigned char *p, uint32_t n) {
+	p[0] = n;
+	p[1] = n >> 8;
+	p[2] = n >> 16;
+	p[3] = n >> 24;
+}
+
+/** Store a big-endian 32-bit word. */
+static void store_be32(unsigned char *p, uint32_t n) {
+	p[0] = n >> 24;
+	p[1] = n >> 16;
+	p[2] = n >> 8;
+	p[3] = n;
+}
+
+/** Store a big-endian 64-bit word. */
+static void store_be64(unsigned char *p, uint64_t n) {
+	store_be32(p, n >> 32);
+	store_be32(p + 4, n);
+}
+
+/** The SHA-256 initial hash value, also the BLAKE3 IV. */
+static const uint32_t sha256_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+// BLAKE3: https://github.com/BLAKE3-team/BLAKE3-specs
+
+/** BLAKE3 domain separation flags. */
+enum {
+	BLAKE3_CHUNK_START = 1 << 0,
+	BLAKE3_CHUNK_END   = 1 << 1,
+	BLAKE3_PARENT      = 1 << 2,
+	BLAKE3_ROOT        = 1 << 3,
+};
+
+/** The size of a BLAKE3 chunk. */
+#define BLAKE3_CHUNK 1024
+
+/** The BLAKE3 message schedule permutation. */
+static const unsigned char blake3_perm[16] = {
+	2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8,
+};
+
+/** The BLAKE3 quarter-round. */
+static void blake3_g(uint32_t s[16], int a, int b, int c, int d, uint32_t x, uint32_t y) {
+	s[a] += s[b] + x;
+	s[d] = rotate_right(s[d] ^ s[a], 16);
+	s[c] += s[d];
+	s[b] = rotate_right(s[b] ^ s[c], 12);
+	s[a] += s[b] + y;
+	s[d] = rotate_right(s[d] ^ s[a], 8);
+	s[c] += s[d];
+	s[b] = rotate_right(s[b] ^ s[c], 7);
+}
+
+/** The BLAKE3 compression function, producing a new chaining value. */
+static void blake3_compress(uint32_t cv[8], const uint32_t block[16], uint64_t counter, uint32_t len, uint32_t flags) {
+	uint32_t s[16] = {
+		cv[0], cv[1], cv[2], cv[3],
+		cv[4], cv[5], cv[6], cv[7],
+		sha256_iv[0], sha256_iv[1], sha256_iv[2], sha256_iv[3],
+		(uint32_t)counter, (uint32_t)(counter >> 32), len, flags,
+	};
+
+	uint32_t m[16];
+	memcpy(m, block, sizeof(m));
+
+	for (int r = 0; r < 7; ++r) {
+		blake3_g(s, 0, 4, 8, 12, m[0], m[1]);
+		blake3_g(s, 1, 5, 9, 13, m[2], m[3]);
+		blake3_g(s, 2, 6, 10, 14, m[4], m[5]);
+		blake3_g(s, 3, 7, 11, 15, m[6], m[7]);
+		blake3_g(s, 0, 5, 10, 15, m[8], m[9]);
+		blake3_g(s, 1, 6, 11, 12, m[10], m[11]);
+		blake3_g(s, 2, 7, 8, 13, m[12], m[13]);
+		blake3_g(s, 3, 4, 9, 14, m[14], m[15]);
+
+		uint32_t p[16];
+		for (int i = 0; i < 16; ++i) {
+			p[i] = m[blake3_perm[i]];
+		}
+		memcpy(m, p, sizeof(m));
+	}
+
+	for (int i = 0; i < 8; ++i) {
+		cv[i] = s[i] ^ s[i + 8];
+	}
+}
+
+/** Load a (zero-padded) BLAKE3 block. */
+static void blake3_load(uint32_t words[16], const unsigned char block[64]) {
+	for (int i = 0; i < 16; ++i) {
+		words[i] = load_le32(block + 4 * i);
+	}
+}
+
+/** Compute a BLAKE3 parent node's chaining value. */
+static void blake3_parent(uint32_t cv[8], const uint32_t left[8], const uint32_t right[8], uint32_t flags) {
+	uint32_t block[16];
+	memcpy(block, left, 8 * sizeof(*block));
+	memcpy(block + 8, right, 8 * sizeof(*block));
+
+	memcpy(cv, sha256_iv, sizeof(sha256_iv));
+	blake3_compress(cv, block, 0, 64, BLAKE3_PARENT | flags);
+}
+
+/** Get the flags for the next block of the current chunk. */
+static uint32_t blake3_chunk_flags(const struct bfs_hasher *hasher) {
+	return hasher->blake3.blocks == 0 ? BLAKE3_CHUNK_START : 0;
+}
+
+static void blake3_init(struct bfs_hasher *hasher) {
+	memcpy(hasher->blake3.cv, sha256_iv, sizeof(sha256_iv));
+	hasher->blake3.depth = 0;
+	hasher->blake3.chunk = 0;
+	hasher->blake3.blocks = 0;
+	hasher->blake3.len = 0;
+}
+
+/** Finish a chunk, and merge any complete subtrees. */
+static void blake3_push_chunk(struct bfs_hasher *hasher) {
+	uint32_t cv[8], block[16];
+	blake3_load(block, hasher->blake3.block);
+	memcpy(cv, hasher->blake3.cv, sizeof(cv));
+	blake3_compress(cv, block, hasher->blake3.chunk, 64, blake3_chunk_flags(hasher) | BLAKE3_CHUNK_END);
+
+	// Merge one subtree per trailing zero bit of the new chunk count
+	uint64_t chunks = ++hasher->blake3.chunk;
+	while (!(chunks & 1)) {
+		uint32_t (*left)[8] = &hasher->blake3.stack[--hasher->blake3.depth];
+		blake3_parent(cv, *left, cv, 0);
+		chunks >>= 1;
+	}
+	memcpy(hasher->blake3.stack[hasher->blake3.depth++], cv, sizeof(cv));
+
+	memcpy(hasher->blake3.cv, sha256_iv, sizeof(sha256_iv));
+	hasher->blake3.blocks = 0;
+	hasher->blake3.len = 0;
+}
+
+static void blake3_update(struct bfs_hasher *hasher, const unsigned char *data, size_t size) {
+	while (size > 0) {
+		if (hasher->blake3.len == 64) {
+			if (hasher->blake3.blocks == BLAKE3_CHUNK / 64 - 1) {
+				// The last block of a chunk
+				blake3_push_chunk(hasher);
+			} else {
+				uint32_t block[16];
+				blake3_load(block, hasher->blake3.block);
+				blake3_compress(hasher->blake3.cv, block, hasher->blake3.chunk, 64, blake3_chunk_flags(hasher));
+				++hasher->blake3.blocks;
+				hasher->blake3.len = 0;
+			}
+		}
+
+		size_t n = 64 - hasher->blake3.len;
+		if (n > size) {
+			n = size;
+		}
+		memcpy(hasher->blake3.block + hasher->blake3.len, data, n);
+		hasher->blake3.len += n;
+		data += n;
+		size -= n;
+	}
+}
+
+static void blake3_final(struct bfs_hasher *hasher, unsigned char *digest) {
+	size_t len = hasher->blake3.len;
+	memset(hasher->blake3.block + len, 0, 64 - len);
+
+	// The output node, before the ROOT flag
+	uint32_t cv[8], block[16];
+	memcpy(cv, hasher->blake3.cv, sizeof(cv));
+	blake3_load(block, hasher->blake3.block);
+	uint64_t counter = hasher->blake3.chunk;
+	uint32_t flags = blake3_chunk_flags(hasher) | BLAKE3_CHUNK_END;
+
+	for (size_t i = hasher->blake3.depth; i-- > 0;) {
+		// Finish the pending node, then make it the right child of a parent
+		blake3_compress(cv, block, counter, len, flags);
+		memcpy(block, hasher->blake3.stack[i], 8 * sizeof(*block));
+		memcpy(block + 8, cv, 8 * sizeof(*block));
+		memcpy(cv, sha256_iv, sizeof(sha256_iv));
+		counter = 0;
+		len = 64;
+		flags = BLAKE3_PARENT;
+	}
+
+	blake3_compress(cv, block, counter, len, flags | BLAKE3_ROOT);
+	for (int i = 0; i < 8; ++i) {
+		store_le32(digest + 4 * i, cv[i]);
+	}
+}
+
+// SHA-256: FIPS 180-4
+
+/** The SHA-256 round constants. */
+static const uint32_t sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+/** Process one SHA-256 block. */
+static void sha256_block(uint32_t h[8], const unsigned char block[64]) {
+	uint32_t w[64];
+	for (int i = 0; i < 16; ++i) {
+		w[i] = load_be32(block + 4 * i);
+	}
+	for (int i = 16; i < 64; ++i) {
+		uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+	uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+
+	for (int i = 0; i < 64; ++i) {
+		uint32_t s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = k + s1 + ch + sha256_k[i] + w[i];
+		uint32_t s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = s0 + maj;
+
+		k = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+	h[5] += f;
+	h[6] += g;
+	h[7] += k;
+}
+
+static void sha256_init(struct bfs_hasher *hasher) {
+	memcpy(hasher->sha256.h, sha256_iv, sizeof(sha256_iv));
+	hasher->sha256.total = 0;
+	hasher->sha256.len = 0;
+}
+
+static void sha256_update(struct bfs_hasher *hasher, const unsigned char *data, size_t size) {
+	hasher->sha256.total += size;
+
+	if (hasher->sha256.len > 0) {
+		size_t n = 64 - hasher->sha256.len;
+		if (n > size) {
+			n = size;
+		}
+		memcpy(hasher->sha256.block + hasher->sha256.len, data, n);
+		hasher->sha256.len += n;
+		data += n;
+		size -= n;
+
+		if (hasher->sha256.len < 64) {
+			return;
+		}
+		sha256_block(hasher->sha256.h, hasher->sha256.block);
+		hasher->sha256.len = 0;
+	}
+
+	for (; size >= 64; data += 64, size -= 64) {
+		sha256_block(hasher->sha256.h, data);
+	}
+
+	memcpy(hasher->sha256.block, data, size);
+	hasher->sha256.len = size;
+}
+
+static void sha256_final(struct bfs_hasher *hasher, unsigned char *digest) {
+	uint64_t bits = hasher->sha256.total * 8;
+
+	unsigned char *block = hasher->sha256.block;
+	size_t len = hasher->sha256.len;
+	block[len++] = 0x80;
+	if (len > 56) {
+		memset(block + len, 0, 64 - len);
+		sha256_block(hasher->sha256.h, block);
+		len = 0;
+	}
+	memset(block + len, 0, 56 - len);
+	store_be64(block + 56, bits);
+	sha256_block(hasher->sha256.h, block);
+
+	for (int i = 0; i < 8; ++i) {
+		store_be32(digest + 4 * i, hasher->sha256.h[i]);
+	}
+}
+
+// XXH64: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+/** Mix a lane into an accumulator. */
+static uint64_t xxh64_round(uint64_t acc, uint64_t lane) {
+	acc += lane * XXH_PRIME64_2;
+	acc = rotate_left(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+/** Merge an accumulator into the hash. */
+static uint64_t xxh64_merge(uint64_t hash, uint64_t acc) {
+	hash ^= xxh64_round(0, acc);
+	return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/** Process one 32-byte stripe. */
+static void xxh64_stripe(uint64_t acc[4], const unsigned char *stripe) {
+	for (int i = 0; i < 4; ++i) {
+		acc[i] = xxh64_round(acc[i], load_le64(stripe + 8 * i));
+	}
+}
+
+static void xxh64_init(struct bfs_hasher *hasher) {
+	hasher->xxh64.acc[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+	hasher->xxh64.acc[1] = XXH_PRIME64_2;
+	hasher->xxh64.acc[2] = 0;
+	hasher->xxh64.acc[3] = -XXH_PRIME64_1;
+	hasher->xxh64.total = 0;
+	hasher->xxh64.len = 0;
+}
+
+static void xxh64_update(struct bfs_hasher *hasher, const unsigned char *data, size_t size) {
+	hasher->xxh64.total += size;
+
+	if (hasher->xxh64.len > 0) {
+		size_t n = 32 - hasher->xxh64.len;
+		if (n > size) {
+			n = size;
+		}
+		memcpy(hasher->xxh64.stripe + hasher->xxh64.len, data, n);
+		hasher->xxh64.len += n;
+		data += n;
+		size -= n;
+
+		if (hasher->xxh64.len < 32) {
+			return;
+		}
+		xxh64_stripe(hasher->xxh64.acc, hasher->xxh64.stripe);
+		hasher->xxh64.len = 0;
+	}
+
+	for (; size >= 32; data += 32, size -= 32) {
+		xxh64_stripe(hasher->xxh64.acc, data);
+	}
+
+	memcpy(hasher->xxh64.stripe, data, size);
+	hasher->xxh64.len = size;
+}
+
+static void xxh64_final(struct bfs_hasher *hasher, unsigned char *digest) {
+	const uint64_t *acc = hasher->xxh64.acc;
+
+	uint64_t hash;
+	if (hasher->xxh64.total >= 32) {
+		hash = rotate_left(acc[0], 1) + rotate_left(acc[1], 7) + rotate_left(acc[2], 12) + rotate_left(acc[3], 18);
+		for (int i = 0; i < 4; ++i) {
+			hash = xxh64_merge(hash, acc[i]);
+		}
+	} else {
+		hash = XXH_PRIME64_5;
+	}
+
+	hash += hasher->xxh64.total;
+
+	const unsigned char *p = hasher->xxh64.stripe;
+	size_t len = hasher->xxh64.len;
+	for (; len >= 8; p += 8, len -= 8) {
+		hash ^= xxh64_round(0, load_le64(p));
+		hash = rotate_left(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (len >= 4) {
+		hash ^= load_le32(p) * XXH_PRIME64_1;
+		hash = rotate_left(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+		len -= 4;
+	}
+	for (; len > 0; ++p, --len) {
+		hash ^= *p * XXH_PRIME64_5;
+		hash = rotate_left(hash, 11) * XXH_PRIME64_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME64_3;
+	hash ^= hash >> 32;
+
+	// The canonical representation is big-endian
+	store_be64(digest, hash);
+}
+
+void bfs_hash_init(struct bfs_hasher *hasher, enum bfs_hash_algo algo) {
+	hasher->algo = algo;
+
+	switch (algo) {
+	case BFS_HASH_BLAKE3:
+		blake3_init(hasher);
+		return;
+	case BFS_HASH_SHA256:
+		sha256_init(hasher);
+		return;
+	case BFS_HASH_XXH64:
+		xxh64_init(hasher);
+		return;
+
+	case BFS_HASH_ALGOS:
+		break;
+	}
+
+	bfs_bug("Unknown hash algorithm %d", (int)algo);
+}
+
+void bfs_hash_update(struct bfs_hasher *hasher, const void *data, size_t size) {
+	switch (hasher->algo) {
+	case BFS_HASH_BLAKE3:
+		blake3_update(hasher, data, size);
+		return;
+	case BFS_HASH_SHA256:
+		sha256_update(hasher, data, size);
+		return;
+	case BFS_HASH_XXH64:
+		xxh64_update(hasher, data, size);
+		return;
+
+	case BFS_HASH_ALGOS:
+		break;
+	}
+
+	bfs_bug("Unknown hash algorithm %d", (int)hasher->algo);
+}
+
+void bfs_hash_final(struct bfs_hasher *hasher, unsigned char *digest) {
+	switch (hasher->algo) {
+	case BFS_HASH_BLAKE3:
+		blake3_final(hasher, digest);
+		return;
+	case BFS_HASH_SHA256:
+		sha256_final(hasher, digest);
+		return;
+	case BFS_HASH_XXH64:
+		xxh64_final(hasher, digest);
+		return;
+
+	case BFS_HASH_ALGOS:
+		break;
+	}
+
+	bfs_bug("Unknown hash algorithm %d", (int)hasher->algo);
+}
+
+/** The size of the buffer for reading files. */
+#define HASH_BUFSIZE (128 << 10)
+
+/** Hash the contents of an open file. */
+static int hash_fd(int fd, enum bfs_hash_algo algo, unsigned char *digest) {
+	unsigned char *buf = malloc(HASH_BUFSIZE);
+	if (!buf) {
+		return -1;
+	}
+
+	struct bfs_hasher hasher;
+	bfs_hash_init(&hasher, algo);
+
+	int ret = 0;
+	while (true) {
+		ssize_t size = read(fd, buf, HASH_BUFSIZE);
+		if (size < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ret = -1;
+			break;
+		} else if (size == 0) {
+			break;
+		}
+
+		bfs_hash_update(&hasher, buf, size);
+	}
+
+	if (ret == 0) {
+		bfs_hash_final(&hasher, digest);
+	}
+
+	free(buf);
+	return ret;
+}
+
+int bfs_check_hash(const struct BFTW *ftwbuf, enum bfs_hash_algo algo, unsigned char *digest) {
+	const struct bfs_fsade_probe *probe = &ftwbuf->fsade;
+	if ((probe->checked & BFS_CHECK_HASH) && probe->hash == algo) {
+		if (probe->found & BFS_CHECK_HASH) {
+			memcpy(digest, probe->digest, bfs_hash_size(algo));
+			return 1;
+		} else {
+			return 0;
+		}
+	}
+
+	if (ftwbuf->type != BFS_REG) {
+		return 0;
+	}
+
+	// O_NONBLOCK in case it was replaced with a FIFO
+	int fd = openat(ftwbuf->at_fd, ftwbuf->at_path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int ret = -1;
+	struct stat buf;
+	if (fstat(fd, &buf) != 0) {
+		goto done;
+	} else if (!S_ISREG(buf.st_mode)) {
+		ret = 0;
+		goto done;
+	}
+
+	if (hash_fd(fd, algo, digest) == 0) {
+		ret = 1;
+	}
+
+done:
+	close_quietly(fd);
+	return ret;
+}
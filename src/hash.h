@@ -0,0 +1,145 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * File content hashing (-hash and -printf %X).
+ */
+
+#ifndef BFS_HASH_H
+#define BFS_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct BFTW;
+
+/**
+ * Supported hash algorithms.
+ */
+enum bfs_hash_algo {
+	/** BLAKE3, with a 256-bit digest. */
+	BFS_HASH_BLAKE3,
+	/** SHA-256. */
+	BFS_HASH_SHA256,
+	/** XXH64, with a zero seed. */
+	BFS_HASH_XXH64,
+	/** The number of algorithms. */
+	BFS_HASH_ALGOS,
+};
+
+/** The size of the largest digest, in bytes. */
+#define BFS_HASH_MAX 32
+
+/**
+ * Look up a hash algorithm by name.
+ *
+ * @param name
+ *         The name of the algorithm, e.g. "sha256".
+ * @param[out] algo
+ *         Will hold the algorithm.
+ * @return
+ *         0 on success, -1 if the name is not recognized.
+ */
+int bfs_hash_parse(const char *name, enum bfs_hash_algo *algo);
+
+/**
+ * Get the name of a hash algorithm.
+ */
+const char *bfs_hash_name(enum bfs_hash_algo algo);
+
+/**
+ * Get the size of a hash algorithm's digests, in bytes.
+ */
+size_t bfs_hash_size(enum bfs_hash_algo algo);
+
+/**
+ * Incremental hashing state.
+ */
+struct bfs_hasher {
+	/** The algorithm in use. */
+	enum bfs_hash_algo algo;
+
+	/** Algorithm-specific state. */
+	union {
+		/** BLAKE3 state. */
+		struct {
+			/** The chaining value of the current chunk. */
+			uint32_t cv[8];
+			/** The stack of completed subtree chaining values. */
+			uint32_t stack[54][8];
+			/** The height of the stack. */
+			size_t depth;
+			/** The index of the current chunk. */
+			uint64_t chunk;
+			/** The number of blocks of the current chunk already compressed. */
+			size_t blocks;
+			/** The buffered block. */
+			unsigned char block[64];
+			/** The length of the buffered block. */
+			size_t len;
+		} blake3;
+
+		/** SHA-256 state. */
+		struct {
+			/** The intermediate hash value. */
+			uint32_t h[8];
+			/** The total length, in bytes. */
+			uint64_t total;
+			/** The buffered block. */
+			unsigned char block[64];
+			/** The length of the buffered block. */
+			size_t len;
+		} sha256;
+
+		/** XXH64 state. */
+		struct {
+			/** The four accumulators. */
+			uint64_t acc[4];
+			/** The total length, in bytes. */
+			uint64_t total;
+			/** The buffered stripe. */
+			unsigned char stripe[32];
+			/** The length of the buffered stripe. */
+			size_t len;
+		} xxh64;
+	};
+};
+
+/**
+ * Start hashing.
+ */
+void bfs_hash_init(struct bfs_hasher *hasher, enum bfs_hash_algo algo);
+
+/**
+ * Hash some more data.
+ */
+void bfs_hash_update(struct bfs_hasher *hasher, const void *data, size_t size);
+
+/**
+ * Finish hashing.
+ *
+ * @param hasher
+ *         The hashing state.
+ * @param[out] digest
+ *         Will hold the digest, which is bfs_hash_size() bytes long.
+ */
+void bfs_hash_final(struct bfs_hasher *hasher, unsigned char *digest);
+
+/**
+ * Hash the contents of a file encountered during bftw(), unless bftw() already
+ * did it ahead of time.
+ *
+ * @param ftwbuf
+ *         The file to hash.  Like the other fsade checks, BFS_LNK means the
+ *         link itself.
+ * @param algo
+ *         The hash algorithm to use.
+ * @param[out] digest
+ *         Will hold the digest.
+ * @return
+ *         1 if the file was hashed, 0 if it's not a regular file, or -1 if an
+ *         error occurred.
+ */
+int bfs_check_hash(const struct BFTW *ftwbuf, enum bfs_hash_algo algo, unsigned char *digest);
+
+#endif // BFS_HASH_H
@@ -0,0 +1,386 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "idset.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "diag.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Empty slots are all ones, an ID that no real file should have (but we
+ * handle it anyway with idset::empty_refs).
+ */
+static bool idset_is_empty(dev_t dev, ino_t ino) {
+	return dev == (dev_t)-1 && ino == (ino_t)-1;
+}
+
+/** Hash a file ID to 64 bits. */
+static uint64_t idset_hash64(dev_t dev, ino_t ino) {
+	uint64_t hash = (uint64_t)ino * UINT64_C(0x9E3779B97F4A7C15);
+	hash ^= (uint64_t)dev + (hash << 6) + (hash >> 2);
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xFF51AFD7ED558CCD);
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/** Hash a file ID. */
+static size_t idset_hash(dev_t dev, ino_t ino) {
+	return idset_hash64(dev, ino);
+}
+
+void idset_init(struct idset *set) {
+	set->table = NULL;
+	set->capacity = 0;
+	set->refs = NULL;
+	set->count = 0;
+	set->empty_refs = 0;
+}
+
+/** Find the slot for an ID, or the empty slot where it would go. */
+static struct idset_slot *idset_find(const struct idset *set, dev_t dev, ino_t ino) {
+	size_t mask = set->capacity - 1;
+	for (size_t i = idset_hash(dev, ino) & mask;; i = (i + 1) & mask) {
+		struct idset_slot *slot = &set->table[i];
+		if ((slot->dev == dev && slot->ino == ino) || idset_is_empty(slot->dev, slot->ino)) {
+			return slot;
+		}
+	}
+}
+
+bool idset_contains(const struct idset *set, dev_t dev, ino_t ino) {
+	if (idset_is_empty(dev, ino)) {
+		return set->empty_refs > 0;
+	} else if (set->capacity == 0) {
+		return false;
+	}
+
+	const struct idset_slot *slot = idset_find(set, dev, ino);
+	return !idset_is_empty(slot->dev, slot->ino);
+}
+
+/** Grow the hash table, and the reference counts if the set is counted. */
+static int idset_grow(struct idset *set, bool counted) {
+	size_t capacity = set->capacity ? 2 * set->capacity : 64;
+	struct idset_slot *table = ALLOC_ARRAY(struct idset_slot, capacity);
+	if (!table) {
+		return -1;
+	}
+	memset(table, 0xFF, capacity * sizeof(*table));
+
+	size_t *refs = NULL;
+	if (counted) {
+		refs = ALLOC_ARRAY(size_t, capacity);
+		if (!refs) {
+			free(table);
+			return -1;
+		}
+	}
+
+	struct idset_slot *old = set->table;
+	size_t *old_refs = set->refs;
+	size_t old_capacity = set->capacity;
+	set->table = table;
+	set->refs = refs;
+	set->capacity = capacity;
+
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (!idset_is_empty(old[i].dev, old[i].ino)) {
+			struct idset_slot *slot = idset_find(set, old[i].dev, old[i].ino);
+			*slot = old[i];
+			if (refs) {
+				refs[slot - table] = old_refs[i];
+			}
+		}
+	}
+
+	free(old_refs);
+	free(old);
+	return 0;
+}
+
+/** Find the slot for an ID, making room for it if necessary. */
+static struct idset_slot *idset_reserve(struct idset *set, dev_t dev, ino_t ino, bool counted) {
+	// Keep the load factor below 3/4
+	if (4 * (set->count + 1) > 3 * set->capacity) {
+		if (idset_grow(set, counted) != 0) {
+			return NULL;
+		}
+	}
+
+	return idset_find(set, dev, ino);
+}
+
+int idset_insert(struct idset *set, dev_t dev, ino_t ino) {
+	if (idset_is_empty(dev, ino)) {
+		if (set->empty_refs > 0) {
+			return 0;
+		}
+		set->empty_refs = 1;
+		return 1;
+	}
+
+	struct idset_slot *slot = idset_reserve(set, dev, ino, false);
+	if (!slot) {
+		return -1;
+	} else if (!idset_is_empty(slot->dev, slot->ino)) {
+		return 0;
+	}
+
+	slot->dev = dev;
+	slot->ino = ino;
+	++set->count;
+	return 1;
+}
+
+/** Remove an occupied slot. */
+static void idset_remove_slot(struct idset *set, struct idset_slot *slot) {
+	// Backward-shift deletion: move later entries in the same probe
+	// sequence into the hole, so lookups never need tombstones
+	size_t mask = set->capacity - 1;
+	size_t hole = slot - set->table;
+	for (size_t i = (hole + 1) & mask;; i = (i + 1) & mask) {
+		struct idset_slot *next = &set->table[i];
+		if (idset_is_empty(next->dev, next->ino)) {
+			break;
+		}
+
+		// Move it if the hole is between its home slot and i (cyclically)
+		size_t home = idset_hash(next->dev, next->ino) & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			set->table[hole] = *next;
+			if (set->refs) {
+				set->refs[hole] = set->refs[i];
+			}
+			hole = i;
+		}
+	}
+
+	memset(&set->table[hole], 0xFF, sizeof(set->table[hole]));
+	--set->count;
+}
+
+void idset_remove(struct idset *set, dev_t dev, ino_t ino) {
+	if (idset_is_empty(dev, ino)) {
+		set->empty_refs = 0;
+		return;
+	} else if (set->capacity == 0) {
+		return;
+	}
+
+	struct idset_slot *slot = idset_find(set, dev, ino);
+	if (!idset_is_empty(slot->dev, slot->ino)) {
+		idset_remove_slot(set, slot);
+	}
+}
+
+int idset_ref(struct idset *set, dev_t dev, ino_t ino) {
+	if (idset_is_empty(dev, ino)) {
+		++set->empty_refs;
+		return 0;
+	}
+
+	struct idset_slot *slot = idset_reserve(set, dev, ino, true);
+	if (!slot) {
+		return -1;
+	}
+
+	size_t i = slot - set->table;
+	if (idset_is_empty(slot->dev, slot->ino)) {
+		slot->dev = dev;
+		slot->ino = ino;
+		set->refs[i] = 0;
+		++set->count;
+	}
+
+	++set->refs[i];
+	return 0;
+}
+
+void idset_unref(struct idset *set, dev_t dev, ino_t ino) {
+	if (idset_is_empty(dev, ino)) {
+		bfs_assert(set->empty_refs > 0);
+		--set->empty_refs;
+		return;
+	}
+
+	bfs_assert(set->capacity > 0);
+	struct idset_slot *slot = idset_find(set, dev, ino);
+	bfs_assert(!idset_is_empty(slot->dev, slot->ino));
+
+	if (--set->refs[slot - set->table] == 0) {
+		idset_remove_slot(set, slot);
+	}
+}
+
+void idset_destroy(struct idset *set) {
+	free(set->refs);
+	free(set->table);
+}
+
+/** The maximum length of an idfilter's queue. */
+#define IDFILTER_QUEUE 1024
+
+/** The number of IDs per Bloom filter block before it's grown (16 bits each). */
+#define IDFILTER_LOAD 32
+
+struct idfilter_entry {
+	/** The hash of the ID, and later its home slot in the table. */
+	uint64_t key;
+	/** The device number. */
+	dev_t dev;
+	/** The inode number. */
+	ino_t ino;
+};
+
+void idfilter_init(struct idfilter *filter) {
+	idset_init(&filter->set);
+	filter->bloom = NULL;
+	filter->blocks = 0;
+	filter->queue = NULL;
+	filter->queued = 0;
+}
+
+/**
+ * Set the Bloom filter bits for a hash.  The high bits pick the block, and
+ * four 9-bit fields of the low bits each pick one of its 512 bits.
+ *
+ * @return
+ *         Whether all the bits were already set.
+ */
+static bool idfilter_bloom(uint64_t *bloom, size_t blocks, uint64_t hash) {
+	uint64_t *block = bloom + 8 * ((hash >> 36) & (blocks - 1));
+
+	bool found = true;
+	for (int i = 0; i < 4; ++i) {
+		size_t bit = (hash >> (9 * i)) & 0x1FF;
+		uint64_t mask = (uint64_t)1 << (bit % 64);
+		found &= (block[bit / 64] & mask) != 0;
+		block[bit / 64] |= mask;
+	}
+
+	return found;
+}
+
+/** Grow the Bloom filter to hold every ID, plus one more. */
+static int idfilter_grow(struct idfilter *filter) {
+	size_t ids = filter->set.count + filter->queued + 1;
+	if (ids <= IDFILTER_LOAD * filter->blocks) {
+		return 0;
+	}
+
+	if (!filter->queue) {
+		filter->queue = ALLOC_ARRAY(struct idfilter_entry, IDFILTER_QUEUE);
+		if (!filter->queue) {
+			return -1;
+		}
+	}
+
+	size_t blocks = filter->blocks ? filter->blocks : 64;
+	while (ids > IDFILTER_LOAD * blocks) {
+		blocks *= 2;
+	}
+
+	uint64_t *bloom = ZALLOC_ARRAY(uint64_t, 8 * blocks);
+	if (!bloom) {
+		return -1;
+	}
+
+	const struct idset *set = &filter->set;
+	for (size_t i = 0; i < set->capacity; ++i) {
+		const struct idset_slot *slot = &set->table[i];
+		if (!idset_is_empty(slot->dev, slot->ino)) {
+			idfilter_bloom(bloom, blocks, idset_hash64(slot->dev, slot->ino));
+		}
+	}
+
+	for (size_t i = 0; i < filter->queued; ++i) {
+		idfilter_bloom(bloom, blocks, filter->queue[i].key);
+	}
+
+	free(filter->bloom);
+	filter->bloom = bloom;
+	filter->blocks = blocks;
+	return 0;
+}
+
+/** Sort queued entries by home slot. */
+static int idfilter_cmp(const void *a, const void *b) {
+	const struct idfilter_entry *x = a;
+	const struct idfilter_entry *y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/** Move the queued IDs into the exact set. */
+static int idfilter_flush(struct idfilter *filter) {
+	struct idset *set = &filter->set;
+	size_t n = filter->queued;
+	if (n == 0) {
+		return 0;
+	}
+
+	while (4 * (set->count + n) > 3 * set->capacity) {
+		if (idset_grow(set, false) != 0) {
+			return -1;
+		}
+	}
+
+	size_t mask = set->capacity - 1;
+	for (size_t i = 0; i < n; ++i) {
+		filter->queue[i].key &= mask;
+	}
+	qsort(filter->queue, n, sizeof(*filter->queue), idfilter_cmp);
+
+	// The Bloom filter guarantees that none of these are present yet
+	for (size_t i = 0; i < n; ++i) {
+		const struct idfilter_entry *entry = &filter->queue[i];
+		struct idset_slot *slot = idset_find(set, entry->dev, entry->ino);
+		bfs_assert(idset_is_empty(slot->dev, slot->ino));
+		slot->dev = entry->dev;
+		slot->ino = entry->ino;
+	}
+
+	set->count += n;
+	filter->queued = 0;
+	return 0;
+}
+
+int idfilter_insert(struct idfilter *filter, dev_t dev, ino_t ino) {
+	if (idset_is_empty(dev, ino)) {
+		return idset_insert(&filter->set, dev, ino);
+	}
+
+	if (filter->queued == IDFILTER_QUEUE && idfilter_flush(filter) != 0) {
+		return -1;
+	}
+
+	if (idfilter_grow(filter) != 0) {
+		return -1;
+	}
+
+	uint64_t hash = idset_hash64(dev, ino);
+	if (idfilter_bloom(filter->bloom, filter->blocks, hash)) {
+		// Possibly a duplicate, so consult the exact set
+		if (idfilter_flush(filter) != 0) {
+			return -1;
+		}
+		return idset_insert(&filter->set, dev, ino);
+	}
+
+	struct idfilter_entry *entry = &filter->queue[filter->queued++];
+	entry->key = hash;
+	entry->dev = dev;
+	entry->ino = ino;
+	return 1;
+}
+
+void idfilter_destroy(struct idfilter *filter) {
+	free(filter->queue);
+	free(filter->bloom);
+	idset_destroy(&filter->set);
+}
@@ -0,0 +1,127 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * A compact set of file IDs (device and inode numbers).
+ */
+
+#ifndef BFS_IDSET_H
+#define BFS_IDSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * A file ID in the set.
+ */
+struct idset_slot {
+	/** The device number. */
+	dev_t dev;
+	/** The inode number. */
+	ino_t ino;
+};
+
+/**
+ * An open-addressed hash set of file IDs.
+ */
+struct idset {
+	/** The hash table. */
+	struct idset_slot *table;
+	/** The capacity of the table (a power of two, or zero). */
+	size_t capacity;
+	/** Reference counts for each slot, if the set is counted. */
+	size_t *refs;
+	/** The number of IDs in the table. */
+	size_t count;
+	/** The number of references to the ID used to mark empty slots. */
+	size_t empty_refs;
+};
+
+/**
+ * Initialize an empty set.
+ */
+void idset_init(struct idset *set);
+
+/**
+ * Check whether a file ID is in the set.
+ */
+bool idset_contains(const struct idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Add a file ID to the set.
+ *
+ * @return
+ *         1 if the ID was added, 0 if it was already there, or -1 on failure.
+ */
+int idset_insert(struct idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Remove a file ID from the set, if it is there.
+ */
+void idset_remove(struct idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Add a reference to a file ID, adding it to the set if necessary.  Counted
+ * and uncounted operations should not be mixed on the same set.
+ *
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int idset_ref(struct idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Drop a reference to a file ID, removing it from the set once the last
+ * reference is gone.
+ */
+void idset_unref(struct idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Destroy a set.
+ */
+void idset_destroy(struct idset *set);
+
+/** A queued entry in an idfilter. */
+struct idfilter_entry;
+
+/**
+ * A set of file IDs with a blocked Bloom filter in front, for sets that
+ * mostly see new IDs (like -unique).
+ *
+ * The filter is an order of magnitude smaller than the exact set, so it stays
+ * mostly cache-resident.  IDs it definitely hasn't seen are queued rather than
+ * inserted right away, and the queue is flushed into the exact set in slot
+ * order, so the table is written nearly sequentially instead of at random.
+ */
+struct idfilter {
+	/** The exact set. */
+	struct idset set;
+	/** The Bloom filter, in blocks of 8 words (one cache line). */
+	uint64_t *bloom;
+	/** The number of blocks in the filter (a power of two, or zero). */
+	size_t blocks;
+	/** The IDs waiting to be inserted into the exact set. */
+	struct idfilter_entry *queue;
+	/** The length of the queue. */
+	size_t queued;
+};
+
+/**
+ * Initialize an empty filtered set.
+ */
+void idfilter_init(struct idfilter *filter);
+
+/**
+ * Add a file ID to a filtered set.
+ *
+ * @return
+ *         1 if the ID was added, 0 if it was already there, or -1 on failure.
+ */
+int idfilter_insert(struct idfilter *filter, dev_t dev, ino_t ino);
+
+/**
+ * Destroy a filtered set.
+ */
+void idfilter_destroy(struct idfilter *filter);
+
+#endif // BFS_IDSET_H
@@ -0,0 +1,352 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "ignore.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "dstring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A single ignore rule.
+ */
+struct bfs_ignore_rule {
+	/** The pattern, without any leading "!" or "/", or trailing "/". */
+	char *pattern;
+	/** Whether the pattern has no wildcards. */
+	bool literal;
+	/** Whether the pattern had a slash, so it matches the relative path, not just the name. */
+	bool anchored;
+	/** Whether the pattern only matches directories (it ended with a slash). */
+	bool dir_only;
+	/** Whether the rule re-includes the files it matches (it started with "!"). */
+	bool negate;
+};
+
+struct bfs_ignore {
+	/** The rules of the closest ancestor with ignore files. */
+	struct bfs_ignore *parent;
+	/** The offset of the paths relative to this directory. */
+	size_t base;
+	/** The rules, in file order. */
+	struct bfs_ignore_rule *rules;
+	/** The number of rules. */
+	size_t nrules;
+};
+
+/** Compile one line of an ignore file. */
+static int ignore_parse_line(struct bfs_ignore *ignore, char *line) {
+	size_t len = strlen(line);
+	if (len > 0 && line[len - 1] == '\r') {
+		line[--len] = '\0';
+	}
+
+	if (len == 0 || line[0] == '#') {
+		return 0;
+	}
+
+	// Trailing spaces are ignored, unless they're escaped
+	while (len > 0 && line[len - 1] == ' ') {
+		if (len > 1 && line[len - 2] == '\\') {
+			break;
+		}
+		line[--len] = '\0';
+	}
+
+	bool negate = line[0] == '!';
+	if (negate) {
+		++line;
+		--len;
+	}
+
+	bool dir_only = len > 0 && line[len - 1] == '/';
+	if (dir_only) {
+		line[--len] = '\0';
+	}
+
+	bool anchored = line[0] == '/';
+	if (anchored) {
+		++line;
+		--len;
+	} else {
+		anchored = strchr(line, '/');
+	}
+
+	if (len == 0) {
+		return 0;
+	}
+
+	struct bfs_ignore_rule *rule = RESERVE(struct bfs_ignore_rule, &ignore->rules, &ignore->nrules);
+	if (!rule) {
+		return -1;
+	}
+
+	rule->pattern = strdup(line);
+	if (!rule->pattern) {
+		--ignore->nrules;
+		return -1;
+	}
+
+	rule->literal = !strpbrk(line, "*?[\\");
+	rule->anchored = anchored;
+	rule->dir_only = dir_only;
+	rule->negate = negate;
+	return 0;
+}
+
+/** Add the rules from an ignore file, if it exists. */
+static int ignore_parse_file(struct bfs_ignore **ignore, struct bfs_ignore *parent, int dfd, const char *path, size_t base, const char *name) {
+	dchar *file_path = dstrprintf("%s/%s", path, name);
+	if (!file_path) {
+		return -1;
+	}
+
+	int fd = openat(dfd, file_path, O_RDONLY | O_CLOEXEC);
+	dstrfree(file_path);
+	if (fd < 0) {
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	FILE *file = fdopen(fd, "r");
+	if (!file) {
+		close_quietly(fd);
+		return -1;
+	}
+
+	int ret = -1;
+	if (*ignore == parent) {
+		struct bfs_ignore *new = ZALLOC(struct bfs_ignore);
+		if (!new) {
+			goto done;
+		}
+		new->parent = parent;
+		new->base = base;
+		*ignore = new;
+	}
+
+	char *line;
+	while ((line = xgetdelim(file, '\n'))) {
+		int err = ignore_parse_line(*ignore, line);
+		free(line);
+		if (err != 0) {
+			goto done;
+		}
+	}
+
+	if (errno == 0) {
+		ret = 0;
+	}
+
+done:
+	fclose(file);
+	return ret;
+}
+
+int bfs_ignore_load(struct bfs_ignore **ignore, struct bfs_ignore *parent, int dfd, const char *path, size_t base) {
+	*ignore = parent;
+
+	// Like ripgrep and fd, .ignore takes precedence over .gitignore
+	static const char *const names[] = {".gitignore", ".ignore"};
+	for (size_t i = 0; i < countof(names); ++i) {
+		if (ignore_parse_file(ignore, parent, dfd, path, base, names[i]) != 0) {
+			int error = errno;
+			if (*ignore != parent) {
+				bfs_ignore_free(*ignore);
+				*ignore = parent;
+			}
+			errno = error;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Match a bracket expression like [a-z] against a character.
+ *
+ * @return
+ *         The length of the bracket expression if it matches, 0 if it doesn't,
+ *         or -1 if it's not terminated.
+ */
+static int ignore_bracket(const char *pat, char c) {
+	const char *p = pat + 1;
+
+	bool negate = *p == '!' || *p == '^';
+	if (negate) {
+		++p;
+	}
+
+	bool match = false;
+	for (bool first = true; *p && (first || *p != ']'); first = false) {
+		char lo = *p++;
+		if (lo == '\\' && *p) {
+			lo = *p++;
+		}
+
+		char hi = lo;
+		if (p[0] == '-' && p[1] && p[1] != ']') {
+			++p;
+			hi = *p++;
+			if (hi == '\\' && *p) {
+				hi = *p++;
+			}
+		}
+
+		unsigned char uc = c;
+		if ((unsigned char)lo <= uc && uc <= (unsigned char)hi) {
+			match = true;
+		}
+	}
+
+	if (*p != ']') {
+		return -1;
+	} else if (match == negate) {
+		return 0;
+	} else {
+		return p + 1 - pat;
+	}
+}
+
+/**
+ * Match a glob against a path, where "*", "?", and [...] don't match slashes,
+ * but "**" matches any number of path components.
+ */
+static bool ignore_glob(const char *start, const char *pat, const char *str) {
+	while (true) {
+		switch (*pat) {
+		case '\0':
+			return *str == '\0';
+
+		case '*':
+			if (pat[1] == '*' && (pat == start || pat[-1] == '/') && (pat[2] == '/' || !pat[2])) {
+				if (!pat[2]) {
+					// A trailing "/**" matches everything inside
+					return true;
+				}
+
+				// "**/" matches zero or more directories
+				pat += 3;
+				while (true) {
+					if (ignore_glob(start, pat, str)) {
+						return true;
+					}
+					str = strchr(str, '/');
+					if (!str) {
+						return false;
+					}
+					++str;
+				}
+			}
+
+			while (*pat == '*') {
+				++pat;
+			}
+
+			while (true) {
+				if (ignore_glob(start, pat, str)) {
+					return true;
+				}
+				if (!*str || *str == '/') {
+					return false;
+				}
+				++str;
+			}
+
+		case '?':
+			if (!*str || *str == '/') {
+				return false;
+			}
+			++pat;
+			++str;
+			break;
+
+		case '[': {
+			if (!*str || *str == '/') {
+				return false;
+			}
+
+			int len = ignore_bracket(pat, *str);
+			if (len == 0) {
+				return false;
+			} else if (len > 0) {
+				pat += len;
+				++str;
+				break;
+			}
+
+			// An unterminated [ is just a literal
+			if (*str != '[') {
+				return false;
+			}
+			++pat;
+			++str;
+			break;
+		}
+
+		case '\\':
+			if (pat[1]) {
+				++pat;
+			}
+			_fallthrough;
+
+		default:
+			if (*str != *pat) {
+				return false;
+			}
+			++pat;
+			++str;
+			break;
+		}
+	}
+}
+
+/** Check whether a rule matches a file. */
+static bool ignore_rule_match(const struct bfs_ignore_rule *rule, const char *rel, const char *name, bool dir) {
+	if (rule->dir_only && !dir) {
+		return false;
+	}
+
+	const char *str = rule->anchored ? rel : name;
+	if (rule->literal) {
+		return strcmp(rule->pattern, str) == 0;
+	} else {
+		return ignore_glob(rule->pattern, rule->pattern, str);
+	}
+}
+
+bool bfs_ignored(const struct bfs_ignore *ignore, const char *path, bool dir) {
+	const char *name = path + xbaseoff(path);
+
+	// Deeper files take precedence, and later rules override earlier ones
+	for (; ignore; ignore = ignore->parent) {
+		const char *rel = path + ignore->base;
+		for (size_t i = ignore->nrules; i-- > 0;) {
+			const struct bfs_ignore_rule *rule = &ignore->rules[i];
+			if (ignore_rule_match(rule, rel, name, dir)) {
+				return !rule->negate;
+			}
+		}
+	}
+
+	return false;
+}
+
+void bfs_ignore_free(struct bfs_ignore *ignore) {
+	if (!ignore) {
+		return;
+	}
+
+	for (size_t i = 0; i < ignore->nrules; ++i) {
+		free(ignore->rules[i].pattern);
+	}
+	free(ignore->rules);
+	free(ignore);
+}
@@ -0,0 +1,62 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * .gitignore-style ignore rules (-gitignore).
+ *
+ * The rules from the .gitignore and .ignore files in a directory are compiled
+ * into a rule set that points to the rule set of the closest ancestor with its
+ * own ignore files, so each directory only has to remember one pointer.
+ */
+
+#ifndef BFS_IGNORE_H
+#define BFS_IGNORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * The ignore rules for a directory and its ancestors.
+ */
+struct bfs_ignore;
+
+/**
+ * Load the ignore files in a directory.
+ *
+ * @param[out] ignore
+ *         Will hold the rules for the directory's children: a new rule set if
+ *         the directory has any ignore files, or parent otherwise.
+ * @param parent
+ *         The rules that apply to the directory itself, or NULL.
+ * @param dfd
+ *         The base file descriptor for path.
+ * @param path
+ *         The path to the directory, relative to dfd.
+ * @param base
+ *         The offset of the directory's children's names in their paths.
+ * @return
+ *         0 on success, -1 on failure.  A new rule set must be freed with
+ *         bfs_ignore_free().
+ */
+int bfs_ignore_load(struct bfs_ignore **ignore, struct bfs_ignore *parent, int dfd, const char *path, size_t base);
+
+/**
+ * Check whether a file is ignored.
+ *
+ * @param ignore
+ *         The rules for the file's parent directory.
+ * @param path
+ *         The path to the file.
+ * @param dir
+ *         Whether the file is a directory.
+ * @return
+ *         Whether the last rule that matches the file ignores it.
+ */
+bool bfs_ignored(const struct bfs_ignore *ignore, const char *path, bool dir);
+
+/**
+ * Free a rule set from bfs_ignore_load() (but not its parents).
+ */
+void bfs_ignore_free(struct bfs_ignore *ignore);
+
+#endif // BFS_IGNORE_H
@@ -0,0 +1,1094 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "index.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "bftw.h"
+#include "diag.h"
+#include "dir.h"
+#include "dstring.h"
+#include "stat.h"
+#include "trie.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * An index file starts with a header, followed by one entry per file in the
+ * order bftw() visited them.  Each entry is a sequence of LEB128 varints:
+ *
+ *     shared    The length of the prefix shared with the previous path
+ *     len       The length of the rest of the path
+ *     (bytes)   The rest of the path itself
+ *     nameoff   The string offset of the filename
+ *     depth     The depth of the file in the traversal
+ *     root      Which root the file is under, in order of appearance
+ *     parent    How many entries back the parent directory is (0 for none)
+ *     type      The file type (enum bfs_type)
+ *     mask      The bfs_stat() fields that follow, in bit order
+ *     (fields)  Each saved field (signed values are zigzag-encoded, and
+ *               timestamps are stored as seconds, then nanoseconds)
+ *
+ * The stat info is always from bfs_stat(BFS_STAT_NOFOLLOW).
+ */
+struct bfs_index_header {
+	/** Identifies the file as an index. */
+	char magic[8];
+	/** The format version. */
+	uint32_t version;
+	/** The bfs_stat() fields that were requested. */
+	uint32_t fields;
+	/** The number of entries. */
+	uint64_t count;
+};
+
+/** The magic number, which is only written once the index is complete. */
+static const char BFS_INDEX_MAGIC[8] = "bfsindex";
+
+/** The current format version. */
+#define BFS_INDEX_VERSION 1
+
+/** Trim trailing slashes from a directory path, to use it as a trie key. */
+static size_t index_key_len(const char *path, size_t len) {
+	while (len > 1 && path[len - 1] == '/') {
+		--len;
+	}
+	return len;
+}
+
+/**
+ * Copy a trimmed directory path to a NUL-terminated trie key.  Raw paths like
+ * "tree/net" and "tree/netfilter" aren't prefix-free, so they can't be used as
+ * trie_*_mem() keys directly.
+ */
+static const char *index_key(dchar **key, const char *path, size_t len) {
+	if (dstrxcpy(key, path, index_key_len(path, len)) != 0) {
+		return NULL;
+	}
+	return *key;
+}
+
+/** Zigzag-encode a signed value. */
+static uintmax_t zigzag_encode(intmax_t n) {
+	return ((uintmax_t)n << 1) ^ (uintmax_t)(n < 0 ? -1 : 0);
+}
+
+/** Zigzag-decode a signed value. */
+static intmax_t zigzag_decode(uintmax_t n) {
+	return (intmax_t)(n >> 1) ^ -(intmax_t)(n & 1);
+}
+
+struct bfs_index_writer {
+	/** The index file. */
+	FILE *file;
+	/** The fields to save. */
+	enum bfs_stat_field fields;
+	/** The number of entries written. */
+	uint64_t count;
+	/** The previous path, for front coding. */
+	dchar *prev;
+	/** Maps directory paths to their entry numbers. */
+	struct trie dirs;
+	/** Scratch space for dirs keys. */
+	dchar *key;
+	/** Maps root paths to their root numbers. */
+	struct trie roots;
+	/** The number of roots. */
+	size_t nroots;
+	/** The first error that occurred, if any. */
+	int error;
+};
+
+struct bfs_index_writer *bfs_index_create(const char *path, enum bfs_stat_field fields) {
+	struct bfs_index_writer *writer = ZALLOC(struct bfs_index_writer);
+	if (!writer) {
+		return NULL;
+	}
+
+	writer->fields = fields;
+	trie_init(&writer->dirs);
+	trie_init(&writer->roots);
+
+	writer->prev = dstralloc(0);
+	if (!writer->prev) {
+		goto fail;
+	}
+
+	writer->file = xfopen(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+	if (!writer->file) {
+		goto fail;
+	}
+
+	// Leave room for the header, which we write at the end
+	struct bfs_index_header header = {0};
+	if (fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+		goto fail;
+	}
+
+	return writer;
+
+fail:
+	bfs_index_close(writer);
+	return NULL;
+}
+
+/** Write a varint. */
+static int index_putv(FILE *file, uintmax_t n) {
+	while (n >= 0x80) {
+		if (putc((n & 0x7F) | 0x80, file) == EOF) {
+			return -1;
+		}
+		n >>= 7;
+	}
+
+	return putc(n, file) == EOF ? -1 : 0;
+}
+
+/** Write a timestamp. */
+static int index_puttime(FILE *file, const struct timespec *ts) {
+	if (index_putv(file, zigzag_encode(ts->tv_sec)) != 0) {
+		return -1;
+	}
+	return index_putv(file, ts->tv_nsec);
+}
+
+/** Write a single stat field. */
+static int index_putfield(FILE *file, const struct bfs_stat *buf, enum bfs_stat_field field) {
+	switch (field) {
+	case BFS_STAT_MODE:
+		return index_putv(file, buf->mode);
+	case BFS_STAT_DEV:
+		return index_putv(file, buf->dev);
+	case BFS_STAT_INO:
+		return index_putv(file, buf->ino);
+	case BFS_STAT_NLINK:
+		return index_putv(file, buf->nlink);
+	case BFS_STAT_GID:
+		return index_putv(file, buf->gid);
+	case BFS_STAT_UID:
+		return index_putv(file, buf->uid);
+	case BFS_STAT_SIZE:
+		return index_putv(file, zigzag_encode(buf->size));
+	case BFS_STAT_BLOCKS:
+		return index_putv(file, zigzag_encode(buf->blocks));
+	case BFS_STAT_RDEV:
+		return index_putv(file, buf->rdev);
+	case BFS_STAT_ATTRS:
+		return index_putv(file, buf->attrs);
+	case BFS_STAT_ATIME:
+		return index_puttime(file, &buf->atime);
+	case BFS_STAT_BTIME:
+		return index_puttime(file, &buf->btime);
+	case BFS_STAT_CTIME:
+		return index_puttime(file, &buf->ctime);
+	case BFS_STAT_MTIME:
+		return index_puttime(file, &buf->mtime);
+	}
+
+	bfs_bug("Unrecognized stat field %d", (int)field);
+	errno = EINVAL;
+	return -1;
+}
+
+/** Look up (or assign) the number of a root. */
+static int index_root(struct bfs_index_writer *writer, const char *root, uintmax_t *id) {
+	struct trie_leaf *leaf = trie_insert_str(&writer->roots, root);
+	if (!leaf) {
+		return -1;
+	}
+
+	if (!leaf->value) {
+		leaf->value = (void *)(uintptr_t)++writer->nroots;
+	}
+
+	*id = (uintptr_t)leaf->value - 1;
+	return 0;
+}
+
+/** Write an entry to the index. */
+static int index_write(struct bfs_index_writer *writer, const char *path, size_t nameoff, size_t depth, const char *root_path, enum bfs_type type, const struct bfs_stat *buf) {
+	if (writer->error) {
+		errno = writer->error;
+		return -1;
+	}
+
+	FILE *file = writer->file;
+	size_t len = strlen(path);
+	uint64_t id = ++writer->count;
+
+	uintmax_t root;
+	if (index_root(writer, root_path, &root) != 0) {
+		goto fail;
+	}
+
+	uintmax_t parent = 0;
+	if (depth > 0) {
+		const char *key = index_key(&writer->key, path, nameoff);
+		if (!key) {
+			goto fail;
+		}
+
+		struct trie_leaf *leaf = trie_find_str(&writer->dirs, key);
+		if (leaf) {
+			parent = id - (uintptr_t)leaf->value;
+		}
+	}
+
+	if (type == BFS_DIR) {
+		const char *key = index_key(&writer->key, path, len);
+		if (!key) {
+			goto fail;
+		}
+
+		struct trie_leaf *leaf = trie_insert_str(&writer->dirs, key);
+		if (!leaf) {
+			goto fail;
+		}
+		leaf->value = (void *)(uintptr_t)id;
+	}
+
+	enum bfs_stat_field mask = buf ? (buf->mask & writer->fields) : 0;
+
+	const dchar *prev = writer->prev;
+	size_t prev_len = dstrlen(prev);
+	size_t shared = 0;
+	while (shared < len && shared < prev_len && prev[shared] == path[shared]) {
+		++shared;
+	}
+
+	if (index_putv(file, shared) != 0
+	    || index_putv(file, len - shared) != 0
+	    || fwrite(path + shared, 1, len - shared, file) != len - shared
+	    || index_putv(file, nameoff) != 0
+	    || index_putv(file, depth) != 0
+	    || index_putv(file, root) != 0
+	    || index_putv(file, parent) != 0
+	    || index_putv(file, type) != 0
+	    || index_putv(file, mask) != 0) {
+		goto fail;
+	}
+
+	for (enum bfs_stat_field field = 1; field & BFS_STAT_ALL; field <<= 1) {
+		if ((mask & field) && index_putfield(file, buf, field) != 0) {
+			goto fail;
+		}
+	}
+
+	if (dstrxcpy(&writer->prev, path, len) != 0) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	writer->error = errno;
+	return -1;
+}
+
+int bfs_index_add(struct bfs_index_writer *writer, const struct BFTW *ftwbuf) {
+	const struct bfs_stat *buf = NULL;
+	if (writer->fields && !writer->error) {
+		buf = bftw_stat(ftwbuf, BFS_STAT_NOFOLLOW);
+	}
+
+	return index_write(writer, ftwbuf->path, ftwbuf->nameoff, ftwbuf->depth, ftwbuf->root, ftwbuf->type, buf);
+}
+
+int bfs_index_close(struct bfs_index_writer *writer) {
+	if (!writer) {
+		return 0;
+	}
+
+	int ret = 0, error = writer->error;
+	if (error) {
+		ret = -1;
+	}
+
+	FILE *file = writer->file;
+	if (file) {
+		if (ret == 0) {
+			struct bfs_index_header header = {
+				.version = BFS_INDEX_VERSION,
+				.fields = writer->fields,
+				.count = writer->count,
+			};
+			memcpy(header.magic, BFS_INDEX_MAGIC, sizeof(header.magic));
+
+			if (fflush(file) != 0
+			    || fseek(file, 0, SEEK_SET) != 0
+			    || fwrite(&header, sizeof(header), 1, file) != 1) {
+				error = errno;
+				ret = -1;
+			}
+		}
+
+		if (fclose(file) != 0 && ret == 0) {
+			error = errno;
+			ret = -1;
+		}
+	}
+
+	trie_destroy(&writer->roots);
+	trie_destroy(&writer->dirs);
+	dstrfree(writer->key);
+	dstrfree(writer->prev);
+	free(writer);
+
+	errno = error;
+	return ret;
+}
+
+struct bfs_index {
+	/** The mapped file. */
+	void *map;
+	/** The size of the mapping. */
+	size_t size;
+	/** The saved fields. */
+	enum bfs_stat_field fields;
+	/** The number of entries. */
+	uint64_t count;
+};
+
+struct bfs_index *bfs_index_open(const char *path) {
+	struct bfs_index *index = ZALLOC(struct bfs_index);
+	if (!index) {
+		return NULL;
+	}
+	index->map = MAP_FAILED;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		goto fail;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		goto fail_fd;
+	}
+
+	if (sb.st_size < (off_t)sizeof(struct bfs_index_header) || (uintmax_t)sb.st_size > SIZE_MAX) {
+		errno = EINVAL;
+		goto fail_fd;
+	}
+
+	index->size = sb.st_size;
+	index->map = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (index->map == MAP_FAILED) {
+		goto fail_fd;
+	}
+	xclose(fd);
+
+	struct bfs_index_header header;
+	memcpy(&header, index->map, sizeof(header));
+	if (memcmp(header.magic, BFS_INDEX_MAGIC, sizeof(header.magic)) != 0
+	    || header.version != BFS_INDEX_VERSION
+	    || (header.fields & ~BFS_STAT_ALL)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	index->fields = header.fields;
+	index->count = header.count;
+	return index;
+
+fail_fd:;
+	int error = errno;
+	xclose(fd);
+	errno = error;
+fail:
+	bfs_index_free(index);
+	return NULL;
+}
+
+enum bfs_stat_field bfs_index_fields(const struct bfs_index *index) {
+	return index->fields;
+}
+
+/** A position in a mapped index. */
+struct index_cursor {
+	/** The current position. */
+	const unsigned char *pos;
+	/** The end of the index. */
+	const unsigned char *end;
+};
+
+/** Read a varint. */
+static int index_getv(struct index_cursor *cur, uintmax_t *n) {
+	uintmax_t ret = 0;
+
+	for (unsigned int shift = 0; cur->pos < cur->end && shift < sizeof(ret) * 8; shift += 7) {
+		unsigned char byte = *cur->pos++;
+		ret |= (uintmax_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			*n = ret;
+			return 0;
+		}
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+/** Read a timestamp. */
+static int index_gettime(struct index_cursor *cur, struct timespec *ts) {
+	uintmax_t sec, nsec;
+	if (index_getv(cur, &sec) != 0 || index_getv(cur, &nsec) != 0) {
+		return -1;
+	}
+
+	ts->tv_sec = zigzag_decode(sec);
+	ts->tv_nsec = nsec;
+	return 0;
+}
+
+/** Read a single stat field. */
+static int index_getfield(struct index_cursor *cur, struct bfs_stat *buf, enum bfs_stat_field field) {
+	uintmax_t n;
+
+	switch (field) {
+	case BFS_STAT_ATIME:
+		return index_gettime(cur, &buf->atime);
+	case BFS_STAT_BTIME:
+		return index_gettime(cur, &buf->btime);
+	case BFS_STAT_CTIME:
+		return index_gettime(cur, &buf->ctime);
+	case BFS_STAT_MTIME:
+		return index_gettime(cur, &buf->mtime);
+	default:
+		break;
+	}
+
+	if (index_getv(cur, &n) != 0) {
+		return -1;
+	}
+
+	switch (field) {
+	case BFS_STAT_MODE:
+		buf->mode = n;
+		break;
+	case BFS_STAT_DEV:
+		buf->dev = n;
+		break;
+	case BFS_STAT_INO:
+		buf->ino = n;
+		break;
+	case BFS_STAT_NLINK:
+		buf->nlink = n;
+		break;
+	case BFS_STAT_GID:
+		buf->gid = n;
+		break;
+	case BFS_STAT_UID:
+		buf->uid = n;
+		break;
+	case BFS_STAT_SIZE:
+		buf->size = zigzag_decode(n);
+		break;
+	case BFS_STAT_BLOCKS:
+		buf->blocks = zigzag_decode(n);
+		break;
+	case BFS_STAT_RDEV:
+		buf->rdev = n;
+		break;
+	case BFS_STAT_ATTRS:
+		buf->attrs = n;
+		break;
+	default:
+		bfs_bug("Unrecognized stat field %d", (int)field);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** A decoded index entry. */
+struct index_entry {
+	/** The path to the file. */
+	dchar *path;
+	/** The string offset of the filename. */
+	size_t nameoff;
+	/** The depth of the file. */
+	size_t depth;
+	/** The root number. */
+	uintmax_t root;
+	/** The distance back to the parent entry. */
+	uintmax_t parent;
+	/** The file type. */
+	enum bfs_type type;
+	/** The saved stat info. */
+	struct bfs_stat stat;
+};
+
+/** Decode the next entry. */
+static int index_next(struct index_cursor *cur, struct index_entry *entry) {
+	uintmax_t shared, len, nameoff, depth, type, mask;
+	if (index_getv(cur, &shared) != 0 || index_getv(cur, &len) != 0) {
+		return -1;
+	}
+
+	if (shared > dstrlen(entry->path) || len > (size_t)(cur->end - cur->pos)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (dstresize(&entry->path, shared + len) != 0) {
+		return -1;
+	}
+	memcpy(entry->path + shared, cur->pos, len);
+	cur->pos += len;
+
+	if (index_getv(cur, &nameoff) != 0
+	    || index_getv(cur, &depth) != 0
+	    || index_getv(cur, &entry->root) != 0
+	    || index_getv(cur, &entry->parent) != 0
+	    || index_getv(cur, &type) != 0
+	    || index_getv(cur, &mask) != 0) {
+		return -1;
+	}
+
+	if (nameoff > shared + len || type > BFS_WHT || (mask & ~BFS_STAT_ALL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	entry->nameoff = nameoff;
+	entry->depth = depth;
+	entry->type = type;
+	entry->stat.mask = mask;
+
+	for (enum bfs_stat_field field = 1; field & BFS_STAT_ALL; field <<= 1) {
+		if ((mask & field) && index_getfield(cur, &entry->stat, field) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Compute the bfs_stat() flags for a file, like bftw() would. */
+static enum bfs_stat_flags index_stat_flags(enum bftw_flags flags, size_t depth) {
+	enum bftw_flags mask = BFTW_FOLLOW_ALL;
+	if (depth == 0) {
+		mask |= BFTW_FOLLOW_ROOTS;
+	}
+
+	if (flags & mask) {
+		return BFS_STAT_TRYFOLLOW;
+	} else {
+		return BFS_STAT_NOFOLLOW;
+	}
+}
+
+/** Check whether a saved root was requested. */
+static bool index_want_root(const struct bftw_args *args, const char *root) {
+	if (args->npaths == 0) {
+		return true;
+	}
+
+	for (size_t i = 0; i < args->npaths; ++i) {
+		if (strcmp(args->paths[i], root) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Remember the path of a new root. */
+static int index_push_root(dchar ***roots, size_t *nroots, const dchar *path) {
+	dchar **new_roots = REALLOC_ARRAY(dchar *, *roots, *nroots, *nroots + 1);
+	if (!new_roots) {
+		return -1;
+	}
+	*roots = new_roots;
+
+	new_roots[*nroots] = dstrddup(path);
+	if (!new_roots[*nroots]) {
+		return -1;
+	}
+
+	++*nroots;
+	return 0;
+}
+
+/** Mark an entry as skipped. */
+static void index_skip(unsigned char *skip, uint64_t i) {
+	skip[i / CHAR_BIT] |= 1 << (i % CHAR_BIT);
+}
+
+/** Check if an entry was skipped. */
+static bool index_skipped(const unsigned char *skip, uint64_t i) {
+	return skip[i / CHAR_BIT] & (1 << (i % CHAR_BIT));
+}
+
+int bfs_index_walk(const struct bfs_index *index, const struct bftw_args *args) {
+	int ret = -1;
+
+	struct index_cursor cur = {
+		.pos = (const unsigned char *)index->map + sizeof(struct bfs_index_header),
+		.end = (const unsigned char *)index->map + index->size,
+	};
+
+	struct index_entry entry = {0};
+	dchar **roots = NULL;
+	bool *want_roots = NULL;
+	size_t nroots = 0;
+	dchar *link_buf = NULL;
+
+	unsigned char *skip = ZALLOC_ARRAY(unsigned char, index->count / CHAR_BIT + 1);
+	if (!skip) {
+		goto done;
+	}
+
+	entry.path = dstralloc(0);
+	if (!entry.path) {
+		goto done;
+	}
+
+	// Use the saved stat info if it has everything the callback needs
+	enum bfs_stat_field needed = args->stat_mask ? args->stat_mask : index->fields;
+	bool use_stat = !(needed & ~index->fields);
+
+	for (uint64_t i = 0; i < index->count; ++i) {
+		if (index_next(&cur, &entry) != 0) {
+			goto done;
+		}
+
+		if (entry.depth == 0 && entry.root == nroots) {
+			bool *new_want = REALLOC_ARRAY(bool, want_roots, nroots, nroots + 1);
+			if (!new_want) {
+				goto done;
+			}
+			want_roots = new_want;
+			want_roots[nroots] = index_want_root(args, entry.path);
+
+			if (index_push_root(&roots, &nroots, entry.path) != 0) {
+				goto done;
+			}
+		}
+
+		if (entry.root >= nroots || entry.parent > i) {
+			errno = EINVAL;
+			goto done;
+		}
+
+		if (!want_roots[entry.root] || (entry.parent && index_skipped(skip, i - entry.parent))) {
+			index_skip(skip, i);
+			continue;
+		}
+
+		const char *name = entry.path + entry.nameoff;
+		if (entry.depth > 0 && args->filter) {
+			struct bfs_dirent de = {
+				.type = entry.type,
+				.name = name,
+				.namelen = dstrlen(entry.path) - entry.nameoff,
+				.ino = (entry.stat.mask & BFS_STAT_INO) ? entry.stat.ino : 0,
+			};
+			if (args->filter(&de, entry.depth, args->ptr)) {
+				index_skip(skip, i);
+				continue;
+			}
+		}
+
+		// Scratch space in case the callback needs to stat() the real file
+		struct bfs_stat scratch[2];
+
+		struct BFTW ftwbuf = {
+			.path = entry.path,
+			.nameoff = entry.nameoff,
+			.root = roots[entry.root],
+			.depth = entry.depth,
+			.visit = BFTW_PRE,
+			.type = entry.type,
+			.at_fd = AT_FDCWD,
+			.at_path = entry.path,
+			.stat_flags = index_stat_flags(args->flags, entry.depth),
+			.stat_mask = args->stat_mask,
+			.stat_bufs = {
+				.stat_buf = &scratch[0],
+				.lstat_buf = &scratch[1],
+				.stat_err = -1,
+				.lstat_err = -1,
+				.link_buf = &link_buf,
+				.link_err = -1,
+			},
+			.empty = -1,
+		};
+
+		if (use_stat && entry.stat.mask) {
+			struct bftw_stat *bufs = &ftwbuf.stat_bufs;
+			bufs->lstat_buf = &entry.stat;
+			bufs->lstat_err = 0;
+			if ((entry.stat.mask & BFS_STAT_MODE) && !S_ISLNK(entry.stat.mode)) {
+				// Non-link, so share stat info
+				bufs->stat_buf = &entry.stat;
+				bufs->stat_err = 0;
+			}
+		}
+
+		enum bftw_action action = args->callback(&ftwbuf, args->ptr);
+		if (action == BFTW_STOP) {
+			break;
+		} else if (action == BFTW_PRUNE) {
+			index_skip(skip, i);
+		}
+	}
+
+	ret = 0;
+done:;
+	int error = errno;
+	for (size_t i = 0; i < nroots; ++i) {
+		dstrfree(roots[i]);
+	}
+	free(want_roots);
+	free(roots);
+	dstrfree(entry.path);
+	dstrfree(link_buf);
+	free(skip);
+	errno = error;
+	return ret;
+}
+
+/** A directory that was re-read during a refresh. */
+struct index_listing {
+	/** The depth of the directory. */
+	size_t depth;
+	/** The root it's under. */
+	uintmax_t root;
+	/** The names it contains (non-NULL values have a saved entry). */
+	struct trie names;
+};
+
+/** bfs_index_refresh() state. */
+struct index_refresh {
+	/** The new index. */
+	struct bfs_index_writer *writer;
+	/** The saved root paths. */
+	dchar **roots;
+	/** The number of roots. */
+	size_t nroots;
+	/** Maps re-read directory paths to their listings. */
+	struct trie listings;
+	/** Scratch space for listings keys. */
+	dchar *key;
+	/** Maps new paths to the listings they were found in. */
+	struct trie found;
+};
+
+/** Check whether a directory's entries may have changed since it was saved. */
+static bool index_dir_changed(const struct bfs_stat *saved, const struct bfs_stat *live) {
+	enum bfs_stat_field times = BFS_STAT_MTIME | BFS_STAT_CTIME;
+	if ((saved->mask & times) != times || (live->mask & times) != times) {
+		return true;
+	}
+
+	return saved->mtime.tv_sec != live->mtime.tv_sec
+		|| saved->mtime.tv_nsec != live->mtime.tv_nsec
+		|| saved->ctime.tv_sec != live->ctime.tv_sec
+		|| saved->ctime.tv_nsec != live->ctime.tv_nsec;
+}
+
+/** Re-read the names in a changed directory. */
+static int index_relist(struct index_refresh *state, const struct index_entry *entry) {
+	const char *path = entry->path;
+	const char *key = index_key(&state->key, path, dstrlen(path));
+	if (!key) {
+		return -1;
+	}
+
+	struct trie_leaf *leaf = trie_insert_str(&state->listings, key);
+	if (!leaf) {
+		return -1;
+	}
+
+	struct index_listing *listing = ZALLOC(struct index_listing);
+	if (!listing) {
+		return -1;
+	}
+	listing->depth = entry->depth;
+	listing->root = entry->root;
+	trie_init(&listing->names);
+	leaf->value = listing;
+
+	struct bfs_dir *dir = bfs_allocdir();
+	if (!dir) {
+		return -1;
+	}
+
+	int ret = 0;
+	if (bfs_opendir(dir, AT_FDCWD, path, 0) != 0) {
+		// Forget the contents of directories we can no longer read
+		goto done;
+	}
+
+	struct bfs_dirent de;
+	while ((ret = bfs_readdir(dir, &de)) > 0) {
+		if (!trie_insert_str(&listing->names, de.name)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	int error = errno;
+	bfs_closedir(dir);
+	errno = error;
+done:
+	free(dir);
+	return ret < 0 ? -1 : 0;
+}
+
+/** bftw() callback for the new files found by a refresh. */
+static enum bftw_action index_refresh_callback(const struct BFTW *ftwbuf, void *ptr) {
+	struct index_refresh *state = ptr;
+
+	if (ftwbuf->type == BFS_ERROR) {
+		return BFTW_PRUNE;
+	} else if (ftwbuf->visit != BFTW_PRE) {
+		return BFTW_CONTINUE;
+	}
+
+	struct bfs_index_writer *writer = state->writer;
+	const struct trie_leaf *leaf = trie_find_str(&state->found, ftwbuf->root);
+	const struct index_listing *listing = leaf->value;
+
+	const struct bfs_stat *buf = NULL;
+	if (writer->fields) {
+		buf = bftw_stat(ftwbuf, BFS_STAT_NOFOLLOW);
+	}
+
+	size_t depth = listing->depth + 1 + ftwbuf->depth;
+	const char *root = state->roots[listing->root];
+	if (index_write(writer, ftwbuf->path, ftwbuf->nameoff, depth, root, ftwbuf->type, buf) != 0) {
+		return BFTW_STOP;
+	}
+
+	return BFTW_CONTINUE;
+}
+
+/** Search the new files in the re-read directories. */
+static int index_refresh_new(struct index_refresh *state, const struct bftw_args *args) {
+	int ret = -1;
+	dchar **paths = NULL;
+	size_t npaths = 0;
+
+	for_trie (leaf, &state->listings) {
+		struct index_listing *listing = leaf->value;
+
+		for (struct trie_leaf *name = listing->names.head; name; name = name->next) {
+			if (name->value) {
+				continue;
+			}
+
+			dchar *path = dstrdup(leaf->key);
+			if (!path) {
+				goto done;
+			}
+
+			size_t len = dstrlen(path);
+			if ((len > 0 && path[len - 1] != '/' && dstrapp(&path, '/') != 0)
+			    || dstrcat(&path, name->key) != 0) {
+				dstrfree(path);
+				goto done;
+			}
+
+			dchar **new_paths = REALLOC_ARRAY(dchar *, paths, npaths, npaths + 1);
+			if (!new_paths) {
+				dstrfree(path);
+				goto done;
+			}
+			paths = new_paths;
+			paths[npaths++] = path;
+
+			struct trie_leaf *found = trie_insert_str(&state->found, path);
+			if (!found) {
+				goto done;
+			}
+			found->value = listing;
+		}
+	}
+
+	if (npaths == 0) {
+		ret = 0;
+		goto done;
+	}
+
+	struct bftw_args new_args = *args;
+	new_args.paths = (const char **)paths;
+	new_args.npaths = npaths;
+	new_args.callback = index_refresh_callback;
+	new_args.ptr = state;
+	new_args.filter = NULL;
+	new_args.stat_hint = NULL;
+	// Match the saved bfs_stat(BFS_STAT_NOFOLLOW) info
+	new_args.flags &= ~(BFTW_FOLLOW_ROOTS | BFTW_FOLLOW_ALL | BFTW_POST_ORDER);
+	new_args.stat_mask = state->writer->fields | BFS_STAT_MODE;
+	new_args.spills = NULL;
+
+	if (bftw(&new_args) != 0) {
+		goto done;
+	}
+
+	if (state->writer->error) {
+		errno = state->writer->error;
+		goto done;
+	}
+
+	ret = 0;
+done:;
+	int error = errno;
+	for (size_t i = 0; i < npaths; ++i) {
+		dstrfree(paths[i]);
+	}
+	free(paths);
+	errno = error;
+	return ret;
+}
+
+int bfs_index_refresh(const struct bfs_index *index, struct bfs_index_writer *writer, const struct bftw_args *args) {
+	int ret = -1;
+
+	struct index_cursor cur = {
+		.pos = (const unsigned char *)index->map + sizeof(struct bfs_index_header),
+		.end = (const unsigned char *)index->map + index->size,
+	};
+
+	struct index_entry entry = {0};
+
+	struct index_refresh state = {
+		.writer = writer,
+	};
+	trie_init(&state.listings);
+	trie_init(&state.found);
+
+	// Entries that no longer exist
+	unsigned char *stale = ZALLOC_ARRAY(unsigned char, index->count / CHAR_BIT + 1);
+	if (!stale) {
+		goto done;
+	}
+
+	entry.path = dstralloc(0);
+	if (!entry.path) {
+		goto done;
+	}
+
+	// Directories need their times checked, on top of the saved fields
+	enum bfs_stat_field fields = writer->fields | BFS_STAT_MTIME | BFS_STAT_CTIME;
+
+	for (uint64_t i = 0; i < index->count; ++i) {
+		if (index_next(&cur, &entry) != 0) {
+			goto done;
+		}
+
+		if (entry.depth == 0 && entry.root == state.nroots) {
+			if (index_push_root(&state.roots, &state.nroots, entry.path) != 0) {
+				goto done;
+			}
+		}
+
+		if (entry.root >= state.nroots || entry.parent > i) {
+			errno = EINVAL;
+			goto done;
+		}
+
+		if (entry.parent && index_skipped(stale, i - entry.parent)) {
+			index_skip(stale, i);
+			continue;
+		}
+
+		// If the parent was re-read, make sure this file is still there
+		struct trie_leaf *name = NULL;
+		if (entry.depth > 0) {
+			const char *key = index_key(&state.key, entry.path, entry.nameoff);
+			if (!key) {
+				goto done;
+			}
+
+			struct trie_leaf *leaf = trie_find_str(&state.listings, key);
+			if (leaf) {
+				struct index_listing *listing = leaf->value;
+				name = trie_find_str(&listing->names, entry.path + entry.nameoff);
+				if (!name) {
+					index_skip(stale, i);
+					continue;
+				}
+			}
+		}
+
+		// Files in unchanged directories keep their saved metadata, but
+		// directories (and anything in a changed one) are checked again
+		const struct bfs_stat *buf = &entry.stat;
+		struct bfs_stat live;
+		if (entry.type == BFS_DIR || name) {
+			if (bfs_stat_mask(AT_FDCWD, entry.path, BFS_STAT_NOFOLLOW, fields, &live) != 0) {
+				index_skip(stale, i);
+				continue;
+			}
+
+			if (bfs_mode_to_type(live.mode) != entry.type) {
+				// Replaced with a different kind of file, so search it again
+				index_skip(stale, i);
+				continue;
+			}
+
+			if (name) {
+				name->value = name;
+			}
+
+			if (entry.type == BFS_DIR && index_dir_changed(&entry.stat, &live)) {
+				if (index_relist(&state, &entry) != 0) {
+					goto done;
+				}
+			}
+
+			buf = &live;
+		}
+
+		if (index_write(writer, entry.path, entry.nameoff, entry.depth, state.roots[entry.root], entry.type, buf) != 0) {
+			goto done;
+		}
+	}
+
+	ret = index_refresh_new(&state, args);
+done:;
+	int error = errno;
+	trie_destroy(&state.found);
+	for_trie (leaf, &state.listings) {
+		struct index_listing *listing = leaf->value;
+		if (listing) {
+			trie_destroy(&listing->names);
+			free(listing);
+		}
+	}
+	trie_destroy(&state.listings);
+	dstrfree(state.key);
+	for (size_t i = 0; i < state.nroots; ++i) {
+		dstrfree(state.roots[i]);
+	}
+	free(state.roots);
+	dstrfree(entry.path);
+	free(stale);
+	errno = error;
+	return ret;
+}
+
+void bfs_index_free(struct bfs_index *index) {
+	if (index) {
+		if (index->map != MAP_FAILED) {
+			munmap(index->map, index->size);
+		}
+		free(index);
+	}
+}
@@ -0,0 +1,121 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Persistent metadata indexes (-save-index, -index).
+ */
+
+#ifndef BFS_INDEX_H
+#define BFS_INDEX_H
+
+#include "stat.h"
+
+#include <stddef.h>
+
+struct BFTW;
+struct bftw_args;
+
+/**
+ * An index being written.
+ */
+struct bfs_index_writer;
+
+/**
+ * Start writing a new index.
+ *
+ * @param path
+ *         The path to the index file.
+ * @param fields
+ *         The bfs_stat() fields to save for each file.
+ * @return
+ *         The new index writer, or NULL on failure.
+ */
+struct bfs_index_writer *bfs_index_create(const char *path, enum bfs_stat_field fields);
+
+/**
+ * Add a file to an index.  Files must be added in the order bftw() visits them,
+ * so that parents come before their children.
+ *
+ * @param writer
+ *         The index writer.
+ * @param ftwbuf
+ *         The bftw() data for the file.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_index_add(struct bfs_index_writer *writer, const struct BFTW *ftwbuf);
+
+/**
+ * Finish writing an index.
+ *
+ * @param writer
+ *         The index writer to finish and free.
+ * @return
+ *         0 on success, -1 if the index could not be written.
+ */
+int bfs_index_close(struct bfs_index_writer *writer);
+
+/**
+ * A saved index, mapped into memory.
+ */
+struct bfs_index;
+
+/**
+ * Open a saved index.
+ *
+ * @param path
+ *         The path to the index file.
+ * @return
+ *         The opened index, or NULL on failure.
+ */
+struct bfs_index *bfs_index_open(const char *path);
+
+/**
+ * Get the bfs_stat() fields that were saved in an index.
+ */
+enum bfs_stat_field bfs_index_fields(const struct bfs_index *index);
+
+/**
+ * Walk the files in an index, like bftw() would walk the filesystem.
+ *
+ * Files are visited in the order they were saved, with synthesized BFTW
+ * buffers whose stat info comes from the index when it has all the fields in
+ * args->stat_mask.  Returning BFTW_PRUNE from the callback skips a directory's
+ * descendants, and BFTW_STOP ends the walk.  Post-order visits are not
+ * supported.
+ *
+ * @param index
+ *         The index to walk.
+ * @param args
+ *         The bftw() arguments.  If args->npaths is non-zero, only files under
+ *         the matching saved roots are visited.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int bfs_index_walk(const struct bfs_index *index, const struct bftw_args *args);
+
+/**
+ * Bring an index up to date with the file system.
+ *
+ * Every saved directory is checked with bfs_stat().  The entries in directories
+ * whose mtime and ctime haven't changed are copied as-is, while changed
+ * directories are re-read, and any new files in them are searched with bftw().
+ *
+ * @param index
+ *         The saved index.
+ * @param writer
+ *         The writer for the new index.
+ * @param args
+ *         The bftw() arguments to use for new files (the paths, callback and
+ *         filter are ignored).
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int bfs_index_refresh(const struct bfs_index *index, struct bfs_index_writer *writer, const struct bftw_args *args);
+
+/**
+ * Close an index.
+ */
+void bfs_index_free(struct bfs_index *index);
+
+#endif // BFS_INDEX_H
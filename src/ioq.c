@@ -13,8 +13,10 @@
  * to the `ready` queue.  The main thread pushes requests to `pending` and pops
  * them from `ready`.
  *
- * struct ioqq is a blocking MPMC queue (though it could be SPMC/MPSC for
- * pending/ready respectively).  It is implemented as a circular buffer:
+ * struct ioqq is a blocking MPMC queue.  `ready` is only used as an MPSC queue,
+ * so it has a specialized fast path for the main thread's side (see
+ * ioqq_pop_sc() below).  `pending` needs the general version, since workers
+ * hand unstarted requests back to it.  It is implemented as a circular buffer:
  *
  *     size_t mask;            // (1 << N) - 1
  *     [padding]
@@ -41,8 +43,8 @@
  *     head:     1 → 2
  *     slots[1]: empty!
  *
- * To avoid this, non-blocking reads (ioqq_pop(ioqq, false)) must mark the slots
- * somehow so that writers can skip them:
+ * To avoid this, non-blocking reads (ioqq_pop_batch(..., false)) must mark the
+ * slots somehow so that writers can skip them:
  *
  *     Reader                     Writer
  *     ───────────────────────    ───────────────────────
@@ -87,6 +89,10 @@
  * ahead of writers.  This is okay for us because we don't retry failed non-
  * blocking reads.
  *
+ * With only one reader, none of this is necessary: the reader can look at the
+ * slot before it moves the tail, and leave it alone if it's empty.  So
+ * ioqq_pop_sc() never skips any slots, and the writers never see skip(N).
+ *
  * The slot representation uses tag bits to hold either a pointer or skip(N):
  *
  *     IOQ_SKIP (highest bit)    IOQ_BLOCKED (lowest bit)
@@ -112,8 +118,13 @@
  * goes to sleep.  Whenever a slot is updated, if the old value had IOQ_BLOCKED
  * set, ioq_slot_wake() must be called to wake up that waiter.
  *
- * Blocking/waking uses a pool of monitors (mutex, condition variable pairs).
- * Slots are assigned round-robin to a monitor from the pool.
+ * Where possible, waiters sleep directly on the slot with a futex (or the
+ * equivalent _umtx_op() on FreeBSD, or __ulock_wait() on macOS).  These wait on
+ * a 32-bit word, so we use the half of the slot that holds IOQ_BLOCKED.  Every
+ * update clears IOQ_BLOCKED, so that half always changes when the slot does.
+ *
+ * Otherwise, blocking/waking uses a pool of monitors (mutex, condition variable
+ * pairs).  Slots are assigned round-robin to a monitor from the pool.
  *
  * [1]: https://arxiv.org/abs/2201.02179
  */
@@ -127,22 +138,59 @@
 #include "bit.h"
 #include "diag.h"
 #include "dir.h"
+#include "fsade.h"
+#include "perf.h"
 #include "stat.h"
 #include "thread.h"
+#include "throttle.h"
+#include "trace.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#if BFS_HAS_PTHREAD_SETAFFINITY_NP
+#  include <sched.h>
+#endif
 
 #if BFS_WITH_LIBURING
 #  include <liburing.h>
 #endif
 
+#if BFS_WITH_LIBURING && BFS_HAS_OPENAT2_SYSCALL
+#  include <linux/openat2.h>
+#endif
+
+#if BFS_HAS_FUTEX_SYSCALL
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#elif BFS_HAS_UMTX_OP
+#  include <sys/types.h>
+#  include <sys/umtx.h>
+#elif BFS_HAS_ULOCK_WAIT
+// Private Darwin APIs, from <sys/ulock.h> in xnu
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+#  define UL_COMPARE_AND_WAIT 1
+#  define ULF_WAKE_ALL 0x00000100
+#  define ULF_NO_ERRNO 0x01000000
+#endif
+
 /**
- * A monitor for an I/O queue slot.
+ * Whether to wait on the queue slots directly, rather than with monitors.
+ */
+#ifndef BFS_USE_FUTEX
+#  define BFS_USE_FUTEX (BFS_HAS_FUTEX_SYSCALL || BFS_HAS_UMTX_OP || BFS_HAS_ULOCK_WAIT)
+#endif
+
+/**
+ * A monitor for an I/O queue slot, or for parked threads.
  */
 struct ioq_monitor {
 	cache_align pthread_mutex_t mutex;
@@ -191,10 +239,12 @@ struct ioqq {
 	/** Circular buffer index mask. */
 	size_t slot_mask;
 
+#if !BFS_USE_FUTEX
 	/** Monitor index mask. */
 	size_t monitor_mask;
 	/** Array of monitors used by the slots. */
 	struct ioq_monitor *monitors;
+#endif
 
 	/** Index of next writer. */
 	cache_align atomic size_t head;
@@ -211,10 +261,13 @@ static void ioqq_destroy(struct ioqq *ioqq) {
 		return;
 	}
 
+#if !BFS_USE_FUTEX
 	for (size_t i = 0; i < ioqq->monitor_mask + 1; ++i) {
 		ioq_monitor_destroy(&ioqq->monitors[i]);
 	}
 	free(ioqq->monitors);
+#endif
+
 	free(ioqq);
 }
 
@@ -229,6 +282,8 @@ static struct ioqq *ioqq_create(size_t size) {
 	}
 
 	ioqq->slot_mask = size - 1;
+
+#if !BFS_USE_FUTEX
 	ioqq->monitor_mask = -1;
 
 	// Use a pool of monitors
@@ -246,6 +301,7 @@ static struct ioqq *ioqq_create(size_t size) {
 		}
 		++ioqq->monitor_mask;
 	}
+#endif
 
 	atomic_init(&ioqq->head, 0);
 	atomic_init(&ioqq->tail, 0);
@@ -257,6 +313,64 @@ static struct ioqq *ioqq_create(size_t size) {
 	return ioqq;
 }
 
+#if BFS_USE_FUTEX
+
+/** Get the 32-bit word of a slot that holds IOQ_BLOCKED. */
+static uint32_t *ioq_slot_word(ioq_slot *slot) {
+	char *addr = (char *)slot;
+#if ENDIAN_NATIVE == ENDIAN_BIG
+	addr += sizeof(*slot) - sizeof(uint32_t);
+#endif
+	return (uint32_t *)addr;
+}
+
+/** Atomically wait for a slot to change. */
+_noinline
+static uintptr_t ioq_slot_wait(struct ioqq *ioqq, ioq_slot *slot, uintptr_t value) {
+	uintptr_t ret = load(slot, relaxed);
+	if (ret != value) {
+		return ret;
+	}
+
+	if (!(value & IOQ_BLOCKED)) {
+		value |= IOQ_BLOCKED;
+		if (!compare_exchange_strong(slot, &ret, value, relaxed, relaxed)) {
+			return ret;
+		}
+	}
+
+	uint32_t *word = ioq_slot_word(slot);
+	do {
+		// The kernel re-checks the word before sleeping, so a wakeup
+		// can't be missed.  Spurious wakeups and EINTR just loop.
+#if BFS_HAS_FUTEX_SYSCALL
+		syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, (uint32_t)value, NULL, NULL, 0);
+#elif BFS_HAS_UMTX_OP
+		_umtx_op(word, UMTX_OP_WAIT_UINT_PRIVATE, (uint32_t)value, NULL, NULL);
+#elif BFS_HAS_ULOCK_WAIT
+		__ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, word, (uint32_t)value, 0);
+#endif
+		ret = load(slot, relaxed);
+	} while (ret == value);
+
+	return ret;
+}
+
+/** Wake up any threads waiting on a slot. */
+_noinline
+static void ioq_slot_wake(struct ioqq *ioqq, ioq_slot *slot) {
+	uint32_t *word = ioq_slot_word(slot);
+#if BFS_HAS_FUTEX_SYSCALL
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#elif BFS_HAS_UMTX_OP
+	_umtx_op(word, UMTX_OP_WAKE_PRIVATE, INT_MAX, NULL, NULL);
+#elif BFS_HAS_ULOCK_WAIT
+	__ulock_wake(UL_COMPARE_AND_WAIT | ULF_WAKE_ALL | ULF_NO_ERRNO, word, 0);
+#endif
+}
+
+#else // !BFS_USE_FUTEX
+
 /** Get the monitor associated with a slot. */
 static struct ioq_monitor *ioq_slot_monitor(struct ioqq *ioqq, ioq_slot *slot) {
 	size_t i = slot - ioqq->slots;
@@ -314,6 +428,8 @@ static void ioq_slot_wake(struct ioqq *ioqq, ioq_slot *slot) {
 	cond_broadcast(&monitor->cond);
 }
 
+#endif // !BFS_USE_FUTEX
+
 /** Branch-free ((slot & IOQ_SKIP) ? skip : full) & ~IOQ_BLOCKED */
 static uintptr_t ioq_slot_blend(uintptr_t slot, uintptr_t skip, uintptr_t full) {
 	uintptr_t mask = -(slot >> IOQ_SKIP_BIT);
@@ -409,11 +525,36 @@ static void ioqq_push_batch(struct ioqq *ioqq, struct ioq_ent *batch[], size_t s
 	} while (size > 0);
 }
 
-/** Pop an entry from the queue. */
-static struct ioq_ent *ioqq_pop(struct ioqq *ioqq, bool block) {
-	size_t i = fetch_add(&ioqq->tail, 1, relaxed);
+/** Pop an entry from a slot that only one reader uses. */
+static struct ioq_ent *ioq_slot_pop_sc(struct ioqq *ioqq, ioq_slot *slot, bool block) {
+	uintptr_t prev = load(slot, relaxed);
+	while (!(prev & ~IOQ_BLOCKED)) {
+		// empty → wait
+		if (!block) {
+			return NULL;
+		}
+		prev = ioq_slot_wait(ioqq, slot, prev);
+	}
+
+	// full(ptr) → empty (a blocked writer may set IOQ_BLOCKED concurrently)
+	prev = exchange(slot, 0, acquire);
+	if (prev & IOQ_BLOCKED) {
+		ioq_slot_wake(ioqq, slot);
+	}
+
+	prev &= ~IOQ_BLOCKED;
+	return (struct ioq_ent *)(prev << 1);
+}
+
+/** Pop an entry from the queue, when no other thread pops from it. */
+static struct ioq_ent *ioqq_pop_sc(struct ioqq *ioqq, bool block) {
+	size_t i = load(&ioqq->tail, relaxed);
 	ioq_slot *slot = &ioqq->slots[i & ioqq->slot_mask];
-	return ioq_slot_pop(ioqq, slot, block);
+	struct ioq_ent *ent = ioq_slot_pop_sc(ioqq, slot, block);
+	if (ent) {
+		store(&ioqq->tail, i + 1, relaxed);
+	}
+	return ent;
 }
 
 /** Pop a batch of entries from the queue. */
@@ -427,8 +568,34 @@ static void ioqq_pop_batch(struct ioqq *ioqq, struct ioq_ent *batch[], size_t si
 	}
 }
 
-/** Use cache-line-sized batches. */
-#define IOQ_BATCH (FALSE_SHARING_SIZE / sizeof(ioq_slot))
+/**
+ * Pop a batch of entries from the queue, when no other thread pops from it.
+ * Stops at the first empty slot (after the first one, if block is set).
+ *
+ * @return
+ *         The number of entries popped.
+ */
+static size_t ioqq_pop_batch_sc(struct ioqq *ioqq, struct ioq_ent *batch[], size_t size, bool block) {
+	size_t mask = ioqq->slot_mask;
+	size_t i = load(&ioqq->tail, relaxed);
+
+	size_t count = 0;
+	while (count < size) {
+		ioq_slot *slot = &ioqq->slots[(i + count) & mask];
+		struct ioq_ent *ent = ioq_slot_pop_sc(ioqq, slot, block);
+		if (!ent) {
+			break;
+		}
+		batch[count++] = ent;
+		block = false;
+	}
+
+	store(&ioqq->tail, i + count, relaxed);
+	return count;
+}
+
+// IOQ_BATCH (from ioq.h) should be cache-line-sized
+static_assert(sizeof(ioq_slot) == sizeof(uintptr_t), "ioq_slot size mismatch");
 
 /**
  * A batch of entries to send all at once.
@@ -465,11 +632,87 @@ static struct ioq_ent IOQ_STOP;
  * Supported io_uring operations.
  */
 enum ioq_ring_ops {
-	IOQ_RING_OPENAT = 1 << 0,
-	IOQ_RING_CLOSE  = 1 << 1,
-	IOQ_RING_STATX  = 1 << 2,
+	IOQ_RING_OPENAT     = 1 << 0,
+	IOQ_RING_CLOSE      = 1 << 1,
+	IOQ_RING_STATX      = 1 << 2,
+	IOQ_RING_GETDENTS   = 1 << 3,
+	IOQ_RING_UNLINKAT   = 1 << 4,
+	IOQ_RING_OPENAT2    = 1 << 5,
+	IOQ_RING_READLINKAT = 1 << 6,
 };
+
+#if BFS_HAS_OPENAT2_SYSCALL
+/** The IORING_OP_OPENAT2 arguments for each combination of path resolution flags. */
+static const struct open_how ioq_open_hows[] = {
+	[1] = {
+		.flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY,
+		.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS,
+	},
+	[2] = {
+		.flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY,
+		.resolve = RESOLVE_NO_XDEV,
+	},
+	[3] = {
+		.flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY,
+		.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_XDEV,
+	},
+};
+#endif
+
+/** Get the IORING_OP_OPENAT2 arguments for some bfs_opendir() flags, if needed. */
+static const void *ioq_open_how(enum bfs_dir_flags flags) {
+	size_t i = 0;
+	if (flags & BFS_DIR_NOFOLLOW) {
+		i |= 1;
+	}
+	if (flags & BFS_DIR_NOXDEV) {
+		i |= 2;
+	}
+
+#if BFS_HAS_OPENAT2_SYSCALL
+	if (i) {
+		return &ioq_open_hows[i];
+	}
+#endif
+	return NULL;
+}
+
+/**
+ * Whether we can issue getdents() on the ring.  IORING_OP_GETDENTS is not
+ * (yet) in mainline Linux, so this is detected at build time and probed at
+ * run time.
+ */
+#define BFS_USE_RING_GETDENTS (BFS_USE_GETDENTS && BFS_HAS_IO_URING_GETDENTS)
+
+/** Likewise for IORING_OP_READLINKAT. */
+#define BFS_USE_RING_READLINKAT BFS_HAS_IO_URING_READLINKAT
+
+/**
+ * Whether we can cancel every in-flight request at once (Linux 5.19+), and
+ * wait for completions with a timeout without spending an SQE (Linux 5.11+).
+ */
+#if defined(IORING_ASYNC_CANCEL_ANY) && defined(IORING_FEAT_EXT_ARG)
+#  define BFS_USE_RING_CANCEL true
+#else
+#  define BFS_USE_RING_CANCEL false
 #endif
+#endif
+
+/**
+ * The request that a thread pool worker is running, so the watchdog can time
+ * it out.
+ */
+struct ioq_watch {
+	/** The current request's deadline (0 if idle, IOQ_ABANDONED if timed out). */
+	atomic uint64_t deadline;
+	/** The current request. */
+	struct ioq_ent *atomic ent;
+	/** The last deadline this worker used, to keep them unique. */
+	uint64_t last;
+};
+
+/** ioq_watch::deadline for requests that the watchdog gave up on. */
+#define IOQ_ABANDONED ((uint64_t)1)
 
 /** I/O queue thread-specific data. */
 struct ioq_thread {
@@ -486,15 +729,45 @@ struct ioq_thread {
 	/** Bitmask of supported io_uring operations. */
 	enum ioq_ring_ops ring_ops;
 #endif
+
+	/** The current request, if requests can time out on this thread. */
+	struct ioq_watch *watch;
+	/** Whether the thread has exited (protected by ioq->watch.mutex). */
+	bool exited;
+	/** Whether the thread was abandoned, and not replaced. */
+	bool detached;
+
+	/**
+	 * The rest of the batch this thread is working through.  Idle threads
+	 * steal from the end, so one slow batch can't hold up the others.
+	 */
+	cache_align struct ioq_ent *atomic batch[IOQ_BATCH];
 };
 
 struct ioq {
+	/** ioq_create() flags. */
+	enum ioq_flags flags;
 	/** The depth of the queue. */
 	size_t depth;
+	/** The current in-flight limit (at most depth). */
+	size_t limit;
 	/** The current size of the queue. */
 	size_t size;
 	/** Cancellation flag. */
 	atomic bool cancel;
+	/** The I/O throttle, if any. */
+	struct bfs_throttle *throttle;
+	/** The timeout for opening directories and stat()ing files (in ns, or 0). */
+	uint64_t timeout;
+
+	/** The watchdog thread, which times out stuck requests. */
+	pthread_t watchdog;
+	/** Whether the watchdog is running. */
+	bool watching;
+	/** Whether the watchdog should stop (protected by watch.mutex). */
+	bool watch_stop;
+	/** Wakes up the watchdog, and anyone waiting for watched threads to exit. */
+	struct ioq_monitor watch;
 
 	/** ioq_ent arena. */
 	struct arena ents;
@@ -508,12 +781,134 @@ struct ioq {
 	/** Ready I/O responses. */
 	struct ioqq *ready;
 
+#if BFS_HAS_PTHREAD_SETAFFINITY_NP
+	/** The CPUs we're allowed to run on, for IOQ_AFFINITY. */
+	cpu_set_t cpus;
+#endif
+
+	/** The number of active background threads (the rest are parked). */
+	atomic size_t active;
+	/** Parked threads wait on this monitor. */
+	struct ioq_monitor park;
+	/** The total time the background threads have waited for requests. */
+	atomic uint64_t idle;
+	/** The number of threads looking for requests, which may be blocked. */
+	atomic size_t sleepers;
+
 	/** The number of background threads. */
 	size_t nthreads;
 	/** The background threads themselves. */
 	struct ioq_thread threads[];
 };
 
+static_assert(IOQ_READLINK < BFS_PERF_IOQ_OPS, "BFS_PERF_IOQ_OPS is too small");
+
+const char *ioq_op_name(enum ioq_op op) {
+	switch (op) {
+	case IOQ_CLOSE:
+		return "close";
+	case IOQ_OPENDIR:
+		return "opendir";
+	case IOQ_READAHEAD:
+		return "readahead";
+	case IOQ_CLOSEDIR:
+		return "closedir";
+	case IOQ_STAT:
+		return "stat";
+	case IOQ_UNLINK:
+		return "unlink";
+	case IOQ_PROBE:
+		return "probe";
+	case IOQ_READLINK:
+		return "readlink";
+	}
+
+	bfs_bug("Unknown ioq_op %d", (int)op);
+	return "???";
+}
+
+/** Wait until a background thread is needed again. */
+static void ioq_park(struct ioq *ioq, const struct ioq_thread *thread) {
+	size_t i = thread - ioq->threads;
+	if (i < load(&ioq->active, relaxed)) {
+		return;
+	}
+
+	mutex_lock(&ioq->park.mutex);
+	while (i >= load(&ioq->active, relaxed) && !load(&ioq->cancel, relaxed)) {
+		cond_wait(&ioq->park.cond, &ioq->park.mutex);
+	}
+	mutex_unlock(&ioq->park.mutex);
+}
+
+/** Start waiting for requests (for IOQ_IDLE_TIME). */
+static uint64_t ioq_idle_start(const struct ioq *ioq) {
+	if (ioq->flags & IOQ_IDLE_TIME) {
+		return bfs_perf_now();
+	} else {
+		return 0;
+	}
+}
+
+/** Finish waiting for requests. */
+static void ioq_idle_end(struct ioq *ioq, uint64_t start) {
+	if (start) {
+		uint64_t end = bfs_perf_now();
+		if (end > start) {
+			fetch_add(&ioq->idle, end - start, relaxed);
+		}
+	}
+}
+
+/** Record that a request was submitted (-D perf, -trace). */
+static void ioq_perf_submit(struct ioq *ioq, struct ioq_ent *ent) {
+	if (bfs_perf_enabled || bfs_tracing) {
+		ent->submitted = bfs_perf_now();
+		bfs_perf_sample(BFS_PERF_INFLIGHT, ioq->size);
+		bfs_trace_counter("ioq in flight", ioq->size + 1);
+	} else {
+		ent->submitted = 0;
+	}
+}
+
+/** Record that a background thread started a request (-D perf, -trace). */
+static void ioq_perf_start(struct ioq_ent *ent) {
+	if (ent->submitted) {
+		ent->started = bfs_perf_now();
+		if (bfs_perf_enabled) {
+			bfs_perf_ioq(ent->op, BFS_PERF_PENDING, ent->submitted, ent->started);
+		}
+	}
+}
+
+/** Record that a background thread finished a request (-D perf, -trace). */
+static void ioq_perf_finish(struct ioq_ent *ent) {
+	if (ent->submitted) {
+		ent->finished = bfs_perf_now();
+		if (bfs_perf_enabled) {
+			bfs_perf_ioq(ent->op, BFS_PERF_EXEC, ent->started, ent->finished);
+		}
+		if (bfs_tracing) {
+			bfs_trace_span(ioq_op_name(ent->op), ent->started, ent->finished);
+		}
+	}
+}
+
+/** Record that the submitter received a response (-D perf). */
+static void ioq_perf_pop(struct ioq_ent *ent) {
+	if (ent->submitted && bfs_perf_enabled) {
+		uint64_t now = bfs_perf_now();
+		bfs_perf_ioq(ent->op, BFS_PERF_READY, ent->finished, now);
+		bfs_perf_ioq(ent->op, BFS_PERF_TOTAL, ent->submitted, now);
+	}
+}
+
+/** Push a finished request onto the ready queue. */
+static void ioq_ready(struct ioq *ioq, struct ioq_batch *batch, struct ioq_ent *ent) {
+	ioq_perf_finish(ent);
+	ioq_batch_push(ioq->ready, batch, ent);
+}
+
 /** Cancel a request if we need to. */
 static bool ioq_check_cancel(struct ioq *ioq, struct ioq_ent *ent) {
 	if (!load(&ioq->cancel, relaxed)) {
@@ -529,6 +924,11 @@ static bool ioq_check_cancel(struct ioq *ioq, struct ioq_ent *ent) {
 	return true;
 }
 
+/** Check if a request can time out. */
+static bool ioq_can_timeout(const struct ioq *ioq, const struct ioq_ent *ent) {
+	return ioq->timeout && (ent->op == IOQ_OPENDIR || ent->op == IOQ_STAT);
+}
+
 /** Dispatch a single request synchronously. */
 static void ioq_dispatch_sync(struct ioq *ioq, struct ioq_ent *ent) {
 	switch (ent->op) {
@@ -545,13 +945,46 @@ static void ioq_dispatch_sync(struct ioq *ioq, struct ioq_ent *ent) {
 			return;
 		}
 
+		case IOQ_READAHEAD: {
+#if BFS_USE_GETDENTS
+			struct ioq_readahead *args = &ent->readahead;
+			ent->result = try(bfs_dirread(args->dir, args->buf, args->size));
+#else
+			ent->result = -ENOTSUP;
+#endif
+			return;
+		}
+
 		case IOQ_CLOSEDIR:
 			ent->result = try(bfs_closedir(ent->closedir.dir));
 			return;
 
 		case IOQ_STAT: {
 			struct ioq_stat *args = &ent->stat;
-			ent->result = try(bfs_stat(args->dfd, args->path, args->flags, args->buf));
+			ent->result = try(bfs_stat_mask(args->dfd, args->path, args->flags, args->mask, args->buf));
+			return;
+		}
+
+		case IOQ_UNLINK: {
+			struct ioq_unlink *args = &ent->unlink;
+			uint64_t start = bfs_perf_start();
+			ent->result = try(unlinkat(args->dfd, args->path, args->flags));
+			bfs_perf_end(BFS_PERF_UNLINK, start, 0);
+			return;
+		}
+
+		case IOQ_PROBE: {
+			struct ioq_probe *args = &ent->probe;
+			bfs_fsade_probe(args->dfd, args->path, args->type, args->flags, args->checks, args->probe);
+			ent->result = 0;
+			return;
+		}
+
+		case IOQ_READLINK: {
+			struct ioq_readlink *args = &ent->readlink;
+			uint64_t start = bfs_perf_start();
+			ent->result = try(readlinkat(args->dfd, args->path, args->buf, args->size));
+			bfs_perf_end(BFS_PERF_READLINK, start, 0);
 			return;
 		}
 	}
@@ -566,6 +999,8 @@ static void ioq_dispatch_sync(struct ioq *ioq, struct ioq_ent *ent) {
 struct ioq_ring_state {
 	/** The I/O queue. */
 	struct ioq *ioq;
+	/** The thread running this loop. */
+	struct ioq_thread *thread;
 	/** The io_uring. */
 	struct io_uring *ring;
 	/** Supported io_uring operations. */
@@ -576,10 +1011,41 @@ struct ioq_ring_state {
 	size_t submitted;
 	/** Whether to stop the loop. */
 	bool stop;
+	/** Whether the in-flight requests have been cancelled. */
+	bool cancelled;
+	/** The timeout for IORING_OP_LINK_TIMEOUT, if any. */
+	struct __kernel_timespec timeout;
 	/** A batch of ready entries. */
 	struct ioq_batch ready;
 };
 
+#if BFS_USE_RING_GETDENTS
+
+/** Tag bit for getdents() requests chained after an openat(). */
+#define IOQ_RING_CHAINED ((uintptr_t)1)
+
+/** Prep a getdents() SQE, if the directory needs one. */
+static struct io_uring_sqe *ioq_prep_getdents(struct ioq_ring_state *state, struct bfs_dir *dir) {
+	if (!(state->ops & IOQ_RING_GETDENTS)) {
+		return NULL;
+	}
+
+	void *buf;
+	size_t size = bfs_dirbuf(dir, &buf);
+	if (size == 0) {
+		return NULL;
+	}
+
+	struct io_uring_sqe *sqe = io_uring_get_sqe(state->ring);
+	if (sqe) {
+		// Offset 0 means "the current file position"
+		io_uring_prep_rw(IORING_OP_GETDENTS, sqe, bfs_dirfd(dir), buf, size, 0);
+	}
+	return sqe;
+}
+
+#endif // BFS_USE_RING_GETDENTS
+
 /** Dispatch a single request asynchronously. */
 static struct io_uring_sqe *ioq_dispatch_async(struct ioq_ring_state *state, struct ioq_ent *ent) {
 	struct io_uring *ring = state->ring;
@@ -596,13 +1062,30 @@ static struct io_uring_sqe *ioq_dispatch_async(struct ioq_ring_state *state, str
 
 	case IOQ_OPENDIR:
 		if (ops & IOQ_RING_OPENAT) {
-			sqe = io_uring_get_sqe(ring);
 			struct ioq_opendir *args = &ent->opendir;
-			int flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
-			io_uring_prep_openat(sqe, args->dfd, args->path, flags, 0);
+			const void *how = ioq_open_how(args->flags);
+			if (!how) {
+				sqe = io_uring_get_sqe(ring);
+				int flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
+				io_uring_prep_openat(sqe, args->dfd, args->path, flags, 0);
+			} else if (ops & IOQ_RING_OPENAT2) {
+				sqe = io_uring_get_sqe(ring);
+				io_uring_prep_openat2(sqe, args->dfd, args->path, (struct open_how *)how);
+			}
+			// Otherwise, let bfs_opendir() enforce the flags (or fall back)
 		}
 		return sqe;
 
+	case IOQ_READAHEAD:
+#if BFS_USE_RING_GETDENTS
+		if (ops & IOQ_RING_GETDENTS) {
+			sqe = io_uring_get_sqe(ring);
+			struct ioq_readahead *args = &ent->readahead;
+			io_uring_prep_rw(IORING_OP_GETDENTS, sqe, bfs_dirfd(args->dir), args->buf, args->size, 0);
+		}
+#endif
+		return sqe;
+
 	case IOQ_CLOSEDIR:
 #if BFS_USE_UNWRAPDIR
 		if (ops & IOQ_RING_CLOSE) {
@@ -618,9 +1101,32 @@ static struct io_uring_sqe *ioq_dispatch_async(struct ioq_ring_state *state, str
 			sqe = io_uring_get_sqe(ring);
 			struct ioq_stat *args = &ent->stat;
 			int flags = bfs_statx_flags(args->flags);
-			unsigned int mask = STATX_BASIC_STATS | STATX_BTIME;
+			unsigned int mask = bfs_statx_mask(args->mask);
 			io_uring_prep_statx(sqe, args->dfd, args->path, flags, mask, args->xbuf);
 		}
+#endif
+		return sqe;
+
+	case IOQ_UNLINK:
+		if (ops & IOQ_RING_UNLINKAT) {
+			sqe = io_uring_get_sqe(ring);
+			struct ioq_unlink *args = &ent->unlink;
+			io_uring_prep_unlinkat(sqe, args->dfd, args->path, args->flags);
+		}
+		return sqe;
+
+	case IOQ_PROBE:
+		// These go through libraries (libacl, libcap) and /proc/self/fd
+		// paths, so they always run on the worker thread
+		return sqe;
+
+	case IOQ_READLINK:
+#if BFS_USE_RING_READLINKAT
+		if (ops & IOQ_RING_READLINKAT) {
+			sqe = io_uring_get_sqe(ring);
+			struct ioq_readlink *args = &ent->readlink;
+			io_uring_prep_rw(IORING_OP_READLINKAT, sqe, args->dfd, args->path, args->size, (uintptr_t)args->buf);
+		}
 #endif
 		return sqe;
 	}
@@ -634,11 +1140,30 @@ static bool ioq_ring_empty(struct ioq_ring_state *state) {
 	return !state->prepped && !state->submitted && !state->ready.size;
 }
 
+/** Link a timeout to a request, if it can time out. */
+static void ioq_link_timeout(struct ioq_ring_state *state, struct ioq_ent *ent, struct io_uring_sqe *sqe) {
+	if (!ioq_can_timeout(state->ioq, ent)) {
+		return;
+	}
+
+	struct io_uring_sqe *timeout = io_uring_get_sqe(state->ring);
+	if (!timeout) {
+		return;
+	}
+
+	// The request completes with -ECANCELED if the timeout fires first
+	sqe->flags |= IOSQE_IO_LINK;
+	io_uring_prep_link_timeout(timeout, &state->timeout, 0);
+	io_uring_sqe_set_data(timeout, NULL);
+	++state->prepped;
+}
+
 /** Prep a single SQE. */
 static void ioq_prep_sqe(struct ioq_ring_state *state, struct ioq_ent *ent) {
 	struct ioq *ioq = state->ioq;
+	ioq_perf_start(ent);
 	if (ioq_check_cancel(ioq, ent)) {
-		ioq_batch_push(ioq->ready, &state->ready, ent);
+		ioq_ready(ioq, &state->ready, ent);
 		return;
 	}
 
@@ -646,9 +1171,10 @@ static void ioq_prep_sqe(struct ioq_ring_state *state, struct ioq_ent *ent) {
 	if (sqe) {
 		io_uring_sqe_set_data(sqe, ent);
 		++state->prepped;
+		ioq_link_timeout(state, ent, sqe);
 	} else {
 		ioq_dispatch_sync(ioq, ent);
-		ioq_batch_push(ioq->ready, &state->ready, ent);
+		ioq_ready(ioq, &state->ready, ent);
 	}
 }
 
@@ -662,9 +1188,17 @@ static bool ioq_ring_prep(struct ioq_ring_state *state) {
 	struct io_uring *ring = state->ring;
 	struct ioq_ent *pending[IOQ_BATCH];
 
-	while (io_uring_sq_space_left(ring) >= IOQ_BATCH) {
+	// Requests with timeouts take two SQEs
+	size_t space = ioq->timeout ? 2 * IOQ_BATCH : IOQ_BATCH;
+	while (io_uring_sq_space_left(ring) >= space) {
 		bool block = ioq_ring_empty(state);
+		uint64_t start = 0;
+		if (block) {
+			ioq_park(ioq, state->thread);
+			start = ioq_idle_start(ioq);
+		}
 		ioqq_pop_batch(ioq->pending, pending, IOQ_BATCH, block);
+		ioq_idle_end(ioq, start);
 
 		bool any = false;
 		for (size_t i = 0; i < IOQ_BATCH; ++i) {
@@ -693,11 +1227,37 @@ static void ioq_reap_cqe(struct ioq_ring_state *state, struct io_uring_cqe *cqe)
 	struct ioq *ioq = state->ioq;
 	struct io_uring *ring = state->ring;
 
-	struct ioq_ent *ent = io_uring_cqe_get_data(cqe);
-	ent->result = cqe->res;
+	uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+	int res = cqe->res;
 	io_uring_cqe_seen(ring, cqe);
 	--state->submitted;
 
+	if (!data) {
+		// The completion of an IORING_OP_ASYNC_CANCEL or
+		// IORING_OP_LINK_TIMEOUT
+		return;
+	}
+
+	struct ioq_ent *ent;
+
+#if BFS_USE_RING_GETDENTS
+	if (data & IOQ_RING_CHAINED) {
+		// The first getdents() after an openat().  If it failed, the
+		// error will be reported by the next bfs_polldir() instead.
+		ent = (struct ioq_ent *)(data ^ IOQ_RING_CHAINED);
+		if (res >= 0) {
+			bfs_dirfill(ent->opendir.dir, res);
+		}
+		goto push;
+	}
+#endif
+
+	ent = (struct ioq_ent *)data;
+	if (res == -ECANCELED && !state->cancelled && ioq_can_timeout(ioq, ent)) {
+		// Cancelled by the linked timeout
+		res = -ETIMEDOUT;
+	}
+	ent->result = res;
 	if (ent->result < 0) {
 		goto push;
 	}
@@ -713,7 +1273,14 @@ static void ioq_reap_cqe(struct ioq_ring_state *state, struct io_uring_cqe *cqe)
 			struct ioq_opendir *args = &ent->opendir;
 			ent->result = try(bfs_opendir(args->dir, fd, NULL, args->flags));
 			if (ent->result >= 0) {
-				// TODO: io_uring_prep_getdents()
+#if BFS_USE_RING_GETDENTS
+				struct io_uring_sqe *sqe = ioq_prep_getdents(state, args->dir);
+				if (sqe) {
+					io_uring_sqe_set_data(sqe, (void *)((uintptr_t)ent | IOQ_RING_CHAINED));
+					++state->prepped;
+					return;
+				}
+#endif
 				bfs_polldir(args->dir);
 			} else {
 				xclose(fd);
@@ -735,7 +1302,62 @@ static void ioq_reap_cqe(struct ioq_ring_state *state, struct io_uring_cqe *cqe)
 	}
 
 push:
-	ioq_batch_push(ioq->ready, &state->ready, ent);
+	ioq_ready(ioq, &state->ready, ent);
+}
+
+#if BFS_USE_RING_CANCEL
+
+/** How often to check for cancellation while waiting on the ring. */
+#define IOQ_CANCEL_POLL (10 * 1000 * 1000)
+
+/**
+ * Cancel every in-flight request on the ring.  This can't lose any close()s,
+ * since IORING_OP_CLOSE on a directory completes inline during submission.
+ */
+static void ioq_ring_cancel(struct ioq_ring_state *state) {
+	struct io_uring *ring = state->ring;
+
+	state->cancelled = true;
+
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+	if (!sqe) {
+		return;
+	}
+
+	io_uring_prep_cancel(sqe, NULL, IORING_ASYNC_CANCEL_ANY);
+	io_uring_sqe_set_data(sqe, NULL);
+	if (io_uring_submit(ring) > 0) {
+		++state->submitted;
+	}
+}
+
+#endif
+
+/** Wait for a CQE, cancelling the in-flight requests if the ioq is cancelled. */
+static int ioq_ring_wait(struct ioq_ring_state *state, struct io_uring_cqe **cqe) {
+	struct io_uring *ring = state->ring;
+
+#if BFS_USE_RING_CANCEL
+	// Without IORING_FEAT_EXT_ARG, timeouts cost an extra SQE every time
+	bool poll = ring->features & IORING_FEAT_EXT_ARG;
+
+	while (poll && !state->cancelled) {
+		if (load(&state->ioq->cancel, relaxed)) {
+			ioq_ring_cancel(state);
+			break;
+		}
+
+		struct __kernel_timespec ts = {
+			.tv_nsec = IOQ_CANCEL_POLL,
+		};
+		int ret = io_uring_wait_cqe_timeout(ring, cqe, &ts);
+		if (ret != -ETIME) {
+			return ret;
+		}
+	}
+#endif
+
+	return io_uring_wait_cqe(ring, cqe);
 }
 
 /** Reap a batch of CQEs. */
@@ -753,7 +1375,7 @@ static void ioq_ring_reap(struct ioq_ring_state *state) {
 
 	while (state->submitted) {
 		struct io_uring_cqe *cqe;
-		if (io_uring_wait_cqe(ring, &cqe) < 0) {
+		if (ioq_ring_wait(state, &cqe) < 0) {
 			continue;
 		}
 
@@ -763,12 +1385,63 @@ static void ioq_ring_reap(struct ioq_ring_state *state) {
 	ioq_batch_flush(ioq->ready, &state->ready);
 }
 
+/** Get the optional io_uring setup flags to try. */
+static unsigned int ioq_ring_flags(const struct ioq *ioq) {
+	unsigned int flags = 0;
+
+	if (ioq->flags & IOQ_SQPOLL) {
+		flags |= IORING_SETUP_SQPOLL;
+		return flags;
+	}
+
+	// Each ring is only ever submitted to by its own thread, and we only
+	// reap completions from that same thread, so let the kernel defer
+	// completion work until we ask for it
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_DEFER_TASKRUN)
+	flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	// The ring is created on the main thread, so don't pick a submitter
+	// until ioq_ring_start()
+	flags |= IORING_SETUP_R_DISABLED;
+#endif
+
+	return flags;
+}
+
+/** Finish setting up a ring from its own thread. */
+static void ioq_ring_start(struct ioq_thread *thread) {
+	struct io_uring *ring = &thread->ring;
+
+#ifdef IORING_SETUP_R_DISABLED
+	// With IORING_SETUP_SINGLE_ISSUER, the task that enables the ring
+	// becomes its only allowed submitter
+	if (ring->flags & IORING_SETUP_R_DISABLED) {
+		io_uring_enable_rings(ring);
+	}
+#endif
+
+#if BFS_HAS_IO_URING_REGISTER_RING_FD
+	// Only this thread ever submits to its ring, so register the ring fd to
+	// save an fget()/fput() pair on every io_uring_enter().  Registered
+	// ring fds are per-task, so this must happen on the worker thread.
+	// This can fail on older kernels, which is harmless.
+	io_uring_register_ring_fd(ring);
+#endif
+}
+
 /** io_uring worker loop. */
 static void ioq_ring_work(struct ioq_thread *thread) {
+	ioq_ring_start(thread);
+
+	struct ioq *ioq = thread->parent;
 	struct ioq_ring_state state = {
-		.ioq = thread->parent,
+		.ioq = ioq,
+		.thread = thread,
 		.ring = &thread->ring,
 		.ops = thread->ring_ops,
+		.timeout = {
+			.tv_sec = ioq->timeout / 1000000000,
+			.tv_nsec = ioq->timeout % 1000000000,
+		},
 	};
 
 	while (ioq_ring_prep(&state)) {
@@ -778,39 +1451,236 @@ static void ioq_ring_work(struct ioq_thread *thread) {
 
 #endif // BFS_WITH_LIBURING
 
+/** Dispatch a request, subject to the throttle. */
+static void ioq_dispatch_throttled(struct ioq *ioq, struct ioq_ent *ent) {
+	struct bfs_throttle *throttle = ioq->throttle;
+
+	// close() doesn't touch the disk, and frees up fds, so don't hold it back
+	if (!throttle || ent->op == IOQ_CLOSE || ent->op == IOQ_CLOSEDIR) {
+		ioq_dispatch_sync(ioq, ent);
+		return;
+	}
+
+	uint64_t start = bfs_throttle_start(throttle);
+	ioq_dispatch_sync(ioq, ent);
+	bfs_throttle_end(throttle, start);
+}
+
+/**
+ * Dispatch a request that can time out.  The blocking part works on private
+ * buffers, so if the watchdog gives up on it, nothing the submitter owns is
+ * touched after the timeout is reported.
+ *
+ * @return
+ *         Whether the request finished in time.  If not, the watchdog has
+ *         already replied, and this thread has been replaced, so it must exit.
+ */
+static bool ioq_dispatch_watched(struct ioq *ioq, struct ioq_watch *watch, struct ioq_ent *ent) {
+	struct bfs_throttle *throttle = ioq->throttle;
+	uint64_t start = 0;
+	if (throttle) {
+		start = bfs_throttle_start(throttle);
+	}
+
+	// Copy the arguments first, since the submitter may free the request as
+	// soon as the watchdog replies
+	enum ioq_op op = ent->op;
+	struct ioq_opendir opendir;
+	struct ioq_stat stat;
+	if (op == IOQ_OPENDIR) {
+		opendir = ent->opendir;
+	} else {
+		stat = ent->stat;
+	}
+
+	uint64_t deadline = bfs_perf_now() + ioq->timeout;
+	if (deadline <= watch->last) {
+		deadline = watch->last + 1;
+	}
+	watch->last = deadline;
+	store(&watch->ent, ent, relaxed);
+	store(&watch->deadline, deadline, release);
+
+	int fd = -1;
+	struct bfs_stat buf;
+	int result;
+	if (op == IOQ_OPENDIR) {
+		fd = bfs_opendirfd(opendir.dfd, opendir.path, opendir.flags);
+		result = fd < 0 ? -errno : 0;
+	} else {
+		result = try(bfs_stat_mask(stat.dfd, stat.path, stat.flags, stat.mask, &buf));
+	}
+
+	if (!compare_exchange_strong(&watch->deadline, &deadline, 0, acquire, acquire)) {
+		// We were abandoned, and now own the watch
+		if (fd >= 0) {
+			xclose(fd);
+		}
+		free(watch);
+		return false;
+	}
+
+	if (op == IOQ_OPENDIR) {
+		if (fd >= 0) {
+			result = try(bfs_opendir(opendir.dir, fd, NULL, opendir.flags));
+			if (result >= 0) {
+				bfs_polldir(opendir.dir);
+			} else {
+				xclose(fd);
+			}
+		}
+	} else if (result >= 0) {
+		*stat.buf = buf;
+	}
+	ent->result = result;
+
+	if (throttle) {
+		bfs_throttle_end(throttle, start);
+	}
+	return true;
+}
+
+/** Steal a request that another thread popped but hasn't started yet. */
+static struct ioq_ent *ioq_steal(struct ioq *ioq, const struct ioq_thread *thread) {
+	for (size_t i = 0; i < ioq->nthreads; ++i) {
+		struct ioq_thread *victim = &ioq->threads[i];
+		if (victim == thread) {
+			continue;
+		}
+
+		// The owner works from the front, so take the last request
+		for (size_t j = IOQ_BATCH; j-- > 1;) {
+			if (!load(&victim->batch[j], relaxed)) {
+				continue;
+			}
+
+			struct ioq_ent *ent = exchange(&victim->batch[j], NULL, acquire);
+			if (ent) {
+				bfs_perf_count(BFS_PERF_IOQ_STEALS);
+				return ent;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Hand the unstarted rest of a batch back to the pending queue if other threads
+ * may be blocked on it, since they won't look for anything to steal until they
+ * wake up.
+ */
+static void ioq_hand_back(struct ioq *ioq, struct ioq_thread *thread, size_t count) {
+	// Pairs with the fence in ioq_sync_work(), so either we see the
+	// sleeper, or it sees our batch
+	thread_fence(&ioq->sleepers, seq_cst);
+	if (load(&ioq->sleepers, relaxed) == 0) {
+		return;
+	}
+
+	for (size_t i = 1; i < count; ++i) {
+		struct ioq_ent *ent = exchange(&thread->batch[i], NULL, relaxed);
+		if (ent) {
+			ioqq_push(ioq->pending, ent);
+		}
+	}
+}
+
 /** Synchronous syscall loop. */
 static void ioq_sync_work(struct ioq_thread *thread) {
 	struct ioq *ioq = thread->parent;
+	struct ioq_watch *watch = thread->watch;
+
+	// A request that times out takes the thread down with it, so don't
+	// strand a batch of other requests behind it
+	size_t size = watch ? 1 : IOQ_BATCH;
 
 	bool stop = false;
 	while (!stop) {
+		ioq_park(ioq, thread);
+
 		struct ioq_ent *pending[IOQ_BATCH];
-		ioqq_pop_batch(ioq->pending, pending, IOQ_BATCH, true);
+		size_t count = 0;
+		if (!watch) {
+			fetch_add(&ioq->sleepers, 1, relaxed);
+			thread_fence(&ioq->sleepers, seq_cst);
+			pending[0] = ioq_steal(ioq, thread);
+			count = pending[0] ? 1 : 0;
+		}
+
+		bool popped = count == 0;
+		if (popped) {
+			uint64_t start = ioq_idle_start(ioq);
+			ioqq_pop_batch(ioq->pending, pending, size, true);
+			ioq_idle_end(ioq, start);
+			count = size;
+		}
+
+		if (!watch) {
+			fetch_sub(&ioq->sleepers, 1, relaxed);
+		}
+
+		if (popped && !watch) {
+			// Share the rest of the batch with idle threads
+			bool share = true;
+			for (size_t i = 1; i < count; ++i) {
+				if (pending[i] == &IOQ_STOP) {
+					count = i + 1;
+					share = false;
+					break;
+				}
+				store(&thread->batch[i], pending[i], release);
+			}
+
+			if (share) {
+				ioq_hand_back(ioq, thread, count);
+			}
+		}
 
 		struct ioq_batch ready;
 		ready.size = 0;
 
-		for (size_t i = 0; i < IOQ_BATCH; ++i) {
+		for (size_t i = 0; i < count; ++i) {
 			struct ioq_ent *ent = pending[i];
+			if (ent && ent != &IOQ_STOP && i > 0) {
+				// Make sure nobody stole it first
+				ent = exchange(&thread->batch[i], NULL, relaxed);
+			}
+
 			if (ent == &IOQ_STOP) {
 				ioqq_push(ioq->pending, &IOQ_STOP);
 				stop = true;
 				break;
 			} else if (ent) {
-				if (!ioq_check_cancel(ioq, ent)) {
-					ioq_dispatch_sync(ioq, ent);
+				ioq_perf_start(ent);
+				if (ioq_check_cancel(ioq, ent)) {
+					// Already failed with EINTR
+				} else if (watch && ioq_can_timeout(ioq, ent)) {
+					if (!ioq_dispatch_watched(ioq, watch, ent)) {
+						return;
+					}
+				} else {
+					ioq_dispatch_throttled(ioq, ent);
 				}
-				ioq_batch_push(ioq->ready, &ready, ent);
+				ioq_ready(ioq, &ready, ent);
 			}
 		}
 
 		ioq_batch_flush(ioq->ready, &ready);
 	}
+
+	if (watch) {
+		mutex_lock(&ioq->watch.mutex);
+		thread->exited = true;
+		cond_broadcast(&ioq->watch.cond);
+		mutex_unlock(&ioq->watch.mutex);
+	}
 }
 
 /** Background thread entry point. */
 static void *ioq_work(void *ptr) {
 	struct ioq_thread *thread = ptr;
+	bfs_perf_name("ioq");
 
 #if BFS_WITH_LIBURING
 	if (thread->ring_err == 0) {
@@ -823,36 +1693,87 @@ static void *ioq_work(void *ptr) {
 	return NULL;
 }
 
+#if BFS_WITH_LIBURING
+
+/**
+ * Limit the number of io-wq workers for a ring, so that all the rings together
+ * stay within one budget of ioq->nthreads bound and unbound workers.
+ */
+static void ioq_ring_limit(struct ioq *ioq, struct ioq_thread *thread) {
+	// Without SQPOLL, each submitting thread gets its own io-wq (even with
+	// IORING_SETUP_ATTACH_WQ), so give each ring an equal share of the
+	// budget.  Otherwise, the rings all share the SQPOLL thread's io-wq.
+	unsigned int max = 1;
+	if (thread->ring.flags & IORING_SETUP_SQPOLL) {
+		max = ioq->nthreads;
+	}
+
+	// Every ring has to be limited, since the limits are stored per ring
+	// and only apply to the workers of the threads that submit to it
+	unsigned int values[] = {
+		max, // [IO_WQ_BOUND]
+		max, // [IO_WQ_UNBOUND]
+	};
+	io_uring_register_iowq_max_workers(&thread->ring, values);
+}
+
+#endif
+
 /** Initialize io_uring thread state. */
 static int ioq_ring_init(struct ioq *ioq, struct ioq_thread *thread) {
 #if BFS_WITH_LIBURING
-	struct ioq_thread *prev = NULL;
+	// Throttled requests are paced one at a time by the synchronous loop
+	if (ioq->throttle) {
+		thread->ring_err = ENOTSUP;
+		return -1;
+	}
+
+	struct ioq_thread *first = NULL;
 	if (thread > ioq->threads) {
-		prev = thread - 1;
+		first = ioq->threads;
 	}
 
-	if (prev && prev->ring_err) {
-		thread->ring_err = prev->ring_err;
+	if (first && first->ring_err) {
+		thread->ring_err = first->ring_err;
 		return -1;
 	}
 
-	// Share io-wq workers between rings
+	// Share io-wq workers (and the SQPOLL thread, if any) with the first ring
 	struct io_uring_params params = {0};
-	if (prev) {
+	if (first) {
 		params.flags |= IORING_SETUP_ATTACH_WQ;
-		params.wq_fd = prev->ring.ring_fd;
+		params.wq_fd = first->ring.ring_fd;
 	}
 
 	// Use a page for each SQE ring
 	size_t entries = 4096 / sizeof(struct io_uring_sqe);
-	thread->ring_err = -io_uring_queue_init_params(entries, &thread->ring, &params);
+
+	// Try the optional setup flags first, then fall back to a plain ring
+	unsigned int extra = ioq_ring_flags(ioq);
+	if (extra) {
+		struct io_uring_params xparams = params;
+		xparams.flags |= extra;
+		if (extra & IORING_SETUP_SQPOLL) {
+			// Let the SQPOLL thread sleep after 100ms of inactivity
+			xparams.sq_thread_idle = 100;
+		}
+
+		thread->ring_err = -io_uring_queue_init_params(entries, &thread->ring, &xparams);
+	} else {
+		thread->ring_err = EINVAL;
+	}
+
+	if (thread->ring_err) {
+		thread->ring_err = -io_uring_queue_init_params(entries, &thread->ring, &params);
+	}
 	if (thread->ring_err) {
 		return -1;
 	}
 
-	if (prev) {
+	if (first) {
 		// Initial setup already complete
-		thread->ring_ops = prev->ring_ops;
+		thread->ring_ops = first->ring_ops;
+		ioq_ring_limit(ioq, thread);
 		return 0;
 	}
 
@@ -865,10 +1786,28 @@ static int ioq_ring_init(struct ioq *ioq, struct ioq_thread *thread) {
 		if (io_uring_opcode_supported(probe, IORING_OP_CLOSE)) {
 			thread->ring_ops |= IOQ_RING_CLOSE;
 		}
+#if BFS_HAS_OPENAT2_SYSCALL
+		if (io_uring_opcode_supported(probe, IORING_OP_OPENAT2)) {
+			thread->ring_ops |= IOQ_RING_OPENAT2;
+		}
+#endif
 #if BFS_USE_STATX
 		if (io_uring_opcode_supported(probe, IORING_OP_STATX)) {
 			thread->ring_ops |= IOQ_RING_STATX;
 		}
+#endif
+		if (io_uring_opcode_supported(probe, IORING_OP_UNLINKAT)) {
+			thread->ring_ops |= IOQ_RING_UNLINKAT;
+		}
+#if BFS_USE_RING_GETDENTS
+		if (io_uring_opcode_supported(probe, IORING_OP_GETDENTS)) {
+			thread->ring_ops |= IOQ_RING_GETDENTS;
+		}
+#endif
+#if BFS_USE_RING_READLINKAT
+		if (io_uring_opcode_supported(probe, IORING_OP_READLINKAT)) {
+			thread->ring_ops |= IOQ_RING_READLINKAT;
+		}
 #endif
 		io_uring_free_probe(probe);
 	}
@@ -878,17 +1817,21 @@ static int ioq_ring_init(struct ioq *ioq, struct ioq_thread *thread) {
 		return -1;
 	}
 
-	// Limit the number of io_uring workers
-	unsigned int values[] = {
-		ioq->nthreads, // [IO_WQ_BOUND]
-		0,             // [IO_WQ_UNBOUND]
-	};
-	io_uring_register_iowq_max_workers(&thread->ring, values);
+	ioq_ring_limit(ioq, thread);
 #endif
 
 	return 0;
 }
 
+/** Check if a thread uses io_uring. */
+static bool ioq_thread_ring(const struct ioq_thread *thread) {
+#if BFS_WITH_LIBURING
+	return thread->ring_err == 0;
+#else
+	return false;
+#endif
+}
+
 /** Destroy an io_uring. */
 static void ioq_ring_exit(struct ioq_thread *thread) {
 #if BFS_WITH_LIBURING
@@ -898,33 +1841,218 @@ static void ioq_ring_exit(struct ioq_thread *thread) {
 #endif
 }
 
+#if BFS_HAS_PTHREAD_SETAFFINITY_NP
+
+/** Pin a thread to the nth CPU in a set. */
+static void ioq_pin(pthread_t thread, const cpu_set_t *cpus, size_t n) {
+	size_t count = CPU_COUNT(cpus);
+	if (count <= 1) {
+		return;
+	}
+	n %= count;
+
+	for (size_t i = 0; i < CPU_SETSIZE; ++i) {
+		if (!CPU_ISSET(i, cpus)) {
+			continue;
+		}
+
+		if (n-- == 0) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(i, &set);
+			// Affinity is just a hint, so ignore failures
+			pthread_setaffinity_np(thread, sizeof(set), &set);
+			return;
+		}
+	}
+}
+
+#endif
+
 /** Create an I/O queue thread. */
 static int ioq_thread_create(struct ioq *ioq, struct ioq_thread *thread) {
 	thread->parent = ioq;
 
 	ioq_ring_init(ioq, thread);
 
+	// Rings time out requests with IORING_OP_LINK_TIMEOUT, while the thread
+	// pool needs the watchdog
+	if (ioq->timeout && !ioq_thread_ring(thread)) {
+		thread->watch = ZALLOC(struct ioq_watch);
+		if (!thread->watch) {
+			return -1;
+		}
+	}
+
 	if (thread_create(&thread->id, NULL, ioq_work, thread) != 0) {
+		free(thread->watch);
+		thread->watch = NULL;
 		ioq_ring_exit(thread);
 		return -1;
 	}
 
+#if BFS_HAS_PTHREAD_SETAFFINITY_NP
+	if (ioq->flags & IOQ_AFFINITY) {
+		// Leave the first CPU for the main thread, so start from the second
+		size_t i = thread - ioq->threads;
+		ioq_pin(thread->id, &ioq->cpus, i + 1);
+	}
+#endif
+
 	return 0;
 }
 
+/** Get the (CLOCK_REALTIME) deadline for the watchdog's next check. */
+static void ioq_watch_next(const struct ioq *ioq, struct timespec *ts) {
+	// Check a few times per timeout, but at least once a second
+	long interval = ioq->timeout / 4;
+	if (interval < 1000000) {
+		interval = 1000000;
+	} else if (interval > 999999999) {
+		interval = 999999999;
+	}
+
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec += interval;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		++ts->tv_sec;
+	}
+}
+
+/**
+ * Give up on a thread's request if it's past its deadline.  The request fails
+ * with ETIMEDOUT, and the stuck thread is left to exit whenever it wakes up.
+ * Must be called with ioq->watch.mutex held.
+ *
+ * @return
+ *         Whether the thread was abandoned.
+ */
+static bool ioq_watch_abandon(struct ioq *ioq, struct ioq_thread *thread) {
+	struct ioq_watch *watch = thread->watch;
+	uint64_t deadline = load(&watch->deadline, acquire);
+	if (deadline <= IOQ_ABANDONED || bfs_perf_now() < deadline) {
+		return false;
+	}
+
+	// Deadlines are unique, so if the exchange succeeds, this is still the
+	// request that the deadline was set for
+	struct ioq_ent *ent = load(&watch->ent, relaxed);
+	if (!compare_exchange_strong(&watch->deadline, &deadline, IOQ_ABANDONED, release, relaxed)) {
+		return false;
+	}
+
+	// The stuck thread owns its watch now, and won't touch anything else
+	thread->watch = NULL;
+	thread->detached = true;
+	thread_detach(thread->id);
+
+	ent->result = -ETIMEDOUT;
+	ioq_perf_finish(ent);
+	ioqq_push(ioq->ready, ent);
+	return true;
+}
+
+/** Replace an abandoned thread pool worker. */
+static void ioq_watch_replace(struct ioq_thread *thread) {
+	struct ioq_watch *watch = ZALLOC(struct ioq_watch);
+	if (!watch) {
+		return;
+	}
+
+	thread->watch = watch;
+	thread->exited = false;
+	if (thread_create(&thread->id, NULL, ioq_work, thread) != 0) {
+		thread->watch = NULL;
+		free(watch);
+		return;
+	}
+
+	thread->detached = false;
+}
+
+/** Watchdog thread entry point. */
+static void *ioq_watchdog(void *ptr) {
+	struct ioq *ioq = ptr;
+	bfs_perf_name("ioq watchdog");
+
+	mutex_lock(&ioq->watch.mutex);
+	while (!ioq->watch_stop) {
+		struct timespec ts;
+		ioq_watch_next(ioq, &ts);
+		cond_timedwait(&ioq->watch.cond, &ioq->watch.mutex, &ts);
+
+		for (size_t i = 0; i < ioq->nthreads; ++i) {
+			struct ioq_thread *thread = &ioq->threads[i];
+			if (thread->watch && !thread->exited && ioq_watch_abandon(ioq, thread)) {
+				ioq_watch_replace(thread);
+			}
+		}
+	}
+	mutex_unlock(&ioq->watch.mutex);
+
+	return NULL;
+}
+
 /** Join an I/O queue thread. */
-static void ioq_thread_join(struct ioq_thread *thread) {
-	thread_join(thread->id, NULL);
-	ioq_ring_exit(thread);
+static void ioq_thread_join(struct ioq *ioq, struct ioq_thread *thread) {
+	if (thread->watch) {
+		// Don't wait forever for a stuck request
+		mutex_lock(&ioq->watch.mutex);
+		while (!thread->exited) {
+			struct timespec ts;
+			ioq_watch_next(ioq, &ts);
+			cond_timedwait(&ioq->watch.cond, &ioq->watch.mutex, &ts);
+			if (!thread->exited && ioq_watch_abandon(ioq, thread)) {
+				break;
+			}
+		}
+		mutex_unlock(&ioq->watch.mutex);
+	}
+
+	if (!thread->detached) {
+		thread_join(thread->id, NULL);
+		ioq_ring_exit(thread);
+	}
+
+	free(thread->watch);
+	thread->watch = NULL;
 }
 
-struct ioq *ioq_create(size_t depth, size_t nthreads) {
+struct ioq *ioq_create(size_t depth, size_t nthreads, enum ioq_flags flags, struct bfs_throttle *throttle, uint64_t timeout) {
 	struct ioq *ioq = ZALLOC_FLEX(struct ioq, threads, nthreads);
 	if (!ioq) {
-		goto fail;
+		return NULL;
 	}
 
+	if (ioq_monitor_init(&ioq->park) != 0) {
+		free(ioq);
+		return NULL;
+	}
+
+	if (timeout && ioq_monitor_init(&ioq->watch) != 0) {
+		ioq_monitor_destroy(&ioq->park);
+		free(ioq);
+		return NULL;
+	}
+
+	ioq->flags = flags;
 	ioq->depth = depth;
+	ioq->limit = depth;
+	ioq->throttle = throttle;
+	ioq->timeout = timeout;
+
+#if BFS_HAS_PTHREAD_SETAFFINITY_NP
+	if (flags & IOQ_AFFINITY) {
+		// Don't pin the calling thread itself, since everything it
+		// creates later (commands, threads, other ioqs) would inherit
+		// the single-CPU mask
+		pthread_t self = pthread_self();
+		if (pthread_getaffinity_np(self, sizeof(ioq->cpus), &ioq->cpus) != 0) {
+			ioq->flags &= ~IOQ_AFFINITY;
+		}
+	}
+#endif
 
 	ARENA_INIT(&ioq->ents, struct ioq_ent);
 #if BFS_WITH_LIBURING && BFS_USE_STATX
@@ -941,12 +2069,21 @@ struct ioq *ioq_create(size_t depth, size_t nthreads) {
 		goto fail;
 	}
 
+	ioq->active = nthreads;
 	ioq->nthreads = nthreads;
 	for (size_t i = 0; i < nthreads; ++i) {
 		if (ioq_thread_create(ioq, &ioq->threads[i]) != 0) {
 			ioq->nthreads = i;
 			goto fail;
 		}
+
+		if (ioq->threads[i].watch && !ioq->watching) {
+			if (thread_create(&ioq->watchdog, NULL, ioq_watchdog, ioq) != 0) {
+				ioq->nthreads = i + 1;
+				goto fail;
+			}
+			ioq->watching = true;
+		}
 	}
 
 	return ioq;
@@ -960,11 +2097,49 @@ fail:
 }
 
 size_t ioq_capacity(const struct ioq *ioq) {
-	return ioq->depth - ioq->size;
+	if (ioq->size >= ioq->limit) {
+		return 0;
+	}
+	return ioq->limit - ioq->size;
+}
+
+size_t ioq_set_depth(struct ioq *ioq, size_t depth) {
+	if (depth > ioq->depth) {
+		depth = ioq->depth;
+	} else if (depth < 1) {
+		depth = 1;
+	}
+
+	ioq->limit = depth;
+	return depth;
+}
+
+size_t ioq_set_threads(struct ioq *ioq, size_t nthreads) {
+	if (nthreads > ioq->nthreads) {
+		nthreads = ioq->nthreads;
+	} else if (nthreads < 1 && ioq->nthreads > 0) {
+		nthreads = 1;
+	}
+
+	mutex_lock(&ioq->park.mutex);
+	size_t active = load(&ioq->active, relaxed);
+	store(&ioq->active, nthreads, relaxed);
+	if (nthreads > active) {
+		cond_broadcast(&ioq->park.cond);
+	}
+	mutex_unlock(&ioq->park.mutex);
+
+	return nthreads;
+}
+
+uint64_t ioq_idle_time(const struct ioq *ioq) {
+	return load(&ioq->idle, relaxed);
 }
 
 static struct ioq_ent *ioq_request(struct ioq *ioq, enum ioq_op op, void *ptr) {
-	if (load(&ioq->cancel, relaxed)) {
+	// Closing files is still allowed after ioq_cancel(), for teardown
+	bool close = op == IOQ_CLOSE || op == IOQ_CLOSEDIR;
+	if (!close && load(&ioq->cancel, relaxed)) {
 		errno = EINTR;
 		return NULL;
 	}
@@ -981,6 +2156,7 @@ static struct ioq_ent *ioq_request(struct ioq *ioq, enum ioq_op op, void *ptr) {
 
 	ent->op = op;
 	ent->ptr = ptr;
+	ioq_perf_submit(ioq, ent);
 	++ioq->size;
 	return ent;
 }
@@ -1013,6 +2189,21 @@ int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path,
 	return 0;
 }
 
+int ioq_readahead(struct ioq *ioq, struct bfs_dir *dir, void *buf, size_t size, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_READAHEAD, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_readahead *args = &ent->readahead;
+	args->dir = dir;
+	args->buf = buf;
+	args->size = size;
+
+	ioqq_push(ioq->pending, ent);
+	return 0;
+}
+
 int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr) {
 	struct ioq_ent *ent = ioq_request(ioq, IOQ_CLOSEDIR, ptr);
 	if (!ent) {
@@ -1025,7 +2216,7 @@ int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr) {
 	return 0;
 }
 
-int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, struct bfs_stat *buf, void *ptr) {
+int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, enum bfs_stat_field mask, struct bfs_stat *buf, void *ptr) {
 	struct ioq_ent *ent = ioq_request(ioq, IOQ_STAT, ptr);
 	if (!ent) {
 		return -1;
@@ -1035,6 +2226,7 @@ int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags fla
 	args->dfd = dfd;
 	args->path = path;
 	args->flags = flags;
+	args->mask = mask;
 	args->buf = buf;
 
 #if BFS_WITH_LIBURING && BFS_USE_STATX
@@ -1049,12 +2241,83 @@ int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags fla
 	return 0;
 }
 
+int ioq_unlink(struct ioq *ioq, int dfd, const char *path, int flags, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_UNLINK, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_unlink *args = &ent->unlink;
+	args->dfd = dfd;
+	args->path = path;
+	args->flags = flags;
+
+	ioqq_push(ioq->pending, ent);
+	return 0;
+}
+
+int ioq_probe(struct ioq *ioq, int dfd, const char *path, enum bfs_type type, enum bfs_stat_flags flags, enum bfs_fsade_check checks, struct bfs_fsade_probe *probe, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_PROBE, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_probe *args = &ent->probe;
+	args->dfd = dfd;
+	args->path = path;
+	args->type = type;
+	args->flags = flags;
+	args->checks = checks;
+	args->probe = probe;
+
+	ioqq_push(ioq->pending, ent);
+	return 0;
+}
+
+int ioq_readlink(struct ioq *ioq, int dfd, const char *path, char *buf, size_t size, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_READLINK, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_readlink *args = &ent->readlink;
+	args->dfd = dfd;
+	args->path = path;
+	args->buf = buf;
+	args->size = size;
+
+	ioqq_push(ioq->pending, ent);
+	return 0;
+}
+
 struct ioq_ent *ioq_pop(struct ioq *ioq, bool block) {
 	if (ioq->size == 0) {
 		return NULL;
 	}
 
-	return ioqq_pop(ioq->ready, block);
+	struct ioq_ent *ent = ioqq_pop_sc(ioq->ready, block);
+	if (ent) {
+		ioq_perf_pop(ent);
+	}
+	return ent;
+}
+
+size_t ioq_pop_batch(struct ioq *ioq, struct ioq_ent *batch[], size_t size, bool block) {
+	// Don't reserve more slots than there are outstanding requests
+	if (size > ioq->size) {
+		size = ioq->size;
+	}
+	if (size == 0) {
+		return 0;
+	}
+
+	size_t count = ioqq_pop_batch_sc(ioq->ready, batch, size, block);
+	for (size_t i = 0; i < count; ++i) {
+		ioq_perf_pop(batch[i]);
+	}
+
+	bfs_perf_sample(BFS_PERF_READY_DEPTH, count);
+	return count;
 }
 
 void ioq_free(struct ioq *ioq, struct ioq_ent *ent) {
@@ -1070,9 +2333,18 @@ void ioq_free(struct ioq *ioq, struct ioq_ent *ent) {
 	arena_free(&ioq->ents, ent);
 }
 
+void ioq_free_batch(struct ioq *ioq, struct ioq_ent *batch[], size_t size) {
+	for (size_t i = 0; i < size; ++i) {
+		ioq_free(ioq, batch[i]);
+	}
+}
+
 void ioq_cancel(struct ioq *ioq) {
 	if (!exchange(&ioq->cancel, true, relaxed)) {
-		ioqq_push(ioq->pending, &IOQ_STOP);
+		// Wake up any parked threads so they can cancel their requests
+		mutex_lock(&ioq->park.mutex);
+		cond_broadcast(&ioq->park.cond);
+		mutex_unlock(&ioq->park.mutex);
 	}
 }
 
@@ -1081,16 +2353,30 @@ void ioq_destroy(struct ioq *ioq) {
 		return;
 	}
 
+	// Stop the watchdog first, so ioq_thread_join() can take over
+	if (ioq->watching) {
+		mutex_lock(&ioq->watch.mutex);
+		ioq->watch_stop = true;
+		cond_broadcast(&ioq->watch.cond);
+		mutex_unlock(&ioq->watch.mutex);
+		thread_join(ioq->watchdog, NULL);
+	}
+
 	if (ioq->nthreads > 0) {
 		ioq_cancel(ioq);
+		ioqq_push(ioq->pending, &IOQ_STOP);
 	}
 
 	for (size_t i = 0; i < ioq->nthreads; ++i) {
-		ioq_thread_join(&ioq->threads[i]);
+		ioq_thread_join(ioq, &ioq->threads[i]);
 	}
 
 	ioqq_destroy(ioq->ready);
 	ioqq_destroy(ioq->pending);
+	if (ioq->timeout) {
+		ioq_monitor_destroy(&ioq->watch);
+	}
+	ioq_monitor_destroy(&ioq->park);
 
 #if BFS_WITH_LIBURING && BFS_USE_STATX
 	arena_destroy(&ioq->xbufs);
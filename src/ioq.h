@@ -9,9 +9,13 @@
 #define BFS_IOQ_H
 
 #include "dir.h"
+#include "fsade.h"
 #include "stat.h"
 
 #include <stddef.h>
+#include <stdint.h>
+
+struct bfs_throttle;
 
 /**
  * An queue of asynchronous I/O operations.
@@ -26,12 +30,25 @@ enum ioq_op {
 	IOQ_CLOSE,
 	/** ioq_opendir(). */
 	IOQ_OPENDIR,
+	/** ioq_readahead(). */
+	IOQ_READAHEAD,
 	/** ioq_closedir(). */
 	IOQ_CLOSEDIR,
 	/** ioq_stat(). */
 	IOQ_STAT,
+	/** ioq_unlink(). */
+	IOQ_UNLINK,
+	/** ioq_probe(). */
+	IOQ_PROBE,
+	/** ioq_readlink(). */
+	IOQ_READLINK,
 };
 
+/**
+ * Get the name of an I/O queue operation.
+ */
+const char *ioq_op_name(enum ioq_op op);
+
 /**
  * The I/O queue implementation needs two tag bits in each pointer to a struct
  * ioq_ent, so we need to ensure at least 4-byte alignment.  The natural
@@ -52,6 +69,13 @@ struct ioq_ent {
 	/** Arbitrary user data. */
 	void *ptr;
 
+	/** When the request was submitted (for -D perf, otherwise 0). */
+	uint64_t submitted;
+	/** When a background thread started the request. */
+	uint64_t started;
+	/** When the request finished. */
+	uint64_t finished;
+
 	/** Operation-specific arguments. */
 	union {
 		/** ioq_close() args. */
@@ -65,6 +89,12 @@ struct ioq_ent {
 			int dfd;
 			enum bfs_dir_flags flags;
 		} opendir;
+		/** ioq_readahead() args. */
+		struct ioq_readahead {
+			struct bfs_dir *dir;
+			void *buf;
+			size_t size;
+		} readahead;
 		/** ioq_closedir() args. */
 		struct ioq_closedir {
 			struct bfs_dir *dir;
@@ -76,10 +106,55 @@ struct ioq_ent {
 			void *xbuf;
 			int dfd;
 			enum bfs_stat_flags flags;
+			enum bfs_stat_field mask;
 		} stat;
+		/** ioq_unlink() args. */
+		struct ioq_unlink {
+			const char *path;
+			int dfd;
+			int flags;
+		} unlink;
+		/** ioq_probe() args. */
+		struct ioq_probe {
+			const char *path;
+			struct bfs_fsade_probe *probe;
+			int dfd;
+			enum bfs_type type;
+			enum bfs_stat_flags flags;
+			enum bfs_fsade_check checks;
+		} probe;
+		/** ioq_readlink() args. */
+		struct ioq_readlink {
+			const char *path;
+			char *buf;
+			size_t size;
+			int dfd;
+		} readlink;
 	};
 };
 
+/**
+ * ioq_create() flags.
+ */
+enum ioq_flags {
+	/** Use a kernel thread to poll for submissions, if possible. */
+	IOQ_SQPOLL   = 1 << 0,
+	/**
+	 * Pin each background thread to its own CPU (within the current
+	 * affinity mask, leaving the first one for the calling thread), if
+	 * possible.
+	 */
+	IOQ_AFFINITY = 1 << 1,
+	/** Measure how long the background threads wait for requests. */
+	IOQ_IDLE_TIME = 1 << 2,
+};
+
+/**
+ * The preferred number of entries to pop at once (one cache line's worth of
+ * queue slots).
+ */
+#define IOQ_BATCH (FALSE_SHARING_SIZE / sizeof(uintptr_t))
+
 /**
  * Create an I/O queue.
  *
@@ -87,16 +162,59 @@ struct ioq_ent {
  *         The maximum depth of the queue.
  * @param nthreads
  *         The maximum number of background threads.
+ * @param flags
+ *         Flags that control the queue implementation.
+ * @param throttle
+ *         If non-NULL, limits how fast requests are executed.
+ * @param timeout
+ *         If nonzero, how long (in nanoseconds) ioq_opendir() and ioq_stat()
+ *         requests may take before they fail with ETIMEDOUT.  Background
+ *         threads that get stuck in a request are replaced.
  * @return
  *         The new I/O queue, or NULL on failure.
  */
-struct ioq *ioq_create(size_t depth, size_t nthreads);
+struct ioq *ioq_create(size_t depth, size_t nthreads, enum ioq_flags flags, struct bfs_throttle *throttle, uint64_t timeout);
 
 /**
- * Check the remaining capacity of a queue.
+ * Check the remaining capacity of a queue, under its current in-flight limit.
  */
 size_t ioq_capacity(const struct ioq *ioq);
 
+/**
+ * Set the in-flight limit of a queue.  Lowering it below the current size
+ * doesn't cancel anything; it just leaves no capacity until enough requests
+ * have been popped.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param depth
+ *         The new limit.
+ * @return
+ *         The new limit, which is clamped to at least 1, and at most the depth
+ *         passed to ioq_create().
+ */
+size_t ioq_set_depth(struct ioq *ioq, size_t depth);
+
+/**
+ * Set how many of the background threads are active.  The rest park until
+ * they're needed again.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param nthreads
+ *         The number of threads that should be active.
+ * @return
+ *         The new number of active threads, which is clamped to at least 1,
+ *         and at most the nthreads passed to ioq_create().
+ */
+size_t ioq_set_threads(struct ioq *ioq, size_t nthreads);
+
+/**
+ * Get the total time the background threads have spent waiting for requests,
+ * in nanoseconds.  Only measured with IOQ_IDLE_TIME.
+ */
+uint64_t ioq_idle_time(const struct ioq *ioq);
+
 /**
  * Asynchronous close().
  *
@@ -131,6 +249,25 @@ int ioq_close(struct ioq *ioq, int fd, void *ptr);
  */
 int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path, enum bfs_dir_flags flags, void *ptr);
 
+/**
+ * Asynchronously read the next chunk of a directory into a buffer from
+ * bfs_dirahead().  The result should be passed to bfs_dirahead_done().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dir
+ *         The open directory to read.
+ * @param buf
+ *         The buffer to fill.
+ * @param size
+ *         The size of the buffer.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_readahead(struct ioq *ioq, struct bfs_dir *dir, void *buf, size_t size, void *ptr);
+
 /**
  * Asynchronous bfs_closedir().
  *
@@ -146,7 +283,7 @@ int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path,
 int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr);
 
 /**
- * Asynchronous bfs_stat().
+ * Asynchronous bfs_stat_mask().
  *
  * @param ioq
  *         The I/O queue.
@@ -156,6 +293,8 @@ int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr);
  *         The path to stat, relative to dfd.
  * @param flags
  *         Flags that affect the lookup.
+ * @param mask
+ *         The fields to request.
  * @param buf
  *         A place to store the stat buffer, if successful.
  * @param ptr
@@ -163,7 +302,71 @@ int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr);
  * @return
  *         0 on success, or -1 on failure.
  */
-int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, struct bfs_stat *buf, void *ptr);
+int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, enum bfs_stat_field mask, struct bfs_stat *buf, void *ptr);
+
+/**
+ * Asynchronous unlinkat().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to remove, relative to dfd.
+ * @param flags
+ *         Flags for unlinkat(), e.g. AT_REMOVEDIR.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_unlink(struct ioq *ioq, int dfd, const char *path, int flags, void *ptr);
+
+/**
+ * Asynchronous bfs_fsade_probe().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to check, relative to dfd.
+ * @param type
+ *         The type of the file, or BFS_UNKNOWN to look it up.
+ * @param flags
+ *         The bfs_stat() flags for looking up an unknown type.
+ * @param checks
+ *         The checks to do.
+ * @param probe
+ *         A place to store the results (with probe->name already set for
+ *         BFS_CHECK_XATTR_NAMED).
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_probe(struct ioq *ioq, int dfd, const char *path, enum bfs_type type, enum bfs_stat_flags flags, enum bfs_fsade_check checks, struct bfs_fsade_probe *probe, void *ptr);
+
+/**
+ * Asynchronous readlinkat().  Like readlinkat(), the target is not
+ * NUL-terminated, and may be truncated if the result is exactly size.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to the link, relative to dfd.
+ * @param buf
+ *         A place to store the link target.
+ * @param size
+ *         The size of buf.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_readlink(struct ioq *ioq, int dfd, const char *path, char *buf, size_t size, void *ptr);
 
 /**
  * Pop a response from the queue.
@@ -175,6 +378,22 @@ int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags fla
  */
 struct ioq_ent *ioq_pop(struct ioq *ioq, bool block);
 
+/**
+ * Pop a batch of responses from the queue.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param[out] batch
+ *         Will hold the popped responses.
+ * @param size
+ *         The maximum number of responses to pop (ideally IOQ_BATCH).
+ * @param block
+ *         Whether to block until at least one response is available.
+ * @return
+ *         The number of responses popped.
+ */
+size_t ioq_pop_batch(struct ioq *ioq, struct ioq_ent *batch[], size_t size, bool block);
+
 /**
  * Free a queue entry.
  *
@@ -186,7 +405,21 @@ struct ioq_ent *ioq_pop(struct ioq *ioq, bool block);
 void ioq_free(struct ioq *ioq, struct ioq_ent *ent);
 
 /**
- * Cancel any pending I/O operations.
+ * Free a batch of queue entries.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param batch
+ *         The entries to free.
+ * @param size
+ *         The number of entries.
+ */
+void ioq_free_batch(struct ioq *ioq, struct ioq_ent *batch[], size_t size);
+
+/**
+ * Cancel any pending I/O operations.  Pending and in-flight requests complete
+ * early with EINTR or ECANCELED, and new requests fail with EINTR, except for
+ * ioq_close() and ioq_closedir(), which still run normally.
  */
 void ioq_cancel(struct ioq *ioq);
 
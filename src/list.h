@@ -503,7 +503,11 @@ static inline void *slist_remove_impl(void *ret, void *cursor, void *next, size_
  *         If specified, use item->node.{prev,next} rather than item->{prev,next}.
  */
 #define LIST_PREPEND(list, ...) \
-	LIST_INSERT(list, NULL, __VA_ARGS__)
+	LIST_INSERT(list, LIST_NULL_(list), __VA_ARGS__)
+
+// A null cursor of the right type, so LIST_INSERT__() can dereference it
+#define LIST_NULL_(list) \
+	(1 ? NULL : (list)->head)
 
 /**
  * Check if an item is attached to a doubly-linked list.
@@ -37,6 +37,7 @@
  *     - mtab.[ch]     (parses the system's mount table)
  *     - pwcache.[ch]  (a cache for the user/group tables)
  *     - sanity.h      (sanitizer interfaces)
+ *     - serve.[ch]    (a resident server for repeated searches)
  *     - sighook.[ch]  (signal hooks)
  *     - stat.[ch]     (wraps stat(), or statx() on Linux)
  *     - thread.h      (multi-threading)
@@ -53,6 +54,7 @@
 #include "diag.h"
 #include "eval.h"
 #include "parse.h"
+#include "serve.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -112,14 +114,9 @@ static int open_std_streams(void) {
 }
 
 /**
- * bfs entry point.
+ * Run a command line.
  */
-int main(int argc, char *argv[]) {
-	// Make sure the standard streams are open
-	if (open_std_streams() != 0) {
-		return EXIT_FAILURE;
-	}
-
+static int bfs_main(int argc, char *argv[]) {
 	// Use the system locale instead of "C"
 	int locale_err = 0;
 	if (!setlocale(LC_ALL, "")) {
@@ -140,8 +137,14 @@ int main(int argc, char *argv[]) {
 		bfs_warning(ctx, "Failed to set locale: %s\n\n", xstrerror(locale_err));
 	}
 
-	// Walk the file system tree, evaluating the expression on each file
-	int ret = bfs_eval(ctx);
+	int ret;
+	if (ctx->serve) {
+		// Run each client's command line in a forked child
+		ret = bfs_serve(ctx, bfs_main);
+	} else {
+		// Walk the file system tree, evaluating the expression on each file
+		ret = bfs_eval(ctx);
+	}
 
 	// Free the parsed command line, and detect any last-minute errors
 	if (bfs_ctx_free(ctx) != 0 && ret == EXIT_SUCCESS) {
@@ -150,3 +153,24 @@ int main(int argc, char *argv[]) {
 
 	return ret;
 }
+
+/**
+ * bfs entry point.
+ */
+int main(int argc, char *argv[]) {
+	// Make sure the standard streams are open
+	if (open_std_streams() != 0) {
+		return EXIT_FAILURE;
+	}
+
+	// Hand the command line to a -serve process, if there is one
+	const char *server = getenv("BFS_SERVER");
+	if (server && *server) {
+		int ret = bfs_connect(server, argc, argv);
+		if (ret >= 0) {
+			return ret;
+		}
+	}
+
+	return bfs_main(argc, argv);
+}
@@ -6,15 +6,36 @@
 #include "alloc.h"
 #include "bfs.h"
 #include "bfstd.h"
+#include "idset.h"
 #include "stat.h"
 #include "trie.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
+#if !defined(BFS_USE_LISTMOUNT) && BFS_HAS_LISTMOUNT_SYSCALL
+#  define BFS_USE_LISTMOUNT true
+#endif
+
+#if !defined(BFS_USE_MOUNTINFO) && __linux__
+#  define BFS_USE_MOUNTINFO true
+#endif
+
+#if BFS_USE_LISTMOUNT
+#  include <linux/mount.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#if BFS_USE_LISTMOUNT || BFS_USE_MOUNTINFO
+#  include <stdio.h>
+#  include <sys/sysmacros.h>
+#endif
+
 #if !defined(BFS_USE_MNTENT) && BFS_HAS_GETMNTENT_1
 #  define BFS_USE_MNTENT true
 #elif !defined(BFS_USE_MNTINFO) && BFS_HAS_GETMNTINFO
@@ -46,6 +67,16 @@ struct bfs_mount {
 	char buf[];
 };
 
+/**
+ * An entry in the device table.
+ */
+struct bfs_mtab_dev {
+	/** The device ID. */
+	dev_t dev;
+	/** The filesystem type (NULL for empty slots). */
+	const char *type;
+};
+
 struct bfs_mtab {
 	/** Mount point arena. */
 	struct varena varena;
@@ -58,23 +89,91 @@ struct bfs_mtab {
 	/** The basenames of every mount point. */
 	struct trie names;
 
-	/** A map from device ID to fstype (populated lazily). */
-	struct trie types;
-	/** Whether the types map has been populated. */
+	/** Open-addressed hash table from device IDs to fstypes. */
+	struct bfs_mtab_dev *devs;
+	/** The capacity of the table (a power of two, or zero). */
+	size_t devs_cap;
+	/** The number of occupied slots. */
+	size_t ndevs;
+	/** Whether the mount points have been stat()ed to fill in the table. */
 	bool types_filled;
 };
 
+/** Hash a device ID. */
+static size_t bfs_dev_hash(dev_t dev) {
+	uint64_t hash = dev;
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xFF51AFD7ED558CCD);
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/** Find the slot for a device ID. */
+static struct bfs_mtab_dev *bfs_mtab_slot(struct bfs_mtab_dev *devs, size_t cap, dev_t dev) {
+	size_t mask = cap - 1;
+	for (size_t i = bfs_dev_hash(dev) & mask;; i = (i + 1) & mask) {
+		struct bfs_mtab_dev *slot = &devs[i];
+		if (!slot->type || slot->dev == dev) {
+			return slot;
+		}
+	}
+}
+
+/** Look up the fstype for a device ID. */
+static const char *bfs_mtab_lookup(const struct bfs_mtab *mtab, dev_t dev) {
+	if (mtab->devs_cap == 0) {
+		return NULL;
+	}
+
+	return bfs_mtab_slot(mtab->devs, mtab->devs_cap, dev)->type;
+}
+
+/**
+ * Associate a device ID with an fstype.  Later mounts replace earlier ones,
+ * since they may be mounted on top of them.
+ */
+static int bfs_mtab_set_dev(struct bfs_mtab *mtab, dev_t dev, const char *type) {
+	// Keep the load factor at most 1/2
+	if (2 * (mtab->ndevs + 1) > mtab->devs_cap) {
+		size_t cap = mtab->devs_cap ? 2 * mtab->devs_cap : 16;
+		struct bfs_mtab_dev *devs = ZALLOC_ARRAY(struct bfs_mtab_dev, cap);
+		if (!devs) {
+			return -1;
+		}
+
+		for (size_t i = 0; i < mtab->devs_cap; ++i) {
+			const struct bfs_mtab_dev *old = &mtab->devs[i];
+			if (old->type) {
+				*bfs_mtab_slot(devs, cap, old->dev) = *old;
+			}
+		}
+
+		free(mtab->devs);
+		mtab->devs = devs;
+		mtab->devs_cap = cap;
+	}
+
+	struct bfs_mtab_dev *slot = bfs_mtab_slot(mtab->devs, mtab->devs_cap, dev);
+	if (!slot->type) {
+		slot->dev = dev;
+		++mtab->ndevs;
+	}
+	slot->type = type;
+
+	return 0;
+}
+
 /**
  * Add an entry to the mount table.
  */
 _maybe_unused
-static int bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *type) {
+static struct bfs_mount *bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *type) {
 	size_t path_size = strlen(path) + 1;
 	size_t type_size = strlen(type) + 1;
 	size_t size = path_size + type_size;
 	struct bfs_mount *mount = varena_alloc(&mtab->varena, size);
 	if (!mount) {
-		return -1;
+		return NULL;
 	}
 
 	struct bfs_mount **ptr = RESERVE(struct bfs_mount *, &mtab->mounts, &mtab->nmounts);
@@ -94,16 +193,210 @@ static int bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *typ
 		goto shrink;
 	}
 
-	return 0;
+	return mount;
 
 shrink:
 	--mtab->nmounts;
 free:
 	varena_free(&mtab->varena, mount, size);
+	return NULL;
+}
+
+/**
+ * Add an entry to the mount table, along with its device ID.
+ */
+_maybe_unused
+static int bfs_mtab_add_dev(struct bfs_mtab *mtab, const char *path, const char *type, dev_t dev) {
+	struct bfs_mount *mount = bfs_mtab_add(mtab, path, type);
+	if (!mount) {
+		return -1;
+	}
+
+	return bfs_mtab_set_dev(mtab, dev, mount->type);
+}
+
+#if BFS_USE_LISTMOUNT
+
+/** The statmount() fields we need. */
+#define BFS_STATMOUNT_MASK (STATMOUNT_SB_BASIC | STATMOUNT_MNT_POINT | STATMOUNT_FS_TYPE)
+
+/**
+ * Read the mount table with listmount() and statmount() (Linux 6.8+), which
+ * avoids formatting and parsing the whole table as text.
+ */
+static int bfs_mtab_listmount(struct bfs_mtab *mtab) {
+	int ret = -1;
+
+	size_t size = 4096;
+	struct statmount *buf = malloc(size);
+	if (!buf) {
+		return -1;
+	}
+
+	struct mnt_id_req list_req = {
+		.size = MNT_ID_REQ_SIZE_VER0,
+		.mnt_id = LSMT_ROOT,
+	};
+
+	while (true) {
+		uint64_t ids[256];
+		long count = syscall(SYS_listmount, &list_req, ids, countof(ids), 0);
+		if (count < 0) {
+			goto done;
+		}
+
+		for (long i = 0; i < count; ++i) {
+			struct mnt_id_req req = {
+				.size = MNT_ID_REQ_SIZE_VER0,
+				.mnt_id = ids[i],
+				.param = BFS_STATMOUNT_MASK,
+			};
+
+			while (syscall(SYS_statmount, &req, buf, size, 0) != 0) {
+				if (errno == ENOENT) {
+					// Unmounted in the meantime
+					goto next;
+				} else if (errno != EOVERFLOW) {
+					goto done;
+				}
+
+				// Not enough space for the strings
+				size *= 2;
+				struct statmount *bigger = realloc(buf, size);
+				if (!bigger) {
+					goto done;
+				}
+				buf = bigger;
+			}
+
+			if ((buf->mask & BFS_STATMOUNT_MASK) != BFS_STATMOUNT_MASK) {
+				continue;
+			}
+
+			const char *path = buf->str + buf->mnt_point;
+			const char *type = buf->str + buf->fs_type;
+			dev_t dev = makedev(buf->sb_dev_major, buf->sb_dev_minor);
+			if (bfs_mtab_add_dev(mtab, path, type, dev) != 0) {
+				goto done;
+			}
+		next:;
+		}
+
+		if ((size_t)count < countof(ids)) {
+			break;
+		}
+		list_req.param = ids[count - 1];
+	}
+
+	ret = 0;
+done:;
+	int error = errno;
+	free(buf);
+	errno = error;
+	return ret;
+}
+
+#endif // BFS_USE_LISTMOUNT
+
+#if BFS_USE_MOUNTINFO
+
+/** Decode the octal escapes (e.g. \040 for ' ') in a mountinfo field. */
+static void bfs_mountinfo_unescape(char *str) {
+	char *out = str;
+
+	for (const char *in = str; *in; ++in) {
+		if (in[0] == '\\'
+		    && in[1] >= '0' && in[1] <= '3'
+		    && in[2] >= '0' && in[2] <= '7'
+		    && in[3] >= '0' && in[3] <= '7') {
+			*out++ = ((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0');
+			in += 3;
+		} else {
+			*out++ = *in;
+		}
+	}
+
+	*out = '\0';
+}
+
+/** Parse one line of /proc/self/mountinfo. */
+static int bfs_mountinfo_line(struct bfs_mtab *mtab, char *line) {
+	// 36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw
+	// (1)(2) (3)   (4)   (5)         (6)       (7)   (8) (9)  ...
+	char *fields[5];
+	char *state;
+	char *field = strtok_r(line, " \n", &state);
+	for (size_t i = 0; i < countof(fields); ++i) {
+		if (!field) {
+			goto invalid;
+		}
+		fields[i] = field;
+		field = strtok_r(NULL, " \n", &state);
+	}
+
+	// Skip the mount options and optional fields, up to the separator
+	while (field && strcmp(field, "-") != 0) {
+		field = strtok_r(NULL, " \n", &state);
+	}
+	if (!field) {
+		goto invalid;
+	}
+
+	char *type = strtok_r(NULL, " \n", &state);
+	if (!type) {
+		goto invalid;
+	}
+
+	unsigned int major, minor;
+	if (sscanf(fields[2], "%u:%u", &major, &minor) != 2) {
+		goto invalid;
+	}
+
+	char *path = fields[4];
+	bfs_mountinfo_unescape(path);
+	bfs_mountinfo_unescape(type);
+	return bfs_mtab_add_dev(mtab, path, type, makedev(major, minor));
+
+invalid:
+	errno = EINVAL;
 	return -1;
 }
 
-struct bfs_mtab *bfs_mtab_parse(void) {
+/**
+ * Read /proc/self/mountinfo, which (unlike /etc/mtab) has the device ID of
+ * every mount, so we don't have to stat() them.
+ */
+static int bfs_mtab_mountinfo(struct bfs_mtab *mtab) {
+	FILE *file = xfopen("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		return -1;
+	}
+
+	int ret = 0;
+	char *line = NULL;
+	size_t size = 0;
+	while (getline(&line, &size, file) >= 0) {
+		if (bfs_mountinfo_line(mtab, line) != 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret == 0 && ferror(file)) {
+		ret = -1;
+	}
+
+	int error = errno;
+	free(line);
+	fclose(file);
+	errno = error;
+	return ret;
+}
+
+#endif // BFS_USE_MOUNTINFO
+
+/** Create an empty mount table. */
+static struct bfs_mtab *bfs_mtab_new(void) {
 	struct bfs_mtab *mtab = ZALLOC(struct bfs_mtab);
 	if (!mtab) {
 		return NULL;
@@ -112,10 +405,51 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 	VARENA_INIT(&mtab->varena, struct bfs_mount, buf);
 
 	trie_init(&mtab->names);
-	trie_init(&mtab->types);
+	return mtab;
+}
+
+/** Finish parsing a mount table. */
+static struct bfs_mtab *bfs_mtab_done(struct bfs_mtab *mtab) {
+	// The names are only looked up from now on.  Freezing is just an
+	// optimization, so failure is fine.
+	trie_freeze(&mtab->names);
+	return mtab;
+}
+
+struct bfs_mtab *bfs_mtab_parse(void) {
+	struct bfs_mtab *mtab = bfs_mtab_new();
+	if (!mtab) {
+		return NULL;
+	}
 
 	int error = 0;
 
+#if BFS_USE_LISTMOUNT
+	if (bfs_mtab_listmount(mtab) == 0) {
+		return bfs_mtab_done(mtab);
+	}
+
+	// Not supported by this kernel, so start over with the fallbacks
+	bfs_mtab_free(mtab);
+	mtab = bfs_mtab_new();
+	if (!mtab) {
+		return NULL;
+	}
+#endif
+
+#if BFS_USE_MOUNTINFO
+	if (bfs_mtab_mountinfo(mtab) == 0) {
+		return bfs_mtab_done(mtab);
+	}
+
+	// No /proc, perhaps, so start over with the fallbacks
+	bfs_mtab_free(mtab);
+	mtab = bfs_mtab_new();
+	if (!mtab) {
+		return NULL;
+	}
+#endif
+
 #if BFS_USE_MNTENT
 
 	FILE *file = setmntent(_PATH_MOUNTED, "r");
@@ -130,7 +464,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	struct mntent *mnt;
 	while ((mnt = getmntent(file))) {
-		if (bfs_mtab_add(mtab, mnt->mnt_dir, mnt->mnt_type) != 0) {
+		if (!bfs_mtab_add(mtab, mnt->mnt_dir, mnt->mnt_type)) {
 			error = errno;
 			endmntent(file);
 			goto fail;
@@ -155,7 +489,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 	}
 
 	for (bfs_statfs *mnt = mntbuf; mnt < mntbuf + size; ++mnt) {
-		if (bfs_mtab_add(mtab, mnt->f_mntonname, mnt->f_fstypename) != 0) {
+		if (!bfs_mtab_add(mtab, mnt->f_mntonname, mnt->f_fstypename)) {
 			error = errno;
 			goto fail;
 		}
@@ -171,7 +505,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	struct mnttab mnt;
 	while (getmntent(file, &mnt) == 0) {
-		if (bfs_mtab_add(mtab, mnt.mnt_mountp, mnt.mnt_fstype) != 0) {
+		if (!bfs_mtab_add(mtab, mnt.mnt_mountp, mnt.mnt_fstype)) {
 			error = errno;
 			fclose(file);
 			goto fail;
@@ -187,7 +521,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 #endif
 
-	return mtab;
+	return bfs_mtab_done(mtab);
 
 fail:
 	bfs_mtab_free(mtab);
@@ -254,10 +588,7 @@ static int bfs_mtab_fill_types(struct bfs_mtab *mtab) {
 			continue;
 		}
 
-		struct trie_leaf *leaf = trie_insert_mem(&mtab->types, &sb.dev, sizeof(sb.dev));
-		if (leaf) {
-			leaf->value = mount->type;
-		} else {
+		if (bfs_mtab_set_dev(mtab, sb.dev, mount->type) != 0) {
 			goto fail;
 		}
 	}
@@ -274,27 +605,76 @@ fail:
 }
 
 const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statbuf) {
-	if (!mtab->types_filled) {
+	return bfs_dev_fstype(mtab, statbuf->dev);
+}
+
+const char *bfs_dev_fstype(const struct bfs_mtab *mtab, dev_t dev) {
+	const char *type = bfs_mtab_lookup(mtab, dev);
+
+	// Not every backend knows the device IDs, and they don't always match
+	// st_dev (e.g. btrfs subvolumes), so fall back to stat()ing every mount
+	if (!type && !mtab->types_filled) {
 		if (bfs_mtab_fill_types((struct bfs_mtab *)mtab) != 0) {
 			return NULL;
 		}
+		type = bfs_mtab_lookup(mtab, dev);
 	}
 
-	const struct trie_leaf *leaf = trie_find_mem(&mtab->types, &statbuf->dev, sizeof(statbuf->dev));
-	if (leaf) {
-		return leaf->value;
-	} else {
-		return "unknown";
-	}
+	return type ? type : "unknown";
 }
 
 bool bfs_might_be_mount(const struct bfs_mtab *mtab, const char *name) {
 	return trie_find_str(&mtab->names, name);
 }
 
+/** qsort() comparator for file IDs, by device. */
+static int bfs_mtab_id_cmp(const void *a, const void *b) {
+	const struct idset_slot *lhs = a;
+	const struct idset_slot *rhs = b;
+	return (lhs->dev > rhs->dev) - (lhs->dev < rhs->dev);
+}
+
+int bfs_mtab_shared_roots(const struct bfs_mtab *mtab, struct idset *roots) {
+	struct idset_slot *ids = ALLOC_ARRAY(struct idset_slot, mtab->nmounts);
+	if (!ids && mtab->nmounts > 0) {
+		return -1;
+	}
+
+	size_t nids = 0;
+	for (size_t i = 0; i < mtab->nmounts; ++i) {
+		struct bfs_stat buf;
+		if (bfs_stat(AT_FDCWD, mtab->mounts[i]->path, BFS_STAT_NOFOLLOW | BFS_STAT_NOSYNC, &buf) == 0) {
+			ids[nids].dev = buf.dev;
+			ids[nids].ino = buf.ino;
+			++nids;
+		}
+	}
+
+	qsort(ids, nids, sizeof(*ids), bfs_mtab_id_cmp);
+
+	int ret = 0;
+	for (size_t i = 0, j; i < nids; i = j) {
+		for (j = i + 1; j < nids && ids[j].dev == ids[i].dev; ++j);
+		if (j - i < 2) {
+			continue;
+		}
+
+		for (size_t k = i; k < j; ++k) {
+			if (idset_insert(roots, ids[k].dev, ids[k].ino) < 0) {
+				ret = -1;
+				goto done;
+			}
+		}
+	}
+
+done:
+	free(ids);
+	return ret;
+}
+
 void bfs_mtab_free(struct bfs_mtab *mtab) {
 	if (mtab) {
-		trie_destroy(&mtab->types);
+		free(mtab->devs);
 		trie_destroy(&mtab->names);
 
 		free(mtab->mounts);
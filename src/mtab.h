@@ -8,7 +8,10 @@
 #ifndef BFS_MTAB_H
 #define BFS_MTAB_H
 
+#include <sys/types.h>
+
 struct bfs_stat;
+struct idset;
 
 /**
  * A file system mount table.
@@ -36,6 +39,18 @@ struct bfs_mtab *bfs_mtab_parse(void);
  */
 const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statbuf);
 
+/**
+ * Determine the type of the file system on a device.
+ *
+ * @param mtab
+ *         The current mount table.
+ * @param dev
+ *         The device number.
+ * @return
+ *         The type of the file system, "unknown" if not known, or NULL on error.
+ */
+const char *bfs_dev_fstype(const struct bfs_mtab *mtab, dev_t dev);
+
 /**
  * Check if a file could be a mount point.
  *
@@ -48,6 +63,20 @@ const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statb
  */
 bool bfs_might_be_mount(const struct bfs_mtab *mtab, const char *name);
 
+/**
+ * Find the mount points of file systems that are mounted more than once (e.g.
+ * by bind mounts).  A bind mount has the same file ID as its source directory,
+ * so this is enough to recognize every copy of a mounted tree.
+ *
+ * @param mtab
+ *         The current mount table.
+ * @param[out] roots
+ *         The set to add the mount points' file IDs to.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_mtab_shared_roots(const struct bfs_mtab *mtab, struct idset *roots);
+
 /**
  * Free a mount table.
  */
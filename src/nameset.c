@@ -0,0 +1,217 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "nameset.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "trie.h"
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A single pattern in a name set.
+ */
+struct bfs_namepat {
+	/** The fnmatch() pattern. */
+	const char *pattern;
+	/** The fnmatch() flags. */
+	int fnm_flags;
+};
+
+/**
+ * Names longer than this are matched one pattern at a time, rather than
+ * copied to the stack.  NAME_MAX is 255 almost everywhere.
+ */
+#define NAMESET_BUF 256
+
+struct bfs_nameset {
+	/** Every pattern, in order. */
+	struct bfs_namepat *patterns;
+	/** The number of patterns. */
+	size_t npatterns;
+
+	/** Patterns that still need fnmatch(). */
+	struct bfs_namepat *globs;
+	/** The number of globs. */
+	size_t nglobs;
+
+	/** Literal names. */
+	struct trie literals;
+	/** Literal names, case-folded (-iname). */
+	struct trie folded;
+	/** Reversed literal suffixes, from patterns like '*.ext'. */
+	struct trie suffixes;
+	/** The number of literals. */
+	size_t nliterals;
+};
+
+struct bfs_nameset *bfs_nameset_new(void) {
+	struct bfs_nameset *set = ZALLOC(struct bfs_nameset);
+	if (!set) {
+		return NULL;
+	}
+
+	trie_init(&set->literals);
+	trie_init(&set->folded);
+	trie_init(&set->suffixes);
+	return set;
+}
+
+/** Check if a string is free of fnmatch() special characters. */
+static bool nameset_is_literal(const char *str, size_t len) {
+	return strcspn(str, "?*\\[") == len;
+}
+
+/** Fold the case of a string, like strcasecmp() does. */
+static void nameset_fold(char *dest, const char *src, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		dest[i] = tolower((unsigned char)src[i]);
+	}
+	dest[len] = '\0';
+}
+
+/** Reverse a string. */
+static void nameset_reverse(char *dest, const char *src, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		dest[i] = src[len - i - 1];
+	}
+	dest[len] = '\0';
+}
+
+/** Try to add a pattern to one of the tries. */
+static int nameset_add_fast(struct bfs_nameset *set, const char *pattern, int fnm_flags) {
+	size_t len = strlen(pattern);
+	if (len >= NAMESET_BUF) {
+		return 1;
+	}
+
+	char buf[NAMESET_BUF];
+	struct trie *trie;
+	if (nameset_is_literal(pattern, len)) {
+		if (fnm_flags & FNM_CASEFOLD) {
+			nameset_fold(buf, pattern, len);
+			trie = &set->folded;
+		} else {
+			memcpy(buf, pattern, len + 1);
+			trie = &set->literals;
+		}
+		++set->nliterals;
+	} else if (!fnm_flags && len > 1 && pattern[0] == '*' && nameset_is_literal(pattern + 1, len - 1)) {
+		// fnmatch() folds case one wide character at a time, so only
+		// handle case-sensitive suffixes here
+		nameset_reverse(buf, pattern + 1, len - 1);
+		trie = &set->suffixes;
+	} else {
+		return 1;
+	}
+
+	if (!trie_insert_str(trie, buf)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int bfs_nameset_add(struct bfs_nameset *set, const char *pattern, int fnm_flags) {
+	struct bfs_namepat *pat = RESERVE(struct bfs_namepat, &set->patterns, &set->npatterns);
+	if (!pat) {
+		return -1;
+	}
+	pat->pattern = pattern;
+	pat->fnm_flags = fnm_flags;
+
+	int ret = nameset_add_fast(set, pattern, fnm_flags);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	struct bfs_namepat *glob = RESERVE(struct bfs_namepat, &set->globs, &set->nglobs);
+	if (!glob) {
+		return -1;
+	}
+	*glob = *pat;
+	return 0;
+}
+
+int bfs_nameset_extend(struct bfs_nameset *set, const struct bfs_nameset *src) {
+	for (size_t i = 0; i < src->npatterns; ++i) {
+		const struct bfs_namepat *pat = &src->patterns[i];
+		if (bfs_nameset_add(set, pat->pattern, pat->fnm_flags) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+size_t bfs_nameset_size(const struct bfs_nameset *set) {
+	return set->npatterns;
+}
+
+size_t bfs_nameset_literals(const struct bfs_nameset *set) {
+	return set->nliterals;
+}
+
+/** Match a name against a single pattern. */
+static bool nameset_match_one(const struct bfs_namepat *pat, const char *name) {
+	return fnmatch(pat->pattern, name, pat->fnm_flags) == 0;
+}
+
+bool bfs_nameset_match(const struct bfs_nameset *set, const char *name) {
+	size_t len = strlen(name);
+	if (len >= NAMESET_BUF) {
+		// Too long for the stack, so match the slow way
+		for (size_t i = 0; i < set->npatterns; ++i) {
+			if (nameset_match_one(&set->patterns[i], name)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	char buf[NAMESET_BUF];
+
+	if (set->literals.root && trie_find_mem(&set->literals, name, len + 1)) {
+		return true;
+	}
+
+	if (set->folded.root) {
+		nameset_fold(buf, name, len);
+		if (trie_find_mem(&set->folded, buf, len + 1)) {
+			return true;
+		}
+	}
+
+	if (set->suffixes.root) {
+		nameset_reverse(buf, name, len);
+		if (trie_find_prefix(&set->suffixes, buf)) {
+			return true;
+		}
+	}
+
+	for (size_t i = 0; i < set->nglobs; ++i) {
+		if (nameset_match_one(&set->globs[i], name)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void bfs_nameset_free(struct bfs_nameset *set) {
+	if (!set) {
+		return;
+	}
+
+	trie_destroy(&set->suffixes);
+	trie_destroy(&set->folded);
+	trie_destroy(&set->literals);
+	free(set->globs);
+	free(set->patterns);
+	free(set);
+}
@@ -0,0 +1,75 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Sets of -name patterns that can be matched all at once.
+ */
+
+#ifndef BFS_NAMESET_H
+#define BFS_NAMESET_H
+
+#include <stddef.h>
+
+/**
+ * A set of fnmatch() patterns.
+ */
+struct bfs_nameset;
+
+/**
+ * Create an empty name set.
+ *
+ * @return
+ *         The new name set, or NULL on failure.
+ */
+struct bfs_nameset *bfs_nameset_new(void);
+
+/**
+ * Add a pattern to a name set.
+ *
+ * @param set
+ *         The name set to modify.
+ * @param pattern
+ *         The fnmatch() pattern, which must outlive the set.
+ * @param fnm_flags
+ *         The fnmatch() flags (0 or FNM_CASEFOLD).
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_nameset_add(struct bfs_nameset *set, const char *pattern, int fnm_flags);
+
+/**
+ * Add all the patterns from another name set.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_nameset_extend(struct bfs_nameset *set, const struct bfs_nameset *src);
+
+/**
+ * Get the number of patterns in a name set.
+ */
+size_t bfs_nameset_size(const struct bfs_nameset *set);
+
+/**
+ * Get the number of literal (wildcard-free) patterns in a name set.
+ */
+size_t bfs_nameset_literals(const struct bfs_nameset *set);
+
+/**
+ * Check if a name matches any pattern in a set.
+ *
+ * @param set
+ *         The name set.
+ * @param name
+ *         The file name to check.
+ * @return
+ *         Whether any pattern matched.
+ */
+bool bfs_nameset_match(const struct bfs_nameset *set, const char *name);
+
+/**
+ * Free a name set.
+ */
+void bfs_nameset_free(struct bfs_nameset *set);
+
+#endif // BFS_NAMESET_H
@@ -18,7 +18,9 @@
  * (-foo -and -bar), if both -foo and -bar are pure (no side effects), they can
  * be re-ordered to (-bar -and -foo).  This is profitable if the expected cost
  * is lower for the re-ordered expression, for example if -foo is very slow or
- * -bar is likely to return false.
+ * -bar is likely to return false.  Pure subexpressions that appear more than
+ * once are also given a shared result slot, so they're only evaluated once per
+ * file.
  *
  * -O4/-Ofast: aggressive optimizations that may affect correctness in corner
  * cases.  The main effect is to use opt->impure to determine if any side-
@@ -27,25 +29,37 @@
 
 #include "opt.h"
 
+#include "alloc.h"
 #include "bfs.h"
 #include "bfstd.h"
 #include "bftw.h"
 #include "bit.h"
 #include "color.h"
+#include "cost.h"
+#include "coproc.h"
 #include "ctx.h"
 #include "diag.h"
 #include "dir.h"
 #include "eval.h"
 #include "exec.h"
 #include "expr.h"
+#include "fsade.h"
+#include "grep.h"
 #include "list.h"
+#include "nameset.h"
+#include "printf.h"
+#include "profile.h"
 #include "pwcache.h"
+#include "xregex.h"
 #include "xspawn.h"
 
 #include <errno.h>
+#include <fnmatch.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 static char *fake_and_arg = "-and";
@@ -965,6 +979,9 @@ static struct bfs_expr *annotate_empty(struct bfs_opt *opt, struct bfs_expr *exp
 		expr->pure = true;
 	}
 
+	// readdir() is worse than stat()
+	expr->cost *= 2;
+
 	return expr;
 }
 
@@ -979,9 +996,20 @@ static struct bfs_expr *annotate_exec(struct bfs_opt *opt, struct bfs_expr *expr
 	return expr;
 }
 
+/** Annotate -coproc. */
+static struct bfs_expr *annotate_coproc(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
+	if (expr->coproc->flags & BFS_COPROC_TEST) {
+		expr->cost = 100000.0;
+	} else {
+		expr->always_true = true;
+	}
+
+	return expr;
+}
+
 /** Annotate -name/-lname/-path. */
 static struct bfs_expr *annotate_fnmatch(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
-	if (expr->literal) {
+	if (expr->glob == BFS_GLOB_LITERAL) {
 		expr->probability = 0.1;
 	} else {
 		expr->probability = 0.5;
@@ -990,6 +1018,20 @@ static struct bfs_expr *annotate_fnmatch(struct bfs_opt *opt, struct bfs_expr *e
 	return expr;
 }
 
+/** Annotate merged -i?name tests. */
+static struct bfs_expr *annotate_names(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
+	// Same estimates as annotate_fnmatch(), assuming independence
+	size_t total = bfs_nameset_size(expr->nameset);
+	size_t literals = bfs_nameset_literals(expr->nameset);
+
+	float miss = 1.0;
+	for (size_t i = 0; i < total; ++i) {
+		miss *= i < literals ? 0.9 : 0.5;
+	}
+	expr->probability = 1.0 - miss;
+	return expr;
+}
+
 /** Annotate -f?print. */
 static struct bfs_expr *annotate_fprint(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
 	const struct colors *colors = expr->cfile->colors;
@@ -1128,17 +1170,23 @@ static struct bfs_expr *annotate_visit(struct bfs_opt *opt, struct bfs_expr *exp
 		eval_flags,
 		eval_fstype,
 		eval_gid,
+		eval_grep,
+		eval_hash,
 		eval_hidden,
 		eval_inum,
 		eval_links,
 		eval_lname,
 		eval_name,
+		eval_name_from,
+		eval_names,
 		eval_newer,
 		eval_nogroup,
 		eval_nouser,
 		eval_path,
+		eval_path_from,
 		eval_perm,
 		eval_regex,
+		eval_regexes,
 		eval_samefile,
 		eval_size,
 		eval_sparse,
@@ -1161,13 +1209,17 @@ static struct bfs_expr *annotate_visit(struct bfs_opt *opt, struct bfs_expr *exp
 
 	/** Table of always-true expressions. */
 	static bfs_eval_fn *const always_true[] = {
+		eval_count,
+		eval_du,
 		eval_fls,
 		eval_fprint,
 		eval_fprint0,
 		eval_fprintf,
+		eval_fprintjson,
 		eval_fprintx,
 		eval_limit,
 		eval_prune,
+		eval_top,
 		eval_true,
 		// Non-returning
 		eval_exit,
@@ -1198,13 +1250,19 @@ static struct bfs_expr *annotate_visit(struct bfs_opt *opt, struct bfs_expr *exp
 		}
 	}
 
-	/** Table of stat-calling primaries. */
+	/**
+	 * Table of stat-calling primaries.  -fstype isn't one, since bftw()
+	 * knows the file system of most files from their parent directory.
+	 */
 	static bfs_eval_fn *const calls_stat[] = {
+		eval_chmod,
+		eval_chown,
+		eval_du,
 		eval_empty,
 		eval_flags,
 		eval_fls,
 		eval_fprintf,
-		eval_fstype,
+		eval_fprintjson,
 		eval_gid,
 		eval_inum,
 		eval_links,
@@ -1216,6 +1274,7 @@ static struct bfs_expr *annotate_visit(struct bfs_opt *opt, struct bfs_expr *exp
 		eval_size,
 		eval_sparse,
 		eval_time,
+		eval_top,
 		eval_uid,
 		eval_used,
 		eval_xattr,
@@ -1230,51 +1289,56 @@ static struct bfs_expr *annotate_visit(struct bfs_opt *opt, struct bfs_expr *exp
 		}
 	}
 
-#define FAST_COST       40.0
-#define FNMATCH_COST   400.0
-#define STAT_COST     1000.0
-#define PRINT_COST   20000.0
-
-	/** Table of expression costs. */
+	/** Table of expression cost classes. */
 	static const struct {
 		bfs_eval_fn *eval_fn;
-		float cost;
+		enum bfs_cost cost;
 	} costs[] = {
-		{eval_access,    STAT_COST},
-		{eval_acl,       STAT_COST},
-		{eval_capable,   STAT_COST},
-		{eval_empty, 2 * STAT_COST}, // readdir() is worse than stat()
-		{eval_flags,     STAT_COST},
-		{eval_fls,      PRINT_COST},
-		{eval_fprint,   PRINT_COST},
-		{eval_fprint0,  PRINT_COST},
-		{eval_fprintf,  PRINT_COST},
-		{eval_fprintx,  PRINT_COST},
-		{eval_fstype,    STAT_COST},
-		{eval_gid,       STAT_COST},
-		{eval_inum,      STAT_COST},
-		{eval_links,     STAT_COST},
-		{eval_lname,  FNMATCH_COST},
-		{eval_name,   FNMATCH_COST},
-		{eval_newer,     STAT_COST},
-		{eval_nogroup,   STAT_COST},
-		{eval_nouser,    STAT_COST},
-		{eval_path,   FNMATCH_COST},
-		{eval_perm,      STAT_COST},
-		{eval_samefile,  STAT_COST},
-		{eval_size,      STAT_COST},
-		{eval_sparse,    STAT_COST},
-		{eval_time,      STAT_COST},
-		{eval_uid,       STAT_COST},
-		{eval_used,      STAT_COST},
-		{eval_xattr,     STAT_COST},
-		{eval_xattrname, STAT_COST},
+		{eval_access,      BFS_COST_STAT},
+		{eval_acl,         BFS_COST_STAT},
+		{eval_capable,     BFS_COST_STAT},
+		{eval_du,          BFS_COST_PRINT},
+		{eval_empty,       BFS_COST_STAT},
+		{eval_flags,       BFS_COST_STAT},
+		{eval_fls,         BFS_COST_PRINT},
+		{eval_fprint,      BFS_COST_PRINT},
+		{eval_fprint0,     BFS_COST_PRINT},
+		{eval_fprintf,     BFS_COST_PRINT},
+		{eval_fprintjson,  BFS_COST_PRINT},
+		{eval_fprintx,     BFS_COST_PRINT},
+		{eval_fstype,      BFS_COST_STAT},
+		{eval_gid,         BFS_COST_STAT},
+		// Reads the whole file, so at least as slow as printing
+		{eval_grep,        BFS_COST_PRINT},
+		{eval_hash,        BFS_COST_PRINT},
+		{eval_inum,        BFS_COST_STAT},
+		{eval_links,       BFS_COST_STAT},
+		{eval_lname,       BFS_COST_FNMATCH},
+		{eval_name,        BFS_COST_FNMATCH},
+		{eval_names,       BFS_COST_FNMATCH},
+		{eval_newer,       BFS_COST_STAT},
+		{eval_nogroup,     BFS_COST_STAT},
+		{eval_nouser,      BFS_COST_STAT},
+		{eval_path,        BFS_COST_FNMATCH},
+		{eval_perm,        BFS_COST_STAT},
+		{eval_regex,       BFS_COST_REGEX},
+		{eval_regexes,     BFS_COST_REGEX},
+		{eval_samefile,    BFS_COST_STAT},
+		{eval_size,        BFS_COST_STAT},
+		{eval_sparse,      BFS_COST_STAT},
+		{eval_time,        BFS_COST_STAT},
+		{eval_top,         BFS_COST_STAT},
+		{eval_uid,         BFS_COST_STAT},
+		{eval_used,        BFS_COST_STAT},
+		{eval_xattr,       BFS_COST_STAT},
+		{eval_xattrname,   BFS_COST_STAT},
 	};
 
-	expr->cost = FAST_COST;
+	const float *class_costs = opt->ctx->costs;
+	expr->cost = class_costs[BFS_COST_FAST];
 	for (size_t i = 0; i < countof(costs); ++i) {
 		if (expr->eval_fn == costs[i].eval_fn) {
-			expr->cost = costs[i].cost;
+			expr->cost = class_costs[costs[i].cost];
 			break;
 		}
 	}
@@ -1290,6 +1354,8 @@ static struct bfs_expr *annotate_visit(struct bfs_opt *opt, struct bfs_expr *exp
 		{eval_capable,   0.000002},
 		{eval_empty,     0.01},
 		{eval_false,     0.0},
+		{eval_grep,      0.1},
+		{eval_hash,      0.01},
 		{eval_hidden,    0.01},
 		{eval_nogroup,   0.01},
 		{eval_nouser,    0.01},
@@ -1310,6 +1376,29 @@ static struct bfs_expr *annotate_visit(struct bfs_opt *opt, struct bfs_expr *exp
 	return expr;
 }
 
+/** Annotate -i?regex. */
+static struct bfs_expr *annotate_regex(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
+	// Most paths fail the required literal check, which is much cheaper
+	// than running the regex engine
+	if (bfs_regex_literal(expr->regex) > 0) {
+		expr->cost = opt->ctx->costs[BFS_COST_FNMATCH];
+		expr->probability = 0.1;
+	}
+
+	return expr;
+}
+
+/** Annotate merged -i?regex tests. */
+static struct bfs_expr *annotate_regexes(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
+	// One regex scan, but more likely to match, assuming independence
+	float miss = 1.0;
+	for (size_t i = 0; i < bfs_regex_patterns(expr->regex); ++i) {
+		miss *= 0.5;
+	}
+	expr->probability = 1.0 - miss;
+	return expr;
+}
+
 /**
  * Annotating visitor.
  */
@@ -1318,12 +1407,16 @@ static const struct visitor annotate = {
 	.visit = annotate_visit,
 	.table = (const struct visitor_table[]) {
 		{eval_access, annotate_access},
+		{eval_coproc, annotate_coproc},
 		{eval_empty, annotate_empty},
 		{eval_exec, annotate_exec},
 		{eval_fprint, annotate_fprint},
 		{eval_lname, annotate_fnmatch},
 		{eval_name, annotate_fnmatch},
+		{eval_names, annotate_names},
 		{eval_path, annotate_fnmatch},
+		{eval_regex, annotate_regex},
+		{eval_regexes, annotate_regexes},
 		{eval_type, annotate_type},
 		{eval_xtype, annotate_xtype},
 
@@ -1588,11 +1681,29 @@ static struct bfs_expr *reorder_andor(struct bfs_opt *opt, struct bfs_expr *expr
 	return visit_shallow(opt, expr, &annotate);
 }
 
+/** Use measured costs from -load-profile, if available. */
+static struct bfs_expr *reorder_measured(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
+	const struct bfs_profile *profile = opt->ctx->profile;
+	if (!profile || bfs_expr_is_parent(expr)) {
+		return expr;
+	}
+
+	float cost, probability;
+	if (bfs_profile_lookup(profile, expr, &cost, &probability)) {
+		// The built-in costs are roughly in nanoseconds too
+		expr->cost = cost;
+		expr->probability = probability;
+	}
+
+	return expr;
+}
+
 /**
  * Reordering visitor.
  */
 static const struct visitor reorder = {
 	.name = "reorder",
+	.visit = reorder_measured,
 	.table = (const struct visitor_table[]) {
 		{eval_and, reorder_andor},
 		{eval_or, reorder_andor},
@@ -2063,6 +2174,252 @@ static struct bfs_expr *simplify_and(struct bfs_opt *opt, struct bfs_expr *expr,
 	return lift_andor_not(opt, expr);
 }
 
+/** The minimum number of patterns worth merging into a name set. */
+#define NAMESET_MIN 4
+
+/** Check for a (possibly merged) -i?name test. */
+static bool is_name_test(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_name || expr->eval_fn == eval_names;
+}
+
+/** Merge a run of -i?name tests into a single name set. */
+static struct bfs_expr *merge_names(struct bfs_opt *opt, const struct bfs_exprs *run) {
+	size_t argc = 0;
+	for (struct bfs_expr *child = run->head; child; child = child->next) {
+		if (argc > 0) {
+			++argc;
+		}
+		argc += child->argc;
+	}
+
+	char **argv = ALLOC_ARRAY(char *, argc);
+	if (!argv) {
+		return NULL;
+	}
+
+	struct bfs_expr *expr = bfs_expr_new(opt->ctx, eval_names, argc, argv, BFS_TEST);
+	if (!expr) {
+		free(argv);
+		return NULL;
+	}
+
+	// From here on, bfs_expr_clear() owns argv and the name set
+	expr->nameset = bfs_nameset_new();
+	if (!expr->nameset) {
+		return NULL;
+	}
+
+	size_t i = 0;
+	for (struct bfs_expr *child = run->head; child; child = child->next) {
+		if (i > 0) {
+			argv[i++] = fake_or_arg;
+		}
+		for (size_t j = 0; j < child->argc; ++j) {
+			argv[i++] = child->argv[j];
+		}
+
+		int ret;
+		if (child->eval_fn == eval_names) {
+			ret = bfs_nameset_extend(expr->nameset, child->nameset);
+		} else {
+			ret = bfs_nameset_add(expr->nameset, child->pattern, child->fnm_flags);
+		}
+		if (ret != 0) {
+			return NULL;
+		}
+	}
+
+	return visit_shallow(opt, expr, &annotate);
+}
+
+/** Append a run of -i?name tests to a disjunction, merging them if worthwhile. */
+static int flush_names(struct bfs_opt *opt, struct bfs_expr *expr, struct bfs_exprs *run, size_t npatterns) {
+	struct bfs_expr *child = run->head;
+	if (npatterns >= NAMESET_MIN && child->next) {
+		child = merge_names(opt, run);
+		if (!child) {
+			return -1;
+		}
+		opt_debug(opt, "merged %zu patterns: %pe\n", npatterns, child);
+		bfs_expr_append(expr, child);
+	} else {
+		while ((child = SLIST_POP(run))) {
+			bfs_expr_append(expr, child);
+		}
+	}
+
+	SLIST_INIT(run);
+	return 0;
+}
+
+/** Merge runs of adjacent -i?name tests in a disjunction. */
+static struct bfs_expr *merge_or_names(struct bfs_opt *opt, struct bfs_expr *expr) {
+	struct bfs_exprs children;
+	foster_children(expr, &children);
+
+	struct bfs_exprs run;
+	SLIST_INIT(&run);
+	size_t npatterns = 0;
+
+	struct bfs_expr *child;
+	while ((child = SLIST_POP(&children))) {
+		if (is_name_test(child)) {
+			SLIST_APPEND(&run, child);
+			if (child->eval_fn == eval_names) {
+				npatterns += bfs_nameset_size(child->nameset);
+			} else {
+				++npatterns;
+			}
+			continue;
+		}
+
+		if (!SLIST_EMPTY(&run)) {
+			if (flush_names(opt, expr, &run, npatterns) != 0) {
+				return NULL;
+			}
+			npatterns = 0;
+		}
+		bfs_expr_append(expr, child);
+	}
+
+	if (!SLIST_EMPTY(&run)) {
+		if (flush_names(opt, expr, &run, npatterns) != 0) {
+			return NULL;
+		}
+	}
+
+	if (!bfs_expr_children(expr)->next) {
+		opt_debug(opt, "unary identity\n");
+		return only_child(expr);
+	}
+
+	return expr;
+}
+
+/** The minimum number of patterns worth merging into one regex. */
+#define REGEXSET_MIN 4
+
+/** Check for a (possibly merged) -i?regex test that could be merged. */
+static bool is_unionable_regex(const struct bfs_expr *expr, const struct bfs_exprs *run) {
+	if (expr->eval_fn != eval_regex && expr->eval_fn != eval_regexes) {
+		return false;
+	}
+
+	const struct bfs_regex *first = run->head ? run->head->regex : expr->regex;
+	return bfs_regex_unionable(first, expr->regex);
+}
+
+/** Merge a run of -i?regex tests into a single regex. */
+static struct bfs_expr *merge_regexes(struct bfs_opt *opt, const struct bfs_exprs *run, size_t nregexes) {
+	size_t argc = 0;
+	for (struct bfs_expr *child = run->head; child; child = child->next) {
+		if (argc > 0) {
+			++argc;
+		}
+		argc += child->argc;
+	}
+
+	char **argv = ALLOC_ARRAY(char *, argc);
+	if (!argv) {
+		return NULL;
+	}
+
+	struct bfs_expr *expr = bfs_expr_new(opt->ctx, eval_regexes, argc, argv, BFS_TEST);
+	if (!expr) {
+		free(argv);
+		return NULL;
+	}
+
+	// From here on, bfs_expr_clear() owns argv and the regex
+	struct bfs_regex **regexes = ALLOC_ARRAY(struct bfs_regex *, nregexes);
+	if (!regexes) {
+		return NULL;
+	}
+
+	size_t i = 0, j = 0;
+	for (struct bfs_expr *child = run->head; child; child = child->next) {
+		if (i > 0) {
+			argv[i++] = fake_or_arg;
+		}
+		for (size_t k = 0; k < child->argc; ++k) {
+			argv[i++] = child->argv[k];
+		}
+		regexes[j++] = child->regex;
+	}
+
+	int ret = bfs_regunion(&expr->regex, regexes, nregexes);
+	free(regexes);
+	if (ret != 0) {
+		return NULL;
+	}
+
+	return visit_shallow(opt, expr, &annotate);
+}
+
+/** Append a run of -i?regex tests to a disjunction, merging them if worthwhile. */
+static void flush_regexes(struct bfs_opt *opt, struct bfs_expr *expr, struct bfs_exprs *run, size_t nregexes) {
+	struct bfs_expr *child = NULL;
+	size_t npatterns = 0;
+	for_slist (struct bfs_expr, regex, run) {
+		npatterns += bfs_regex_patterns(regex->regex);
+	}
+
+	if (npatterns >= REGEXSET_MIN && nregexes > 1) {
+		child = merge_regexes(opt, run, nregexes);
+		if (child) {
+			opt_debug(opt, "merged %zu patterns: %pe\n", npatterns, child);
+			bfs_expr_append(expr, child);
+		} else {
+			// Not fatal, we can always evaluate them one at a time
+			opt_debug(opt, "couldn't merge %zu patterns: %s\n", npatterns, errstr());
+		}
+	}
+
+	if (!child) {
+		while ((child = SLIST_POP(run))) {
+			bfs_expr_append(expr, child);
+		}
+	}
+
+	SLIST_INIT(run);
+}
+
+/** Merge runs of adjacent -i?regex tests in a disjunction. */
+static struct bfs_expr *merge_or_regexes(struct bfs_opt *opt, struct bfs_expr *expr) {
+	struct bfs_exprs children;
+	foster_children(expr, &children);
+
+	struct bfs_exprs run;
+	SLIST_INIT(&run);
+	size_t nregexes = 0;
+
+	struct bfs_expr *child;
+	while ((child = SLIST_POP(&children))) {
+		if (!SLIST_EMPTY(&run) && !is_unionable_regex(child, &run)) {
+			flush_regexes(opt, expr, &run, nregexes);
+			nregexes = 0;
+		}
+
+		if (is_unionable_regex(child, &run)) {
+			SLIST_APPEND(&run, child);
+			++nregexes;
+		} else {
+			bfs_expr_append(expr, child);
+		}
+	}
+
+	if (!SLIST_EMPTY(&run)) {
+		flush_regexes(opt, expr, &run, nregexes);
+	}
+
+	if (!bfs_expr_children(expr)->next) {
+		opt_debug(opt, "unary identity\n");
+		return only_child(expr);
+	}
+
+	return expr;
+}
+
 /** Simplify a disjunction. */
 static struct bfs_expr *simplify_or(struct bfs_opt *opt, struct bfs_expr *expr, const struct visitor *visitor) {
 	struct bfs_expr *ignorable = first_ignorable(opt, expr);
@@ -2109,6 +2466,18 @@ static struct bfs_expr *simplify_or(struct bfs_opt *opt, struct bfs_expr *expr,
 		return only_child(expr);
 	}
 
+	if (opt->level >= 2) {
+		expr = merge_or_names(opt, expr);
+		if (!expr || expr->eval_fn != eval_or) {
+			return expr;
+		}
+
+		expr = merge_or_regexes(opt, expr);
+		if (expr->eval_fn != eval_or) {
+			return expr;
+		}
+	}
+
 	return lift_andor_not(opt, expr);
 }
 
@@ -2253,104 +2622,1316 @@ static bool calls_stat(const struct bfs_expr *expr) {
 	return expr->calls_stat;
 }
 
+/** Estimate the odds that a matching expression will be evaluated for a file. */
+static float estimate_file_odds(struct bfs_ctx *ctx, expr_pred *pred) {
+	float nonmatch_odds = 1.0 - estimate_odds(ctx->exclude, pred);
+
+	float reached_odds = 1.0 - ctx->exclude->probability;
+	float expr_odds = estimate_odds(ctx->expr, pred);
+	nonmatch_odds *= 1.0 - reached_odds * expr_odds;
+
+	return 1.0 - nonmatch_odds;
+}
+
 /** Estimate the odds of calling stat(). */
 static float estimate_stat_odds(struct bfs_ctx *ctx) {
 	if (ctx->unique) {
 		return 1.0;
 	}
 
-	float nostat_odds = 1.0 - estimate_odds(ctx->exclude, calls_stat);
-
-	float reached_odds = 1.0 - ctx->exclude->probability;
-	float expr_odds = estimate_odds(ctx->expr, calls_stat);
-	nostat_odds *= 1.0 - reached_odds * expr_odds;
+	return estimate_file_odds(ctx, calls_stat);
+}
 
-	return 1.0 - nostat_odds;
+/** Whether an expression checks for ACLs. */
+static bool checks_acl(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_acl || expr->eval_fn == eval_fls;
 }
 
-/** Matches -(exec|ok) ... \; */
-static bool single_exec(const struct bfs_expr *expr) {
-	return expr->eval_fn == eval_exec && !(expr->exec->flags & BFS_EXEC_MULTI);
+/** Whether an expression checks for capabilities. */
+static bool checks_capabilities(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_capable;
 }
 
-int bfs_optimize(struct bfs_ctx *ctx) {
-	bfs_ctx_dump(ctx, DEBUG_OPT);
+/** Whether an expression checks for xattrs. */
+static bool checks_xattrs(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_xattr;
+}
 
-	struct df_domain impure;
-	df_init_bottom(&impure);
+/** Whether an expression checks for a named xattr. */
+static bool checks_xattr_named(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_xattrname;
+}
 
-	struct bfs_opt opt = {
-		.ctx = ctx,
-		.level = ctx->optlevel,
-		.depth = 0,
-		.warn = ctx->warn,
-		.ignore_result = false,
-		.impure = &impure,
-	};
-	df_init_top(&opt.before);
+/** Find the xattr name that every -xattrname uses, if there's only one. */
+static bool find_xattr_name(const struct bfs_expr *expr, const char **name) {
+	if (expr->eval_fn == eval_xattrname) {
+		const char *arg = expr->argv[1];
+		if (*name && strcmp(*name, arg) != 0) {
+			return false;
+		}
+		*name = arg;
+	}
 
-	ctx->exclude = optimize(&opt, ctx->exclude);
-	if (!ctx->exclude) {
-		return -1;
+	for_expr (child, expr) {
+		if (!find_xattr_name(child, name)) {
+			return false;
+		}
 	}
 
-	// Only non-excluded files are evaluated
-	opt.before = opt.after_false;
-	opt.ignore_result = true;
+	return true;
+}
 
-	struct df_range *depth = &opt.before.ranges[DEPTH_RANGE];
-	if (ctx->mindepth > 0) {
-		constrain_min(depth, ctx->mindepth);
-	}
-	if (ctx->maxdepth < INT_MAX) {
-		constrain_max(depth, ctx->maxdepth);
-	}
+/** Get the hash algorithms that an expression uses, as a bitmask. */
+static unsigned int expr_hashes(const struct bfs_expr *expr) {
+	unsigned int ret = 0;
 
-	ctx->expr = optimize(&opt, ctx->expr);
-	if (!ctx->expr) {
-		return -1;
+	if (expr->eval_fn == eval_hash) {
+		ret |= 1U << expr->hash_algo;
+	} else if (expr->eval_fn == eval_fprintf) {
+		ret |= bfs_printf_hashes(expr->printf);
 	}
 
-	if (opt.level >= 2 && df_is_bottom(&impure)) {
-		bfs_warning(ctx, "This command won't do anything.\n\n");
+	for_expr (child, expr) {
+		ret |= expr_hashes(child);
 	}
 
-	const struct df_range *impure_depth = &impure.ranges[DEPTH_RANGE];
-	long long mindepth = impure_depth->min;
-	long long maxdepth = impure_depth->max;
+	return ret;
+}
 
-	opt_enter(&opt, "post-process:\n");
+/** Whether an expression hashes file contents. */
+static bool checks_hash(const struct bfs_expr *expr) {
+	return expr_hashes(expr) != 0;
+}
 
-	if (opt.level >= 2 && mindepth > ctx->mindepth) {
-		if (mindepth > INT_MAX) {
-			mindepth = INT_MAX;
+/** Whether an expression searches file contents. */
+static bool checks_grep(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_grep;
+}
+
+/** Find the search that every -grep does, if there's only one. */
+static bool find_grep(const struct bfs_expr *expr, const struct bfs_grep **grep) {
+	if (expr->eval_fn == eval_grep) {
+		if (*grep && !bfs_grep_equal(*grep, expr->grep)) {
+			return false;
 		}
-		opt_enter(&opt, "${blu}-mindepth${rs} ${bld}%d${rs}\n", ctx->mindepth);
-		ctx->mindepth = mindepth;
-		opt_leave(&opt, "${blu}-mindepth${rs} ${bld}%d${rs}\n", ctx->mindepth);
+		*grep = expr->grep;
 	}
 
-	if (opt.level >= 4 && maxdepth < ctx->maxdepth) {
-		if (maxdepth < INT_MIN) {
-			maxdepth = INT_MIN;
+	for_expr (child, expr) {
+		if (!find_grep(child, grep)) {
+			return false;
 		}
-		opt_enter(&opt, "${blu}-maxdepth${rs} ${bld}%d${rs}\n", ctx->maxdepth);
-		ctx->maxdepth = maxdepth;
-		opt_leave(&opt, "${blu}-maxdepth${rs} ${bld}%d${rs}\n", ctx->maxdepth);
 	}
 
-	if (opt.level >= 3) {
-		// bfs_eval() can do lazy stat() calls, but only on one thread.
-		float lazy_cost = estimate_stat_odds(ctx);
-		// bftw() can do eager stat() calls in parallel
-		float eager_cost = 1.0 / ctx->threads;
+	return true;
+}
 
-		if (eager_cost <= lazy_cost) {
-			opt_enter(&opt, "lazy stat cost: ${ylw}%g${rs}\n", lazy_cost);
+/** Decide which fsade checks bftw() should do ahead of time. */
+static void optimize_fsade_checks(struct bfs_opt *opt, struct bfs_ctx *ctx, float eager_cost) {
+	static const struct {
+		enum bfs_fsade_check check;
+		expr_pred *pred;
+		const char *name;
+		bool supported;
+	} checks[] = {
+		{BFS_CHECK_ACL, checks_acl, "acl", BFS_CAN_CHECK_ACL},
+		{BFS_CHECK_CAPABILITIES, checks_capabilities, "capable", BFS_CAN_CHECK_CAPABILITIES},
+		{BFS_CHECK_XATTRS, checks_xattrs, "xattr", BFS_CAN_CHECK_XATTRS},
+		{BFS_CHECK_XATTR_NAMED, checks_xattr_named, "xattrname", BFS_CAN_CHECK_XATTRS},
+		{BFS_CHECK_HASH, checks_hash, "hash", true},
+		{BFS_CHECK_GREP, checks_grep, "grep", true},
+	};
+
+	const char *xattr = NULL;
+	if (!find_xattr_name(ctx->exclude, &xattr) || !find_xattr_name(ctx->expr, &xattr)) {
+		xattr = NULL;
+	}
+
+	const struct bfs_grep *grep = NULL;
+	if (!find_grep(ctx->exclude, &grep) || !find_grep(ctx->expr, &grep)) {
+		grep = NULL;
+	}
+
+	// bftw() can only compute one digest per file
+	unsigned int hashes = expr_hashes(ctx->exclude) | expr_hashes(ctx->expr);
+	bool one_hash = has_single_bit(hashes);
+
+	for (size_t i = 0; i < countof(checks); ++i) {
+		if (!checks[i].supported) {
+			continue;
+		} else if (checks[i].check == BFS_CHECK_XATTR_NAMED && !xattr) {
+			continue;
+		} else if (checks[i].check == BFS_CHECK_HASH && !one_hash) {
+			continue;
+		} else if (checks[i].check == BFS_CHECK_GREP && !grep) {
+			continue;
+		}
+
+		float lazy_cost = estimate_file_odds(ctx, checks[i].pred);
+		if (lazy_cost > 0.0 && eager_cost <= lazy_cost) {
+			opt_enter(opt, "lazy ${blu}-%s${rs} cost: ${ylw}%g${rs}\n", checks[i].name, lazy_cost);
+			ctx->fsade_checks |= checks[i].check;
+			opt_leave(opt, "eager ${blu}-%s${rs} cost: ${ylw}%g${rs}\n", checks[i].name, eager_cost);
+		}
+	}
+
+	if (ctx->fsade_checks & BFS_CHECK_XATTR_NAMED) {
+		ctx->fsade_xattr = xattr;
+	}
+
+	if (ctx->fsade_checks & BFS_CHECK_HASH) {
+		ctx->fsade_hash = trailing_zeros(hashes);
+	}
+
+	if (ctx->fsade_checks & BFS_CHECK_GREP) {
+		ctx->fsade_grep = grep;
+	}
+}
+
+/** Get the timestamp fields that an expression uses. */
+static enum bfs_stat_field expr_stat_times(const struct bfs_expr *expr) {
+	enum bfs_stat_field ret = 0;
+
+	if (expr->eval_fn == eval_newer || expr->eval_fn == eval_time) {
+		ret |= expr->stat_field;
+	} else if (expr->eval_fn == eval_used) {
+		ret |= BFS_STAT_ATIME | BFS_STAT_CTIME;
+	} else if (expr->eval_fn == eval_fls) {
+		ret |= BFS_STAT_MTIME;
+	} else if (expr->eval_fn == eval_fprintjson) {
+		ret |= BFS_STAT_ATIME | BFS_STAT_MTIME | BFS_STAT_CTIME;
+	} else if (expr->eval_fn == eval_fprintf) {
+		ret |= bfs_printf_stat_times(expr->printf);
+	} else if (expr->eval_fn == eval_top) {
+		ret |= expr->top_field & BFS_STAT_TIMES;
+	}
+
+	for_expr (child, expr) {
+		ret |= expr_stat_times(child);
+	}
+
+	return ret;
+}
+
+/** The most guard tests that a path_guard can hold. */
+#define PATH_GUARD_MAX 8
+
+/**
+ * A conservative approximation of a set of paths: every path in the set
+ * matches at least one of the given guard tests (e.g. -path).
+ */
+struct path_guard {
+	/** Whether the set may contain any path at all. */
+	bool any;
+	/** The number of tests. */
+	size_t ntests;
+	/** The tests themselves. */
+	const struct bfs_expr *tests[PATH_GUARD_MAX];
+};
+
+/** The set of all paths. */
+static const struct path_guard guard_any = {.any = true};
+/** The empty set. */
+static const struct path_guard guard_none = {.any = false};
+
+/** Get the literal prefix that every path matching a test must have. */
+static bool path_prefix(const struct bfs_expr *expr, struct bfs_prefix *prefix) {
+	if (expr->eval_fn == eval_path) {
+		const char *pattern = expr->pattern;
+		size_t len = strcspn(pattern, "*?[\\");
+
+		prefix->casefold = false;
+#ifdef FNM_CASEFOLD
+		prefix->casefold = expr->fnm_flags & FNM_CASEFOLD;
+#endif
+		if (prefix->casefold) {
+			// Only ASCII letters are folded consistently with fnmatch()
+			for (size_t i = 0; i < len; ++i) {
+				if ((unsigned char)pattern[i] >= 0x80) {
+					len = i;
+					break;
+				}
+			}
+		}
+
+		prefix->str = pattern;
+		prefix->len = len;
+	} else if (expr->eval_fn == eval_regex) {
+		prefix->len = bfs_regex_prefix(expr->regex, &prefix->str);
+		prefix->casefold = false;
+	} else {
+		return false;
+	}
+
+	return prefix->len > 0;
+}
+
+/** Check whether a test has a literal path prefix. */
+static bool has_path_prefix(const struct bfs_expr *expr) {
+	struct bfs_prefix prefix;
+	return path_prefix(expr, &prefix);
+}
+
+/** Over-approximate the union of two path sets. */
+static void guard_union(struct path_guard *dest, const struct path_guard *src) {
+	if (dest->any) {
+		return;
+	}
+
+	if (src->any || dest->ntests + src->ntests > PATH_GUARD_MAX) {
+		*dest = guard_any;
+		return;
+	}
+
+	for (size_t i = 0; i < src->ntests; ++i) {
+		dest->tests[dest->ntests++] = src->tests[i];
+	}
+}
+
+/** Over-approximate the intersection of two path sets. */
+static struct path_guard guard_meet(const struct path_guard *a, const struct path_guard *b) {
+	if (a->any) {
+		return *b;
+	} else if (b->any) {
+		return *a;
+	} else if (a->ntests <= b->ntests) {
+		return *a;
+	} else {
+		return *b;
+	}
+}
+
+/** Whether an expression has side effects. */
+static bool is_impure(const struct bfs_expr *expr) {
+	return !expr->pure;
+}
+
+/**
+ * Find the paths where an expression could evaluate a test matching
+ * is_effect() (e.g. one with side effects), and the paths it could return true
+ * or false for, in terms of the tests matching is_guard().
+ */
+static void path_guards(const struct bfs_expr *expr, expr_pred *is_guard, expr_pred *is_effect, struct path_guard *impure, struct path_guard *on_true, struct path_guard *on_false) {
+	if (!bfs_expr_is_parent(expr)) {
+		*impure = is_effect(expr) ? guard_any : guard_none;
+		*on_true = expr->always_false ? guard_none : guard_any;
+		*on_false = expr->always_true ? guard_none : guard_any;
+
+		if (!on_true->any || !is_guard(expr)) {
+			return;
+		}
+
+		on_true->any = false;
+		on_true->ntests = 1;
+		on_true->tests[0] = expr;
+		return;
+	}
+
+	if (expr->eval_fn == eval_not) {
+		path_guards(bfs_expr_children(expr), is_guard, is_effect, impure, on_false, on_true);
+		return;
+	}
+
+	*impure = guard_none;
+	*on_true = guard_none;
+	*on_false = guard_none;
+
+	// The paths that reach the current child
+	struct path_guard reach = guard_any;
+
+	for_expr (child, expr) {
+		struct path_guard child_impure, child_true, child_false;
+		path_guards(child, is_guard, is_effect, &child_impure, &child_true, &child_false);
+
+		child_impure = guard_meet(&reach, &child_impure);
+		guard_union(impure, &child_impure);
+
+		if (expr->eval_fn == eval_and) {
+			child_false = guard_meet(&reach, &child_false);
+			guard_union(on_false, &child_false);
+			reach = guard_meet(&reach, &child_true);
+		} else if (expr->eval_fn == eval_or) {
+			child_true = guard_meet(&reach, &child_true);
+			guard_union(on_true, &child_true);
+			reach = guard_meet(&reach, &child_false);
+		} else {
+			*on_true = child_true;
+			*on_false = child_false;
+		}
+	}
+
+	if (expr->eval_fn == eval_and) {
+		*on_true = reach;
+	} else if (expr->eval_fn == eval_or) {
+		*on_false = reach;
+	}
+}
+
+/** Get a literal that paths matching a test must have, for -S best. */
+static bool path_goal(const struct bfs_expr *expr, struct bfs_goal *goal) {
+	struct bfs_prefix prefix;
+	if (path_prefix(expr, &prefix)) {
+		goal->str = prefix.str;
+		goal->len = prefix.len;
+		goal->path = true;
+		goal->casefold = prefix.casefold;
+		return true;
+	}
+
+	if (expr->eval_fn != eval_name) {
+		return false;
+	}
+
+	// Use the longest run of literal characters in the pattern
+	const char *pattern = expr->pattern;
+	goal->str = pattern;
+	goal->len = 0;
+	goal->path = false;
+	goal->casefold = false;
+#ifdef FNM_CASEFOLD
+	goal->casefold = expr->fnm_flags & FNM_CASEFOLD;
+#endif
+
+	for (const char *str = pattern; *str;) {
+		size_t len = strcspn(str, "*?[\\");
+		if (len > goal->len) {
+			goal->str = str;
+			goal->len = len;
+		}
+
+		str += len;
+		if (*str == '[') {
+			const char *end = strchr(str + 2, ']');
+			str = end ? end + 1 : str + strlen(str);
+		} else if (*str == '\\' && str[1]) {
+			str += 2;
+		} else if (*str) {
+			++str;
+		}
+	}
+
+	return goal->len > 0;
+}
+
+/** Check whether a test has a literal for -S best. */
+static bool has_path_goal(const struct bfs_expr *expr) {
+	struct bfs_goal goal;
+	return path_goal(expr, &goal);
+}
+
+/** Find what -S best should search towards. */
+static int find_goals(struct bfs_opt *opt, struct bfs_ctx *ctx) {
+	struct path_guard impure, on_true, on_false;
+	path_guards(ctx->expr, has_path_goal, is_impure, &impure, &on_true, &on_false);
+	if (impure.any || impure.ntests == 0) {
+		return 0;
+	}
+
+	ctx->goals = ALLOC_ARRAY(struct bfs_goal, impure.ntests);
+	if (!ctx->goals) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < impure.ntests; ++i) {
+		const struct bfs_expr *test = impure.tests[i];
+		bfs_verify(path_goal(test, &ctx->goals[i]));
+		opt_visit(opt, "searching towards %pe\n", test);
+	}
+	ctx->ngoals = impure.ntests;
+
+	return 0;
+}
+
+/** Only descend into directories that could contain paths with side effects. */
+static int limit_paths(struct bfs_opt *opt, struct bfs_ctx *ctx) {
+	struct path_guard impure, on_true, on_false;
+
+	// The exclusions are evaluated everywhere
+	path_guards(ctx->exclude, has_path_prefix, is_impure, &impure, &on_true, &on_false);
+	if (impure.any || impure.ntests > 0) {
+		return 0;
+	}
+
+	path_guards(ctx->expr, has_path_prefix, is_impure, &impure, &on_true, &on_false);
+	if (impure.any || impure.ntests == 0) {
+		return 0;
+	}
+
+	ctx->prefixes = ALLOC_ARRAY(struct bfs_prefix, impure.ntests);
+	if (!ctx->prefixes) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < impure.ntests; ++i) {
+		const struct bfs_expr *test = impure.tests[i];
+		bfs_verify(path_prefix(test, &ctx->prefixes[i]));
+		opt_visit(opt, "only descending towards %pe\n", test);
+	}
+	ctx->nprefixes = impure.ntests;
+
+	return 0;
+}
+
+/**
+ * Find the names of the files that could need stat(), so bftw() can prefetch
+ * just the files that will likely use it.
+ *
+ * @param lazy_cost
+ *         The odds that any file will need stat().
+ * @param eager_cost
+ *         The relative cost of an eager stat().
+ */
+static int find_stat_guards(struct bfs_opt *opt, struct bfs_ctx *ctx, float lazy_cost, float eager_cost) {
+	if (ctx->unique || lazy_cost <= 0.0) {
+		return 0;
+	}
+
+	struct path_guard stats, expr_stats, on_true, on_false;
+	path_guards(ctx->exclude, is_name_test, calls_stat, &stats, &on_true, &on_false);
+	path_guards(ctx->expr, is_name_test, calls_stat, &expr_stats, &on_true, &on_false);
+	guard_union(&stats, &expr_stats);
+	if (stats.any || stats.ntests == 0) {
+		return 0;
+	}
+
+	// The odds that a file passing the guards needs stat()
+	float guard_odds = 0.0;
+	for (size_t i = 0; i < stats.ntests; ++i) {
+		guard_odds += stats.tests[i]->probability;
+	}
+	float odds = guard_odds > lazy_cost ? lazy_cost / guard_odds : 1.0;
+	if (odds < eager_cost) {
+		return 0;
+	}
+
+	ctx->stat_guards = ALLOC_ARRAY(const struct bfs_expr *, stats.ntests);
+	if (!ctx->stat_guards) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < stats.ntests; ++i) {
+		const struct bfs_expr *test = stats.tests[i];
+		ctx->stat_guards[i] = test;
+		opt_visit(opt, "prefetching stat() info for %pe\n", test);
+	}
+	ctx->nstat_guards = stats.ntests;
+
+	return 0;
+}
+
+/** Check for -samefile tests. */
+static bool is_samefile(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_samefile && expr->nlink > 0;
+}
+
+/** Stop searching once every name of a -samefile target has been found. */
+static void limit_samefile(struct bfs_opt *opt, struct bfs_ctx *ctx) {
+	// Symbolic links to the target would match too, -watch can see new
+	// names created after the search, and -save-index needs every file
+	if ((ctx->flags & BFTW_FOLLOW_ALL) || ctx->watch || ctx->save_index) {
+		return;
+	}
+
+	struct path_guard impure, on_true, on_false;
+
+	path_guards(ctx->exclude, is_samefile, is_impure, &impure, &on_true, &on_false);
+	if (impure.any || impure.ntests > 0) {
+		return;
+	}
+
+	path_guards(ctx->expr, is_samefile, is_impure, &impure, &on_true, &on_false);
+	if (impure.any || impure.ntests != 1) {
+		return;
+	}
+
+	struct bfs_expr *test = (struct bfs_expr *)impure.tests[0];
+	test->samefile_left = test->nlink;
+	opt_visit(opt, "stopping after %zu names of %pe\n", (size_t)test->nlink, test);
+}
+
+/** Check for -type tests that only match directories. */
+static bool is_dir_type(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_type && !(expr->num & ~(1 << BFS_DIR));
+}
+
+/**
+ * Find the paths where skipping a non-directory could change what the
+ * expression does, in terms of the tests matching is_guard().
+ */
+static void nondir_effects(const struct bfs_ctx *ctx, expr_pred *is_guard, struct path_guard *effects) {
+	// -du adds up every file, and these need to see every file too
+	if (ctx->du || ctx->watch || ctx->save_index || ctx->calibrate) {
+		*effects = guard_any;
+		return;
+	}
+
+	// Link counts can't be trusted while the tree is changing
+	if (ctx->mutates) {
+		*effects = guard_any;
+		return;
+	}
+
+	struct path_guard impure, on_true, on_false;
+
+	path_guards(ctx->exclude, is_guard, is_impure, &impure, &on_true, &on_false);
+	if (impure.any || impure.ntests > 0) {
+		*effects = guard_any;
+		return;
+	}
+
+	// The name-only prunes can't do anything to non-directories
+	size_t skip = ctx->nprunes;
+	const struct bfs_expr *expr = ctx->expr;
+	if (skip > 0) {
+		bfs_assert(expr->eval_fn == eval_or);
+		*effects = guard_none;
+		for_expr (child, expr) {
+			if (skip > 0) {
+				--skip;
+				continue;
+			}
+
+			path_guards(child, is_guard, is_impure, &impure, &on_true, &on_false);
+			guard_union(effects, &impure);
+		}
+	} else {
+		path_guards(expr, is_guard, is_impure, effects, &on_true, &on_false);
+	}
+}
+
+/** Let bftw() skip non-directories if they can't have any side effects. */
+static void limit_types(struct bfs_opt *opt, struct bfs_ctx *ctx) {
+	struct path_guard effects;
+	nondir_effects(ctx, is_dir_type, &effects);
+	if (effects.any) {
+		return;
+	}
+
+	opt_debug(opt, "only visiting directories\n");
+	ctx->flags |= BFTW_DIRS_ONLY;
+}
+
+/**
+ * Get the modification time that files must be at least as new as to match a
+ * test like -newer or -mmin -N.
+ */
+static bool mtime_cutoff(const struct bfs_expr *expr, struct timespec *cutoff) {
+	if (expr->eval_fn != eval_newer && expr->eval_fn != eval_time) {
+		return false;
+	} else if (expr->stat_field != BFS_STAT_MTIME) {
+		return false;
+	}
+
+	if (expr->eval_fn == eval_newer) {
+		*cutoff = expr->reftime;
+		return true;
+	}
+
+	long long n;
+	switch (expr->int_cmp) {
+	case BFS_INT_LESS:
+		n = expr->num;
+		break;
+	case BFS_INT_EQUAL:
+		n = expr->num + 1;
+		break;
+	default:
+		return false;
+	}
+
+	// Keep the arithmetic below from overflowing
+	if (expr->num < 0 || expr->num > (1LL << 40)) {
+		return false;
+	}
+
+	long long unit;
+	switch (expr->time_unit) {
+	case BFS_DAYS:
+		unit = 60 * 60 * 24;
+		break;
+	case BFS_MINUTES:
+		unit = 60;
+		break;
+	case BFS_SECONDS:
+		unit = 1;
+		break;
+	}
+
+	// A file that's at least n units older than the reference time never
+	// matches, even after eval_time() rounds the difference down
+	cutoff->tv_sec = expr->reftime.tv_sec - n * unit;
+	cutoff->tv_nsec = 0;
+	return true;
+}
+
+/** Check for tests that only match recently modified files. */
+static bool is_mtime_cutoff(const struct bfs_expr *expr) {
+	struct timespec cutoff;
+	return mtime_cutoff(expr, &cutoff);
+}
+
+/**
+ * In an append-only tree (-append-only), a directory that hasn't been modified
+ * since a time cutoff can't have gained any entries since then, and its
+ * non-directory entries haven't been modified either, so they can't pass tests
+ * like -mmin -N.  Let bftw() skip them if that prevents all side effects.
+ */
+static void limit_stale(struct bfs_opt *opt, struct bfs_ctx *ctx) {
+	if (!ctx->append_only || (ctx->flags & BFTW_DIRS_ONLY)) {
+		return;
+	}
+
+	struct path_guard effects;
+	nondir_effects(ctx, is_mtime_cutoff, &effects);
+	if (effects.any || effects.ntests == 0) {
+		return;
+	}
+
+	// Entries must fail every guard, so use the earliest cutoff
+	struct timespec stale;
+	mtime_cutoff(effects.tests[0], &stale);
+	for (size_t i = 1; i < effects.ntests; ++i) {
+		struct timespec cutoff;
+		mtime_cutoff(effects.tests[i], &cutoff);
+		if (cutoff.tv_sec < stale.tv_sec || (cutoff.tv_sec == stale.tv_sec && cutoff.tv_nsec < stale.tv_nsec)) {
+			stale = cutoff;
+		}
+	}
+
+	for (size_t i = 0; i < effects.ntests; ++i) {
+		opt_visit(opt, "skipping stale directories for %pe\n", effects.tests[i]);
+	}
+	ctx->stale_time = stale;
+	ctx->flags |= BFTW_SKIP_STALE;
+}
+
+/** Check whether an expression only depends on a file's name, depth, and type. */
+static bool is_name_only(const struct bfs_expr *expr, bool *types) {
+	if (expr->eval_fn == eval_type) {
+		*types = true;
+		return true;
+	}
+
+	if (expr->eval_fn == eval_name
+	    || expr->eval_fn == eval_name_from
+	    || expr->eval_fn == eval_names
+	    || expr->eval_fn == eval_hidden
+	    || expr->eval_fn == eval_depth
+	    || expr->eval_fn == eval_true
+	    || expr->eval_fn == eval_false) {
+		return true;
+	}
+
+	if (expr->eval_fn != eval_not
+	    && expr->eval_fn != eval_and
+	    && expr->eval_fn != eval_or
+	    && expr->eval_fn != eval_comma) {
+		return false;
+	}
+
+	for_expr (child, expr) {
+		if (!is_name_only(child, types)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Check for a name-only test that just prunes, like -name .git -prune. */
+static bool is_name_prune(const struct bfs_expr *expr, bool *types) {
+	if (expr->eval_fn != eval_and) {
+		return false;
+	}
+
+	for_expr (child, expr) {
+		if (!child->next) {
+			return child->eval_fn == eval_prune;
+		} else if (!is_name_only(child, types)) {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+/** Find the name-only prunes at the start of the main expression. */
+static int find_prunes(struct bfs_opt *opt, struct bfs_ctx *ctx, bool *types) {
+	const struct bfs_expr *expr = ctx->expr;
+
+	// -prune has no effect with -depth
+	if ((ctx->flags & BFTW_POST_ORDER) || expr->eval_fn != eval_or) {
+		return 0;
+	}
+
+	size_t nprunes = 0;
+	bool prune_types = false;
+	for_expr (child, expr) {
+		bool child_types = false;
+		if (!is_name_prune(child, &child_types)) {
+			break;
+		}
+		prune_types |= child_types;
+		++nprunes;
+	}
+
+	if (nprunes == 0) {
+		return 0;
+	}
+
+	ctx->prunes = ALLOC_ARRAY(struct bfs_expr *, nprunes);
+	if (!ctx->prunes) {
+		return -1;
+	}
+
+	for_expr (child, expr) {
+		if (ctx->nprunes == nprunes) {
+			break;
+		}
+		opt_visit(opt, "filtering directory entries with %pe\n", child);
+		ctx->prunes[ctx->nprunes++] = child;
+	}
+
+	*types |= prune_types;
+	return 0;
+}
+
+/** Check whether an expression may add or remove files as it goes. */
+static bool may_mutate(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_delete || expr->eval_fn == eval_exec || expr->eval_fn == eval_coproc) {
+		return true;
+	}
+
+	for_expr (child, expr) {
+		if (may_mutate(child)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Check whether an expression may change the attributes of existing files. */
+static bool may_modify(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_chmod || expr->eval_fn == eval_chown || expr->eval_fn == eval_touch) {
+		return true;
+	}
+
+	for_expr (child, expr) {
+		if (may_modify(child)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Check whether an expression reads the targets of symbolic links. */
+static bool reads_links(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_lname || expr->eval_fn == eval_fls) {
+		return true;
+	} else if (expr->eval_fn == eval_fprintf && bfs_printf_reads_links(expr->printf)) {
+		return true;
+	}
+
+	for_expr (child, expr) {
+		if (reads_links(child)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Check whether an expression might look at the type of a non-directory.
+ * On Linux, non-directories can be bind-mounted over each other, so their
+ * d_type can't be trusted without the mount table.
+ */
+static bool uses_file_types(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_fprint) {
+		// Colored output depends on the file type
+		return expr->cfile->colors;
+	}
+
+	static bfs_eval_fn *const safe[] = {
+		eval_and,
+		eval_comma,
+		eval_depth,
+		eval_exit,
+		eval_false,
+		eval_fprint0,
+		eval_fprintx,
+		eval_hidden,
+		eval_name,
+		eval_name_from,
+		eval_names,
+		eval_not,
+		eval_or,
+		eval_path,
+		eval_path_from,
+		eval_prune,
+		eval_quit,
+		eval_regex,
+		eval_regexes,
+		eval_true,
+	};
+
+	bool found = false;
+	for (size_t i = 0; i < countof(safe); ++i) {
+		if (expr->eval_fn == safe[i]) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		return true;
+	}
+
+	for_expr (child, expr) {
+		if (uses_file_types(child)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Matches -(exec|ok) ... \; */
+static bool single_exec(const struct bfs_expr *expr) {
+	return expr->eval_fn == eval_exec && !(expr->exec->flags & BFS_EXEC_MULTI);
+}
+
+/** Let -exec ... \; and -delete run in the background wherever their results are ignored. */
+static void mark_async(struct bfs_expr *expr, bool ignored) {
+	if (expr->eval_fn == eval_delete) {
+		expr->background = ignored;
+		return;
+	} else if (single_exec(expr)) {
+		if (ignored && !(expr->exec->flags & BFS_EXEC_CONFIRM)) {
+			expr->exec->flags |= BFS_EXEC_ASYNC;
+		}
+		return;
+	}
+
+	bool and_or = expr->eval_fn == eval_and || expr->eval_fn == eval_or;
+	bool comma = expr->eval_fn == eval_comma;
+	bool not = expr->eval_fn == eval_not;
+
+	for_expr (child, expr) {
+		// The last child of -a/-o/, determines the result of the whole
+		// expression, and the earlier children of , are always ignored
+		bool last = !child->next;
+		bool child_ignored = false;
+		if (not || ((and_or || comma) && last)) {
+			child_ignored = ignored;
+		} else if (comma) {
+			child_ignored = true;
+		}
+		mark_async(child, child_ignored);
+	}
+}
+
+/** Check if two expressions have the same arguments. */
+static bool cse_argv_equal(const struct bfs_expr *a, const struct bfs_expr *b) {
+	if (a->argc != b->argc) {
+		return false;
+	}
+
+	for (size_t i = 0; i < a->argc; ++i) {
+		if (strcmp(a->argv[i], b->argv[i]) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Check if two -regex tests are the same (-regextype isn't in argv). */
+static bool cse_regex_equal(const struct bfs_expr *a, const struct bfs_expr *b) {
+	return cse_argv_equal(a, b) && bfs_regex_equal(a->regex, b->regex);
+}
+
+/** Check if two -grep tests are the same (-regextype isn't in argv). */
+static bool cse_grep_equal(const struct bfs_expr *a, const struct bfs_expr *b) {
+	return cse_argv_equal(a, b) && bfs_grep_equal(a->grep, b->grep);
+}
+
+/** Check if two time tests are the same (-daystart isn't in argv). */
+static bool cse_time_equal(const struct bfs_expr *a, const struct bfs_expr *b) {
+	return cse_argv_equal(a, b)
+		&& a->stat_field == b->stat_field
+		&& a->reftime.tv_sec == b->reftime.tv_sec
+		&& a->reftime.tv_nsec == b->reftime.tv_nsec;
+}
+
+/** A comparison function for common subexpressions. */
+typedef bool cse_equal_fn(const struct bfs_expr *a, const struct bfs_expr *b);
+
+/** Find the comparison function for a primary, if it can be shared. */
+static cse_equal_fn *cse_comparator(const struct bfs_expr *expr) {
+	/**
+	 * Tests whose results only depend on the file and their data, and
+	 * won't change if an earlier action modifies the file.  Their metadata
+	 * is cached for the whole evaluation anyway.
+	 */
+	static const struct {
+		bfs_eval_fn *eval_fn;
+		cse_equal_fn *equal;
+	} table[] = {
+		{eval_acl, cse_argv_equal},
+		{eval_capable, cse_argv_equal},
+		{eval_gid, cse_argv_equal},
+		{eval_grep, cse_grep_equal},
+		{eval_hash, cse_argv_equal},
+		{eval_inum, cse_argv_equal},
+		{eval_links, cse_argv_equal},
+		{eval_lname, cse_argv_equal},
+		{eval_name, cse_argv_equal},
+		{eval_newer, cse_time_equal},
+		{eval_nogroup, cse_argv_equal},
+		{eval_nouser, cse_argv_equal},
+		{eval_path, cse_argv_equal},
+		{eval_perm, cse_argv_equal},
+		{eval_regex, cse_regex_equal},
+		{eval_size, cse_argv_equal},
+		{eval_time, cse_time_equal},
+		{eval_type, cse_argv_equal},
+		{eval_uid, cse_argv_equal},
+		{eval_xattr, cse_argv_equal},
+		{eval_xattrname, cse_argv_equal},
+		{eval_xtype, cse_argv_equal},
+	};
+
+	for (size_t i = 0; i < countof(table); ++i) {
+		if (expr->eval_fn == table[i].eval_fn) {
+			return table[i].equal;
+		}
+	}
+
+	return NULL;
+}
+
+/** A class of equal expressions. */
+struct cse_class {
+	/** The first expression in this class. */
+	const struct bfs_expr *expr;
+	/** A hash of the expression. */
+	size_t hash;
+	/** The number of expressions in this class. */
+	size_t count;
+	/** The assigned result slot, or -1. */
+	int slot;
+};
+
+/** Common subexpression elimination state. */
+struct cse_state {
+	/** The classes of equal expressions. */
+	struct cse_class *classes;
+	/** The number of classes. */
+	size_t nclasses;
+	/** The number of assigned slots. */
+	int nslots;
+	/** Which slots have been used by an earlier expression. */
+	bool seen[BFS_CSE_MAX];
+};
+
+/** Mix a value into a hash. */
+static size_t cse_mix(size_t hash, size_t value) {
+	return (hash ^ value) * 0x100000001B3;
+}
+
+/** Hash an expression, whose children have already been classified. */
+static size_t cse_hash(const struct bfs_expr *expr) {
+	size_t hash = cse_mix(0xCBF29CE484222325, (uintptr_t)expr->eval_fn);
+
+	if (bfs_expr_is_parent(expr)) {
+		for_expr (child, expr) {
+			hash = cse_mix(hash, child->cse);
+		}
+	} else {
+		for (size_t i = 0; i < expr->argc; ++i) {
+			for (const char *c = expr->argv[i]; *c; ++c) {
+				hash = cse_mix(hash, (unsigned char)*c);
+			}
+			hash = cse_mix(hash, 0);
+		}
+	}
+
+	return hash;
+}
+
+/** Check if two expressions are equal, given that their children are classified. */
+static bool cse_equal(const struct bfs_expr *a, const struct bfs_expr *b) {
+	if (a->eval_fn != b->eval_fn) {
+		return false;
+	}
+
+	if (!bfs_expr_is_parent(a)) {
+		return cse_comparator(a)(a, b);
+	}
+
+	const struct bfs_expr *x = bfs_expr_children(a);
+	const struct bfs_expr *y = bfs_expr_children(b);
+	for (; x && y; x = x->next, y = y->next) {
+		if (x->cse != y->cse) {
+			return false;
+		}
+	}
+	return !x && !y;
+}
+
+/** Put each pure subexpression in a class with the equal ones (in expr->cse). */
+static int cse_classify(struct cse_state *cse, struct bfs_expr *expr) {
+	bool shareable = expr->pure && !is_const(expr);
+	if (bfs_expr_is_parent(expr)) {
+		for_expr (child, expr) {
+			if (cse_classify(cse, child) != 0) {
+				return -1;
+			}
+			shareable &= child->cse >= 0;
+		}
+	} else {
+		shareable &= cse_comparator(expr) != NULL;
+	}
+
+	expr->cse = -1;
+	if (!shareable) {
+		return 0;
+	}
+
+	size_t hash = cse_hash(expr);
+	for (size_t i = 0; i < cse->nclasses; ++i) {
+		struct cse_class *class = &cse->classes[i];
+		if (class->hash == hash && cse_equal(class->expr, expr)) {
+			++class->count;
+			expr->cse = i;
+			return 0;
+		}
+	}
+
+	struct cse_class *class = RESERVE(struct cse_class, &cse->classes, &cse->nclasses);
+	if (!class) {
+		return -1;
+	}
+	class->expr = expr;
+	class->hash = hash;
+	class->count = 1;
+	class->slot = -1;
+	expr->cse = cse->nclasses - 1;
+	return 0;
+}
+
+/** Replace classes with result slots, for those with more than one expression. */
+static void cse_assign(struct bfs_opt *opt, struct cse_state *cse, struct bfs_expr *expr) {
+	if (expr->cse >= 0) {
+		struct cse_class *class = &cse->classes[expr->cse];
+		if (class->count > 1 && class->slot < 0 && cse->nslots < BFS_CSE_MAX) {
+			class->slot = cse->nslots++;
+			opt_visit(opt, "common subexpression %pe\n", expr);
+		}
+	}
+
+	for_expr (child, expr) {
+		cse_assign(opt, cse, child);
+	}
+
+	if (expr->cse >= 0) {
+		expr->cse = cse->classes[expr->cse].slot;
+	}
+}
+
+/** Make repeated common subexpressions free, and update their parents' costs. */
+static bool cse_costs(struct bfs_opt *opt, struct cse_state *cse, struct bfs_expr *expr) {
+	if (expr->cse >= 0) {
+		if (cse->seen[expr->cse]) {
+			expr->cost = opt->ctx->costs[BFS_COST_FAST];
+			return true;
+		}
+		cse->seen[expr->cse] = true;
+	}
+
+	bool changed = false;
+	for_expr (child, expr) {
+		changed |= cse_costs(opt, cse, child);
+	}
+
+	if (!changed) {
+		return false;
+	} else if (expr->eval_fn == eval_not) {
+		annotate_not(opt, expr, NULL);
+	} else if (expr->eval_fn == eval_and) {
+		annotate_and(opt, expr, NULL);
+	} else if (expr->eval_fn == eval_or) {
+		annotate_or(opt, expr, NULL);
+	} else if (expr->eval_fn == eval_comma) {
+		annotate_comma(opt, expr, NULL);
+	}
+	return true;
+}
+
+/** Evaluate repeated pure subexpressions only once per file. */
+static int eliminate_common(struct bfs_opt *opt, struct bfs_ctx *ctx) {
+	struct cse_state cse = {0};
+
+	int ret = -1;
+	if (cse_classify(&cse, ctx->exclude) != 0 || cse_classify(&cse, ctx->expr) != 0) {
+		goto done;
+	}
+
+	cse_assign(opt, &cse, ctx->exclude);
+	cse_assign(opt, &cse, ctx->expr);
+	cse_costs(opt, &cse, ctx->exclude);
+	cse_costs(opt, &cse, ctx->expr);
+	ret = 0;
+
+done:
+	free(cse.classes);
+	return ret;
+}
+
+int bfs_optimize(struct bfs_ctx *ctx) {
+	bfs_ctx_dump(ctx, DEBUG_OPT);
+
+	struct df_domain impure;
+	df_init_bottom(&impure);
+
+	struct bfs_opt opt = {
+		.ctx = ctx,
+		.level = ctx->optlevel,
+		.depth = 0,
+		.warn = ctx->warn,
+		.ignore_result = false,
+		.impure = &impure,
+	};
+	df_init_top(&opt.before);
+
+	ctx->exclude = optimize(&opt, ctx->exclude);
+	if (!ctx->exclude) {
+		return -1;
+	}
+
+	// Only non-excluded files are evaluated
+	opt.before = opt.after_false;
+	opt.ignore_result = true;
+
+	struct df_range *depth = &opt.before.ranges[DEPTH_RANGE];
+	if (ctx->mindepth > 0) {
+		constrain_min(depth, ctx->mindepth);
+	}
+	if (ctx->maxdepth < INT_MAX) {
+		constrain_max(depth, ctx->maxdepth);
+	}
+
+	ctx->expr = optimize(&opt, ctx->expr);
+	if (!ctx->expr) {
+		return -1;
+	}
+
+	if (opt.level >= 2 && df_is_bottom(&impure)) {
+		bfs_warning(ctx, "This command won't do anything.\n\n");
+	}
+
+	const struct df_range *impure_depth = &impure.ranges[DEPTH_RANGE];
+	long long mindepth = impure_depth->min;
+	long long maxdepth = impure_depth->max;
+
+	opt_enter(&opt, "post-process:\n");
+
+	// Only ask bfs_stat() for the timestamps we actually use
+	ctx->stat_mask = BFS_STAT_ALL & ~BFS_STAT_TIMES;
+	ctx->stat_mask |= expr_stat_times(ctx->exclude);
+	ctx->stat_mask |= expr_stat_times(ctx->expr);
+
+	ctx->mutates = may_mutate(ctx->exclude) || may_mutate(ctx->expr);
+
+	// Links that resolve to the same path can share their targets' stat()
+	// info, as long as nothing changes the targets during the search
+	if (!ctx->mutates && !may_modify(ctx->exclude) && !may_modify(ctx->expr)) {
+		ctx->flags |= BFTW_SHARE_TARGETS;
+	}
+
+	// Read link targets ahead of time if we'll print or match them
+	if (reads_links(ctx->exclude) || reads_links(ctx->expr)) {
+		ctx->flags |= BFTW_READLINK;
+	}
+	ctx->file_types = uses_file_types(ctx->exclude) || uses_file_types(ctx->expr);
+
+	mark_async(ctx->exclude, false);
+	mark_async(ctx->expr, true);
+
+	if (opt.level >= 3 && eliminate_common(&opt, ctx) != 0) {
+		return -1;
+	}
+
+	if (opt.level >= 2 && mindepth > ctx->mindepth) {
+		if (mindepth > INT_MAX) {
+			mindepth = INT_MAX;
+		}
+		opt_enter(&opt, "${blu}-mindepth${rs} ${bld}%d${rs}\n", ctx->mindepth);
+		ctx->mindepth = mindepth;
+		opt_leave(&opt, "${blu}-mindepth${rs} ${bld}%d${rs}\n", ctx->mindepth);
+	}
+
+	if (opt.level >= 4 && maxdepth < ctx->maxdepth) {
+		if (maxdepth < INT_MIN) {
+			maxdepth = INT_MIN;
+		}
+		opt_enter(&opt, "${blu}-maxdepth${rs} ${bld}%d${rs}\n", ctx->maxdepth);
+		ctx->maxdepth = maxdepth;
+		opt_leave(&opt, "${blu}-maxdepth${rs} ${bld}%d${rs}\n", ctx->maxdepth);
+	}
+
+	if (opt.level >= 4 && limit_paths(&opt, ctx) != 0) {
+		return -1;
+	}
+
+	if (opt.level >= 4) {
+		limit_samefile(&opt, ctx);
+	}
+
+	if (ctx->strategy == BFTW_BEST && find_goals(&opt, ctx) != 0) {
+		return -1;
+	}
+
+	if (opt.level >= 3) {
+		bool types = false;
+		if (!ctx->exclude->always_false && is_name_only(ctx->exclude, &types)) {
+			opt_visit(&opt, "filtering directory entries with %pe\n", ctx->exclude);
+			ctx->exclude_names = true;
+		} else {
+			types = false;
+		}
+
+		if (find_prunes(&opt, ctx, &types) != 0) {
+			return -1;
+		}
+		ctx->filter_types = types;
+
+		limit_types(&opt, ctx);
+		limit_stale(&opt, ctx);
+	}
+
+	if (opt.level >= 3) {
+		// bfs_eval() can do lazy stat() calls, but only on one thread.
+		float lazy_cost = estimate_stat_odds(ctx);
+		// bftw() can do eager stat() calls in parallel
+		float eager_cost = 1.0 / ctx->threads;
+
+		// If only some names need stat(), prefetch just those
+		if (find_stat_guards(&opt, ctx, lazy_cost, eager_cost) != 0) {
+			return -1;
+		}
+
+		if (ctx->nstat_guards == 0 && eager_cost <= lazy_cost) {
+			opt_enter(&opt, "lazy stat cost: ${ylw}%g${rs}\n", lazy_cost);
 			ctx->flags |= BFTW_STAT;
 			opt_leave(&opt, "eager stat cost: ${ylw}%g${rs}\n", eager_cost);
 		}
 
+		// Likewise for ACL, capability, and xattr checks
+		optimize_fsade_checks(&opt, ctx, eager_cost);
+
 #ifndef POSIX_SPAWN_SETRLIMIT
 		// If bfs_spawn_setrlimit() would force us to use fork() over
 		// posix_spawn(), the extra cost may outweigh the benefit of a
@@ -14,20 +14,30 @@
 #include "bfs.h"
 #include "bfstd.h"
 #include "bftw.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "coproc.h"
 #include "ctx.h"
 #include "diag.h"
+#include "dlog.h"
 #include "dir.h"
 #include "eval.h"
 #include "exec.h"
 #include "expr.h"
 #include "fsade.h"
+#include "grep.h"
+#include "hash.h"
+#include "index.h"
 #include "list.h"
 #include "opt.h"
+#include "pathmatch.h"
 #include "printf.h"
+#include "profile.h"
 #include "pwcache.h"
 #include "sanity.h"
 #include "stat.h"
+#include "top.h"
+#include "trie.h"
 #include "typo.h"
 #include "xregex.h"
 #include "xspawn.h"
@@ -54,6 +64,7 @@ static char *fake_hidden_arg = "-hidden";
 static char *fake_or_arg = "-or";
 static char *fake_print_arg = "-print";
 static char *fake_true_arg = "-true";
+static char *fake_visit_arg = "-visit";
 
 /**
  * Color use flags.
@@ -107,6 +118,12 @@ struct bfs_parser {
 	char **xdev_arg;
 	/** A "-files0-from -" argument, if any. */
 	char **files0_stdin_arg;
+	/** The "-files0-from" argument for ctx->files0, if any. */
+	char **files0_arg;
+	/** A "-checkpoint" or "-resume" argument, if any. */
+	char **checkpoint_arg;
+	/** A "-du" argument, if any. */
+	char **du_arg;
 	/** An "-ok"-type expression, if any. */
 	const struct bfs_expr *ok_expr;
 
@@ -330,7 +347,13 @@ static int expr_open(struct bfs_parser *parser, struct bfs_expr *expr, const cha
 		goto fail;
 	}
 
-	cfile = cfwrap(file, parser->use_color ? ctx->colors : NULL, true);
+	// Only parse $LS_COLORS if we'll actually use it
+	const struct colors *colors = NULL;
+	if (parser->use_color && isatty(fileno(file))) {
+		colors = bfs_ctx_colors(ctx);
+	}
+
+	cfile = cfwrap(file, colors, true);
 	if (!cfile) {
 		goto fail;
 	}
@@ -342,6 +365,9 @@ static int expr_open(struct bfs_parser *parser, struct bfs_expr *expr, const cha
 
 	if (dedup != cfile) {
 		cfclose(cfile);
+	} else {
+		// Don't let slow output devices stall the traversal
+		cfasync(cfile);
 	}
 
 	expr->cfile = dedup;
@@ -396,11 +422,19 @@ static char **parser_advance(struct bfs_parser *parser, enum bfs_kind kind, size
 	return argv;
 }
 
+static int parse_files0_read(struct bfs_parser *parser);
+
 /**
  * Parse a root path.
  */
 static int parse_root(struct bfs_parser *parser, const char *path) {
 	struct bfs_ctx *ctx = parser->ctx;
+
+	// Keep the roots in order
+	if (ctx->files0 && parse_files0_read(parser) != 0) {
+		return -1;
+	}
+
 	const char **root = RESERVE(const char *, &ctx->paths, &ctx->npaths);
 	if (!root) {
 		parse_perror(parser, "RESERVE()");
@@ -768,7 +802,9 @@ static void debug_help(CFILE *cfile) {
 	cfprintf(cfile, "  ${bld}help${rs}:   This message.\n");
 	cfprintf(cfile, "  ${bld}cost${rs}:   Show cost estimates.\n");
 	cfprintf(cfile, "  ${bld}exec${rs}:   Print executed command details.\n");
+	cfprintf(cfile, "  ${bld}mem${rs}:    Print memory usage.\n");
 	cfprintf(cfile, "  ${bld}opt${rs}:    Print optimization details.\n");
+	cfprintf(cfile, "  ${bld}perf${rs}:   Print system call counters and timings.\n");
 	cfprintf(cfile, "  ${bld}rates${rs}:  Print predicate success rates.\n");
 	cfprintf(cfile, "  ${bld}search${rs}: Trace the filesystem traversal.\n");
 	cfprintf(cfile, "  ${bld}stat${rs}:   Trace all stat() calls.\n");
@@ -903,12 +939,23 @@ static struct bfs_expr *parse_access(struct bfs_parser *parser, int flag, int ar
 	return expr;
 }
 
+/**
+ * Set up the cache of unsupported devices for -acl, -capable, -xattr, etc.
+ */
+_maybe_unused
+static struct bfs_expr *parse_fsade_test(struct bfs_expr *expr) {
+	if (expr) {
+		bfs_fsade_cache_init(&expr->fsade);
+	}
+	return expr;
+}
+
 /**
  * Parse -acl.
  */
 static struct bfs_expr *parse_acl(struct bfs_parser *parser, int flag, int arg2) {
 #if BFS_CAN_CHECK_ACL
-	return parse_nullary_test(parser, eval_acl);
+	return parse_fsade_test(parse_nullary_test(parser, eval_acl));
 #else
 	parse_error(parser, "Missing platform support.\n");
 	return NULL;
@@ -1015,18 +1062,89 @@ static struct bfs_expr *parse_time(struct bfs_parser *parser, int field, int arg
 	return expr;
 }
 
+/**
+ * Parse -append-only.
+ */
+static struct bfs_expr *parse_append_only(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->append_only = true;
+	return parse_nullary_option(parser);
+}
+
+/**
+ * Parse -calibrate FILE.
+ */
+static struct bfs_expr *parse_calibrate(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	parser->ctx->calibrate = expr->argv[1];
+	return expr;
+}
+
 /**
  * Parse -capable.
  */
 static struct bfs_expr *parse_capable(struct bfs_parser *parser, int flag, int arg2) {
 #if BFS_CAN_CHECK_CAPABILITIES
-	return parse_nullary_test(parser, eval_capable);
+	return parse_fsade_test(parse_nullary_test(parser, eval_capable));
 #else
 	parse_error(parser, "Missing platform support.\n");
 	return NULL;
 #endif
 }
 
+/**
+ * Parse -changed-since SNAPSHOT.
+ */
+static struct bfs_expr *parse_changed_since(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	struct bfs_ctx *ctx = parser->ctx;
+	if (ctx->index) {
+		parse_expr_error(parser, expr, "${blu}-index${rs} searches the index, not the file system.\n");
+		return NULL;
+	}
+
+	ctx->changed_since = expr->argv[1];
+	return expr;
+}
+
+/**
+ * Parse -checkpoint FILE.
+ */
+static struct bfs_expr *parse_checkpoint(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	parser->ctx->checkpoint = expr->argv[1];
+	parser->checkpoint_arg = expr->argv;
+	return expr;
+}
+
+/**
+ * Parse -checkpoint-interval SECONDS.
+ */
+static struct bfs_expr *parse_checkpoint_interval(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &parser->ctx->checkpoint_interval, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	return expr;
+}
+
 /**
  * Parse -(no)?color.
  */
@@ -1037,9 +1155,9 @@ static struct bfs_expr *parse_color(struct bfs_parser *parser, int color, int ar
 	}
 
 	struct bfs_ctx *ctx = parser->ctx;
-	struct colors *colors = ctx->colors;
 
 	if (color) {
+		const struct colors *colors = bfs_ctx_colors(ctx);
 		if (!colors) {
 			parse_expr_error(parser, expr, "Error parsing $$LS_COLORS: %s.\n", xstrerror(ctx->colors_error));
 			return NULL;
@@ -1057,6 +1175,63 @@ static struct bfs_expr *parse_color(struct bfs_parser *parser, int color, int ar
 	return expr;
 }
 
+/**
+ * Classify an fnmatch() pattern.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+static int parse_glob_shape(struct bfs_expr *expr, size_t len) {
+	const char *pattern = expr->pattern;
+	expr->pattern_len = len;
+	expr->glob = BFS_GLOB_FNMATCH;
+	expr->folded = NULL;
+	expr->pathmatch_id = -1;
+
+	// strcmp() can be much faster than fnmatch() since it doesn't have to
+	// parse the pattern, so special-case patterns with no wildcards.
+	//
+	//     https://pubs.opengroup.org/onlinepubs/9799919799/utilities/V3_chap02.html#tag_19_14_01
+	if (strcspn(pattern, "?\\[") != len) {
+		return 0;
+	}
+
+	if (expr->fnm_flags) {
+		// Case-insensitive shapes compare ASCII-folded strings, so the
+		// pattern itself must be ASCII (and fold predictably)
+		if (asciinlen(pattern, len) != len || !ascii_casefold_safe()) {
+			return 0;
+		}
+
+		expr->folded = malloc(len + 1);
+		if (!expr->folded) {
+			return -1;
+		}
+		for (size_t i = 0; i <= len; ++i) {
+			expr->folded[i] = ascii_tolower(pattern[i]);
+		}
+	}
+
+	const char *star = strchr(pattern, '*');
+	if (!star) {
+		expr->glob = BFS_GLOB_LITERAL;
+		return 0;
+	}
+
+	const char *last = strrchr(pattern, '*');
+	if (star == last) {
+		// prefix*suffix, including prefix* and *suffix
+		expr->glob = BFS_GLOB_AFFIX;
+		expr->prefix_len = star - pattern;
+		expr->suffix_len = len - expr->prefix_len - 1;
+	} else if (star == pattern && last == pattern + len - 1 && !memchr(star + 1, '*', last - star - 1)) {
+		// *infix*
+		expr->glob = BFS_GLOB_INFIX;
+	}
+
+	return 0;
+}
+
 /**
  * Common code for fnmatch() tests.
  */
@@ -1096,11 +1271,10 @@ static struct bfs_expr *parse_fnmatch(const struct bfs_parser *parser, struct bf
 		return expr;
 	}
 
-	// strcmp() can be much faster than fnmatch() since it doesn't have to
-	// parse the pattern, so special-case patterns with no wildcards.
-	//
-	//     https://pubs.opengroup.org/onlinepubs/9799919799/utilities/V3_chap02.html#tag_19_14_01
-	expr->literal = strcspn(expr->pattern, "?*\\[") == len;
+	if (parse_glob_shape(expr, len) != 0) {
+		parse_perror(parser, "malloc()");
+		return NULL;
+	}
 
 	return expr;
 }
@@ -1154,6 +1328,45 @@ static struct bfs_expr *parse_daystart(struct bfs_parser *parser, int arg1, int
 	return parse_nullary_option(parser);
 }
 
+/**
+ * Parse -debug-log FILE.
+ */
+static struct bfs_expr *parse_debug_log(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	parser->ctx->debug_log = expr->argv[1];
+	return expr;
+}
+
+/**
+ * Parse -debug-decode FILE.
+ */
+static struct bfs_expr *parse_debug_decode(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	if (bfs_dlog_decode(parser->ctx, expr->argv[1]) != 0) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return NULL;
+	}
+
+	parser->just_info = true;
+	return NULL;
+}
+
+/**
+ * Parse -dedup.
+ */
+static struct bfs_expr *parse_dedup(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->dedup = true;
+	return parse_nullary_option(parser);
+}
+
 /**
  * Parse -delete.
  */
@@ -1164,7 +1377,31 @@ static struct bfs_expr *parse_delete(struct bfs_parser *parser, int arg1, int ar
 
 	parser->depth_arg = parser->argv;
 
-	return parse_nullary_action(parser, eval_delete);
+	struct bfs_expr *expr = parse_nullary_action(parser, eval_delete);
+	if (expr) {
+		// To dup() parent directories for background unlinks
+		expr->persistent_fds = BFS_DELETE_DIRS;
+	}
+	return expr;
+}
+
+/**
+ * Parse -du.
+ */
+static struct bfs_expr *parse_du(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_ctx *ctx = parser->ctx;
+	// Directory totals are complete by their post-order visit
+	ctx->flags |= BFTW_POST_ORDER | BFTW_STAT;
+	ctx->du = true;
+
+	parser->depth_arg = parser->argv;
+	parser->du_arg = parser->argv;
+
+	struct bfs_expr *expr = parse_nullary_action(parser, eval_du);
+	if (expr) {
+		init_print_expr(parser, expr);
+	}
+	return expr;
 }
 
 /**
@@ -1176,6 +1413,45 @@ static struct bfs_expr *parse_depth(struct bfs_parser *parser, int arg1, int arg
 	return parse_nullary_flag(parser);
 }
 
+/**
+ * Parse -dir-memory N[kMG].
+ */
+static struct bfs_expr *parse_dir_memory(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	long long size;
+	char **arg = &expr->argv[1];
+	const char *unit = parse_int(parser, arg, *arg, &size, IF_LONG_LONG | IF_UNSIGNED | IF_PARTIAL_OK);
+	if (!unit) {
+		return NULL;
+	}
+
+	int shift;
+	if (strcmp(unit, "") == 0) {
+		shift = 0;
+	} else if (strcmp(unit, "k") == 0) {
+		shift = 10;
+	} else if (strcmp(unit, "M") == 0) {
+		shift = 20;
+	} else if (strcmp(unit, "G") == 0) {
+		shift = 30;
+	} else {
+		parse_expr_error(parser, expr, "Expected a size unit (one of ${bld}kMG${rs}); found ${err}%pq${rs}.\n", unit);
+		return NULL;
+	}
+
+	if (size > (LLONG_MAX >> shift)) {
+		parse_expr_error(parser, expr, "Size is too big.\n");
+		return NULL;
+	}
+
+	parser->ctx->dir_memory = size << shift;
+	return expr;
+}
+
 /**
  * Parse -depth [N].
  */
@@ -1220,155 +1496,358 @@ static struct bfs_expr *parse_empty(struct bfs_parser *parser, int arg1, int arg
 }
 
 /**
- * Parse -exec(dir)?/-ok(dir)?.
+ * Parse -errors each|buffered|summary.
  */
-static struct bfs_expr *parse_exec(struct bfs_parser *parser, int flags, int arg2) {
-	struct bfs_ctx *ctx = parser->ctx;
-
-	struct bfs_exec *execbuf = bfs_exec_parse(ctx, parser->argv, flags);
-	if (!execbuf) {
-		return NULL;
-	}
-
-	struct bfs_expr *expr = parse_action(parser, eval_exec, execbuf->tmpl_argc + 2);
+static struct bfs_expr *parse_errors(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
 	if (!expr) {
-		bfs_exec_free(execbuf);
 		return NULL;
 	}
 
-	expr->exec = execbuf;
-
-	// For pipe() in bfs_spawn()
-	expr->ephemeral_fds = 2;
-
-	if (execbuf->flags & BFS_EXEC_CHDIR) {
-		// Check for relative paths in $PATH
-		const char *path = getenv("PATH");
-		while (path) {
-			if (*path != '/') {
-				size_t len = strcspn(path, ":");
-				char *comp = strndup(path, len);
-				if (comp) {
-					parse_expr_error(parser, expr,
-						"This action would be unsafe, since ${bld}$$PATH${rs} contains the relative path ${bld}%pq${rs}\n", comp);
-					free(comp);
-				} else {
-					parse_perror(parser, "strndup()");
-				}
-				return NULL;
-			}
-
-			path = strchr(path, ':');
-			if (path) {
-				++path;
-			}
-		}
-
-		// To dup() the parent directory
-		if (execbuf->flags & BFS_EXEC_MULTI) {
-			++expr->persistent_fds;
-		} else {
-			++expr->ephemeral_fds;
-		}
-	}
-
-	if (execbuf->flags & BFS_EXEC_CONFIRM) {
-		parser->ok_expr = expr;
+	struct bfs_ctx *ctx = parser->ctx;
+	const char *mode = expr->argv[1];
+	if (strcmp(mode, "each") == 0) {
+		ctx->errors = BFS_ERRORS_EACH;
+	} else if (strcmp(mode, "buffered") == 0) {
+		ctx->errors = BFS_ERRORS_BUFFERED;
+	} else if (strcmp(mode, "summary") == 0) {
+		ctx->errors = BFS_ERRORS_SUMMARY;
 	} else {
-		ctx->dangerous = true;
+		parse_expr_error(parser, expr, "Expected ${bld}each${rs}, ${bld}buffered${rs}, or ${bld}summary${rs}.\n");
+		return NULL;
 	}
 
 	return expr;
 }
 
 /**
- * Parse -exit [STATUS].
+ * Parse -compress none|gzip[:LEVEL].
  */
-static struct bfs_expr *parse_exit(struct bfs_parser *parser, int arg1, int arg2) {
-	size_t argc = 1;
-	const char *value = parser->argv[1];
+static struct bfs_expr *parse_compress(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
 
-	int status = EXIT_SUCCESS;
-	if (value && parse_int(parser, NULL, value, &status, IF_INT | IF_UNSIGNED | IF_QUIET)) {
-		argc = 2;
+	struct bfs_ctx *ctx = parser->ctx;
+	const char *format = expr->argv[1];
+	const char *level = NULL;
+	if (strcmp(format, "none") == 0) {
+		ctx->compress = BFS_COMPRESS_NONE;
+		return expr;
+	} else if (strcmp(format, "gzip") == 0) {
+		level = NULL;
+	} else if (strncmp(format, "gzip:", 5) == 0) {
+		level = format + 5;
+	} else {
+		parse_expr_error(parser, expr, "Expected ${bld}none${rs} or ${bld}gzip${rs}[:${bld}LEVEL${rs}].\n");
+		return NULL;
 	}
 
-	struct bfs_expr *expr = parse_action(parser, eval_exit, argc);
-	if (expr) {
-		expr->num = status;
+	if (!BFS_WITH_ZLIB) {
+		parse_expr_error(parser, expr, "Missing platform support.\n");
+		return NULL;
+	}
+
+	int n = -1;
+	if (level) {
+		if (!parse_int(parser, &expr->argv[1], level, &n, IF_INT | IF_UNSIGNED)) {
+			return NULL;
+		}
+		if (n < 1 || n > 9) {
+			parse_expr_error(parser, expr, "The compression level must be between ${bld}1${rs} and ${bld}9${rs}.\n");
+			return NULL;
+		}
 	}
+
+	ctx->compress = BFS_COMPRESS_GZIP;
+	ctx->compress_level = n;
 	return expr;
 }
 
 /**
- * Parse -f PATH.
+ * Parse -coproc[0]/-coproc-test[0].
  */
-static struct bfs_expr *parse_f(struct bfs_parser *parser, int arg1, int arg2) {
-	struct bfs_expr *expr = parse_unary_flag(parser);
-	if (!expr) {
+static struct bfs_expr *parse_coproc(struct bfs_parser *parser, int flags, int arg2) {
+	struct bfs_ctx *ctx = parser->ctx;
+
+	struct bfs_coproc *coproc = bfs_coproc_parse(ctx, parser->argv, flags);
+	if (!coproc) {
 		return NULL;
 	}
 
-	if (parse_root(parser, expr->argv[1]) != 0) {
+	struct bfs_expr *expr = parse_action(parser, eval_coproc, coproc->argc + 2);
+	if (!expr) {
+		bfs_coproc_free(coproc);
 		return NULL;
 	}
 
-	return expr;
-}
+	expr->coproc = coproc;
+
+	// The command's stdin, and stdout for -coproc-test
+	expr->persistent_fds = (flags & BFS_COPROC_TEST) ? 2 : 1;
+	// For pipe() in bfs_spawn()
+	expr->ephemeral_fds = 2;
+
+	return expr;
+}
 
 /**
- * Parse -files0-from PATH.
+ * Parse -count.
  */
-static struct bfs_expr *parse_files0_from(struct bfs_parser *parser, int arg1, int arg2) {
+static struct bfs_expr *parse_count(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_nullary_action(parser, eval_count);
+	if (expr) {
+		init_print_expr(parser, expr);
+	}
+	return expr;
+}
+
+/**
+ * Parse -count-by {root,depth}.
+ */
+static struct bfs_expr *parse_count_by(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(parser, eval_count);
+	if (!expr) {
+		return NULL;
+	}
+
+	init_print_expr(parser, expr);
+
+	const char *by = expr->argv[1];
+	if (strcmp(by, "root") == 0) {
+		expr->count_by = BFS_COUNT_ROOT;
+		expr->root_counts = ALLOC(struct trie);
+		if (!expr->root_counts) {
+			parse_perror(parser, "ALLOC()");
+			return NULL;
+		}
+		trie_init(expr->root_counts);
+	} else if (strcmp(by, "depth") == 0) {
+		expr->count_by = BFS_COUNT_DEPTH;
+	} else {
+		parse_expr_error(parser, expr, "Expected ${bld}root${rs} or ${bld}depth${rs}.\n");
+		return NULL;
+	}
+
+	return expr;
+}
+
+/**
+ * Parse -exec-capture.
+ */
+static struct bfs_expr *parse_exec_capture(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->exec_capture = true;
+	return parse_nullary_option(parser);
+}
+
+/**
+ * Parse -exec-jobs N.
+ */
+static struct bfs_expr *parse_exec_jobs(struct bfs_parser *parser, int arg1, int arg2) {
 	struct bfs_expr *expr = parse_unary_option(parser);
 	if (!expr) {
 		return NULL;
 	}
 
-	const char *from = expr->argv[1];
+	struct bfs_ctx *ctx = parser->ctx;
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &ctx->exec_jobs, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
 
-	FILE *file;
-	if (strcmp(from, "-") == 0) {
-		file = stdin;
+	if (ctx->exec_jobs == 0) {
+		parse_expr_error(parser, expr, "${bld}0${rs} is not enough jobs.\n");
+		return NULL;
+	}
+
+	return expr;
+}
+
+/**
+ * Parse -exec(dir)?/-ok(dir)?.
+ */
+static struct bfs_expr *parse_exec(struct bfs_parser *parser, int flags, int arg2) {
+	struct bfs_ctx *ctx = parser->ctx;
+
+	struct bfs_exec *execbuf = bfs_exec_parse(ctx, parser->argv, flags);
+	if (!execbuf) {
+		return NULL;
+	}
+
+	struct bfs_expr *expr = parse_action(parser, eval_exec, execbuf->tmpl_argc + 2);
+	if (!expr) {
+		bfs_exec_free(execbuf);
+		return NULL;
+	}
+
+	expr->exec = execbuf;
+
+	// For pipe() in bfs_spawn()
+	expr->ephemeral_fds = 2;
+
+	if (execbuf->flags & BFS_EXEC_CHDIR) {
+		// Check for relative paths in $PATH
+		const char *path = getenv("PATH");
+		while (path) {
+			if (*path != '/') {
+				size_t len = strcspn(path, ":");
+				char *comp = strndup(path, len);
+				if (comp) {
+					parse_expr_error(parser, expr,
+						"This action would be unsafe, since ${bld}$$PATH${rs} contains the relative path ${bld}%pq${rs}\n", comp);
+					free(comp);
+				} else {
+					parse_perror(parser, "strndup()");
+				}
+				return NULL;
+			}
+
+			path = strchr(path, ':');
+			if (path) {
+				++path;
+			}
+		}
+
+		// To dup() the parent directory (and any pending ones)
+		if (execbuf->flags & BFS_EXEC_MULTI) {
+			expr->persistent_fds += BFS_EXEC_DIRS + 1;
+		} else {
+			++expr->ephemeral_fds;
+		}
+	}
+
+	if (execbuf->flags & BFS_EXEC_CONFIRM) {
+		parser->ok_expr = expr;
 	} else {
-		file = xfopen(from, O_RDONLY | O_CLOEXEC);
+		ctx->dangerous = true;
 	}
-	if (!file) {
-		parse_expr_error(parser, expr, "%s.\n", errstr());
+
+	return expr;
+}
+
+/**
+ * Parse -exit [STATUS].
+ */
+static struct bfs_expr *parse_exit(struct bfs_parser *parser, int arg1, int arg2) {
+	size_t argc = 1;
+	const char *value = parser->argv[1];
+
+	int status = EXIT_SUCCESS;
+	if (value && parse_int(parser, NULL, value, &status, IF_INT | IF_UNSIGNED | IF_QUIET)) {
+		argc = 2;
+	}
+
+	struct bfs_expr *expr = parse_action(parser, eval_exit, argc);
+	if (expr) {
+		expr->num = status;
+	}
+	return expr;
+}
+
+/**
+ * Parse -f PATH.
+ */
+static struct bfs_expr *parse_f(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_flag(parser);
+	if (!expr) {
 		return NULL;
 	}
 
+	if (parse_root(parser, expr->argv[1]) != 0) {
+		return NULL;
+	}
+
+	return expr;
+}
+
+/**
+ * Read the rest of the paths from ctx->files0 into ctx->paths, instead of
+ * streaming them.
+ */
+static int parse_files0_read(struct bfs_parser *parser) {
+	struct bfs_ctx *ctx = parser->ctx;
+	FILE *file = ctx->files0;
+	ctx->files0 = NULL;
+
+	int ret = -1;
 	while (true) {
 		char *path = xgetdelim(file, '\0');
 		if (!path) {
 			if (errno) {
-				goto fail;
+				parse_argv_error(parser, parser->files0_arg, 2, "%s.\n", errstr());
 			} else {
-				break;
+				ret = 0;
 			}
+			break;
 		}
 
-		int ret = parse_root(parser, path);
+		int err = parse_root(parser, path);
 		free(path);
-		if (ret != 0) {
-			goto fail;
+		if (err != 0) {
+			break;
 		}
 	}
 
+	if (file != stdin) {
+		fclose(file);
+	}
+	return ret;
+}
+
+/**
+ * Check whether the -files0-from paths can be streamed during the search.
+ */
+static bool parse_files0_streamable(const struct bfs_ctx *ctx) {
+	// Commands could read the paths out from under us
+	if (ctx->files0 == stdin && ctx->mutates) {
+		return false;
+	}
+
+	// These need every root up front
+	if (ctx->strategy == BFTW_IDS || ctx->strategy == BFTW_EDS || (ctx->flags & BFTW_SPLIT_ROOTS)) {
+		return false;
+	}
+
+	return !ctx->dedup && !ctx->index && !ctx->checkpoint && !ctx->resume && !ctx->watch;
+}
+
+/**
+ * Parse -files0-from PATH.
+ */
+static struct bfs_expr *parse_files0_from(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	struct bfs_ctx *ctx = parser->ctx;
+	if (ctx->files0 && parse_files0_read(parser) != 0) {
+		return NULL;
+	}
+
+	const char *from = expr->argv[1];
+
+	FILE *file;
+	if (strcmp(from, "-") == 0) {
+		file = stdin;
+	} else {
+		file = xfopen(from, O_RDONLY | O_CLOEXEC);
+	}
+	if (!file) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return NULL;
+	}
+
+	// The paths are read later, either all at once or during the search
+	ctx->files0 = file;
+	parser->files0_arg = expr->argv;
 	if (file == stdin) {
 		parser->files0_stdin_arg = expr->argv;
-	} else {
-		fclose(file);
 	}
 
 	parser->implicit_root = false;
 	return expr;
-
-fail:
-	if (file != stdin) {
-		fclose(file);
-	}
-	return NULL;
 }
 
 /**
@@ -1455,6 +1934,22 @@ static struct bfs_expr *parse_fprint0(struct bfs_parser *parser, int arg1, int a
 	return expr;
 }
 
+/**
+ * Parse -fprintjson FILE.
+ */
+static struct bfs_expr *parse_fprintjson(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(parser, eval_fprintjson);
+	if (!expr) {
+		return NULL;
+	}
+
+	if (expr_open(parser, expr, expr->argv[1]) != 0) {
+		return NULL;
+	}
+
+	return expr;
+}
+
 /**
  * Parse -fprintf FILE FORMAT.
  */
@@ -1506,6 +2001,46 @@ static struct bfs_expr *parse_fstype(struct bfs_parser *parser, int arg1, int ar
 	return expr;
 }
 
+/**
+ * Parse -grep PATTERN and -grep-regex REGEX.
+ */
+static struct bfs_expr *parse_grep(struct bfs_parser *parser, int is_regex, int arg2) {
+	struct bfs_expr *expr = parse_unary_test(parser, eval_grep);
+	if (!expr) {
+		return NULL;
+	}
+
+	// To open() the file
+	expr->ephemeral_fds = 1;
+
+	const char *pattern = expr->argv[1];
+	struct bfs_regex *regex = NULL;
+	if (is_regex && bfs_regcomp(&regex, pattern, parser->regex_type, 0) != 0) {
+		if (regex) {
+			char *str = bfs_regerror(regex);
+			if (str) {
+				parse_expr_error(parser, expr, "%s.\n", str);
+				free(str);
+			} else {
+				parse_perror(parser, "bfs_regerror()");
+			}
+			bfs_regfree(regex);
+		} else {
+			parse_perror(parser, "bfs_regcomp()");
+		}
+		return NULL;
+	}
+
+	expr->grep = bfs_grep_new(pattern, regex);
+	if (!expr->grep) {
+		parse_perror(parser, "bfs_grep_new()");
+		bfs_regfree(regex);
+		return NULL;
+	}
+
+	return expr;
+}
+
 /**
  * Parse -gid/-group.
  */
@@ -1534,6 +2069,14 @@ static struct bfs_expr *parse_group(struct bfs_parser *parser, int arg1, int arg
 	return expr;
 }
 
+/**
+ * Parse -gitignore.
+ */
+static struct bfs_expr *parse_gitignore(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->gitignore = true;
+	return parse_nullary_option(parser);
+}
+
 /**
  * Parse -unique.
  */
@@ -1542,6 +2085,14 @@ static struct bfs_expr *parse_unique(struct bfs_parser *parser, int arg1, int ar
 	return parse_nullary_option(parser);
 }
 
+/**
+ * Parse -watch.
+ */
+static struct bfs_expr *parse_watch(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->watch = true;
+	return parse_nullary_option(parser);
+}
+
 /**
  * Parse -used N.
  */
@@ -1577,6 +2128,71 @@ static struct bfs_expr *parse_user(struct bfs_parser *parser, int arg1, int arg2
 	return expr;
 }
 
+/** Decode a hex digit. */
+static int parse_hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	} else {
+		return -1;
+	}
+}
+
+/**
+ * Parse -hash ALGO:DIGEST.
+ */
+static struct bfs_expr *parse_hash(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_test(parser, eval_hash);
+	if (!expr) {
+		return NULL;
+	}
+
+	// To open() the file
+	expr->ephemeral_fds = 1;
+
+	const char *arg = expr->argv[1];
+	const char *colon = strchr(arg, ':');
+	if (!colon) {
+		parse_expr_error(parser, expr, "Expected ${bld}ALGO:DIGEST${rs}.\n");
+		return NULL;
+	}
+
+	char *name = strndup(arg, colon - arg);
+	if (!name) {
+		parse_perror(parser, "strndup()");
+		return NULL;
+	}
+	int ret = bfs_hash_parse(name, &expr->hash_algo);
+	free(name);
+	if (ret != 0) {
+		parse_expr_error(parser, expr, "Unknown hash algorithm.\n");
+		return NULL;
+	}
+
+	const char *hex = colon + 1;
+	size_t size = bfs_hash_size(expr->hash_algo);
+	if (strlen(hex) != 2 * size) {
+		parse_expr_error(parser, expr, "A ${bld}%s${rs} digest has %zu hex digits.\n",
+			bfs_hash_name(expr->hash_algo), 2 * size);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < size; ++i) {
+		int hi = parse_hex_digit(hex[2 * i]);
+		int lo = parse_hex_digit(hex[2 * i + 1]);
+		if (hi < 0 || lo < 0) {
+			parse_expr_error(parser, expr, "Invalid hex digest.\n");
+			return NULL;
+		}
+		expr->digest[i] = (hi << 4) | lo;
+	}
+
+	return expr;
+}
+
 /**
  * Parse -hidden.
  */
@@ -1592,6 +2208,97 @@ static struct bfs_expr *parse_ignore_races(struct bfs_parser *parser, int ignore
 	return parse_nullary_option(parser);
 }
 
+/**
+ * Parse -index FILE, -update-index FILE.
+ */
+static struct bfs_expr *parse_index(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	struct bfs_ctx *ctx = parser->ctx;
+	if (ctx->index) {
+		parse_expr_error(parser, expr, "Only one index can be searched.\n");
+		return NULL;
+	} else if (ctx->changed_since) {
+		parse_expr_error(parser, expr, "${blu}-changed-since${rs} searches the file system, not an index.\n");
+		return NULL;
+	}
+
+	ctx->index = bfs_index_open(expr->argv[1]);
+	if (!ctx->index) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return NULL;
+	}
+	ctx->index_path = expr->argv[1];
+	ctx->update_index = arg1;
+
+	return expr;
+}
+
+/** The names of the -index-fields. */
+static const struct {
+	const char *name;
+	enum bfs_stat_field field;
+} index_fields[] = {
+	{"mode", BFS_STAT_MODE},
+	{"dev", BFS_STAT_DEV},
+	{"ino", BFS_STAT_INO},
+	{"nlink", BFS_STAT_NLINK},
+	{"gid", BFS_STAT_GID},
+	{"uid", BFS_STAT_UID},
+	{"size", BFS_STAT_SIZE},
+	{"blocks", BFS_STAT_BLOCKS},
+	{"rdev", BFS_STAT_RDEV},
+	{"attrs", BFS_STAT_ATTRS},
+	{"atime", BFS_STAT_ATIME},
+	{"btime", BFS_STAT_BTIME},
+	{"ctime", BFS_STAT_CTIME},
+	{"mtime", BFS_STAT_MTIME},
+	{"all", BFS_STAT_ALL},
+	{"none", 0},
+};
+
+/**
+ * Parse -index-fields FIELD[,FIELD...].
+ */
+static struct bfs_expr *parse_index_fields(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	enum bfs_stat_field fields = 0;
+
+	for (const char *field = expr->argv[1], *next; field; field = next) {
+		size_t len = strcspn(field, ",");
+		if (field[len]) {
+			next = field + len + 1;
+		} else {
+			next = NULL;
+		}
+
+		size_t i;
+		for (i = 0; i < countof(index_fields); ++i) {
+			const char *name = index_fields[i].name;
+			if (strlen(name) == len && strncmp(field, name, len) == 0) {
+				break;
+			}
+		}
+
+		if (i == countof(index_fields)) {
+			parse_expr_error(parser, expr, "Unknown field ${bld}%.*s${rs}.\n", (int)len, field);
+			return NULL;
+		}
+
+		fields |= index_fields[i].field;
+	}
+
+	parser->ctx->index_fields = fields;
+	return expr;
+}
+
 /**
  * Parse -inum N.
  */
@@ -1600,7 +2307,80 @@ static struct bfs_expr *parse_inum(struct bfs_parser *parser, int arg1, int arg2
 }
 
 /**
- * Parse -j<n>.
+ * Parse -io-depth N.
+ */
+static struct bfs_expr *parse_io_depth(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	int depth;
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &depth, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (depth == 0) {
+		parse_expr_error(parser, expr, "${bld}0${rs} is not enough concurrent operations.\n");
+		return NULL;
+	}
+
+	parser->ctx->io_depth = depth;
+	return expr;
+}
+
+/**
+ * Parse -io-idle.
+ */
+static struct bfs_expr *parse_io_idle(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->io_idle = true;
+	return parse_nullary_option(parser);
+}
+
+/**
+ * Parse -io-rate N.
+ */
+static struct bfs_expr *parse_io_rate(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	int rate;
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &rate, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (rate == 0) {
+		parse_expr_error(parser, expr, "${bld}0${rs} is not enough operations per second.\n");
+		return NULL;
+	}
+
+	parser->ctx->io_rate = rate;
+	return expr;
+}
+
+/**
+ * Parse -io-timeout SECONDS.
+ */
+static struct bfs_expr *parse_io_timeout(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &parser->ctx->io_timeout, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	return expr;
+}
+
+/**
+ * Parse -j<n>|auto[,<type>=<n>...].
  */
 static struct bfs_expr *parse_jobs(struct bfs_parser *parser, int arg1, int arg2) {
 	const char *arg;
@@ -1609,17 +2389,59 @@ static struct bfs_expr *parse_jobs(struct bfs_parser *parser, int arg1, int arg2
 		return NULL;
 	}
 
-	unsigned int n;
-	if (!parse_int(parser, expr->argv, arg, &n, IF_INT | IF_UNSIGNED)) {
-		return NULL;
-	}
+	// -jN[,TYPE=N...]
+	struct bfs_ctx *ctx = parser->ctx;
+	const char *str = arg;
+	while (true) {
+		size_t len = strcspn(str, "=,");
+		if (str[len] == '=') {
+			struct bftw_fslimit *fslimit = RESERVE(struct bftw_fslimit, &ctx->fslimits, &ctx->nfslimits);
+			if (!fslimit) {
+				parse_perror(parser, "RESERVE()");
+				return NULL;
+			}
+
+			fslimit->type = strndup(str, len);
+			if (!fslimit->type) {
+				--ctx->nfslimits;
+				parse_perror(parser, "strndup()");
+				return NULL;
+			}
+
+			unsigned int n;
+			str = parse_int(parser, expr->argv, str + len + 1, &n, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+			if (!str) {
+				return NULL;
+			}
+			fslimit->limit = n;
+		} else if (strncmp(str, "auto", 4) == 0 && (str[4] == ',' || !str[4])) {
+			ctx->auto_threads = true;
+			str += 4;
+		} else {
+			unsigned int n;
+			str = parse_int(parser, expr->argv, str, &n, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+			if (!str) {
+				return NULL;
+			}
+
+			if (n == 0) {
+				parse_expr_error(parser, expr, "${bld}0${rs} is not enough threads.\n");
+				return NULL;
+			}
+			ctx->threads = n;
+			ctx->auto_threads = false;
+		}
 
-	if (n == 0) {
-		parse_expr_error(parser, expr, "${bld}0${rs} is not enough threads.\n");
-		return NULL;
+		if (*str == ',') {
+			++str;
+		} else if (*str) {
+			parse_expr_error(parser, expr, "Expected ${bld}N${rs}, ${bld}auto${rs}, or ${bld}TYPE=N${rs}, not ${bld}%pq${rs}.\n", str);
+			return NULL;
+		} else {
+			break;
+		}
 	}
 
-	parser->ctx->threads = n;
 	return expr;
 }
 
@@ -1653,6 +2475,49 @@ static struct bfs_expr *parse_links(struct bfs_parser *parser, int arg1, int arg
 	return parse_test_icmp(parser, eval_links);
 }
 
+/**
+ * Parse -load-costs FILE.
+ */
+static struct bfs_expr *parse_load_costs(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	if (bfs_costs_load(parser->ctx->costs, expr->argv[1]) != 0) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return NULL;
+	}
+
+	return expr;
+}
+
+/**
+ * Parse -load-profile FILE.
+ */
+static struct bfs_expr *parse_load_profile(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	struct bfs_ctx *ctx = parser->ctx;
+	if (!ctx->profile) {
+		ctx->profile = bfs_profile_new();
+		if (!ctx->profile) {
+			parse_perror(parser, "bfs_profile_new()");
+			return NULL;
+		}
+	}
+
+	if (bfs_profile_load(ctx->profile, expr->argv[1]) != 0) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return NULL;
+	}
+
+	return expr;
+}
+
 /**
  * Parse -ls.
  */
@@ -1688,12 +2553,110 @@ static struct bfs_expr *parse_name(struct bfs_parser *parser, int casefold, int
 	return parse_fnmatch(parser, expr, casefold);
 }
 
+/** Add a literal from -(name|path)-from to the set. */
+static int parse_literal(struct trie *trie, const char *str) {
+	if (!str[0]) {
+		return 0;
+	}
+
+	return trie_insert_str(trie, str) ? 0 : -1;
+}
+
+/** Add newline-separated literals to the set. */
+static int parse_literal_lines(struct trie *trie, char *str) {
+	while (*str) {
+		char *end = str + strcspn(str, "\n");
+		bool last = !*end;
+		*end = '\0';
+
+		if (parse_literal(trie, str) != 0) {
+			return -1;
+		}
+
+		str = last ? end : end + 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Parse -name-from FILE, -path-from FILE.
+ */
+static struct bfs_expr *parse_name_from(struct bfs_parser *parser, int path, int arg2) {
+	struct bfs_expr *expr = parse_unary_test(parser, path ? eval_path_from : eval_name_from);
+	if (!expr) {
+		return NULL;
+	}
+
+	expr->literals = ALLOC(struct trie);
+	if (!expr->literals) {
+		parse_perror(parser, "alloc()");
+		return NULL;
+	}
+	trie_init(expr->literals);
+
+	FILE *file = xfopen(expr->argv[1], O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return NULL;
+	}
+
+	// The entries are NUL-separated if there are any NULs at all, and
+	// newline-separated otherwise
+	for (bool first = true; ; first = false) {
+		char *chunk = xgetdelim(file, '\0');
+		if (!chunk) {
+			if (errno) {
+				parse_expr_error(parser, expr, "%s.\n", errstr());
+				goto fail;
+			}
+			break;
+		}
+
+		int ret;
+		if (first && feof(file)) {
+			ret = parse_literal_lines(expr->literals, chunk);
+		} else {
+			ret = parse_literal(expr->literals, chunk);
+		}
+		free(chunk);
+
+		if (ret != 0) {
+			parse_perror(parser, "trie_insert_str()");
+			goto fail;
+		}
+	}
+
+	fclose(file);
+	return expr;
+
+fail:
+	fclose(file);
+	return NULL;
+}
+
 /**
  * Parse -i?path, -i?wholename.
  */
 static struct bfs_expr *parse_path(struct bfs_parser *parser, int casefold, int arg2) {
 	struct bfs_expr *expr = parse_unary_test(parser, eval_path);
-	return parse_fnmatch(parser, expr, casefold);
+	expr = parse_fnmatch(parser, expr, casefold);
+	if (!expr || expr->eval_fn != eval_path || expr->glob != BFS_GLOB_FNMATCH) {
+		return expr;
+	}
+
+	// General patterns are matched one path component at a time
+	struct bfs_ctx *ctx = parser->ctx;
+	if (!ctx->pathmatch) {
+		ctx->pathmatch = bfs_pathmatch_new();
+		if (!ctx->pathmatch) {
+			parse_perror(parser, "bfs_pathmatch_new()");
+			return NULL;
+		}
+	}
+
+	expr->pathmatch_id = bfs_pathmatch_add(ctx->pathmatch, expr->pattern, casefold);
+	return expr;
 }
 
 /**
@@ -1860,6 +2823,19 @@ static struct bfs_expr *parse_noleaf(struct bfs_parser *parser, int arg1, int ar
 	return parse_nullary_option(parser);
 }
 
+/**
+ * Parse -nostat-cache.
+ */
+static struct bfs_expr *parse_nostat_cache(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_ctx *ctx = parser->ctx;
+	for (size_t i = 0; i < ctx->nstat_cache; ++i) {
+		free(ctx->stat_cache[i]);
+	}
+	ctx->nstat_cache = 0;
+
+	return parse_nullary_option(parser);
+}
+
 /**
  * Parse -nouser.
  */
@@ -1876,228 +2852,169 @@ static struct bfs_expr *parse_nouser(struct bfs_parser *parser, int arg1, int ar
  * Parse a permission mode like chmod(1).
  */
 static int parse_mode(const struct bfs_parser *parser, const char *mode, struct bfs_expr *expr) {
-	if (mode[0] >= '0' && mode[0] <= '9') {
-		unsigned int parsed;
-		if (!parse_int(parser, NULL, mode, &parsed, 8 | IF_INT | IF_UNSIGNED | IF_QUIET)) {
-			goto fail;
-		}
-		if (parsed > 07777) {
-			goto fail;
-		}
+	expr->file_mode = 0;
+	expr->dir_mode = 0;
+	if (xstrtomode(mode, parser->ctx->umask, &expr->file_mode, &expr->dir_mode) != 0) {
+		parse_expr_error(parser, expr, "Invalid mode.\n");
+		return -1;
+	}
 
-		expr->file_mode = parsed;
-		expr->dir_mode = parsed;
-		return 0;
+	return 0;
+}
+
+/**
+ * Parse -chmod MODE.
+ */
+static struct bfs_expr *parse_chmod(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(parser, eval_chmod);
+	if (!expr) {
+		return NULL;
 	}
 
-	mode_t umask = parser->ctx->umask;
+	// Check the mode now, rather than for every file
+	if (parse_mode(parser, expr->argv[1], expr) != 0) {
+		return NULL;
+	}
 
-	expr->file_mode = 0;
-	expr->dir_mode = 0;
+	parser->ctx->dangerous = true;
+	return expr;
+}
 
-	// Parse the same grammar as chmod(1), which looks like this:
-	//
-	// MODE : CLAUSE ["," CLAUSE]*
-	//
-	// CLAUSE : WHO* ACTION+
-	//
-	// WHO : "u" | "g" | "o" | "a"
-	//
-	// ACTION : OP PERM*
-	//        | OP PERMCOPY
-	//
-	// OP : "+" | "-" | "="
-	//
-	// PERM : "r" | "w" | "x" | "X" | "s" | "t"
-	//
-	// PERMCOPY : "u" | "g" | "o"
-
-	// State machine state
-	enum {
-		MODE_CLAUSE,
-		MODE_WHO,
-		MODE_ACTION,
-		MODE_ACTION_APPLY,
-		MODE_OP,
-		MODE_PERM,
-	} state = MODE_CLAUSE;
-
-	enum {
-		MODE_PLUS,
-		MODE_MINUS,
-		MODE_EQUALS,
-	} op uninit(MODE_EQUALS);
-
-	mode_t who uninit(0);
-	mode_t mask uninit(0);
-	mode_t file_change uninit(0);
-	mode_t dir_change uninit(0);
-
-	const char *i = mode;
-	while (true) {
-		switch (state) {
-		case MODE_CLAUSE:
-			who = 0;
-			mask = 0777;
-			state = MODE_WHO;
-			_fallthrough;
+/** Parse the user part of -chown. */
+static int parse_chown_user(const struct bfs_parser *parser, struct bfs_expr *expr, const char *user) {
+	const struct passwd *pwd = bfs_getpwnam(parser->ctx->users, user);
+	if (pwd) {
+		expr->chown_uid = pwd->pw_uid;
+		return 0;
+	} else if (errno) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return -1;
+	}
 
-		case MODE_WHO:
-			switch (*i) {
-			case 'u':
-				who |= 0700;
-				break;
-			case 'g':
-				who |= 0070;
-				break;
-			case 'o':
-				who |= 0007;
-				break;
-			case 'a':
-				who |= 0777;
-				break;
-			default:
-				state = MODE_ACTION;
-				continue;
-			}
-			break;
+	long long uid;
+	if (xstrtoll(user, NULL, 10, &uid) == 0 && uid >= 0 && (uid_t)uid == uid && (uid_t)uid != (uid_t)-1) {
+		expr->chown_uid = uid;
+		return 0;
+	}
 
-		case MODE_ACTION_APPLY:
-			switch (op) {
-			case MODE_EQUALS:
-				expr->file_mode &= ~who;
-				expr->dir_mode &= ~who;
-				_fallthrough;
-			case MODE_PLUS:
-				expr->file_mode |= file_change;
-				expr->dir_mode |= dir_change;
-				break;
-			case MODE_MINUS:
-				expr->file_mode &= ~file_change;
-				expr->dir_mode &= ~dir_change;
-				break;
-			}
-			_fallthrough;
+	parse_expr_error(parser, expr, "No such user.\n");
+	return -1;
+}
 
-		case MODE_ACTION:
-			if (who == 0) {
-				who = 0777;
-				mask = who & ~umask;
-			} else {
-				mask = who;
-			}
+/** Parse the group part of -chown. */
+static int parse_chown_group(const struct bfs_parser *parser, struct bfs_expr *expr, const char *group) {
+	const struct group *grp = bfs_getgrnam(parser->ctx->groups, group);
+	if (grp) {
+		expr->chown_gid = grp->gr_gid;
+		return 0;
+	} else if (errno) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return -1;
+	}
 
-			switch (*i) {
-			case '+':
-				op = MODE_PLUS;
-				state = MODE_OP;
-				break;
-			case '-':
-				op = MODE_MINUS;
-				state = MODE_OP;
-				break;
-			case '=':
-				op = MODE_EQUALS;
-				state = MODE_OP;
-				break;
+	long long gid;
+	if (xstrtoll(group, NULL, 10, &gid) == 0 && gid >= 0 && (gid_t)gid == gid && (gid_t)gid != (gid_t)-1) {
+		expr->chown_gid = gid;
+		return 0;
+	}
 
-			case ',':
-				if (state == MODE_ACTION_APPLY) {
-					state = MODE_CLAUSE;
-				} else {
-					goto fail;
-				}
-				break;
+	parse_expr_error(parser, expr, "No such group.\n");
+	return -1;
+}
 
-			case '\0':
-				if (state == MODE_ACTION_APPLY) {
-					goto done;
-				} else {
-					goto fail;
-				}
+/**
+ * Parse -chown [USER][:GROUP].
+ */
+static struct bfs_expr *parse_chown(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(parser, eval_chown);
+	if (!expr) {
+		return NULL;
+	}
 
-			default:
-				goto fail;
-			}
-			break;
+	expr->chown_uid = -1;
+	expr->chown_gid = -1;
 
-		case MODE_OP:
-			switch (*i) {
-			case 'u':
-				file_change = (expr->file_mode >> 6) & 07;
-				dir_change = (expr->dir_mode >> 6) & 07;
-				break;
-			case 'g':
-				file_change = (expr->file_mode >> 3) & 07;
-				dir_change = (expr->dir_mode >> 3) & 07;
-				break;
-			case 'o':
-				file_change = expr->file_mode & 07;
-				dir_change = expr->dir_mode & 07;
-				break;
+	const char *arg = expr->argv[1];
+	const char *group = strchr(arg, ':');
+	size_t len = group ? (size_t)(group - arg) : strlen(arg);
+	if (group) {
+		++group;
+	}
 
-			default:
-				file_change = 0;
-				dir_change = 0;
-				state = MODE_PERM;
-				continue;
-			}
+	if (len == 0 && (!group || !group[0])) {
+		parse_expr_error(parser, expr, "Expected a user and/or group.\n");
+		return NULL;
+	}
 
-			file_change |= (file_change << 6) | (file_change << 3);
-			file_change &= mask;
-			dir_change |= (dir_change << 6) | (dir_change << 3);
-			dir_change &= mask;
-			state = MODE_ACTION_APPLY;
-			break;
+	if (len > 0) {
+		char *user = strndup(arg, len);
+		if (!user) {
+			parse_perror(parser, "strndup()");
+			return NULL;
+		}
 
-		case MODE_PERM:
-			switch (*i) {
-			case 'r':
-				file_change |= mask & 0444;
-				dir_change |= mask & 0444;
-				break;
-			case 'w':
-				file_change |= mask & 0222;
-				dir_change |= mask & 0222;
-				break;
-			case 'x':
-				file_change |= mask & 0111;
-				_fallthrough;
-			case 'X':
-				dir_change |= mask & 0111;
-				break;
-			case 's':
-				if (who & 0700) {
-					file_change |= S_ISUID;
-					dir_change |= S_ISUID;
-				}
-				if (who & 0070) {
-					file_change |= S_ISGID;
-					dir_change |= S_ISGID;
-				}
-				break;
-			case 't':
-				if (who & 0007) {
-					file_change |= S_ISVTX;
-					dir_change |= S_ISVTX;
-				}
-				break;
-			default:
-				state = MODE_ACTION_APPLY;
-				continue;
-			}
-			break;
+		int ret = parse_chown_user(parser, expr, user);
+		free(user);
+		if (ret != 0) {
+			return NULL;
 		}
+	}
 
-		++i;
+	if (group && group[0] && parse_chown_group(parser, expr, group) != 0) {
+		return NULL;
 	}
 
-done:
-	return 0;
+	parser->ctx->dangerous = true;
+	return expr;
+}
 
-fail:
-	parse_expr_error(parser, expr, "Invalid mode.\n");
-	return -1;
+/**
+ * Parse -ordered.
+ */
+static struct bfs_expr *parse_ordered(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->parallel = true;
+	parser->ctx->ordered = true;
+	return parse_nullary_option(parser);
+}
+
+/**
+ * Parse -parallel.
+ */
+static struct bfs_expr *parse_parallel(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->parallel = true;
+	return parse_nullary_option(parser);
+}
+
+/**
+ * Parse -parallel-roots.
+ */
+static struct bfs_expr *parse_parallel_roots(struct bfs_parser *parser, int arg1, int arg2) {
+	parser->ctx->flags |= BFTW_SPLIT_ROOTS;
+	return parse_nullary_option(parser);
+}
+
+/**
+ * Parse -profile-sample N.
+ */
+static struct bfs_expr *parse_profile_sample(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	int rate;
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &rate, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	if (rate == 0) {
+		parse_expr_error(parser, expr, "${bld}0${rs} is not a sampling rate.\n");
+		return NULL;
+	}
+
+	parser->ctx->profile_sample = rate;
+	return expr;
 }
 
 /**
@@ -2160,6 +3077,17 @@ static struct bfs_expr *parse_print0(struct bfs_parser *parser, int arg1, int ar
 	return expr;
 }
 
+/**
+ * Parse -printjson.
+ */
+static struct bfs_expr *parse_printjson(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_nullary_action(parser, eval_fprintjson);
+	if (expr) {
+		init_print_expr(parser, expr);
+	}
+	return expr;
+}
+
 /**
  * Parse -printf FORMAT.
  */
@@ -2311,6 +3239,31 @@ list_types:
 	return NULL;
 }
 
+/**
+ * Parse -resume FILE.
+ */
+static struct bfs_expr *parse_resume(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	struct bfs_ctx *ctx = parser->ctx;
+	if (ctx->resume) {
+		parse_expr_error(parser, expr, "Only one ${blu}-resume${rs} is allowed.\n");
+		return NULL;
+	}
+
+	ctx->resume = bfs_checkpoint_load(expr->argv[1]);
+	if (!ctx->resume) {
+		parse_expr_error(parser, expr, "%s.\n", errstr());
+		return NULL;
+	}
+
+	parser->checkpoint_arg = expr->argv;
+	return expr;
+}
+
 /**
  * Parse -s.
  */
@@ -2335,6 +3288,117 @@ static struct bfs_expr *parse_samefile(struct bfs_parser *parser, int arg1, int
 
 	expr->dev = sb.dev;
 	expr->ino = sb.ino;
+	// Directories can only have one name (not counting . and ..)
+	expr->nlink = S_ISDIR(sb.mode) ? 1 : sb.nlink;
+	return expr;
+}
+
+/**
+ * Parse -save-index FILE.
+ */
+static struct bfs_expr *parse_save_index(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	parser->ctx->save_index = expr->argv[1];
+	return expr;
+}
+
+/**
+ * Parse -save-profile FILE.
+ */
+static struct bfs_expr *parse_save_profile(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	parser->ctx->save_profile = expr->argv[1];
+	return expr;
+}
+
+/**
+ * Parse -serve SOCKET.
+ */
+static struct bfs_expr *parse_serve(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	parser->ctx->serve = expr->argv[1];
+	return expr;
+}
+
+/**
+ * Parse -shard K/N.
+ */
+static struct bfs_expr *parse_shard(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	int k, n;
+	char **arg = &expr->argv[1];
+	const char *str = parse_int(parser, arg, *arg, &k, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+	if (!str) {
+		return NULL;
+	}
+	if (*str != '/') {
+		parse_expr_error(parser, expr, "Expected ${bld}K/N${rs}, not ${bld}%pq${rs}.\n", *arg);
+		return NULL;
+	}
+	if (!parse_int(parser, arg, str + 1, &n, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+	if (k < 1 || k > n) {
+		parse_expr_error(parser, expr, "Shard ${bld}%d${rs} is not between ${bld}1${rs} and ${bld}%d${rs}.\n", k, n);
+		return NULL;
+	}
+
+	parser->ctx->shard = k - 1;
+	parser->ctx->shards = n;
+	return expr;
+}
+
+/**
+ * Parse -shard-depth N.
+ */
+static struct bfs_expr *parse_shard_depth(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	int depth;
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &depth, IF_INT | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	parser->ctx->shard_depth = depth;
+	return expr;
+}
+
+/**
+ * Parse -sort-limit N.
+ */
+static struct bfs_expr *parse_sort_limit(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	long long limit;
+	char **arg = &expr->argv[1];
+	if (!parse_int(parser, arg, *arg, &limit, IF_LONG_LONG | IF_UNSIGNED)) {
+		return NULL;
+	}
+
+	parser->ctx->sort_limit = limit;
 	return expr;
 }
 
@@ -2360,6 +3424,8 @@ static struct bfs_expr *parse_search_strategy(struct bfs_parser *parser, int arg
 		ctx->strategy = BFTW_IDS;
 	} else if (strcmp(arg, "eds") == 0) {
 		ctx->strategy = BFTW_EDS;
+	} else if (strcmp(arg, "best") == 0) {
+		ctx->strategy = BFTW_BEST;
 	} else if (strcmp(arg, "help") == 0) {
 		parser->just_info = true;
 		cfile = ctx->cout;
@@ -2377,6 +3443,7 @@ list_strategies:
 	cfprintf(cfile, "  ${bld}dfs${rs}: depth-first search\n");
 	cfprintf(cfile, "  ${bld}ids${rs}: iterative deepening search\n");
 	cfprintf(cfile, "  ${bld}eds${rs}: exponential deepening search\n");
+	cfprintf(cfile, "  ${bld}best${rs}: best-first search, towards the paths and names in the expression\n");
 	return NULL;
 }
 
@@ -2397,6 +3464,105 @@ static struct bfs_expr *parse_since(struct bfs_parser *parser, int field, int ar
 	return expr;
 }
 
+/**
+ * Parse -top/-bottom N FIELD.
+ */
+static struct bfs_expr *parse_top(struct bfs_parser *parser, int largest, int arg2) {
+	const char *arg = parser->argv[0];
+
+	const char *num = parser->argv[1];
+	if (!num) {
+		parse_error(parser, "${blu}%s${rs} needs a count.\n", arg);
+		return NULL;
+	}
+
+	const char *name = parser->argv[2];
+	if (!name) {
+		parse_error(parser, "${blu}%s${rs} needs a field.\n", arg);
+		return NULL;
+	}
+
+	struct bfs_expr *expr = parse_action(parser, eval_top, 3);
+	if (!expr) {
+		return NULL;
+	}
+
+	long long n;
+	if (!parse_int(parser, &expr->argv[1], num, &n, IF_LONG_LONG)) {
+		return NULL;
+	}
+	if (n <= 0) {
+		parse_expr_error(parser, expr, "The count must be at least ${bld}1${rs}.\n");
+		return NULL;
+	}
+
+	static const struct {
+		const char *name;
+		enum bfs_stat_field field;
+	} fields[] = {
+		{"atime", BFS_STAT_ATIME},
+		{"blocks", BFS_STAT_BLOCKS},
+		{"btime", BFS_STAT_BTIME},
+		{"ctime", BFS_STAT_CTIME},
+		{"gid", BFS_STAT_GID},
+		{"inum", BFS_STAT_INO},
+		{"links", BFS_STAT_NLINK},
+		{"mtime", BFS_STAT_MTIME},
+		{"size", BFS_STAT_SIZE},
+		{"uid", BFS_STAT_UID},
+	};
+
+	expr->top_field = 0;
+	for (size_t i = 0; i < countof(fields); ++i) {
+		if (strcmp(name, fields[i].name) == 0) {
+			expr->top_field = fields[i].field;
+			break;
+		}
+	}
+	if (!expr->top_field) {
+		parse_argv_error(parser, &expr->argv[2], 1, "Unknown field.\n");
+		return NULL;
+	}
+
+	init_print_expr(parser, expr);
+
+	expr->top = bfs_top_new(n, largest);
+	if (!expr->top) {
+		parse_perror(parser, "bfs_top_new()");
+		return NULL;
+	}
+
+	return expr;
+}
+
+/**
+ * Parse -touch.
+ */
+static struct bfs_expr *parse_touch(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_nullary_action(parser, eval_touch);
+	if (expr) {
+		parser->ctx->dangerous = true;
+	}
+	return expr;
+}
+
+/**
+ * Parse -touch-time TIME.
+ */
+static struct bfs_expr *parse_touch_time(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(parser, eval_touch);
+	if (!expr) {
+		return NULL;
+	}
+
+	if (parse_reftime(parser, expr) != 0) {
+		return NULL;
+	}
+
+	parser->ctx->dangerous = true;
+	return expr;
+}
+
 /**
  * Parse -size N[cwbkMGTP]?.
  */
@@ -2458,6 +3624,48 @@ static struct bfs_expr *parse_sparse(struct bfs_parser *parser, int arg1, int ar
 	return parse_nullary_test(parser, eval_sparse);
 }
 
+/**
+ * Parse -stat-cache TYPE[,TYPE...].
+ */
+static struct bfs_expr *parse_stat_cache(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	struct bfs_ctx *ctx = parser->ctx;
+	const char *str = expr->argv[1];
+	while (true) {
+		size_t len = strcspn(str, ",");
+		if (len == 0) {
+			parse_expr_error(parser, expr, "Expected a file system type.\n");
+			return NULL;
+		}
+
+		char **type = RESERVE(char *, &ctx->stat_cache, &ctx->nstat_cache);
+		if (!type) {
+			parse_perror(parser, "RESERVE()");
+			return NULL;
+		}
+
+		*type = strndup(str, len);
+		if (!*type) {
+			--ctx->nstat_cache;
+			parse_perror(parser, "strndup()");
+			return NULL;
+		}
+
+		str += len;
+		if (*str == ',') {
+			++str;
+		} else {
+			break;
+		}
+	}
+
+	return expr;
+}
+
 /**
  * Parse -status.
  */
@@ -2466,6 +3674,19 @@ static struct bfs_expr *parse_status(struct bfs_parser *parser, int arg1, int ar
 	return parse_nullary_option(parser);
 }
 
+/**
+ * Parse -trace FILE.
+ */
+static struct bfs_expr *parse_trace(struct bfs_parser *parser, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(parser);
+	if (!expr) {
+		return NULL;
+	}
+
+	parser->ctx->trace = expr->argv[1];
+	return expr;
+}
+
 /**
  * Parse -x?type [bcdpflsD].
  */
@@ -2549,7 +3770,7 @@ static struct bfs_expr *parse_warn(struct bfs_parser *parser, int warn, int arg2
  */
 static struct bfs_expr *parse_xattr(struct bfs_parser *parser, int arg1, int arg2) {
 #if BFS_CAN_CHECK_XATTRS
-	return parse_nullary_test(parser, eval_xattr);
+	return parse_fsade_test(parse_nullary_test(parser, eval_xattr));
 #else
 	parse_error(parser, "Missing platform support.\n");
 	return NULL;
@@ -2561,7 +3782,7 @@ static struct bfs_expr *parse_xattr(struct bfs_parser *parser, int arg1, int arg
  */
 static struct bfs_expr *parse_xattrname(struct bfs_parser *parser, int arg1, int arg2) {
 #if BFS_CAN_CHECK_XATTRS
-	return parse_unary_test(parser, eval_xattrname);
+	return parse_fsade_test(parse_unary_test(parser, eval_xattrname));
 #else
 	parse_error(parser, "Missing platform support.\n");
 	return NULL;
@@ -2717,11 +3938,17 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 	cfprintf(cout, "      Turn on a debugging flag (see ${cyn}-D${rs} ${bld}help${rs})\n");
 	cfprintf(cout, "  ${cyn}-O${bld}N${rs}\n");
 	cfprintf(cout, "      Enable optimization level ${bld}N${rs} (default: ${bld}3${rs})\n");
-	cfprintf(cout, "  ${cyn}-S${rs} ${bld}bfs${rs}|${bld}dfs${rs}|${bld}ids${rs}|${bld}eds${rs}\n");
-	cfprintf(cout, "      Use ${bld}b${rs}readth-${bld}f${rs}irst/${bld}d${rs}epth-${bld}f${rs}irst/${bld}i${rs}terative/${bld}e${rs}xponential ${bld}d${rs}eepening ${bld}s${rs}earch\n");
+	cfprintf(cout, "  ${cyn}-S${rs} ${bld}bfs${rs}|${bld}dfs${rs}|${bld}ids${rs}|${bld}eds${rs}|${bld}best${rs}\n");
+	cfprintf(cout, "      Use ${bld}b${rs}readth-${bld}f${rs}irst/${bld}d${rs}epth-${bld}f${rs}irst/${bld}i${rs}terative/${bld}e${rs}xponential ${bld}d${rs}eepening ${bld}s${rs}earch,\n");
+	cfprintf(cout, "      or ${bld}best${rs}-first search towards the paths and names in the expression\n");
 	cfprintf(cout, "      (default: ${cyn}-S${rs} ${bld}bfs${rs})\n");
 	cfprintf(cout, "  ${cyn}-j${bld}N${rs}\n");
-	cfprintf(cout, "      Search with ${bld}N${rs} threads in parallel (default: number of CPUs, up to ${bld}8${rs})\n\n");
+	cfprintf(cout, "      Search with ${bld}N${rs} threads in parallel (default: number of CPUs, up to ${bld}8${rs})\n");
+	cfprintf(cout, "  ${cyn}-j${bld}auto${rs}\n");
+	cfprintf(cout, "      Adjust the number of threads as the search goes, depending on how much\n");
+	cfprintf(cout, "      waiting for I/O they save\n");
+	cfprintf(cout, "  ${cyn}-j${bld}N${rs},${bld}TYPE${rs}=${bld}M${rs}...\n");
+	cfprintf(cout, "      Also limit asynchronous I/O to file systems of type ${bld}TYPE${rs} to ${bld}M${rs} requests at once\n\n");
 
 	cfprintf(cout, "${bld}Operators:${rs}\n\n");
 
@@ -2746,23 +3973,76 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 
 	cfprintf(cout, "${bld}Options:${rs}\n\n");
 
+	cfprintf(cout, "  ${blu}-append-only${rs}\n");
+	cfprintf(cout, "      Assert that files are only ever added, never modified, so that tests like ${blu}-mmin${rs}\n");
+	cfprintf(cout, "      ${bld}-N${rs} can skip the files in directories that haven't been modified since then\n");
+	cfprintf(cout, "  ${blu}-calibrate${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Measure the cost of each kind of test on a sample of the files, and save the\n");
+	cfprintf(cout, "      estimates to ${bld}FILE${rs} for ${blu}-load-costs${rs}\n");
+	cfprintf(cout, "  ${blu}-changed-since${rs} ${bld}SNAPSHOT${rs}\n");
+	cfprintf(cout, "      Only search the files that changed since a btrfs or ZFS ${bld}SNAPSHOT${rs} was taken\n");
+	cfprintf(cout, "  ${blu}-checkpoint${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Periodically save the directories left to search to ${bld}FILE${rs}, for ${blu}-resume${rs}\n");
+	cfprintf(cout, "  ${blu}-checkpoint-interval${rs} ${bld}SECONDS${rs}\n");
+	cfprintf(cout, "      How often to save a ${blu}-checkpoint${rs} (default: ${bld}60${rs})\n");
 	cfprintf(cout, "  ${blu}-color${rs}\n");
 	cfprintf(cout, "  ${blu}-nocolor${rs}\n");
 	cfprintf(cout, "      Turn colors on or off (default: ${blu}-color${rs} if outputting to a terminal,\n");
 	cfprintf(cout, "      ${blu}-nocolor${rs} otherwise)\n");
+	cfprintf(cout, "  ${blu}-compress${rs} ${bld}none${rs}|${bld}gzip${rs}[:${bld}LEVEL${rs}]\n");
+	cfprintf(cout, "      Compress standard output and the ${blu}-fprint${rs}/${blu}-fls${rs}/etc. files on background threads\n");
+	cfprintf(cout, "      (default: ${bld}none${rs})\n");
 	cfprintf(cout, "  ${blu}-daystart${rs}\n");
 	cfprintf(cout, "      Measure times relative to the start of today\n");
+	cfprintf(cout, "  ${blu}-debug-log${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Record the ${cyn}-D${rs} ${bld}stat${rs}, ${bld}search${rs}, and ${bld}exec${rs} messages in memory, and write them to\n");
+	cfprintf(cout, "      ${bld}FILE${rs} in binary at exit (see ${blu}-debug-decode${rs})\n");
+	cfprintf(cout, "  ${blu}-dedup${rs}\n");
+	cfprintf(cout, "      Skip roots that another root already covers, and read directories that are mounted\n");
+	cfprintf(cout, "      more than once (e.g. bind mounts) only once\n");
 	cfprintf(cout, "  ${blu}-depth${rs}\n");
 	cfprintf(cout, "      Search in post-order (descendents first)\n");
+	cfprintf(cout, "  ${blu}-dir-memory${rs} ${bld}N${rs}[${bld}kMG${rs}]\n");
+	cfprintf(cout, "      Use at most ${bld}N${rs} bytes for directory read buffers\n");
+	cfprintf(cout, "  ${blu}-errors${rs} ${bld}each${rs}|${bld}buffered${rs}|${bld}summary${rs}\n");
+	cfprintf(cout, "      Write each error right away (the default), buffer them, or count the errors from\n");
+	cfprintf(cout, "      reading the tree under each top-level entry and only report the totals at the end\n");
+	cfprintf(cout, "  ${blu}-exec-capture${rs}\n");
+	cfprintf(cout, "      Buffer the output of concurrent ${blu}-exec${rs} commands (${blu}-exec-jobs${rs}), and write it out\n");
+	cfprintf(cout, "      in order as each command finishes\n");
+	cfprintf(cout, "  ${blu}-exec-jobs${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Run up to ${bld}N${rs} ${blu}-exec${rs}/${blu}-execdir${rs} commands at once (default: ${bld}1${rs}).  Applies to\n");
+	cfprintf(cout, "      ${bld}... {} +${rs}, and to ${bld}... ;${rs} when its result is ignored\n");
 	cfprintf(cout, "  ${blu}-files0-from${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "      Search the NUL ('\\0')-separated paths from ${bld}FILE${rs} (${bld}-${rs} for standard input).\n");
 	cfprintf(cout, "  ${blu}-follow${rs}\n");
 	cfprintf(cout, "      Follow all symbolic links (same as ${cyn}-L${rs})\n");
+	cfprintf(cout, "  ${blu}-gitignore${rs}\n");
+	cfprintf(cout, "      Skip the files matched by the ${bld}.gitignore${rs} and ${bld}.ignore${rs} files in the searched\n");
+	cfprintf(cout, "      directories\n");
 	cfprintf(cout, "  ${blu}-ignore_readdir_race${rs}\n");
 	cfprintf(cout, "  ${blu}-noignore_readdir_race${rs}\n");
 	cfprintf(cout, "      Whether to report an error if ${ex}%s${rs} detects that the file tree is modified\n",
 		BFS_COMMAND);
 	cfprintf(cout, "      during the search (default: ${blu}-noignore_readdir_race${rs})\n");
+	cfprintf(cout, "  ${blu}-index${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Search the files saved by ${blu}-save-index${rs} ${bld}FILE${rs} instead of the file system\n");
+	cfprintf(cout, "  ${blu}-index-fields${rs} ${bld}FIELD${rs}[,${bld}FIELD${rs}...]\n");
+	cfprintf(cout, "      Choose the metadata that ${blu}-save-index${rs} records (default: ${bld}all${rs})\n");
+	cfprintf(cout, "  ${blu}-io-depth${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Run at most ${bld}N${rs} I/O operations at once\n");
+	cfprintf(cout, "  ${blu}-io-idle${rs}\n");
+	cfprintf(cout, "      Only use the disk when nothing else is (the idle I/O scheduling class)\n");
+	cfprintf(cout, "  ${blu}-io-rate${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Run at most ${bld}N${rs} I/O operations per second.  With ${blu}-io-depth${rs} or ${blu}-io-rate${rs}, the\n");
+	cfprintf(cout, "      search also slows down on its own when the storage gets slower\n");
+	cfprintf(cout, "  ${blu}-io-timeout${rs} ${bld}SECONDS${rs}\n");
+	cfprintf(cout, "      Give up on opening a directory or ${blu}stat()${rs}ing a file in the background after\n");
+	cfprintf(cout, "      ${bld}SECONDS${rs} (e.g. on a dead network mount), and report it as an error\n");
+	cfprintf(cout, "  ${blu}-load-costs${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Use the cost estimates from ${blu}-calibrate${rs} ${bld}FILE${rs} to optimize the expression\n");
+	cfprintf(cout, "  ${blu}-load-profile${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Use the measurements from ${blu}-save-profile${rs} ${bld}FILE${rs} to optimize the expression\n");
 	cfprintf(cout, "  ${blu}-maxdepth${rs} ${bld}N${rs}\n");
 	cfprintf(cout, "  ${blu}-mindepth${rs} ${bld}N${rs}\n");
 	cfprintf(cout, "      Ignore files deeper/shallower than ${bld}N${rs}\n");
@@ -2774,15 +4054,53 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 	cfprintf(cout, "      Exclude hidden files\n");
 	cfprintf(cout, "  ${blu}-noleaf${rs}\n");
 	cfprintf(cout, "      Ignored; for compatibility with GNU find\n");
+	cfprintf(cout, "  ${blu}-ordered${rs}\n");
+	cfprintf(cout, "      Like ${blu}-parallel${rs}, but print the output in the same order as without it\n");
+	cfprintf(cout, "  ${blu}-parallel${rs}\n");
+	cfprintf(cout, "      Evaluate the expression on multiple threads (see ${cyn}-j${rs}).  Output order is\n");
+	cfprintf(cout, "      unspecified\n");
+	cfprintf(cout, "  ${blu}-parallel-roots${rs}\n");
+	cfprintf(cout, "      Search the starting points on different devices at the same time, on separate\n");
+	cfprintf(cout, "      threads (see ${cyn}-j${rs}).  Output order is unspecified\n");
+	cfprintf(cout, "  ${blu}-profile-sample${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Only time one evaluation in ${bld}N${rs} for ${cyn}-D${rs} ${bld}rates${rs} and ${blu}-save-profile${rs}, and\n");
+	cfprintf(cout, "      extrapolate the rest\n");
 	cfprintf(cout, "  ${blu}-regextype${rs} ${bld}TYPE${rs}\n");
 	cfprintf(cout, "      Use ${bld}TYPE${rs}-flavored regexes (default: ${bld}posix-basic${rs}; see ${blu}-regextype${rs} ${bld}help${rs})\n");
+	cfprintf(cout, "  ${blu}-resume${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Continue an interrupted search from its ${blu}-checkpoint${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "  ${blu}-save-index${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Save the path and metadata of every file visited to ${bld}FILE${rs}\n");
+	cfprintf(cout, "  ${blu}-save-profile${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Measure the cost of each part of the expression, and save it to ${bld}FILE${rs}\n");
+	cfprintf(cout, "  ${blu}-serve${rs} ${bld}SOCKET${rs}\n");
+	cfprintf(cout, "      Listen on ${bld}SOCKET${rs}, and run the searches of clients with ${bld}BFS_SERVER=SOCKET${rs}\n");
+	cfprintf(cout, "  ${blu}-shard${rs} ${bld}K/N${rs}\n");
+	cfprintf(cout, "      Only search the ${bld}K${rs}th of ${bld}N${rs} disjoint parts of the tree, split by hashing the paths\n");
+	cfprintf(cout, "      at ${blu}-shard-depth${rs}\n");
+	cfprintf(cout, "  ${blu}-shard-depth${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Split the tree for ${blu}-shard${rs} at depth ${bld}N${rs} (default: ${bld}1${rs})\n");
+	cfprintf(cout, "  ${blu}-sort-limit${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      With ${cyn}-s${rs}, sort up to ${bld}N${rs} files in memory, and bigger directories in a temporary\n");
+	cfprintf(cout, "      file (default: ${bld}1048576${rs}; ${bld}0${rs} for no limit)\n");
+	cfprintf(cout, "  ${blu}-stat-cache${rs} ${bld}TYPE${rs}[,${bld}TYPE${rs}...]\n");
+	cfprintf(cout, "  ${blu}-nostat-cache${rs}\n");
+	cfprintf(cout, "      Let ${blu}stat()${rs} use cached attributes instead of asking the server on these file\n");
+	cfprintf(cout, "      system types (e.g. ${bld}nfs${rs},${bld}ceph${rs}), or not (default: ${blu}-nostat-cache${rs})\n");
 	cfprintf(cout, "  ${blu}-status${rs}\n");
 	cfprintf(cout, "      Display a status bar while searching\n");
+	cfprintf(cout, "  ${blu}-trace${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Write a timeline of the search to ${bld}FILE${rs} in the Chrome trace event format\n");
 	cfprintf(cout, "  ${blu}-unique${rs}\n");
 	cfprintf(cout, "      Skip any files that have already been seen\n");
+	cfprintf(cout, "  ${blu}-update-index${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Like ${blu}-index${rs} ${bld}FILE${rs}, but bring it up to date first by re-reading the directories\n");
+	cfprintf(cout, "      that changed\n");
 	cfprintf(cout, "  ${blu}-warn${rs}\n");
 	cfprintf(cout, "  ${blu}-nowarn${rs}\n");
 	cfprintf(cout, "      Turn on or off warnings about the command line\n");
+	cfprintf(cout, "  ${blu}-watch${rs}\n");
+	cfprintf(cout, "      After searching, keep running and handle new or modified files as they appear\n");
 	cfprintf(cout, "  ${blu}-xdev${rs}\n");
 	cfprintf(cout, "      Don't descend into other mount points\n\n");
 
@@ -2828,6 +4146,13 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 	cfprintf(cout, "  ${blu}-group${rs} ${bld}NAME${rs}\n");
 	cfprintf(cout, "  ${blu}-user${rs}  ${bld}NAME${rs}\n");
 	cfprintf(cout, "      Find files owned by the group/user ${bld}NAME${rs}\n");
+	cfprintf(cout, "  ${blu}-grep${rs} ${bld}PATTERN${rs}\n");
+	cfprintf(cout, "      Find regular files that contain the literal string ${bld}PATTERN${rs}\n");
+	cfprintf(cout, "  ${blu}-grep-regex${rs} ${bld}REGEX${rs}\n");
+	cfprintf(cout, "      Find regular files with a line that matches the regular expression ${bld}REGEX${rs}\n");
+	cfprintf(cout, "  ${blu}-hash${rs} ${bld}ALGO:DIGEST${rs}\n");
+	cfprintf(cout, "      Find regular files whose contents hash to ${bld}DIGEST${rs} (${bld}ALGO${rs} is one of\n");
+	cfprintf(cout, "      ${bld}blake3${rs}, ${bld}sha256${rs}, or ${bld}xxh64${rs})\n");
 	cfprintf(cout, "  ${blu}-hidden${rs}\n");
 	cfprintf(cout, "      Find hidden files\n");
 #ifdef FNM_CASEFOLD
@@ -2847,6 +4172,10 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 	cfprintf(cout, "      Find symbolic links whose target matches the ${bld}GLOB${rs}\n");
 	cfprintf(cout, "  ${blu}-name${rs} ${bld}GLOB${rs}\n");
 	cfprintf(cout, "      Find files whose name matches the ${bld}GLOB${rs}\n");
+	cfprintf(cout, "  ${blu}-name-from${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "  ${blu}-path-from${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Find files whose name/entire path is exactly one of the lines (or NUL-separated\n");
+	cfprintf(cout, "      entries) in ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-newer${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "      Find files newer than ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-newer${bld}XY${rs} ${bld}REFERENCE${rs}\n");
@@ -2889,9 +4218,29 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 
 	cfprintf(cout, "${bld}Actions:${rs}\n\n");
 
+	cfprintf(cout, "  ${blu}-chmod${rs} ${bld}MODE${rs}\n");
+	cfprintf(cout, "      Change the permissions of the found file, like ${ex}chmod${rs}\n");
+	cfprintf(cout, "  ${blu}-chown${rs} ${bld}[USER][:GROUP]${rs}\n");
+	cfprintf(cout, "      Change the owner and/or group of the found file, like ${ex}chown${rs}\n");
+
+	cfprintf(cout, "  ${blu}-coproc${rs} ${bld}command ... ;${rs}\n");
+	cfprintf(cout, "  ${blu}-coproc0${rs} ${bld}command ... ;${rs}\n");
+	cfprintf(cout, "      Start a command once, and write the found paths to its standard input,\n");
+	cfprintf(cout, "      separated by newlines/NUL bytes\n");
+	cfprintf(cout, "  ${blu}-coproc-test${rs} ${bld}command ... ;${rs}\n");
+	cfprintf(cout, "  ${blu}-coproc-test0${rs} ${bld}command ... ;${rs}\n");
+	cfprintf(cout, "      Like ${blu}-coproc${rs}/${blu}-coproc0${rs}, but read a reply line for each path, and match\n");
+	cfprintf(cout, "      if it starts with ${bld}y${rs}\n");
+	cfprintf(cout, "  ${blu}-count${rs}\n");
+	cfprintf(cout, "      Print the number of found files when the search finishes\n");
+	cfprintf(cout, "  ${blu}-count-by${rs} ${bld}root${rs}|${bld}depth${rs}\n");
+	cfprintf(cout, "      Like ${blu}-count${rs}, but print a count for each root path/depth\n");
 	cfprintf(cout, "  ${blu}-delete${rs}\n");
 	cfprintf(cout, "  ${blu}-rm${rs}\n");
 	cfprintf(cout, "      Delete any found files (implies ${blu}-depth${rs})\n");
+	cfprintf(cout, "  ${blu}-du${rs}\n");
+	cfprintf(cout, "      Print the disk usage of each file, including everything beneath it, in KiB\n");
+	cfprintf(cout, "      (implies ${blu}-depth${rs})\n");
 	cfprintf(cout, "  ${blu}-exec${rs} ${bld}command ... {} ;${rs}\n");
 	cfprintf(cout, "      Execute a command\n");
 	cfprintf(cout, "  ${blu}-exec${rs} ${bld}command ... {} +${rs}\n");
@@ -2909,8 +4258,9 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 	cfprintf(cout, "  ${blu}-fprint${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprint0${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprintf${rs} ${bld}FILE${rs} ${bld}FORMAT${rs}\n");
-	cfprintf(cout, "      Like ${blu}-ls${rs}/${blu}-print${rs}/${blu}-print0${rs}/${blu}-printf${rs}, but write to ${bld}FILE${rs} instead of standard\n"
-	               "      output\n");
+	cfprintf(cout, "  ${blu}-fprintjson${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Like ${blu}-ls${rs}/${blu}-print${rs}/${blu}-print0${rs}/${blu}-printf${rs}/${blu}-printjson${rs}, but write to ${bld}FILE${rs} instead\n"
+	               "      of standard output\n");
 	cfprintf(cout, "  ${blu}-limit${rs} ${bld}N${rs}\n");
 	cfprintf(cout, "      Quit after this action is evaluated ${bld}N${rs} times\n");
 	cfprintf(cout, "  ${blu}-ls${rs}\n");
@@ -2923,6 +4273,8 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 	cfprintf(cout, "  ${blu}-printf${rs} ${bld}FORMAT${rs}\n");
 	cfprintf(cout, "      Print according to a format string (see ${ex}man${rs} ${bld}find${rs}).  The additional format\n");
 	cfprintf(cout, "      directives %%w and %%W${bld}k${rs} for printing file birth times are supported.\n");
+	cfprintf(cout, "  ${blu}-printjson${rs}\n");
+	cfprintf(cout, "      Print the path and metadata of the found file as a line of JSON\n");
 	cfprintf(cout, "  ${blu}-printx${rs}\n");
 	cfprintf(cout, "      Like ${blu}-print${rs}, but escape whitespace and quotation characters, to make the\n");
 	cfprintf(cout, "      output safe for ${ex}xargs${rs}.  Consider using ${blu}-print0${rs} and ${ex}xargs${rs} ${bld}-0${rs} instead.\n");
@@ -2930,6 +4282,15 @@ static struct bfs_expr *parse_help(struct bfs_parser *parser, int arg1, int arg2
 	cfprintf(cout, "      Don't descend into this directory\n");
 	cfprintf(cout, "  ${blu}-quit${rs}\n");
 	cfprintf(cout, "      Quit immediately\n");
+	cfprintf(cout, "  ${blu}-top${rs}    ${bld}N${rs} ${bld}FIELD${rs}\n");
+	cfprintf(cout, "  ${blu}-bottom${rs} ${bld}N${rs} ${bld}FIELD${rs}\n");
+	cfprintf(cout, "      When the search finishes, print the ${bld}N${rs} found files with the largest/smallest\n");
+	cfprintf(cout, "      ${bld}FIELD${rs} (${bld}size${rs}, ${bld}blocks${rs}, ${bld}links${rs}, ${bld}inum${rs}, ${bld}uid${rs}, ${bld}gid${rs}, ${bld}atime${rs}, ${bld}btime${rs}, ${bld}ctime${rs}, or ${bld}mtime${rs})\n");
+	cfprintf(cout, "  ${blu}-touch${rs}\n");
+	cfprintf(cout, "  ${blu}-touch-time${rs} ${bld}TIME${rs}\n");
+	cfprintf(cout, "      Set the access and modification times of the found file to now, or ${bld}TIME${rs}\n");
+	cfprintf(cout, "  ${blu}-debug-decode${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Print the messages recorded by ${blu}-debug-log${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-version${rs}\n");
 	cfprintf(cout, "      Print version information\n");
 	cfprintf(cout, "  ${blu}-help${rs}\n");
@@ -3039,23 +4400,46 @@ static const struct table_entry parse_table[] = {
 	{"-amin", BFS_TEST, parse_min, BFS_STAT_ATIME},
 	{"-and", BFS_OPERATOR},
 	{"-anewer", BFS_TEST, parse_newer, BFS_STAT_ATIME},
+	{"-append-only", BFS_OPTION, parse_append_only},
 	{"-asince", BFS_TEST, parse_since, BFS_STAT_ATIME},
 	{"-atime", BFS_TEST, parse_time, BFS_STAT_ATIME},
+	{"-bottom", BFS_ACTION, parse_top, false},
+	{"-calibrate", BFS_OPTION, parse_calibrate},
 	{"-capable", BFS_TEST, parse_capable},
+	{"-changed-since", BFS_OPTION, parse_changed_since},
+	{"-checkpoint", BFS_OPTION, parse_checkpoint},
+	{"-checkpoint-interval", BFS_OPTION, parse_checkpoint_interval},
+	{"-chmod", BFS_ACTION, parse_chmod},
+	{"-chown", BFS_ACTION, parse_chown},
 	{"-cmin", BFS_TEST, parse_min, BFS_STAT_CTIME},
 	{"-cnewer", BFS_TEST, parse_newer, BFS_STAT_CTIME},
 	{"-color", BFS_OPTION, parse_color, true},
+	{"-compress", BFS_OPTION, parse_compress},
 	{"-context", BFS_TEST, parse_context, true},
+	{"-coproc", BFS_ACTION, parse_coproc, 0},
+	{"-coproc-test", BFS_ACTION, parse_coproc, BFS_COPROC_TEST},
+	{"-coproc-test0", BFS_ACTION, parse_coproc, BFS_COPROC_TEST | BFS_COPROC_NUL},
+	{"-coproc0", BFS_ACTION, parse_coproc, BFS_COPROC_NUL},
+	{"-count", BFS_ACTION, parse_count},
+	{"-count-by", BFS_ACTION, parse_count_by},
 	{"-csince", BFS_TEST, parse_since, BFS_STAT_CTIME},
 	{"-ctime", BFS_TEST, parse_time, BFS_STAT_CTIME},
 	{"-d", BFS_FLAG, parse_depth},
 	{"-daystart", BFS_OPTION, parse_daystart},
+	{"-debug-decode", BFS_ACTION, parse_debug_decode},
+	{"-debug-log", BFS_OPTION, parse_debug_log},
+	{"-dedup", BFS_OPTION, parse_dedup},
 	{"-delete", BFS_ACTION, parse_delete},
 	{"-depth", BFS_OPTION, parse_depth_n},
+	{"-dir-memory", BFS_OPTION, parse_dir_memory},
+	{"-du", BFS_ACTION, parse_du},
 	{"-empty", BFS_TEST, parse_empty},
+	{"-errors", BFS_OPTION, parse_errors},
 	{"-exclude", BFS_OPERATOR},
 	{"-exec", BFS_ACTION, parse_exec, 0},
 	{"-execdir", BFS_ACTION, parse_exec, BFS_EXEC_CHDIR},
+	{"-exec-capture", BFS_OPTION, parse_exec_capture},
+	{"-exec-jobs", BFS_OPTION, parse_exec_jobs},
 	{"-executable", BFS_TEST, parse_access, X_OK},
 	{"-exit", BFS_ACTION, parse_exit},
 	{"-f", BFS_FLAG, parse_f, .needs_arg = true},
@@ -3067,15 +4451,26 @@ static const struct table_entry parse_table[] = {
 	{"-fprint", BFS_ACTION, parse_fprint},
 	{"-fprint0", BFS_ACTION, parse_fprint0},
 	{"-fprintf", BFS_ACTION, parse_fprintf},
+	{"-fprintjson", BFS_ACTION, parse_fprintjson},
 	{"-fstype", BFS_TEST, parse_fstype},
 	{"-gid", BFS_TEST, parse_group},
+	{"-gitignore", BFS_OPTION, parse_gitignore},
+	{"-grep", BFS_TEST, parse_grep, false},
+	{"-grep-regex", BFS_TEST, parse_grep, true},
 	{"-group", BFS_TEST, parse_group},
+	{"-hash", BFS_TEST, parse_hash},
 	{"-help", BFS_ACTION, parse_help},
 	{"-hidden", BFS_TEST, parse_hidden},
 	{"-ignore_readdir_race", BFS_OPTION, parse_ignore_races, true},
 	{"-ilname", BFS_TEST, parse_lname, true},
 	{"-iname", BFS_TEST, parse_name, true},
+	{"-index", BFS_OPTION, parse_index},
+	{"-index-fields", BFS_OPTION, parse_index_fields},
 	{"-inum", BFS_TEST, parse_inum},
+	{"-io-depth", BFS_OPTION, parse_io_depth},
+	{"-io-idle", BFS_OPTION, parse_io_idle},
+	{"-io-rate", BFS_OPTION, parse_io_rate},
+	{"-io-timeout", BFS_OPTION, parse_io_timeout},
 	{"-ipath", BFS_TEST, parse_path, true},
 	{"-iregex", BFS_TEST, parse_regex, BFS_REGEX_ICASE},
 	{"-iwholename", BFS_TEST, parse_path, true},
@@ -3083,6 +4478,8 @@ static const struct table_entry parse_table[] = {
 	{"-limit", BFS_ACTION, parse_limit},
 	{"-links", BFS_TEST, parse_links},
 	{"-lname", BFS_TEST, parse_lname, false},
+	{"-load-costs", BFS_OPTION, parse_load_costs},
+	{"-load-profile", BFS_OPTION, parse_load_profile},
 	{"-ls", BFS_ACTION, parse_ls},
 	{"-maxdepth", BFS_OPTION, parse_depth_limit, false},
 	{"-mindepth", BFS_OPTION, parse_depth_limit, true},
@@ -3092,6 +4489,7 @@ static const struct table_entry parse_table[] = {
 	{"-msince", BFS_TEST, parse_since, BFS_STAT_MTIME},
 	{"-mtime", BFS_TEST, parse_time, BFS_STAT_MTIME},
 	{"-name", BFS_TEST, parse_name, false},
+	{"-name-from", BFS_TEST, parse_name_from, false},
 	{"-newer", BFS_TEST, parse_newer, BFS_STAT_MTIME},
 	{"-newer", BFS_TEST, parse_newerxy, .prefix = true},
 	{"-nocolor", BFS_OPTION, parse_color, false},
@@ -3100,6 +4498,7 @@ static const struct table_entry parse_table[] = {
 	{"-nohidden", BFS_TEST, parse_nohidden},
 	{"-noignore_readdir_race", BFS_OPTION, parse_ignore_races, false},
 	{"-noleaf", BFS_OPTION, parse_noleaf},
+	{"-nostat-cache", BFS_OPTION, parse_nostat_cache},
 	{"-not", BFS_OPERATOR},
 	{"-nouser", BFS_TEST, parse_nouser},
 	{"-nowarn", BFS_OPTION, parse_warn, false},
@@ -3107,32 +4506,52 @@ static const struct table_entry parse_table[] = {
 	{"-ok", BFS_ACTION, parse_exec, BFS_EXEC_CONFIRM},
 	{"-okdir", BFS_ACTION, parse_exec, BFS_EXEC_CONFIRM | BFS_EXEC_CHDIR},
 	{"-or", BFS_OPERATOR},
+	{"-ordered", BFS_OPTION, parse_ordered},
+	{"-parallel", BFS_OPTION, parse_parallel},
+	{"-parallel-roots", BFS_OPTION, parse_parallel_roots},
 	{"-path", BFS_TEST, parse_path, false},
+	{"-path-from", BFS_TEST, parse_name_from, true},
 	{"-perm", BFS_TEST, parse_perm},
 	{"-print", BFS_ACTION, parse_print},
 	{"-print0", BFS_ACTION, parse_print0},
 	{"-printf", BFS_ACTION, parse_printf},
+	{"-printjson", BFS_ACTION, parse_printjson},
 	{"-printx", BFS_ACTION, parse_printx},
+	{"-profile-sample", BFS_OPTION, parse_profile_sample},
 	{"-prune", BFS_ACTION, parse_prune},
 	{"-quit", BFS_ACTION, parse_quit},
 	{"-readable", BFS_TEST, parse_access, R_OK},
 	{"-regex", BFS_TEST, parse_regex, 0},
 	{"-regextype", BFS_OPTION, parse_regextype},
+	{"-resume", BFS_OPTION, parse_resume},
 	{"-rm", BFS_ACTION, parse_delete},
 	{"-s", BFS_FLAG, parse_s},
 	{"-samefile", BFS_TEST, parse_samefile},
+	{"-save-index", BFS_OPTION, parse_save_index},
+	{"-save-profile", BFS_OPTION, parse_save_profile},
+	{"-serve", BFS_OPTION, parse_serve},
+	{"-shard", BFS_OPTION, parse_shard},
+	{"-shard-depth", BFS_OPTION, parse_shard_depth},
 	{"-since", BFS_TEST, parse_since, BFS_STAT_MTIME},
 	{"-size", BFS_TEST, parse_size},
+	{"-sort-limit", BFS_OPTION, parse_sort_limit},
 	{"-sparse", BFS_TEST, parse_sparse},
+	{"-stat-cache", BFS_OPTION, parse_stat_cache},
 	{"-status", BFS_OPTION, parse_status},
+	{"-top", BFS_ACTION, parse_top, true},
+	{"-touch", BFS_ACTION, parse_touch},
+	{"-touch-time", BFS_ACTION, parse_touch_time},
+	{"-trace", BFS_OPTION, parse_trace},
 	{"-true", BFS_TEST, parse_const, true},
 	{"-type", BFS_TEST, parse_type, false},
 	{"-uid", BFS_TEST, parse_user},
 	{"-unique", BFS_OPTION, parse_unique},
+	{"-update-index", BFS_OPTION, parse_index, true},
 	{"-used", BFS_TEST, parse_used},
 	{"-user", BFS_TEST, parse_user},
 	{"-version", BFS_ACTION, parse_version},
 	{"-warn", BFS_OPTION, parse_warn, true},
+	{"-watch", BFS_OPTION, parse_watch},
 	{"-wholename", BFS_TEST, parse_path, false},
 	{"-writable", BFS_TEST, parse_access, W_OK},
 	{"-x", BFS_FLAG, parse_xdev},
@@ -3537,11 +4956,18 @@ static struct bfs_expr *parse_whole_expr(struct bfs_parser *parser) {
 			return NULL;
 		}
 
-		struct bfs_expr *print = parse_new_expr(parser, eval_fprint, 1, &fake_print_arg, BFS_ACTION);
+		struct bfs_expr *print;
+		if (ctx->visit) {
+			print = parse_new_expr(parser, eval_visit, 1, &fake_visit_arg, BFS_ACTION);
+		} else {
+			print = parse_new_expr(parser, eval_fprint, 1, &fake_print_arg, BFS_ACTION);
+			if (print) {
+				init_print_expr(parser, print);
+			}
+		}
 		if (!print) {
 			return NULL;
 		}
-		init_print_expr(parser, print);
 
 		expr = new_binary_expr(parser, eval_and, expr, print, &fake_and_arg);
 		if (!expr) {
@@ -3577,6 +5003,46 @@ static struct bfs_expr *parse_whole_expr(struct bfs_parser *parser) {
 		return NULL;
 	}
 
+	// Per-directory totals need each directory to outlive its children
+	if (parser->du_arg && (ctx->strategy == BFTW_IDS || ctx->strategy == BFTW_EDS)) {
+		parse_argv_error(parser, parser->du_arg, 1,
+			"${blu}%s${rs} does not work with ${blu}-S ids/eds${rs}.\n",
+			parser->du_arg[0]);
+		return NULL;
+	}
+
+	char **checkpoint = parser->checkpoint_arg;
+	if (checkpoint) {
+		// Checkpoints only hold the unread directories, so they can't
+		// capture post-order visits, deepening passes, or other state
+		const char *conflict = NULL;
+		if (parser->depth_arg) {
+			parse_conflict_error(parser, checkpoint, 2, parser->depth_arg, 1,
+				"${blu}%s${rs} does not work in the presence of ${blu}%s${rs}.\n",
+				checkpoint[0], parser->depth_arg[0]);
+			return NULL;
+		} else if (ctx->strategy == BFTW_IDS || ctx->strategy == BFTW_EDS) {
+			conflict = "-S ids/eds";
+		} else if (ctx->unique) {
+			conflict = "-unique";
+		} else if (ctx->flags & BFTW_SPLIT_ROOTS) {
+			conflict = "-parallel-roots";
+		} else if (ctx->index_path) {
+			conflict = "-index";
+		} else if (ctx->changed_since) {
+			conflict = "-changed-since";
+		} else if (ctx->watch) {
+			conflict = "-watch";
+		}
+
+		if (conflict) {
+			parse_argv_error(parser, checkpoint, 2,
+				"${blu}%s${rs} does not work with ${blu}%s${rs}.\n",
+				checkpoint[0], conflict);
+			return NULL;
+		}
+	}
+
 	return expr;
 }
 
@@ -3590,6 +5056,8 @@ static const char *bftw_strategy_name(enum bftw_strategy strategy) {
 		return "ids";
 	case BFTW_EDS:
 		return "eds";
+	case BFTW_BEST:
+		return "best";
 	}
 
 	bfs_bug("Invalid strategy");
@@ -3658,7 +5126,16 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 		cfprintf(cerr, " ${cyn}-s${rs}");
 	}
 
-	cfprintf(cerr, " ${cyn}-j${bld}%d${rs}", ctx->threads);
+	if (ctx->auto_threads) {
+		cfprintf(cerr, " ${cyn}-j${bld}auto");
+	} else {
+		cfprintf(cerr, " ${cyn}-j${bld}%d", ctx->threads);
+	}
+	for (size_t i = 0; i < ctx->nfslimits; ++i) {
+		const struct bftw_fslimit *fslimit = &ctx->fslimits[i];
+		cfprintf(cerr, ",%s=%zu", fslimit->type, fslimit->limit);
+	}
+	cfprintf(cerr, "${rs}");
 
 	if (ctx->optlevel != 3) {
 		cfprintf(cerr, " ${cyn}-O${bld}%d${rs}", ctx->optlevel);
@@ -3711,12 +5188,88 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 	if (ctx->flags & BFTW_SKIP_MOUNTS) {
 		cfprintf(cerr, " ${blu}-mount${rs}");
 	}
+	if (ctx->flags & BFTW_SPLIT_ROOTS) {
+		cfprintf(cerr, " ${blu}-parallel-roots${rs}");
+	}
+	if (ctx->exec_jobs != 1) {
+		cfprintf(cerr, " ${blu}-exec-jobs${rs} ${bld}%d${rs}", ctx->exec_jobs);
+	}
+	if (ctx->io_depth) {
+		cfprintf(cerr, " ${blu}-io-depth${rs} ${bld}%zu${rs}", ctx->io_depth);
+	}
+	if (ctx->io_idle) {
+		cfprintf(cerr, " ${blu}-io-idle${rs}");
+	}
+	if (ctx->io_rate) {
+		cfprintf(cerr, " ${blu}-io-rate${rs} ${bld}%zu${rs}", ctx->io_rate);
+	}
+	if (ctx->io_timeout) {
+		cfprintf(cerr, " ${blu}-io-timeout${rs} ${bld}%d${rs}", ctx->io_timeout);
+	}
+	for (size_t i = 0; i < ctx->nstat_cache; ++i) {
+		if (i == 0) {
+			cfprintf(cerr, " ${blu}-stat-cache${rs} ");
+		} else {
+			cfprintf(cerr, ",");
+		}
+		cfprintf(cerr, "${bld}%s${rs}", ctx->stat_cache[i]);
+	}
+	if (ctx->compress == BFS_COMPRESS_GZIP) {
+		if (ctx->compress_level < 0) {
+			cfprintf(cerr, " ${blu}-compress${rs} ${bld}gzip${rs}");
+		} else {
+			cfprintf(cerr, " ${blu}-compress${rs} ${bld}gzip:%d${rs}", ctx->compress_level);
+		}
+	}
+	if (ctx->errors == BFS_ERRORS_BUFFERED) {
+		cfprintf(cerr, " ${blu}-errors${rs} ${bld}buffered${rs}");
+	} else if (ctx->errors == BFS_ERRORS_SUMMARY) {
+		cfprintf(cerr, " ${blu}-errors${rs} ${bld}summary${rs}");
+	}
+	if (ctx->exec_capture) {
+		cfprintf(cerr, " ${blu}-exec-capture${rs}");
+	}
+	if (ctx->dir_memory) {
+		cfprintf(cerr, " ${blu}-dir-memory${rs} ${bld}%zu${rs}", ctx->dir_memory);
+	}
+	if (ctx->sort_limit != 1 << 20) {
+		cfprintf(cerr, " ${blu}-sort-limit${rs} ${bld}%zu${rs}", ctx->sort_limit);
+	}
+	if (ctx->profile_sample > 1) {
+		cfprintf(cerr, " ${blu}-profile-sample${rs} ${bld}%zu${rs}", ctx->profile_sample);
+	}
+	if (ctx->shards) {
+		cfprintf(cerr, " ${blu}-shard${rs} ${bld}%zu/%zu${rs}", ctx->shard + 1, ctx->shards);
+	}
+	if (ctx->shard_depth != 1) {
+		cfprintf(cerr, " ${blu}-shard-depth${rs} ${bld}%zu${rs}", ctx->shard_depth);
+	}
+	if (ctx->checkpoint) {
+		cfprintf(cerr, " ${blu}-checkpoint${rs} ${bld}%pq${rs}", ctx->checkpoint);
+	}
+	if (ctx->checkpoint_interval != 60) {
+		cfprintf(cerr, " ${blu}-checkpoint-interval${rs} ${bld}%d${rs}", ctx->checkpoint_interval);
+	}
+	if (ctx->ordered) {
+		cfprintf(cerr, " ${blu}-ordered${rs}");
+	} else if (ctx->parallel) {
+		cfprintf(cerr, " ${blu}-parallel${rs}");
+	}
+	if (ctx->dedup) {
+		cfprintf(cerr, " ${blu}-dedup${rs}");
+	}
+	if (ctx->gitignore) {
+		cfprintf(cerr, " ${blu}-gitignore${rs}");
+	}
 	if (ctx->status) {
 		cfprintf(cerr, " ${blu}-status${rs}");
 	}
 	if (ctx->unique) {
 		cfprintf(cerr, " ${blu}-unique${rs}");
 	}
+	if (ctx->watch) {
+		cfprintf(cerr, " ${blu}-watch${rs}");
+	}
 	if ((ctx->flags & (BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS)) == BFTW_PRUNE_MOUNTS) {
 		cfprintf(cerr, " ${blu}-xdev${rs}");
 	}
@@ -3738,13 +5291,17 @@ static void dump_costs(const struct bfs_ctx *ctx) {
 	bfs_debug(ctx, DEBUG_COST, "Probability: ~${ylw}%g%%${rs}\n", 100.0 * expr->probability);
 }
 
-struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
+/** Parse the command line, with an optional visit callback. */
+static struct bfs_ctx *parse_cmdline(int argc, char *argv[], bftw_callback *visit, void *ptr) {
 	struct bfs_ctx *ctx = bfs_ctx_new();
 	if (!ctx) {
 		perror("bfs_ctx_new()");
 		goto fail;
 	}
 
+	ctx->visit = visit;
+	ctx->visit_ptr = ptr;
+
 	static char *default_argv[] = {BFS_COMMAND, NULL};
 	if (argc < 1) {
 		argc = 1;
@@ -3765,18 +5322,23 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		use_color = COLOR_NEVER;
 	}
 
-	ctx->colors = parse_colors();
-	if (!ctx->colors) {
-		ctx->colors_error = errno;
+	bool stdin_tty = isatty(STDIN_FILENO);
+	bool stdout_tty = isatty(STDOUT_FILENO);
+	bool stderr_tty = isatty(STDERR_FILENO);
+
+	// Only parse $LS_COLORS if we'll actually use it
+	const struct colors *colors = NULL;
+	if (use_color && (stdout_tty || stderr_tty)) {
+		colors = bfs_ctx_colors(ctx);
 	}
 
-	ctx->cerr = cfwrap(stderr, use_color ? ctx->colors : NULL, false);
+	ctx->cerr = cfwrap(stderr, colors, false);
 	if (!ctx->cerr) {
 		perror("cfwrap()");
 		goto fail;
 	}
 
-	ctx->cout = cfwrap(stdout, use_color ? ctx->colors : NULL, false);
+	ctx->cout = cfwrap(stdout, colors, false);
 	if (!ctx->cout) {
 		bfs_perror(ctx, "cfwrap()");
 		goto fail;
@@ -3787,15 +5349,24 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		goto fail;
 	}
 
-	bool stdin_tty = isatty(STDIN_FILENO);
-	bool stdout_tty = isatty(STDOUT_FILENO);
-	bool stderr_tty = isatty(STDERR_FILENO);
-
 	if (getenv("POSIXLY_CORRECT")) {
 		ctx->posixly_correct = true;
 	} else {
 		ctx->warn = stdin_tty;
 	}
+
+	if (getenv("BFS_SQPOLL")) {
+		ctx->flags |= BFTW_SQPOLL;
+	}
+	if (getenv("BFS_AFFINITY")) {
+		ctx->flags |= BFTW_AFFINITY;
+	}
+	if (getenv("BFS_INODE_ORDER")) {
+		ctx->flags |= BFTW_INO_ORDER;
+	}
+	if (getenv("BFS_BULKSTAT")) {
+		ctx->flags |= BFTW_BULKSTAT;
+	}
 	ctx->interactive = stdin_tty && stderr_tty;
 
 	struct bfs_parser parser = {
@@ -3815,6 +5386,9 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		.mount_arg = NULL,
 		.xdev_arg = NULL,
 		.files0_stdin_arg = NULL,
+		.files0_arg = NULL,
+		.checkpoint_arg = NULL,
+		.du_arg = NULL,
 		.ok_expr = NULL,
 		.now = ctx->now,
 	};
@@ -3833,10 +5407,15 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		}
 	}
 
-	if (parser.use_color == COLOR_AUTO && !ctx->colors) {
+	if (parser.use_color == COLOR_AUTO && ctx->colors_error) {
 		bfs_warning(ctx, "Error parsing $$LS_COLORS: %s.\n\n", xstrerror(ctx->colors_error));
 	}
 
+	// Every output file is open by now, and nothing has been written yet
+	if (ctx->compress != BFS_COMPRESS_NONE && bfs_ctx_compress(ctx) != 0) {
+		goto fail;
+	}
+
 	if (bfs_optimize(ctx) != 0) {
 		if (errno != 0) {
 			bfs_perror(ctx, "bfs_optimize()");
@@ -3844,7 +5423,14 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		goto fail;
 	}
 
-	if (ctx->npaths == 0 && parser.implicit_root) {
+	if (ctx->files0 && !parse_files0_streamable(ctx)) {
+		if (parse_files0_read(&parser) != 0) {
+			goto fail;
+		}
+	}
+
+	// Without explicit roots, -index searches every saved root
+	if (ctx->npaths == 0 && parser.implicit_root && !ctx->index) {
 		if (parse_root(&parser, ".") != 0) {
 			goto fail;
 		}
@@ -3865,3 +5451,11 @@ fail:
 	bfs_ctx_free(ctx);
 	return NULL;
 }
+
+struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
+	return parse_cmdline(argc, argv, NULL, NULL);
+}
+
+struct bfs_ctx *bfs_parse_query(int argc, char *argv[], bftw_callback *visit, void *ptr) {
+	return parse_cmdline(argc, argv, visit, ptr);
+}
@@ -8,6 +8,8 @@
 #ifndef BFS_PARSE_H
 #define BFS_PARSE_H
 
+#include "bftw.h"
+
 /**
  * Parse the command line.
  *
@@ -20,4 +22,24 @@
  */
 struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]);
 
+/**
+ * Parse a query for an embedded search.  Like bfs_parse_cmdline(), but files
+ * that would be printed by the implicit -print are passed to a callback
+ * instead.  The search is run with bfs_eval(), and the context freed with
+ * bfs_ctx_free().
+ *
+ * @param argc
+ *         The number of arguments.
+ * @param argv
+ *         The arguments to parse, starting with the command name.
+ * @param visit
+ *         The callback for matching files.  Its return value controls the
+ *         search like -prune (BFTW_PRUNE) and -quit (BFTW_STOP) do.
+ * @param ptr
+ *         An argument to pass to the callback.
+ * @return
+ *         A new bfs context, or NULL on failure.
+ */
+struct bfs_ctx *bfs_parse_query(int argc, char *argv[], bftw_callback *visit, void *ptr);
+
 #endif // BFS_PARSE_H
@@ -0,0 +1,168 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "pathmatch.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "diag.h"
+
+#include <langinfo.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The state bit that records a non-ASCII character, since case-insensitive
+ * patterns are only folded correctly for ASCII strings.
+ */
+#define PATHMATCH_NONASCII ((uint64_t)1 << 63)
+
+/** A state bit that is always set, so no state is zero. */
+#define PATHMATCH_VALID ((uint64_t)1 << 62)
+
+/** The maximum number of bits available for pattern positions. */
+#define PATHMATCH_BITS 62
+
+/** The maximum number of patterns. */
+#define PATHMATCH_MAX 32
+
+/**
+ * Each pattern with m tokens (literal characters or star runs) gets m + 1
+ * consecutive bits, where bit i means "the first i tokens have matched."
+ */
+struct bfs_pathmatch {
+	/** The positions that advance on each character. */
+	uint64_t chars[256];
+	/** The positions just after a star, which loop on any character. */
+	uint64_t loops;
+	/** The positions just before a star, which also reach the next one. */
+	uint64_t skips;
+	/** The starting state. */
+	uint64_t start;
+	/** The number of bits in use. */
+	size_t nbits;
+
+	/** The accepting bit for each pattern. */
+	uint64_t accept[PATHMATCH_MAX];
+	/** Whether each pattern is case-insensitive. */
+	bool casefold[PATHMATCH_MAX];
+	/** The number of patterns. */
+	size_t npatterns;
+};
+
+struct bfs_pathmatch *bfs_pathmatch_new(void) {
+	return ZALLOC(struct bfs_pathmatch);
+}
+
+/** Check if matching bytes is the same as matching characters. */
+static bool pathmatch_bytewise(void) {
+	if (MB_CUR_MAX == 1) {
+		return true;
+	}
+
+	// UTF-8 never puts ASCII bytes inside multi-byte characters
+	const char *charmap = nl_langinfo(CODESET);
+	return charmap && strcmp(charmap, "UTF-8") == 0;
+}
+
+/** Follow the star transitions that don't consume a character. */
+static uint64_t pathmatch_closure(const struct bfs_pathmatch *pm, uint64_t state) {
+	// Star runs are collapsed, so one step is enough
+	return state | ((state & pm->skips) << 1);
+}
+
+int bfs_pathmatch_add(struct bfs_pathmatch *pm, const char *pattern, bool casefold) {
+	if (pm->npatterns >= PATHMATCH_MAX) {
+		return -1;
+	}
+
+	size_t len = strlen(pattern);
+	if (strcspn(pattern, "?[\\") != len || asciinlen(pattern, len) != len) {
+		return -1;
+	}
+
+	if (!pathmatch_bytewise() || (casefold && !ascii_casefold_safe())) {
+		return -1;
+	}
+
+	size_t ntokens = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if (pattern[i] != '*' || i == 0 || pattern[i - 1] != '*') {
+			++ntokens;
+		}
+	}
+	if (pm->nbits + ntokens + 1 > PATHMATCH_BITS) {
+		return -1;
+	}
+
+	size_t bit = pm->nbits;
+	pm->start |= (uint64_t)1 << bit;
+
+	for (size_t i = 0; i < len; ++i) {
+		char c = pattern[i];
+		uint64_t here = (uint64_t)1 << bit;
+		if (c == '*') {
+			if (i > 0 && pattern[i - 1] == '*') {
+				continue;
+			}
+			pm->skips |= here;
+			pm->loops |= here << 1;
+		} else if (casefold) {
+			pm->chars[(unsigned char)ascii_tolower(c)] |= here << 1;
+			pm->chars[(unsigned char)ascii_toupper(c)] |= here << 1;
+		} else {
+			pm->chars[(unsigned char)c] |= here << 1;
+		}
+		++bit;
+	}
+
+	size_t id = pm->npatterns++;
+	pm->accept[id] = (uint64_t)1 << bit;
+	pm->casefold[id] = casefold;
+	pm->nbits = bit + 1;
+	pm->start = pathmatch_closure(pm, pm->start);
+	return id;
+}
+
+uint64_t bfs_pathmatch_start(const struct bfs_pathmatch *pm) {
+	return pm->start | PATHMATCH_VALID;
+}
+
+uint64_t bfs_pathmatch_advance(const struct bfs_pathmatch *pm, uint64_t state, const char *str) {
+	bfs_assert(state & PATHMATCH_VALID);
+	uint64_t flags = state & (PATHMATCH_NONASCII | PATHMATCH_VALID);
+	state &= ~flags;
+
+	for (const unsigned char *s = (const unsigned char *)str; *s; ++s) {
+		if (*s >= 0x80) {
+			flags |= PATHMATCH_NONASCII;
+		}
+
+		if (!state) {
+			// Dead, but keep looking for non-ASCII characters
+			if (flags & PATHMATCH_NONASCII) {
+				break;
+			}
+			continue;
+		}
+
+		state = ((state << 1) & pm->chars[*s]) | (state & pm->loops);
+		state = pathmatch_closure(pm, state);
+	}
+
+	return state | flags;
+}
+
+int bfs_pathmatch_result(const struct bfs_pathmatch *pm, uint64_t state, int id) {
+	if (pm->casefold[id] && (state & PATHMATCH_NONASCII)) {
+		return -1;
+	}
+
+	return !!(state & pm->accept[id]);
+}
+
+void bfs_pathmatch_free(struct bfs_pathmatch *pm) {
+	free(pm);
+}
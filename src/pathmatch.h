@@ -0,0 +1,69 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Incremental matching of -path globs, one path component at a time.
+ *
+ * Patterns made of literals and stars are compiled together into a single
+ * shift-and automaton whose whole state fits in 64 bits.  The state after a
+ * directory's path is saved with the directory, so each of its children only
+ * has to advance the automaton over its own name.
+ */
+
+#ifndef BFS_PATHMATCH_H
+#define BFS_PATHMATCH_H
+
+#include <stdint.h>
+
+/**
+ * A set of compiled -path patterns.
+ */
+struct bfs_pathmatch;
+
+/**
+ * Create an empty pattern set.
+ */
+struct bfs_pathmatch *bfs_pathmatch_new(void);
+
+/**
+ * Add an fnmatch() pattern to the set, if possible.
+ *
+ * @param pm
+ *         The pattern set.
+ * @param pattern
+ *         The pattern to add.
+ * @param casefold
+ *         Whether to match case-insensitively (FNM_CASEFOLD).
+ * @return
+ *         The ID of the pattern, or -1 if it can't be matched incrementally
+ *         (it uses ?, [, or \, or there's no room left).
+ */
+int bfs_pathmatch_add(struct bfs_pathmatch *pm, const char *pattern, bool casefold);
+
+/**
+ * Get the starting state, before any characters have been matched.  States
+ * are never zero, so zero can be used to mean "unknown."
+ */
+uint64_t bfs_pathmatch_start(const struct bfs_pathmatch *pm);
+
+/**
+ * Advance a state over a string.
+ */
+uint64_t bfs_pathmatch_advance(const struct bfs_pathmatch *pm, uint64_t state, const char *str);
+
+/**
+ * Check whether a pattern matches in a state.
+ *
+ * @return
+ *         1 for a match, 0 for no match, or -1 if unknown (a case-insensitive
+ *         pattern applied to a non-ASCII string), in which case the caller
+ *         should fall back to fnmatch().
+ */
+int bfs_pathmatch_result(const struct bfs_pathmatch *pm, uint64_t state, int id);
+
+/**
+ * Free a pattern set.
+ */
+void bfs_pathmatch_free(struct bfs_pathmatch *pm);
+
+#endif // BFS_PATHMATCH_H
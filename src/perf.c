@@ -0,0 +1,274 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "perf.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bit.h"
+#include "diag.h"
+#include "stat.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+const char *bfs_perf_op_name(enum bfs_perf_op op) {
+	switch (op) {
+	case BFS_PERF_OPENAT:
+		return "openat";
+	case BFS_PERF_GETDENTS:
+		return "getdents";
+	case BFS_PERF_STAT:
+#if BFS_USE_STATX
+		return "statx";
+#else
+		return "fstatat";
+#endif
+	case BFS_PERF_CLOSE:
+		return "close";
+	case BFS_PERF_READLINK:
+		return "readlink";
+	case BFS_PERF_UNLINK:
+		return "unlink";
+	case BFS_PERF_ACL:
+		return "acl";
+	case BFS_PERF_CAPS:
+		return "capabilities";
+	case BFS_PERF_XATTR:
+		return "xattr";
+
+	case BFS_PERF_OPS:
+		break;
+	}
+
+	bfs_bug("Unknown bfs_perf_op %d", (int)op);
+	return "???";
+}
+
+void bfs_perf_merge(struct bfs_perf_counter *dest, const struct bfs_perf_counter *src) {
+	dest->calls += src->calls;
+	dest->bytes += src->bytes;
+	dest->sum += src->sum;
+	for (size_t i = 0; i < BFS_PERF_BUCKETS; ++i) {
+		dest->hist[i] += src->hist[i];
+	}
+}
+
+uint64_t bfs_perf_percentile(const struct bfs_perf_counter *counter, double percent) {
+	double exact = counter->calls * percent / 100.0;
+	uint64_t target = exact;
+	if (target < exact || target == 0) {
+		++target;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BFS_PERF_BUCKETS - 1; ++i) {
+		seen += counter->hist[i];
+		if (seen >= target) {
+			return (uint64_t)1 << (i + 1);
+		}
+	}
+
+	return UINT64_MAX;
+}
+
+const char *bfs_perf_phase_name(enum bfs_perf_phase phase) {
+	switch (phase) {
+	case BFS_PERF_PENDING:
+		return "pending";
+	case BFS_PERF_EXEC:
+		return "exec";
+	case BFS_PERF_READY:
+		return "ready";
+	case BFS_PERF_TOTAL:
+		return "total";
+
+	case BFS_PERF_PHASES:
+		break;
+	}
+
+	bfs_bug("Unknown bfs_perf_phase %d", (int)phase);
+	return "???";
+}
+
+const char *bfs_perf_gauge_name(enum bfs_perf_gauge gauge) {
+	switch (gauge) {
+	case BFS_PERF_INFLIGHT:
+		return "in flight";
+	case BFS_PERF_READY_DEPTH:
+		return "ready";
+	case BFS_PERF_THREADS:
+		return "active threads";
+	case BFS_PERF_DEPTH:
+		return "depth limit";
+
+	case BFS_PERF_GAUGES:
+		break;
+	}
+
+	bfs_bug("Unknown bfs_perf_gauge %d", (int)gauge);
+	return "???";
+}
+
+const char *bfs_perf_event_name(enum bfs_perf_event event) {
+	switch (event) {
+	case BFS_PERF_DIRS_ASYNC:
+		return "async opendir";
+	case BFS_PERF_DIRS_SYNC:
+		return "sync opendir";
+	case BFS_PERF_DIRS_UNBALANCED:
+		return "opendir rebalances";
+	case BFS_PERF_FILES_ASYNC:
+		return "async stat";
+	case BFS_PERF_FILES_SYNC:
+		return "sync stat";
+	case BFS_PERF_FILES_UNBALANCED:
+		return "stat rebalances";
+	case BFS_PERF_DIRS_CACHED:
+		return "cached listings";
+	case BFS_PERF_DIRS_HANDLE:
+		return "handle reopens";
+	case BFS_PERF_DIRS_BATCHED:
+		return "batched stat dirs";
+	case BFS_PERF_DIRS_STALE:
+		return "stale dirs";
+	case BFS_PERF_DIRS_AHEAD:
+		return "dir read-aheads";
+	case BFS_PERF_TARGETS_CACHED:
+		return "cached link targets";
+	case BFS_PERF_IOQ_STEALS:
+		return "ioq steals";
+
+	case BFS_PERF_EVENTS:
+		break;
+	}
+
+	bfs_bug("Unknown bfs_perf_event %d", (int)event);
+	return "???";
+}
+
+bool bfs_perf_enabled = false;
+
+void bfs_perf_enable(void) {
+	bfs_perf_enabled = true;
+}
+
+/** The list of threads with counters. */
+static struct bfs_perf_thread *perf_threads = NULL;
+/** The tail of perf_threads, to keep them in creation order. */
+static struct bfs_perf_thread **perf_tail = &perf_threads;
+/** Protects perf_threads. */
+static pthread_mutex_t perf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The calling thread's name. */
+static thread_local const char *perf_name = "main";
+/** The calling thread's counters, allocated on first use. */
+static thread_local struct bfs_perf_thread *perf_self = NULL;
+
+void bfs_perf_name(const char *name) {
+	perf_name = name;
+	perf_self = NULL;
+}
+
+const char *bfs_perf_thread_name(void) {
+	return perf_name;
+}
+
+uint64_t bfs_perf_now(void) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		return 0;
+	}
+
+	uint64_t ret = 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+	// 0 means "not timing"
+	return ret ? ret : 1;
+}
+
+/** Allocate and register the calling thread's counters. */
+static struct bfs_perf_thread *perf_register(void) {
+	struct bfs_perf_thread *self = ZALLOC(struct bfs_perf_thread);
+	if (!self) {
+		return NULL;
+	}
+	self->name = perf_name;
+
+	mutex_lock(&perf_mutex);
+	for (const struct bfs_perf_thread *thread = perf_threads; thread; thread = thread->next) {
+		if (strcmp(thread->name, self->name) == 0) {
+			++self->index;
+		}
+	}
+	*perf_tail = self;
+	perf_tail = &self->next;
+	mutex_unlock(&perf_mutex);
+
+	perf_self = self;
+	return self;
+}
+
+/** Get the calling thread's counters. */
+static struct bfs_perf_thread *perf_thread(void) {
+	struct bfs_perf_thread *self = perf_self;
+	if (!self) {
+		int error = errno;
+		self = perf_register();
+		errno = error;
+	}
+	return self;
+}
+
+/** Add a value to a counter. */
+static void perf_add(struct bfs_perf_counter *counter, uint64_t value, uint64_t bytes) {
+	size_t bucket = value ? bit_width(value) - 1 : 0;
+
+	++counter->calls;
+	counter->bytes += bytes;
+	counter->sum += value;
+	++counter->hist[bucket];
+}
+
+/** Compute an elapsed time. */
+static uint64_t perf_elapsed(uint64_t start, uint64_t end) {
+	return end > start ? end - start : 0;
+}
+
+void bfs_perf_record(enum bfs_perf_op op, uint64_t start, uint64_t bytes) {
+	uint64_t end = bfs_perf_now();
+
+	struct bfs_perf_thread *self = perf_thread();
+	if (self) {
+		perf_add(&self->ops[op], perf_elapsed(start, end), bytes);
+	}
+}
+
+void bfs_perf_ioq(unsigned int op, enum bfs_perf_phase phase, uint64_t start, uint64_t end) {
+	bfs_assert(op < BFS_PERF_IOQ_OPS);
+
+	struct bfs_perf_thread *self = perf_thread();
+	if (self) {
+		perf_add(&self->ioq[op][phase], perf_elapsed(start, end), 0);
+	}
+}
+
+void bfs_perf_record_sample(enum bfs_perf_gauge gauge, uint64_t value) {
+	struct bfs_perf_thread *self = perf_thread();
+	if (self) {
+		perf_add(&self->gauges[gauge], value, 0);
+	}
+}
+
+void bfs_perf_record_event(enum bfs_perf_event event) {
+	struct bfs_perf_thread *self = perf_thread();
+	if (self) {
+		++self->events[event];
+	}
+}
+
+const struct bfs_perf_thread *bfs_perf_threads(void) {
+	return perf_threads;
+}
@@ -0,0 +1,290 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Built-in system call counters (-D perf).
+ */
+
+#ifndef BFS_PERF_H
+#define BFS_PERF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The kinds of calls that are counted.
+ */
+enum bfs_perf_op {
+	/** openat() for directories. */
+	BFS_PERF_OPENAT,
+	/** getdents() and friends. */
+	BFS_PERF_GETDENTS,
+	/** statx() or fstatat(). */
+	BFS_PERF_STAT,
+	/** close(). */
+	BFS_PERF_CLOSE,
+	/** readlinkat(). */
+	BFS_PERF_READLINK,
+	/** unlinkat(). */
+	BFS_PERF_UNLINK,
+	/** Access control list lookups. */
+	BFS_PERF_ACL,
+	/** Capability lookups. */
+	BFS_PERF_CAPS,
+	/** Extended attribute lookups. */
+	BFS_PERF_XATTR,
+	/** The number of counted calls. */
+	BFS_PERF_OPS,
+};
+
+/**
+ * Get the name of a counted call.
+ */
+const char *bfs_perf_op_name(enum bfs_perf_op op);
+
+/** The number of latency histogram buckets. */
+#define BFS_PERF_BUCKETS 64
+
+/**
+ * Counters for one kind of call, or one kind of sample.
+ */
+struct bfs_perf_counter {
+	/** The number of calls (or samples). */
+	uint64_t calls;
+	/** The number of bytes transferred. */
+	uint64_t bytes;
+	/** The sum of the recorded values (the total time, for calls). */
+	uint64_t sum;
+	/** Histogram, where bucket i counts values in [2^i, 2^(i+1)) (and bucket 0 also counts 0). */
+	uint64_t hist[BFS_PERF_BUCKETS];
+};
+
+/**
+ * Add one set of counters to another.
+ */
+void bfs_perf_merge(struct bfs_perf_counter *dest, const struct bfs_perf_counter *src);
+
+/**
+ * Estimate a percentile from a histogram.
+ *
+ * @param counter
+ *         The counters to check.
+ * @param percent
+ *         The percentile to compute, from 0 to 100.
+ * @return
+ *         An exclusive upper bound on the value (in nanoseconds, for calls),
+ *         rounded up to a power of two.
+ */
+uint64_t bfs_perf_percentile(const struct bfs_perf_counter *counter, double percent);
+
+/** The number of ioq operations that can be counted (at least IOQ_READLINK + 1). */
+#define BFS_PERF_IOQ_OPS 8
+
+/**
+ * The phases of an ioq request.
+ */
+enum bfs_perf_phase {
+	/** Waiting in the pending queue for a background thread. */
+	BFS_PERF_PENDING,
+	/** Being executed. */
+	BFS_PERF_EXEC,
+	/** Waiting in the ready queue for the submitter. */
+	BFS_PERF_READY,
+	/** The whole time from submission to completion. */
+	BFS_PERF_TOTAL,
+	/** The number of phases. */
+	BFS_PERF_PHASES,
+};
+
+/**
+ * Get the name of an ioq request phase.
+ */
+const char *bfs_perf_phase_name(enum bfs_perf_phase phase);
+
+/**
+ * Sampled values.
+ */
+enum bfs_perf_gauge {
+	/** The number of outstanding ioq requests, sampled at each submission. */
+	BFS_PERF_INFLIGHT,
+	/** The number of ready ioq responses, sampled at each pop. */
+	BFS_PERF_READY_DEPTH,
+	/** The number of active ioq threads, sampled whenever -jauto tunes it. */
+	BFS_PERF_THREADS,
+	/** The ioq's in-flight limit, sampled whenever bftw() adapts it. */
+	BFS_PERF_DEPTH,
+	/** The number of gauges. */
+	BFS_PERF_GAUGES,
+};
+
+/**
+ * Get the name of a gauge.
+ */
+const char *bfs_perf_gauge_name(enum bfs_perf_gauge gauge);
+
+/**
+ * Counted events.
+ */
+enum bfs_perf_event {
+	/** A directory was opened by the ioq. */
+	BFS_PERF_DIRS_ASYNC,
+	/** A directory was opened by the main thread. */
+	BFS_PERF_DIRS_SYNC,
+	/** Opening directories in the ioq was held back to rebalance the queue. */
+	BFS_PERF_DIRS_UNBALANCED,
+	/** A file was stat()ed by the ioq. */
+	BFS_PERF_FILES_ASYNC,
+	/** A file was stat()ed by the main thread. */
+	BFS_PERF_FILES_SYNC,
+	/** Calling stat() in the ioq was held back to rebalance the queue. */
+	BFS_PERF_FILES_UNBALANCED,
+	/** A directory's cached listing was used instead of reading it again. */
+	BFS_PERF_DIRS_CACHED,
+	/** An evicted directory was reopened from its file handle. */
+	BFS_PERF_DIRS_HANDLE,
+	/** A directory full of unknown types had its stat() calls batched. */
+	BFS_PERF_DIRS_BATCHED,
+	/** A stale directory had its non-directory entries skipped. */
+	BFS_PERF_DIRS_STALE,
+	/** The next chunk of a large directory was read ahead by the ioq. */
+	BFS_PERF_DIRS_AHEAD,
+	/** A symlink's target was found in the shared target cache. */
+	BFS_PERF_TARGETS_CACHED,
+	/** An idle ioq thread stole a request from another thread's batch. */
+	BFS_PERF_IOQ_STEALS,
+	/** The number of events. */
+	BFS_PERF_EVENTS,
+};
+
+/**
+ * Get the name of an event.
+ */
+const char *bfs_perf_event_name(enum bfs_perf_event event);
+
+/**
+ * The counters from one thread.
+ */
+struct bfs_perf_thread {
+	/** The next thread in the list. */
+	struct bfs_perf_thread *next;
+	/** The thread's name (e.g. "main" or "ioq"). */
+	const char *name;
+	/** The thread's index among those with the same name. */
+	size_t index;
+	/** The counters for each call. */
+	struct bfs_perf_counter ops[BFS_PERF_OPS];
+	/** The counters for each ioq operation and phase. */
+	struct bfs_perf_counter ioq[BFS_PERF_IOQ_OPS][BFS_PERF_PHASES];
+	/** The sampled values. */
+	struct bfs_perf_counter gauges[BFS_PERF_GAUGES];
+	/** The event counts. */
+	uint64_t events[BFS_PERF_EVENTS];
+};
+
+/** Whether counting is enabled. */
+extern bool bfs_perf_enabled;
+
+/**
+ * Start counting calls.  Must be called before any other threads are started.
+ */
+void bfs_perf_enable(void);
+
+/**
+ * Name the calling thread for its counters.  Threads are "main" by default.
+ */
+void bfs_perf_name(const char *name);
+
+/**
+ * Get the calling thread's name.
+ */
+const char *bfs_perf_thread_name(void);
+
+/**
+ * Get the current time for bfs_perf_end(), in nanoseconds.
+ */
+uint64_t bfs_perf_now(void);
+
+/**
+ * Start timing a call.
+ *
+ * @return
+ *         The start time, or 0 if counting is disabled.
+ */
+static inline uint64_t bfs_perf_start(void) {
+	if (bfs_perf_enabled) {
+		return bfs_perf_now();
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Record a call (slow path of bfs_perf_end()).
+ */
+void bfs_perf_record(enum bfs_perf_op op, uint64_t start, uint64_t bytes);
+
+/**
+ * Finish timing a call.
+ *
+ * @param op
+ *         The kind of call.
+ * @param start
+ *         The return value of bfs_perf_start().
+ * @param bytes
+ *         The number of bytes transferred, if any.
+ */
+static inline void bfs_perf_end(enum bfs_perf_op op, uint64_t start, uint64_t bytes) {
+	if (start) {
+		bfs_perf_record(op, start, bytes);
+	}
+}
+
+/**
+ * Record the time an ioq request spent in one phase.
+ *
+ * @param op
+ *         The enum ioq_op.
+ * @param phase
+ *         The phase of the request.
+ * @param start
+ *         When the phase started, from bfs_perf_start().
+ * @param end
+ *         When the phase ended, from bfs_perf_start().
+ */
+void bfs_perf_ioq(unsigned int op, enum bfs_perf_phase phase, uint64_t start, uint64_t end);
+
+/**
+ * Record a sample (slow path of bfs_perf_sample()).
+ */
+void bfs_perf_record_sample(enum bfs_perf_gauge gauge, uint64_t value);
+
+/**
+ * Sample a gauge, if counting is enabled.
+ */
+static inline void bfs_perf_sample(enum bfs_perf_gauge gauge, uint64_t value) {
+	if (bfs_perf_enabled) {
+		bfs_perf_record_sample(gauge, value);
+	}
+}
+
+/**
+ * Record an event (slow path of bfs_perf_count()).
+ */
+void bfs_perf_record_event(enum bfs_perf_event event);
+
+/**
+ * Count an event, if counting is enabled.
+ */
+static inline void bfs_perf_count(enum bfs_perf_event event) {
+	if (bfs_perf_enabled) {
+		bfs_perf_record_event(event);
+	}
+}
+
+/**
+ * Get the counters for every thread that made any calls.  Must only be called
+ * once all other threads have finished.
+ */
+const struct bfs_perf_thread *bfs_perf_threads(void);
+
+#endif // BFS_PERF_H
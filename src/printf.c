@@ -14,6 +14,7 @@
 #include "dstring.h"
 #include "expr.h"
 #include "fsade.h"
+#include "hash.h"
 #include "mtab.h"
 #include "pwcache.h"
 #include "stat.h"
@@ -47,6 +48,10 @@ struct bfs_fmt {
 	enum bfs_stat_field stat_field;
 	/** Character data associated with this directive. */
 	char c;
+	/** The hash algorithm to use (for %X). */
+	enum bfs_hash_algo hash;
+	/** Whether this directive has no flags, width, or precision. */
+	bool plain;
 	/** Some data used by the directive. */
 	void *ptr;
 };
@@ -108,6 +113,103 @@ static int bfs_fprintf(CFILE *cfile, const struct bfs_fmt *fmt, const char *fake
 	return ret;
 }
 
+/** Write a string, formatting it only if necessary. */
+static int bfs_printf_str(CFILE *cfile, const struct bfs_fmt *fmt, const char *str) {
+	if (!fmt->plain) {
+		return bfs_fprintf(cfile, fmt, "%s", str);
+	}
+
+	size_t len = strlen(str);
+	if (fwrite(str, 1, len, cfile->file) == len) {
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
+/** The size of a buffer that can hold any uintmax_t in octal. */
+#define UINT_BUF_SIZE (sizeof(uintmax_t) * 3 + 2)
+
+/**
+ * Convert an integer to a string, backwards from the end of a buffer.
+ *
+ * @param end
+ *         The end of the buffer.
+ * @param n
+ *         The number to convert.
+ * @param base
+ *         The base (8 or 10).
+ * @param digits
+ *         The minimum number of digits to write.
+ * @return
+ *         The start of the converted string.
+ */
+static char *uint_to_str(char *end, uintmax_t n, unsigned int base, size_t digits) {
+	char *str = end;
+	do {
+		*--str = '0' + n % base;
+		n /= base;
+	} while (n > 0 || (size_t)(end - str) < digits);
+	return str;
+}
+
+/** Print an unsigned integer like "%ju". */
+static int bfs_printf_uint(CFILE *cfile, const struct bfs_fmt *fmt, uintmax_t n) {
+	char buf[UINT_BUF_SIZE];
+	char *end = buf + sizeof(buf) - 1;
+	*end = '\0';
+	return bfs_printf_str(cfile, fmt, uint_to_str(end, n, 10, 1));
+}
+
+/** A cached localtime_r() result. */
+struct tm_cache {
+	/** Whether the cache is filled. */
+	bool valid;
+	/** The cached time. */
+	time_t sec;
+	/** The broken-down local time. */
+	struct tm tm;
+};
+
+/**
+ * Files in a tree tend to share timestamps, so remember the last conversion.
+ * localtime_r() is relatively slow, since it has to check $TZ every time.
+ */
+static thread_local struct tm_cache tm_cache;
+
+/** Cached localtime_r(). */
+static int bfs_localtime(time_t sec, struct tm *tm) {
+	if (!tm_cache.valid || tm_cache.sec != sec) {
+		if (!localtime_r(&sec, &tm_cache.tm)) {
+			tm_cache.valid = false;
+			return -1;
+		}
+		tm_cache.valid = true;
+		tm_cache.sec = sec;
+	}
+
+	*tm = tm_cache.tm;
+	return 0;
+}
+
+/** The longest strftime() result to cache. */
+#define STRFTIME_CACHE_LEN 64
+/** The number of cached strftime() results. */
+#define STRFTIME_CACHE_SIZE 16
+
+/** A cached strftime() result. */
+struct strftime_cache {
+	/** The cached time. */
+	time_t sec;
+	/** The conversion specifier (0 for an empty slot). */
+	char c;
+	/** The formatted string. */
+	char str[STRFTIME_CACHE_LEN];
+};
+
+/** Cached strftime() results, keyed on (tv_sec, specifier). */
+static thread_local struct strftime_cache strftime_cache[STRFTIME_CACHE_SIZE];
+
 /** %a, %c, %t: ctime() */
 static int bfs_printf_ctime(CFILE *cfile, const struct bfs_fmt *fmt, const struct BFTW *ftwbuf) {
 	// Not using ctime() itself because GNU find adds nanoseconds
@@ -125,7 +227,7 @@ static int bfs_printf_ctime(CFILE *cfile, const struct bfs_fmt *fmt, const struc
 	}
 
 	struct tm tm;
-	if (!localtime_r(&ts->tv_sec, &tm)) {
+	if (bfs_localtime(ts->tv_sec, &tm) != 0) {
 		return -1;
 	}
 
@@ -139,7 +241,7 @@ static int bfs_printf_ctime(CFILE *cfile, const struct bfs_fmt *fmt, const struc
 		(long)ts->tv_nsec,
 		1900 + tm.tm_year);
 
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_str(cfile, fmt, buf);
 }
 
 /** %A, %B/%W, %C, %T: strftime() */
@@ -155,16 +257,27 @@ static int bfs_printf_strftime(CFILE *cfile, const struct bfs_fmt *fmt, const st
 	}
 
 	struct tm tm;
-	if (!localtime_r(&ts->tv_sec, &tm)) {
+	if (bfs_localtime(ts->tv_sec, &tm) != 0) {
 		return -1;
 	}
 
 	int ret;
 	char buf[256];
 	char format[] = "% ";
+	struct strftime_cache *cache;
 	switch (fmt->c) {
 	// Non-POSIX strftime() features
 	case '@':
+		if (ts->tv_sec >= 0) {
+			// The hot case for '%T@', so avoid snprintf()
+			char *end = buf + sizeof(buf) - 1;
+			*end = '\0';
+			*--end = '0';
+			char *str = uint_to_str(end, ts->tv_nsec, 10, 9);
+			*--str = '.';
+			str = uint_to_str(str, ts->tv_sec, 10, 1);
+			return bfs_printf_str(cfile, fmt, str);
+		}
 		ret = snprintf(buf, sizeof(buf), "%lld.%09ld0", (long long)ts->tv_sec, (long)ts->tv_nsec);
 		break;
 	case '+':
@@ -199,6 +312,11 @@ static int bfs_printf_strftime(CFILE *cfile, const struct bfs_fmt *fmt, const st
 
 	// POSIX strftime() features
 	default:
+		cache = &strftime_cache[(unsigned char)fmt->c % STRFTIME_CACHE_SIZE];
+		if (cache->c == fmt->c && cache->sec == ts->tv_sec) {
+			return bfs_printf_str(cfile, fmt, cache->str);
+		}
+
 		format[1] = fmt->c;
 #if __GNUC__
 #  pragma GCC diagnostic push
@@ -208,13 +326,19 @@ static int bfs_printf_strftime(CFILE *cfile, const struct bfs_fmt *fmt, const st
 #if __GNUC__
 #  pragma GCC diagnostic pop
 #endif
+
+		if ((size_t)ret < sizeof(cache->str)) {
+			memcpy(cache->str, buf, ret + 1);
+			cache->sec = ts->tv_sec;
+			cache->c = fmt->c;
+		}
 		break;
 	}
 
 	bfs_assert(ret >= 0 && (size_t)ret < sizeof(buf));
 	(void)ret;
 
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_str(cfile, fmt, buf);
 }
 
 /** %b: blocks */
@@ -225,12 +349,15 @@ static int bfs_printf_b(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 	}
 
 	uintmax_t blocks = ((uintmax_t)statbuf->blocks * BFS_STAT_BLKSIZE + 511) / 512;
-	BFS_PRINTF_BUF(buf, "%ju", blocks);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, blocks);
 }
 
 /** %d: depth */
 static int bfs_printf_d(CFILE *cfile, const struct bfs_fmt *fmt, const struct BFTW *ftwbuf) {
+	if (fmt->plain) {
+		return bfs_printf_uint(cfile, fmt, ftwbuf->depth);
+	}
+
 	return bfs_fprintf(cfile, fmt, "%jd", (intmax_t)ftwbuf->depth);
 }
 
@@ -241,8 +368,7 @@ static int bfs_printf_D(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->dev);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, (uintmax_t)statbuf->dev);
 }
 
 /** %f: file name */
@@ -250,23 +376,26 @@ static int bfs_printf_f(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 	if (should_color(cfile, fmt)) {
 		return cfprintf(cfile, "%pF", ftwbuf);
 	} else {
-		return bfs_fprintf(cfile, fmt, "%s", ftwbuf->path + ftwbuf->nameoff);
+		return bfs_printf_str(cfile, fmt, ftwbuf->path + ftwbuf->nameoff);
 	}
 }
 
 /** %F: file system type */
 static int bfs_printf_F(CFILE *cfile, const struct bfs_fmt *fmt, const struct BFTW *ftwbuf) {
-	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
-	if (!statbuf) {
-		return -1;
-	}
-
-	const char *type = bfs_fstype(fmt->ptr, statbuf);
+	const char *type = ftwbuf->fstype;
 	if (!type) {
-		return -1;
+		const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+		if (!statbuf) {
+			return -1;
+		}
+
+		type = bfs_fstype(fmt->ptr, statbuf);
+		if (!type) {
+			return -1;
+		}
 	}
 
-	return bfs_fprintf(cfile, fmt, "%s", type);
+	return bfs_printf_str(cfile, fmt, type);
 }
 
 /** %G: gid */
@@ -276,8 +405,7 @@ static int bfs_printf_G(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->gid);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, (uintmax_t)statbuf->gid);
 }
 
 /** %g: group name */
@@ -293,12 +421,11 @@ static int bfs_printf_g(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return bfs_printf_G(cfile, fmt, ftwbuf);
 	}
 
-	return bfs_fprintf(cfile, fmt, "%s", grp->gr_name);
+	return bfs_printf_str(cfile, fmt, grp->gr_name);
 }
 
 /** %h: leading directories */
 static int bfs_printf_h(CFILE *cfile, const struct bfs_fmt *fmt, const struct BFTW *ftwbuf) {
-	char *copy = NULL;
 	const char *buf;
 
 	if (ftwbuf->nameoff > 0) {
@@ -307,26 +434,21 @@ static int bfs_printf_h(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 			--len;
 		}
 
-		buf = copy = strndup(ftwbuf->path, len);
+		if (dstrncpy(&cfile->scratch, ftwbuf->path, len) != 0) {
+			return -1;
+		}
+		buf = cfile->scratch;
 	} else if (ftwbuf->path[0] == '/') {
 		buf = "/";
 	} else {
 		buf = ".";
 	}
 
-	if (!buf) {
-		return -1;
-	}
-
-	int ret;
 	if (should_color(cfile, fmt)) {
-		ret = cfprintf(cfile, "${di}%pQ${rs}", buf);
+		return cfprintf(cfile, "${di}%pQ${rs}", buf);
 	} else {
-		ret = bfs_fprintf(cfile, fmt, "%s", buf);
+		return bfs_printf_str(cfile, fmt, buf);
 	}
-
-	free(copy);
-	return ret;
 }
 
 /** %H: current root */
@@ -338,7 +460,7 @@ static int bfs_printf_H(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 			return cfprintf(cfile, "${di}%pQ${rs}", ftwbuf->root);
 		}
 	} else {
-		return bfs_fprintf(cfile, fmt, "%s", ftwbuf->root);
+		return bfs_printf_str(cfile, fmt, ftwbuf->root);
 	}
 }
 
@@ -349,8 +471,7 @@ static int bfs_printf_i(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->ino);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, (uintmax_t)statbuf->ino);
 }
 
 /** %k: 1K blocks */
@@ -361,13 +482,11 @@ static int bfs_printf_k(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 	}
 
 	uintmax_t blocks = ((uintmax_t)statbuf->blocks * BFS_STAT_BLKSIZE + 1023) / 1024;
-	BFS_PRINTF_BUF(buf, "%ju", blocks);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, blocks);
 }
 
 /** %l: link target */
 static int bfs_printf_l(CFILE *cfile, const struct bfs_fmt *fmt, const struct BFTW *ftwbuf) {
-	char *buf = NULL;
 	const char *target = "";
 
 	if (ftwbuf->type == BFS_LNK) {
@@ -375,18 +494,13 @@ static int bfs_printf_l(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 			return cfprintf(cfile, "%pL", ftwbuf);
 		}
 
-		const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-		size_t len = statbuf ? statbuf->size : 0;
-
-		target = buf = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
+		target = bftw_readlink(ftwbuf);
 		if (!target) {
 			return -1;
 		}
 	}
 
-	int ret = bfs_fprintf(cfile, fmt, "%s", target);
-	free(buf);
-	return ret;
+	return bfs_printf_str(cfile, fmt, target);
 }
 
 /** %m: mode */
@@ -396,7 +510,15 @@ static int bfs_printf_m(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	return bfs_fprintf(cfile, fmt, "%o", (unsigned int)(statbuf->mode & 07777));
+	unsigned int mode = statbuf->mode & 07777;
+	if (fmt->plain) {
+		char buf[UINT_BUF_SIZE];
+		char *end = buf + sizeof(buf) - 1;
+		*end = '\0';
+		return bfs_printf_str(cfile, fmt, uint_to_str(end, mode, 8, 1));
+	}
+
+	return bfs_fprintf(cfile, fmt, "%o", mode);
 }
 
 /** %M: symbolic mode */
@@ -408,7 +530,7 @@ static int bfs_printf_M(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 
 	char buf[11];
 	xstrmode(statbuf->mode, buf);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_str(cfile, fmt, buf);
 }
 
 /** %n: link count */
@@ -418,8 +540,7 @@ static int bfs_printf_n(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->nlink);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, (uintmax_t)statbuf->nlink);
 }
 
 /** %p: full path */
@@ -427,7 +548,7 @@ static int bfs_printf_p(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 	if (should_color(cfile, fmt)) {
 		return cfprintf(cfile, "%pP", ftwbuf);
 	} else {
-		return bfs_fprintf(cfile, fmt, "%s", ftwbuf->path);
+		return bfs_printf_str(cfile, fmt, ftwbuf->path);
 	}
 }
 
@@ -448,7 +569,7 @@ static int bfs_printf_P(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		copybuf.nameoff -= offset;
 		return cfprintf(cfile, "%pP", &copybuf);
 	} else {
-		return bfs_fprintf(cfile, fmt, "%s", ftwbuf->path + offset);
+		return bfs_printf_str(cfile, fmt, ftwbuf->path + offset);
 	}
 }
 
@@ -459,8 +580,7 @@ static int bfs_printf_s(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->size);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, (uintmax_t)statbuf->size);
 }
 
 /** %S: sparseness */
@@ -486,8 +606,7 @@ static int bfs_printf_U(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->uid);
-	return bfs_fprintf(cfile, fmt, "%s", buf);
+	return bfs_printf_uint(cfile, fmt, (uintmax_t)statbuf->uid);
 }
 
 /** %u: user name */
@@ -503,7 +622,7 @@ static int bfs_printf_u(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return bfs_printf_U(cfile, fmt, ftwbuf);
 	}
 
-	return bfs_fprintf(cfile, fmt, "%s", pwd->pw_name);
+	return bfs_printf_str(cfile, fmt, pwd->pw_name);
 }
 
 static const char *bfs_printf_type(enum bfs_type type) {
@@ -528,10 +647,30 @@ static const char *bfs_printf_type(enum bfs_type type) {
 	return name ? name : "U";
 }
 
+/** %X: content hash */
+static int bfs_printf_X(CFILE *cfile, const struct bfs_fmt *fmt, const struct BFTW *ftwbuf) {
+	unsigned char digest[BFS_HASH_MAX];
+	int ret = bfs_check_hash(ftwbuf, fmt->hash, digest);
+	if (ret < 0) {
+		return -1;
+	}
+
+	static const char xdigits[] = "0123456789abcdef";
+	char hex[2 * BFS_HASH_MAX + 1];
+	size_t len = ret ? 2 * bfs_hash_size(fmt->hash) : 0;
+	for (size_t i = 0; i < len / 2; ++i) {
+		hex[2 * i] = xdigits[digest[i] >> 4];
+		hex[2 * i + 1] = xdigits[digest[i] & 0xF];
+	}
+	hex[len] = '\0';
+
+	return bfs_printf_str(cfile, fmt, hex);
+}
+
 /** %y: type */
 static int bfs_printf_y(CFILE *cfile, const struct bfs_fmt *fmt, const struct BFTW *ftwbuf) {
 	const char *type = bfs_printf_type(ftwbuf->type);
-	return bfs_fprintf(cfile, fmt, "%s", type);
+	return bfs_printf_str(cfile, fmt, type);
 }
 
 /** %Y: target type */
@@ -553,7 +692,7 @@ static int bfs_printf_Y(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		str = bfs_printf_type(type);
 	}
 
-	int ret = bfs_fprintf(cfile, fmt, "%s", str);
+	int ret = bfs_printf_str(cfile, fmt, str);
 	if (error != 0) {
 		ret = -1;
 		errno = error;
@@ -569,7 +708,7 @@ static int bfs_printf_Z(CFILE *cfile, const struct bfs_fmt *fmt, const struct BF
 		return -1;
 	}
 
-	int ret = bfs_fprintf(cfile, fmt, "%s", con);
+	int ret = bfs_printf_str(cfile, fmt, con);
 	bfs_freecon(con);
 	return ret;
 }
@@ -837,6 +976,27 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 				fmt.fn = bfs_printf_ctime;
 				fmt.stat_field = BFS_STAT_BTIME;
 				break;
+			case 'X':
+				fmt.fn = bfs_printf_X;
+				// To open() the file
+				expr->ephemeral_fds = 1;
+				c = *++i;
+				if (c == 'b') {
+					fmt.hash = BFS_HASH_BLAKE3;
+				} else if (c == 's') {
+					fmt.hash = BFS_HASH_SHA256;
+				} else if (c == 'x') {
+					fmt.hash = BFS_HASH_XXH64;
+				} else if (!c) {
+					bfs_expr_error(ctx, expr);
+					bfs_error(ctx, "Incomplete hash specifier '%s%c'.\n", fmt.str, i[-1]);
+					goto fmt_error;
+				} else {
+					bfs_expr_error(ctx, expr);
+					bfs_error(ctx, "Unrecognized hash specifier '%%%c%c'.\n", i[-1], c);
+					goto fmt_error;
+				}
+				break;
 			case 'y':
 				fmt.fn = bfs_printf_y;
 				break;
@@ -900,6 +1060,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 				goto fmt_error;
 			}
 
+			fmt.plain = dstrlen(fmt.str) == 1;
 			if (dstrcat(&fmt.str, specifier) != 0) {
 				bfs_perror(ctx, "dstrcat()");
 				goto fmt_error;
@@ -952,6 +1113,34 @@ int bfs_printf(CFILE *cfile, const struct bfs_printf *format, const struct BFTW
 	return ret;
 }
 
+enum bfs_stat_field bfs_printf_stat_times(const struct bfs_printf *format) {
+	enum bfs_stat_field ret = 0;
+	for (size_t i = 0; i < format->nfmts; ++i) {
+		ret |= format->fmts[i].stat_field;
+	}
+	return ret;
+}
+
+unsigned int bfs_printf_hashes(const struct bfs_printf *format) {
+	unsigned int ret = 0;
+	for (size_t i = 0; i < format->nfmts; ++i) {
+		const struct bfs_fmt *fmt = &format->fmts[i];
+		if (fmt->fn == bfs_printf_X) {
+			ret |= 1U << fmt->hash;
+		}
+	}
+	return ret;
+}
+
+bool bfs_printf_reads_links(const struct bfs_printf *format) {
+	for (size_t i = 0; i < format->nfmts; ++i) {
+		if (format->fmts[i].fn == bfs_printf_l) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void bfs_printf_free(struct bfs_printf *format) {
 	if (!format) {
 		return;
@@ -9,6 +9,9 @@
 #define BFS_PRINTF_H
 
 #include "color.h"
+#include "stat.h"
+
+#include <stdbool.h>
 
 struct BFTW;
 struct bfs_ctx;
@@ -47,6 +50,22 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
  */
 int bfs_printf(CFILE *cfile, const struct bfs_printf *format, const struct BFTW *ftwbuf);
 
+/**
+ * Get the timestamp fields used by a format string.
+ */
+enum bfs_stat_field bfs_printf_stat_times(const struct bfs_printf *format);
+
+/**
+ * Get the hash algorithms used by a format string, as a bitmask of
+ * (1 << enum bfs_hash_algo).
+ */
+unsigned int bfs_printf_hashes(const struct bfs_printf *format);
+
+/**
+ * Check whether a format string prints link targets (%l).
+ */
+bool bfs_printf_reads_links(const struct bfs_printf *format);
+
 /**
  * Free a parsed format string.
  */
@@ -0,0 +1,216 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "profile.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "dstring.h"
+#include "expr.h"
+#include "trie.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Measurements for a single primary.
+ *
+ * The profile file has one line per primary, with tab-separated fields:
+ *
+ *     evaluations  successes  nanoseconds  argv[0]  argv[1]  ...
+ */
+struct bfs_profile_entry {
+	/** Number of times the primary was evaluated. */
+	unsigned long long evaluations;
+	/** Number of times the primary succeeded. */
+	unsigned long long successes;
+	/** Total time spent evaluating the primary. */
+	unsigned long long nanoseconds;
+};
+
+struct bfs_profile {
+	/** Maps tab-separated arguments to entries. */
+	struct trie entries;
+};
+
+struct bfs_profile *bfs_profile_new(void) {
+	struct bfs_profile *profile = ALLOC(struct bfs_profile);
+	if (profile) {
+		trie_init(&profile->entries);
+	}
+	return profile;
+}
+
+/** Get or create the entry for a key. */
+static struct bfs_profile_entry *profile_entry(struct bfs_profile *profile, const char *key) {
+	struct trie_leaf *leaf = trie_insert_str(&profile->entries, key);
+	if (!leaf) {
+		return NULL;
+	}
+
+	if (!leaf->value) {
+		leaf->value = ZALLOC(struct bfs_profile_entry);
+		if (!leaf->value) {
+			trie_remove(&profile->entries, leaf);
+			return NULL;
+		}
+	}
+	return leaf->value;
+}
+
+/** Compute the key for an expression, or NULL if it can't be saved. */
+static dchar *profile_key(const struct bfs_expr *expr) {
+	dchar *key = dstralloc(0);
+	if (!key) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < expr->argc; ++i) {
+		const char *arg = expr->argv[i];
+		if (strpbrk(arg, "\t\n")) {
+			errno = EINVAL;
+			goto fail;
+		}
+
+		if (i > 0 && dstrapp(&key, '\t') != 0) {
+			goto fail;
+		}
+		if (dstrcat(&key, arg) != 0) {
+			goto fail;
+		}
+	}
+
+	return key;
+
+fail:
+	dstrfree(key);
+	return NULL;
+}
+
+int bfs_profile_load(struct bfs_profile *profile, const char *path) {
+	FILE *file = xfopen(path, O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		return -1;
+	}
+
+	int ret = -1;
+	char *line;
+	while ((line = xgetdelim(file, '\n'))) {
+		struct bfs_profile_entry parsed;
+		int key = -1;
+		sscanf(line, "%llu\t%llu\t%llu\t%n", &parsed.evaluations, &parsed.successes, &parsed.nanoseconds, &key);
+		if (key < 0 || parsed.successes > parsed.evaluations) {
+			free(line);
+			errno = EINVAL;
+			goto done;
+		}
+
+		struct bfs_profile_entry *entry = profile_entry(profile, line + key);
+		free(line);
+		if (!entry) {
+			goto done;
+		}
+
+		entry->evaluations += parsed.evaluations;
+		entry->successes += parsed.successes;
+		entry->nanoseconds += parsed.nanoseconds;
+	}
+
+	if (errno == 0) {
+		ret = 0;
+	}
+
+done:
+	fclose(file);
+	return ret;
+}
+
+int bfs_profile_record(struct bfs_profile *profile, const struct bfs_expr *expr) {
+	if (bfs_expr_is_parent(expr)) {
+		for_expr (child, expr) {
+			if (bfs_profile_record(profile, child) != 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	if (expr->evaluations == 0) {
+		return 0;
+	}
+
+	dchar *key = profile_key(expr);
+	if (!key) {
+		// Skip primaries whose arguments don't fit the format
+		return errno == EINVAL ? 0 : -1;
+	}
+
+	struct bfs_profile_entry *entry = profile_entry(profile, key);
+	dstrfree(key);
+	if (!entry) {
+		return -1;
+	}
+
+	entry->evaluations += expr->evaluations;
+	entry->successes += expr->successes;
+	entry->nanoseconds += 1000000000ULL * expr->elapsed.tv_sec + expr->elapsed.tv_nsec;
+	return 0;
+}
+
+int bfs_profile_save(const struct bfs_profile *profile, const char *path) {
+	FILE *file = xfopen(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+	if (!file) {
+		return -1;
+	}
+
+	for_trie (leaf, &profile->entries) {
+		const struct bfs_profile_entry *entry = leaf->value;
+		if (fprintf(file, "%llu\t%llu\t%llu\t%s\n", entry->evaluations, entry->successes, entry->nanoseconds, leaf->key) < 0) {
+			goto fail;
+		}
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+
+fail:
+	fclose(file);
+	return -1;
+}
+
+bool bfs_profile_lookup(const struct bfs_profile *profile, const struct bfs_expr *expr, float *cost, float *probability) {
+	dchar *key = profile_key(expr);
+	if (!key) {
+		return false;
+	}
+
+	const struct trie_leaf *leaf = trie_find_str(&profile->entries, key);
+	dstrfree(key);
+	if (!leaf) {
+		return false;
+	}
+
+	const struct bfs_profile_entry *entry = leaf->value;
+	if (entry->evaluations == 0) {
+		return false;
+	}
+
+	*cost = (double)entry->nanoseconds / entry->evaluations;
+	*probability = (double)entry->successes / entry->evaluations;
+	return true;
+}
+
+void bfs_profile_free(struct bfs_profile *profile) {
+	if (!profile) {
+		return;
+	}
+
+	for_trie (leaf, &profile->entries) {
+		free(leaf->value);
+	}
+	trie_destroy(&profile->entries);
+	free(profile);
+}
@@ -0,0 +1,83 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Saved measurements of expression cost and selectivity.
+ */
+
+#ifndef BFS_PROFILE_H
+#define BFS_PROFILE_H
+
+struct bfs_expr;
+
+/**
+ * A table of per-primary measurements, keyed by their arguments.
+ */
+struct bfs_profile;
+
+/**
+ * Create an empty profile.
+ *
+ * @return
+ *         The new profile, or NULL on failure.
+ */
+struct bfs_profile *bfs_profile_new(void);
+
+/**
+ * Load measurements from a file into a profile.
+ *
+ * @param profile
+ *         The profile to fill.
+ * @param path
+ *         The path to the profile file.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_profile_load(struct bfs_profile *profile, const char *path);
+
+/**
+ * Record the measurements from every primary in an expression.
+ *
+ * @param profile
+ *         The profile to fill.
+ * @param expr
+ *         The evaluated expression.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_profile_record(struct bfs_profile *profile, const struct bfs_expr *expr);
+
+/**
+ * Save a profile to a file.
+ *
+ * @param profile
+ *         The profile to save.
+ * @param path
+ *         The path to the profile file.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_profile_save(const struct bfs_profile *profile, const char *path);
+
+/**
+ * Look up the measured cost and probability of an expression.
+ *
+ * @param profile
+ *         The profile to search.
+ * @param expr
+ *         The expression to look up.
+ * @param[out] cost
+ *         Will hold the measured cost, in nanoseconds per evaluation.
+ * @param[out] probability
+ *         Will hold the measured probability of success.
+ * @return
+ *         Whether the expression was found.
+ */
+bool bfs_profile_lookup(const struct bfs_profile *profile, const struct bfs_expr *expr, float *cost, float *probability);
+
+/**
+ * Free a profile.
+ */
+void bfs_profile_free(struct bfs_profile *profile);
+
+#endif // BFS_PROFILE_H
@@ -4,24 +4,61 @@
 #include "pwcache.h"
 
 #include "alloc.h"
+#include "thread.h"
 #include "trie.h"
 
 #include <errno.h>
 #include <grp.h>
 #include <pwd.h>
 #include <stdlib.h>
+#include <string.h>
 
 /** Represents cache hits for negative results. */
 static void *MISSING = &MISSING;
 
+/**
+ * After this many distinct lookups, enumerate the whole database at once.
+ * With network backends like LDAP, each individual lookup is a round trip.
+ */
+#define BULK_THRESHOLD 16
+
+/** Copy a string into an arena buffer. */
+static char *bulk_strcpy(char **buf, const char *str) {
+	if (!str) {
+		return NULL;
+	}
+
+	size_t len = strlen(str) + 1;
+	char *ret = memcpy(*buf, str, len);
+	*buf += len;
+	return ret;
+}
+
+/** Get the storage size for a string. */
+static size_t bulk_strlen(const char *str) {
+	return str ? strlen(str) + 1 : 0;
+}
+
 /** Callback type for bfs_getent(). */
 typedef void *bfs_getent_fn(const void *key, void *ptr, size_t bufsize);
 
+/** Check for a cached entry, without taking any locks. */
+static bool bfs_getent_cached(const struct trie_leaf *leaf, void **ret) {
+	void *value = leaf ? trie_get_value(leaf) : NULL;
+	if (!value) {
+		return false;
+	}
+
+	errno = 0;
+	*ret = value == MISSING ? NULL : value;
+	return true;
+}
+
 /** Shared scaffolding for get{pw,gr}{nam,?id}_r(). */
 static void *bfs_getent(bfs_getent_fn *fn, const void *key, struct trie_leaf *leaf, struct varena *varena) {
-	if (leaf->value) {
-		errno = 0;
-		return leaf->value == MISSING ? NULL : leaf->value;
+	void *ret;
+	if (bfs_getent_cached(leaf, &ret)) {
+		return ret;
 	}
 
 	// _SC_GET{PW,GR}_R_SIZE_MAX tend to be fairly large (~1K).  That's okay
@@ -34,12 +71,12 @@ static void *bfs_getent(bfs_getent_fn *fn, const void *key, struct trie_leaf *le
 	}
 
 	while (true) {
-		void *ret = fn(key, ptr, bufsize);
+		ret = fn(key, ptr, bufsize);
 		if (ret) {
-			leaf->value = ret;
+			trie_set_value(leaf, ret);
 			return ret;
 		} else if (errno == 0) {
-			leaf->value = MISSING;
+			trie_set_value(leaf, MISSING);
 			break;
 		} else if (errno == ERANGE) {
 			void *next = varena_grow(varena, ptr, &bufsize);
@@ -71,6 +108,10 @@ struct bfs_users {
 	struct trie by_name;
 	/** A map from UIDs to entries. */
 	struct trie by_uid;
+	/** The number of distinct lookups so far. */
+	size_t lookups;
+	/** Serializes cache misses (but not hits). */
+	pthread_mutex_t mutex;
 };
 
 struct bfs_users *bfs_users_new(void) {
@@ -79,12 +120,80 @@ struct bfs_users *bfs_users_new(void) {
 		return NULL;
 	}
 
+	if (mutex_init(&users->mutex, NULL) != 0) {
+		free(users);
+		return NULL;
+	}
+
 	VARENA_INIT(&users->varena, struct bfs_passwd, buf);
 	trie_init(&users->by_name);
 	trie_init(&users->by_uid);
+	users->lookups = 0;
 	return users;
 }
 
+/** Cache a copy of a struct passwd. */
+static int bfs_users_add(struct bfs_users *users, const struct passwd *pwd) {
+	struct trie_leaf *by_uid = trie_insert_mem(&users->by_uid, &pwd->pw_uid, sizeof(pwd->pw_uid));
+	if (!by_uid) {
+		return -1;
+	}
+	struct trie_leaf *by_name = trie_insert_str(&users->by_name, pwd->pw_name);
+	if (!by_name) {
+		return -1;
+	}
+
+	// Earlier entries take precedence, like getpw*_r()
+	if (by_uid->value && by_name->value) {
+		return 0;
+	}
+
+	size_t size = bulk_strlen(pwd->pw_name)
+		+ bulk_strlen(pwd->pw_passwd)
+		+ bulk_strlen(pwd->pw_gecos)
+		+ bulk_strlen(pwd->pw_dir)
+		+ bulk_strlen(pwd->pw_shell);
+	struct bfs_passwd *copy = varena_alloc(&users->varena, size);
+	if (!copy) {
+		return -1;
+	}
+
+	char *buf = copy->buf;
+	copy->pwd = *pwd;
+	copy->pwd.pw_name = bulk_strcpy(&buf, pwd->pw_name);
+	copy->pwd.pw_passwd = bulk_strcpy(&buf, pwd->pw_passwd);
+	copy->pwd.pw_gecos = bulk_strcpy(&buf, pwd->pw_gecos);
+	copy->pwd.pw_dir = bulk_strcpy(&buf, pwd->pw_dir);
+	copy->pwd.pw_shell = bulk_strcpy(&buf, pwd->pw_shell);
+
+	if (!by_uid->value) {
+		trie_set_value(by_uid, copy);
+	}
+	if (!by_name->value) {
+		trie_set_value(by_name, copy);
+	}
+	return 0;
+}
+
+/** Load the whole user database, if we've made enough lookups. */
+static void bfs_users_bulk(struct bfs_users *users) {
+	if (++users->lookups != BULK_THRESHOLD) {
+		return;
+	}
+
+	// Enumerating may not list every user (e.g. sssd with enumerate=false),
+	// so entries can't be assumed missing just because we didn't see them
+	setpwent();
+	while (true) {
+		errno = 0;
+		struct passwd *pwd = getpwent();
+		if (!pwd || bfs_users_add(users, pwd) != 0) {
+			break;
+		}
+	}
+	endpwent();
+}
+
 /** bfs_getent() callback for getpwnam_r(). */
 static void *bfs_getpwnam_impl(const void *key, void *ptr, size_t bufsize) {
 	struct bfs_passwd *storage = ptr;
@@ -95,12 +204,24 @@ static void *bfs_getpwnam_impl(const void *key, void *ptr, size_t bufsize) {
 }
 
 const struct passwd *bfs_getpwnam(struct bfs_users *users, const char *name) {
+	void *ret;
+	if (bfs_getent_cached(trie_find_str(&users->by_name, name), &ret)) {
+		return ret;
+	}
+
+	ret = NULL;
+	mutex_lock(&users->mutex);
+
 	struct trie_leaf *leaf = trie_insert_str(&users->by_name, name);
-	if (!leaf) {
-		return NULL;
+	if (leaf) {
+		if (!leaf->value) {
+			bfs_users_bulk(users);
+		}
+		ret = bfs_getent(bfs_getpwnam_impl, name, leaf, &users->varena);
 	}
 
-	return bfs_getent(bfs_getpwnam_impl, name, leaf, &users->varena);
+	mutex_unlock(&users->mutex);
+	return ret;
 }
 
 /** bfs_getent() callback for getpwuid_r(). */
@@ -114,18 +235,36 @@ static void *bfs_getpwuid_impl(const void *key, void *ptr, size_t bufsize) {
 }
 
 const struct passwd *bfs_getpwuid(struct bfs_users *users, uid_t uid) {
+	void *ret;
+	if (bfs_getent_cached(trie_find_mem(&users->by_uid, &uid, sizeof(uid)), &ret)) {
+		return ret;
+	}
+
+	ret = NULL;
+	mutex_lock(&users->mutex);
+
 	struct trie_leaf *leaf = trie_insert_mem(&users->by_uid, &uid, sizeof(uid));
-	if (!leaf) {
-		return NULL;
+	if (leaf) {
+		if (!leaf->value) {
+			bfs_users_bulk(users);
+		}
+		ret = bfs_getent(bfs_getpwuid_impl, &uid, leaf, &users->varena);
 	}
 
-	return bfs_getent(bfs_getpwuid_impl, &uid, leaf, &users->varena);
+	mutex_unlock(&users->mutex);
+	return ret;
+}
+
+void bfs_users_share(struct bfs_users *users) {
+	trie_share(&users->by_uid);
+	trie_share(&users->by_name);
 }
 
 void bfs_users_flush(struct bfs_users *users) {
 	trie_clear(&users->by_uid);
 	trie_clear(&users->by_name);
 	varena_clear(&users->varena);
+	users->lookups = 0;
 }
 
 void bfs_users_free(struct bfs_users *users) {
@@ -133,6 +272,7 @@ void bfs_users_free(struct bfs_users *users) {
 		trie_destroy(&users->by_uid);
 		trie_destroy(&users->by_name);
 		varena_destroy(&users->varena);
+		mutex_destroy(&users->mutex);
 		free(users);
 	}
 }
@@ -152,6 +292,10 @@ struct bfs_groups {
 	struct trie by_name;
 	/** A map from GIDs to entries. */
 	struct trie by_gid;
+	/** The number of distinct lookups so far. */
+	size_t lookups;
+	/** Serializes cache misses (but not hits). */
+	pthread_mutex_t mutex;
 };
 
 struct bfs_groups *bfs_groups_new(void) {
@@ -160,12 +304,86 @@ struct bfs_groups *bfs_groups_new(void) {
 		return NULL;
 	}
 
+	if (mutex_init(&groups->mutex, NULL) != 0) {
+		free(groups);
+		return NULL;
+	}
+
 	VARENA_INIT(&groups->varena, struct bfs_group, buf);
 	trie_init(&groups->by_name);
 	trie_init(&groups->by_gid);
+	groups->lookups = 0;
 	return groups;
 }
 
+/** Cache a copy of a struct group. */
+static int bfs_groups_add(struct bfs_groups *groups, const struct group *grp) {
+	struct trie_leaf *by_gid = trie_insert_mem(&groups->by_gid, &grp->gr_gid, sizeof(grp->gr_gid));
+	if (!by_gid) {
+		return -1;
+	}
+	struct trie_leaf *by_name = trie_insert_str(&groups->by_name, grp->gr_name);
+	if (!by_name) {
+		return -1;
+	}
+
+	// Earlier entries take precedence, like getgr*_r()
+	if (by_gid->value && by_name->value) {
+		return 0;
+	}
+
+	size_t nmem = 0;
+	size_t size = bulk_strlen(grp->gr_name) + bulk_strlen(grp->gr_passwd);
+	for (char **mem = grp->gr_mem; mem && *mem; ++mem) {
+		++nmem;
+		size += bulk_strlen(*mem);
+	}
+	// The member array goes first, to keep it aligned
+	size_t memsize = (nmem + 1) * sizeof(char *);
+	size += memsize;
+
+	struct bfs_group *copy = varena_alloc(&groups->varena, size);
+	if (!copy) {
+		return -1;
+	}
+
+	char **mems = (char **)copy->buf;
+	char *buf = copy->buf + memsize;
+	copy->grp = *grp;
+	copy->grp.gr_name = bulk_strcpy(&buf, grp->gr_name);
+	copy->grp.gr_passwd = bulk_strcpy(&buf, grp->gr_passwd);
+	for (size_t i = 0; i < nmem; ++i) {
+		mems[i] = bulk_strcpy(&buf, grp->gr_mem[i]);
+	}
+	mems[nmem] = NULL;
+	copy->grp.gr_mem = mems;
+
+	if (!by_gid->value) {
+		trie_set_value(by_gid, copy);
+	}
+	if (!by_name->value) {
+		trie_set_value(by_name, copy);
+	}
+	return 0;
+}
+
+/** Load the whole group database, if we've made enough lookups. */
+static void bfs_groups_bulk(struct bfs_groups *groups) {
+	if (++groups->lookups != BULK_THRESHOLD) {
+		return;
+	}
+
+	setgrent();
+	while (true) {
+		errno = 0;
+		struct group *grp = getgrent();
+		if (!grp || bfs_groups_add(groups, grp) != 0) {
+			break;
+		}
+	}
+	endgrent();
+}
+
 /** bfs_getent() callback for getgrnam_r(). */
 static void *bfs_getgrnam_impl(const void *key, void *ptr, size_t bufsize) {
 	struct bfs_group *storage = ptr;
@@ -176,12 +394,24 @@ static void *bfs_getgrnam_impl(const void *key, void *ptr, size_t bufsize) {
 }
 
 const struct group *bfs_getgrnam(struct bfs_groups *groups, const char *name) {
+	void *ret;
+	if (bfs_getent_cached(trie_find_str(&groups->by_name, name), &ret)) {
+		return ret;
+	}
+
+	ret = NULL;
+	mutex_lock(&groups->mutex);
+
 	struct trie_leaf *leaf = trie_insert_str(&groups->by_name, name);
-	if (!leaf) {
-		return NULL;
+	if (leaf) {
+		if (!leaf->value) {
+			bfs_groups_bulk(groups);
+		}
+		ret = bfs_getent(bfs_getgrnam_impl, name, leaf, &groups->varena);
 	}
 
-	return bfs_getent(bfs_getgrnam_impl, name, leaf, &groups->varena);
+	mutex_unlock(&groups->mutex);
+	return ret;
 }
 
 /** bfs_getent() callback for getgrgid_r(). */
@@ -195,18 +425,36 @@ static void *bfs_getgrgid_impl(const void *key, void *ptr, size_t bufsize) {
 }
 
 const struct group *bfs_getgrgid(struct bfs_groups *groups, gid_t gid) {
+	void *ret;
+	if (bfs_getent_cached(trie_find_mem(&groups->by_gid, &gid, sizeof(gid)), &ret)) {
+		return ret;
+	}
+
+	ret = NULL;
+	mutex_lock(&groups->mutex);
+
 	struct trie_leaf *leaf = trie_insert_mem(&groups->by_gid, &gid, sizeof(gid));
-	if (!leaf) {
-		return NULL;
+	if (leaf) {
+		if (!leaf->value) {
+			bfs_groups_bulk(groups);
+		}
+		ret = bfs_getent(bfs_getgrgid_impl, &gid, leaf, &groups->varena);
 	}
 
-	return bfs_getent(bfs_getgrgid_impl, &gid, leaf, &groups->varena);
+	mutex_unlock(&groups->mutex);
+	return ret;
+}
+
+void bfs_groups_share(struct bfs_groups *groups) {
+	trie_share(&groups->by_gid);
+	trie_share(&groups->by_name);
 }
 
 void bfs_groups_flush(struct bfs_groups *groups) {
 	trie_clear(&groups->by_gid);
 	trie_clear(&groups->by_name);
 	varena_clear(&groups->varena);
+	groups->lookups = 0;
 }
 
 void bfs_groups_free(struct bfs_groups *groups) {
@@ -214,6 +462,7 @@ void bfs_groups_free(struct bfs_groups *groups) {
 		trie_destroy(&groups->by_gid);
 		trie_destroy(&groups->by_name);
 		varena_destroy(&groups->varena);
+		mutex_destroy(&groups->mutex);
 		free(groups);
 	}
 }
@@ -50,6 +50,17 @@ const struct passwd *bfs_getpwnam(struct bfs_users *users, const char *name);
  */
 const struct passwd *bfs_getpwuid(struct bfs_users *users, uid_t uid);
 
+/**
+ * Allow concurrent lookups in a user cache.
+ *
+ * Afterwards, cache hits are lock-free and misses are serialized.  The cache
+ * must not be flushed while lookups are in progress.
+ *
+ * @param users
+ *         The user cache.
+ */
+void bfs_users_share(struct bfs_users *users);
+
 /**
  * Flush a user cache.
  *
@@ -105,6 +116,17 @@ const struct group *bfs_getgrnam(struct bfs_groups *groups, const char *name);
  */
 const struct group *bfs_getgrgid(struct bfs_groups *groups, gid_t gid);
 
+/**
+ * Allow concurrent lookups in a group cache.
+ *
+ * Afterwards, cache hits are lock-free and misses are serialized.  The cache
+ * must not be flushed while lookups are in progress.
+ *
+ * @param groups
+ *         The group cache.
+ */
+void bfs_groups_share(struct bfs_groups *groups);
+
 /**
  * Flush a group cache.
  *
@@ -0,0 +1,487 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "serve.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "ctx.h"
+#include "diag.h"
+#include "mtab.h"
+#include "sighook.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/**
+ * The file descriptors sent along with each request.
+ */
+enum {
+	SERVE_STDIN,
+	SERVE_STDOUT,
+	SERVE_STDERR,
+	SERVE_CWD,
+	SERVE_FDS,
+};
+
+/**
+ * The fixed-size part of a request, followed by the NUL-terminated arguments
+ * and environment variables.
+ */
+struct serve_header {
+	/** The number of arguments. */
+	uint32_t argc;
+	/** The number of environment variables. */
+	uint32_t envc;
+	/** The total size of the strings. */
+	uint64_t size;
+};
+
+/** Requests bigger than this are rejected. */
+#define SERVE_MAX (64 << 20)
+
+/** Control message buffer for the file descriptors. */
+union serve_cmsg {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(SERVE_FDS * sizeof(int))];
+};
+
+/** Fill in the address of a socket. */
+static int serve_addr(struct sockaddr_un *addr, const char *path) {
+	size_t len = strlen(path);
+	if (len >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, path, len + 1);
+	return 0;
+}
+
+/** Create a Unix socket. */
+static int serve_socket(void) {
+#ifdef SOCK_CLOEXEC
+	return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+		close_quietly(fd);
+		return -1;
+	}
+	return fd;
+#endif
+}
+
+/** Get the total size of some strings. */
+static size_t serve_strsize(char **strs, size_t count) {
+	size_t size = 0;
+	for (size_t i = 0; i < count; ++i) {
+		size += strlen(strs[i]) + 1;
+	}
+	return size;
+}
+
+/** Copy some strings into a buffer. */
+static char *serve_strcpy(char *buf, char **strs, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		size_t len = strlen(strs[i]) + 1;
+		memcpy(buf, strs[i], len);
+		buf += len;
+	}
+	return buf;
+}
+
+/** Send a request to the server. */
+static int serve_send(int sock, int argc, char *argv[]) {
+	size_t envc = 0;
+	while (environ[envc]) {
+		++envc;
+	}
+
+	size_t size = serve_strsize(argv, argc) + serve_strsize(environ, envc);
+	if (size > SERVE_MAX) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	char *strs = malloc(size);
+	if (!strs) {
+		return -1;
+	}
+	serve_strcpy(serve_strcpy(strs, argv, argc), environ, envc);
+
+	int ret = -1;
+	int fds[SERVE_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1};
+#ifdef O_PATH
+	fds[SERVE_CWD] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+	fds[SERVE_CWD] = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+	if (fds[SERVE_CWD] < 0) {
+		goto done;
+	}
+
+	struct serve_header header = {
+		.argc = argc,
+		.envc = envc,
+		.size = size,
+	};
+	struct iovec iov = {
+		.iov_base = &header,
+		.iov_len = sizeof(header),
+	};
+
+	union serve_cmsg cmsg;
+	memset(&cmsg, 0, sizeof(cmsg));
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg.buf,
+		.msg_controllen = sizeof(cmsg.buf),
+	};
+
+	struct cmsghdr *hdr = CMSG_FIRSTHDR(&msg);
+	hdr->cmsg_level = SOL_SOCKET;
+	hdr->cmsg_type = SCM_RIGHTS;
+	hdr->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(hdr), fds, sizeof(fds));
+
+	ssize_t sent;
+	do {
+		sent = sendmsg(sock, &msg, 0);
+	} while (sent < 0 && errno == EINTR);
+	if (sent != sizeof(header)) {
+		goto done;
+	}
+
+	if (xwrite(sock, strs, size) != size) {
+		goto done;
+	}
+
+	ret = 0;
+done:
+	if (fds[SERVE_CWD] >= 0) {
+		close_quietly(fds[SERVE_CWD]);
+	}
+	free(strs);
+	return ret;
+}
+
+int bfs_connect(const char *path, int argc, char *argv[]) {
+	struct sockaddr_un addr;
+	if (serve_addr(&addr, path) != 0) {
+		return -1;
+	}
+
+	int sock = serve_socket();
+	if (sock < 0) {
+		return -1;
+	}
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close_quietly(sock);
+		return -1;
+	}
+
+	// Once connected, the server is responsible for the command
+	int32_t status = EXIT_FAILURE;
+	if (serve_send(sock, argc, argv) != 0) {
+		fprintf(stderr, "%s: $BFS_SERVER %s: %s.\n", argv[0], path, errstr());
+	} else if (xread(sock, &status, sizeof(status)) != sizeof(status)) {
+		status = EXIT_FAILURE;
+	}
+
+	close_quietly(sock);
+	return status;
+}
+
+/** Receive a request from a client. */
+static int serve_recv(int conn, int fds[static SERVE_FDS], char ***argv, char ***envp) {
+	struct serve_header header;
+	struct iovec iov = {
+		.iov_base = &header,
+		.iov_len = sizeof(header),
+	};
+
+	union serve_cmsg cmsg;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg.buf,
+		.msg_controllen = sizeof(cmsg.buf),
+	};
+
+	int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	ssize_t len;
+	do {
+		len = recvmsg(conn, &msg, flags);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) {
+		return -1;
+	}
+
+	struct cmsghdr *hdr = CMSG_FIRSTHDR(&msg);
+	if (!hdr || hdr->cmsg_level != SOL_SOCKET || hdr->cmsg_type != SCM_RIGHTS
+	    || hdr->cmsg_len != CMSG_LEN(SERVE_FDS * sizeof(int))) {
+		errno = EPROTO;
+		return -1;
+	}
+	memcpy(fds, CMSG_DATA(hdr), SERVE_FDS * sizeof(int));
+
+	// The rest of the header may arrive separately
+	size_t rest = sizeof(header) - len;
+	if (rest > 0 && xread(conn, (char *)&header + len, rest) != rest) {
+		goto eproto;
+	}
+
+	if (header.argc < 1 || header.size > SERVE_MAX || (uint64_t)header.argc + header.envc > header.size) {
+		goto eproto;
+	}
+
+	size_t size = header.size;
+	char *strs = malloc(size);
+	if (!strs) {
+		return -1;
+	}
+	if (xread(conn, strs, size) != size || strs[size - 1] != '\0') {
+		free(strs);
+		goto eproto;
+	}
+
+	size_t count = (size_t)header.argc + header.envc;
+	char **ptrs = ALLOC_ARRAY(char *, count + 2);
+	if (!ptrs) {
+		free(strs);
+		return -1;
+	}
+
+	// Split the strings into argv and envp, each NULL-terminated
+	char *str = strs;
+	size_t j = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (str >= strs + size) {
+			free(ptrs);
+			free(strs);
+			goto eproto;
+		}
+		if (i == header.argc) {
+			ptrs[j++] = NULL;
+		}
+		ptrs[j++] = str;
+		str += strlen(str) + 1;
+	}
+	if (header.envc == 0) {
+		ptrs[j++] = NULL;
+	}
+	ptrs[j] = NULL;
+
+	*argv = ptrs;
+	*envp = ptrs + header.argc + 1;
+	return header.argc;
+
+eproto:
+	errno = EPROTO;
+	return -1;
+}
+
+/** Exit once the client hangs up. */
+static void *serve_watch(void *ptr) {
+	int conn = (intptr_t)ptr;
+
+	// The client never writes after its request, so this only returns
+	// once the client exits (e.g. from ^C)
+	char c;
+	while (read(conn, &c, 1) < 0 && errno == EINTR) {
+		continue;
+	}
+	_exit(EXIT_FAILURE);
+}
+
+/** Handle a connection, in a forked child. */
+static int serve_child(int conn, bfs_main_fn *run) {
+	// Leave the server's session, so the client's terminal never stops us
+	setsid();
+
+	int fds[SERVE_FDS];
+	char **argv, **envp;
+	int argc = serve_recv(conn, fds, &argv, &envp);
+	if (argc < 0) {
+		perror("bfs -serve");
+		return EXIT_FAILURE;
+	}
+
+	for (int i = SERVE_STDIN; i <= SERVE_STDERR; ++i) {
+		if (dup2(fds[i], i) < 0) {
+			perror("dup2()");
+			return EXIT_FAILURE;
+		}
+		if (fds[i] > STDERR_FILENO) {
+			close_quietly(fds[i]);
+		}
+	}
+
+	if (fchdir(fds[SERVE_CWD]) != 0) {
+		perror("fchdir()");
+		return EXIT_FAILURE;
+	}
+	close_quietly(fds[SERVE_CWD]);
+
+	environ = envp;
+
+	pthread_t watcher;
+	if (thread_create(&watcher, NULL, serve_watch, (void *)(intptr_t)conn) == 0) {
+		pthread_detach(watcher);
+	}
+
+	int32_t status = run(argc, argv);
+	xwrite(conn, &status, sizeof(status));
+	return status;
+}
+
+/** Unlink the socket if we're killed. */
+static void serve_unlink(int sig, siginfo_t *info, void *arg) {
+	unlink(arg);
+}
+
+int bfs_serve(const struct bfs_ctx *ctx, bfs_main_fn *run) {
+	const char *path = ctx->serve;
+	int ret = EXIT_FAILURE;
+	struct sighook *hook = NULL;
+	struct bfs_mtab *mtab = NULL;
+	int mountinfo = -1;
+
+	struct sockaddr_un addr;
+	if (serve_addr(&addr, path) != 0) {
+		bfs_error(ctx, "${blu}-serve${rs} ${bld}%pq${rs}: %s.\n", path, errstr());
+		return EXIT_FAILURE;
+	}
+
+	int sock = serve_socket();
+	if (sock < 0) {
+		bfs_perror(ctx, "socket()");
+		return EXIT_FAILURE;
+	}
+
+	// Only let our own user connect
+	mode_t mask = umask(0077);
+	int error = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (error != 0) {
+		bfs_error(ctx, "${blu}-serve${rs} ${bld}%pq${rs}: %s.\n", path, errstr());
+		goto fail;
+	}
+
+	hook = atsigexit(serve_unlink, (void *)path);
+
+	if (listen(sock, SOMAXCONN) != 0) {
+		bfs_perror(ctx, "listen()");
+		goto unlink;
+	}
+
+	// Don't leave zombies behind
+	struct sigaction sa = {
+		.sa_handler = SIG_IGN,
+	};
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGCHLD, &sa, NULL) != 0) {
+		bfs_perror(ctx, "sigaction()");
+		goto unlink;
+	}
+
+#if __linux__
+	// Parse the mount table once, and again whenever it changes
+	mtab = bfs_mtab_parse();
+	mountinfo = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+	if (mountinfo < 0) {
+		bfs_mtab_free(mtab);
+		mtab = NULL;
+	}
+#endif
+
+	while (true) {
+		struct pollfd pfds[] = {
+			{ .fd = sock, .events = POLLIN },
+			{ .fd = mountinfo, .events = POLLPRI },
+		};
+		nfds_t npfds = mountinfo >= 0 ? 2 : 1;
+
+		if (poll(pfds, npfds, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			bfs_perror(ctx, "poll()");
+			break;
+		}
+
+		if (npfds > 1 && (pfds[1].revents & (POLLPRI | POLLERR))) {
+			bfs_mtab_free(mtab);
+			mtab = bfs_mtab_parse();
+		}
+
+		if (!(pfds[0].revents & POLLIN)) {
+			continue;
+		}
+
+		int conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			bfs_perror(ctx, "accept()");
+			break;
+		}
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			sigunhook(hook);
+			close_quietly(sock);
+			if (mountinfo >= 0) {
+				close_quietly(mountinfo);
+			}
+
+			sa.sa_handler = SIG_DFL;
+			sigaction(SIGCHLD, &sa, NULL);
+
+			if (mtab) {
+				bfs_ctx_warm_mtab(mtab);
+			}
+			exit(serve_child(conn, run));
+		} else if (pid < 0) {
+			bfs_perror(ctx, "fork()");
+		}
+
+		close_quietly(conn);
+	}
+
+unlink:
+	unlink(path);
+fail:
+	sigunhook(hook);
+	if (mountinfo >= 0) {
+		close_quietly(mountinfo);
+	}
+	bfs_mtab_free(mtab);
+	close_quietly(sock);
+	return ret;
+}
@@ -0,0 +1,57 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * A resident server for repeated searches (-serve and $BFS_SERVER).
+ */
+
+#ifndef BFS_SERVE_H
+#define BFS_SERVE_H
+
+struct bfs_ctx;
+
+/**
+ * Runs a single bfs command line.
+ *
+ * @param argc
+ *         The number of arguments.
+ * @param argv
+ *         The arguments, starting with the command name.
+ * @return
+ *         The exit status.
+ */
+typedef int bfs_main_fn(int argc, char *argv[]);
+
+/**
+ * Serve searches on a Unix socket, until interrupted.
+ *
+ * Each connection is handled by a forked child, which adopts the client's
+ * standard streams, working directory, and environment before running the
+ * command line with the given function.  The children inherit the server's
+ * already-parsed mount table, and skip program startup entirely.
+ *
+ * @param ctx
+ *         The bfs context (with ctx->serve set).
+ * @param run
+ *         The function that runs each command line.
+ * @return
+ *         EXIT_FAILURE if the server couldn't be started or failed.
+ */
+int bfs_serve(const struct bfs_ctx *ctx, bfs_main_fn *run);
+
+/**
+ * Run a command line in a server started with -serve.
+ *
+ * @param path
+ *         The path to the server's socket.
+ * @param argc
+ *         The number of arguments.
+ * @param argv
+ *         The arguments, starting with the command name.
+ * @return
+ *         The exit status of the command, or -1 if the server couldn't be
+ *         reached (and the command should be run locally instead).
+ */
+int bfs_connect(const char *path, int argc, char *argv[]);
+
+#endif // BFS_SERVE_H
@@ -0,0 +1,652 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "snapdiff.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "bftw.h"
+#include "bit.h"
+#include "dir.h"
+#include "dstring.h"
+#include "mtab.h"
+#include "stat.h"
+#include "xspawn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if BFS_HAS_BTRFS_TREE_SEARCH
+#  include <linux/btrfs.h>
+#  include <linux/btrfs_tree.h>
+#  include <sys/ioctl.h>
+#endif
+
+/** Whether we can find the changed files on btrfs. */
+#if BFS_HAS_BTRFS_TREE_SEARCH && defined(BTRFS_IOC_GET_SUBVOL_INFO)
+#  define SNAPDIFF_BTRFS true
+#else
+#  define SNAPDIFF_BTRFS false
+#endif
+
+/**
+ * The files that changed under one root.
+ */
+struct snapdiff {
+	/** The changed paths, relative to the root ("" for the root itself). */
+	dchar **paths;
+	/** The number of changed paths. */
+	size_t npaths;
+};
+
+/** Add a changed path. */
+static int snapdiff_push(struct snapdiff *diff, const char *rel, size_t len) {
+	dchar **path = RESERVE(dchar *, &diff->paths, &diff->npaths);
+	if (!path) {
+		return -1;
+	}
+
+	*path = dstrxdup(rel, len);
+	if (!*path) {
+		--diff->npaths;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Forget the changed paths. */
+static void snapdiff_clear(struct snapdiff *diff) {
+	for (size_t i = 0; i < diff->npaths; ++i) {
+		dstrfree(diff->paths[i]);
+	}
+	diff->npaths = 0;
+}
+
+#if SNAPDIFF_BTRFS
+
+/** The size of the BTRFS_IOC_TREE_SEARCH_V2 result buffer. */
+#define BTRFS_BUF_SIZE (256 << 10)
+
+/** The size of the BTRFS_IOC_INO_PATHS result buffer (the kernel won't fill more). */
+#define BTRFS_PATHS_SIZE 4096
+
+/** Convert a little-endian integer to native byte order. */
+#define btrfs_le(n) (ENDIAN_NATIVE == ENDIAN_BIG ? bswap(n) : (n))
+
+/**
+ * Get the transaction ID when a snapshot was taken of the subvolume containing
+ * fd.  Everything modified in a later transaction changed since the snapshot.
+ */
+static int btrfs_snapshot_transid(int fd, const char *snapshot, uint64_t *transid) {
+	struct btrfs_ioctl_get_subvol_info_args subvol, snap;
+	if (ioctl(fd, BTRFS_IOC_GET_SUBVOL_INFO, &subvol) != 0) {
+		return -1;
+	}
+
+	int snap_fd = open(snapshot, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (snap_fd < 0) {
+		return -1;
+	}
+
+	int ret = ioctl(snap_fd, BTRFS_IOC_GET_SUBVOL_INFO, &snap);
+	close_quietly(snap_fd);
+	if (ret != 0) {
+		return -1;
+	}
+
+	// Generation numbers can only be compared within the same subvolume
+	if (memcmp(snap.parent_uuid, subvol.uuid, sizeof(subvol.uuid)) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*transid = snap.otransid;
+	return 0;
+}
+
+/** Add the paths to a changed inode that are under the root. */
+static int btrfs_push_paths(struct snapdiff *diff, int fd, uint64_t ino, const char *prefix, struct btrfs_data_container *paths) {
+	struct btrfs_ioctl_ino_path_args args = {
+		.inum = ino,
+		.size = BTRFS_PATHS_SIZE,
+		.fspath = (uintptr_t)paths,
+	};
+
+	if (ioctl(fd, BTRFS_IOC_INO_PATHS, &args) != 0) {
+		// Unlinked files have no paths
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	size_t prefix_len = strlen(prefix);
+	for (uint32_t i = 0; i < paths->elem_cnt; ++i) {
+		// The paths are relative to the subvolume root, at offsets from val
+		const char *path = (const char *)paths->val + paths->val[i];
+		if (strncmp(path, prefix, prefix_len) != 0) {
+			continue;
+		}
+
+		path += prefix_len;
+		if (snapdiff_push(diff, path, strlen(path)) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Find the files that changed on btrfs, by their transaction IDs. */
+static int snapdiff_btrfs(struct snapdiff *diff, const char *root, const char *snapshot) {
+	int ret = -1;
+	struct btrfs_ioctl_search_args_v2 *args = NULL;
+	struct btrfs_data_container *paths = NULL;
+
+	int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		goto fail;
+	}
+
+	uint64_t transid;
+	if (btrfs_snapshot_transid(fd, snapshot, &transid) != 0) {
+		goto fail;
+	}
+
+	// Where the root is in its subvolume, like "dir/sub/" ("" for the
+	// subvolume root itself)
+	struct btrfs_ioctl_ino_lookup_args lookup = {
+		.treeid = 0,
+		.objectid = sb.st_ino,
+	};
+	if (ioctl(fd, BTRFS_IOC_INO_LOOKUP, &lookup) != 0) {
+		goto fail;
+	}
+	lookup.name[sizeof(lookup.name) - 1] = '\0';
+
+	args = ZALLOC_FLEX(struct btrfs_ioctl_search_args_v2, buf, BTRFS_BUF_SIZE / sizeof(uint64_t));
+	paths = malloc(BTRFS_PATHS_SIZE);
+	if (!args || !paths) {
+		goto fail;
+	}
+
+	// Tree 0 is the subvolume containing fd.  The kernel can skip whole
+	// blocks that were not written since min_transid, but the leaves it
+	// does return may still hold older items.
+	struct btrfs_ioctl_search_key key = {
+		.tree_id = 0,
+		.min_objectid = BTRFS_FIRST_FREE_OBJECTID,
+		.max_objectid = BTRFS_LAST_FREE_OBJECTID,
+		.min_offset = 0,
+		.max_offset = UINT64_MAX,
+		.min_transid = transid + 1,
+		.max_transid = UINT64_MAX,
+		.min_type = BTRFS_INODE_ITEM_KEY,
+		.max_type = BTRFS_INODE_ITEM_KEY,
+	};
+
+	while (key.min_objectid <= key.max_objectid) {
+		args->key = key;
+		args->key.nr_items = UINT32_MAX;
+		args->buf_size = BTRFS_BUF_SIZE;
+
+		if (ioctl(fd, BTRFS_IOC_TREE_SEARCH_V2, args) != 0) {
+			goto fail;
+		} else if (args->key.nr_items == 0) {
+			break;
+		}
+
+		const char *cur = (const char *)args->buf;
+		for (uint32_t i = 0; i < args->key.nr_items; ++i) {
+			struct btrfs_ioctl_search_header header;
+			memcpy(&header, cur, sizeof(header));
+			cur += sizeof(header);
+
+			if (header.type == BTRFS_INODE_ITEM_KEY && header.len >= sizeof(struct btrfs_inode_item)) {
+				struct btrfs_inode_item item;
+				memcpy(&item, cur, sizeof(item));
+
+				if (btrfs_le((uint64_t)item.transid) <= transid) {
+					// Unchanged
+				} else if (header.objectid == sb.st_ino) {
+					if (snapdiff_push(diff, "", 0) != 0) {
+						goto fail;
+					}
+				} else if (btrfs_push_paths(diff, fd, header.objectid, lookup.name, paths) != 0) {
+					goto fail;
+				}
+			}
+
+			cur += header.len;
+			key.min_objectid = header.objectid + 1;
+		}
+
+		if (key.min_objectid == 0) {
+			// Wrapped around
+			break;
+		}
+	}
+
+	ret = 0;
+fail:
+	free(paths);
+	free(args);
+	close_quietly(fd);
+	return ret;
+}
+
+#endif // SNAPDIFF_BTRFS
+
+/** Decode the \NNNN octal escapes in a path from zfs diff, in place. */
+static void zfs_unescape(char *path) {
+	char *out = path;
+	for (const char *in = path; *in;) {
+		if (in[0] != '\\' || in[1] < '0' || in[1] > '7') {
+			*out++ = *in++;
+			continue;
+		}
+
+		++in;
+		unsigned int c = 0;
+		for (int i = 0; i < 4 && *in >= '0' && *in <= '7'; ++i) {
+			c = 8 * c + (*in++ - '0');
+		}
+		*out++ = c;
+	}
+	*out = '\0';
+}
+
+/** Add an absolute path from zfs diff, if it's under the root. */
+static int zfs_push_path(struct snapdiff *diff, const char *real, const char *path) {
+	size_t len = strlen(real);
+	if (strncmp(path, real, len) != 0) {
+		return 0;
+	}
+
+	path += len;
+	if (*path == '/') {
+		++path;
+	} else if (*path && strcmp(real, "/") != 0) {
+		// A sibling like /root-other
+		return 0;
+	}
+
+	return snapdiff_push(diff, path, strlen(path));
+}
+
+/** Parse one line of zfs diff -H output, like "M\t/path" or "R\t/from\t/to". */
+static int zfs_parse_line(struct snapdiff *diff, const char *real, char *line) {
+	char *path = strchr(line, '\t');
+	if (!path || path != line + 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	*path++ = '\0';
+
+	char *to = strchr(path, '\t');
+	if (to) {
+		*to++ = '\0';
+	}
+
+	switch (line[0]) {
+	case '-':
+		// Removed files aren't there to visit
+		return 0;
+	case 'R':
+		if (!to) {
+			errno = EINVAL;
+			return -1;
+		}
+		path = to;
+		break;
+	case '+':
+	case 'M':
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	zfs_unescape(path);
+	return zfs_push_path(diff, real, path);
+}
+
+/** Start zfs diff, returning its PID and the read end of its output. */
+static pid_t zfs_diff_spawn(const char *snapshot, int *fd) {
+	pid_t pid = -1;
+	int error;
+
+	char *exe = bfs_spawn_resolve("zfs");
+	if (!exe) {
+		return -1;
+	}
+
+	int pipefd[2];
+	if (pipe_cloexec(pipefd) != 0) {
+		goto fail_exe;
+	}
+
+	struct bfs_spawn spawn;
+	if (bfs_spawn_init(&spawn) != 0) {
+		goto fail_pipe;
+	}
+
+	if (bfs_spawn_adddup2(&spawn, pipefd[1], STDOUT_FILENO) == 0) {
+		char *argv[] = {exe, "diff", "-H", (char *)snapshot, NULL};
+		pid = bfs_spawn(exe, &spawn, argv, NULL);
+	}
+
+	error = errno;
+	bfs_spawn_destroy(&spawn);
+	errno = error;
+fail_pipe:
+	error = errno;
+	xclose(pipefd[1]);
+	if (pid < 0) {
+		xclose(pipefd[0]);
+	} else {
+		*fd = pipefd[0];
+	}
+	errno = error;
+fail_exe:
+	error = errno;
+	free(exe);
+	errno = error;
+	return pid;
+}
+
+/** Read the output of zfs diff and wait for it to finish. */
+static int zfs_diff_read(struct snapdiff *diff, const char *real, int fd, pid_t pid) {
+	int error = 0;
+
+	FILE *file = fdopen(fd, "r");
+	if (file) {
+		char *line;
+		while ((line = xgetdelim(file, '\n'))) {
+			int err = zfs_parse_line(diff, real, line);
+			free(line);
+			if (err != 0) {
+				break;
+			}
+		}
+		error = errno;
+		fclose(file);
+	} else {
+		error = errno;
+		close_quietly(fd);
+	}
+
+	int wstatus;
+	if (xwaitpid(pid, &wstatus, 0) < 0) {
+		return -1;
+	} else if (error) {
+		errno = error;
+		return -1;
+	} else if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+		// zfs diff already complained
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Find the files that changed on ZFS, with zfs diff. */
+static int snapdiff_zfs(struct snapdiff *diff, const char *root, const char *snapshot) {
+	// zfs diff prints canonical absolute paths
+	char *real = realpath(root, NULL);
+	if (!real) {
+		return -1;
+	}
+
+	int ret = -1;
+	int fd;
+	pid_t pid = zfs_diff_spawn(snapshot, &fd);
+	if (pid >= 0) {
+		ret = zfs_diff_read(diff, real, fd, pid);
+	}
+
+	int error = errno;
+	free(real);
+	errno = error;
+	return ret;
+}
+
+/** Find the files that changed under a root. */
+static int snapdiff_load(struct snapdiff *diff, const char *root, const char *fstype, const char *snapshot) {
+#if SNAPDIFF_BTRFS
+	if (fstype && strcmp(fstype, "btrfs") == 0) {
+		return snapdiff_btrfs(diff, root, snapshot);
+	}
+#endif
+
+	if (fstype && strcmp(fstype, "zfs") == 0) {
+		return snapdiff_zfs(diff, root, snapshot);
+	}
+
+	errno = ENOTSUP;
+	return -1;
+}
+
+/**
+ * Compare paths such that '/' sorts before every other character, so each
+ * directory is immediately followed by its descendants.
+ */
+static int snapdiff_cmp(const void *a, const void *b) {
+	const unsigned char *x = *(const unsigned char *const *)a;
+	const unsigned char *y = *(const unsigned char *const *)b;
+
+	while (*x && *x == *y) {
+		++x;
+		++y;
+	}
+
+	int cx = *x == '/' ? 1 : *x ? *x + 1 : 0;
+	int cy = *y == '/' ? 1 : *y ? *y + 1 : 0;
+	return cx - cy;
+}
+
+/** Check whether a path is a descendant of a pruned one. */
+static bool snapdiff_pruned(const char *pruned, const char *rel) {
+	if (!pruned) {
+		return false;
+	} else if (!pruned[0]) {
+		// The root was pruned
+		return true;
+	}
+
+	size_t len = strlen(pruned);
+	return strncmp(rel, pruned, len) == 0 && rel[len] == '/';
+}
+
+/** Get the bfs_stat() flags for a file (like bftw()). */
+static enum bfs_stat_flags snapdiff_stat_flags(enum bftw_flags flags, size_t depth) {
+	enum bftw_flags mask = BFTW_FOLLOW_ALL;
+	if (depth == 0) {
+		mask |= BFTW_FOLLOW_ROOTS;
+	}
+
+	if (flags & mask) {
+		return BFS_STAT_TRYFOLLOW;
+	} else {
+		return BFS_STAT_NOFOLLOW;
+	}
+}
+
+/** Visit a changed file. */
+static enum bftw_action snapdiff_visit(const struct bftw_args *args, const char *root, const char *path, size_t depth, const char *fstype, dchar **link_buf) {
+	enum bfs_stat_flags stat_flags = snapdiff_stat_flags(args->flags, depth);
+	size_t nameoff = xbaseoff(path);
+
+	// [0] holds the followed stat() info for symlinks, [1] the lstat() info
+	struct bfs_stat scratch[2];
+
+	struct BFTW ftwbuf = {
+		.path = path,
+		.nameoff = nameoff,
+		.root = root,
+		.depth = depth,
+		.visit = BFTW_PRE,
+		.type = BFS_ERROR,
+		.at_fd = AT_FDCWD,
+		.at_path = path,
+		.stat_flags = stat_flags,
+		.stat_mask = args->stat_mask,
+		.stat_bufs = {
+			.stat_buf = &scratch[0],
+			.lstat_buf = &scratch[1],
+			.stat_err = -1,
+			.lstat_err = -1,
+			.link_buf = link_buf,
+			.link_err = -1,
+		},
+		.fstype = fstype,
+		.empty = -1,
+	};
+
+	struct bftw_stat *bufs = &ftwbuf.stat_bufs;
+	if (bfs_stat(AT_FDCWD, path, BFS_STAT_NOFOLLOW, &scratch[1]) != 0) {
+		if (depth > 0 && errno == ENOENT) {
+			// Deleted again since the diff
+			return BFTW_CONTINUE;
+		}
+		ftwbuf.error = errno;
+		bufs->lstat_err = errno;
+	} else {
+		bufs->lstat_err = 0;
+		ftwbuf.type = bfs_mode_to_type(scratch[1].mode);
+		if (ftwbuf.type != BFS_LNK) {
+			// Non-link, so share stat info
+			bufs->stat_buf = &scratch[1];
+			bufs->stat_err = 0;
+		} else if ((stat_flags & BFS_STAT_TRYFOLLOW) && bfs_stat(AT_FDCWD, path, BFS_STAT_FOLLOW, &scratch[0]) == 0) {
+			bufs->stat_err = 0;
+			ftwbuf.type = bfs_mode_to_type(scratch[0].mode);
+		}
+	}
+
+	if (depth > 0 && args->filter && ftwbuf.type != BFS_ERROR) {
+		struct bfs_dirent de = {
+			.type = ftwbuf.type,
+			.name = path + nameoff,
+			.namelen = strlen(path + nameoff),
+			.ino = scratch[1].ino,
+			.stat = &scratch[1],
+		};
+		if (args->filter(&de, depth, args->ptr)) {
+			return BFTW_PRUNE;
+		}
+	}
+
+	return args->callback(&ftwbuf, args->ptr);
+}
+
+/** Visit the changed files under one root. */
+static int snapdiff_walk_root(const struct bftw_args *args, const char *root, const struct snapdiff *diff, const char *fstype, bool *stop) {
+	int ret = -1;
+	dchar *path = NULL;
+	dchar *link_buf = NULL;
+	const char *pruned = NULL;
+
+	for (size_t i = 0; i < diff->npaths; ++i) {
+		const dchar *rel = diff->paths[i];
+		if (i > 0 && strcmp(rel, diff->paths[i - 1]) == 0) {
+			continue;
+		} else if (snapdiff_pruned(pruned, rel)) {
+			continue;
+		}
+
+		size_t depth = 0;
+		if (rel[0]) {
+			++depth;
+			for (const char *slash = rel; (slash = strchr(slash, '/')); ++slash) {
+				++depth;
+			}
+		}
+
+		if (dstrcpy(&path, root) != 0) {
+			goto fail;
+		}
+		if (rel[0]) {
+			if (dstrlen(path) > 0 && path[dstrlen(path) - 1] != '/' && dstrapp(&path, '/') != 0) {
+				goto fail;
+			}
+			if (dstrdcat(&path, rel) != 0) {
+				goto fail;
+			}
+		}
+
+		enum bftw_action action = snapdiff_visit(args, root, path, depth, fstype, &link_buf);
+		if (action == BFTW_STOP) {
+			*stop = true;
+			break;
+		} else if (action == BFTW_PRUNE) {
+			pruned = rel;
+		}
+	}
+
+	ret = 0;
+fail:
+	dstrfree(link_buf);
+	dstrfree(path);
+	return ret;
+}
+
+int bfs_snapdiff_walk(const char *snapshot, const struct bfs_mtab *mtab, const struct bftw_args *args) {
+	int ret = -1;
+	struct snapdiff diff = {0};
+	bool stop = false;
+
+	for (size_t i = 0; !stop; ++i) {
+		const char *root;
+		if (i < args->npaths) {
+			root = args->paths[i];
+		} else if (args->next_path) {
+			root = args->next_path(args->ptr);
+			if (!root) {
+				break;
+			}
+		} else {
+			break;
+		}
+
+		struct bfs_stat statbuf;
+		if (bfs_stat(AT_FDCWD, root, snapdiff_stat_flags(args->flags, 0), &statbuf) != 0) {
+			// Report the broken root like bftw() would
+			dchar *link_buf = NULL;
+			stop = snapdiff_visit(args, root, root, 0, NULL, &link_buf) == BFTW_STOP;
+			dstrfree(link_buf);
+			continue;
+		}
+
+		const char *fstype = mtab ? bfs_fstype(mtab, &statbuf) : NULL;
+		if (snapdiff_load(&diff, root, fstype, snapshot) != 0) {
+			goto fail;
+		}
+
+		qsort(diff.paths, diff.npaths, sizeof(*diff.paths), snapdiff_cmp);
+		if (snapdiff_walk_root(args, root, &diff, fstype, &stop) != 0) {
+			goto fail;
+		}
+		snapdiff_clear(&diff);
+	}
+
+	ret = 0;
+fail:;
+	int error = errno;
+	snapdiff_clear(&diff);
+	free(diff.paths);
+	errno = error;
+	return ret;
+}
@@ -0,0 +1,41 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Snapshot-diff traversal (-changed-since).
+ *
+ * Rather than walking the whole namespace, ask the file system which files
+ * changed since an older snapshot was taken, and visit just those.  On btrfs,
+ * the inodes are found by their generation numbers with
+ * BTRFS_IOC_TREE_SEARCH_V2; on ZFS, the paths come from zfs-diff(8).
+ */
+
+#ifndef BFS_SNAPDIFF_H
+#define BFS_SNAPDIFF_H
+
+#include "bftw.h"
+
+struct bfs_mtab;
+
+/**
+ * Visit the files under each root that changed since a snapshot.
+ *
+ * The changed files are visited in pre-order, without any ancestors that did
+ * not change themselves.  Files that were deleted since the snapshot are not
+ * visited.
+ *
+ * @param snapshot
+ *         The snapshot to compare against: the path to a btrfs snapshot of the
+ *         roots' subvolume, or a ZFS snapshot name (dataset@snap).
+ * @param mtab
+ *         The mount table, to determine the type of each root's file system.
+ * @param args
+ *         The bftw() arguments.  Only the paths, flags, filter, and callback
+ *         are used.
+ * @return
+ *         0 on success, -1 on failure (ENOTSUP if a root is not on btrfs or
+ *         ZFS).
+ */
+int bfs_snapdiff_walk(const char *snapshot, const struct bfs_mtab *mtab, const struct bftw_args *args);
+
+#endif // BFS_SNAPDIFF_H
@@ -7,10 +7,12 @@
 #include "bfs.h"
 #include "bfstd.h"
 #include "diag.h"
+#include "perf.h"
 #include "sanity.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -132,7 +134,9 @@ void bfs_stat_convert(struct bfs_stat *dest, const struct stat *src) {
  */
 static int bfs_stat_impl(int at_fd, const char *at_path, int at_flags, struct bfs_stat *buf) {
 	struct stat statbuf;
+	uint64_t start = bfs_perf_start();
 	int ret = fstatat(at_fd, at_path, &statbuf, at_flags);
+	bfs_perf_end(BFS_PERF_STAT, start, 0);
 	if (ret == 0) {
 		bfs_stat_convert(buf, &statbuf);
 	}
@@ -145,11 +149,13 @@ static int bfs_stat_impl(int at_fd, const char *at_path, int at_flags, struct bf
  * Wrapper for the statx() system call, which had no glibc wrapper prior to 2.28.
  */
 static int bfs_statx(int at_fd, const char *at_path, int at_flags, unsigned int mask, struct statx *buf) {
+	uint64_t start = bfs_perf_start();
 #if BFS_HAS_STATX
 	int ret = statx(at_fd, at_path, at_flags, mask, buf);
 #else
 	int ret = syscall(SYS_statx, at_fd, at_path, at_flags, mask, buf);
 #endif
+	bfs_perf_end(BFS_PERF_STAT, start, 0);
 
 	if (ret == 0) {
 		// -fsanitize=memory doesn't know about statx()
@@ -169,6 +175,26 @@ int bfs_statx_flags(enum bfs_stat_flags flags) {
 	return ret;
 }
 
+unsigned int bfs_statx_mask(enum bfs_stat_field mask) {
+	// Always ask for the fields that bfs_statx_convert() requires
+	unsigned int ret = STATX_BASIC_STATS & ~(STATX_ATIME | STATX_CTIME | STATX_MTIME);
+
+	if (mask & BFS_STAT_ATIME) {
+		ret |= STATX_ATIME;
+	}
+	if (mask & BFS_STAT_BTIME) {
+		ret |= STATX_BTIME;
+	}
+	if (mask & BFS_STAT_CTIME) {
+		ret |= STATX_CTIME;
+	}
+	if (mask & BFS_STAT_MTIME) {
+		ret |= STATX_MTIME;
+	}
+
+	return ret;
+}
+
 int bfs_statx_convert(struct bfs_stat *dest, const struct statx *src) {
 	// Callers shouldn't have to check anything except the times
 	const unsigned int guaranteed = STATX_BASIC_STATS & ~(STATX_ATIME | STATX_CTIME | STATX_MTIME);
@@ -239,10 +265,9 @@ int bfs_statx_convert(struct bfs_stat *dest, const struct statx *src) {
 /**
  * bfs_stat() implementation backed by statx().
  */
-static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, struct bfs_stat *buf) {
-	unsigned int mask = STATX_BASIC_STATS | STATX_BTIME;
+static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, enum bfs_stat_field mask, struct bfs_stat *buf) {
 	struct statx xbuf;
-	int ret = bfs_statx(at_fd, at_path, at_flags, mask, &xbuf);
+	int ret = bfs_statx(at_fd, at_path, at_flags, bfs_statx_mask(mask), &xbuf);
 	if (ret != 0) {
 		return ret;
 	}
@@ -255,12 +280,12 @@ static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, struct b
 /**
  * Calls the stat() implementation with explicit flags.
  */
-static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, struct bfs_stat *buf) {
+static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, enum bfs_stat_field mask, struct bfs_stat *buf) {
 #if BFS_USE_STATX
 	static atomic bool has_statx = true;
 
 	if (load(&has_statx, relaxed)) {
-		int ret = bfs_statx_impl(at_fd, at_path, at_flags, buf);
+		int ret = bfs_statx_impl(at_fd, at_path, at_flags, mask, buf);
 		if (ret != 0 && errno_is_like(ENOSYS)) {
 			store(&has_statx, false, relaxed);
 		} else {
@@ -277,21 +302,25 @@ static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, struc
 /**
  * Implements the BFS_STAT_TRYFOLLOW retry logic.
  */
-static int bfs_stat_tryfollow(int at_fd, const char *at_path, int at_flags, enum bfs_stat_flags bfs_flags, struct bfs_stat *buf) {
-	int ret = bfs_stat_explicit(at_fd, at_path, at_flags, buf);
+static int bfs_stat_tryfollow(int at_fd, const char *at_path, int at_flags, enum bfs_stat_flags bfs_flags, enum bfs_stat_field mask, struct bfs_stat *buf) {
+	int ret = bfs_stat_explicit(at_fd, at_path, at_flags, mask, buf);
 
 	if (ret != 0
 	    && (bfs_flags & (BFS_STAT_NOFOLLOW | BFS_STAT_TRYFOLLOW)) == BFS_STAT_TRYFOLLOW
 	    && errno_is_like(ENOENT))
 	{
 		at_flags |= AT_SYMLINK_NOFOLLOW;
-		ret = bfs_stat_explicit(at_fd, at_path, at_flags, buf);
+		ret = bfs_stat_explicit(at_fd, at_path, at_flags, mask, buf);
 	}
 
 	return ret;
 }
 
 int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf) {
+	return bfs_stat_mask(at_fd, at_path, flags, BFS_STAT_ALL, buf);
+}
+
+int bfs_stat_mask(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field mask, struct bfs_stat *buf) {
 #if BFS_USE_STATX
 	int at_flags = bfs_statx_flags(flags);
 #else
@@ -299,13 +328,13 @@ int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct b
 #endif
 
 	if (at_path) {
-		return bfs_stat_tryfollow(at_fd, at_path, at_flags, flags, buf);
+		return bfs_stat_tryfollow(at_fd, at_path, at_flags, flags, mask, buf);
 	}
 
 #if BFS_USE_STATX
 	// If we have statx(), use it with AT_EMPTY_PATH for its extra features
 	at_flags |= AT_EMPTY_PATH;
-	return bfs_stat_explicit(at_fd, "", at_flags, buf);
+	return bfs_stat_explicit(at_fd, "", at_flags, mask, buf);
 #else
 	// Otherwise, just use fstat() rather than fstatat(at_fd, ""), to save
 	// the kernel the trouble of copying in the empty string
@@ -341,6 +370,74 @@ const struct timespec *bfs_stat_time(const struct bfs_stat *buf, enum bfs_stat_f
 	}
 }
 
+/** A field of struct bfs_stat. */
+struct bfs_stat_member {
+	/** The field's offset. */
+	size_t offset;
+	/** The field's size. */
+	size_t size;
+};
+
+#define BFS_STAT_MEMBER(member) \
+	{offsetof(struct bfs_stat, member), sizeof(((struct bfs_stat *)NULL)->member)}
+
+/** The bfs_stat fields, in bit order. */
+static const struct bfs_stat_member bfs_stat_members[] = {
+	BFS_STAT_MEMBER(mode),
+	BFS_STAT_MEMBER(dev),
+	BFS_STAT_MEMBER(ino),
+	BFS_STAT_MEMBER(nlink),
+	BFS_STAT_MEMBER(gid),
+	BFS_STAT_MEMBER(uid),
+	BFS_STAT_MEMBER(size),
+	BFS_STAT_MEMBER(blocks),
+	BFS_STAT_MEMBER(rdev),
+	BFS_STAT_MEMBER(attrs),
+	BFS_STAT_MEMBER(atime),
+	BFS_STAT_MEMBER(btime),
+	BFS_STAT_MEMBER(ctime),
+	BFS_STAT_MEMBER(mtime),
+};
+
+static_assert(BFS_STAT_ALL == (1 << countof(bfs_stat_members)) - 1, "bfs_stat_members mismatch");
+
+size_t bfs_stat_packed_size(enum bfs_stat_field mask) {
+	size_t size = 0;
+	for (size_t i = 0; i < countof(bfs_stat_members); ++i) {
+		if (mask & (1 << i)) {
+			size += bfs_stat_members[i].size;
+		}
+	}
+	return size;
+}
+
+void bfs_stat_pack(struct bfs_packed_stat *dest, const struct bfs_stat *src, enum bfs_stat_field mask) {
+	dest->mask = src->mask & mask;
+
+	unsigned char *data = dest->data;
+	for (size_t i = 0; i < countof(bfs_stat_members); ++i) {
+		if (dest->mask & (1 << i)) {
+			const struct bfs_stat_member *member = &bfs_stat_members[i];
+			memcpy(data, (const char *)src + member->offset, member->size);
+			data += member->size;
+		}
+	}
+}
+
+void bfs_stat_unpack(struct bfs_stat *dest, const struct bfs_packed_stat *src) {
+	memset(dest, 0, sizeof(*dest));
+	dest->mask = src->mask;
+
+	const unsigned char *data = src->data;
+	for (size_t i = 0; i < countof(bfs_stat_members); ++i) {
+		if (src->mask & (1 << i)) {
+			const struct bfs_stat_member *member = &bfs_stat_members[i];
+			memcpy((char *)dest + member->offset, data, member->size);
+			data += member->size;
+		}
+	}
+}
+
 void bfs_stat_id(const struct bfs_stat *buf, bfs_file_id *id) {
 	memcpy(*id, &buf->dev, sizeof(buf->dev));
 	memcpy(*id + sizeof(buf->dev), &buf->ino, sizeof(buf->ino));
@@ -58,6 +58,11 @@ enum bfs_stat_field {
 	BFS_STAT_MTIME  = 1 << 13,
 };
 
+/** All bfs_stat fields. */
+#define BFS_STAT_ALL ((enum bfs_stat_field)((BFS_STAT_MTIME << 1) - 1))
+/** The timestamp fields. */
+#define BFS_STAT_TIMES (BFS_STAT_ATIME | BFS_STAT_BTIME | BFS_STAT_CTIME | BFS_STAT_MTIME)
+
 /**
  * Get the human-readable name of a bfs_stat field.
  */
@@ -133,6 +138,15 @@ struct bfs_stat {
  */
 int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf);
 
+/**
+ * Like bfs_stat(), but only ask for the fields that will be used.
+ *
+ * @param mask
+ *         The fields to request.  The non-time fields are always filled in,
+ *         but unrequested times may be skipped (check buf->mask).
+ */
+int bfs_stat_mask(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field mask, struct bfs_stat *buf);
+
 /**
  * Convert bfs_stat_flags to fstatat() flags.
  */
@@ -149,6 +163,11 @@ void bfs_stat_convert(struct bfs_stat *dest, const struct stat *src);
  */
 int bfs_statx_flags(enum bfs_stat_flags flags);
 
+/**
+ * Convert a bfs_stat_field mask to a statx() mask.
+ */
+unsigned int bfs_statx_mask(enum bfs_stat_field mask);
+
 /**
  * Convert struct statx to struct bfs_stat.
  */
@@ -160,6 +179,38 @@ int bfs_statx_convert(struct bfs_stat *dest, const struct statx *src);
  */
 const struct timespec *bfs_stat_time(const struct bfs_stat *buf, enum bfs_stat_field field);
 
+/**
+ * A bfs_stat() buffer that only stores the fields it has.
+ */
+struct bfs_packed_stat {
+	/** The fields that are present. */
+	enum bfs_stat_field mask;
+	/** The present fields, in bit order. */
+	unsigned char data[];
+};
+
+/**
+ * Get the number of data bytes a packed buffer with the given fields needs.
+ */
+size_t bfs_stat_packed_size(enum bfs_stat_field mask);
+
+/**
+ * Pack some of the fields of a bfs_stat() buffer.
+ *
+ * @param dest
+ *         The packed buffer, with room for bfs_stat_packed_size(mask) bytes.
+ * @param src
+ *         The buffer to pack.
+ * @param mask
+ *         The fields to keep (only those also in src->mask are stored).
+ */
+void bfs_stat_pack(struct bfs_packed_stat *dest, const struct bfs_stat *src, enum bfs_stat_field mask);
+
+/**
+ * Expand a packed buffer back into a bfs_stat() buffer.
+ */
+void bfs_stat_unpack(struct bfs_stat *dest, const struct bfs_packed_stat *src);
+
 /**
  * A unique ID for a file.
  */
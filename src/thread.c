@@ -40,6 +40,10 @@ int mutex_init(pthread_mutex_t *mutex, pthread_mutexattr_t *attr) {
 	THREAD_FALLIBLE(pthread_mutex_init(mutex, attr));
 }
 
+void thread_detach(pthread_t thread) {
+	THREAD_INFALLIBLE(pthread_detach(thread));
+}
+
 void mutex_lock(pthread_mutex_t *mutex) {
 	THREAD_INFALLIBLE(pthread_mutex_lock(mutex));
 }
@@ -65,6 +69,11 @@ void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
 	THREAD_INFALLIBLE(pthread_cond_wait(cond, mutex));
 }
 
+bool cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline) {
+	THREAD_INFALLIBLE(pthread_cond_timedwait(cond, mutex, deadline), ETIMEDOUT);
+	return err == 0;
+}
+
 void cond_signal(pthread_cond_t *cond) {
 	THREAD_INFALLIBLE(pthread_cond_signal(cond));
 }
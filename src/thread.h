@@ -9,6 +9,7 @@
 #define BFS_THREAD_H
 
 #include <pthread.h>
+#include <time.h>
 
 /** Thread entry point type. */
 typedef void *thread_fn(void *arg);
@@ -26,6 +27,11 @@ int thread_create(pthread_t *thread, const pthread_attr_t *attr, thread_fn *fn,
  */
 void thread_join(pthread_t thread, void **ret);
 
+/**
+ * Wrapper for pthread_detach().
+ */
+void thread_detach(pthread_t thread);
+
 /**
  * Wrapper for pthread_mutex_init().
  */
@@ -64,6 +70,15 @@ int cond_init(pthread_cond_t *cond, pthread_condattr_t *attr);
  */
 void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
 
+/**
+ * Wrapper for pthread_cond_timedwait().
+ *
+ * @return
+ *         Whether the condition was signalled before the (CLOCK_REALTIME)
+ *         deadline.
+ */
+bool cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline);
+
 /**
  * Wrapper for pthread_cond_signal().
  */
@@ -0,0 +1,216 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "throttle.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "perf.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if BFS_HAS_IOPRIO_SET_SYSCALL
+#  include <linux/ioprio.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+/** The number of operations to measure before backing off. */
+#define THROTTLE_WARMUP 64
+/** The number of operations between backoff adjustments. */
+#define THROTTLE_PERIOD 16
+/** The largest backoff multiplier. */
+#define THROTTLE_MAX_BACKOFF 64
+/**
+ * Latencies below this (in nanoseconds) never cause backoff.  Faster calls are
+ * served from caches, and their latency mostly reflects CPU noise (including
+ * the cost of waking up after our own sleeps), not contention for the disk.
+ */
+#define THROTTLE_MIN_LATENCY 1000000.0
+
+struct bfs_throttle {
+	/** Protects the rest of the fields. */
+	pthread_mutex_t mutex;
+	/** Signalled when an operation finishes. */
+	pthread_cond_t cond;
+
+	/** The minimum time between operations, in nanoseconds. */
+	uint64_t interval;
+	/** When the next operation may start. */
+	uint64_t next;
+	/** The maximum number of concurrent operations (0 for no limit). */
+	size_t max_inflight;
+	/** The number of operations in progress. */
+	size_t inflight;
+
+	/** Smoothed operation latency, in nanoseconds. */
+	double latency;
+	/** The usual latency, which backoff is relative to. */
+	double baseline;
+	/** The number of latency samples. */
+	size_t samples;
+	/** The current backoff multiplier. */
+	unsigned int backoff;
+};
+
+struct bfs_throttle *bfs_throttle_new(size_t rate, size_t inflight) {
+	struct bfs_throttle *throttle = ZALLOC(struct bfs_throttle);
+	if (!throttle) {
+		return NULL;
+	}
+
+	if (mutex_init(&throttle->mutex, NULL) != 0) {
+		goto fail;
+	}
+
+	if (cond_init(&throttle->cond, NULL) != 0) {
+		goto fail_mutex;
+	}
+
+	if (rate) {
+		throttle->interval = 1000000000ULL / rate;
+	}
+	throttle->max_inflight = inflight;
+	throttle->backoff = 1;
+	return throttle;
+
+fail_mutex:
+	mutex_destroy(&throttle->mutex);
+fail:
+	free(throttle);
+	return NULL;
+}
+
+/** Get the current concurrency limit. */
+static size_t throttle_limit(const struct bfs_throttle *throttle) {
+	size_t limit = throttle->max_inflight / throttle->backoff;
+	return limit ? limit : 1;
+}
+
+/** Get the current time between operations. */
+static uint64_t throttle_gap(const struct bfs_throttle *throttle) {
+	if (throttle->interval) {
+		return throttle->interval * throttle->backoff;
+	} else {
+		// Without a rate limit, back off by idling for (backoff - 1)
+		// times as long as each operation takes
+		return (throttle->backoff - 1) * throttle->latency;
+	}
+}
+
+/** Sleep for some number of nanoseconds. */
+static void throttle_sleep(uint64_t ns) {
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+uint64_t bfs_throttle_start(struct bfs_throttle *throttle) {
+	mutex_lock(&throttle->mutex);
+
+	if (throttle->max_inflight) {
+		while (throttle->inflight >= throttle_limit(throttle)) {
+			cond_wait(&throttle->cond, &throttle->mutex);
+		}
+	}
+	++throttle->inflight;
+
+	uint64_t now = bfs_perf_now();
+	uint64_t when = throttle->next > now ? throttle->next : now;
+	throttle->next = when + throttle_gap(throttle);
+
+	mutex_unlock(&throttle->mutex);
+
+	if (when > now) {
+		int error = errno;
+		throttle_sleep(when - now);
+		errno = error;
+		now = bfs_perf_now();
+	}
+
+	return now;
+}
+
+/** Adjust the backoff based on the latest latency measurement. */
+static void throttle_adapt(struct bfs_throttle *throttle, uint64_t elapsed) {
+	size_t samples = ++throttle->samples;
+	if (samples == 1) {
+		throttle->latency = elapsed;
+	} else {
+		throttle->latency += (elapsed - throttle->latency) / 16.0;
+	}
+
+	if (samples < THROTTLE_WARMUP) {
+		return;
+	} else if (samples == THROTTLE_WARMUP || throttle->latency < throttle->baseline) {
+		throttle->baseline = throttle->latency;
+	} else {
+		// Let the baseline drift upwards, in case the usual latency
+		// really has changed
+		throttle->baseline += throttle->baseline / 4096.0;
+	}
+
+	if (samples % THROTTLE_PERIOD != 0) {
+		return;
+	}
+
+	double high = 4 * throttle->baseline;
+	double low = 2 * throttle->baseline;
+	if (high < THROTTLE_MIN_LATENCY) {
+		high = THROTTLE_MIN_LATENCY;
+	}
+	if (low < THROTTLE_MIN_LATENCY) {
+		low = THROTTLE_MIN_LATENCY;
+	}
+
+	// Back off quickly when the latency climbs, and recover slowly
+	if (throttle->latency > high) {
+		if (throttle->backoff < THROTTLE_MAX_BACKOFF) {
+			throttle->backoff *= 2;
+		}
+	} else if (throttle->latency < low) {
+		if (throttle->backoff > 1) {
+			--throttle->backoff;
+			cond_broadcast(&throttle->cond);
+		}
+	}
+}
+
+void bfs_throttle_end(struct bfs_throttle *throttle, uint64_t start) {
+	uint64_t end = bfs_perf_now();
+	uint64_t elapsed = end > start ? end - start : 0;
+
+	mutex_lock(&throttle->mutex);
+	--throttle->inflight;
+	throttle_adapt(throttle, elapsed);
+	cond_signal(&throttle->cond);
+	mutex_unlock(&throttle->mutex);
+}
+
+void bfs_throttle_free(struct bfs_throttle *throttle) {
+	if (!throttle) {
+		return;
+	}
+
+	cond_destroy(&throttle->cond);
+	mutex_destroy(&throttle->mutex);
+	free(throttle);
+}
+
+int bfs_ioprio_idle(void) {
+#if BFS_HAS_IOPRIO_SET_SYSCALL
+	// Linux doesn't need any special privileges for the idle class
+	return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) == 0 ? 0 : -1;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
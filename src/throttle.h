@@ -0,0 +1,69 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * I/O throttling (-io-rate, -io-depth).
+ */
+
+#ifndef BFS_THROTTLE_H
+#define BFS_THROTTLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A thread-safe limit on the rate and concurrency of I/O operations.
+ *
+ * Throttles also back off when the observed latency of the operations rises
+ * well above its usual level, and recover gradually once it falls again.
+ */
+struct bfs_throttle;
+
+/**
+ * Create a throttle.
+ *
+ * @param rate
+ *         The maximum number of operations per second, or 0 for no limit.
+ * @param inflight
+ *         The maximum number of concurrent operations, or 0 for no limit.
+ * @return
+ *         The new throttle, or NULL on failure.
+ */
+struct bfs_throttle *bfs_throttle_new(size_t rate, size_t inflight);
+
+/**
+ * Wait until another operation is allowed to start.
+ *
+ * @param throttle
+ *         The throttle.
+ * @return
+ *         The start time of the operation, for bfs_throttle_end().
+ */
+uint64_t bfs_throttle_start(struct bfs_throttle *throttle);
+
+/**
+ * Finish an operation.
+ *
+ * @param throttle
+ *         The throttle.
+ * @param start
+ *         The return value of bfs_throttle_start().
+ */
+void bfs_throttle_end(struct bfs_throttle *throttle, uint64_t start);
+
+/**
+ * Destroy a throttle.
+ */
+void bfs_throttle_free(struct bfs_throttle *throttle);
+
+/**
+ * Move the calling process to the idle I/O scheduling class, so it only uses
+ * the disk when nothing else does (-io-idle).  Threads and processes started
+ * afterwards inherit the priority.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_ioprio_idle(void);
+
+#endif // BFS_THROTTLE_H
@@ -0,0 +1,181 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "top.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "diag.h"
+#include "thread.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct bfs_top {
+	/** Protects the heap from concurrent evaluations. */
+	pthread_mutex_t mutex;
+	/** Whether larger keys are better. */
+	bool largest;
+	/** The maximum number of entries. */
+	size_t capacity;
+	/** The number of entries. */
+	size_t count;
+	/**
+	 * The entries, as a binary heap with the worst entry at the root, so
+	 * it can be replaced when a better one comes along.
+	 */
+	struct bfs_top_entry *heap;
+};
+
+struct bfs_top *bfs_top_new(size_t n, bool largest) {
+	struct bfs_top *top = ZALLOC(struct bfs_top);
+	if (!top) {
+		return NULL;
+	}
+
+	top->heap = ALLOC_ARRAY(struct bfs_top_entry, n);
+	if (!top->heap && n > 0) {
+		goto fail;
+	}
+
+	if (mutex_init(&top->mutex, NULL) != 0) {
+		goto fail;
+	}
+
+	top->largest = largest;
+	top->capacity = n;
+	return top;
+
+fail:
+	free(top->heap);
+	free(top);
+	return NULL;
+}
+
+/** Compare two keys. */
+static int top_key_cmp(const struct bfs_top_key *a, const struct bfs_top_key *b) {
+	if (a->value != b->value) {
+		return a->value < b->value ? -1 : 1;
+	} else if (a->nsec != b->nsec) {
+		return a->nsec < b->nsec ? -1 : 1;
+	} else {
+		return 0;
+	}
+}
+
+/** Check if an entry is better than another. */
+static bool top_better(const struct bfs_top *top, const struct bfs_top_key *key, const char *path, const struct bfs_top_entry *other) {
+	int cmp = top_key_cmp(key, &other->key);
+	if (cmp == 0) {
+		// Break ties by path, to make the result deterministic
+		return strcmp(path, other->path) < 0;
+	}
+	return top->largest ? cmp > 0 : cmp < 0;
+}
+
+/** Move an entry down the heap until its children are better. */
+static void top_sift_down(struct bfs_top *top, size_t i, size_t count) {
+	struct bfs_top_entry *heap = top->heap;
+	struct bfs_top_entry entry = heap[i];
+
+	while (true) {
+		size_t child = 2 * i + 1;
+		if (child >= count) {
+			break;
+		}
+
+		// Find the worse child
+		if (child + 1 < count && top_better(top, &heap[child].key, heap[child].path, &heap[child + 1])) {
+			++child;
+		}
+
+		if (!top_better(top, &entry.key, entry.path, &heap[child])) {
+			break;
+		}
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = entry;
+}
+
+/** Move an entry up the heap until its parent is worse. */
+static void top_sift_up(struct bfs_top *top, size_t i) {
+	struct bfs_top_entry *heap = top->heap;
+	struct bfs_top_entry entry = heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!top_better(top, &heap[parent].key, heap[parent].path, &entry)) {
+			break;
+		}
+
+		heap[i] = heap[parent];
+		i = parent;
+	}
+
+	heap[i] = entry;
+}
+
+int bfs_top_add(struct bfs_top *top, const struct bfs_top_key *key, const char *path) {
+	int ret = 0;
+	mutex_lock(&top->mutex);
+
+	if (top->count < top->capacity) {
+		char *copy = strdup(path);
+		if (!copy) {
+			ret = -1;
+			goto done;
+		}
+
+		struct bfs_top_entry *entry = &top->heap[top->count++];
+		entry->key = *key;
+		entry->path = copy;
+		top_sift_up(top, top->count - 1);
+	} else if (top->count > 0 && top_better(top, key, path, &top->heap[0])) {
+		// Replace the worst entry
+		char *copy = strdup(path);
+		if (!copy) {
+			ret = -1;
+			goto done;
+		}
+
+		struct bfs_top_entry *root = &top->heap[0];
+		free(root->path);
+		root->key = *key;
+		root->path = copy;
+		top_sift_down(top, 0, top->count);
+	}
+
+done:
+	mutex_unlock(&top->mutex);
+	return ret;
+}
+
+const struct bfs_top_entry *bfs_top_sort(struct bfs_top *top, size_t *count) {
+	// Heapsort: repeatedly move the worst entry to the end
+	for (size_t n = top->count; n > 1; --n) {
+		struct bfs_top_entry worst = top->heap[0];
+		top->heap[0] = top->heap[n - 1];
+		top->heap[n - 1] = worst;
+		top_sift_down(top, 0, n - 1);
+	}
+
+	*count = top->count;
+	return top->heap;
+}
+
+void bfs_top_free(struct bfs_top *top) {
+	if (!top) {
+		return;
+	}
+
+	for (size_t i = 0; i < top->count; ++i) {
+		free(top->heap[i].path);
+	}
+	free(top->heap);
+	mutex_destroy(&top->mutex);
+	free(top);
+}
@@ -0,0 +1,83 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Bounded heaps that keep the N best files seen so far (-top and -bottom).
+ */
+
+#ifndef BFS_TOP_H
+#define BFS_TOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A sort key, e.g. a size or a timestamp.
+ */
+struct bfs_top_key {
+	/** The value (or seconds, for timestamps). */
+	intmax_t value;
+	/** The nanoseconds, for timestamps. */
+	long nsec;
+};
+
+/**
+ * A file kept by a bfs_top.
+ */
+struct bfs_top_entry {
+	/** The sort key. */
+	struct bfs_top_key key;
+	/** The path to the file. */
+	char *path;
+};
+
+/**
+ * Keeps the N files with the largest (or smallest) keys.
+ */
+struct bfs_top;
+
+/**
+ * Create a new bounded heap.
+ *
+ * @param n
+ *         The number of files to keep.
+ * @param largest
+ *         Whether to keep the largest keys (otherwise the smallest).
+ * @return
+ *         The new heap, or NULL on failure.
+ */
+struct bfs_top *bfs_top_new(size_t n, bool largest);
+
+/**
+ * Offer a file to the heap.  This function is thread-safe.
+ *
+ * @param top
+ *         The heap.
+ * @param key
+ *         The file's sort key.
+ * @param path
+ *         The path to the file (copied if the file is kept).
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_top_add(struct bfs_top *top, const struct bfs_top_key *key, const char *path);
+
+/**
+ * Sort the kept files, best first.  Ties are broken by path, so the result
+ * doesn't depend on the order that files were added.
+ *
+ * @param top
+ *         The heap, which won't accept any more files.
+ * @param[out] count
+ *         Will hold the number of entries.
+ * @return
+ *         The sorted entries.
+ */
+const struct bfs_top_entry *bfs_top_sort(struct bfs_top *top, size_t *count);
+
+/**
+ * Free a bounded heap.
+ */
+void bfs_top_free(struct bfs_top *top);
+
+#endif // BFS_TOP_H
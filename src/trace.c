@@ -0,0 +1,203 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "trace.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "perf.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** A recorded trace event. */
+struct trace_event {
+	/** The event name (a string literal). */
+	const char *name;
+	/** The event timestamp, in nanoseconds. */
+	uint64_t ts;
+	/** The span duration, or counter value. */
+	uint64_t arg;
+	/** The event phase ('X' for spans, 'C' for counters). */
+	char phase;
+};
+
+/** A thread's trace buffer. */
+struct trace_thread {
+	/** The next thread in the list. */
+	struct trace_thread *next;
+	/** The thread's name. */
+	const char *name;
+	/** The thread ID in the trace. */
+	size_t tid;
+	/** The thread's index among those with the same name. */
+	size_t index;
+	/** The recorded events. */
+	struct trace_event *events;
+	/** The number of events. */
+	size_t nevents;
+};
+
+bool bfs_tracing = false;
+
+/** The trace file. */
+static FILE *trace_file = NULL;
+/** The time tracing started. */
+static uint64_t trace_epoch;
+
+/** The list of threads with trace buffers. */
+static struct trace_thread *trace_threads = NULL;
+/** The tail of trace_threads. */
+static struct trace_thread **trace_tail = &trace_threads;
+/** The number of registered threads. */
+static size_t trace_nthreads = 0;
+/** Protects trace_threads. */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The calling thread's trace buffer, allocated on first use. */
+static thread_local struct trace_thread *trace_self = NULL;
+/** The name the calling thread's buffer was registered with. */
+static thread_local const char *trace_self_name = NULL;
+
+int bfs_trace_open(const char *path) {
+	trace_file = xfopen(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+	if (!trace_file) {
+		return -1;
+	}
+
+	trace_epoch = bfs_perf_now();
+	bfs_tracing = true;
+	return 0;
+}
+
+/** Get the calling thread's trace buffer. */
+static struct trace_thread *trace_thread(void) {
+	const char *name = bfs_perf_thread_name();
+	if (trace_self && trace_self_name == name) {
+		return trace_self;
+	}
+
+	int error = errno;
+	struct trace_thread *self = ZALLOC(struct trace_thread);
+	errno = error;
+	if (!self) {
+		return NULL;
+	}
+	self->name = name;
+
+	mutex_lock(&trace_mutex);
+	for (const struct trace_thread *thread = trace_threads; thread; thread = thread->next) {
+		if (strcmp(thread->name, name) == 0) {
+			++self->index;
+		}
+	}
+	self->tid = ++trace_nthreads;
+	*trace_tail = self;
+	trace_tail = &self->next;
+	mutex_unlock(&trace_mutex);
+
+	trace_self = self;
+	trace_self_name = name;
+	return self;
+}
+
+/** Add an event to the calling thread's buffer. */
+static void trace_push(const char *name, char phase, uint64_t ts, uint64_t arg) {
+	struct trace_thread *self = trace_thread();
+	if (!self) {
+		return;
+	}
+
+	int error = errno;
+	struct trace_event *event = RESERVE(struct trace_event, &self->events, &self->nevents);
+	errno = error;
+	if (!event) {
+		return;
+	}
+
+	event->name = name;
+	event->ts = ts;
+	event->arg = arg;
+	event->phase = phase;
+}
+
+void bfs_trace_span(const char *name, uint64_t start, uint64_t end) {
+	trace_push(name, 'X', start, end > start ? end - start : 0);
+}
+
+void bfs_trace_record_counter(const char *name, uint64_t value) {
+	trace_push(name, 'C', bfs_perf_now(), value);
+}
+
+/** Convert a timestamp to microseconds since the trace started. */
+static double trace_us(uint64_t ts) {
+	if (ts < trace_epoch) {
+		return 0.0;
+	}
+	return (ts - trace_epoch) / 1.0e3;
+}
+
+int bfs_trace_close(void) {
+	if (!trace_file) {
+		return 0;
+	}
+
+	bfs_tracing = false;
+
+	FILE *file = trace_file;
+	trace_file = NULL;
+
+	long pid = getpid();
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":0,\"args\":{\"name\":\"bfs\"}}", pid);
+
+	struct trace_thread *next;
+	for (struct trace_thread *thread = trace_threads; thread; thread = next) {
+		next = thread->next;
+
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%zu,\"args\":{\"name\":\"%s #%zu\"}}",
+			pid, thread->tid, thread->name, thread->index + 1);
+
+		for (size_t i = 0; i < thread->nevents; ++i) {
+			const struct trace_event *event = &thread->events[i];
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%ld,\"tid\":%zu,\"ts\":%.3f",
+				event->name, event->phase, pid, thread->tid, trace_us(event->ts));
+			if (event->phase == 'X') {
+				fprintf(file, ",\"dur\":%.3f}", event->arg / 1.0e3);
+			} else {
+				fprintf(file, ",\"args\":{\"value\":%llu}}", (unsigned long long)event->arg);
+			}
+		}
+
+		free(thread->events);
+		free(thread);
+	}
+	trace_threads = NULL;
+	trace_tail = &trace_threads;
+	trace_nthreads = 0;
+	trace_self = NULL;
+
+	fprintf(file, "\n]}\n");
+
+	int ret = 0;
+	if (ferror(file)) {
+		ret = -1;
+	}
+
+	int error = errno;
+	if (fclose(file) != 0) {
+		ret = -1;
+		error = errno;
+	}
+
+	errno = error;
+	return ret;
+}
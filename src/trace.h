@@ -0,0 +1,89 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Timeline tracing in the Chrome trace event format (-trace).
+ */
+
+#ifndef BFS_TRACE_H
+#define BFS_TRACE_H
+
+#include "perf.h"
+
+#include <stdint.h>
+
+/** Whether tracing is enabled. */
+extern bool bfs_tracing;
+
+/**
+ * Start tracing.  Must be called before any other threads are started.
+ *
+ * @param path
+ *         The path to the trace file to write.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_trace_open(const char *path);
+
+/**
+ * Start a span.
+ *
+ * @return
+ *         The start time, or 0 if tracing is disabled.
+ */
+static inline uint64_t bfs_trace_begin(void) {
+	if (bfs_tracing) {
+		return bfs_perf_now();
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Record a span (slow path of bfs_trace_end()).
+ */
+void bfs_trace_span(const char *name, uint64_t start, uint64_t end);
+
+/**
+ * Finish a span.
+ *
+ * @param name
+ *         The name of the span, which must be a string literal.
+ * @param start
+ *         The return value of bfs_trace_begin().
+ */
+static inline void bfs_trace_end(const char *name, uint64_t start) {
+	if (start) {
+		bfs_trace_span(name, start, bfs_perf_now());
+	}
+}
+
+/**
+ * Record a counter value (slow path of bfs_trace_counter()).
+ */
+void bfs_trace_record_counter(const char *name, uint64_t value);
+
+/**
+ * Record the current value of a counter track.
+ *
+ * @param name
+ *         The name of the counter, which must be a string literal.
+ * @param value
+ *         The value of the counter.
+ */
+static inline void bfs_trace_counter(const char *name, uint64_t value) {
+	if (bfs_tracing) {
+		bfs_trace_record_counter(name, value);
+	}
+}
+
+/**
+ * Write out the trace file.  Must only be called once all other threads have
+ * finished.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_trace_close(void);
+
+#endif // BFS_TRACE_H
@@ -84,12 +84,14 @@
 #include "trie.h"
 
 #include "alloc.h"
+#include "atomic.h"
 #include "bfs.h"
 #include "bit.h"
 #include "diag.h"
 #include "list.h"
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 static_assert(CHAR_WIDTH == 8, "This trie implementation assumes 8-bit bytes.");
@@ -163,11 +165,43 @@ static uintptr_t trie_encode_node(const struct trie_node *node) {
 	return ptr;
 }
 
+/**
+ * Shared tries are searched without locks, so their pointers are accessed
+ * atomically.  They're stored as plain words to keep the node layout the same
+ * for every trie, which is fine as long as the representations match.
+ */
+static_assert(sizeof(atomic uintptr_t) == sizeof(uintptr_t), "atomic uintptr_t has a different size");
+
+/** Load a pointer that may be concurrently replaced. */
+static uintptr_t trie_load(const uintptr_t *ptr) {
+	return load((const atomic uintptr_t *)ptr, acquire);
+}
+
+/** Make a fully initialized node or leaf visible at some position. */
+static void trie_publish(uintptr_t *ptr, uintptr_t value) {
+	store((atomic uintptr_t *)ptr, value, release);
+}
+
 void trie_init(struct trie *trie) {
 	trie->root = 0;
 	LIST_INIT(trie);
 	VARENA_INIT(&trie->nodes, struct trie_node, children);
 	VARENA_INIT(&trie->leaves, struct trie_leaf, key);
+	trie->frozen = NULL;
+	trie->shared = false;
+}
+
+void trie_share(struct trie *trie) {
+	bfs_assert(!trie->frozen);
+	trie->shared = true;
+}
+
+void *trie_get_value(const struct trie_leaf *leaf) {
+	return load((void *const atomic *)&leaf->value, acquire);
+}
+
+void trie_set_value(struct trie_leaf *leaf, void *value) {
+	store((void *atomic *)&leaf->value, value, release);
 }
 
 /** Extract the nibble at a certain offset from a byte sequence. */
@@ -194,7 +228,7 @@ static unsigned char trie_key_nibble(const void *key, size_t offset) {
  */
 _trie_clones
 static struct trie_leaf *trie_representative(const struct trie *trie, const void *key, size_t length) {
-	uintptr_t ptr = trie->root;
+	uintptr_t ptr = trie_load(&trie->root);
 	if (!ptr) {
 		return NULL;
 	}
@@ -213,7 +247,7 @@ static struct trie_leaf *trie_representative(const struct trie *trie, const void
 			unsigned int bits = node->bitmap & (bit - 1) & mask;
 			index = count_ones(bits);
 		}
-		ptr = node->children[index];
+		ptr = trie_load(&node->children[index]);
 	}
 
 	return trie_decode_leaf(ptr);
@@ -262,7 +296,7 @@ static struct trie_leaf *trie_terminal_leaf(const struct trie_node *node) {
 			break;
 		}
 
-		uintptr_t ptr = node->children[0];
+		uintptr_t ptr = trie_load(&node->children[0]);
 		if (trie_is_leaf(ptr)) {
 			return trie_decode_leaf(ptr);
 		} else {
@@ -284,7 +318,7 @@ static bool trie_check_prefix(struct trie_leaf *leaf, size_t skip, const char *k
 
 _trie_clones
 static struct trie_leaf *trie_find_prefix_impl(const struct trie *trie, const char *key) {
-	uintptr_t ptr = trie->root;
+	uintptr_t ptr = trie_load(&trie->root);
 	if (!ptr) {
 		return NULL;
 	}
@@ -311,7 +345,7 @@ static struct trie_leaf *trie_find_prefix_impl(const struct trie *trie, const ch
 		unsigned int bit = 1U << nibble;
 		if (node->bitmap & bit) {
 			unsigned int index = count_ones(node->bitmap & (bit - 1));
-			ptr = node->children[index];
+			ptr = trie_load(&node->children[index]);
 		} else {
 			return best;
 		}
@@ -418,6 +452,46 @@ static size_t trie_mismatch(const struct trie_leaf *rep, const void *key, size_t
 	return 2 * i;
 }
 
+/** Copy a node into a new allocation with room for a given number of children. */
+static struct trie_node *trie_node_copy(struct trie *trie, const struct trie_node *node, size_t capacity) {
+	struct trie_node *copy = trie_node_alloc(trie, capacity);
+	if (copy) {
+		size_t size = count_ones(node->bitmap);
+		memcpy(copy, node, sizeof_flex(struct trie_node, children, size));
+	}
+	return copy;
+}
+
+/**
+ * Insert a leaf into a node of a shared trie.  Concurrent searches may be
+ * reading the node, so it's copied rather than modified in place.  The old copy
+ * is retired rather than freed, and only reclaimed with the whole trie.
+ */
+_trie_clones
+static struct trie_leaf *trie_node_insert_shared(struct trie *trie, uintptr_t *ptr, struct trie_leaf *leaf, unsigned char nibble) {
+	const struct trie_node *node = trie_decode_node(*ptr);
+	unsigned int size = count_ones(node->bitmap);
+
+	struct trie_node *copy = trie_node_copy(trie, node, bit_ceil(size + 1));
+	if (!copy) {
+		trie_leaf_free(trie, leaf);
+		return NULL;
+	}
+
+	unsigned int bit = 1U << nibble;
+	bfs_assert(!(copy->bitmap & bit));
+	copy->bitmap |= bit;
+
+	unsigned int target = count_ones(copy->bitmap & (bit - 1));
+	for (size_t i = size; i > target; --i) {
+		copy->children[i] = copy->children[i - 1];
+	}
+	copy->children[target] = trie_encode_leaf(leaf);
+
+	trie_publish(ptr, trie_encode_node(copy));
+	return leaf;
+}
+
 /**
  * Insert a leaf into a node.  The node must not have a child in that position
  * already.  Effectively takes a subtrie like this:
@@ -445,6 +519,10 @@ static struct trie_leaf *trie_node_insert(struct trie *trie, uintptr_t *ptr, str
 	struct trie_node *node = trie_decode_node(*ptr);
 	unsigned int size = count_ones(node->bitmap);
 
+	if (trie->shared) {
+		return trie_node_insert_shared(trie, ptr, leaf, nibble);
+	}
+
 	// Double the capacity every power of two
 	if (has_single_bit(size)) {
 		node = trie_node_realloc(trie, node, size, 2 * size);
@@ -511,7 +589,7 @@ static uintptr_t *trie_jump(struct trie *trie, uintptr_t *ptr, const char *key,
 	node->bitmap = 1 << nibble;
 
 	node->children[0] = *ptr;
-	*ptr = trie_encode_node(node);
+	trie_publish(ptr, trie_encode_node(node));
 	return node->children;
 }
 
@@ -545,17 +623,29 @@ static struct trie_leaf *trie_split(struct trie *trie, uintptr_t *ptr, struct tr
 
 	node->bitmap = (1 << key_nibble) | (1 << rep_nibble);
 
+	uintptr_t other = *ptr;
 	size_t delta = mismatch - offset;
-	if (!trie_is_leaf(*ptr)) {
-		struct trie_node *child = trie_decode_node(*ptr);
+	if (!trie_is_leaf(other)) {
+		struct trie_node *child = trie_decode_node(other);
+		if (trie->shared) {
+			// Searches may still be passing through the child
+			size_t size = count_ones(child->bitmap);
+			child = trie_node_copy(trie, child, bit_ceil(size));
+			if (!child) {
+				trie_node_free(trie, node, 2);
+				trie_leaf_free(trie, leaf);
+				return NULL;
+			}
+			other = trie_encode_node(child);
+		}
 		child->offset -= delta;
 	}
 	node->offset = delta;
 
 	unsigned int key_index = key_nibble > rep_nibble;
 	node->children[key_index] = trie_encode_leaf(leaf);
-	node->children[key_index ^ 1] = *ptr;
-	*ptr = trie_encode_node(node);
+	node->children[key_index ^ 1] = other;
+	trie_publish(ptr, trie_encode_node(node));
 	return leaf;
 }
 
@@ -565,6 +655,8 @@ struct trie_leaf *trie_insert_str(struct trie *trie, const char *key) {
 
 _trie_clones
 static struct trie_leaf *trie_insert_mem_impl(struct trie *trie, const void *key, size_t length) {
+	bfs_assert(!trie->frozen);
+
 	struct trie_leaf *rep = trie_representative(trie, key, length);
 	size_t mismatch = trie_mismatch(rep, key, length);
 	if (mismatch >= (length << 1)) {
@@ -577,7 +669,7 @@ static struct trie_leaf *trie_insert_mem_impl(struct trie *trie, const void *key
 	}
 
 	if (!rep) {
-		trie->root = trie_encode_leaf(leaf);
+		trie_publish(&trie->root, trie_encode_leaf(leaf));
 		return leaf;
 	}
 
@@ -667,6 +759,9 @@ static int trie_collapse_node(struct trie *trie, uintptr_t *parent, struct trie_
 
 _trie_clones
 static void trie_remove_impl(struct trie *trie, struct trie_leaf *leaf) {
+	bfs_assert(!trie->frozen);
+	bfs_assert(!trie->shared, "Removing from a shared trie");
+
 	uintptr_t *child = &trie->root;
 	uintptr_t *parent = NULL;
 	unsigned int child_bit = 0, child_index = 0;
@@ -727,15 +822,100 @@ void trie_remove(struct trie *trie, struct trie_leaf *leaf) {
 	trie_remove_impl(trie, leaf);
 }
 
+/** Get the exact size of a node. */
+static size_t trie_node_size(const struct trie_node *node) {
+	return sizeof_flex(struct trie_node, children, count_ones(node->bitmap));
+}
+
+int trie_freeze(struct trie *trie) {
+	bfs_assert(!trie->frozen);
+	bfs_assert(!trie->shared, "Freezing a shared trie");
+
+	if (!trie->root || trie_is_leaf(trie->root)) {
+		return 0;
+	}
+
+	// Put the nodes in breadth-first order
+	const struct trie_node **order = NULL;
+	size_t count = 0;
+	size_t size = 0;
+
+	const struct trie_node **root = RESERVE(const struct trie_node *, &order, &count);
+	if (!root) {
+		return -1;
+	}
+	*root = trie_decode_node(trie->root);
+
+	for (size_t i = 0; i < count; ++i) {
+		const struct trie_node *node = order[i];
+		size += trie_node_size(node);
+
+		size_t nchildren = count_ones(node->bitmap);
+		for (size_t j = 0; j < nchildren; ++j) {
+			uintptr_t child = node->children[j];
+			if (trie_is_leaf(child)) {
+				continue;
+			}
+
+			const struct trie_node **next = RESERVE(const struct trie_node *, &order, &count);
+			if (!next) {
+				free(order);
+				return -1;
+			}
+			*next = trie_decode_node(child);
+		}
+	}
+
+	char *block = alloc(FALSE_SHARING_SIZE, align_ceil(FALSE_SHARING_SIZE, size));
+	if (!block) {
+		free(order);
+		return -1;
+	}
+
+	// Copy the nodes, pointing each one at where its children will go.
+	// Children are placed in the same order they were found above.
+	char *dest = block;
+	char *next = block + trie_node_size(order[0]);
+	size_t n = 1;
+	for (size_t i = 0; i < count; ++i) {
+		size_t node_size = trie_node_size(order[i]);
+		struct trie_node *node = memcpy(dest, order[i], node_size);
+		dest += node_size;
+
+		size_t nchildren = count_ones(node->bitmap);
+		for (size_t j = 0; j < nchildren; ++j) {
+			if (trie_is_leaf(node->children[j])) {
+				continue;
+			}
+
+			bfs_assert(trie_decode_node(node->children[j]) == order[n]);
+			node->children[j] = trie_encode_node((struct trie_node *)next);
+			next += trie_node_size(order[n]);
+			++n;
+		}
+	}
+	bfs_assert(n == count);
+
+	free(order);
+	varena_clear(&trie->nodes);
+	trie->root = trie_encode_node((struct trie_node *)block);
+	trie->frozen = block;
+	return 0;
+}
+
 void trie_clear(struct trie *trie) {
 	trie->root = 0;
 	LIST_INIT(trie);
 
 	varena_clear(&trie->leaves);
 	varena_clear(&trie->nodes);
+
+	free(trie->frozen);
+	trie->frozen = NULL;
 }
 
 void trie_destroy(struct trie *trie) {
 	varena_destroy(&trie->leaves);
 	varena_destroy(&trie->nodes);
+	free(trie->frozen);
 }
@@ -36,6 +36,10 @@ struct trie {
 	struct varena nodes;
 	/** Leaf allocator. */
 	struct varena leaves;
+	/** The contiguous block of nodes, if the trie is frozen. */
+	void *frozen;
+	/** Whether the trie may be searched concurrently with insertions. */
+	bool shared;
 };
 
 /**
@@ -43,6 +47,31 @@ struct trie {
  */
 void trie_init(struct trie *trie);
 
+/**
+ * Allow a trie to be searched by other threads while it's being modified.
+ *
+ * Afterwards, the trie_find_*() functions may be called concurrently with each
+ * other and with trie_insert_*(), as long as the insertions themselves are
+ * serialized (e.g. by a mutex).  Nodes are never modified in place once other
+ * threads can see them, only replaced, and the replaced nodes are kept until
+ * the trie is cleared or destroyed.  A shared trie can't be frozen, and leaves
+ * can't be removed from it.
+ *
+ * Leaf values should be accessed with trie_get_value() and trie_set_value().
+ */
+void trie_share(struct trie *trie);
+
+/**
+ * Get the value of a leaf that may be concurrently set by trie_set_value().
+ */
+void *trie_get_value(const struct trie_leaf *leaf);
+
+/**
+ * Set the value of a leaf, making it (and anything it points to) visible to
+ * concurrent trie_get_value() calls.
+ */
+void trie_set_value(struct trie_leaf *leaf, void *value);
+
 /**
  * Find the leaf for a string key.
  *
@@ -129,6 +158,20 @@ struct trie_leaf *trie_insert_mem(struct trie *trie, const void *key, size_t len
  */
 void trie_remove(struct trie *trie, struct trie_leaf *leaf);
 
+/**
+ * Freeze a trie that won't be modified any more.
+ *
+ * The internal nodes are copied into a single contiguous block, in breadth-
+ * first order, so that lookups touch as few cache lines as possible.  Leaves
+ * are not moved.  A frozen trie can only be searched, cleared, or destroyed.
+ *
+ * @param trie
+ *         The trie to freeze.
+ * @return
+ *         0 on success, -1 on failure (in which case the trie is unchanged).
+ */
+int trie_freeze(struct trie *trie);
+
 /**
  * Remove all leaves from a trie.
  */
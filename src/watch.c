@@ -0,0 +1,259 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "watch.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "bftw.h"
+#include "dir.h"
+#include "dstring.h"
+#include "stat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if BFS_HAS_INOTIFY
+#  include <sys/inotify.h>
+#endif
+
+#if BFS_HAS_INOTIFY
+
+/** The inotify events we watch for. */
+#define WATCH_EVENTS (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+/** A watched directory. */
+struct bfs_watch_dir {
+	/** The path to the directory (NULL if not watched). */
+	dchar *path;
+	/** The root it was found under. */
+	const char *root;
+	/** The depth of the directory. */
+	size_t depth;
+};
+
+struct bfs_watch {
+	/** The inotify file descriptor. */
+	int fd;
+	/** The watched directories, indexed by watch descriptor. */
+	struct bfs_watch_dir *dirs;
+	/** The capacity of dirs. */
+	size_t capacity;
+	/** The number of watched directories. */
+	size_t count;
+
+	/** The path of the last event. */
+	dchar *path;
+	/** The current position in the event buffer. */
+	size_t pos;
+	/** The number of bytes in the event buffer. */
+	size_t len;
+	/** The event buffer. */
+	alignas(struct inotify_event) char buf[4096];
+};
+
+struct bfs_watch *bfs_watch_new(void) {
+	struct bfs_watch *watch = ZALLOC(struct bfs_watch);
+	if (!watch) {
+		return NULL;
+	}
+
+	watch->path = dstralloc(0);
+	if (!watch->path) {
+		goto fail;
+	}
+
+	watch->fd = inotify_init1(IN_CLOEXEC);
+	if (watch->fd < 0) {
+		goto fail;
+	}
+
+	return watch;
+
+fail:
+	dstrfree(watch->path);
+	free(watch);
+	return NULL;
+}
+
+int bfs_watch_add(struct bfs_watch *watch, const struct BFTW *ftwbuf) {
+	int wd = inotify_add_watch(watch->fd, ftwbuf->path, WATCH_EVENTS | IN_ONLYDIR | IN_EXCL_UNLINK);
+	if (wd < 0) {
+		return -1;
+	}
+
+	size_t i = wd;
+	if (i >= watch->capacity) {
+		size_t capacity = watch->capacity ? watch->capacity : 64;
+		while (capacity <= i) {
+			capacity *= 2;
+		}
+
+		struct bfs_watch_dir *dirs = REALLOC_ARRAY(struct bfs_watch_dir, watch->dirs, watch->capacity, capacity);
+		if (!dirs) {
+			goto fail;
+		}
+		memset(dirs + watch->capacity, 0, (capacity - watch->capacity) * sizeof(*dirs));
+		watch->dirs = dirs;
+		watch->capacity = capacity;
+	}
+
+	struct bfs_watch_dir *dir = &watch->dirs[i];
+	if (dir->path) {
+		// Already watched under another path
+		return 0;
+	}
+
+	dir->path = dstrdup(ftwbuf->path);
+	if (!dir->path) {
+		goto fail;
+	}
+	dir->root = ftwbuf->root;
+	dir->depth = ftwbuf->depth;
+	++watch->count;
+	return 0;
+
+fail:;
+	int error = errno;
+	inotify_rm_watch(watch->fd, wd);
+	errno = error;
+	return -1;
+}
+
+/** Read more events. */
+static int bfs_watch_read(struct bfs_watch *watch) {
+	while (true) {
+		ssize_t ret = read(watch->fd, watch->buf, sizeof(watch->buf));
+		if (ret > 0) {
+			watch->pos = 0;
+			watch->len = ret;
+			return 0;
+		} else if (ret == 0) {
+			errno = EIO;
+			return -1;
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+/** Stop tracking a directory whose watch was removed. */
+static void bfs_watch_forget(struct bfs_watch *watch, struct bfs_watch_dir *dir) {
+	if (dir->path) {
+		dstrfree(dir->path);
+		dir->path = NULL;
+		--watch->count;
+	}
+}
+
+int bfs_watch_wait(struct bfs_watch *watch, struct bfs_watch_event *event) {
+	while (watch->count > 0) {
+		if (watch->pos >= watch->len && bfs_watch_read(watch) != 0) {
+			return -1;
+		}
+
+		const struct inotify_event *ie = (const void *)(watch->buf + watch->pos);
+		watch->pos += sizeof(*ie) + ie->len;
+
+		if (ie->mask & IN_Q_OVERFLOW) {
+			errno = EOVERFLOW;
+			return -1;
+		}
+
+		if (ie->wd < 0 || (size_t)ie->wd >= watch->capacity) {
+			continue;
+		}
+
+		struct bfs_watch_dir *dir = &watch->dirs[ie->wd];
+		if (ie->mask & IN_IGNORED) {
+			bfs_watch_forget(watch, dir);
+			continue;
+		} else if (!dir->path) {
+			continue;
+		} else if (ie->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+			// Our path to it isn't valid any more (if it moved somewhere
+			// else we watch, it'll be picked up again there)
+			inotify_rm_watch(watch->fd, ie->wd);
+			bfs_watch_forget(watch, dir);
+			continue;
+		} else if (ie->len == 0) {
+			continue;
+		}
+
+		if (dstrdcpy(&watch->path, dir->path) != 0) {
+			return -1;
+		}
+
+		size_t nameoff = dstrlen(watch->path);
+		if (nameoff > 0 && watch->path[nameoff - 1] != '/') {
+			if (dstrapp(&watch->path, '/') != 0) {
+				return -1;
+			}
+			++nameoff;
+		}
+
+		if (dstrcat(&watch->path, ie->name) != 0) {
+			return -1;
+		}
+
+		bool is_dir = ie->mask & IN_ISDIR;
+		if ((ie->mask & IN_CREATE) && !is_dir) {
+			// New regular files are reported once they're closed after
+			// writing, so they're only seen once, and with their contents
+			struct bfs_stat buf;
+			if (bfs_stat(AT_FDCWD, watch->path, BFS_STAT_NOFOLLOW, &buf) == 0 && S_ISREG(buf.mode)) {
+				continue;
+			}
+		}
+
+		event->path = watch->path;
+		event->nameoff = nameoff;
+		event->root = dir->root;
+		event->depth = dir->depth + 1;
+		event->type = is_dir ? BFS_DIR : BFS_UNKNOWN;
+		return 1;
+	}
+
+	return 0;
+}
+
+void bfs_watch_free(struct bfs_watch *watch) {
+	if (!watch) {
+		return;
+	}
+
+	for (size_t i = 0; i < watch->capacity; ++i) {
+		dstrfree(watch->dirs[i].path);
+	}
+	free(watch->dirs);
+
+	xclose(watch->fd);
+	dstrfree(watch->path);
+	free(watch);
+}
+
+#else // !BFS_HAS_INOTIFY
+
+struct bfs_watch *bfs_watch_new(void) {
+	errno = ENOTSUP;
+	return NULL;
+}
+
+int bfs_watch_add(struct bfs_watch *watch, const struct BFTW *ftwbuf) {
+	errno = ENOTSUP;
+	return -1;
+}
+
+int bfs_watch_wait(struct bfs_watch *watch, struct bfs_watch_event *event) {
+	errno = ENOTSUP;
+	return -1;
+}
+
+void bfs_watch_free(struct bfs_watch *watch) {
+}
+
+#endif // !BFS_HAS_INOTIFY
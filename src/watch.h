@@ -0,0 +1,78 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Watching directories for new files (-watch).
+ */
+
+#ifndef BFS_WATCH_H
+#define BFS_WATCH_H
+
+#include "dir.h"
+
+#include <stddef.h>
+
+struct BFTW;
+
+/**
+ * A set of watched directories.
+ */
+struct bfs_watch;
+
+/**
+ * A file that was created or modified in a watched directory.
+ */
+struct bfs_watch_event {
+	/** The path to the file. */
+	const char *path;
+	/** The string offset of the filename. */
+	size_t nameoff;
+	/** The root path the directory was found under. */
+	const char *root;
+	/** The depth of the file. */
+	size_t depth;
+	/** BFS_DIR for new directories, otherwise BFS_UNKNOWN. */
+	enum bfs_type type;
+};
+
+/**
+ * Create a new watcher.
+ *
+ * @return
+ *         The new watcher, or NULL on failure (ENOTSUP if the platform has no
+ *         supported notification mechanism).
+ */
+struct bfs_watch *bfs_watch_new(void);
+
+/**
+ * Start watching a directory.
+ *
+ * @param watch
+ *         The watcher.
+ * @param ftwbuf
+ *         The directory to watch.  The root path must outlive the watcher.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_watch_add(struct bfs_watch *watch, const struct BFTW *ftwbuf);
+
+/**
+ * Wait for the next new or modified file.
+ *
+ * @param watch
+ *         The watcher.
+ * @param[out] event
+ *         Filled in with the event, which is valid until the next call.
+ * @return
+ *         1 for an event, 0 if nothing is being watched any more, or -1 on
+ *         failure (EOVERFLOW if some events were lost, after which waiting
+ *         can continue).
+ */
+int bfs_watch_wait(struct bfs_watch *watch, struct bfs_watch_event *event);
+
+/**
+ * Stop watching everything and free a watcher.
+ */
+void bfs_watch_free(struct bfs_watch *watch);
+
+#endif // BFS_WATCH_H
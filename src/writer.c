@@ -0,0 +1,520 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "writer.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "bfstd.h"
+#include "diag.h"
+#include "list.h"
+#include "perf.h"
+#include "thread.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if BFS_WITH_ZLIB
+#  include <zlib.h>
+#endif
+
+/**
+ * The maximum number of bytes to queue before blocking.
+ */
+#define WRITER_MAX (8 << 20)
+
+/**
+ * The size of each compressed frame.
+ */
+#define WRITER_FRAME (1 << 20)
+
+/**
+ * A chunk of pending output.
+ */
+struct writer_chunk {
+	/** The next chunk in the queue. */
+	struct writer_chunk *next;
+	/** The size of this chunk. */
+	size_t len;
+	/** The compressed data, if any. */
+	char *out;
+	/** The size of the compressed data. */
+	size_t outlen;
+	/** Whether the chunk is ready to be written. */
+	bool ready;
+	/** The data to write. */
+	char data[];
+};
+
+struct bfs_writer {
+	/** The underlying stream. */
+	FILE *file;
+	/** The underlying file descriptor. */
+	int fd;
+	/** Whether to close the underlying stream. */
+	bool close;
+
+	/** Protects the fields below. */
+	pthread_mutex_t mutex;
+	/** Signalled when there is more work for the writer thread. */
+	pthread_cond_t work;
+	/** Signalled when pending writes complete. */
+	pthread_cond_t done;
+
+	/** The queue of pending chunks. */
+	struct {
+		struct writer_chunk *head;
+		struct writer_chunk **tail;
+	} queue;
+	/** The next chunk to compress. */
+	struct writer_chunk *claim;
+	/** The number of bytes queued or being written. */
+	size_t pending;
+	/** The first write error, if any. */
+	int error;
+	/** Whether the writer thread should exit. */
+	bool stop;
+
+	/** The writer thread. */
+	pthread_t thread;
+
+	/** The compression level. */
+	int level;
+	/** The compressor threads, if any. */
+	pthread_t *compressors;
+	/** The number of compressor threads. */
+	size_t ncompressors;
+	/** The frame being filled, owned by the thread writing to the stream. */
+	struct writer_chunk *frame;
+	/** Whether any frames have been queued. */
+	bool started;
+};
+
+#if BFS_USE_WRITER
+
+/** Writer thread entry point. */
+static void *writer_thread(void *ptr) {
+	struct bfs_writer *writer = ptr;
+
+	// Report a closed pipe as an EPIPE write error, rather than killing bfs
+	// from a background thread.  A SIGPIPE left pending on this thread is
+	// discarded when it exits.
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	bfs_perf_name("writer");
+
+	mutex_lock(&writer->mutex);
+	while (true) {
+		// Chunks are written in order, even if later ones finish compressing first
+		while (true) {
+			struct writer_chunk *head = SLIST_HEAD(&writer->queue);
+			if (head ? head->ready : writer->stop) {
+				break;
+			}
+			cond_wait(&writer->work, &writer->mutex);
+		}
+
+		struct writer_chunk *chunk = SLIST_POP(&writer->queue);
+		if (!chunk) {
+			break;
+		}
+
+		int error = writer->error;
+		mutex_unlock(&writer->mutex);
+
+		const char *data = chunk->data;
+		size_t len = chunk->len;
+		if (writer->ncompressors > 0) {
+			data = chunk->out;
+			len = chunk->outlen;
+		}
+
+		uint64_t start = bfs_trace_begin();
+		if (!error && xwrite(writer->fd, data, len) != len) {
+			error = errno ? errno : EIO;
+		}
+		bfs_trace_end("write", start);
+
+		mutex_lock(&writer->mutex);
+		if (!writer->error) {
+			writer->error = error;
+		}
+		writer->pending -= chunk->len;
+		cond_broadcast(&writer->done);
+		free(chunk->out);
+		free(chunk);
+	}
+	mutex_unlock(&writer->mutex);
+
+	return NULL;
+}
+
+#if BFS_WITH_ZLIB
+
+/** Compress a chunk into a complete gzip member. */
+static int writer_deflate(z_stream *strm, struct writer_chunk *chunk) {
+	if (deflateReset(strm) != Z_OK) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t size = deflateBound(strm, chunk->len);
+	chunk->out = malloc(size);
+	if (!chunk->out) {
+		return -1;
+	}
+
+	strm->next_in = (Bytef *)chunk->data;
+	strm->avail_in = chunk->len;
+	strm->next_out = (Bytef *)chunk->out;
+	strm->avail_out = size;
+	if (deflate(strm, Z_FINISH) != Z_STREAM_END) {
+		errno = EIO;
+		return -1;
+	}
+
+	chunk->outlen = size - strm->avail_out;
+	return 0;
+}
+
+/** Compressor thread entry point. */
+static void *writer_compressor(void *ptr) {
+	struct bfs_writer *writer = ptr;
+
+	bfs_perf_name("compress");
+
+	// windowBits + 16 writes a gzip header and trailer around each frame
+	int error = 0;
+	z_stream strm = {0};
+	if (deflateInit2(&strm, writer->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		error = ENOMEM;
+	}
+
+	mutex_lock(&writer->mutex);
+	while (true) {
+		while (!writer->claim && !writer->stop) {
+			cond_wait(&writer->work, &writer->mutex);
+		}
+
+		struct writer_chunk *chunk = writer->claim;
+		if (!chunk) {
+			break;
+		}
+		writer->claim = chunk->next;
+
+		if (!error) {
+			error = writer->error;
+		}
+		mutex_unlock(&writer->mutex);
+
+		uint64_t start = bfs_trace_begin();
+		if (!error && writer_deflate(&strm, chunk) != 0) {
+			error = errno;
+		}
+		bfs_trace_end("compress", start);
+
+		mutex_lock(&writer->mutex);
+		if (!writer->error) {
+			writer->error = error;
+		}
+		chunk->ready = true;
+		cond_broadcast(&writer->work);
+	}
+	mutex_unlock(&writer->mutex);
+
+	deflateEnd(&strm);
+	return NULL;
+}
+
+#endif // BFS_WITH_ZLIB
+
+/** Queue a chunk for the background threads. */
+static int writer_submit(struct bfs_writer *writer, struct writer_chunk *chunk) {
+	SLIST_ITEM_INIT(chunk);
+	chunk->out = NULL;
+	chunk->outlen = 0;
+	chunk->ready = writer->ncompressors == 0;
+
+	uint64_t start = bfs_trace_begin();
+	mutex_lock(&writer->mutex);
+	while (writer->pending > 0 && writer->pending + chunk->len > WRITER_MAX && !writer->error) {
+		cond_wait(&writer->done, &writer->mutex);
+	}
+
+	int error = writer->error;
+	if (!error) {
+		SLIST_APPEND(&writer->queue, chunk);
+		if (!chunk->ready && !writer->claim) {
+			writer->claim = chunk;
+		}
+		writer->pending += chunk->len;
+		cond_broadcast(&writer->work);
+	}
+	mutex_unlock(&writer->mutex);
+	bfs_trace_end("output flush", start);
+
+	if (error) {
+		free(chunk);
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Queue the current frame for compression. */
+static int writer_flush_frame(struct bfs_writer *writer) {
+	struct writer_chunk *frame = writer->frame;
+	if (!frame) {
+		return 0;
+	}
+
+	writer->frame = NULL;
+	writer->started = true;
+	return writer_submit(writer, frame);
+}
+
+/** Add some data to the current frame, queueing it when full. */
+static int writer_fill_frame(struct bfs_writer *writer, const char *buf, size_t size) {
+	while (size > 0) {
+		struct writer_chunk *frame = writer->frame;
+		if (!frame) {
+			frame = ALLOC_FLEX(struct writer_chunk, data, WRITER_FRAME);
+			if (!frame) {
+				return -1;
+			}
+			frame->len = 0;
+			writer->frame = frame;
+		}
+
+		size_t len = WRITER_FRAME - frame->len;
+		if (len > size) {
+			len = size;
+		}
+		memcpy(frame->data + frame->len, buf, len);
+		frame->len += len;
+		buf += len;
+		size -= len;
+
+		if (frame->len == WRITER_FRAME && writer_flush_frame(writer) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** fopencookie() write function. */
+static ssize_t writer_write(void *cookie, const char *buf, size_t size) {
+	struct bfs_writer *writer = cookie;
+
+	if (writer->ncompressors > 0) {
+		// Compressed output is batched into large frames, cut short only
+		// by an explicit bfs_writer_sync()
+		if (writer_fill_frame(writer, buf, size) != 0) {
+			return -1;
+		}
+		return size;
+	}
+
+	struct writer_chunk *chunk = ALLOC_FLEX(struct writer_chunk, data, size);
+	if (!chunk) {
+		return -1;
+	}
+	chunk->len = size;
+	memcpy(chunk->data, buf, size);
+
+	if (writer_submit(writer, chunk) != 0) {
+		return -1;
+	}
+
+	return size;
+}
+
+/** Stop the background threads, after they finish any pending writes. */
+static void writer_stop(struct bfs_writer *writer) {
+	mutex_lock(&writer->mutex);
+	writer->stop = true;
+	cond_broadcast(&writer->work);
+	mutex_unlock(&writer->mutex);
+
+	for (size_t i = 0; i < writer->ncompressors; ++i) {
+		thread_join(writer->compressors[i], NULL);
+	}
+	thread_join(writer->thread, NULL);
+}
+
+/** Destroy a writer. */
+static int writer_destroy(struct bfs_writer *writer) {
+	int ret = 0;
+	int error = 0;
+
+	if (writer->ncompressors > 0) {
+		if (!writer->frame && !writer->started) {
+			// An empty gzip file still needs one (empty) member
+			writer->frame = ALLOC_FLEX(struct writer_chunk, data, 0);
+			if (writer->frame) {
+				writer->frame->len = 0;
+			}
+		}
+
+		if (writer_flush_frame(writer) != 0) {
+			ret = -1;
+			error = errno;
+		}
+	}
+
+	writer_stop(writer);
+
+	if (writer->error) {
+		ret = -1;
+		error = writer->error;
+	}
+
+	if (writer->close && fclose(writer->file) != 0 && !error) {
+		ret = -1;
+		error = errno;
+	}
+
+	free(writer->compressors);
+	cond_destroy(&writer->done);
+	cond_destroy(&writer->work);
+	mutex_destroy(&writer->mutex);
+	free(writer);
+
+	errno = error;
+	return ret;
+}
+
+/** fopencookie() close function. */
+static int writer_close(void *cookie) {
+	return writer_destroy(cookie);
+}
+
+struct bfs_writer *bfs_writer_open(FILE *file, bool close, FILE **stream) {
+	struct bfs_writer *writer = ZALLOC(struct bfs_writer);
+	if (!writer) {
+		return NULL;
+	}
+
+	writer->file = file;
+	writer->fd = fileno(file);
+	writer->close = close;
+	SLIST_INIT(&writer->queue);
+
+	if (mutex_init(&writer->mutex, NULL) != 0) {
+		goto fail;
+	}
+	if (cond_init(&writer->work, NULL) != 0) {
+		goto fail_mutex;
+	}
+	if (cond_init(&writer->done, NULL) != 0) {
+		goto fail_work;
+	}
+
+	if (thread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+		goto fail_done;
+	}
+
+	cookie_io_functions_t funcs = {
+		.write = writer_write,
+		.close = writer_close,
+	};
+	*stream = fopencookie(writer, "w", funcs);
+	if (!*stream) {
+		goto fail_thread;
+	}
+
+	return writer;
+
+fail_thread:
+	writer_stop(writer);
+fail_done:
+	cond_destroy(&writer->done);
+fail_work:
+	cond_destroy(&writer->work);
+fail_mutex:
+	mutex_destroy(&writer->mutex);
+fail:
+	free(writer);
+	return NULL;
+}
+
+int bfs_writer_gzip(struct bfs_writer *writer, int level, size_t nthreads) {
+#if BFS_WITH_ZLIB
+	bfs_assert(writer->ncompressors == 0);
+
+	writer->compressors = ALLOC_ARRAY(pthread_t, nthreads);
+	if (!writer->compressors) {
+		return -1;
+	}
+
+	writer->level = level;
+
+	// The compressor threads are started before anything is written, so
+	// the writer thread can't yet be looking at ncompressors
+	for (size_t i = 0; i < nthreads; ++i) {
+		if (thread_create(&writer->compressors[i], NULL, writer_compressor, writer) != 0) {
+			break;
+		}
+		++writer->ncompressors;
+	}
+
+	if (writer->ncompressors == 0) {
+		free(writer->compressors);
+		writer->compressors = NULL;
+		return -1;
+	}
+
+	return 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+int bfs_writer_sync(struct bfs_writer *writer) {
+	if (writer_flush_frame(writer) != 0) {
+		return -1;
+	}
+
+	mutex_lock(&writer->mutex);
+	while (writer->pending > 0) {
+		cond_wait(&writer->done, &writer->mutex);
+	}
+	int error = writer->error;
+	mutex_unlock(&writer->mutex);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+#else // !BFS_USE_WRITER
+
+struct bfs_writer *bfs_writer_open(FILE *file, bool close, FILE **stream) {
+	errno = ENOTSUP;
+	return NULL;
+}
+
+int bfs_writer_gzip(struct bfs_writer *writer, int level, size_t nthreads) {
+	errno = ENOTSUP;
+	return -1;
+}
+
+int bfs_writer_sync(struct bfs_writer *writer) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,69 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Background writers for output streams.
+ */
+
+#ifndef BFS_WRITER_H
+#define BFS_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Whether background writers are supported.
+ */
+#ifndef BFS_USE_WRITER
+#  define BFS_USE_WRITER BFS_HAS_FOPENCOOKIE
+#endif
+
+/**
+ * A stream whose writes are performed by a background thread.
+ */
+struct bfs_writer;
+
+/**
+ * Create a background writer.
+ *
+ * @param file
+ *         The underlying stream.  Nothing should have been written to it yet.
+ * @param close
+ *         Whether the writer owns the underlying stream.
+ * @param[out] stream
+ *         Will hold a new stream that hands writes to the background thread.
+ *         Closing it waits for all pending writes, then closes the underlying
+ *         stream if the writer owns it.
+ * @return
+ *         The new writer, or NULL on failure.
+ */
+struct bfs_writer *bfs_writer_open(FILE *file, bool close, FILE **stream);
+
+/**
+ * Compress a writer's output with gzip.  Output is cut into frames that are
+ * compressed in parallel into separate gzip members, which gzip -d
+ * concatenates back together.
+ *
+ * @param writer
+ *         The writer to compress.  Nothing should have been written to it yet.
+ * @param level
+ *         The zlib compression level (Z_DEFAULT_COMPRESSION is -1).
+ * @param nthreads
+ *         The number of compressor threads.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_writer_gzip(struct bfs_writer *writer, int level, size_t nthreads);
+
+/**
+ * Wait for all pending writes to complete.  The stream should have been
+ * flushed first.  Any partial compressed frame is finished, so everything
+ * written so far can be decompressed.
+ *
+ * @return
+ *         0 on success, -1 if any write has failed.
+ */
+int bfs_writer_sync(struct bfs_writer *writer);
+
+#endif // BFS_WRITER_H
@@ -4,9 +4,11 @@
 #include "xregex.h"
 
 #include "alloc.h"
+#include "atomic.h"
 #include "bfs.h"
 #include "bfstd.h"
 #include "diag.h"
+#include "dstring.h"
 #include "sanity.h"
 #include "thread.h"
 
@@ -22,16 +24,61 @@
 #  include <regex.h>
 #endif
 
+#if !BFS_WITH_ONIGURUMA
+/**
+ * The number of copies of each POSIX regex.  regexec() may serialize matches
+ * against the same regex_t (glibc takes a lock for the whole match), so
+ * concurrent evaluator threads each get their own copy.
+ */
+#define REGEX_COPIES 8
+
+/** A copy of a compiled POSIX regex. */
+struct bfs_regex_copy {
+	/** Held while this copy is in use. */
+	pthread_mutex_t mutex;
+	/** Whether this copy has been compiled yet. */
+	bool compiled;
+	/** The compiled regex. */
+	regex_t impl;
+};
+#endif
+
 struct bfs_regex {
 #if BFS_WITH_ONIGURUMA
 	unsigned char *pattern;
 	OnigRegex impl;
-	int err;
+	atomic int err;
 	OnigErrorInfo einfo;
 #else
-	regex_t impl;
-	int err;
+	/** The pattern, for compiling more copies. */
+	char *pattern;
+	/** The regcomp() flags. */
+	int cflags;
+	/** The copies, compiled on demand (except the first). */
+	struct bfs_regex_copy copies[REGEX_COPIES];
+	/** The last error. */
+	atomic int err;
 #endif
+
+	/** A literal substring that every match must contain, if known. */
+	char *literal;
+	/** The length of the required literal. */
+	size_t literal_len;
+	/** Whether the literal is ASCII-folded, for case-insensitive regexes. */
+	bool literal_folded;
+	/** A literal prefix that every match must start with, if known. */
+	char *prefix;
+	/** The length of the required prefix. */
+	size_t prefix_len;
+
+	/** The regex syntax. */
+	enum bfs_regex_type type;
+	/** The compilation flags. */
+	enum bfs_regcomp_flags flags;
+	/** The original pattern, if it can be combined with others. */
+	char *source;
+	/** The number of patterns combined into this regex. */
+	size_t npatterns;
 };
 
 #if BFS_WITH_ONIGURUMA
@@ -152,12 +199,237 @@ static int bfs_onig_initialize(OnigEncoding *enc) {
 }
 #endif
 
+/** Check for characters that are literal in every regex syntax. */
+static bool regex_is_literal(char c) {
+	return (c >= 'a' && c <= 'z')
+		|| (c >= 'A' && c <= 'Z')
+		|| (c >= '0' && c <= '9')
+		|| (c && strchr(" !\"#%&',-/:;<=>@_~", c));
+}
+
+/** Check for characters that are literal when escaped in every regex syntax. */
+static bool regex_is_escapable(char c) {
+	return c && strchr(".*[]^$\\/", c);
+}
+
+/**
+ * Find the longest literal that every match of a regex must contain, and the
+ * literal prefix that every (anchored) match must start with.
+ *
+ * This is deliberately conservative, since it has to work for every regex
+ * syntax we support: anything that might be an alternation, a backreference,
+ * or some other extension just gives up.  Only runs of plain characters that
+ * are outside any group and not followed by a repetition operator count.
+ *
+ * @return
+ *         0 on success (even if no literal was found), -1 on failure.
+ */
+static int regex_find_literal(struct bfs_regex *regex, const char *pattern) {
+	size_t len = strlen(pattern);
+	char *buf = malloc(len + 1);
+	if (!buf) {
+		return -1;
+	}
+
+	// The current run of literal characters
+	size_t start = 0, end = 0;
+	// The longest run so far
+	size_t best_start = 0, best_len = 0;
+	// The length of the leading run, once it ends
+	size_t prefix_len = 0;
+	bool prefix_done = false;
+	// The group nesting depth
+	size_t depth = 0;
+
+	for (const char *p = pattern; *p; ++p) {
+		char c = *p;
+
+		if ((unsigned char)c >= 0x80) {
+			// Multi-byte characters are encoding-dependent
+			goto none;
+		} else if (c == '^' && p == pattern) {
+			// A leading anchor doesn't change the prefix
+			continue;
+		} else if (c == '*' || c == '+' || c == '?' || c == '{') {
+			// The preceding atom is optional, or repeated
+			if (end > start) {
+				--end;
+			}
+			if (c == '{') {
+				p = strchr(p, '}');
+				if (!p) {
+					goto none;
+				}
+			}
+		} else if (c == '|') {
+			if (depth == 0) {
+				goto none;
+			}
+		} else if (c == '[') {
+			// Skip the bracket expression
+			++p;
+			if (*p == '^') {
+				++p;
+			}
+			if (*p == ']') {
+				++p;
+			}
+			for (; *p != ']'; ++p) {
+				if (!*p || *p == '\\') {
+					goto none;
+				} else if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+					const char delim[] = {p[1], ']', '\0'};
+					p = strstr(p + 2, delim);
+					if (!p) {
+						goto none;
+					}
+					++p;
+				}
+			}
+		} else if (c == '\\') {
+			++p;
+			if (!regex_is_escapable(*p)) {
+				goto none;
+			}
+			if (depth == 0) {
+				buf[end++] = *p;
+				continue;
+			}
+		} else if (regex_is_literal(c)) {
+			if (depth == 0) {
+				buf[end++] = c;
+				continue;
+			}
+		} else if (c == '(') {
+			if (p[1] == '?') {
+				// Possibly an inline option like (?i)
+				goto none;
+			}
+			++depth;
+		} else if (c == ')') {
+			if (depth > 0) {
+				--depth;
+			}
+		}
+
+		// Anything else ends the current run
+		if (!prefix_done) {
+			prefix_len = end;
+			prefix_done = true;
+		}
+		if (end - start > best_len) {
+			best_start = start;
+			best_len = end - start;
+		}
+		start = end;
+	}
+
+	if (depth != 0) {
+		goto none;
+	}
+
+	if (end - start > best_len) {
+		best_start = start;
+		best_len = end - start;
+	}
+
+	if (!prefix_done) {
+		prefix_len = end;
+	}
+
+	if (best_len == 0) {
+		goto none;
+	}
+
+	if (prefix_len > 0) {
+		regex->prefix = strndup(buf, prefix_len);
+		if (!regex->prefix) {
+			free(buf);
+			return -1;
+		}
+		regex->prefix_len = prefix_len;
+	}
+
+	memmove(buf, buf + best_start, best_len);
+	buf[best_len] = '\0';
+	regex->literal = buf;
+	regex->literal_len = best_len;
+	return 0;
+
+none:
+	free(buf);
+	return 0;
+}
+
+#if !BFS_WITH_ONIGURUMA
+/**
+ * Check whether an extended regex can be parenthesized and joined to others
+ * with |, without changing what it matches.
+ */
+static bool regex_is_unionable(const char *pattern) {
+	// A leading repetition operator is literal, but wouldn't be after (
+	if (pattern[0] && strchr("*+?{", pattern[0])) {
+		return false;
+	}
+
+	size_t depth = 0;
+	for (const char *p = pattern; *p; ++p) {
+		if (*p == '\\') {
+			++p;
+			// Backreferences are numbered across the whole regex
+			if (!*p || (*p >= '0' && *p <= '9')) {
+				return false;
+			}
+		} else if (*p == '[') {
+			++p;
+			if (*p == '^') {
+				++p;
+			}
+			if (*p == ']') {
+				++p;
+			}
+			for (; *p != ']'; ++p) {
+				if (!*p) {
+					return false;
+				} else if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+					const char delim[] = {p[1], ']', '\0'};
+					p = strstr(p + 2, delim);
+					if (!p) {
+						return false;
+					}
+					++p;
+				}
+			}
+		} else if (*p == '(') {
+			++depth;
+		} else if (*p == ')') {
+			if (depth == 0) {
+				return false;
+			}
+			--depth;
+		}
+	}
+
+	return depth == 0;
+}
+#endif
+
 int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_type type, enum bfs_regcomp_flags flags) {
 	struct bfs_regex *regex = *preg = ALLOC(struct bfs_regex);
 	if (!regex) {
 		return -1;
 	}
 
+	regex->literal = NULL;
+	regex->literal_len = 0;
+	regex->literal_folded = false;
+	regex->prefix = NULL;
+	regex->prefix_len = 0;
+	regex->type = type;
+	regex->flags = flags;
+	regex->source = NULL;
+	regex->npatterns = 1;
+
 #if BFS_WITH_ONIGURUMA
 	// onig_error_code_to_str() says
 	//
@@ -234,14 +506,64 @@ int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_typ
 		cflags |= REG_ICASE;
 	}
 
-	regex->err = regcomp(&regex->impl, pattern, cflags);
+	regex->pattern = strdup(pattern);
+	if (!regex->pattern) {
+		goto fail;
+	}
+	regex->cflags = cflags;
+
+	for (size_t i = 0; i < REGEX_COPIES; ++i) {
+		struct bfs_regex_copy *copy = &regex->copies[i];
+		if (mutex_init(&copy->mutex, NULL) != 0) {
+			while (i-- > 0) {
+				mutex_destroy(&regex->copies[i].mutex);
+			}
+			free(regex->pattern);
+			goto fail;
+		}
+		copy->compiled = false;
+	}
+
+	// The first copy is always compiled, so errors are reported up front
+	struct bfs_regex_copy *first = &regex->copies[0];
+	first->compiled = true;
+	regex->err = regcomp(&first->impl, pattern, cflags);
 	if (regex->err != 0) {
 		// https://github.com/google/sanitizers/issues/1496
-		sanitize_init(&regex->impl);
+		sanitize_init(&first->impl);
 		return -1;
 	}
+
+	// Oniguruma's anchored matches are leftmost-first rather than leftmost-
+	// longest, so joining alternatives is only safe for POSIX regexes
+	if (type == BFS_REGEX_POSIX_EXTENDED && regex_is_unionable(pattern)) {
+		regex->source = strdup(pattern);
+		if (!regex->source) {
+			return -1;
+		}
+	}
 #endif
 
+	if (!(flags & BFS_REGEX_ICASE)) {
+		if (regex_find_literal(regex, pattern) != 0) {
+			return -1;
+		}
+	} else if (ascii_casefold_safe()) {
+		if (regex_find_literal(regex, pattern) != 0) {
+			return -1;
+		}
+
+		// Anchored prefixes are compared case-sensitively
+		free(regex->prefix);
+		regex->prefix = NULL;
+		regex->prefix_len = 0;
+
+		for (size_t i = 0; i < regex->literal_len; ++i) {
+			regex->literal[i] = ascii_tolower(regex->literal[i]);
+		}
+		regex->literal_folded = true;
+	}
+
 	return 0;
 
 fail:
@@ -250,9 +572,36 @@ fail:
 	return -1;
 }
 
+/** Search for an ASCII-folded literal in an ASCII string, ignoring case. */
+static bool regex_find_folded(const char *str, size_t len, const char *literal, size_t literal_len) {
+	for (size_t i = 0; i + literal_len <= len; ++i) {
+		size_t j = 0;
+		while (j < literal_len && ascii_tolower(str[i + j]) == literal[j]) {
+			++j;
+		}
+		if (j == literal_len) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags flags) {
 	size_t len = strlen(str);
 
+	if (regex->literal && !regex->literal_folded) {
+		if (!memmem(str, len, regex->literal, regex->literal_len)) {
+			return 0;
+		}
+	} else if (regex->literal && asciinlen(str, len) == len) {
+		// Non-ASCII characters may fold to ASCII ones (e.g. U+212A KELVIN
+		// SIGN), so only pre-filter pure-ASCII strings
+		if (!regex_find_folded(str, len, regex->literal, regex->literal_len)) {
+			return 0;
+		}
+	}
+
 #if BFS_WITH_ONIGURUMA
 	const unsigned char *ustr = (const unsigned char *)str;
 	const unsigned char *end = ustr + len;
@@ -280,10 +629,34 @@ int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags
 	} else if (ret == ONIG_MISMATCH) {
 		return 0;
 	} else {
-		regex->err = ret;
+		store(&regex->err, ret, relaxed);
 		return -1;
 	}
 #else
+	// Use the first copy that isn't busy, or wait for the first one
+	struct bfs_regex_copy *copy = NULL;
+	for (size_t i = 0; i < REGEX_COPIES; ++i) {
+		struct bfs_regex_copy *next = &regex->copies[i];
+		if (!mutex_trylock(&next->mutex)) {
+			continue;
+		}
+
+		if (!next->compiled) {
+			next->compiled = regcomp(&next->impl, regex->pattern, regex->cflags) == 0;
+		}
+		if (next->compiled) {
+			copy = next;
+			break;
+		}
+
+		mutex_unlock(&next->mutex);
+	}
+
+	if (!copy) {
+		copy = &regex->copies[0];
+		mutex_lock(&copy->mutex);
+	}
+
 	regmatch_t match = {
 		.rm_so = 0,
 		.rm_eo = len,
@@ -294,7 +667,9 @@ int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags
 	eflags |= REG_STARTEND;
 #endif
 
-	int ret = regexec(&regex->impl, str, 1, &match, eflags);
+	int ret = regexec(&copy->impl, str, 1, &match, eflags);
+	mutex_unlock(&copy->mutex);
+
 	if (ret == 0) {
 		if (flags & BFS_REGEX_ANCHOR) {
 			return match.rm_so == 0 && (size_t)match.rm_eo == len;
@@ -304,20 +679,81 @@ int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags
 	} else if (ret == REG_NOMATCH) {
 		return 0;
 	} else {
-		regex->err = ret;
+		store(&regex->err, ret, relaxed);
 		return -1;
 	}
 #endif
 }
 
+bool bfs_regex_equal(const struct bfs_regex *a, const struct bfs_regex *b) {
+	return a->type == b->type
+		&& a->flags == b->flags
+		&& strcmp((const char *)a->pattern, (const char *)b->pattern) == 0;
+}
+
+bool bfs_regex_unionable(const struct bfs_regex *a, const struct bfs_regex *b) {
+	return a->source && b->source && a->type == b->type && a->flags == b->flags;
+}
+
+int bfs_regunion(struct bfs_regex **preg, struct bfs_regex *const regexes[], size_t n) {
+	*preg = NULL;
+
+	dchar *pattern = dstralloc(0);
+	if (!pattern) {
+		return -1;
+	}
+
+	int ret = -1;
+	size_t npatterns = 0;
+	for (size_t i = 0; i < n; ++i) {
+		bfs_assert(bfs_regex_unionable(regexes[0], regexes[i]));
+		if (dstrcatf(&pattern, "%s(%s)", i > 0 ? "|" : "", regexes[i]->source) != 0) {
+			goto done;
+		}
+		npatterns += regexes[i]->npatterns;
+	}
+
+	ret = bfs_regcomp(preg, pattern, regexes[0]->type, regexes[0]->flags);
+	if (ret == 0) {
+		(*preg)->npatterns = npatterns;
+	}
+
+done:
+	dstrfree(pattern);
+	return ret;
+}
+
+size_t bfs_regex_patterns(const struct bfs_regex *regex) {
+	return regex->npatterns;
+}
+
+size_t bfs_regex_literal(const struct bfs_regex *regex) {
+	return regex->literal_len;
+}
+
+size_t bfs_regex_prefix(const struct bfs_regex *regex, const char **prefix) {
+	*prefix = regex->prefix;
+	return regex->prefix_len;
+}
+
 void bfs_regfree(struct bfs_regex *regex) {
 	if (regex) {
 #if BFS_WITH_ONIGURUMA
 		onig_free(regex->impl);
 		free(regex->pattern);
 #else
-		regfree(&regex->impl);
+		for (size_t i = 0; i < REGEX_COPIES; ++i) {
+			struct bfs_regex_copy *copy = &regex->copies[i];
+			if (copy->compiled) {
+				regfree(&copy->impl);
+			}
+			mutex_destroy(&copy->mutex);
+		}
+		free(regex->pattern);
 #endif
+		free(regex->source);
+		free(regex->prefix);
+		free(regex->literal);
 		free(regex);
 	}
 }
@@ -330,14 +766,16 @@ char *bfs_regerror(const struct bfs_regex *regex) {
 #if BFS_WITH_ONIGURUMA
 	unsigned char *str = malloc(ONIG_MAX_ERROR_MESSAGE_LEN);
 	if (str) {
-		onig_error_code_to_str(str, regex->err, &regex->einfo);
+		onig_error_code_to_str(str, load(&regex->err, relaxed), &regex->einfo);
 	}
 	return (char *)str;
 #else
-	size_t len = regerror(regex->err, &regex->impl, NULL, 0);
+	int err = load(&regex->err, relaxed);
+	const regex_t *impl = &regex->copies[0].impl;
+	size_t len = regerror(err, impl, NULL, 0);
 	char *str = malloc(len);
 	if (str) {
-		regerror(regex->err, &regex->impl, str, len);
+		regerror(err, impl, str, len);
 	}
 	return str;
 #endif
@@ -4,6 +4,8 @@
 #ifndef BFS_XREGEX_H
 #define BFS_XREGEX_H
 
+#include <stddef.h>
+
 /**
  * A compiled regular expression.
  */
@@ -69,6 +71,59 @@ int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_typ
  */
 int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags flags);
 
+/**
+ * Get the length of the literal that any match must contain, if known.
+ *
+ * @param regex
+ *         The compiled regex.
+ * @return
+ *         The length of the required literal, or 0 if none was found.
+ */
+size_t bfs_regex_literal(const struct bfs_regex *regex);
+
+/**
+ * Get the literal prefix that any anchored match must start with, if known.
+ *
+ * @param regex
+ *         The compiled regex.
+ * @param[out] prefix
+ *         Will hold the prefix (not necessarily NUL-terminated).
+ * @return
+ *         The length of the required prefix, or 0 if none was found.
+ */
+size_t bfs_regex_prefix(const struct bfs_regex *regex, const char **prefix);
+
+/**
+ * Check whether two regexes were compiled from the same pattern, syntax, and
+ * flags.
+ */
+bool bfs_regex_equal(const struct bfs_regex *a, const struct bfs_regex *b);
+
+/**
+ * Check whether two regexes can be combined with bfs_regunion().
+ */
+bool bfs_regex_unionable(const struct bfs_regex *a, const struct bfs_regex *b);
+
+/**
+ * Combine several regexes into one that matches (anchored) wherever any of
+ * them would, so they can all be checked in a single scan.
+ *
+ * @param[out] preg
+ *         Will hold the combined regex.
+ * @param regexes
+ *         The regexes to combine, which must all be bfs_regex_unionable().
+ * @param n
+ *         The number of regexes.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_regunion(struct bfs_regex **preg, struct bfs_regex *const regexes[], size_t n);
+
+/**
+ * Get the number of patterns combined into a regex.
+ */
+size_t bfs_regex_patterns(const struct bfs_regex *regex);
+
 /**
  * Free a compiled regex.
  */
@@ -533,16 +533,61 @@ static bool bfs_use_posix_spawn(const struct bfs_resolver *res, const struct bfs
 
 #endif // BFS_POSIX_SPAWN >= 0
 
+/**
+ * Whether to spawn with clone(CLONE_VM | CLONE_VFORK) when posix_spawn() can't
+ * be used, to avoid copying the page tables like fork() does.
+ */
+#ifndef BFS_USE_CLONE_VFORK
+// The child's stack would grow the wrong way on PA-RISC
+#  if __linux__ && !defined(__hppa__)
+#    define BFS_USE_CLONE_VFORK true
+#  else
+#    define BFS_USE_CLONE_VFORK false
+#  endif
+#endif
+
+/**
+ * Whether to spawn with vfork() when posix_spawn() can't be used.
+ */
+#ifndef BFS_USE_VFORK
+#  define BFS_USE_VFORK (__DragonFly__ || __FreeBSD__ || __NetBSD__ || __OpenBSD__)
+#endif
+
+#if BFS_USE_CLONE_VFORK
+#  include <sched.h>
+#endif
+
+/**
+ * State shared between the parent and the child.
+ */
+struct bfs_spawn_child {
+	struct bfs_resolver *res;
+	const struct bfs_spawn *ctx;
+	char **argv;
+	char **envp;
+	/** The signal mask to restore before exec(). */
+	const sigset_t *mask;
+	/** The error-reporting pipe, for fork(). */
+	int pipefd[2];
+	/** The error from the child, for vfork() (which shares our memory). */
+	int error;
+};
+
 /** Actually exec() the new process. */
 _noreturn
-static void bfs_spawn_exec(struct bfs_resolver *res, const struct bfs_spawn *ctx, char **argv, char **envp, int pipefd[2]) {
-	xclose(pipefd[0]);
+static void bfs_spawn_exec(struct bfs_spawn_child *child) {
+	const struct bfs_spawn *ctx = child->ctx;
+	int *pipefd = child->pipefd;
+
+	if (pipefd[0] >= 0) {
+		xclose(pipefd[0]);
+	}
 
 	for_slist (const struct bfs_spawn_action, action, ctx) {
 		int fd;
 
 		// Move the error-reporting pipe out of the way if necessary...
-		if (action->out_fd == pipefd[1]) {
+		if (pipefd[1] >= 0 && action->out_fd == pipefd[1]) {
 			fd = dup_cloexec(pipefd[1]);
 			if (fd < 0) {
 				goto fail;
@@ -552,7 +597,7 @@ static void bfs_spawn_exec(struct bfs_resolver *res, const struct bfs_spawn *ctx
 		}
 
 		// ... and pretend the pipe doesn't exist
-		if (action->in_fd == pipefd[1]) {
+		if (pipefd[1] >= 0 && action->in_fd == pipefd[1]) {
 			errno = EBADF;
 			goto fail;
 		}
@@ -592,50 +637,127 @@ static void bfs_spawn_exec(struct bfs_resolver *res, const struct bfs_spawn *ctx
 		}
 	}
 
-	if (bfs_resolve_late(res) != 0) {
+	if (bfs_resolve_late(child->res) != 0) {
 		goto fail;
 	}
 
-	execve(res->exe, argv, envp);
+	// Our signal handlers must not run in the child, especially if it
+	// shares our memory, so reset them before unblocking signals
+	for (int sig = 1; sig < NSIG; ++sig) {
+		struct sigaction sa;
+		if (sigaction(sig, NULL, &sa) != 0) {
+			continue;
+		}
+
+		if (sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+			sa.sa_handler = SIG_DFL;
+			sa.sa_flags = 0;
+			sigaction(sig, &sa, NULL);
+		}
+	}
+
+	errno = pthread_sigmask(SIG_SETMASK, child->mask, NULL);
+	if (errno != 0) {
+		goto fail;
+	}
+
+	execve(child->res->exe, child->argv, child->envp);
 
 fail:;
 	int error = errno;
 
-	// In case of a write error, the parent will still see that we exited
-	// unsuccessfully, but won't know why
-	(void)xwrite(pipefd[1], &error, sizeof(error));
+	if (pipefd[1] >= 0) {
+		// In case of a write error, the parent will still see that we
+		// exited unsuccessfully, but won't know why
+		(void)xwrite(pipefd[1], &error, sizeof(error));
+		xclose(pipefd[1]);
+	} else {
+		child->error = error;
+	}
 
-	xclose(pipefd[1]);
 	_Exit(127);
 }
 
-/** bfs_spawn() implementation using fork()/exec(). */
-static pid_t bfs_fork_spawn(struct bfs_resolver *res, const struct bfs_spawn *ctx, char **argv, char **envp) {
-	// Use a pipe to report errors from the child
-	int pipefd[2];
-	if (pipe_cloexec(pipefd) != 0) {
-		return -1;
+#if BFS_USE_CLONE_VFORK
+
+/** clone() entry point. */
+static int bfs_clone_child(void *ptr) {
+	bfs_spawn_exec(ptr);
+}
+
+#endif
+
+/** Spawn the child with clone()/vfork(), if supported. */
+static pid_t bfs_vfork(struct bfs_spawn_child *child) {
+#if BFS_USE_CLONE_VFORK
+	// The parent is suspended until the child calls exec() or exits, so
+	// the child can safely run on a stack borrowed from our frame
+	alignas(max_align_t) char stack[16 << 10];
+	return clone(bfs_clone_child, stack + sizeof(stack), CLONE_VM | CLONE_VFORK | SIGCHLD, child);
+#elif BFS_USE_VFORK
+	pid_t pid = vfork();
+	if (pid == 0) {
+		bfs_spawn_exec(child);
 	}
+	return pid;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
 
+/**
+ * bfs_spawn() implementation using vfork()/exec() (or clone(CLONE_VFORK) on
+ * Linux), falling back to fork()/exec().
+ */
+static pid_t bfs_fork_spawn(struct bfs_resolver *res, const struct bfs_spawn *ctx, char **argv, char **envp) {
 	// Block signals before fork() so handlers don't run in the child
 	sigset_t new_mask;
 	if (sigfillset(&new_mask) != 0) {
-		goto fail;
+		return -1;
 	}
 	sigset_t old_mask;
 	errno = pthread_sigmask(SIG_BLOCK, &new_mask, &old_mask);
 	if (errno != 0) {
+		return -1;
+	}
+
+	struct bfs_spawn_child child = {
+		.res = res,
+		.ctx = ctx,
+		.argv = argv,
+		.envp = envp,
+		.mask = &old_mask,
+		.pipefd = {-1, -1},
+	};
+
+	pid_t pid = bfs_vfork(&child);
+	if (pid >= 0) {
+		errno = pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+		bfs_everify(errno == 0, "pthread_sigmask()");
+
+		if (child.error != 0) {
+			xwaitpid(pid, NULL, 0);
+			errno = child.error;
+			return -1;
+		}
+
+		return pid;
+	}
+
+	// Use a pipe to report errors from the child
+	if (pipe_cloexec(child.pipefd) != 0) {
 		goto fail;
 	}
 
 #if BFS_HAS__FORK
-	pid_t pid = _Fork();
+	pid = _Fork();
 #else
-	pid_t pid = fork();
+	pid = fork();
 #endif
 	if (pid == 0) {
 		// Child
-		bfs_spawn_exec(res, ctx, argv, envp, pipefd);
+		bfs_spawn_exec(&child);
 	}
 
 	// Restore the original signal mask
@@ -644,14 +766,14 @@ static pid_t bfs_fork_spawn(struct bfs_resolver *res, const struct bfs_spawn *ct
 
 	if (pid < 0) {
 		// fork() failed
-		goto fail;
+		goto fail_pipe;
 	}
 
-	xclose(pipefd[1]);
+	xclose(child.pipefd[1]);
 
 	int error;
-	ssize_t nbytes = xread(pipefd[0], &error, sizeof(error));
-	xclose(pipefd[0]);
+	ssize_t nbytes = xread(child.pipefd[0], &error, sizeof(error));
+	xclose(child.pipefd[0]);
 	if (nbytes == sizeof(error)) {
 		xwaitpid(pid, NULL, 0);
 		errno = error;
@@ -660,9 +782,16 @@ static pid_t bfs_fork_spawn(struct bfs_resolver *res, const struct bfs_spawn *ct
 
 	return pid;
 
-fail:
-	close_quietly(pipefd[1]);
-	close_quietly(pipefd[0]);
+fail:;
+	int fail_error = errno;
+	errno = pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	bfs_everify(errno == 0, "pthread_sigmask()");
+	errno = fail_error;
+	return -1;
+
+fail_pipe:
+	close_quietly(child.pipefd[1]);
+	close_quietly(child.pipefd[0]);
 	return -1;
 }
 
@@ -5,10 +5,78 @@
 
 #include "alloc.h"
 #include "diag.h"
+#include "thread.h"
 
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+
+/** A thread that frees chunks allocated by another thread. */
+struct cache_worker {
+	/** The shared pool. */
+	struct arena_pool *pool;
+	/** The chunks to free. */
+	void **chunks;
+	/** The number of chunks. */
+	size_t count;
+};
+
+static void *cache_worker(void *ptr) {
+	struct cache_worker *worker = ptr;
+
+	struct arena_cache cache;
+	arena_cache_init(&cache, worker->pool);
+
+	for (size_t i = 0; i < worker->count; ++i) {
+		arena_cache_free(&cache, worker->chunks[i]);
+	}
+
+	// Churn through some chunks of our own, too
+	for (size_t i = 0; i < worker->count; ++i) {
+		worker->chunks[i] = arena_cache_alloc(&cache);
+		bfs_verify(worker->chunks[i]);
+		memset(worker->chunks[i], 0xAA, sizeof(int[4]));
+	}
+	for (size_t i = 0; i < worker->count; ++i) {
+		arena_cache_free(&cache, worker->chunks[i]);
+	}
+
+	arena_cache_destroy(&cache);
+	return NULL;
+}
+
+/** Check that arena caches can free each other's chunks. */
+static void check_arena_cache(void) {
+	struct arena_pool pool;
+	bfs_verify(ARENA_POOL_INIT(&pool, int[4]) == 0);
+
+	struct arena_cache cache;
+	arena_cache_init(&cache, &pool);
+
+	enum { NTHREADS = 4, PER_THREAD = 1000 };
+	static void *chunks[NTHREADS * PER_THREAD];
+	for (size_t i = 0; i < countof(chunks); ++i) {
+		chunks[i] = arena_cache_alloc(&cache);
+		bfs_verify(chunks[i]);
+	}
+
+	pthread_t threads[NTHREADS];
+	struct cache_worker workers[NTHREADS];
+	for (size_t i = 0; i < NTHREADS; ++i) {
+		workers[i].pool = &pool;
+		workers[i].chunks = chunks + i * PER_THREAD;
+		workers[i].count = PER_THREAD;
+		bfs_verify(thread_create(&threads[i], NULL, cache_worker, &workers[i]) == 0);
+	}
+	for (size_t i = 0; i < NTHREADS; ++i) {
+		thread_join(threads[i], NULL);
+	}
+
+	arena_cache_destroy(&cache);
+	bfs_check(pool.arena.live == 0);
+	arena_pool_destroy(&pool);
+}
 
 void check_alloc(void) {
 	// Check sizeof_flex()
@@ -47,4 +115,31 @@ void check_alloc(void) {
 	}
 
 	varena_destroy(&varena);
+
+	// Trimmed chunks can be reused
+	struct arena arena;
+	arena_init(&arena, 64, 64 << 10, "check_alloc");
+
+	void *chunks[16];
+	for (size_t i = 0; i < countof(chunks); ++i) {
+		chunks[i] = arena_alloc(&arena);
+		bfs_verify(chunks[i]);
+		memset(chunks[i], 0xFF, 64 << 10);
+	}
+	for (size_t i = 0; i < countof(chunks); ++i) {
+		arena_free(&arena, chunks[i]);
+	}
+
+	size_t nslabs = arena.nslabs;
+	arena_trim(&arena, 4);
+	for (size_t i = 0; i < countof(chunks); ++i) {
+		void *chunk = arena_alloc(&arena);
+		bfs_check(chunk);
+		memset(chunk, 0, 64 << 10);
+	}
+	bfs_check(arena.nslabs == nslabs);
+
+	arena_destroy(&arena);
+
+	check_arena_cache();
 }
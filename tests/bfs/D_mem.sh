@@ -0,0 +1,2 @@
+stderr=$(invoke_bfs basic -D mem 2>&1 >"$OUT")
+[[ "$stderr" == *"struct bftw_file"* ]] || fail
@@ -0,0 +1,2 @@
+stderr=$(invoke_bfs basic -D perf 2>&1 >"$OUT")
+[[ "$stderr" == *"getdents"* ]] || fail
@@ -0,0 +1,12 @@
+cd "$TEST"
+
+"$XTOUCH" -p dir/file sub/file
+mkdir farm sub/farm
+for i in 1 2 3; do
+    ln -s "$PWD/dir" "farm/abs$i"
+    ln -s ../dir/file "farm/rel$i"
+    ln -s ../file "sub/farm/rel$i"
+    ln -s missing "farm/broken$i"
+done
+
+bfs_diff -L farm sub/farm -printf '%p %y %Y\n'
@@ -0,0 +1 @@
+bfs_diff -O3 basic \( -name '*f*' -type f \) -o \( -name '*f*' -type d \) -o \( -not -name '*f*' -type l \)
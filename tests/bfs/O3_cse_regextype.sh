@@ -0,0 +1,2 @@
+# -regextype changes the meaning of the same -regex argument
+bfs_diff -O3 basic -regextype posix-extended -regex '.*/\(a\)' -o -regextype posix-basic -regex '.*/\(a\)'
@@ -0,0 +1 @@
+bfs_diff -O4 basic -path 'basic/k/*' -o -ipath 'BASIC/E/*' -o -regex 'basic/l/foo/.*'
@@ -0,0 +1 @@
+bfs_diff -O4 -S dfs -depth basic -path 'basic/l/*'
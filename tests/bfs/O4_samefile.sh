@@ -0,0 +1 @@
+bfs_diff -O4 links -samefile links/file
@@ -0,0 +1 @@
+bfs_diff -S best basic
@@ -0,0 +1,5 @@
+cd "$TEST"
+"$XTOUCH" -p a/libfoo.so libs/foo/libfoo.so b/libfoo.so
+
+# Directories named like the pattern are searched first
+bfs_diff -S best . -name libfoo.so -print -quit
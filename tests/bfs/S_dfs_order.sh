@@ -0,0 +1,4 @@
+# Sorted parallel depth-first search visits files in the same order as a serial one
+invoke_bfs -j1 -S dfs -s basic deep >"$TEST/serial"
+invoke_bfs -j4 -S dfs -s basic deep >"$TEST/parallel"
+cmp -s "$TEST/serial" "$TEST/parallel"
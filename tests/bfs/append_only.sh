@@ -0,0 +1,11 @@
+# Files in directories that haven't been modified since the cutoff are skipped
+cd "$TEST"
+
+now=$(epoch_time)
+
+"$XTOUCH" -p old/sub/new old/file old/cheat new/file
+"$XTOUCH" -mt "@$((now - 60 * 60 * 2))" old/file
+"$XTOUCH" -mt "@$((now - 60 * 60 * 2))" old
+
+# old/cheat was modified without touching old, breaking the assertion
+bfs_diff . -append-only -mmin -60
@@ -0,0 +1,10 @@
+# Skipping files in stale directories would change what this does
+cd "$TEST"
+
+now=$(epoch_time)
+
+"$XTOUCH" -p old/file
+"$XTOUCH" -mt "@$((now - 60 * 60 * 2))" old/file
+"$XTOUCH" -mt "@$((now - 60 * 60 * 2))" old
+
+bfs_diff . -append-only -mmin -60 -o -print
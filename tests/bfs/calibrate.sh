@@ -0,0 +1,4 @@
+invoke_bfs basic -calibrate "$TEST/costs" -false
+grep -q '^fnmatch ' "$TEST/costs" || fail
+
+bfs_diff basic -load-costs "$TEST/costs" -name '*a*' -type f
@@ -0,0 +1,6 @@
+# Stop partway through, then resume from the last checkpoint
+mkdir -p "$TEST"
+invoke_bfs basic | sort >"$TEST/all"
+invoke_bfs -S bfs basic -checkpoint "$TEST/ck" -checkpoint-interval 0 -print -path basic/k -quit >"$TEST/out"
+invoke_bfs -S bfs -resume "$TEST/ck" >>"$TEST/out"
+sort -u "$TEST/out" | cmp -s - "$TEST/all"
@@ -0,0 +1 @@
+! invoke_bfs basic -checkpoint "$TEST/ck" -depth
@@ -0,0 +1,4 @@
+# A finished search leaves nothing to resume
+mkdir -p "$TEST"
+invoke_bfs -S bfs basic -checkpoint "$TEST/ck" >/dev/null
+bfs_diff -S bfs -resume "$TEST/ck"
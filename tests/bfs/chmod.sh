@@ -0,0 +1,6 @@
+cd "$TEST"
+"$XTOUCH" -p -M644 foo/bar foo/baz/qux
+chmod 755 foo foo/baz
+
+invoke_bfs . -type f -chmod 600
+bfs_diff . -printf '%m %p\n'
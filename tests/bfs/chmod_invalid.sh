@@ -0,0 +1 @@
+! invoke_bfs basic -chmod u+q
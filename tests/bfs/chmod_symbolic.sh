@@ -0,0 +1,8 @@
+cd "$TEST"
+"$XTOUCH" -p -M644 foo/bar foo/baz/qux
+"$XTOUCH" -p -M744 foo/exe
+chmod 700 foo foo/baz
+
+# Symbolic modes apply to the current mode, with X only for directories and executables
+invoke_bfs . -mindepth 1 -chmod go+rX,u-w
+bfs_diff . -printf '%m %p\n'
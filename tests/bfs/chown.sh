@@ -0,0 +1,5 @@
+cd "$TEST"
+"$XTOUCH" -p foo/bar foo/baz/qux
+
+# Changing to the current owner is a no-op, but still matches
+bfs_diff . -chown "$(id -u):$(id -g)" -print
@@ -0,0 +1 @@
+! invoke_bfs basic -chown :
@@ -0,0 +1,11 @@
+# Many broken links into the same missing directories
+cd "$TEST"
+"$XTOUCH" -p file dir/
+ln -s gone/a/x link1
+ln -s gone/a/y link2
+ln -s gone/b link3
+ln -s dir/gone/x link4
+ln -s file/x link5
+ln -s dir link6
+
+LS_COLORS="or=01;31:mi=01;33:" bfs_diff . -color -type l -printf '%p -> %l\n'
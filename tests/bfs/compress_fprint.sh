@@ -0,0 +1,11 @@
+invoke_bfs -quit -compress gzip >/dev/null || skip
+command -v gzip &>/dev/null || skip
+
+# bfs flushes its outputs before each -exec, which must cut a complete gzip
+# member, so the command can already decompress the path printed just before it
+invoke_bfs basic -compress gzip:1 -fprint "$OUT.gz" \
+    -exec sh -c 'gzip -dc "$1" | tail -n1 >>"$2"' sh "$OUT.gz" "$TEST/last" \; >/dev/null || fail
+gzip -dc "$OUT.gz" >"$OUT"
+diff "$OUT" "$TEST/last" >&$DUPERR || fail
+sort_output
+diff_output
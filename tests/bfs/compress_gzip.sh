@@ -0,0 +1,6 @@
+invoke_bfs -quit -compress gzip >/dev/null || skip
+command -v gzip &>/dev/null || skip
+
+invoke_bfs basic -compress gzip | gzip -dc >"$OUT"
+sort_output
+diff_output
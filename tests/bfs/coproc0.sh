@@ -0,0 +1 @@
+bfs_diff basic -coproc0 tr '\0' '\n' \;
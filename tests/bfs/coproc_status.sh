@@ -0,0 +1,2 @@
+# A failing coprocess should make bfs exit with a non-zero status
+! invoke_bfs basic -coproc false \;
@@ -0,0 +1 @@
+bfs_diff basic -coproc-test sh -c 'while read -r path; do case "$path" in */[ab]) echo y;; *) echo n;; esac; done' sh \; -print
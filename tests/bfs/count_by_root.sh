@@ -0,0 +1 @@
+bfs_diff basic links -count-by root
@@ -0,0 +1 @@
+bfs_diff basic -type f -count , -name foo -count
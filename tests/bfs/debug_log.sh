@@ -0,0 +1,10 @@
+# The decoded log should match what -D would have printed directly
+invoke_bfs basic -D stat,search -links 1 2>"$TEST/err" >/dev/null || fail
+# Parallel runs may log files in any order, so compare sorted lines
+sed '/^bfs: -D search: bftw({$/,/^})$/d' "$TEST/err" | sort >"$TEST/want"
+
+invoke_bfs basic -D stat,search -links 1 -debug-log "$TEST/log" 2>/dev/null >/dev/null || fail
+invoke_bfs -debug-decode "$TEST/log" >"$TEST/log.txt" || fail
+sort "$TEST/log.txt" >"$TEST/got"
+
+diff "$TEST/want" "$TEST/got" >&$DUPERR || fail
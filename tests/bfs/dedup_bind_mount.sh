@@ -0,0 +1,9 @@
+test "$UNAME" = "Linux" || skip
+
+cd "$TEST"
+"$XTOUCH" -p foo/bar/baz mnt/qux
+
+bfs_sudo mount --bind foo mnt || skip
+defer bfs_sudo umount mnt
+
+bfs_diff -s . -dedup
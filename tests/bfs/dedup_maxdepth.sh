@@ -0,0 +1 @@
+bfs_diff -dedup -maxdepth 1 basic basic/l basic
@@ -0,0 +1 @@
+bfs_diff -dedup basic/l basic basic/k/foo/bar basic/l/foo basic
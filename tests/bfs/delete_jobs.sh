@@ -0,0 +1,5 @@
+# -delete runs in the background with multiple threads
+cd "$TEST"
+"$XTOUCH" -p foo/{1..8}/{1..64} foo/{1..8}/bar/{1..64} foo/{1..8}/bar/baz/qux
+invoke_bfs -j4 foo -delete
+bfs_diff .
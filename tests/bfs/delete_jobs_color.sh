@@ -0,0 +1,6 @@
+# Background -delete errors are formatted the same way as serial ones
+"$XTOUCH" -p "$TEST"/{serial,jobs}/{1..8}/bar/baz
+
+! invoke_bfs -s -j1 "$TEST/serial" -name bar -color -delete 2>"$TEST/serial.err" || fail
+! invoke_bfs -s -j4 "$TEST/jobs" -name bar -color -delete 2>"$TEST/jobs.err" || fail
+sed 's|/serial|/jobs|' "$TEST/serial.err" | cmp -s - "$TEST/jobs.err"
@@ -0,0 +1,6 @@
+# Background -delete errors are reported in the same order as serial ones
+"$XTOUCH" -p "$TEST"/{serial,jobs}/{1..8}/{1..16} "$TEST"/{serial,jobs}/{1..8}/bar/baz
+
+! invoke_bfs -s -j1 "$TEST/serial" -type d -delete 2>"$TEST/serial.err" || fail
+! invoke_bfs -s -j4 "$TEST/jobs" -type d -delete 2>"$TEST/jobs.err" || fail
+sed 's|/serial|/jobs|' "$TEST/serial.err" | cmp -s - "$TEST/jobs.err"
@@ -0,0 +1 @@
+bfs_diff basic -dir-memory 1
@@ -0,0 +1,4 @@
+cd "$TMP"
+invoke_bfs -S bfs basic -du | sort -k2 >"$TEST/bfs"
+du -a -k basic | sort -k2 >"$TEST/du"
+cmp -s "$TEST/bfs" "$TEST/du"
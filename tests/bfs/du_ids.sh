@@ -0,0 +1 @@
+! invoke_bfs basic -S ids -du
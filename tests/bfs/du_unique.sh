@@ -0,0 +1,4 @@
+cd "$TMP"
+invoke_bfs -S bfs links -unique -du | tail -n1 >"$TEST/bfs"
+du -k -s links >"$TEST/du"
+cmp -s "$TEST/bfs" "$TEST/du"
@@ -0,0 +1 @@
+bfs_diff basic -depth -type d -empty
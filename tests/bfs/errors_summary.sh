@@ -0,0 +1,11 @@
+# Loops under the same top-level directory are counted together
+cd "$TEST"
+mkdir -p a/b c
+ln -s x a/x
+ln -s y a/b/y
+ln -s z c/z
+
+stderr=$(invoke_bfs -L . -errors summary 2>&1 >/dev/null) && fail
+[ "$(printf '%s\n' "$stderr" | wc -l)" -eq 2 ] || fail
+[[ "$stderr" == *" errors under ./a:"* ]] || fail
+[[ "$stderr" == *" under ./c:"* ]] || fail
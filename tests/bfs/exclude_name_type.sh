@@ -0,0 +1 @@
+bfs_diff basic -exclude \( -name '[ekl]' -type d -o -depth +2 \)
@@ -0,0 +1,7 @@
+# With -exec-capture, concurrent commands' output comes out whole and in the
+# same order as running them one at a time
+mkdir -p "$TEST"
+cmd=(-exec sh -c 'echo "$1"; echo "$1" >&2; echo "$1"' sh {} \;)
+invoke_bfs -s basic "${cmd[@]}" >"$TEST/serial" 2>&1
+invoke_bfs -s basic -exec-jobs 4 -exec-capture "${cmd[@]}" >"$TEST/capture" 2>&1
+cmp -s "$TEST/serial" "$TEST/capture"
@@ -0,0 +1,3 @@
+# -exec ... \; with an ignored result runs in the background, so failures
+# are reported through the exit status
+! invoke_bfs basic -exec-jobs 4 -exec false \;
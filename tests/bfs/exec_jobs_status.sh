@@ -0,0 +1,2 @@
+# Failures from concurrent -exec ... {} + batches must still be reported
+! bfs_diff basic -exec-jobs 4 -exec false {} + -print
@@ -0,0 +1,19 @@
+# The resolved executable is reused, but looked up again if it goes away
+cd "$TEST"
+mkdir first second
+"$XTOUCH" -p files/a files/b files/c
+
+cat >first/cmd <<'SH'
+#!/bin/sh
+rm -f "$0"
+echo first "$@"
+SH
+
+cat >second/cmd <<'SH'
+#!/bin/sh
+echo second "$@"
+SH
+
+chmod +x first/cmd second/cmd
+
+PATH="$PWD/first:$PWD/second:$PATH" bfs_diff -s files -type f -exec cmd {} \;
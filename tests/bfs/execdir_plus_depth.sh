@@ -0,0 +1,2 @@
+# Post-order traversal interleaves files from different directories
+bfs_diff -j1 -s basic -depth -execdir "$TESTS/sort-args.sh" {} +
@@ -0,0 +1,8 @@
+cd "$TEST"
+"$XTOUCH" -p a.o keep.o a/b/c.o a/b/c.c build/f src/build/g src/main.c deep/x/y/z deep/z sub/q.tmp sub/q.txt
+
+printf '*.o\n/build/\n!keep.o\n# comment\ndeep/**/z\nsub/*.tmp\n' >.gitignore
+printf '!c.o\n' >a/.gitignore
+printf 'main.c\n' >src/.ignore
+
+bfs_diff . -gitignore
@@ -0,0 +1,15 @@
+cd "$TEST"
+
+printf 'hello world\nfoo bar\n' >a
+printf 'no match here' >b
+printf 'xx\nfoo baz' >c
+# Make sure matches that span two reads are found
+head -c 131070 /dev/zero >span
+printf 'needle\n' >>span
+mkdir dir
+ln -s a link
+
+bfs_diff . \
+    \( -grep 'foo ba' -printf '-grep: %p\n' -o -true \) \
+    \( -grep needle -printf '-grep needle: %p\n' -o -true \) \
+    \( -grep-regex '^foo ba[rz]$' -printf '-grep-regex: %p\n' -o -true \)
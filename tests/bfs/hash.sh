@@ -0,0 +1 @@
+bfs_diff basic -hash sha256:bf07a7fbb825fc0aae7bf4a1177b2b31fcf8a3feeaf7092761e18c859ee52a9c
@@ -0,0 +1 @@
+bfs_diff basic -iname 'F*' -o -ipath '*/K/*' -o -iname '*A*R*' -o -iregex 'BASIC/L/.*BAZ'
@@ -0,0 +1,3 @@
+mkdir -p "$TEST"
+invoke_bfs basic -save-index "$TEST/idx" >/dev/null
+! invoke_bfs -index "$TEST/idx" -depth
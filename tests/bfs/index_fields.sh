@@ -0,0 +1,4 @@
+# Tests that need fields the index doesn't have fall back to stat()
+mkdir -p "$TEST"
+invoke_bfs basic -index-fields mode -save-index "$TEST/idx" >/dev/null
+bfs_diff -index "$TEST/idx" -type f -size 0
@@ -0,0 +1 @@
+bfs_diff basic -io-rate 1000 -io-depth 1
@@ -0,0 +1 @@
+bfs_diff -j2 -io-timeout 60 basic
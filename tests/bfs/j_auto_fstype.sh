@@ -0,0 +1 @@
+bfs_diff -jauto,tmpfs=2 basic
@@ -0,0 +1 @@
+bfs_diff -j2,nfs=1,tmpfs=0,ext4=1 basic
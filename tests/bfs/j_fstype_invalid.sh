@@ -0,0 +1 @@
+! invoke_bfs -j2,nfs basic
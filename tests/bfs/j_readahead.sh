@@ -0,0 +1,10 @@
+# A directory big enough to be read in several chunks
+cd "$TEST"
+mkdir big
+i=0
+while [ $i -lt 4000 ]; do
+    echo "big/a_rather_long_file_name_to_fill_up_the_buffer_$i"
+    i=$((i + 1))
+done | xargs "$XTOUCH"
+
+bfs_diff big -j2 -name '*00'
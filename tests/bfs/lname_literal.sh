@@ -0,0 +1,2 @@
+# "filf" has the same length as "file", but "nowher" doesn't match st_size
+bfs_diff links -lname file -o -lname filf -o -lname nowher
@@ -0,0 +1,2 @@
+printf 'foo\nbar\n\n' >"$TEST/names"
+bfs_diff basic -name-from "$TEST/names"
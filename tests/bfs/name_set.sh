@@ -0,0 +1 @@
+bfs_diff basic -name a -o -name 'F*' -o -iname 'BA?' -o -name '*r' -o -iname 'J' -o -type f -name k -o -name l -o -name 'h' -o -name '[cd]'
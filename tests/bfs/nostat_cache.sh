@@ -0,0 +1 @@
+bfs_diff -stat-cache nfs -nostat-cache basic -type f
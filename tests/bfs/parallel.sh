@@ -0,0 +1 @@
+bfs_diff -j4 -parallel basic -type f -print
@@ -0,0 +1,2 @@
+# Digests computed ahead of time must outlive the directory they came from
+bfs_diff -O3 -j8 -parallel basic -hash sha256:bf07a7fbb825fc0aae7bf4a1177b2b31fcf8a3feeaf7092761e18c859ee52a9c
@@ -0,0 +1 @@
+bfs_diff -j4 -parallel basic \( -nouser -o -nogroup -o -type f \) -print
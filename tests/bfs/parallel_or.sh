@@ -0,0 +1 @@
+bfs_diff -j4 -parallel basic \( -name '*f*' -o -type l \) -print
@@ -0,0 +1,4 @@
+# -ordered output must match the serial order exactly, not just after sorting
+invoke_bfs -s basic weirdnames -print >"$TEST/serial"
+invoke_bfs -s -j4 -ordered basic weirdnames -print >"$TEST/ordered"
+cmp -s "$TEST/serial" "$TEST/ordered"
@@ -0,0 +1,2 @@
+# -printf isn't safe to evaluate in parallel, so this is evaluated serially
+bfs_diff -j4 -parallel basic -printf '%p\n'
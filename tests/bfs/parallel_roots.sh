@@ -0,0 +1 @@
+bfs_diff basic/a basic/b basic/c basic/j -parallel-roots
@@ -0,0 +1,2 @@
+printf 'basic/a\0basic/k/foo\0basic/l/foo/\0' >"$TEST/paths"
+bfs_diff basic -path-from "$TEST/paths"
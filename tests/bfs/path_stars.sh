@@ -0,0 +1 @@
+bfs_diff basic -path 'basic/*/f*o/*' -o -ipath '*/K*/*/B*' -o -path '*l**o*'
@@ -1,4 +1,4 @@
-everything=(%{a,b,c,d,D,f,g,G,h,H,i,k,l,m,M,n,p,P,s,S,t,u,U,y,Y})
+everything=(%{a,b,c,d,D,f,g,G,h,H,i,k,l,m,M,n,p,P,s,S,t,u,U,y,Y} %X{b,s,x})
 
 # Check if we have fstypes
 if invoke_bfs basic -printf '%F' -quit >/dev/null; then
@@ -0,0 +1 @@
+bfs_diff basic -printf '%p %Xs\n'
@@ -0,0 +1,11 @@
+cd "$TEST"
+
+mkdir links
+for i in 1 2 3; do
+    ln -s "target$i" "links/short$i"
+done
+ln -s "$(printf 'x%.0s' {1..300})" links/long
+ln -s missing links/broken
+"$XTOUCH" links/file
+
+bfs_diff -j2 links -printf '%p -> %l\n'
@@ -0,0 +1,4 @@
+cd weirdnames
+invoke_bfs . -printjson | sed 's/,"mode".*/}/' >"$OUT"
+sort_output
+diff_output
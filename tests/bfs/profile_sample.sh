@@ -0,0 +1,4 @@
+invoke_bfs basic -save-profile "$TEST/profile" -profile-sample 3 -name '*a*' -type f >/dev/null
+test -s "$TEST/profile" || fail
+
+bfs_diff basic -load-profile "$TEST/profile" -name '*a*' -type f
@@ -0,0 +1 @@
+bfs_diff basic -name '[ekl]' -type d -prune -o -name foo -prune -o -print
@@ -0,0 +1 @@
+bfs_diff basic -regextype posix-extended -regex '.*/a' -o -regex '.*/(f|g)oo?' -o -regex '.*/b(a|)r' -o -regex '.*/[jk]' -o -iregex '.*/BA.' -o -type f -regex '.*/l.*' -o -regex 'basic/(e|c)/(d|f)' -o -regex '.*/(x)\1' -o -regex '.*/[[:digit:]]+'
@@ -0,0 +1,10 @@
+cd "$TEST"
+"${BFS[@]}" -serve sock {DUPOUT}>&- {DUPERR}>&- &
+defer kill $!
+
+while ! test -S sock; do
+	sleep 0.1
+done
+
+cd "$TMP"
+BFS_SERVER="$TEST/sock" bfs_diff basic
@@ -0,0 +1,8 @@
+# Together, the shards find every file exactly once
+mkdir -p "$TEST"
+invoke_bfs basic >"$TEST/all"
+for k in 1 2 3; do
+    invoke_bfs basic -shard $k/3 -shard-depth 2
+done >"$TEST/shards"
+sort "$TEST/all" >"$TEST/all.sorted"
+sort "$TEST/shards" | cmp -s - "$TEST/all.sorted"
@@ -0,0 +1,2 @@
+invoke_bfs -S bfs -s -sort-limit 2 basic >"$OUT"
+diff_output
@@ -0,0 +1 @@
+bfs_diff -stat-cache nfs,ceph basic -size -1
@@ -0,0 +1,2 @@
+# Only the files matching -name will be stat()ed ahead of time
+bfs_diff -j4 basic -name '*o*' -links 1
@@ -0,0 +1,16 @@
+# Runs of stat() comparisons are fused into range checks
+cd "$TEST"
+
+now=$(epoch_time)
+
+"$XTOUCH" -mt "@$((now - 60 * 60 * 49))" old
+"$XTOUCH" -mt "@$((now - 60 * 60))" hour
+"$XTOUCH" -mt "@$((now + 60 * 60 * 24))" tomorrow
+printf '%1500s' "" >big
+
+bfs_diff . -type f \
+    \( -mtime -3 -mmin +1 -size -1 -printf '-mtime -3 -mmin +1 -size -1: %p\n' -o -true \) \
+    \( -size +1k -size -3k -links 1 -printf '-size +1k -size -3k -links 1: %p\n' -o -true \) \
+    \( -mtime -1 -mmin -1 -size -1 -printf '-mtime -1 -mmin -1 -size -1: %p\n' -o -true \) \
+    \( -mtime 0 -mmin +30 -links -2 -printf '-mtime 0 -mmin +30 -links -2: %p\n' -o -true \) \
+    \( -newer hour -size +0 -links +0 -printf '-newer hour -size +0 -links +0: %p\n' -o -true \)
@@ -0,0 +1,2 @@
+invoke_bfs basic -type f -top 3 size >"$OUT"
+diff_output
@@ -0,0 +1 @@
+! invoke_bfs basic -top 1 color
@@ -0,0 +1,2 @@
+invoke_bfs links -type f -top 2 links >"$OUT"
+diff_output
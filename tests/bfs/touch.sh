@@ -0,0 +1,5 @@
+cd "$TEST"
+"$XTOUCH" -p -t "1991-12-14 00:00" foo/bar foo/baz/qux
+
+invoke_bfs . -mindepth 1 -touch
+bfs_diff . -mmin -10
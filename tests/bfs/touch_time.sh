@@ -0,0 +1,5 @@
+cd "$TEST"
+"$XTOUCH" -p foo/bar foo/baz/qux
+
+invoke_bfs . -mindepth 1 -touch-time 1991-12-14T00:00:00Z
+bfs_diff . -mindepth 1 -newermt 1991-12-13T23:59:59Z -not -newermt 1991-12-14T00:00:00Z
@@ -0,0 +1,2 @@
+bfs_diff basic -trace "$TEST/trace.json"
+grep -q '"name":"bftw_visit"' "$TEST/trace.json" || fail
@@ -0,0 +1 @@
+bfs_diff basic -name foo -prune -o -type d -print
@@ -0,0 +1,9 @@
+cd "$TEST"
+"$XTOUCH" -p tree/a/b tree/c/d tree/e/f tree/g
+# Backdate the directories so the changes below always bump their mtimes
+"$XTOUCH" -d "2000-01-01" tree/a tree/c tree/e tree
+invoke_bfs tree -save-index idx >/dev/null
+
+rm tree/a/b
+"$XTOUCH" -p tree/c/h/i tree/j
+bfs_diff -update-index idx
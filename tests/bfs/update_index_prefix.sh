@@ -0,0 +1,14 @@
+# Unchanged directories that share a name prefix with a sibling keep their saved entries
+cd "$TEST"
+for dir in n n1 n1x net netfilter nf nf_tables; do
+	"$XTOUCH" -p "tree/$dir/sub/file"
+	"$XTOUCH" -d "2000-01-01" "tree/$dir/sub" "tree/$dir"
+done
+"$XTOUCH" -p tree/netfilter.h
+"$XTOUCH" -d "2000-01-01" tree
+invoke_bfs tree -save-index idx >/dev/null
+
+# Only tree itself changes, and gets re-read
+"$XTOUCH" tree/new
+invoke_bfs -update-index idx >/dev/null
+bfs_diff -index idx
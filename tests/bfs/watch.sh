@@ -0,0 +1,10 @@
+invoke_bfs . -quit -watch || skip
+
+cd "$TEST"
+mkdir dir
+{
+	sleep 1
+	"$XTOUCH" -p dir/sub/file
+} &
+
+bfs_diff dir -watch -name file -print -quit
@@ -34,6 +34,14 @@ static void check_wordesc(const char *str, const char *exp, enum wesc_flags flag
 	}
 }
 
+/** Check the result of xstrtomode(). */
+static void check_strtomode(const char *str, mode_t file, mode_t dir, mode_t exp_file, mode_t exp_dir) {
+	if (bfs_check(xstrtomode(str, 022, &file, &dir) == 0, "xstrtomode('%s')", str)) {
+		bfs_check(file == exp_file, "xstrtomode('%s') == 0%o (!= 0%o)", str, (unsigned int)file, (unsigned int)exp_file);
+		bfs_check(dir == exp_dir, "xstrtomode('%s') == 0%o (!= 0%o)", str, (unsigned int)dir, (unsigned int)exp_dir);
+	}
+}
+
 void check_bfstd(void) {
 	bfs_check(asciilen("") == 0);
 	bfs_check(asciilen("@") == 1);
@@ -81,6 +89,20 @@ void check_bfstd(void) {
 		check_wordesc("\xCB\x9Cuser", "\xCB\x9Cuser", WESC_SHELL);
 	}
 
+	check_strtomode("644", 0777, 0777, 0644, 0644);
+	check_strtomode("u+x", 0644, 0755, 0744, 0755);
+	check_strtomode("go-w", 0666, 0777, 0644, 0755);
+	check_strtomode("+x", 0600, 0700, 0711, 0711);
+	check_strtomode("a+X", 0644, 0700, 0644, 0711);
+	check_strtomode("a+X", 0744, 0700, 0755, 0711);
+	check_strtomode("g=u", 0640, 0750, 0660, 0770);
+	check_strtomode("a+r,u=wX", 0, 0, 0244, 0344);
+
+	mode_t file = 0, dir = 0;
+	bfs_check(xstrtomode("10000", 022, &file, &dir) != 0);
+	bfs_check(xstrtomode("u+q", 022, &file, &dir) != 0);
+	bfs_check(xstrtomode("", 022, &file, &dir) != 0);
+
 	bfs_check(xstrwidth("Hello world") == 11);
 	bfs_check(xstrwidth("Hello\1world") == 10);
 }
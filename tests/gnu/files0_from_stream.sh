@@ -0,0 +1,7 @@
+# Enough roots to need more than one batch
+FILE="$TMP/$TEST.in"
+for i in $(seq 3000); do
+    printf 'basic/a\0basic/k/foo\0'
+done >"$FILE"
+invoke_bfs -files0-from "$FILE" basic/l/foo | sort | uniq -c | sed "s/^ *//" >"$OUT"
+diff_output
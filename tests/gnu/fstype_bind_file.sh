@@ -0,0 +1,16 @@
+# Files don't always share their parent's file system
+test "$UNAME" = "Linux" || skip
+
+cd "$TEST"
+mkdir tmp
+bfs_sudo mount -t tmpfs tmpfs tmp || skip
+defer bfs_sudo umount -R tmp
+
+"$XTOUCH" tmp/a tmp/b
+mkdir ram
+bfs_sudo mount -t ramfs ramfs ram || skip
+defer bfs_sudo umount ram
+"$XTOUCH" ram/file
+bfs_sudo mount --bind ram/file tmp/b || skip
+
+bfs_diff tmp -printf '%p: %F\n'
@@ -0,0 +1,90 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "tests.h"
+
+#include "alloc.h"
+#include "bfs.h"
+#include "diag.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Hash some data in one go, and format it as hex. */
+static void hash_hex(enum bfs_hash_algo algo, const void *data, size_t size, char *hex) {
+	struct bfs_hasher hasher;
+	bfs_hash_init(&hasher, algo);
+	bfs_hash_update(&hasher, data, size);
+
+	unsigned char digest[BFS_HASH_MAX];
+	bfs_hash_final(&hasher, digest);
+
+	for (size_t i = 0; i < bfs_hash_size(algo); ++i) {
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	}
+}
+
+/** Check a known digest. */
+static void check_digest(const char *name, const void *data, size_t size, const char *expected) {
+	enum bfs_hash_algo algo;
+	bfs_verify(bfs_hash_parse(name, &algo) == 0);
+
+	char hex[2 * BFS_HASH_MAX + 1];
+	hash_hex(algo, data, size, hex);
+	bfs_check(strcmp(hex, expected) == 0, "%s: %s != %s", name, hex, expected);
+}
+
+/** Check that incremental hashing matches hashing everything at once. */
+static void check_incremental(enum bfs_hash_algo algo, const unsigned char *data, size_t size) {
+	unsigned char whole[BFS_HASH_MAX];
+	struct bfs_hasher hasher;
+	bfs_hash_init(&hasher, algo);
+	bfs_hash_update(&hasher, data, size);
+	bfs_hash_final(&hasher, whole);
+
+	// Feed it in awkwardly-sized pieces, crossing every block boundary
+	unsigned char parts[BFS_HASH_MAX];
+	bfs_hash_init(&hasher, algo);
+	for (size_t i = 0, n = 1; i < size; i += n, n = n % 97 + 1) {
+		if (n > size - i) {
+			n = size - i;
+		}
+		bfs_hash_update(&hasher, data + i, n);
+	}
+	bfs_hash_final(&hasher, parts);
+
+	bfs_check(memcmp(whole, parts, bfs_hash_size(algo)) == 0, "%s", bfs_hash_name(algo));
+}
+
+void check_hash(void) {
+	check_digest("blake3", "", 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+	check_digest("blake3", "abc", 3, "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+
+	check_digest("sha256", "", 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	check_digest("sha256", "abc", 3, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+	check_digest("xxh64", "", 0, "ef46db3751d8e999");
+	check_digest("xxh64", "abc", 3, "44bc2cf5ad770999");
+
+	const size_t size = 102400;
+	unsigned char *data = ALLOC_ARRAY(unsigned char, size);
+	bfs_everify(data, "malloc()");
+	for (size_t i = 0; i < size; ++i) {
+		data[i] = i % 251;
+	}
+
+	// From the official BLAKE3 test vectors
+	check_digest("blake3", data, 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7");
+	check_digest("blake3", data, 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444");
+	check_digest("blake3", data, 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085");
+
+	check_digest("sha256", data, size, "74588b7f0bcc354ac14d9cf199fa3a20c05f0c7293b9075b2f2e146e718de800");
+
+	for (int i = 0; i < BFS_HASH_ALGOS; ++i) {
+		check_incremental(i, data, size);
+	}
+
+	free(data);
+}
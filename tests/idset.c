@@ -0,0 +1,122 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "tests.h"
+
+#include "bfs.h"
+#include "diag.h"
+#include "idset.h"
+
+#include <stddef.h>
+
+/** The number of IDs to insert. */
+#define NIDS 10000
+
+/** Make up a file ID, with plenty of collisions in each half. */
+static void make_id(size_t i, dev_t *dev, ino_t *ino) {
+	*dev = i % 3;
+	*ino = i / 3;
+}
+
+void check_idset(void) {
+	struct idset set;
+	idset_init(&set);
+
+	dev_t dev;
+	ino_t ino;
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		bfs_check(!idset_contains(&set, dev, ino));
+		bfs_echeck(idset_insert(&set, dev, ino) == 1);
+		bfs_check(idset_contains(&set, dev, ino));
+	}
+	bfs_check(set.count == NIDS);
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		bfs_check(idset_insert(&set, dev, ino) == 0);
+	}
+	bfs_check(set.count == NIDS);
+
+	// Remove every other ID
+	for (size_t i = 0; i < NIDS; i += 2) {
+		make_id(i, &dev, &ino);
+		idset_remove(&set, dev, ino);
+	}
+	bfs_check(set.count == NIDS / 2);
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		bfs_check(idset_contains(&set, dev, ino) == (i % 2 == 1), "%zu", i);
+	}
+
+	// The ID that marks empty slots is handled specially
+	dev = -1;
+	ino = -1;
+	bfs_check(!idset_contains(&set, dev, ino));
+	bfs_echeck(idset_insert(&set, dev, ino) == 1);
+	bfs_check(idset_contains(&set, dev, ino));
+	bfs_check(idset_insert(&set, dev, ino) == 0);
+	idset_remove(&set, dev, ino);
+	bfs_check(!idset_contains(&set, dev, ino));
+
+	idset_destroy(&set);
+
+	// Counted sets keep IDs until their last reference is dropped
+	idset_init(&set);
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		bfs_echeck(idset_ref(&set, dev, ino) == 0);
+		if (i % 2 == 1) {
+			bfs_echeck(idset_ref(&set, dev, ino) == 0);
+		}
+	}
+	bfs_check(set.count == NIDS);
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		idset_unref(&set, dev, ino);
+	}
+	bfs_check(set.count == NIDS / 2);
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		bfs_check(idset_contains(&set, dev, ino) == (i % 2 == 1), "%zu", i);
+	}
+
+	for (size_t i = 1; i < NIDS; i += 2) {
+		make_id(i, &dev, &ino);
+		idset_unref(&set, dev, ino);
+	}
+	bfs_check(set.count == 0);
+
+	idset_destroy(&set);
+
+	// Filtered sets must agree with the exact set, even across flushes
+	struct idfilter filter;
+	idfilter_init(&filter);
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		bfs_echeck(idfilter_insert(&filter, dev, ino) == 1, "%zu", i);
+		if (i % 7 == 0) {
+			bfs_check(idfilter_insert(&filter, dev, ino) == 0, "%zu", i);
+		}
+	}
+
+	for (size_t i = 0; i < NIDS; ++i) {
+		make_id(i, &dev, &ino);
+		bfs_check(idfilter_insert(&filter, dev, ino) == 0, "%zu", i);
+		bfs_check(idset_contains(&filter.set, dev, ino), "%zu", i);
+	}
+	bfs_check(filter.set.count == NIDS);
+
+	dev = -1;
+	ino = -1;
+	bfs_echeck(idfilter_insert(&filter, dev, ino) == 1);
+	bfs_check(idfilter_insert(&filter, dev, ino) == 0);
+
+	idfilter_destroy(&filter);
+}
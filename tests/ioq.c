@@ -3,10 +3,13 @@
 
 #include "tests.h"
 
+#include "alloc.h"
 #include "diag.h"
 #include "dir.h"
+#include "fsade.h"
 #include "ioq.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 
@@ -31,45 +34,293 @@
  *                                   ...
  *                                   slots[0]: empty → full
  *
- * To reproduce this unlikely scenario, we must fill up the ready queue, then
- * call ioq_cancel() which pushes an additional sentinel IOQ_STOP operation.
+ * To reproduce this unlikely scenario, we must fill up the pending queue, then
+ * call ioq_destroy() which pushes an additional sentinel IOQ_STOP operation.
  */
 static void check_ioq_push_block(void) {
 	// Must be a power of two to fill the entire queue
 	const size_t depth = 2;
 
-	struct ioq *ioq = ioq_create(depth, 1);
+	struct ioq *ioq = ioq_create(depth, 1, 0, NULL, 0);
 	bfs_everify(ioq, "ioq_create()");
 
 	// Push enough operations to fill the queue
 	for (size_t i = 0; i < depth; ++i) {
-		struct bfs_dir *dir = bfs_allocdir();
-		bfs_everify(dir, "bfs_allocdir()");
+		int fd = open(".", O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+		bfs_everify(fd >= 0, "open()");
 
-		int ret = ioq_opendir(ioq, dir, AT_FDCWD, ".", 0, NULL);
-		bfs_everify(ret == 0, "ioq_opendir()");
+		int ret = ioq_close(ioq, fd, NULL);
+		bfs_everify(ret == 0, "ioq_close()");
 	}
 	bfs_verify(ioq_capacity(ioq) == 0);
 
-	// Now cancel the queue, pushing an additional IOQ_STOP message
+	// Now destroy the queue, pushing an additional IOQ_STOP message
+	ioq_destroy(ioq);
+}
+
+/** Test cancellation. */
+static void check_ioq_cancel(void) {
+	struct ioq *ioq = ioq_create(2, 1, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	struct bfs_dir *dir = bfs_allocdir();
+	bfs_everify(dir, "bfs_allocdir()");
+
+	int ret = ioq_opendir(ioq, dir, AT_FDCWD, ".", 0, NULL);
+	bfs_everify(ret == 0, "ioq_opendir()");
+
 	ioq_cancel(ioq);
 
-	// Drain the queue
-	for (size_t i = 0; i < depth; ++i) {
+	// New requests fail, except for closing files
+	ret = ioq_unlink(ioq, AT_FDCWD, "tests/nonexistent", 0, NULL);
+	bfs_check(ret != 0 && errno == EINTR);
+
+	int fd = open(".", O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+	bfs_everify(fd >= 0, "open()");
+	ret = ioq_close(ioq, fd, NULL);
+	bfs_everify(ret == 0, "ioq_close()");
+
+	for (int i = 0; i < 2; ++i) {
 		struct ioq_ent *ent = ioq_pop(ioq, true);
-		bfs_verify(ent && ent->op == IOQ_OPENDIR);
+		bfs_verify(ent);
 
-		if (ent->result >= 0) {
-			bfs_closedir(ent->opendir.dir);
+		if (ent->op == IOQ_OPENDIR) {
+			// Might have finished before the cancellation
+			if (ent->result >= 0) {
+				bfs_closedir(dir);
+			} else {
+				bfs_check(ent->result == -EINTR || ent->result == -ECANCELED);
+			}
+		} else {
+			bfs_check(ent->op == IOQ_CLOSE);
+			bfs_check(ent->result == 0);
 		}
-		free(ent->opendir.dir);
+
 		ioq_free(ioq, ent);
 	}
 	bfs_verify(!ioq_pop(ioq, true));
 
+	free(dir);
+	ioq_destroy(ioq);
+}
+
+/** Test batched completions. */
+static void check_ioq_pop_batch(void) {
+	const size_t depth = 4;
+
+	struct ioq *ioq = ioq_create(depth, 2, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	struct bfs_stat bufs[4];
+	for (size_t i = 0; i < depth; ++i) {
+		int ret = ioq_stat(ioq, AT_FDCWD, ".", BFS_STAT_NOFOLLOW, BFS_STAT_ALL, &bufs[i], NULL);
+		bfs_everify(ret == 0, "ioq_stat()");
+	}
+
+	size_t count = 0;
+	while (count < depth) {
+		struct ioq_ent *batch[IOQ_BATCH];
+		size_t size = ioq_pop_batch(ioq, batch, IOQ_BATCH, true);
+		bfs_verify(size > 0 && count + size <= depth);
+
+		for (size_t i = 0; i < size; ++i) {
+			bfs_check(batch[i]->op == IOQ_STAT);
+			bfs_echeck(batch[i]->result >= 0, "ioq_stat()");
+		}
+
+		ioq_free_batch(ioq, batch, size);
+		count += size;
+	}
+
+	bfs_check(ioq_capacity(ioq) == depth);
+	bfs_check(ioq_pop_batch(ioq, (struct ioq_ent *[1]){0}, 1, true) == 0);
+
+	ioq_destroy(ioq);
+}
+
+/** Test the in-flight limit. */
+static void check_ioq_depth(void) {
+	struct ioq *ioq = ioq_create(16, 1, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	bfs_check(ioq_capacity(ioq) == 16);
+	bfs_check(ioq_set_depth(ioq, 0) == 1);
+	bfs_check(ioq_set_depth(ioq, 64) == 16);
+	bfs_check(ioq_set_depth(ioq, 4) == 4);
+
+	struct bfs_stat bufs[4];
+	for (size_t i = 0; i < countof(bufs); ++i) {
+		int ret = ioq_stat(ioq, AT_FDCWD, ".", BFS_STAT_NOFOLLOW, BFS_STAT_ALL, &bufs[i], NULL);
+		bfs_everify(ret == 0, "ioq_stat()");
+	}
+	bfs_check(ioq_capacity(ioq) == 0);
+
+	// Lowering the limit below the size leaves no capacity
+	ioq_set_depth(ioq, 2);
+	bfs_check(ioq_capacity(ioq) == 0);
+
+	for (size_t i = 0; i < countof(bufs); ++i) {
+		struct ioq_ent *ent = ioq_pop(ioq, true);
+		bfs_verify(ent && ent->op == IOQ_STAT);
+		ioq_free(ioq, ent);
+	}
+	bfs_check(ioq_capacity(ioq) == 2);
+
+	ioq_destroy(ioq);
+}
+
+/** Test asynchronous unlinks. */
+static void check_ioq_unlink(void) {
+	struct ioq *ioq = ioq_create(1, 1, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	int ret = ioq_unlink(ioq, AT_FDCWD, "tests/nonexistent", 0, NULL);
+	bfs_everify(ret == 0, "ioq_unlink()");
+
+	struct ioq_ent *ent = ioq_pop(ioq, true);
+	bfs_verify(ent && ent->op == IOQ_UNLINK);
+	bfs_check(ent->result == -ENOENT);
+	ioq_free(ioq, ent);
+
+	ioq_destroy(ioq);
+}
+
+/** Test asynchronous readlinks. */
+static void check_ioq_readlink(void) {
+	struct ioq *ioq = ioq_create(1, 1, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	char buf[64];
+	int ret = ioq_readlink(ioq, AT_FDCWD, "tests/ioq.c", buf, sizeof(buf), NULL);
+	bfs_everify(ret == 0, "ioq_readlink()");
+
+	struct ioq_ent *ent = ioq_pop(ioq, true);
+	bfs_verify(ent && ent->op == IOQ_READLINK);
+	bfs_check(ent->result == -EINVAL);
+	ioq_free(ioq, ent);
+
+	ioq_destroy(ioq);
+}
+
+/** Test asynchronous fsade checks. */
+static void check_ioq_probe(void) {
+	struct ioq *ioq = ioq_create(1, 1, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	struct bfs_fsade_probe probe = {
+		.name = "user.bfs.nonexistent",
+	};
+	int ret = ioq_probe(ioq, AT_FDCWD, "tests/ioq.c", BFS_UNKNOWN, BFS_STAT_NOFOLLOW, BFS_CHECK_XATTR_NAMED, &probe, NULL);
+	bfs_everify(ret == 0, "ioq_probe()");
+
+	struct ioq_ent *ent = ioq_pop(ioq, true);
+	bfs_verify(ent && ent->op == IOQ_PROBE);
+	bfs_check(ent->result == 0);
+	ioq_free(ioq, ent);
+
+#if BFS_CAN_CHECK_XATTRS
+	bfs_check(probe.checked == BFS_CHECK_XATTR_NAMED);
+#endif
+	bfs_check(probe.found == 0);
+
+	ioq_destroy(ioq);
+}
+
+/** Test requests that could time out, but don't. */
+static void check_ioq_timeout(void) {
+	// Long enough to never fire, even on a loaded machine
+	const uint64_t timeout = 60ULL * 1000 * 1000 * 1000;
+
+	struct ioq *ioq = ioq_create(2, 2, 0, NULL, timeout);
+	bfs_everify(ioq, "ioq_create()");
+
+	struct bfs_dir *dir = bfs_allocdir();
+	bfs_everify(dir, "bfs_allocdir()");
+
+	int ret = ioq_opendir(ioq, dir, AT_FDCWD, ".", 0, NULL);
+	bfs_everify(ret == 0, "ioq_opendir()");
+
+	struct bfs_stat buf;
+	ret = ioq_stat(ioq, AT_FDCWD, "tests/nonexistent", BFS_STAT_NOFOLLOW, BFS_STAT_ALL, &buf, NULL);
+	bfs_everify(ret == 0, "ioq_stat()");
+
+	for (int i = 0; i < 2; ++i) {
+		struct ioq_ent *ent = ioq_pop(ioq, true);
+		bfs_verify(ent);
+
+		if (ent->op == IOQ_OPENDIR) {
+			bfs_echeck(ent->result >= 0, "ioq_opendir()");
+			if (ent->result >= 0) {
+				bfs_closedir(dir);
+			}
+		} else {
+			bfs_check(ent->op == IOQ_STAT);
+			bfs_check(ent->result == -ENOENT);
+		}
+
+		ioq_free(ioq, ent);
+	}
+
+	free(dir);
+	ioq_destroy(ioq);
+}
+
+/**
+ * Stress test for the slot wait/wake paths.
+ *
+ * Many cheap operations are kept in flight across several threads, so that
+ * workers and the main thread frequently block on each other.  Timing
+ * `tests/units ioq` gives a rough measure of the queue's throughput.
+ */
+static void check_ioq_stress(void) {
+	const size_t depth = 64;
+	const size_t nthreads = 8;
+	const size_t total = 1 << 15;
+
+	struct ioq *ioq = ioq_create(depth, nthreads, 0, NULL, 0);
+	bfs_everify(ioq, "ioq_create()");
+
+	struct bfs_stat *bufs = ALLOC_ARRAY(struct bfs_stat, depth);
+	bfs_everify(bufs, "malloc()");
+
+	size_t pushed = 0, popped = 0;
+	size_t next = 0;
+	while (popped < total) {
+		while (pushed < total && ioq_capacity(ioq) > 0) {
+			struct bfs_stat *buf = &bufs[next++ % depth];
+			int ret = ioq_stat(ioq, AT_FDCWD, ".", BFS_STAT_NOFOLLOW, BFS_STAT_ALL, buf, NULL);
+			bfs_everify(ret == 0, "ioq_stat()");
+			++pushed;
+		}
+
+		struct ioq_ent *batch[IOQ_BATCH];
+		size_t size = ioq_pop_batch(ioq, batch, IOQ_BATCH, true);
+		bfs_verify(size > 0);
+
+		for (size_t i = 0; i < size; ++i) {
+			bfs_check(batch[i]->op == IOQ_STAT);
+			bfs_echeck(batch[i]->result >= 0, "ioq_stat()");
+		}
+
+		ioq_free_batch(ioq, batch, size);
+		popped += size;
+	}
+
+	bfs_check(pushed == total && popped == total);
+	bfs_check(ioq_capacity(ioq) == depth);
+
+	free(bufs);
 	ioq_destroy(ioq);
 }
 
 void check_ioq(void) {
 	check_ioq_push_block();
+	check_ioq_cancel();
+	check_ioq_pop_batch();
+	check_ioq_depth();
+	check_ioq_unlink();
+	check_ioq_readlink();
+	check_ioq_probe();
+	check_ioq_timeout();
+	check_ioq_stress();
 }
@@ -124,9 +124,13 @@ int main(int argc, char *argv[]) {
 	run_test(&ctx, "alloc", check_alloc);
 	run_test(&ctx, "bfstd", check_bfstd);
 	run_test(&ctx, "bit", check_bit);
+	run_test(&ctx, "hash", check_hash);
+	run_test(&ctx, "idset", check_idset);
 	run_test(&ctx, "ioq", check_ioq);
 	run_test(&ctx, "list", check_list);
+	run_test(&ctx, "pathmatch", check_pathmatch);
 	run_test(&ctx, "sighook", check_sighook);
+	run_test(&ctx, "top", check_top);
 	run_test(&ctx, "trie", check_trie);
 	run_test(&ctx, "xspawn", check_xspawn);
 	run_test(&ctx, "xtime", check_xtime);
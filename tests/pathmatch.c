@@ -0,0 +1,118 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "tests.h"
+
+#include "bfs.h"
+#include "diag.h"
+#include "pathmatch.h"
+
+#include <fnmatch.h>
+#include <stddef.h>
+#include <string.h>
+
+static const char *const patterns[] = {
+	"*/src/*/*.c",
+	"*/TESTS/**",
+	"a*b*c",
+	"*",
+	"",
+	"exact/path",
+	"*x*y*z*",
+	"*/.*",
+};
+
+static const char *const paths[] = {
+	"",
+	"a/b/c",
+	"abc",
+	"aXbYc",
+	"acb",
+	"./src/bfs/eval.c",
+	"./src/eval.c",
+	"./src/bfs/eval.h",
+	"./tests/bfs/a",
+	"./Tests/x",
+	"exact/path",
+	"exact/path/",
+	"xyz",
+	"zyx/xyz",
+	"./.hidden",
+	"./dir/.git/config",
+};
+
+/** Match a path one component at a time, the way bftw() visits it. */
+static uint64_t advance_components(const struct bfs_pathmatch *pm, const char *path) {
+	uint64_t state = bfs_pathmatch_start(pm);
+
+	char buf[256];
+	const char *start = path;
+	while (true) {
+		const char *slash = strchr(start, '/');
+		size_t len = slash ? (size_t)(slash - start + 1) : strlen(start);
+		memcpy(buf, start, len);
+		buf[len] = '\0';
+		state = bfs_pathmatch_advance(pm, state, buf);
+		if (!slash) {
+			return state;
+		}
+		start = slash + 1;
+	}
+}
+
+static void check_patterns(bool casefold) {
+	struct bfs_pathmatch *pm = bfs_pathmatch_new();
+	bfs_everify(pm, "bfs_pathmatch_new()");
+
+	int ids[countof(patterns)];
+	for (size_t i = 0; i < countof(patterns); ++i) {
+		ids[i] = bfs_pathmatch_add(pm, patterns[i], casefold);
+		bfs_check(ids[i] >= 0, "%s", patterns[i]);
+	}
+
+	bfs_check(bfs_pathmatch_add(pm, "a?c", casefold) < 0);
+	bfs_check(bfs_pathmatch_add(pm, "[ab]*", casefold) < 0);
+
+	int flags = casefold ? FNM_CASEFOLD : 0;
+	for (size_t j = 0; j < countof(paths); ++j) {
+		uint64_t whole = bfs_pathmatch_advance(pm, bfs_pathmatch_start(pm), paths[j]);
+		uint64_t parts = advance_components(pm, paths[j]);
+
+		for (size_t i = 0; i < countof(patterns); ++i) {
+			if (ids[i] < 0) {
+				continue;
+			}
+
+			int expected = fnmatch(patterns[i], paths[j], flags) == 0;
+			int ret = bfs_pathmatch_result(pm, whole, ids[i]);
+			bfs_check(ret == expected, "'%s' ~ '%s': %d != %d", paths[j], patterns[i], ret, expected);
+			ret = bfs_pathmatch_result(pm, parts, ids[i]);
+			bfs_check(ret == expected, "'%s' ~ '%s': %d != %d", paths[j], patterns[i], ret, expected);
+		}
+	}
+
+	bfs_pathmatch_free(pm);
+}
+
+/** Check that case-insensitive patterns give up on non-ASCII strings. */
+static void check_nonascii(void) {
+	struct bfs_pathmatch *pm = bfs_pathmatch_new();
+	bfs_everify(pm, "bfs_pathmatch_new()");
+
+	int sensitive = bfs_pathmatch_add(pm, "*k", false);
+	int insensitive = bfs_pathmatch_add(pm, "*k", true);
+	bfs_verify(sensitive >= 0 && insensitive >= 0);
+
+	uint64_t state = bfs_pathmatch_advance(pm, bfs_pathmatch_start(pm), "\xE2\x84\xAA/");
+	state = bfs_pathmatch_advance(pm, state, "k");
+	bfs_check(bfs_pathmatch_result(pm, state, sensitive) == 1);
+	bfs_check(bfs_pathmatch_result(pm, state, insensitive) == -1);
+
+	bfs_pathmatch_free(pm);
+}
+
+void check_pathmatch(void) {
+	check_patterns(false);
+	check_patterns(true);
+	check_nonascii();
+}
@@ -20,15 +20,27 @@ void check_bfstd(void);
 /** Bit manipulation tests. */
 void check_bit(void);
 
+/** Content hashing tests. */
+void check_hash(void);
+
+/** File ID set tests. */
+void check_idset(void);
+
 /** I/O queue tests. */
 void check_ioq(void);
 
 /** Linked list tests. */
 void check_list(void);
 
+/** Incremental -path matching tests. */
+void check_pathmatch(void);
+
 /** Signal hook tests. */
 void check_sighook(void);
 
+/** Bounded heap tests. */
+void check_top(void);
+
 /** Trie tests. */
 void check_trie(void);
 
@@ -0,0 +1,64 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "tests.h"
+
+#include "bfs.h"
+#include "diag.h"
+#include "top.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** Offer the keys 0, 1, ..., n - 1 in a scrambled order. */
+static void top_fill(struct bfs_top *top, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		// 37 is coprime to every n we use, so this is a permutation
+		size_t j = (37 * i) % n;
+		struct bfs_top_key key = {.value = j};
+
+		char path[32];
+		snprintf(path, sizeof(path), "%zu", j);
+		bfs_everify(bfs_top_add(top, &key, path) == 0);
+	}
+}
+
+/** Check the sorted results of a bounded heap. */
+static void check_top_order(size_t n, size_t keep, bool largest) {
+	struct bfs_top *top = bfs_top_new(keep, largest);
+	bfs_everify(top, "bfs_top_new()");
+	top_fill(top, n);
+
+	size_t count;
+	const struct bfs_top_entry *entries = bfs_top_sort(top, &count);
+	bfs_check(count == (keep < n ? keep : n));
+
+	for (size_t i = 0; i < count; ++i) {
+		intmax_t expected = largest ? (intmax_t)(n - 1 - i) : (intmax_t)i;
+		bfs_check(entries[i].key.value == expected, "%jd != %jd", entries[i].key.value, expected);
+	}
+
+	bfs_top_free(top);
+}
+
+void check_top(void) {
+	check_top_order(100, 10, true);
+	check_top_order(100, 10, false);
+	check_top_order(5, 10, true);
+	check_top_order(1000, 1, false);
+
+	// Ties are broken by path
+	struct bfs_top *top = bfs_top_new(2, true);
+	bfs_everify(top, "bfs_top_new()");
+	struct bfs_top_key key = {.value = 1};
+	bfs_everify(bfs_top_add(top, &key, "c") == 0);
+	bfs_everify(bfs_top_add(top, &key, "b") == 0);
+	bfs_everify(bfs_top_add(top, &key, "a") == 0);
+
+	size_t count;
+	const struct bfs_top_entry *entries = bfs_top_sort(top, &count);
+	bfs_check(count == 2);
+	bfs_check(strcmp(entries[0].path, "a") == 0);
+	bfs_check(strcmp(entries[1].path, "b") == 0);
+	bfs_top_free(top);
+}
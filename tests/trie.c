@@ -82,6 +82,63 @@ void check_trie(void) {
 		bfs_check(i == nkeys);
 	}
 
+	{
+		// Check that a frozen copy finds the same leaves
+		struct trie frozen;
+		trie_init(&frozen);
+		for (size_t i = 0; i < nkeys; ++i) {
+			bfs_verify(trie_insert_str(&frozen, keys[i]));
+		}
+		bfs_check(trie_freeze(&frozen) == 0);
+		bfs_check(frozen.frozen);
+
+		for (size_t i = 0; i < nkeys; ++i) {
+			struct trie_leaf *leaf = trie_find_str(&frozen, keys[i]);
+			bfs_verify(leaf);
+			bfs_check(strcmp(keys[i], leaf->key) == 0);
+
+			bfs_check(trie_find_prefix(&frozen, keys[i]) == leaf);
+
+			struct trie_leaf *postfix = trie_find_postfix(&trie, keys[i]);
+			bfs_verify(postfix);
+			leaf = trie_find_postfix(&frozen, keys[i]);
+			bfs_verify(leaf);
+			bfs_check(strcmp(postfix->key, leaf->key) == 0);
+		}
+
+		bfs_check(!trie_find_str(&frozen, "fo"));
+		bfs_check(!trie_find_str(&frozen, "prefixes"));
+		trie_destroy(&frozen);
+	}
+
+	{
+		// Check that copy-on-write insertion builds the same trie
+		struct trie shared;
+		trie_init(&shared);
+		trie_share(&shared);
+		for (size_t i = 0; i < nkeys; ++i) {
+			struct trie_leaf *leaf = trie_insert_str(&shared, keys[i]);
+			bfs_verify(leaf);
+			trie_set_value(leaf, (void *)keys[i]);
+
+			for (size_t j = 0; j <= i; ++j) {
+				leaf = trie_find_str(&shared, keys[j]);
+				bfs_verify(leaf);
+				bfs_check(trie_get_value(leaf) == keys[j]);
+			}
+		}
+
+		size_t i = 0;
+		for_trie (leaf, &shared) {
+			bfs_check(strcmp(leaf->key, keys[i]) == 0);
+			++i;
+		}
+		bfs_check(i == nkeys);
+
+		bfs_check(!trie_find_str(&shared, "fo"));
+		trie_destroy(&shared);
+	}
+
 	for (size_t i = 0; i < nkeys; ++i) {
 		struct trie_leaf *leaf = trie_find_str(&trie, keys[i]);
 		bfs_verify(leaf);
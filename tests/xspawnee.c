@@ -1,11 +1,18 @@
 // Copyright © Tavian Barnes <tavianator@tavianator.com>
 // SPDX-License-Identifier: 0BSD
 
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 
 /** Child binary for bfs_spawn() tests. */
 int main(int argc, char *argv[]) {
+	// bfs_spawn() blocks signals while it forks, but we shouldn't inherit that
+	sigset_t mask;
+	if (sigprocmask(SIG_BLOCK, NULL, &mask) != 0 || sigismember(&mask, SIGTERM)) {
+		return EXIT_FAILURE;
+	}
+
 	if (argc >= 2) {
 		const char *path = getenv("PATH");
 		if (!path || strcmp(path, argv[1]) != 0) {